@@ -1,908 +1,847 @@
-/*
-*  benchmark.cpp
-*
-*
-*  Created by Marc Modat on 15/11/2009.
-*  Copyright (c) 2009, University College London. All rights reserved.
-*  Centre for Medical Image Computing (CMIC)
-*  See the LICENSE.txt file in the nifty_reg root folder
-*
-*/
-
+/**
+ * @file reg_benchmark.cpp
+ * @author Marc Modat
+ * @date 15/11/2009
+ * @brief Executable that times the main computation kernels of the
+ * registration algorithms on synthetic images
+ *
+ *  Copyright (c) 2009, University College London. All rights reserved.
+ *  Centre for Medical Image Computing (CMIC)
+ *  See the LICENSE.txt file in the nifty_reg root folder
+ *
+ */
+
+#include "_reg_ReadWriteImage.h"
 #include "_reg_resampling.h"
-#include "_reg_affineTransformation.h"
-#include "_reg_bspline.h"
-#include "_reg_bspline_comp.h"
-#include "_reg_mutualinformation.h"
-#include "_reg_ssd.h"
-#include "_reg_tools.h"
+#include "_reg_globalTrans.h"
+#include "_reg_localTrans.h"
+#include "_reg_localTrans_regul.h"
 #include "_reg_blockMatching.h"
-
-#ifdef _USE_CUDA
-#include "_reg_cudaCommon.h"
-#include "_reg_resampling_gpu.h"
-#include "_reg_affineTransformation_gpu.h"
-#include "_reg_bspline_gpu.h"
-#include "_reg_mutualinformation_gpu.h"
-#include "_reg_tools_gpu.h"
-#include "_reg_blockMatching_gpu.h"
-#endif
-
-#ifdef _WINDOWS
-#include <time.h>
-#endif
-
-void Usage(char *);
-
-int main(int argc, char **argv)
+#include "_reg_tools.h"
+#include "_reg_nmi.h"
+#include "_reg_ssd.h"
+#include "_reg_lncc.h"
+#include "_reg_mind.h"
+#include "_reg_f3d.h"
+#include <algorithm>
+#include <vector>
+
+/// @brief Kernels that can be timed
+typedef enum
+{
+   BENCH_RESAMPLE_NEAREST,
+   BENCH_RESAMPLE_LINEAR,
+   BENCH_RESAMPLE_CUBIC,
+   BENCH_SPLINE_DEFORMATION,
+   BENCH_GRADIENT_LINEAR,
+   BENCH_GRADIENT_CUBIC,
+   BENCH_NMI_VALUE,
+   BENCH_NMI_GRADIENT,
+   BENCH_SSD_VALUE,
+   BENCH_SSD_GRADIENT,
+   BENCH_LNCC_VALUE,
+   BENCH_LNCC_GRADIENT,
+   BENCH_MIND_VALUE,
+   BENCH_MIND_GRADIENT,
+   BENCH_BLOCK_MATCHING,
+   BENCH_COMPOSE,
+   BENCH_FLOW_EXPONENTIATION,
+   BENCH_BENDING_ENERGY_VALUE,
+   BENCH_BENDING_ENERGY_GRADIENT,
+   BENCH_F3D_MEASURE_VALUE,
+   BENCH_F3D_MEASURE_VALUE_FUSED,
+   BENCH_F3D_MEASURE_GRADIENT,
+   BENCH_F3D_MEASURE_GRADIENT_FUSED,
+   BENCH_F3D_CONVERGENCE_ADAPTIVE,
+   BENCH_F3D_CONVERGENCE_BRENT,
+   BENCH_NUMBER
+} BENCH_KERNEL;
+
+static const char *benchmarkName[BENCH_NUMBER]=
+{
+   "resample_nearest",
+   "resample_linear",
+   "resample_cubic",
+   "spline_deformation_field",
+   "image_gradient_linear",
+   "image_gradient_cubic",
+   "nmi_value",
+   "nmi_gradient",
+   "ssd_value",
+   "ssd_gradient",
+   "lncc_value",
+   "lncc_gradient",
+   "mind_value",
+   "mind_gradient",
+   "block_matching",
+   "deformation_field_compose",
+   "flow_field_exponentiation",
+   "bending_energy_value",
+   "bending_energy_gradient",
+   "f3d_nmi_value",
+   "f3d_nmi_value_fused",
+   "f3d_nmi_gradient",
+   "f3d_nmi_gradient_fused",
+   "f3d_convergence_adaptive",
+   "f3d_convergence_brent"
+};
+
+typedef struct
 {
-   int dimension = 100;
-   float gridSpacing = 10.0f;
-   unsigned int binning = 68;
-   char *outputFileName = (char *)"benchmark_result.txt";
-   bool runGPU=1;
+   int dim[3];
+   float spacing;
+   int repetition;
+   int threadNumber;
+   unsigned int seed;
+   char *filter;
+   char *jsonFileName;
+   char *csvFileName;
+} PARAM;
+
+/// @brief Expose the similarity measure computations of the f3d class so that
+/// the default and the fused pipelines can be timed on the same transformation
+class reg_f3d_benchmark : public reg_f3d<float>
+{
+public:
+   size_t evaluationNumber;
 
-   for(int i=1; i<argc; i++)
+   reg_f3d_benchmark() : reg_f3d<float>(1, 1)
    {
-      if(strcmp(argv[i], "-help")==0 || strcmp(argv[i], "-Help")==0 ||
-            strcmp(argv[i], "-HELP")==0 || strcmp(argv[i], "-h")==0 ||
-            strcmp(argv[i], "--h")==0 || strcmp(argv[i], "--help")==0)
-      {
-         Usage(argv[0]);
-         return 0;
-      }
-      else if(strcmp(argv[i], "-dim") == 0)
-      {
-         dimension=atoi(argv[++i]);
-      }
-      else if(strcmp(argv[i], "-sp") == 0)
-      {
-         gridSpacing=atof(argv[++i]);
-      }
-      else if(strcmp(argv[i], "-bin") == 0)
-      {
-         binning=atoi(argv[++i]);
-      }
-      else if(strcmp(argv[i], "-o") == 0)
-      {
-         outputFileName=argv[++i];
-      }
-      else if(strcmp(argv[i], "-cpu") == 0)
-      {
-         runGPU=0;
-      }
-      else
-      {
-         fprintf(stderr,"Err:\tParameter %s unknown.\n",argv[i]);
-         Usage(argv[0]);
-         return 1;
-      }
+      this->evaluationNumber=0;
    }
-
-   // The target, source and result images are created
-   int dim_img[8];
-   dim_img[0]=3;
-   dim_img[1]=dimension;
-   dim_img[2]=dimension;
-   dim_img[3]=dimension;
-   dim_img[4]=dim_img[5]=dim_img[6]=dim_img[7]=1;
-   nifti_image *targetImage = nifti_make_new_nim(dim_img, NIFTI_TYPE_FLOAT32, true);
-   nifti_image *sourceImage = nifti_make_new_nim(dim_img, NIFTI_TYPE_FLOAT32, true);
-   nifti_image *resultImage = nifti_make_new_nim(dim_img, NIFTI_TYPE_FLOAT32, true);
-   targetImage->sform_code=0;
-   sourceImage->sform_code=0;
-   resultImage->sform_code=0;
-   int *maskImage = (int *)malloc(targetImage->nvox*sizeof(int));
-
-   // The target and source images are filled with random number
-   float *targetPtr=static_cast<float *>(targetImage->data);
-   float *sourcePtr=static_cast<float *>(sourceImage->data);
-   srand((unsigned)time(0));
-   for(unsigned int i=0; i<targetImage->nvox; ++i)
+   double GetObjectiveFunctionValue()
    {
-      *targetPtr++ = (float)(binning-4)*(float)rand()/(float)RAND_MAX + 2.0f;
-      *sourcePtr++ = (float)(binning-4)*(float)rand()/(float)RAND_MAX + 2.0f;
-      maskImage[i]=i;
+      ++this->evaluationNumber;
+      return reg_f3d<float>::GetObjectiveFunctionValue();
    }
-
-   // Deformation field image is created
-   dim_img[0]=5;
-   dim_img[1]=dimension;
-   dim_img[2]=dimension;
-   dim_img[3]=dimension;
-   dim_img[5]=3;
-   dim_img[4]=dim_img[6]=dim_img[7]=1;
-   nifti_image *deformationFieldImage = nifti_make_new_nim(dim_img, NIFTI_TYPE_FLOAT32, true);
-
-   // Joint histogram creation
-   double *probaJointHistogram=(double *)malloc(binning*(binning+2)*sizeof(double));
-   double *logJointHistogram=(double *)malloc(binning*(binning+2)*sizeof(double));
-
-
-   // A control point image is created
-   dim_img[0]=5;
-   dim_img[1]=(int)floor(targetImage->nx*targetImage->dx/gridSpacing)+4;
-   dim_img[2]=(int)floor(targetImage->ny*targetImage->dy/gridSpacing)+4;
-   dim_img[3]=(int)floor(targetImage->nz*targetImage->dz/gridSpacing)+4;
-   dim_img[5]=3;
-   dim_img[4]=dim_img[6]=dim_img[7]=1;
-   nifti_image *controlPointImage = nifti_make_new_nim(dim_img, NIFTI_TYPE_FLOAT32, true);
-   controlPointImage->cal_min=0;
-   controlPointImage->cal_max=0;
-   controlPointImage->pixdim[0]=1.0f;
-   controlPointImage->pixdim[1]=controlPointImage->dx=gridSpacing;
-   controlPointImage->pixdim[2]=controlPointImage->dy=gridSpacing;
-   controlPointImage->pixdim[3]=controlPointImage->dz=gridSpacing;
-   controlPointImage->pixdim[4]=controlPointImage->dt=1.0f;
-   controlPointImage->pixdim[5]=controlPointImage->du=1.0f;
-   controlPointImage->pixdim[6]=controlPointImage->dv=1.0f;
-   controlPointImage->pixdim[7]=controlPointImage->dw=1.0f;
-   controlPointImage->qform_code=targetImage->qform_code;
-   controlPointImage->sform_code=targetImage->sform_code;
-   float qb, qc, qd, qx, qy, qz, dx, dy, dz, qfac;
-   nifti_mat44_to_quatern( targetImage->qto_xyz, &qb, &qc, &qd, &qx, &qy, &qz, &dx, &dy, &dz, &qfac);
-   controlPointImage->quatern_b=qb;
-   controlPointImage->quatern_c=qc;
-   controlPointImage->quatern_d=qd;
-   controlPointImage->qfac=qfac;
-   controlPointImage->qto_xyz = nifti_quatern_to_mat44(qb, qc, qd, qx, qy, qz,
-                                controlPointImage->dx, controlPointImage->dy, controlPointImage->dz, qfac);
-   float originIndex[3];
-   float originReal[3];
-   originIndex[0] = -1.0f;
-   originIndex[1] = -1.0f;
-   originIndex[2] = -1.0f;
-   reg_mat44_mul(&(controlPointImage->qto_xyz), originIndex, originReal);
-   controlPointImage->qto_xyz.m[0][3] = controlPointImage->qoffset_x = originReal[0];
-   controlPointImage->qto_xyz.m[1][3] = controlPointImage->qoffset_y = originReal[1];
-   controlPointImage->qto_xyz.m[2][3] = controlPointImage->qoffset_z = originReal[2];
-   controlPointImage->qto_ijk = nifti_mat44_inverse(controlPointImage->qto_xyz);
-
-   // Velocity field image
-   nifti_image *velocityFieldImage = nifti_copy_nim_info(controlPointImage);
-   velocityFieldImage->datatype = NIFTI_TYPE_FLOAT32;
-   velocityFieldImage->nbyper = sizeof(float);
-   velocityFieldImage->data = (void *)calloc(velocityFieldImage->nvox, velocityFieldImage->nbyper);
-
-   // Different gradient images
-   nifti_image *resultGradientImage = nifti_copy_nim_info(deformationFieldImage);
-   resultGradientImage->datatype = NIFTI_TYPE_FLOAT32;
-   resultGradientImage->nbyper = sizeof(float);
-   resultGradientImage->data = (void *)calloc(resultGradientImage->nvox, resultGradientImage->nbyper);
-   nifti_image *voxelNMIGradientImage = nifti_copy_nim_info(deformationFieldImage);
-   voxelNMIGradientImage->datatype = NIFTI_TYPE_FLOAT32;
-   voxelNMIGradientImage->nbyper = sizeof(float);
-   voxelNMIGradientImage->data = (void *)calloc(voxelNMIGradientImage->nvox, voxelNMIGradientImage->nbyper);
-   nifti_image *nodeNMIGradientImage = nifti_copy_nim_info(controlPointImage);
-   nodeNMIGradientImage->datatype = NIFTI_TYPE_FLOAT32;
-   nodeNMIGradientImage->nbyper = sizeof(float);
-   nodeNMIGradientImage->data = (void *)calloc(nodeNMIGradientImage->nvox, nodeNMIGradientImage->nbyper);
-
-#ifdef _USE_CUDA
-   float *targetImageArray_d;
-   cudaArray *sourceImageArray_d;
-   int *targetMask_d;
-   float4 *deformationFieldImageArray_d;
-   if(runGPU)
+   double GetBestObjectiveFunctionValue()
    {
-      if(cudaCommon_allocateArrayToDevice<float>(&targetImageArray_d, targetImage->dim)) return 1;
-      if(cudaCommon_transferNiftiToArrayOnDevice<float>(&targetImageArray_d, targetImage)) return 1;
-      if(cudaCommon_allocateArrayToDevice<float>(&sourceImageArray_d, sourceImage->dim)) return 1;
-      if(cudaCommon_transferNiftiToArrayOnDevice<float>(&sourceImageArray_d,sourceImage)) return 1;
-      CUDA_SAFE_CALL(cudaMalloc((void **)&targetMask_d, targetImage->nvox*sizeof(int)));
-      CUDA_SAFE_CALL(cudaMemcpy(targetMask_d, maskImage, targetImage->nvox*sizeof(int), cudaMemcpyHostToDevice));
-      CUDA_SAFE_CALL(cudaMalloc((void **)&deformationFieldImageArray_d, targetImage->nvox*sizeof(float4)));
+      return this->bestWMeasure-this->bestWBE-this->bestWLE-this->bestWJac-this->bestWLand;
    }
-#endif
-
-   time_t start,end;
-   int minutes, seconds, cpuTime, maxIt;
-#ifdef _USE_CUDA
-   int gpuTime
-#endif
-
-   FILE *outputFile;
-   outputFile=fopen(outputFileName, "w");
-
-   /* Functions to be tested
-   	- affine deformation field
-   	- spline deformation field
-   	- linear interpolation
-   	- block matching computation
-   	- spatial gradient computation
-   	- voxel-based NMI gradient computation
-   	- node-based NMI gradient computation
-        - bending-energy computation
-        - bending-energy gradient computation
-
-        - Jacobian-based penalty term computation from CPP
-        - Jacobian-based gradient computation from CPP
-        - Folding correction from CPP
-        - Approximated Jacobian-based penalty term computation from CPP
-        - Approximated Jacobian-based gradient computation from CPP
-        - Approximated Folding correction from CPP
-   */
-
-   // AFFINE DEFORMATION FIELD CREATION
+   void InitialiseFirstLevel(nifti_image *grid)
    {
-      maxIt=500000 / dimension;
-//        maxIt=1;
-      mat44 *affineTransformation = (mat44 *)calloc(1,sizeof(mat44));
-      affineTransformation->m[0][0]=1.0;
-      affineTransformation->m[1][1]=1.0;
-      affineTransformation->m[2][2]=1.0;
-      affineTransformation->m[3][3]=1.0;
-      if(reg_bspline_initialiseControlPointGridWithAffine(affineTransformation, controlPointImage))
-         return 1;
-
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
-      {
-         reg_affine_positionField(   affineTransformation,
-                                     targetImage,
-                                     deformationFieldImage);
-      }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf( "CPU - %i affine deformation field computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i affine deformation field computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
-      {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
-         {
-            reg_affine_positionField_gpu(   affineTransformation,
-                                            targetImage,
-                                            &deformationFieldImageArray_d);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i affine deformation field computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i affine deformation field computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("Affine deformation field ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "Affine deformation field ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
-      }
-#endif
-      printf("Affine deformation done\n\n");
+      this->Initialise();
+      this->currentLevel=0;
+      this->currentReference=this->referencePyramid[0];
+      this->currentFloating=this->floatingPyramid[0];
+      this->currentMask=this->maskPyramid[0];
+      this->AllocateWarped();
+      this->AllocateDeformationField();
+      this->AllocateWarpedGradient();
+      this->InitialiseCurrentLevel();
+      this->AllocateVoxelBasedMeasureGradient();
+      this->AllocateTransformationGradient();
+      this->InitialiseSimilarity();
+      // The displacement of the shared control point grid is used when both
+      // grids have the same dimension
+      if(grid->nvox==this->controlPointGrid->nvox)
+         memcpy(this->controlPointGrid->data, grid->data,
+                grid->nvox*grid->nbyper);
    }
-
-   // SPLINE DEFORMATION FIELD CREATION
-#ifdef _USE_CUDA
-   float4 *controlPointImageArray_d;
-   if(runGPU)
+   /// @brief Similarity measure value as computed by GetObjectiveFunctionValue
+   double GetMeasureValue()
    {
-      if(cudaCommon_allocateArrayToDevice<float4>(&controlPointImageArray_d, controlPointImage->dim)) return 1;
-      if(cudaCommon_transferNiftiToArrayOnDevice<float4>(&controlPointImageArray_d,controlPointImage)) return 1;
+      if(this->CanUseFusedPipeline())
+         return this->ComputeFusedSimilarityMeasure();
+      this->WarpFloatingImage(this->interpolation);
+      return this->ComputeSimilarityMeasure();
    }
-#endif
+   /// @brief Similarity measure gradient as computed by GetObjectiveFunctionGradient
+   void GetMeasureGradient()
    {
-      maxIt=50000 / dimension;
-//        maxIt=1;
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
-      {
-         reg_bspline<float>( controlPointImage,
-                             targetImage,
-                             deformationFieldImage,
-                             maskImage,
-                             0);
-      }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i spline deformation field computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i spline deformation field computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
-      {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
-         {
-            reg_bspline_gpu(controlPointImage,
-                            targetImage,
-                            &controlPointImageArray_d,
-                            &deformationFieldImageArray_d,
-                            &targetMask_d,
-                            targetImage->nvox);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i spline deformation field computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i spline deformation field computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("Spline deformation field ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "Spline deformation field ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
-      }
-#endif
-      printf("Spline deformation done\n\n");
+      if(!this->CanUseFusedPipeline())
+         this->WarpFloatingImage(this->interpolation);
+      this->GetSimilarityMeasureGradient();
    }
+};
 
-   // SCALING-AND-SQUARING APPROACH
-#ifdef _USE_CUDA
-   float4 *velocityFieldImageArray_d;
-   if(runGPU)
-   {
-      if(cudaCommon_allocateArrayToDevice<float4>(&velocityFieldImageArray_d, velocityFieldImage->dim)) return 1;
-      if(cudaCommon_transferNiftiToArrayOnDevice<float4>(&velocityFieldImageArray_d,velocityFieldImage)) return 1;
-   }
+/// @brief Images and objects shared by all the kernels
+typedef struct
+{
+   nifti_image *reference;
+   nifti_image *floating;
+   nifti_image *warped;
+   nifti_image *warpedGradient;
+   nifti_image *voxelBasedGradient;
+   nifti_image *deformationField;
+   nifti_image *composedField;
+   nifti_image *flowField;
+   nifti_image *controlPointGrid;
+   nifti_image *controlPointGradient;
+   int *mask;
+   reg_nmi *nmi;
+   reg_ssd *ssd;
+   reg_lncc *lncc;
+   reg_mind *mind;
+   // The measures rescale their input images, they thus use their own copies
+   nifti_image *measureReference[4];
+   nifti_image *measureFloating[4];
+   bool measureInitialised[4];
+   _reg_blockMatchingParam *blockMatchingParams;
+   // Default and fused pipeline registrations
+   reg_f3d_benchmark *registration[2];
+   // Outcome of the last registration run to convergence
+   double convergenceObjective;
+   size_t convergenceEvaluationNumber;
+} DATA;
+
+/// @brief Timings of one kernel
+typedef struct
+{
+   int kernel;
+   size_t elementNumber;
+   double median;
+   double percentile10;
+   double percentile90;
+   double minimum;
+   double mean;
+} RESULT;
+
+void PetitUsage(char *exec)
+{
+   fprintf(stderr,"Usage:\t%s [OPTIONS].\n",exec);
+   fprintf(stderr,"\tSee the help for more details (-h).\n");
+   return;
+}
+void Usage(char *exec)
+{
+   printf("* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\n");
+   printf("Time the main computation kernels on synthetic images.\n");
+   printf("Usage:\t%s [OPTIONS].\n",exec);
+   printf("* * OPTIONS * *\n");
+   printf("\t-dim <int> <int> <int>\tImage dimension, a last value of 1 defines 2D images [128 128 128]\n");
+   printf("\t-sp <float>\t\tControl point spacing in voxel [5]\n");
+   printf("\t-rep <int>\t\tNumber of timed repetitions per kernel [10]\n");
+   printf("\t-seed <int>\t\tSeed of the random generator used for the synthetic images [0]\n");
+   printf("\t-only <string>\t\tOnly time the kernels whose name contains the string. The\n");
+   printf("\t\t\t\tf3d_convergence kernels, which run a registration to convergence\n");
+   printf("\t\t\t\twith every line search, are only timed when selected this way\n");
+   printf("\t-json <filename>\tSave the timings in a JSON file\n");
+   printf("\t-csv <filename>\t\tSave the timings in a CSV file\n");
+   printf("\t-list\t\t\tPrint the kernel names and exit\n");
+#if defined (_OPENMP)
+   int defaultOpenMPValue=omp_get_num_procs();
+   if(getenv("OMP_NUM_THREADS")!=NULL)
+      defaultOpenMPValue=atoi(getenv("OMP_NUM_THREADS"));
+   printf("\t-omp <int>\t\tNumber of thread to use with OpenMP. [%i/%i]\n",
+          defaultOpenMPValue, omp_get_num_procs());
 #endif
+   printf("\t--version\t\tPrint current version and exit (%s)\n",NR_VERSION);
+   printf("* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\n");
+   return;
+}
+/* *************************************************************** */
+double GetTime()
+{
+#if defined (_OPENMP)
+   return omp_get_wtime();
+#else
+   return (double)clock()/(double)CLOCKS_PER_SEC;
+#endif
+}
+/* *************************************************************** */
+/// @brief Allocate an image with the spatial dimension of the input image
+/// and the specified number of vector components per voxel
+nifti_image *AllocateVectorImage(nifti_image *image, int componentNumber)
+{
+   nifti_image *vectorImage=nifti_copy_nim_info(image);
+   vectorImage->dim[0]=vectorImage->ndim=5;
+   vectorImage->dim[4]=vectorImage->nt=1;
+   vectorImage->dim[5]=vectorImage->nu=componentNumber;
+   nifti_update_dims_from_array(vectorImage);
+   vectorImage->datatype=NIFTI_TYPE_FLOAT32;
+   vectorImage->nbyper=sizeof(float);
+   vectorImage->data=(void *)calloc(vectorImage->nvox,vectorImage->nbyper);
+   return vectorImage;
+}
+/* *************************************************************** */
+/// @brief Fill an image with smooth structures and noise
+void FillSyntheticImage(nifti_image *image, float shift)
+{
+   float *imagePtr=static_cast<float *>(image->data);
+   size_t index=0;
+   for(int z=0; z<image->nz; ++z)
    {
-      maxIt=20000 / dimension;
-//        maxIt=1;
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
-      {
-         reg_spline_scaling_squaring(velocityFieldImage,
-                                     controlPointImage);
-      }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i scaling-and-squaring - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i scaling-and-squarings - %i min %i sec\n", maxIt, minutes, seconds);
-      time(&start);
-#ifdef _USE_CUDA
-      if(runGPU)
+      for(int y=0; y<image->ny; ++y)
       {
-         for(int i=0; i<maxIt; ++i)
+         for(int x=0; x<image->nx; ++x)
          {
-            reg_spline_scaling_squaring_gpu(velocityFieldImage,
-                                            controlPointImage,
-                                            &velocityFieldImageArray_d,
-                                            &controlPointImageArray_d);
+            float position[3]= {(float)x+shift, (float)y, (float)z};
+            float value=100.f;
+            value += 40.f*sinf(position[0]*0.19f)*cosf(position[1]*0.13f);
+            value += 30.f*sinf(position[1]*0.07f+position[2]*0.11f);
+            value += 10.f*(float)rand()/(float)RAND_MAX;
+            imagePtr[index++]=value;
          }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i scaling-and-squaring - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i scaling-and-squarings - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("Scaling-and-squarings ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "Scaling-and-squarings ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
       }
-#endif
-      printf("scaling-and-squarings done\n\n");
    }
-
-   // LINEAR INTERPOLATION
-#ifdef _USE_CUDA
-   float *resultImageArray_d;
-   if(runGPU)
-      if(cudaCommon_allocateArrayToDevice<float>(&resultImageArray_d, targetImage->dim)) return 1;
-#endif
+}
+/* *************************************************************** */
+/// @brief Returns a copy of the input image
+nifti_image *CopyImage(nifti_image *image)
+{
+   nifti_image *copy=nifti_copy_nim_info(image);
+   copy->data=(void *)malloc(copy->nvox*copy->nbyper);
+   memcpy(copy->data, image->data, copy->nvox*copy->nbyper);
+   return copy;
+}
+/* *************************************************************** */
+void InitialiseData(DATA *data, PARAM *param)
+{
+   srand(param->seed);
+   int dim_img[8]= {3, param->dim[0], param->dim[1], param->dim[2], 1, 1, 1, 1};
+   data->reference=nifti_make_new_nim(dim_img, NIFTI_TYPE_FLOAT32, true);
+   // The dimensions above dim[0] are not set by nifti_make_new_nim
+   for(int i=4; i<8; ++i)
+      data->reference->dim[i]=1;
+   nifti_update_dims_from_array(data->reference);
+   // The header is checked as it would be when read from file, the
+   // registration classes require a valid slope and orientation
+   reg_checkAndCorrectDimension(data->reference);
+   data->floating=CopyImage(data->reference);
+   data->warped=CopyImage(data->reference);
+   FillSyntheticImage(data->reference, 0.f);
+   FillSyntheticImage(data->floating, 1.5f);
+   size_t voxelNumber=data->reference->nvox;
+   data->mask=(int *)calloc(voxelNumber,sizeof(int));
+   int dim=data->reference->nz>1?3:2;
+
+   // The control point grid is initialised with a smooth random displacement
+   float spacing[3]= {param->spacing, param->spacing, param->spacing};
+   reg_createControlPointGrid<float>(&data->controlPointGrid, data->reference, spacing);
+   mat44 identity;
+   reg_mat44_eye(&identity);
+   reg_affine_getDeformationField(&identity, data->controlPointGrid);
+   float *cppPtr=static_cast<float *>(data->controlPointGrid->data);
+   for(size_t i=0; i<data->controlPointGrid->nvox; ++i)
+      cppPtr[i] += 2.f*param->spacing*((float)rand()/(float)RAND_MAX-0.5f);
+   data->controlPointGradient=nifti_copy_nim_info(data->controlPointGrid);
+   data->controlPointGradient->data=(void *)calloc(data->controlPointGradient->nvox,
+                                                   data->controlPointGradient->nbyper);
+
+   data->deformationField=AllocateVectorImage(data->reference, dim);
+   data->composedField=AllocateVectorImage(data->reference, dim);
+   data->deformationField->intent_code=NIFTI_INTENT_VECTOR;
+   memset(data->deformationField->intent_name, 0, 16);
+   strcpy(data->deformationField->intent_name,"NREG_TRANS");
+   data->deformationField->intent_p1=DEF_FIELD;
+   reg_spline_getDeformationField(data->controlPointGrid, data->deformationField,
+                                  data->mask, false, true);
+   // The flow field uses the deformation field as a stationary velocity field
+   data->flowField=CopyImage(data->deformationField);
+   data->flowField->intent_p1=DEF_VEL_FIELD;
+   reg_resampleImage(data->floating, data->warped, data->deformationField,
+                     data->mask, 1, std::numeric_limits<float>::quiet_NaN());
+   data->warpedGradient=AllocateVectorImage(data->reference, dim);
+   data->voxelBasedGradient=AllocateVectorImage(data->reference, dim);
+   reg_getImageGradient(data->floating, data->warpedGradient, data->deformationField,
+                        data->mask, 1, std::numeric_limits<float>::quiet_NaN(), 0);
+
+   data->nmi=NULL;
+   data->ssd=NULL;
+   data->lncc=NULL;
+   data->mind=NULL;
+   for(int m=0; m<4; ++m)
    {
-      maxIt=100000 / dimension;
-//        maxIt=1;
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
-      {
-         reg_resampleSourceImage<float>( targetImage,
-                                         sourceImage,
-                                         resultImage,
-                                         deformationFieldImage,
-                                         maskImage,
-                                         1,
-                                         0);
-      }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i linear interpolation computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i linear interpolation computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
-      {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
-         {
-            reg_resampleSourceImage_gpu(resultImage,
-                                        sourceImage,
-                                        &resultImageArray_d,
-                                        &sourceImageArray_d,
-                                        &deformationFieldImageArray_d,
-                                        &targetMask_d,
-                                        targetImage->nvox,
-                                        0);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i linear interpolation computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i linear interpolation computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("Linear interpolation ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "Linear interpolation ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
-      }
-#endif
-      printf("Linear interpolation done\n\n");
+      data->measureReference[m]=CopyImage(data->reference);
+      data->measureFloating[m]=CopyImage(data->floating);
+      data->measureInitialised[m]=false;
    }
-
-   // SPATIAL GRADIENT COMPUTATION
-#ifdef _USE_CUDA
-   float4 *resultGradientArray_d;
-   CUDA_SAFE_CALL(cudaMalloc((void **)&resultGradientArray_d, targetImage->nvox*sizeof(float4)));
-#endif
+   data->blockMatchingParams=NULL;
+   data->registration[0]=data->registration[1]=NULL;
+   data->convergenceObjective=0.;
+   data->convergenceEvaluationNumber=0;
+}
+/* *************************************************************** */
+void FreeData(DATA *data)
+{
+   if(data->nmi!=NULL) delete data->nmi;
+   if(data->ssd!=NULL) delete data->ssd;
+   if(data->lncc!=NULL) delete data->lncc;
+   if(data->mind!=NULL) delete data->mind;
+   if(data->blockMatchingParams!=NULL) delete data->blockMatchingParams;
+   for(int r=0; r<2; ++r)
+      if(data->registration[r]!=NULL) delete data->registration[r];
+   for(int m=0; m<4; ++m)
    {
-      maxIt=100000 / dimension;
-//        maxIt=1;
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
-      {
-         reg_getSourceImageGradient<float>(  targetImage,
-                                             sourceImage,
-                                             resultGradientImage,
-                                             deformationFieldImage,
-                                             maskImage,
-                                             1);
-      }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i spatial gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i spatial gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
-      {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
-         {
-            reg_getSourceImageGradient_gpu( targetImage,
-                                            sourceImage,
-                                            &sourceImageArray_d,
-                                            &deformationFieldImageArray_d,
-                                            &resultGradientArray_d,
-                                            targetImage->nvox);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i spatial gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i spatial gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("Spatial gradient ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "Spatial gradient ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
-         cudaCommon_free( &sourceImageArray_d );
-      }
-#endif
-      printf("Spatial gradient done\n\n");
+      nifti_image_free(data->measureReference[m]);
+      nifti_image_free(data->measureFloating[m]);
    }
-   nifti_image_free(sourceImage);
-
-#ifdef _USE_CUDA
-   if(runGPU)
+   nifti_image_free(data->reference);
+   nifti_image_free(data->floating);
+   nifti_image_free(data->warped);
+   nifti_image_free(data->warpedGradient);
+   nifti_image_free(data->voxelBasedGradient);
+   nifti_image_free(data->deformationField);
+   nifti_image_free(data->composedField);
+   nifti_image_free(data->flowField);
+   nifti_image_free(data->controlPointGrid);
+   nifti_image_free(data->controlPointGradient);
+   free(data->mask);
+}
+/* *************************************************************** */
+/// @brief Initialise a measure of similarity object with its own copies of
+/// the reference and floating images
+template <class MEASURE>
+void InitialiseMeasure(MEASURE *measure, DATA *data, int measureIndex)
+{
+   if(data->measureInitialised[measureIndex]) return;
+   measure->SetTimepointWeight(0, 1.0);
+   measure->InitialiseMeasure(data->measureReference[measureIndex],
+                              data->measureFloating[measureIndex],
+                              data->mask,
+                              data->warped,
+                              data->warpedGradient,
+                              data->voxelBasedGradient,
+                              NULL);
+   data->measureInitialised[measureIndex]=true;
+}
+/* *************************************************************** */
+/// @brief Initialise a single level registration using either the default or
+/// the fused pipeline
+void InitialiseRegistration(DATA *data, bool fused)
+{
+   int index=fused?1:0;
+   if(data->registration[index]!=NULL) return;
+   reg_f3d_benchmark *registration=new reg_f3d_benchmark();
+   registration->SetReferenceImage(data->reference);
+   registration->SetFloatingImage(data->floating);
+   registration->SetLevelNumber(1);
+   registration->SetLevelToPerform(1);
+   for(unsigned int i=0; i<3; ++i)
+      registration->SetSpacing(i, data->controlPointGrid->pixdim[i+1]);
+   registration->DoNotPrintOutInformation();
+   if(fused) registration->UseFusedPipeline();
+   registration->InitialiseFirstLevel(data->controlPointGrid);
+   data->registration[index]=registration;
+}
+/* *************************************************************** */
+/// @brief Run a single level registration to convergence from the identity
+/// using the specified line search
+void RunRegistration(DATA *data, int lineSearchType)
+{
+   reg_f3d_benchmark *registration=new reg_f3d_benchmark();
+   registration->SetReferenceImage(data->reference);
+   registration->SetFloatingImage(data->floating);
+   registration->SetLevelNumber(1);
+   registration->SetLevelToPerform(1);
+   registration->SetMaximalIterationNumber(1000);
+   for(unsigned int i=0; i<3; ++i)
+      registration->SetSpacing(i, data->controlPointGrid->pixdim[i+1]);
+   registration->DoNotPrintOutInformation();
+   registration->SetLineSearchType(lineSearchType);
+   registration->Run();
+   data->convergenceObjective=registration->GetBestObjectiveFunctionValue();
+   data->convergenceEvaluationNumber=registration->evaluationNumber;
+   delete registration;
+}
+/* *************************************************************** */
+/// @brief Prepare what is required by a kernel, this step is not timed
+void PrepareKernel(int kernel, DATA *data)
+{
+   reg_measure *measure=NULL;
+   int measureIndex=-1;
+   switch(kernel)
    {
-      cudaCommon_free( (void **)&deformationFieldImageArray_d );
+   case BENCH_NMI_VALUE:
+   case BENCH_NMI_GRADIENT:
+      if(data->nmi==NULL) data->nmi=new reg_nmi();
+      measure=data->nmi;
+      measureIndex=0;
+      InitialiseMeasure(data->nmi, data, measureIndex);
+      break;
+   case BENCH_SSD_VALUE:
+   case BENCH_SSD_GRADIENT:
+      if(data->ssd==NULL) data->ssd=new reg_ssd();
+      measure=data->ssd;
+      measureIndex=1;
+      InitialiseMeasure(data->ssd, data, measureIndex);
+      break;
+   case BENCH_LNCC_VALUE:
+   case BENCH_LNCC_GRADIENT:
+      if(data->lncc==NULL) data->lncc=new reg_lncc();
+      measure=data->lncc;
+      measureIndex=2;
+      InitialiseMeasure(data->lncc, data, measureIndex);
+      break;
+   case BENCH_MIND_VALUE:
+   case BENCH_MIND_GRADIENT:
+      if(data->mind==NULL) data->mind=new reg_mind();
+      measure=data->mind;
+      measureIndex=3;
+      InitialiseMeasure(data->mind, data, measureIndex);
+      break;
+   case BENCH_BLOCK_MATCHING:
+      if(data->blockMatchingParams==NULL)
+      {
+         data->blockMatchingParams=new _reg_blockMatchingParam();
+         initialise_block_matching_method(data->reference, data->blockMatchingParams,
+                                          50, 50, 1, data->mask);
+      }
+      reg_resampleImage(data->floating, data->warped, data->deformationField,
+                        data->mask, 1, std::numeric_limits<float>::quiet_NaN());
+      break;
+   case BENCH_COMPOSE:
+      memcpy(data->composedField->data, data->deformationField->data,
+             data->composedField->nvox*data->composedField->nbyper);
+      break;
+   case BENCH_FLOW_EXPONENTIATION:
+      // The flow field is scaled in place by the exponentiation
+      memcpy(data->flowField->data, data->deformationField->data,
+             data->flowField->nvox*data->flowField->nbyper);
+      data->flowField->intent_p2=6;
+      break;
+   case BENCH_F3D_MEASURE_VALUE:
+   case BENCH_F3D_MEASURE_VALUE_FUSED:
+      InitialiseRegistration(data, kernel==BENCH_F3D_MEASURE_VALUE_FUSED);
+      break;
+   case BENCH_F3D_MEASURE_GRADIENT:
+      // The default gradient relies on the statistics of a previous value
+      // computation, as after the line search of an optimisation step
+      InitialiseRegistration(data, false);
+      data->registration[0]->GetMeasureValue();
+      break;
+   case BENCH_F3D_MEASURE_GRADIENT_FUSED:
+      InitialiseRegistration(data, true);
+      break;
    }
-#endif
-
-   // JOINT HISTOGRAM COMPUTATION
-   double entropies[4];
+   if(measure!=NULL)
    {
-      reg_getEntropies<double>(   targetImage,
-                                  resultImage,
-                                  2,
-                                  &binning,
-                                  &binning,
-                                  probaJointHistogram,
-                                  logJointHistogram,
-                                  entropies,
-                                  maskImage);
+      // The warped image is generated from the rescaled floating image
+      reg_resampleImage(data->measureFloating[measureIndex], data->warped, data->deformationField,
+                        data->mask, 1, std::numeric_limits<float>::quiet_NaN());
+      memset(data->voxelBasedGradient->data, 0,
+             data->voxelBasedGradient->nvox*data->voxelBasedGradient->nbyper);
+      // The gradients require the statistics of the measure value
+      if(kernel==BENCH_NMI_GRADIENT || kernel==BENCH_MIND_GRADIENT)
+         measure->GetSimilarityMeasureValue();
    }
-
-   // VOXEL-BASED NMI GRADIENT COMPUTATION
-#ifdef _USE_CUDA
-   float4 *voxelNMIGradientArray_d;
-   if(runGPU)
+}
+/* *************************************************************** */
+/// @brief Run a kernel once and return the number of processed elements
+size_t RunKernel(int kernel, DATA *data)
+{
+   size_t voxelNumber=(size_t)data->reference->nx*data->reference->ny*data->reference->nz;
+   float padding=std::numeric_limits<float>::quiet_NaN();
+   switch(kernel)
    {
-      if(cudaCommon_allocateArrayToDevice(&voxelNMIGradientArray_d, resultImage->dim)) return 1;
+   case BENCH_RESAMPLE_NEAREST:
+      reg_resampleImage(data->floating, data->warped, data->deformationField,
+                        data->mask, 0, padding);
+      break;
+   case BENCH_RESAMPLE_LINEAR:
+      reg_resampleImage(data->floating, data->warped, data->deformationField,
+                        data->mask, 1, padding);
+      break;
+   case BENCH_RESAMPLE_CUBIC:
+      reg_resampleImage(data->floating, data->warped, data->deformationField,
+                        data->mask, 3, padding);
+      break;
+   case BENCH_SPLINE_DEFORMATION:
+      reg_spline_getDeformationField(data->controlPointGrid, data->deformationField,
+                                     data->mask, false, true);
+      break;
+   case BENCH_GRADIENT_LINEAR:
+      reg_getImageGradient(data->floating, data->warpedGradient, data->deformationField,
+                           data->mask, 1, padding, 0);
+      break;
+   case BENCH_GRADIENT_CUBIC:
+      reg_getImageGradient(data->floating, data->warpedGradient, data->deformationField,
+                           data->mask, 3, padding, 0);
+      break;
+   case BENCH_NMI_VALUE:
+      data->nmi->GetSimilarityMeasureValue();
+      break;
+   case BENCH_NMI_GRADIENT:
+      data->nmi->GetVoxelBasedSimilarityMeasureGradient(0);
+      break;
+   case BENCH_SSD_VALUE:
+      data->ssd->GetSimilarityMeasureValue();
+      break;
+   case BENCH_SSD_GRADIENT:
+      data->ssd->GetVoxelBasedSimilarityMeasureGradient(0);
+      break;
+   case BENCH_LNCC_VALUE:
+      data->lncc->GetSimilarityMeasureValue();
+      break;
+   case BENCH_LNCC_GRADIENT:
+      data->lncc->GetVoxelBasedSimilarityMeasureGradient(0);
+      break;
+   case BENCH_MIND_VALUE:
+      data->mind->GetSimilarityMeasureValue();
+      break;
+   case BENCH_MIND_GRADIENT:
+      data->mind->GetVoxelBasedSimilarityMeasureGradient(0);
+      break;
+   case BENCH_BLOCK_MATCHING:
+      block_matching_method(data->reference, data->warped,
+                            data->blockMatchingParams, data->mask);
+      break;
+   case BENCH_COMPOSE:
+      reg_defField_compose(data->deformationField, data->composedField, data->mask);
+      break;
+   case BENCH_FLOW_EXPONENTIATION:
+      reg_defField_getDeformationFieldFromFlowField(data->flowField, data->composedField, false);
+      break;
+   case BENCH_BENDING_ENERGY_VALUE:
+      reg_spline_approxBendingEnergy(data->controlPointGrid);
+      return (size_t)data->controlPointGrid->nx*data->controlPointGrid->ny*
+            data->controlPointGrid->nz;
+   case BENCH_BENDING_ENERGY_GRADIENT:
+      reg_spline_approxBendingEnergyGradient(data->controlPointGrid,
+                                             data->controlPointGradient,
+                                             1.f);
+      return (size_t)data->controlPointGrid->nx*data->controlPointGrid->ny*
+            data->controlPointGrid->nz;
+   case BENCH_F3D_MEASURE_VALUE:
+   case BENCH_F3D_MEASURE_VALUE_FUSED:
+      data->registration[kernel==BENCH_F3D_MEASURE_VALUE_FUSED?1:0]->GetMeasureValue();
+      break;
+   case BENCH_F3D_MEASURE_GRADIENT:
+   case BENCH_F3D_MEASURE_GRADIENT_FUSED:
+      data->registration[kernel==BENCH_F3D_MEASURE_GRADIENT_FUSED?1:0]->GetMeasureGradient();
+      break;
+   case BENCH_F3D_CONVERGENCE_ADAPTIVE:
+   case BENCH_F3D_CONVERGENCE_BRENT:
+      RunRegistration(data, kernel==BENCH_F3D_CONVERGENCE_BRENT?BRENT_LINE_SEARCH:
+                      ADAPTIVE_LINE_SEARCH);
+      break;
    }
-#endif
+   return voxelNumber;
+}
+/* *************************************************************** */
+/// @brief Returns the value of a sorted array at the specified percentile,
+/// using a linear interpolation between the closest ranks
+double GetPercentile(std::vector<double> &sortedValues, double percentile)
+{
+   double position=percentile/100.0*(double)(sortedValues.size()-1);
+   size_t lower=(size_t)floor(position);
+   size_t upper=lower+1<sortedValues.size()?lower+1:lower;
+   double ratio=position-(double)lower;
+   return (1.0-ratio)*sortedValues[lower]+ratio*sortedValues[upper];
+}
+/* *************************************************************** */
+RESULT TimeKernel(int kernel, DATA *data, int repetition)
+{
+   RESULT result;
+   result.kernel=kernel;
+   std::vector<double> timings;
+   // A first run, which is not timed, allocates and warms up the caches
+   PrepareKernel(kernel, data);
+   result.elementNumber=RunKernel(kernel, data);
+   for(int r=0; r<repetition; ++r)
    {
-      maxIt=100000 / dimension;
-//        maxIt=1;
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
-      {
-         reg_getVoxelBasedNMIGradientUsingPW<double>(targetImage,
-               resultImage,
-               2,
-               resultGradientImage,
-               &binning,
-               &binning,
-               logJointHistogram,
-               entropies,
-               voxelNMIGradientImage,
-               maskImage);
-      }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i voxel-based NMI gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i voxel-based NMI gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      float *logJointHistogram_d;
-      if(runGPU)
-      {
-         CUDA_SAFE_CALL(cudaMalloc((void **)&logJointHistogram_d, binning*(binning+2)*sizeof(float)));
-         float *tempB=(float *)malloc(binning*(binning+2)*sizeof(float));
-         for(int i=0; i<binning*(binning+2); i++)
-         {
-            tempB[i]=(float)logJointHistogram[i];
-         }
-         CUDA_SAFE_CALL(cudaMemcpy(logJointHistogram_d, tempB, binning*(binning+2)*sizeof(float), cudaMemcpyHostToDevice));
-         free(tempB);
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
-         {
-            reg_getVoxelBasedNMIGradientUsingPW_gpu(targetImage,
-                                                    resultImage,
-                                                    &targetImageArray_d,
-                                                    &resultImageArray_d,
-                                                    &resultGradientArray_d,
-                                                    &logJointHistogram_d,
-                                                    &voxelNMIGradientArray_d,
-                                                    &targetMask_d,
-                                                    targetImage->nvox,
-                                                    entropies,
-                                                    binning);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i voxel-based NMI gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i voxel-based NMI gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("Voxel-based NMI gradient ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "Voxel-based NMI gradient ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
-         cudaCommon_free((void **)&logJointHistogram_d);
-      }
-      CUDA_SAFE_CALL(cudaFree(targetMask_d));
-#endif
-      printf("Voxel-based NMI gradient done\n\n");
+      PrepareKernel(kernel, data);
+      double start=GetTime();
+      RunKernel(kernel, data);
+      timings.push_back(GetTime()-start);
    }
-
-#ifdef _USE_CUDA
-   if(runGPU)
+   std::sort(timings.begin(), timings.end());
+   result.median=GetPercentile(timings, 50.0);
+   result.percentile10=GetPercentile(timings, 10.0);
+   result.percentile90=GetPercentile(timings, 90.0);
+   result.minimum=timings[0];
+   result.mean=0;
+   for(size_t i=0; i<timings.size(); ++i)
+      result.mean += timings[i];
+   result.mean /= (double)timings.size();
+   return result;
+}
+/* *************************************************************** */
+void SaveJSON(char *fileName, PARAM *param, std::vector<RESULT> &results)
+{
+   FILE *outputFile=fopen(fileName, "w");
+   if(outputFile==NULL)
    {
-      cudaCommon_free((void **)&resultGradientArray_d);
+      reg_print_fct_error("SaveJSON");
+      reg_print_msg_error("The JSON file can not be created:");
+      reg_print_msg_error(fileName);
+      reg_exit();
    }
-#endif
-
-   // NODE-BASED NMI GRADIENT COMPUTATION
-#ifdef _USE_CUDA
-   float4 *nodeNMIGradientArray_d;
-   if(runGPU)
+   fprintf(outputFile, "{\n");
+   fprintf(outputFile, "  \"version\": \"%s\",\n", NR_VERSION);
+   fprintf(outputFile, "  \"dim\": [%i, %i, %i],\n", param->dim[0], param->dim[1], param->dim[2]);
+   fprintf(outputFile, "  \"spacing\": %g,\n", param->spacing);
+   fprintf(outputFile, "  \"threads\": %i,\n", param->threadNumber);
+   fprintf(outputFile, "  \"repetitions\": %i,\n", param->repetition);
+   fprintf(outputFile, "  \"kernels\": [\n");
+   for(size_t i=0; i<results.size(); ++i)
    {
-      if(cudaCommon_allocateArrayToDevice(&nodeNMIGradientArray_d, controlPointImage->dim)) return 1;
+      RESULT &r=results[i];
+      fprintf(outputFile, "    {\"name\": \"%s\", \"elements\": %lu, \"median_s\": %.9g, "
+              "\"p10_s\": %.9g, \"p90_s\": %.9g, \"min_s\": %.9g, \"mean_s\": %.9g, "
+              "\"elements_per_s\": %.9g}%s\n",
+              benchmarkName[r.kernel], (unsigned long)r.elementNumber, r.median,
+              r.percentile10, r.percentile90, r.minimum, r.mean,
+              (double)r.elementNumber/r.median, i+1<results.size()?",":"");
    }
-#endif
+   fprintf(outputFile, "  ]\n");
+   fprintf(outputFile, "}\n");
+   fclose(outputFile);
+}
+/* *************************************************************** */
+void SaveCSV(char *fileName, PARAM *param, std::vector<RESULT> &results)
+{
+   FILE *outputFile=fopen(fileName, "w");
+   if(outputFile==NULL)
    {
-      maxIt=10000 / dimension;
-//        maxIt=1;
-      int smoothingRadius[3];
-      smoothingRadius[0] = (int)floor( 2.0*controlPointImage->dx/targetImage->dx );
-      smoothingRadius[1] = (int)floor( 2.0*controlPointImage->dy/targetImage->dy );
-      smoothingRadius[2] = (int)floor( 2.0*controlPointImage->dz/targetImage->dz );
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
-      {
-         reg_smoothImageForCubicSpline<float>(voxelNMIGradientImage,smoothingRadius);
-         reg_voxelCentric2NodeCentric(nodeNMIGradientImage,voxelNMIGradientImage,1.0f);
-      }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i node-based NMI gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i node-based NMI gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
-      {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
-         {
-            reg_smoothImageForCubicSpline_gpu(  resultImage,
-                                                &voxelNMIGradientArray_d,
-                                                smoothingRadius);
-            reg_voxelCentric2NodeCentric_gpu(   targetImage,
-                                                controlPointImage,
-                                                &voxelNMIGradientArray_d,
-                                                &nodeNMIGradientArray_d,
-                                                1.0f);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i node-based NMI gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i node-based NMI gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("Node-based NMI gradient ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "Node-based NMI gradient ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
-      }
-#endif
-      printf("Node-based NMI gradient done\n\n");
+      reg_print_fct_error("SaveCSV");
+      reg_print_msg_error("The CSV file can not be created:");
+      reg_print_msg_error(fileName);
+      reg_exit();
    }
-
-#ifdef _USE_CUDA
-   if(runGPU)
+   fprintf(outputFile, "name,nx,ny,nz,threads,repetitions,elements,median_s,p10_s,p90_s,min_s,mean_s,elements_per_s\n");
+   for(size_t i=0; i<results.size(); ++i)
    {
-      cudaCommon_free((void **)&voxelNMIGradientArray_d);
-      cudaCommon_free((void **)&nodeNMIGradientArray_d);
+      RESULT &r=results[i];
+      fprintf(outputFile, "%s,%i,%i,%i,%i,%i,%lu,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n",
+              benchmarkName[r.kernel], param->dim[0], param->dim[1], param->dim[2],
+              param->threadNumber, param->repetition, (unsigned long)r.elementNumber,
+              r.median, r.percentile10, r.percentile90, r.minimum, r.mean,
+              (double)r.elementNumber/r.median);
    }
+   fclose(outputFile);
+}
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   PARAM *param = (PARAM *)calloc(1,sizeof(PARAM));
+   param->dim[0]=param->dim[1]=param->dim[2]=128;
+   param->spacing=5.f;
+   param->repetition=10;
+   param->threadNumber=1;
+
+#if defined (_OPENMP)
+   // Set the default number of thread
+   int defaultOpenMPValue=omp_get_num_procs();
+   if(getenv("OMP_NUM_THREADS")!=NULL)
+      defaultOpenMPValue=atoi(getenv("OMP_NUM_THREADS"));
+   omp_set_num_threads(defaultOpenMPValue);
 #endif
 
-   // APPROXIMATED BENDING ENERGY PENALTY TERM COMPUTATION
+   /* read the input parameter */
+   for(int i=1; i<argc; i++)
    {
-      maxIt=100000 / dimension;
-//        maxIt=1;
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
+      if(strcmp(argv[i],"-h")==0 ||
+            strcmp(argv[i],"-H")==0 ||
+            strcmp(argv[i],"-help")==0 ||
+            strcmp(argv[i],"--help")==0 ||
+            strcmp(argv[i],"-HELP")==0 ||
+            strcmp(argv[i],"--HELP")==0 ||
+            strcmp(argv[i],"-Help")==0 ||
+            strcmp(argv[i],"--Help")==0
+        )
       {
-         reg_bspline_bendingEnergy<float>(controlPointImage, targetImage,1);
+         Usage(argv[0]);
+         return EXIT_SUCCESS;
       }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i BE computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i BE computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
+      else if(strcmp(argv[i], "-omp")==0 || strcmp(argv[i], "--omp")==0)
       {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
-         {
-            reg_bspline_ApproxBendingEnergy_gpu(controlPointImage,
-                                                &controlPointImageArray_d);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i BE computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i BE computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("BE  ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "BE  ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
-      }
+#if defined (_OPENMP)
+         omp_set_num_threads(atoi(argv[++i]));
+#else
+         reg_print_msg_warn("NiftyReg has not been compiled with OpenMP, the \'-omp\' flag is ignored");
+         ++i;
 #endif
-      printf("BE done\n\n");
-   }
-
-   // APPROXIMATED BENDING ENERGY GRADIENT COMPUTATION
-   {
-      maxIt=1000000 / dimension;
-//        maxIt=1;
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
+      }
+      else if( strcmp(argv[i], "-version")==0 ||
+            strcmp(argv[i], "-Version")==0 ||
+            strcmp(argv[i], "-V")==0 ||
+            strcmp(argv[i], "-v")==0 ||
+            strcmp(argv[i], "--v")==0 ||
+            strcmp(argv[i], "--version")==0)
       {
-         reg_bspline_bendingEnergyGradient<float>(   controlPointImage,
-               targetImage,
-               nodeNMIGradientImage,
-               0.01f);
+         printf("%s\n",NR_VERSION);
+         return EXIT_SUCCESS;
       }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i BE gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i BE gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
+      else if(strcmp(argv[i], "-list")==0)
       {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
-         {
-            reg_bspline_ApproxBendingEnergyGradient_gpu(targetImage,
-                  controlPointImage,
-                  &controlPointImageArray_d,
-                  &nodeNMIGradientArray_d,
-                  0.01f);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i BE gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i BE gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("BE gradient ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "BE gradient ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
+         for(int k=0; k<BENCH_NUMBER; ++k)
+            printf("%s\n", benchmarkName[k]);
+         return EXIT_SUCCESS;
       }
-#endif
-      printf("BE gradient done\n\n");
-   }
-
-   // JACOBIAN DETERMINANT PENALTY TERM COMPUTATION
-   {
-      maxIt=10000 / dimension;
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
+      else if(strcmp(argv[i], "-dim")==0 && i+3<argc)
       {
-         reg_bspline_jacobian<float>(controlPointImage,targetImage,0);
+         param->dim[0]=atoi(argv[++i]);
+         param->dim[1]=atoi(argv[++i]);
+         param->dim[2]=atoi(argv[++i]);
       }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i |Jac| penalty term computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i |Jac| penalty term computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
+      else if(strcmp(argv[i], "-sp")==0)
       {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
-         {
-            reg_bspline_ComputeJacobianPenaltyTerm_gpu(targetImage,controlPointImage,&controlPointImageArray_d,0);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i |Jac| penalty term computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i |Jac| penalty term computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("|Jac| penalty term ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "|Jac| penalty term ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
+         param->spacing=(float)atof(argv[++i]);
       }
-#endif
-      printf("|Jac| penalty term done\n\n");
-   }
-
-   // APPROXIMATED JACOBIAN DETERMINANT PENALTY TERM COMPUTATION
-   {
-      maxIt=1000000 / dimension;
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
+      else if(strcmp(argv[i], "-rep")==0)
       {
-         reg_bspline_jacobian<float>(controlPointImage,targetImage,1);
+         param->repetition=atoi(argv[++i]);
       }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i Approx. |Jac| penalty term computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i Approx. |Jac| penalty term computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
+      else if(strcmp(argv[i], "-seed")==0)
       {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
-         {
-            reg_bspline_ComputeJacobianPenaltyTerm_gpu(targetImage,controlPointImage,&controlPointImageArray_d,1);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i Approx. |Jac| penalty term computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i Approx. |Jac| penalty term computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("Approx. |Jac| penalty term ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "Approx. |Jac| penalty term ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
+         param->seed=(unsigned int)atoi(argv[++i]);
       }
-#endif
-      printf("Approx. |Jac| penalty term done\n\n");
-   }
-
-#ifdef _USE_CUDA
-   if(runGPU)
-   {
-      cudaCommon_free( (void **)&controlPointImageArray_d );
-   }
-#endif
-
-   // BLOCK MATCHING
-   {
-      maxIt=2000 / dimension;
-//        maxIt=1;
-      _reg_blockMatchingParam blockMatchingParams;
-      initialise_block_matching_method(   targetImage,
-                                          &blockMatchingParams,
-                                          100,    // percentage of block kept
-                                          50,     // percentage of inlier in the optimisation process
-                                          maskImage);
-#ifdef _USE_CUDA
-      int *activeBlock_d;
-      float *targetPosition_d;
-      float *resultPosition_d;
-      if(runGPU)
+      else if(strcmp(argv[i], "-only")==0)
       {
-         CUDA_SAFE_CALL(cudaMalloc((void **)&activeBlock_d,
-                                   blockMatchingParams.blockNumber[0]*blockMatchingParams.blockNumber[1]*blockMatchingParams.blockNumber[2]*sizeof(int)));
-         CUDA_SAFE_CALL(cudaMemcpy(activeBlock_d, blockMatchingParams.activeBlock,
-                                   blockMatchingParams.blockNumber[0]*blockMatchingParams.blockNumber[1]*blockMatchingParams.blockNumber[2]*sizeof(int),
-                                   cudaMemcpyHostToDevice));
-         CUDA_SAFE_CALL(cudaMalloc((void **)&targetPosition_d, blockMatchingParams.activeBlockNumber*3*sizeof(float)));
-         CUDA_SAFE_CALL(cudaMalloc((void **)&resultPosition_d, blockMatchingParams.activeBlockNumber*3*sizeof(float)));
+         param->filter=argv[++i];
       }
-#endif
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
+      else if(strcmp(argv[i], "-json")==0)
       {
-         block_matching_method<float>(   targetImage,
-                                         resultImage,
-                                         &blockMatchingParams,
-                                         maskImage);
+         param->jsonFileName=argv[++i];
       }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i block matching computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i block matching computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
+      else if(strcmp(argv[i], "-csv")==0)
       {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
-         {
-            block_matching_method_gpu(  targetImage,
-                                        resultImage,
-                                        &blockMatchingParams,
-                                        &targetImageArray_d,
-                                        &resultImageArray_d,
-                                        &targetPosition_d,
-                                        &resultPosition_d,
-                                        &activeBlock_d);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i block matching computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i block matching computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("Block-Matching ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "Block-Matching ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
-         cudaCommon_free((void **)&targetPosition_d);
-         cudaCommon_free((void **)&resultPosition_d);
-         cudaCommon_free((void **)&activeBlock_d);
+         param->csvFileName=argv[++i];
+      }
+      else
+      {
+         reg_print_msg_error("Parameter unknown:");
+         reg_print_msg_error(argv[i]);
+         PetitUsage(argv[0]);
+         return EXIT_FAILURE;
       }
-#endif
-      printf("Block-matching done\n");
    }
+   if(param->dim[0]<4 || param->dim[1]<4 || param->dim[2]<1 ||
+         param->repetition<1 || param->spacing<=0)
+   {
+      reg_print_msg_error("Invalid image dimension, spacing or number of repetitions");
+      PetitUsage(argv[0]);
+      return EXIT_FAILURE;
+   }
+#if defined (_OPENMP)
+   param->threadNumber=omp_get_max_threads();
+#endif
 
-   fclose(outputFile);
-
-   /* Monsieur Propre */
-   nifti_image_free(targetImage);
-   nifti_image_free(resultImage);
-   nifti_image_free(controlPointImage);
-   nifti_image_free(deformationFieldImage);
-   nifti_image_free(resultGradientImage);
-   nifti_image_free(voxelNMIGradientImage);
-   nifti_image_free(nodeNMIGradientImage);
-   free(maskImage);
-   free(probaJointHistogram);
-   free(logJointHistogram);
+   DATA data;
+   InitialiseData(&data, param);
+   printf("[NiftyReg BENCHMARK] Image dimension %ix%ix%i - %i thread(s) - %i repetition(s)\n",
+          param->dim[0], param->dim[1], param->dim[2], param->threadNumber, param->repetition);
+   printf("%-28s %12s %12s %12s %14s\n", "kernel", "median (ms)", "p10 (ms)",
+          "p90 (ms)", "elements/s");
 
-#ifdef _USE_CUDA
-   if(runGPU)
+   std::vector<RESULT> results;
+   for(int k=0; k<BENCH_NUMBER; ++k)
    {
-      cudaCommon_free( (void **)&targetImageArray_d );
-      cudaCommon_free( (void **)&resultImageArray_d );
+      bool convergenceKernel=k>=BENCH_F3D_CONVERGENCE_ADAPTIVE && k<=BENCH_F3D_CONVERGENCE_BRENT;
+      if(param->filter==NULL && convergenceKernel)
+         continue;
+      if(param->filter!=NULL && strstr(benchmarkName[k], param->filter)==NULL)
+         continue;
+      RESULT result=TimeKernel(k, &data, param->repetition);
+      printf("%-28s %12.4f %12.4f %12.4f %14.4g\n", benchmarkName[k],
+             1000.0*result.median, 1000.0*result.percentile10,
+             1000.0*result.percentile90, (double)result.elementNumber/result.median);
+      // The registrations are deterministic, the final objective function
+      // value and the number of evaluations are those of every run
+      if(convergenceKernel)
+         printf("%-28s objective %.7g after %lu evaluation(s)\n", "",
+                data.convergenceObjective, (unsigned long)data.convergenceEvaluationNumber);
+      results.push_back(result);
    }
-#endif
 
-   return 0;
-}
+   if(param->jsonFileName!=NULL)
+      SaveJSON(param->jsonFileName, param, results);
+   if(param->csvFileName!=NULL)
+      SaveCSV(param->csvFileName, param, results);
 
-void Usage(char *exec)
-{
-   printf("* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\n");
-   printf("Usage:\t%s [OPTIONS].\n",exec);
-   printf("\t-dim <int>\tImage dimension [100]\n");
-   printf("\t-bin <int>\tBin number [68]\n");
-   printf("\t-sp <float>\tControl point grid spacing [10]\n");
-   printf("\t-o <char*>\t Output file name [benchmark_result.txt]\n");
-   printf("\t-cpu\t\t Run only the CPU function\n");
-   printf("* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\n");
-   return;
+   FreeData(&data);
+   free(param);
+   return EXIT_SUCCESS;
 }
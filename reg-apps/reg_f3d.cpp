@@ -95,6 +95,8 @@ void Usage(char *exec)
    reg_print_info(exec, "\t-fbn <tp> <int>\t\tNMI. Number of bin to use for the floating image histogram for the specified time point");
    reg_print_info(exec, "\t--lncc <float>\t\tLNCC. Standard deviation of the Gaussian kernel. Identical value for every timepoint");
    reg_print_info(exec, "\t-lncc <tp> <float>\tLNCC. Standard deviation of the Gaussian kernel for the specified timepoint");
+   reg_print_info(exec, "\t-lnccMean\t\tLNCC. A mean kernel, whose half-width is the specified value, is used instead of the Gaussian kernel");
+   reg_print_info(exec, "\t-lnccBox\t\tLNCC. The Gaussian kernel is approximated by iterated box filters");
    reg_print_info(exec, "\t--ssd \t\t\tSSD. Used for all time points - images are normalized between 0 and 1 before computing the measure");
    reg_print_info(exec, "\t-ssd <tp> \t\tSSD. Used for the specified timepoint - images are normalized between 0 and 1 before computing the measure");
    reg_print_info(exec, "\t--ssdn \t\t\tSSD. Used for all time points - images are NOT normalized between 0 and 1 before computing the measure");
@@ -124,6 +126,8 @@ void Usage(char *exec)
    reg_print_info(exec, "\t-nopy\t\t\tDo not use a pyramidal approach");
    reg_print_info(exec, "\t-noConj\t\t\tTo not use the conjuage gradient optimisation but a simple gradient ascent");
    reg_print_info(exec, "\t-pert <int>\t\tTo add perturbation step(s) after each optimisation scheme");
+   reg_print_info(exec, "\t-lineSearch <int>\tLine search strategy: 0=adaptive, 1=Brent [0]");
+   reg_print_info(exec, "\t-fused\t\t\tCompute the NMI/SSD measure and its gradient brick by brick without full size intermediate images");
    reg_print_info(exec, "");
    reg_print_info(exec, "*** F3D2 options:");
    reg_print_info(exec, "\t-vel \t\t\tUse a velocity field integration to generate the deformation");
@@ -325,7 +329,7 @@ int main(int argc, char **argv)
    nifti_image *refLocalWeightSim=NULL;
    char *outputWarpedImageName=NULL;
    char *outputCPPImageName=NULL;
-   bool useMeanLNCC=false;
+   int lnccKernelType=-1;
    int refBinNumber=0;
    int floBinNumber=0;
 
@@ -660,7 +664,11 @@ int main(int argc, char **argv)
       }
       else if(strcmp(argv[i], "-lnccMean")==0)
       {
-         useMeanLNCC=true;
+         lnccKernelType=MEAN_KERNEL;
+      }
+      else if(strcmp(argv[i], "-lnccBox")==0)
+      {
+         lnccKernelType=ITERATED_BOX_KERNEL;
       }
       else if(strcmp(argv[i], "-dti")==0 || strcmp(argv[i], "--dti")==0)
       {
@@ -724,6 +732,14 @@ int main(int argc, char **argv)
       {
          REG->UseApproximatedGradient();
       }
+      else if(strcmp(argv[i], "-fused")==0 || strcmp(argv[i], "--fused")==0)
+      {
+         REG->UseFusedPipeline();
+      }
+      else if(strcmp(argv[i], "-lineSearch")==0 || strcmp(argv[i], "--lineSearch")==0)
+      {
+         REG->SetLineSearchType(atoi(argv[++i]));
+      }
       else if(strcmp(argv[i], "-interp")==0 || strcmp(argv[i], "--interp")==0)
       {
          int interp=atoi(argv[++i]);
@@ -810,8 +826,8 @@ int main(int argc, char **argv)
          return EXIT_FAILURE;
       }
    }
-   if(useMeanLNCC)
-      REG->SetLNCCKernelType(2);
+   if(lnccKernelType>=0)
+      REG->SetLNCCKernelType(lnccKernelType);
 
 #ifndef NDEBUG
    reg_print_msg_debug("*******************************************");
@@ -0,0 +1,296 @@
+/**
+ * @file reg_groupwise.cpp
+ * @brief Executable used to create a population template by groupwise
+ * registration
+ *
+ * Copyright (c) 2009, University College London. All rights reserved.
+ * Centre for Medical Image Computing (CMIC)
+ * See the LICENSE.txt file in the nifty_reg root folder
+ *
+ */
+
+#include "_reg_ReadWriteImage.h"
+#include "_reg_groupwise.h"
+
+#ifdef _WINDOWS
+#include <time.h>
+#endif
+
+#define PrecisionTYPE float
+
+void PetitUsage(char *exec)
+{
+   reg_print_msg_error("");
+   reg_print_msg_error("reg_groupwise");
+   char text[255];
+   sprintf(text, "Usage:\t%s -in <n> <img1> ... <imgN> -res <outputTemplate> [OPTIONS]",exec);
+   reg_print_msg_error(text);
+   reg_print_msg_error("\tSee the help for more details (-h).");
+   return;
+}
+void Usage(char *exec)
+{
+   char text[255];
+   reg_print_info(exec, "* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *");
+   reg_print_info(exec, "Groupwise registration used to create a population template.");
+   reg_print_info(exec, "All the input images are registered to the template, which is then replaced");
+   reg_print_info(exec, "by the average of the resampled images. The affine iterations are followed");
+   reg_print_info(exec, "by the non-rigid ones. The first affine iteration is rigid and the mean");
+   reg_print_info(exec, "transformation is removed before averaging, except for the last iteration");
+   reg_print_info(exec, "of each stage.");
+   reg_print_info(exec, "* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *");
+   reg_print_info(exec, "Usage:");
+   sprintf(text, "\t%s -in <n> <img1> ... <imgN> -res <outputTemplate> [OPTIONS]", exec);
+   reg_print_info(exec, text);
+   reg_print_info(exec, "\t-in <n> <filenames>\tThe n input images (mandatory)");
+   reg_print_info(exec, "\t-res <filename>\t\tFilename of the final template (mandatory)");
+   reg_print_info(exec, "");
+   reg_print_info(exec, "*** Input options:");
+   reg_print_info(exec, "\t-template <filename>\tInitial template [first input image]");
+   reg_print_info(exec, "\t-tmask <filename>\tMask defined in the template space");
+   reg_print_info(exec, "\t-fmask <n> <filenames>\tOne mask per input image, used by the symmetric affine");
+   reg_print_info(exec, "\t-out <folder>\t\tExisting folder where every iteration is saved. A new run");
+   reg_print_info(exec, "\t\t\t\tresumes from the iterations found in the folder");
+   reg_print_info(exec, "");
+   reg_print_info(exec, "*** Groupwise options:");
+   reg_print_info(exec, "\t-affIt <int>\t\tNumber of affine iterations [5]");
+   reg_print_info(exec, "\t-nrrIt <int>\t\tNumber of non-rigid iterations [10]");
+   reg_print_info(exec, "\t-par <int>\t\tNumber of registrations performed concurrently [1]");
+   reg_print_info(exec, "");
+   reg_print_info(exec, "*** Affine options:");
+   reg_print_info(exec, "\t-noSym\t\t\tUse the non-symmetric affine registration");
+   reg_print_info(exec, "\t-aln <int>\t\tNumber of levels [3]");
+   reg_print_info(exec, "\t-amaxit <int>\t\tMaximal number of iterations per level [5]");
+   reg_print_info(exec, "");
+   reg_print_info(exec, "*** Non-rigid options:");
+   reg_print_info(exec, "\t-nln <int>\t\tNumber of levels [3]");
+   reg_print_info(exec, "\t-nmaxit <int>\t\tMaximal number of iterations per level [150]");
+   reg_print_info(exec, "\t-sx <float>\t\tFinal grid spacing along all axes, in mm if positive, in voxel if negative [-5]");
+   reg_print_info(exec, "\t-be <float>\t\tWeight of the bending energy penalty term [0.001]");
+   reg_print_info(exec, "\t-le <float>\t\tWeight of the linear elasticity penalty term [0.01]");
+   reg_print_info(exec, "\t-lncc <float>\t\tUse the LNCC with the specified standard deviation instead of the NMI");
+#if defined (_OPENMP)
+   reg_print_info(exec, "");
+   reg_print_info(exec, "*** OpenMP-related options:");
+   int defaultOpenMPValue=omp_get_num_procs();
+   if(getenv("OMP_NUM_THREADS")!=NULL)
+      defaultOpenMPValue=atoi(getenv("OMP_NUM_THREADS"));
+   sprintf(text,"\t-omp <int>\t\tNumber of thread to use with OpenMP. [%i/%i]",
+           defaultOpenMPValue, omp_get_num_procs());
+   reg_print_info(exec, text);
+   reg_print_info(exec, "\t-ompReg <int>\t\tNumber of thread used by every registration [omp/par]");
+#endif
+   reg_print_info(exec, "");
+   reg_print_info(exec, "*** Other options:");
+   reg_print_info(exec, "\t-voff\t\t\tTo turn verbose off");
+   reg_print_info(exec, "* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *");
+   return;
+}
+
+int main(int argc, char **argv)
+{
+   if(argc==1)
+   {
+      PetitUsage(argv[0]);
+      return EXIT_FAILURE;
+   }
+   time_t start;
+   time(&start);
+
+#if defined (_OPENMP)
+   // Set the default number of thread
+   int defaultOpenMPValue=omp_get_num_procs();
+   if(getenv("OMP_NUM_THREADS")!=NULL)
+      defaultOpenMPValue=atoi(getenv("OMP_NUM_THREADS"));
+   omp_set_num_threads(defaultOpenMPValue);
+#endif
+
+   size_t inputImageNumber=0;
+   char **inputImageName=NULL;
+   size_t inputMaskNumber=0;
+   char **inputMaskName=NULL;
+   char *templateImageName=NULL;
+   char *templateMaskName=NULL;
+   char *outputTemplateName=NULL;
+   char *outputFolder=NULL;
+   bool verbose=true;
+
+   reg_groupwise<PrecisionTYPE> *GROUPWISE=new reg_groupwise<PrecisionTYPE>;
+
+   for(int i=1; i<argc; ++i)
+   {
+      if(strcmp(argv[i], "-h")==0 || strcmp(argv[i], "-H")==0 ||
+            strcmp(argv[i], "-help")==0 || strcmp(argv[i], "--help")==0 ||
+            strcmp(argv[i], "-HELP")==0 || strcmp(argv[i], "--HELP")==0 ||
+            strcmp(argv[i], "-Help")==0 || strcmp(argv[i], "--Help")==0)
+      {
+         Usage(argv[0]);
+         delete GROUPWISE;
+         return EXIT_SUCCESS;
+      }
+      else if(strcmp(argv[i], "-in")==0 && i+1<argc)
+      {
+         inputImageNumber=atoi(argv[++i]);
+         if(i+(int)inputImageNumber>=argc)
+         {
+            reg_print_msg_error("The number of input images does not match the -in option");
+            delete GROUPWISE;
+            return EXIT_FAILURE;
+         }
+         inputImageName=&argv[i+1];
+         i+=inputImageNumber;
+      }
+      else if(strcmp(argv[i], "-fmask")==0 && i+1<argc)
+      {
+         inputMaskNumber=atoi(argv[++i]);
+         if(i+(int)inputMaskNumber>=argc)
+         {
+            reg_print_msg_error("The number of masks does not match the -fmask option");
+            delete GROUPWISE;
+            return EXIT_FAILURE;
+         }
+         inputMaskName=&argv[i+1];
+         i+=inputMaskNumber;
+      }
+      else if(strcmp(argv[i], "-template")==0 && i+1<argc)
+         templateImageName=argv[++i];
+      else if(strcmp(argv[i], "-tmask")==0 && i+1<argc)
+         templateMaskName=argv[++i];
+      else if(strcmp(argv[i], "-res")==0 && i+1<argc)
+         outputTemplateName=argv[++i];
+      else if(strcmp(argv[i], "-out")==0 && i+1<argc)
+         outputFolder=argv[++i];
+      else if(strcmp(argv[i], "-affIt")==0 && i+1<argc)
+         GROUPWISE->SetAffineIterationNumber(atoi(argv[++i]));
+      else if(strcmp(argv[i], "-nrrIt")==0 && i+1<argc)
+         GROUPWISE->SetNonRigidIterationNumber(atoi(argv[++i]));
+      else if(strcmp(argv[i], "-par")==0 && i+1<argc)
+         GROUPWISE->SetConcurrentRegistrationNumber(atoi(argv[++i]));
+      else if(strcmp(argv[i], "-noSym")==0)
+         GROUPWISE->DoNotUseSymmetricAffine();
+      else if(strcmp(argv[i], "-aln")==0 && i+1<argc)
+         GROUPWISE->SetAffineLevelNumber(atoi(argv[++i]));
+      else if(strcmp(argv[i], "-amaxit")==0 && i+1<argc)
+         GROUPWISE->SetAffineMaxIterationNumber(atoi(argv[++i]));
+      else if(strcmp(argv[i], "-nln")==0 && i+1<argc)
+         GROUPWISE->SetNonRigidLevelNumber(atoi(argv[++i]));
+      else if(strcmp(argv[i], "-nmaxit")==0 && i+1<argc)
+         GROUPWISE->SetNonRigidMaxIterationNumber(atoi(argv[++i]));
+      else if(strcmp(argv[i], "-sx")==0 && i+1<argc)
+         GROUPWISE->SetSpacing(atof(argv[++i]));
+      else if(strcmp(argv[i], "-be")==0 && i+1<argc)
+         GROUPWISE->SetBendingEnergyWeight(atof(argv[++i]));
+      else if(strcmp(argv[i], "-le")==0 && i+1<argc)
+         GROUPWISE->SetLinearEnergyWeight(atof(argv[++i]));
+      else if(strcmp(argv[i], "-lncc")==0 && i+1<argc)
+         GROUPWISE->UseLNCC(atof(argv[++i]));
+      else if(strcmp(argv[i], "-voff")==0)
+      {
+         verbose=false;
+         GROUPWISE->DoNotPrintOutInformation();
+      }
+      else if((strcmp(argv[i], "-omp")==0 || strcmp(argv[i], "--omp")==0) && i+1<argc)
+      {
+#if defined (_OPENMP)
+         omp_set_num_threads(atoi(argv[++i]));
+#else
+         reg_print_msg_warn("NiftyReg has not been compiled with OpenMP, the \'-omp\' flag is ignored");
+         ++i;
+#endif
+      }
+      else if(strcmp(argv[i], "-ompReg")==0 && i+1<argc)
+      {
+#if defined (_OPENMP)
+         GROUPWISE->SetThreadNumberPerRegistration(atoi(argv[++i]));
+#else
+         reg_print_msg_warn("NiftyReg has not been compiled with OpenMP, the \'-ompReg\' flag is ignored");
+         ++i;
+#endif
+      }
+      else
+      {
+         char text[2048];
+         sprintf(text,"Unknown or incomplete parameter: %s",argv[i]);
+         reg_print_msg_error(text);
+         PetitUsage(argv[0]);
+         delete GROUPWISE;
+         return EXIT_FAILURE;
+      }
+   }
+
+   if(inputImageNumber<2 || outputTemplateName==NULL)
+   {
+      reg_print_msg_error("At least two input images and the output template name are required");
+      PetitUsage(argv[0]);
+      delete GROUPWISE;
+      return EXIT_FAILURE;
+   }
+   if(inputMaskName!=NULL && inputMaskNumber!=inputImageNumber)
+   {
+      reg_print_msg_error("The number of masks and input images differ");
+      delete GROUPWISE;
+      return EXIT_FAILURE;
+   }
+
+   // The first input image is used as initial template by default
+   if(templateImageName==NULL)
+      templateImageName=inputImageName[0];
+   nifti_image *templateImage=reg_io_ReadImageFile(templateImageName);
+   if(templateImage==NULL)
+   {
+      reg_print_msg_error("Error when reading the template image:");
+      reg_print_msg_error(templateImageName);
+      delete GROUPWISE;
+      return EXIT_FAILURE;
+   }
+   reg_checkAndCorrectDimension(templateImage);
+   nifti_image *templateMask=NULL;
+   if(templateMaskName!=NULL)
+   {
+      templateMask=reg_io_ReadImageFile(templateMaskName);
+      if(templateMask==NULL)
+      {
+         reg_print_msg_error("Error when reading the template mask:");
+         reg_print_msg_error(templateMaskName);
+         nifti_image_free(templateImage);
+         delete GROUPWISE;
+         return EXIT_FAILURE;
+      }
+      reg_checkAndCorrectDimension(templateMask);
+   }
+
+   GROUPWISE->SetInputImages(inputImageNumber,inputImageName);
+   if(inputMaskName!=NULL)
+      GROUPWISE->SetInputMasks(inputMaskName);
+   GROUPWISE->SetTemplateImage(templateImage);
+   nifti_image_free(templateImage);
+   if(templateMask!=NULL)
+      GROUPWISE->SetTemplateMask(templateMask);
+   if(outputFolder!=NULL)
+      GROUPWISE->SetOutputFolder(outputFolder);
+
+   GROUPWISE->Run();
+
+   // The final template is saved
+   nifti_image *outputTemplate=GROUPWISE->GetTemplateImage();
+   memset(outputTemplate->descrip, 0, 80);
+   strcpy(outputTemplate->descrip,"Template created using reg_groupwise - NiftyReg");
+   reg_io_WriteImageFile(outputTemplate,outputTemplateName);
+
+   delete GROUPWISE;
+   if(templateMask!=NULL)
+      nifti_image_free(templateMask);
+
+   if(verbose)
+   {
+      time_t end;
+      time(&end);
+      int minutes=(int)floorf(float(end-start)/60.0f);
+      int seconds=(int)(end-start - 60*minutes);
+      char text[255];
+      sprintf(text, "Groupwise registration performed in %i min %i sec", minutes, seconds);
+      reg_print_info(argv[0], text);
+      reg_print_info(argv[0], "Have a good day !");
+   }
+   return EXIT_SUCCESS;
+}
@@ -11,11 +11,16 @@
  */
 
 
+#include "_reg_ReadWriteImage.h"
+#include "_reg_ReadWriteMatrix.h"
 #include "_reg_tools.h"
+#include "_reg_f3d.h"
+#include "_reg_aladin_sym.h"
 #include "float.h"
 #include <limits>
 #include <cmath>
 #include <string.h>
+#include <vector>
 
 #ifdef _WINDOWS
 #include <time.h>
@@ -40,6 +45,8 @@ typedef struct
    int maxIteration;
    int prinComp;
    int tp;
+   int concurrentNumber;
+   int registrationThreadNumber;
    const char *outputResultName;
    char *outputCPPName;
 } PARAM;
@@ -59,6 +66,7 @@ typedef struct
    bool pca2;
    bool pca3;
    bool aladin;
+   bool aladinNoSym;
    bool flirt;
    bool tp;
    bool noinit;
@@ -113,15 +121,285 @@ void Usage(char *exec)
    printf("\t-locality <int>\t\tIterative registration to the local mean image (pm <int> images - no PPCR).\n");
    printf("\t-tp       <int>\t\tIterative registration to single timepoint (no PPCR).\n");
    printf("\t-noinit \t\tTurn off cpp initialisation from previous iteration.\n");
+   printf("\t-par       <int>\t\tNumber of timepoints registered concurrently [1].\n");
+#if defined (_OPENMP)
+   printf("\t-ompReg    <int>\t\tNumber of thread used by every registration [omp/par].\n");
+   printf("\t\t\t\tThe results only do not depend on -par when this number is fixed.\n");
+#endif
    //printf("\t-flirt \t\t\tfor PPCNR using Flirt affine registration (not tested)\n");
    printf("\n*** reg_f3d/reg_aladin options are carried through (use reg_f3d -h or reg_aladin -h to see these options).\n");
-   //system("reg_f3d -h");
+   printf("\tThe registrations run in-process and support the following options:\n");
+   printf("\treg_f3d: -maxit -ln -lp -sx -sy -sz -be -le -jl -noAppJL -smooR -smooF -smoothGrad\n");
+   printf("\t         -ssd -lncc -kld -rbn -fbn -pad -nopy -noConj -approxGrad -fused -lineSearch -interp\n");
+   printf("\treg_aladin: -maxit -ln -lp -smooR -smooF -rigOnly -affDirect -noSym -nac -cog -pv -pi\n");
+   printf("\t            -speeeeed -interp -refLowThr -refUpThr -floLowThr -floUpThr -pad\n");
+   printf("\tBoth: -voff -omp <int>\n");
 
    printf("* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\n");
    return;
 }
 
 
+/* *************************************************************** */
+/// @brief Apply the reg_f3d options carried through the command line to a
+/// registration object. Returns false if an option is not recognised
+bool SetF3DOptions(reg_f3d<PrecisionTYPE> *REG, std::vector<char *> &option)
+{
+   for(size_t i=0; i<option.size(); ++i)
+   {
+      const char *o=option[i];
+      bool hasValue=i+1<option.size();
+      if((strcmp(o,"-maxit")==0 || strcmp(o,"--maxit")==0) && hasValue)
+         REG->SetMaximalIterationNumber(atoi(option[++i]));
+      else if((strcmp(o,"-ln")==0 || strcmp(o,"--ln")==0) && hasValue)
+         REG->SetLevelNumber(atoi(option[++i]));
+      else if((strcmp(o,"-lp")==0 || strcmp(o,"--lp")==0) && hasValue)
+         REG->SetLevelToPerform(atoi(option[++i]));
+      else if((strcmp(o,"-sx")==0 || strcmp(o,"--sx")==0) && hasValue)
+         REG->SetSpacing(0,(PrecisionTYPE)atof(option[++i]));
+      else if((strcmp(o,"-sy")==0 || strcmp(o,"--sy")==0) && hasValue)
+         REG->SetSpacing(1,(PrecisionTYPE)atof(option[++i]));
+      else if((strcmp(o,"-sz")==0 || strcmp(o,"--sz")==0) && hasValue)
+         REG->SetSpacing(2,(PrecisionTYPE)atof(option[++i]));
+      else if((strcmp(o,"-be")==0 || strcmp(o,"--be")==0) && hasValue)
+         REG->SetBendingEnergyWeight(atof(option[++i]));
+      else if((strcmp(o,"-le")==0 || strcmp(o,"--le")==0) && hasValue)
+         REG->SetLinearEnergyWeight(atof(option[++i]));
+      else if((strcmp(o,"-jl")==0 || strcmp(o,"--jl")==0) && hasValue)
+         REG->SetJacobianLogWeight(atof(option[++i]));
+      else if(strcmp(o,"-noAppJL")==0 || strcmp(o,"--noAppJL")==0)
+         REG->DoNotApproximateJacobianLog();
+      else if((strcmp(o,"-smooR")==0 || strcmp(o,"-smooT")==0 || strcmp(o,"--smooR")==0) && hasValue)
+         REG->SetReferenceSmoothingSigma(atof(option[++i]));
+      else if((strcmp(o,"-smooF")==0 || strcmp(o,"-smooS")==0 || strcmp(o,"--smooF")==0) && hasValue)
+         REG->SetFloatingSmoothingSigma(atof(option[++i]));
+      else if((strcmp(o,"-smoothGrad")==0 || strcmp(o,"--smoothGrad")==0) && hasValue)
+         REG->SetGradientSmoothingSigma(atof(option[++i]));
+      else if(strcmp(o,"-ssd")==0 || strcmp(o,"--ssd")==0)
+         REG->UseSSD(0,true);
+      else if((strcmp(o,"-lncc")==0 || strcmp(o,"--lncc")==0) && hasValue)
+         REG->UseLNCC(0,(float)atof(option[++i]));
+      else if(strcmp(o,"-kld")==0 || strcmp(o,"--kld")==0)
+         REG->UseKLDivergence(0);
+      else if((strcmp(o,"-rbn")==0 || strcmp(o,"--rbn")==0 || strcmp(o,"-tbn")==0) && hasValue)
+         REG->UseNMISetReferenceBinNumber(0,atoi(option[++i]));
+      else if((strcmp(o,"-fbn")==0 || strcmp(o,"--fbn")==0 || strcmp(o,"-sbn")==0) && hasValue)
+         REG->UseNMISetFloatingBinNumber(0,atoi(option[++i]));
+      else if((strcmp(o,"-pad")==0 || strcmp(o,"--pad")==0) && hasValue)
+         REG->SetWarpedPaddingValue(atof(option[++i]));
+      else if(strcmp(o,"-nopy")==0 || strcmp(o,"--nopy")==0)
+         REG->DoNotUsePyramidalApproach();
+      else if(strcmp(o,"-noConj")==0 || strcmp(o,"--noConj")==0)
+         REG->DoNotUseConjugateGradient();
+      else if(strcmp(o,"-approxGrad")==0 || strcmp(o,"--approxGrad")==0)
+         REG->UseApproximatedGradient();
+      else if(strcmp(o,"-fused")==0 || strcmp(o,"--fused")==0)
+         REG->UseFusedPipeline();
+      else if((strcmp(o,"-lineSearch")==0 || strcmp(o,"--lineSearch")==0) && hasValue)
+         REG->SetLineSearchType(atoi(option[++i]));
+      else if((strcmp(o,"-interp")==0 || strcmp(o,"--interp")==0) && hasValue)
+      {
+         int interp=atoi(option[++i]);
+         if(interp==0) REG->UseNeareatNeighborInterpolation();
+         else if(interp==1) REG->UseLinearInterpolation();
+         else REG->UseCubicSplineInterpolation();
+      }
+      else if(strcmp(o,"-voff")==0 || strcmp(o,"--voff")==0)
+         REG->DoNotPrintOutInformation();
+      else
+      {
+         fprintf(stderr,"* ERROR Unknown or incomplete reg_f3d option: %s\n",o);
+         return false;
+      }
+   }
+   return true;
+}
+/* *************************************************************** */
+/// @brief Apply the reg_aladin options carried through the command line to a
+/// registration object. Returns false if an option is not recognised
+bool SetAladinOptions(reg_aladin<PrecisionTYPE> *REG, std::vector<char *> &option)
+{
+   for(size_t i=0; i<option.size(); ++i)
+   {
+      const char *o=option[i];
+      bool hasValue=i+1<option.size();
+      if((strcmp(o,"-maxit")==0 || strcmp(o,"--maxit")==0) && hasValue)
+         REG->SetMaxIterations(atoi(option[++i]));
+      else if((strcmp(o,"-ln")==0 || strcmp(o,"--ln")==0) && hasValue)
+         REG->SetNumberOfLevels(atoi(option[++i]));
+      else if((strcmp(o,"-lp")==0 || strcmp(o,"--lp")==0) && hasValue)
+         REG->SetLevelsToPerform(atoi(option[++i]));
+      else if((strcmp(o,"-smooR")==0 || strcmp(o,"-smooT")==0 || strcmp(o,"--smooR")==0) && hasValue)
+         REG->SetReferenceSigma((float)atof(option[++i]));
+      else if((strcmp(o,"-smooF")==0 || strcmp(o,"-smooS")==0 || strcmp(o,"--smooF")==0) && hasValue)
+         REG->SetFloatingSigma((float)atof(option[++i]));
+      else if(strcmp(o,"-rigOnly")==0 || strcmp(o,"--rigOnly")==0)
+      {
+         REG->SetPerformRigid(true);
+         REG->SetPerformAffine(false);
+      }
+      else if(strcmp(o,"-affDirect")==0 || strcmp(o,"--affDirect")==0)
+      {
+         REG->SetPerformRigid(false);
+         REG->SetPerformAffine(true);
+      }
+      else if(strcmp(o,"-noSym")==0 || strcmp(o,"--noSym")==0)
+         continue; // The registration object type is already defined
+      else if(strcmp(o,"-nac")==0 || strcmp(o,"--nac")==0)
+         REG->SetAlignCentre(false);
+      else if(strcmp(o,"-cog")==0 || strcmp(o,"--cog")==0)
+      {
+         REG->SetAlignCentre(false);
+         REG->SetAlignCentreGravity(true);
+      }
+      else if((strcmp(o,"-%v")==0 || strcmp(o,"-pv")==0 || strcmp(o,"--pv")==0) && hasValue)
+         REG->SetBlockPercentage(atoi(option[++i]));
+      else if((strcmp(o,"-%i")==0 || strcmp(o,"-pi")==0 || strcmp(o,"--pi")==0) && hasValue)
+         REG->SetInlierLts((float)atof(option[++i]));
+      else if(strcmp(o,"-speeeeed")==0 || strcmp(o,"--speeed")==0)
+         REG->SetBlockStepSize(2);
+      else if((strcmp(o,"-interp")==0 || strcmp(o,"--interp")==0) && hasValue)
+         REG->SetInterpolation(atoi(option[++i]));
+      else if((strcmp(o,"-refLowThr")==0 || strcmp(o,"--refLowThr")==0) && hasValue)
+         REG->SetReferenceLowerThreshold((float)atof(option[++i]));
+      else if((strcmp(o,"-refUpThr")==0 || strcmp(o,"--refUpThr")==0) && hasValue)
+         REG->SetReferenceUpperThreshold((float)atof(option[++i]));
+      else if((strcmp(o,"-floLowThr")==0 || strcmp(o,"--floLowThr")==0) && hasValue)
+         REG->SetFloatingLowerThreshold((float)atof(option[++i]));
+      else if((strcmp(o,"-floUpThr")==0 || strcmp(o,"--floUpThr")==0) && hasValue)
+         REG->SetFloatingUpperThreshold((float)atof(option[++i]));
+      else if((strcmp(o,"-pad")==0 || strcmp(o,"--pad")==0) && hasValue)
+         REG->SetWarpedPaddingValue((float)atof(option[++i]));
+      else if(strcmp(o,"-voff")==0 || strcmp(o,"--voff")==0)
+         REG->SetVerbose(false);
+      else
+      {
+         fprintf(stderr,"* ERROR Unknown or incomplete reg_aladin option: %s\n",o);
+         return false;
+      }
+   }
+   return true;
+}
+/* *************************************************************** */
+/// @brief Register a floating timepoint to its anchor in memory. The
+/// control point grid or the affine matrix of the timepoint is used to
+/// initialise the registration when defined, and is replaced by the result.
+/// The warped timepoint is copied to the warped pointer
+void RegisterTimepoint(nifti_image *anchor,
+                       nifti_image *floating,
+                       PrecisionTYPE *warped,
+                       nifti_image **controlPointGrid,
+                       mat44 *affineMatrix,
+                       bool *affineInitialised,
+                       std::vector<char *> &option,
+                       FLAG *flag,
+                       int levelNumber,
+                       float spacing,
+                       bool verbose)
+{
+   nifti_image *result=NULL;
+   if(flag->aladin)
+   {
+      reg_aladin<PrecisionTYPE> *REG=NULL;
+      if(flag->aladinNoSym)
+         REG=new reg_aladin<PrecisionTYPE>;
+      else REG=new reg_aladin_sym<PrecisionTYPE>;
+      REG->SetInputReference(anchor);
+      REG->SetInputFloating(floating);
+      REG->SetVerbose(verbose);
+      // The warped images are used for the PCA and can not be padded with NaN
+      REG->SetWarpedPaddingValue(0);
+      SetAladinOptions(REG, option);
+      if(flag->autolevel)
+      {
+         REG->SetNumberOfLevels(levelNumber);
+         REG->SetLevelsToPerform(levelNumber);
+      }
+      if(REG->GetLevelsToPerform() > REG->GetNumberOfLevels())
+         REG->SetLevelsToPerform(REG->GetNumberOfLevels());
+      if(*affineInitialised && !flag->noinit)
+         REG->SetInputTransform(affineMatrix);
+      REG->Run();
+      result=REG->GetFinalWarpedImage();
+      *affineMatrix=*REG->GetTransformationMatrix();
+      *affineInitialised=true;
+      delete REG;
+   }
+   else
+   {
+      reg_f3d<PrecisionTYPE> *REG=new reg_f3d<PrecisionTYPE>(anchor->nt,floating->nt);
+      REG->SetReferenceImage(anchor);
+      REG->SetFloatingImage(floating);
+      if(!verbose)
+         REG->DoNotPrintOutInformation();
+      REG->SetWarpedPaddingValue(0);
+      SetF3DOptions(REG, option);
+      if(flag->autolevel)
+      {
+         REG->SetLevelNumber(levelNumber);
+         REG->SetSpacing(0,spacing);
+      }
+      if(*controlPointGrid!=NULL && !flag->noinit)
+         REG->SetControlPointGridImage(*controlPointGrid);
+      REG->Run();
+      nifti_image **warpedImage=REG->GetWarpedImage();
+      result=warpedImage[0];
+      if(warpedImage[1]!=NULL)
+         nifti_image_free(warpedImage[1]);
+      free(warpedImage);
+      // The previous grid is only released once the registration is over as
+      // it is not copied by the registration object
+      nifti_image *newControlPointGrid=REG->GetControlPointPositionImage();
+      delete REG;
+      if(*controlPointGrid!=NULL)
+         nifti_image_free(*controlPointGrid);
+      *controlPointGrid=newControlPointGrid;
+   }
+   reg_tools_changeDatatype<PrecisionTYPE>(result);
+   memcpy(warped, result->data, result->nvox*result->nbyper);
+   nifti_image_free(result);
+}
+/* *************************************************************** */
+/// @brief Write the affine matrices of all timepoints one after the other in
+/// a text file
+void WriteAffineMatrices(mat44 *affineMatrix, int timepointNumber, const char *filename)
+{
+   FILE *affineFile=fopen(filename, "w");
+   if(affineFile==NULL)
+   {
+      fprintf(stderr,"* ERROR Error when writing the affine file: %s\n",filename);
+      return;
+   }
+   for(int t=0; t<timepointNumber; ++t)
+      for(int i=0; i<4; i++)
+         fprintf(affineFile, "%.7g %.7g %.7g %.7g\n", affineMatrix[t].m[i][0], affineMatrix[t].m[i][1],
+                 affineMatrix[t].m[i][2], affineMatrix[t].m[i][3]);
+   fclose(affineFile);
+}
+/* *************************************************************** */
+/// @brief Gather the control point grids of all timepoints in a single image
+/// whose fourth dimension is the timepoint
+void WriteControlPointGrids(nifti_image **controlPointGrid, int timepointNumber, const char *filename)
+{
+   nifti_image *dofs = nifti_copy_nim_info(controlPointGrid[0]);
+   dofs->nt = dofs->dim[4] = timepointNumber;
+   dofs->nvox = controlPointGrid[0]->nvox*timepointNumber;
+   dofs->data = (PrecisionTYPE *)calloc(dofs->nvox, controlPointGrid[0]->nbyper);
+   PrecisionTYPE *intensityPtrD = static_cast<PrecisionTYPE *>(dofs->data);
+   for(int t=0; t<timepointNumber; t++)
+   {
+      PrecisionTYPE *intensityPtrDD = static_cast<PrecisionTYPE *>(controlPointGrid[t]->data);
+      int r=controlPointGrid[t]->nvox/3.0;
+      for(int i=0; i<3; i++)
+      {
+         memcpy(&intensityPtrD[i*timepointNumber*r+t*r], &intensityPtrDD[i*r], controlPointGrid[t]->nbyper*r);
+      }
+   }
+   nifti_set_filenames(dofs,filename, 0, 0);
+   nifti_image_write(dofs);
+   nifti_image_free(dofs);
+}
+/* *************************************************************** */
 int main(int argc, char **argv)
 {
    time_t start;
@@ -143,16 +421,23 @@ int main(int argc, char **argv)
    flag->prinCompFlag=0;
    flag->tp=0;
    flag->noinit=0;
+   flag->aladinNoSym=0;
    param->tp=0;
    param->maxIteration=-1;
+   param->concurrentNumber=1;
+   param->registrationThreadNumber=0;
 
-   char regCommandAll[1055]="";
-   char regCommand[1000]="";
-   strcat(regCommand,"-target anchorx.nii -source floatx.nii");
-   char regCommandF[1000]="";
-   strcat(regCommandF,"flirt -ref anchorx.nii -in floatx.nii -out outputResult.nii.gz");
+   // Options that are carried through to the registration objects
+   std::vector<char *> regOption;
    char style[10]="";
-   char STYL3[10]="";
+
+#if defined (_OPENMP)
+   // Set the default number of thread
+   int defaultOpenMPValue=omp_get_num_procs();
+   if(getenv("OMP_NUM_THREADS")!=NULL)
+      defaultOpenMPValue=atoi(getenv("OMP_NUM_THREADS"));
+   omp_set_num_threads(defaultOpenMPValue);
+#endif
 
    /* read the input parameters */
    for(int i=1; i<argc; i++)
@@ -321,6 +606,34 @@ int main(int argc, char **argv)
       {
          flag->flirt=1;
       }
+      else if(strcmp(argv[i], "-noSym") == 0 || strcmp(argv[i], "--noSym") == 0)
+      {
+         flag->aladinNoSym=1;
+      }
+      else if(strcmp(argv[i], "-par") == 0)  // number of timepoints registered concurrently
+      {
+         param->concurrentNumber=atoi(argv[++i]);
+         if(param->concurrentNumber<1) param->concurrentNumber=1;
+      }
+      else if(strcmp(argv[i], "-ompReg") == 0)  // number of thread used by every registration
+      {
+#if defined (_OPENMP)
+         param->registrationThreadNumber=atoi(argv[++i]);
+         if(param->registrationThreadNumber<1) param->registrationThreadNumber=1;
+#else
+         reg_print_msg_warn("NiftyReg has not been compiled with OpenMP, the \'-ompReg\' flag is ignored");
+         ++i;
+#endif
+      }
+      else if(strcmp(argv[i], "-omp")==0 || strcmp(argv[i], "--omp")==0)
+      {
+#if defined (_OPENMP)
+         omp_set_num_threads(atoi(argv[++i]));
+#else
+         reg_print_msg_warn("NiftyReg has not been compiled with OpenMP, the \'-omp\' flag is ignored");
+         ++i;
+#endif
+      }
       else if(strcmp(argv[i], "-autolevel") == 0)
       {
          flag->autolevel=1;
@@ -329,39 +642,52 @@ int main(int argc, char **argv)
       {
          flag->noinit=1;
       }
-      else if(strcmp(argv[i], "-lp") == 0)   // force autolevel select off if lp or ln are present.
+      else if(strcmp(argv[i], "-lp") == 0 && i+1<argc)   // force autolevel select off if lp or ln are present.
       {
          flag->autolevel=0;
-         strcat(regCommand," ");
-         strcat(regCommand,argv[i]);
-         strcat(regCommand," ");
-         strcat(regCommand,argv[i+1]);
-         ++i;
+         regOption.push_back(argv[i]);
+         regOption.push_back(argv[++i]);
       }
-      else if(strcmp(argv[i], "-ln") == 0)   // force autolevel select off if lp or ln are present.
+      else if(strcmp(argv[i], "-ln") == 0 && i+1<argc)   // force autolevel select off if lp or ln are present.
       {
          flag->autolevel=0;
-         strcat(regCommand," ");
-         strcat(regCommand,argv[i]);
-         strcat(regCommand," ");
-         strcat(regCommand,argv[i+1]);
-         ++i;
+         regOption.push_back(argv[i]);
+         regOption.push_back(argv[++i]);
       }
-      else if(strcmp(argv[i], "-maxit") == 0)  // extract number of registration iterations for display
+      else if(strcmp(argv[i], "-maxit") == 0 && i+1<argc)  // extract number of registration iterations for display
       {
          param->maxIteration=atoi(argv[i+1]);
-         strcat(regCommand," ");
-         strcat(regCommand,argv[i]);
-         strcat(regCommand," ");
-         strcat(regCommand,argv[i+1]);
-         ++i;
+         regOption.push_back(argv[i]);
+         regOption.push_back(argv[++i]);
       }
       else
       {
-         strcat(regCommand," ");
-         strcat(regCommand,argv[i]);
+         regOption.push_back(argv[i]);
       }
    }
+   if(flag->flirt)
+   {
+      reg_print_msg_warn("The registrations run in-process and flirt is not available, reg_aladin is used instead");
+      flag->flirt=0;
+      flag->aladin=1;
+   }
+   // The carried through options are checked once before any registration
+   if(flag->aladin)
+   {
+      reg_aladin<PrecisionTYPE> *checkREG=new reg_aladin<PrecisionTYPE>;
+      bool validOptions=SetAladinOptions(checkREG, regOption);
+      delete checkREG;
+      if(!validOptions)
+         return EXIT_FAILURE;
+   }
+   else
+   {
+      reg_f3d<PrecisionTYPE> *checkREG=new reg_f3d<PrecisionTYPE>(1,1);
+      bool validOptions=SetF3DOptions(checkREG, regOption);
+      delete checkREG;
+      if(!validOptions)
+         return EXIT_FAILURE;
+   }
    if(flag->makesourcex)
    {
       return EXIT_SUCCESS;  // stop if being used to concatenate 3D images into 4D object.
@@ -425,36 +751,27 @@ int main(int argc, char **argv)
 //    param->maxIteration=(param->maxIteration<50)?50:param->maxIteration;
    if(param->tp>image->nt) param->tp=image->nt;
    if(flag->aladin)  // decide whether to use affine or free-form
-   {
-      strcat(regCommandAll,"reg_aladin ");
-      strcat(style,"aff");
-      strcat(STYL3,"AFF");
-   }
-   else if(flag->flirt)
    {
       strcat(style,"aff");
    }
    else
    {
-      strcat(regCommandAll,"reg_f3d ");
       strcat(style,"cpp");
-      strcat(STYL3,"CPP");
    }
+   char outputCPPBuffer[40];
    if(!flag->outputCPPFlag)
    {
-      char buffer[40];
-      sprintf(buffer,"ppcnrfinal-%s",style);
-      if(flag->aladin || flag->flirt)
+      sprintf(outputCPPBuffer,"ppcnrfinal-%s",style);
+      if(flag->aladin)
       {
-         strcat(buffer,".txt");
+         strcat(outputCPPBuffer,".txt");
       }
       else
       {
-         strcat(buffer,".nii");
+         strcat(outputCPPBuffer,".nii");
       }
-      param->outputCPPName=buffer;
+      param->outputCPPName=outputCPPBuffer;
    }
-   strcat(regCommandAll,regCommand);
    printf("%s\n",style);
 
    /* ****************** */
@@ -487,15 +804,51 @@ int main(int argc, char **argv)
    printf("Number of timepoints: %i \n", image->nt);
    printf("Number of principal components: %i\n",param->prinComp);
    printf("Registration max iterations: %i\n",param->maxIteration);
+   printf("Number of concurrent registrations: %i\n",param->concurrentNumber);
 
    /* ********************** */
    /* START THE REGISTRATION */
    /* ********************** */
-   param->outputImageName="anchor.nii";   // NEED TO GET WORKING AND PUT INTERMEDIATE FILES IN SOURCE DIRECTORY.
    nifti_image *images=nifti_copy_nim_info(image); // Need to make a new image that has the same info as the original.
    images->data = (PrecisionTYPE *)calloc(images->nvox, image->nbyper);
    memcpy(images->data, image->data, image->nvox*image->nbyper);
 
+   // The floating timepoints and the transformations are kept in memory
+   // across the principal component iterations
+   const int timepointNumber=images->nt;
+   nifti_image **floatingImages=(nifti_image **)malloc(timepointNumber*sizeof(nifti_image *));
+   nifti_image **controlPointGrids=(nifti_image **)calloc(timepointNumber,sizeof(nifti_image *));
+   mat44 *affineMatrices=(mat44 *)malloc(timepointNumber*sizeof(mat44));
+   bool *affineInitialised=(bool *)calloc(timepointNumber,sizeof(bool));
+   for(int t=0; t<timepointNumber; t++)
+   {
+      floatingImages[t] = nifti_copy_nim_info(images);
+      floatingImages[t]->ndim=floatingImages[t]->dim[0]=3;
+      floatingImages[t]->dim[4]=floatingImages[t]->dim[5]=1;
+      floatingImages[t]->dim[6]=floatingImages[t]->dim[7]=1;
+      nifti_update_dims_from_array(floatingImages[t]);
+      // The header is checked as it would be when read from file
+      reg_checkAndCorrectDimension(floatingImages[t]);
+      floatingImages[t]->data = (void *)malloc(floatingImages[t]->nvox*images->nbyper);
+      memcpy(floatingImages[t]->data, &static_cast<PrecisionTYPE *>(images->data)[t*floatingImages[t]->nvox],
+             floatingImages[t]->nvox*floatingImages[t]->nbyper);
+   }
+
+   // The timepoints are registered concurrently, the threads are shared
+   // between the registrations unless their number is specified. The
+   // registration results depend on their thread number, they thus only
+   // do not depend on the number of concurrent registrations when it is fixed
+   int concurrentNumber=param->concurrentNumber<timepointNumber?param->concurrentNumber:timepointNumber;
+   int registrationThreadNumber=1;
+#if defined (_OPENMP)
+   registrationThreadNumber=param->registrationThreadNumber;
+   if(registrationThreadNumber<1)
+      registrationThreadNumber=omp_get_max_threads()/concurrentNumber;
+   if(registrationThreadNumber<1) registrationThreadNumber=1;
+   if(concurrentNumber>1) omp_set_max_active_levels(2);
+#endif
+   printf("Number of thread(s) per registration: %i\n",registrationThreadNumber);
+
    /* ************************************/
    /* FOR NUMBER OF PRINCIPAL COMPONENTS */
    /* ************************************/
@@ -854,101 +1207,42 @@ int main(int argc, char **argv)
          // current: images // these are both open: perpetual source
          // target:  imagep //					   pca target
          PrecisionTYPE *intensityPtrP = static_cast<PrecisionTYPE *>(imagep->data); // pointer to pca-anchor data
-         PrecisionTYPE *intensityPtrS = static_cast<PrecisionTYPE *>(images->data); // pointer to real source-float data
          PrecisionTYPE *intensityPtrC = static_cast<PrecisionTYPE *>(image->data); // pointer to updated 'current' data
-         for(int imageNumber=0; imageNumber<images->nt; imageNumber++)
+         int imageNumber;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) schedule(dynamic) num_threads(concurrentNumber) \
+   shared(images, floatingImages, controlPointGrids, affineMatrices, affineInitialised, \
+   intensityPtrP, intensityPtrC, regOption, flag, param, prinCompNumber, levelNumber, \
+   concurrentNumber, registrationThreadNumber) \
+   private(imageNumber)
+#endif
+         for(imageNumber=0; imageNumber<images->nt; imageNumber++)
          {
-            // ROLLING FLOAT AND ANCHOR IMAGES
-            nifti_image *stores = nifti_copy_nim_info(images);
-            stores->ndim=stores->dim[0]=3;
-            stores->nt=stores->dim[4]=1;
-            stores->nvox=stores->nx*stores->ny*stores->nz;
-            stores->data = (void *)calloc(stores->nvox,images->nbyper);
-
-            nifti_image *storet = nifti_copy_nim_info(stores);
-            storet->data = (void *)calloc(storet->nvox, storet->nbyper);
-
-            // COPY THE APPROPRIATE VALUES
-            PrecisionTYPE *intensityPtrPP = static_cast<PrecisionTYPE *>(storet->data); // 3D real source image (needs current cpp image)
-            PrecisionTYPE *intensityPtrSS = static_cast<PrecisionTYPE *>(stores->data); // 3D pca-float data
-            memcpy(intensityPtrPP, &intensityPtrP[imageNumber*storet->nvox], storet->nvox*storet->nbyper);
-            memcpy(intensityPtrSS, &intensityPtrS[imageNumber*stores->nvox], stores->nvox*stores->nbyper);
-
-            nifti_set_filenames(stores,"outputResult.nii", 0, 0); // Fail-safe for reg_f3d failure
-            nifti_image_write(stores);
-            nifti_set_filenames(stores,"floatx.nii", 0, 0); // TODO NAME
-            nifti_image_write(stores);
-            nifti_image_free(stores);
-            nifti_set_filenames(storet,"anchorx.nii", 0, 0); // TODO NAME
-            nifti_image_write(storet);
-            nifti_image_free(storet);
-
-            char regCommandB[1055]="";
-            if(!flag->flirt)
-            {
-               sprintf(regCommandB,"%s -%s ",regCommandAll,style);
-               char buffer[20];
-               if(flag->aladin)
-               {
-                  n=sprintf(buffer,"float%s%i.txt", style,imageNumber+1);
-               }
-               else
-               {
-                  sprintf(buffer,"float%s%i.nii", style,imageNumber+1);
-               }
-               strcat(regCommandB,buffer);
-               char buffer2[30];
-               if(flag->autolevel)
-               {
-                  n=sprintf(buffer2," -ln %i",levelNumber);
-                  strcat(regCommandB,buffer2);
-                  char buffer3[20];
-                  if(!flag->aladin) n=sprintf(buffer3," -sx %g",param->spacing[0]);
-                  strcat(regCommandB,buffer3);
-               }
-               if(prinCompNumber>1 && !flag->noinit)
-               {
-                  char buffer4[8];
-                  n=sprintf(buffer4," -in%s ",style);
-                  strcat(regCommandB,buffer4);
-                  strcat(regCommandB,buffer);
-               }
-            }
-            else  // flirt -ref -in -out -omat -init
-            {
-               n=sprintf(regCommandB,"%s -omat ",regCommandF);
-               char buffer[20];
-               n=sprintf(buffer,"float%s%i.txt", style,imageNumber+1);
-               strcat(regCommandB,buffer);
-               if(prinCompNumber>1 && !flag->noinit)
-               {
-                  char buffer3[8];
-                  n=sprintf(buffer3," -init ");
-                  strcat(regCommandB,buffer3);
-                  strcat(regCommandB,buffer);
-                  strcat(regCommandB,";gunzip -f outputResult.nii.gz");
-               }
-            }
+#if defined (_OPENMP)
+            omp_set_num_threads(registrationThreadNumber);
+#endif
+            // ROLLING ANCHOR IMAGE, THE FLOATING IMAGE IS THE ORIGINAL TIMEPOINT
+            nifti_image *storet = nifti_copy_nim_info(floatingImages[imageNumber]);
+            storet->data = (void *)malloc(storet->nvox*storet->nbyper);
+            memcpy(storet->data, &intensityPtrP[imageNumber*storet->nvox], storet->nvox*storet->nbyper);
 
             // DO REGISTRATION
             printf("* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\n");
             printf("RUNNING ITERATION %i of %i \n",prinCompNumber, param->prinComp);
             printf("* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\n");
             printf("Registering image %i of %i \n", imageNumber+1,images->nt);
-            printf("'%s' \n",regCommandB);
-            //system(regCommandB);
-
-            if(system(regCommandB))
-            {
-               fprintf(stderr, "Error while running the following command:\n%s\n",regCommandB);
-               reg_exit(1);
-            }
-
-            // READ IN RESULT AND MAKE A NEW CURRENT IMAGE 'image'
-            stores = nifti_image_read("outputResult.nii",true); // TODO NAME
-            PrecisionTYPE *intensityPtrCC = static_cast<PrecisionTYPE *>(stores->data); // 3D result image
-            memcpy(&intensityPtrC[imageNumber*stores->nvox], intensityPtrCC, stores->nvox*stores->nbyper);
-            nifti_image_free(stores);
+            RegisterTimepoint(storet,
+                              floatingImages[imageNumber],
+                              &intensityPtrC[imageNumber*storet->nvox],
+                              &controlPointGrids[imageNumber],
+                              &affineMatrices[imageNumber],
+                              &affineInitialised[imageNumber],
+                              regOption,
+                              flag,
+                              levelNumber,
+                              param->spacing[0],
+                              concurrentNumber==1);
+            nifti_image_free(storet);
          }
       }
       nifti_image_free(imagep);
@@ -963,46 +1257,11 @@ int main(int argc, char **argv)
       {
          char cppname[20];
          sprintf(cppname,"cpp%i.nii",prinCompNumber);
-         if(!flag->aladin & !flag->flirt)
-         {
-            char buffer[20];
-            sprintf(buffer,"float%s1.nii",style);
-            nifti_image *dof = nifti_image_read(buffer,true);
-            nifti_image *dofs = nifti_copy_nim_info(dof);
-            dofs->nt = dofs->dim[4] = images->nt;
-            dofs->nvox = dof->nvox*images->nt;
-            dofs->data = (PrecisionTYPE *)calloc(dofs->nvox, dof->nbyper);
-            PrecisionTYPE *intensityPtrD = static_cast<PrecisionTYPE *>(dofs->data);
-            for(int t=0; t<images->nt; t++)
-            {
-               char buffer[20];
-               sprintf(buffer,"float%s%i.nii",style, t+1);
-               nifti_image *dof = nifti_image_read(buffer,true);
-               PrecisionTYPE *intensityPtrDD = static_cast<PrecisionTYPE *>(dof->data);
-               int r=dof->nvox/3.0;
-               for(int i=0; i<3; i++)
-               {
-                  memcpy(&intensityPtrD[i*image->nt*r+t*r], &intensityPtrDD[i*r], dof->nbyper*r);
-               }
-               nifti_image_free(dof);
-            }
-            nifti_set_filenames(dofs,cppname, 0, 0); // TODO NAME 	// write final dof data
-            nifti_image_write(dofs);
-            nifti_image_free(dofs);
-         }
-         else
+         if(!flag->pca0) // no transformation is estimated with -pca0
          {
-            std::string final_string = "";
-            for(int t=0; t<images->nt; t++)
-            {
-               char buffer[20];
-               sprintf(buffer,"float%s%i.txt",style,t+1);
-               std::ifstream ifs(buffer);
-               std::string str((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-               final_string+=str;
-            }
-            std::ofstream ofs(cppname);
-            ofs<<final_string.c_str();
+            if(!flag->aladin)
+               WriteControlPointGrids(controlPointGrids, timepointNumber, cppname);
+            else WriteAffineMatrices(affineMatrices, timepointNumber, cppname);
          }
 
       }
@@ -1014,61 +1273,25 @@ int main(int argc, char **argv)
    // Read in images and put into single object
    if(!flag->pca0)
    {
-      if(!flag->aladin & !flag->flirt)
-      {
-         char buffer[20];
-         sprintf(buffer,"float%s1.nii",style);
-         nifti_image *dof = nifti_image_read(buffer,true);
-         nifti_image *dofs = nifti_copy_nim_info(dof);
-         dofs->nt = dofs->dim[4] = images->nt;
-         dofs->nvox = dof->nvox*images->nt;
-         dofs->data = (PrecisionTYPE *)calloc(dofs->nvox, dof->nbyper);
-         PrecisionTYPE *intensityPtrD = static_cast<PrecisionTYPE *>(dofs->data);
-         for(int t=0; t<images->nt; t++)
-         {
-            char buffer[20];
-            sprintf(buffer,"float%s%i.nii",style, t+1);
-            nifti_image *dof = nifti_image_read(buffer,true);
-            PrecisionTYPE *intensityPtrDD = static_cast<PrecisionTYPE *>(dof->data);
-            int r=dof->nvox/3.0;
-            for(int i=0; i<3; i++)
-            {
-               memcpy(&intensityPtrD[i*image->nt*r+t*r], &intensityPtrDD[i*r], dof->nbyper*r);
-            }
-            nifti_image_free(dof);
-            remove(buffer); // delete spare floatcpp files
-         }
-         nifti_set_filenames(dofs,param->outputCPPName, 0, 0); // TODO NAME 	// write final dof data
-         nifti_image_write(dofs);
-         nifti_image_free(dofs);
-      }
-      else
-      {
-         std::string final_string = "";
-         for(int t=0; t<images->nt; t++)
-         {
-            char buffer[20];
-            sprintf(buffer,"float%s%i.txt",style,t+1);
-            std::ifstream ifs(buffer);
-            std::string str((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-            final_string+=str;
-            remove(buffer);
-         }
-         std::ofstream ofs(param->outputCPPName);
-         ofs<<final_string.c_str();
-      }
-
-      // DELETE
-      // delete: anchorx.nii floatx.nii outputResult.nii : I think this is all...
-      remove("anchorx.nii");  // flakey...
-      remove("floatx.nii");
-      remove("outputResult.nii");
-      remove("outputResult.nii.gz");
+      if(!flag->aladin)
+         WriteControlPointGrids(controlPointGrids, timepointNumber, param->outputCPPName);
+      else WriteAffineMatrices(affineMatrices, timepointNumber, param->outputCPPName);
 
       // Write final image data
       nifti_set_filenames(image,param->outputResultName, 0, 0);
       nifti_image_write(image);
    }
+   for(int t=0; t<timepointNumber; t++)
+   {
+      nifti_image_free(floatingImages[t]);
+      if(controlPointGrids[t]!=NULL)
+         nifti_image_free(controlPointGrids[t]);
+   }
+   free(floatingImages);
+   free(controlPointGrids);
+   free(affineMatrices);
+   free(affineInitialised);
+   nifti_image_free(images);
    nifti_image_free(image);
    nifti_image_free(mask);
 
@@ -33,6 +33,7 @@ typedef struct
    char *inputLandmarkName;
    float affTransParam[12];
    char *outputTransName;
+   int invertIterationNumber;
 } PARAM;
 typedef struct
 {
@@ -47,6 +48,7 @@ typedef struct
    bool halfTransFlag;
    bool invertAffFlag;
    bool invertNRRFlag;
+   bool invertIterationFlag;
    bool flirtAff2NRFlag;
    bool makeAffFlag;
    bool aff2rigFlag;
@@ -121,6 +123,10 @@ void Usage(char *exec)
    printf("\t\tNote that the cubic b-spline grid parametrisations can not be inverted without approximation,\n");
    printf("\t\tas a result, they are converted into deformation fields before inversion.\n\n");
 
+   printf("\t-invNrrIt <int>\n");
+   printf("\t\tMaximal number of fixed-point iterations per voxel used by -invNrr to invert a dense field [100].\n");
+   printf("\t\tThe mean and maximal inverse consistency errors (mm) are then reported.\n\n");
+
    printf("\t-half <filename1> <filename2>\n");
    printf("\t\tThe input transformation is halfed and stored using the same transformation type.\n");
    printf("\t\tfilename1 - Input transformation file name\n");
@@ -286,6 +292,11 @@ int main(int argc, char **argv)
          param->input2TransName=argv[++i];
          param->outputTransName=argv[++i];
       }
+      else if(strcmp(argv[i],"-invNrrIt")==0 || strcmp(argv[i],"--invNrrIt")==0)
+      {
+         flag->invertIterationFlag=true;
+         param->invertIterationNumber=atoi(argv[++i]);
+      }
       else if(strcmp(argv[i],"-makeAff")==0 || strcmp(argv[i],"--makeAff")==0)
       {
          flag->makeAffFlag=true;
@@ -1344,17 +1355,21 @@ int main(int argc, char **argv)
      outputTransImage->scl_inter = 0.f;
      outputTransImage->data = (void *)malloc
         (outputTransImage->nvox*outputTransImage->nbyper);
+      int invertIterationNumber=flag->invertIterationFlag?param->invertIterationNumber:100;
+      double inverseError[2];
       // Invert the provided
       switch(reg_round(inputTransImage->intent_p1))
       {
       case DEF_FIELD:
-         reg_defFieldInvert(inputTransImage,outputTransImage,1.0e-6f);
+         reg_defFieldInvert(inputTransImage,outputTransImage,1.0e-6f,
+                            invertIterationNumber,false,inverseError);
        memset(outputTransImage->descrip, 0, 80);
        strcpy(outputTransImage->descrip, "Deformation field from NiftyReg (reg_transform -invNrr)");
          break;
       case DISP_FIELD:
          reg_getDeformationFromDisplacement(inputTransImage);
-         reg_defFieldInvert(inputTransImage,outputTransImage,1.0e-6f);
+         reg_defFieldInvert(inputTransImage,outputTransImage,1.0e-6f,
+                            invertIterationNumber,false,inverseError);
        reg_getDisplacementFromDeformation(outputTransImage);
        memset(outputTransImage->descrip, 0, 80);
        strcpy(outputTransImage->descrip, "Displacement field from NiftyReg (reg_transform -invNrr)");
@@ -1402,6 +1417,14 @@ int main(int argc, char **argv)
                  param->inputTransName);
          return EXIT_FAILURE;
       }
+      if(flag->invertIterationFlag)
+      {
+         if(reg_round(inputTransImage->intent_p1)==DEF_FIELD ||
+               reg_round(inputTransImage->intent_p1)==DISP_FIELD)
+            printf("[NiftyReg] Inverse consistency error with at most %i iteration(s): mean %g mm, max %g mm\n",
+                   invertIterationNumber, inverseError[0], inverseError[1]);
+         else reg_print_msg_warn("The velocity fields are inverted without iteration, the \'-invNrrIt\' flag is ignored");
+      }
       // Save the inverted transformation
       reg_io_WriteImageFile(outputTransImage,param->outputTransName);
       // Free the allocated images
@@ -0,0 +1,22 @@
+#ifndef AFFINERESAMPLEIMAGEKERNEL_H
+#define AFFINERESAMPLEIMAGEKERNEL_H
+
+#include "Kernel.h"
+#include "nifti1_io.h"
+
+/// @brief Resample the floating image through the current affine transformation
+/// without computing a deformation field
+class AffineResampleImageKernel : public Kernel {
+public:
+    static std::string getName() {
+        return "AffineResampleImageKernel";
+    }
+    AffineResampleImageKernel( std::string name) : Kernel(name) {
+    }
+
+    virtual ~AffineResampleImageKernel(){}
+
+    virtual void calculate(int interp, float paddingValue) = 0;
+};
+
+#endif // AFFINERESAMPLEIMAGEKERNEL_H
@@ -107,13 +107,10 @@ void AladinContent::initVars()
       this->CurrentWarped = NULL;
    }
 
-   if (this->CurrentReference != NULL){
-      this->AllocateDeformationField(bytes);
+   // The deformation field is allocated on demand by getCurrentDeformationField()
+   this->CurrentDeformationField = NULL;
+   if (this->CurrentReference != NULL)
       refMatrix_xyz = (CurrentReference->sform_code > 0) ? (CurrentReference->sto_xyz) : (CurrentReference->qto_xyz);
-   }
-   else {
-      this->CurrentDeformationField = NULL;
-   }
 
    if (this->CurrentReferenceMask == NULL && this->CurrentReference != NULL)
       this->CurrentReferenceMask = (int *) calloc(this->CurrentReference->nx * this->CurrentReference->ny * this->CurrentReference->nz, sizeof(int));
@@ -51,8 +51,12 @@ public:
 	unsigned int floatingVoxels, referenceVoxels;
 
 	//getters
+	/// The deformation field is only allocated when first requested as the
+	/// affine resampling kernel does not require it
 	virtual nifti_image *getCurrentDeformationField()
 	{
+		if (this->CurrentDeformationField == NULL && this->CurrentReference != NULL)
+			this->AllocateDeformationField(this->bytes);
 		return this->CurrentDeformationField;
 	}
 	nifti_image *getCurrentReference()
@@ -0,0 +1,18 @@
+#ifndef FASTBLOCKMATCHINGKERNEL_H
+#define FASTBLOCKMATCHINGKERNEL_H
+
+#include "BlockMatchingKernel.h"
+
+class FastBlockMatchingKernel : public BlockMatchingKernel {
+public:
+    static std::string getName() {
+        return "fastBlockMatchingKernel";
+    }
+    FastBlockMatchingKernel(std::string name) : BlockMatchingKernel(name) {
+
+    }
+    virtual ~FastBlockMatchingKernel(){}
+    virtual void calculate() = 0;
+};
+
+#endif // FASTBLOCKMATCHINGKERNEL_H
@@ -7,6 +7,7 @@
 #include "Platform.h"
 #include "AffineDeformationFieldKernel.h"
 #include "ResampleImageKernel.h"
+#include "AffineResampleImageKernel.h"
 #include "BlockMatchingKernel.h"
 #include "OptimiseKernel.h"
 #include "ConvolutionKernel.h"
@@ -34,11 +35,13 @@ template<class T> reg_aladin<T>::reg_aladin()
 
   this->TransformationMatrix = new mat44;
   this->InputTransformName = NULL;
+  this->InputTransform = NULL;
 
   this->affineTransformation3DKernel = NULL;
   this->blockMatchingKernel = NULL;
   this->optimiseKernel = NULL;
   this->resamplingKernel = NULL;
+  this->affineResamplingKernel = NULL;
 
   this->con = NULL;
   this->blockMatchingParams = NULL;
@@ -57,6 +60,7 @@ template<class T> reg_aladin<T>::reg_aladin()
   this->BlockStepSize = 1;
   this->BlockPercentage = 50;
   this->InlierLts = 50;
+  this->captureRangeVox = 3;
 
   this->AlignCentre = 1;
   this->AlignCentreGravity = 0;
@@ -92,6 +96,10 @@ template<class T> reg_aladin<T>::~reg_aladin()
     delete this->TransformationMatrix;
   this->TransformationMatrix = NULL;
 
+  if (this->InputTransform != NULL)
+    delete this->InputTransform;
+  this->InputTransform = NULL;
+
   if(this->ReferencePyramid!=NULL){
     for (unsigned int l = 0; l < this->LevelsToPerform; ++l)
     {
@@ -253,6 +261,15 @@ void reg_aladin<T>::SetInputTransform(const char *filename)
 }
 /* *************************************************************** */
 template<class T>
+void reg_aladin<T>::SetInputTransform(mat44 *mat)
+{
+  if (this->InputTransform == NULL)
+    this->InputTransform = new mat44;
+  *this->InputTransform = *mat;
+  return;
+}
+/* *************************************************************** */
+template<class T>
 void reg_aladin<T>::InitialiseRegistration()
 {
 #ifndef NDEBUG
@@ -331,7 +348,11 @@ void reg_aladin<T>::InitialiseRegistration()
   }
 
   // Initialise the transformation
-  if (this->InputTransformName != NULL)
+  if (this->InputTransform != NULL)
+  {
+    *this->TransformationMatrix = *this->InputTransform;
+  }
+  else if (this->InputTransformName != NULL)
   {
     if (FILE *aff = fopen(this->InputTransformName, "r")) {
       fclose(aff);
@@ -396,8 +417,16 @@ void reg_aladin<T>::ClearCurrentInputImage()
 template<class T>
 void reg_aladin<T>::createKernels()
 {
-  this->affineTransformation3DKernel = platform->createKernel(AffineDeformationFieldKernel::getName(), this->con);
-  this->resamplingKernel = platform->createKernel(ResampleImageKernel::getName(), this->con);
+  // The warped image is directly computed from the transformation matrix when
+  // the platform provides it, the deformation field is otherwise required
+  this->affineResamplingKernel = platform->createKernel(AffineResampleImageKernel::getName(), this->con);
+  if (this->affineResamplingKernel == NULL) {
+    this->affineTransformation3DKernel = platform->createKernel(AffineDeformationFieldKernel::getName(), this->con);
+    this->resamplingKernel = platform->createKernel(ResampleImageKernel::getName(), this->con);
+  } else {
+    this->affineTransformation3DKernel = NULL;
+    this->resamplingKernel = NULL;
+  }
   if (this->blockMatchingParams != NULL) {
     this->blockMatchingKernel = platform->createKernel(BlockMatchingKernel::getName(), this->con);
     this->optimiseKernel = platform->createKernel(OptimiseKernel::getName(), this->con);
@@ -410,8 +439,12 @@ void reg_aladin<T>::createKernels()
 template<class T>
 void reg_aladin<T>::clearKernels()
 {
-  delete this->affineTransformation3DKernel;
-  delete this->resamplingKernel;
+  if (this->affineTransformation3DKernel != NULL)
+    delete this->affineTransformation3DKernel;
+  if (this->resamplingKernel != NULL)
+    delete this->resamplingKernel;
+  if (this->affineResamplingKernel != NULL)
+    delete this->affineResamplingKernel;
   if (this->blockMatchingKernel != NULL)
     delete this->blockMatchingKernel;
   if (this->optimiseKernel != NULL)
@@ -427,6 +460,10 @@ void reg_aladin<T>::GetDeformationField()
 template<class T>
 void reg_aladin<T>::GetWarpedImage(int interp, float padding)
 {
+  if (this->affineResamplingKernel != NULL) {
+    this->affineResamplingKernel->template castTo<AffineResampleImageKernel>()->calculate(interp, padding);
+    return;
+  }
   this->GetDeformationField();
   this->resamplingKernel->template castTo<ResampleImageKernel>()->calculate(interp, padding);
 }
@@ -68,6 +68,7 @@ class reg_aladin
         int *activeVoxelNumber; ///TODO Needs to be removed
 
         char *InputTransformName;
+        mat44 *InputTransform;
         mat44 *TransformationMatrix;
 
         bool Verbose;
@@ -168,6 +169,9 @@ class reg_aladin
         }
 
         void SetInputTransform(const char *filename);
+        /// @brief Initialise the registration with a copy of an affine
+        /// matrix held in memory instead of an affine file
+        void SetInputTransform(mat44 *mat);
         mat44 *GetInputTransform()
         {
             return this->InputTransform;
@@ -284,7 +288,7 @@ class reg_aladin
 
     private:
         Kernel *affineTransformation3DKernel,*blockMatchingKernel;
-        Kernel *optimiseKernel, *resamplingKernel;
+        Kernel *optimiseKernel, *resamplingKernel, *affineResamplingKernel;
         void resolveMatrix(unsigned int iterations,
                            const unsigned int optimizationFlag);
 };
@@ -22,6 +22,7 @@ reg_aladin_sym<T>::reg_aladin_sym ()
    this->bBlockMatchingKernel=NULL;
    this->bOptimiseKernel=NULL;
    this->bResamplingKernel=NULL;
+   this->bAffineResamplingKernel=NULL;
 
    this->backCon = NULL;
    this->BackwardBlockMatchingParams=NULL;
@@ -221,6 +222,10 @@ template <class T>
 void reg_aladin_sym<T>::GetWarpedImage(int interp, float padding)
 {
    reg_aladin<T>::GetWarpedImage(interp, padding);
+   if (this->bAffineResamplingKernel != NULL) {
+      this->bAffineResamplingKernel->template castTo<AffineResampleImageKernel>()->calculate(interp, padding);
+      return;
+   }
    this->GetBackwardDeformationField();
    this->bResamplingKernel->template castTo<ResampleImageKernel>()->calculate(interp, padding);
 
@@ -330,9 +335,15 @@ template <class T>
 void reg_aladin_sym<T>::createKernels()
 {
   reg_aladin<T>::createKernels();
-  this->bAffineTransformation3DKernel = this->platform->createKernel (AffineDeformationFieldKernel::getName(), this->backCon);
+  this->bAffineResamplingKernel = this->platform->createKernel(AffineResampleImageKernel::getName(), this->backCon);
+  if (this->bAffineResamplingKernel == NULL) {
+    this->bAffineTransformation3DKernel = this->platform->createKernel (AffineDeformationFieldKernel::getName(), this->backCon);
+    this->bResamplingKernel = this->platform->createKernel(ResampleImageKernel::getName(), this->backCon);
+  } else {
+    this->bAffineTransformation3DKernel = NULL;
+    this->bResamplingKernel = NULL;
+  }
   this->bBlockMatchingKernel = this->platform->createKernel(BlockMatchingKernel::getName(), this->backCon);
-  this->bResamplingKernel = this->platform->createKernel(ResampleImageKernel::getName(), this->backCon);
   this->bOptimiseKernel = this->platform->createKernel(OptimiseKernel::getName(), this->backCon);
 }
 /* *************************************************************** */
@@ -347,8 +358,12 @@ template <class T>
 void reg_aladin_sym<T>::clearKernels()
 {
   reg_aladin<T>::clearKernels();
-  delete this->bResamplingKernel;
-  delete this->bAffineTransformation3DKernel;
+  if (this->bResamplingKernel != NULL)
+    delete this->bResamplingKernel;
+  if (this->bAffineTransformation3DKernel != NULL)
+    delete this->bAffineTransformation3DKernel;
+  if (this->bAffineResamplingKernel != NULL)
+    delete this->bAffineResamplingKernel;
   delete this->bBlockMatchingKernel;
   delete this->bOptimiseKernel;
 }
@@ -32,6 +32,8 @@ reg_base<T>::reg_base(int refTimePoint,int floTimePoint)
    this->perturbationNumber=0;
    this->useConjGradient=true;
    this->useApproxGradient=false;
+   this->useFusedPipeline=false;
+   this->lineSearchType=ADAPTIVE_LINE_SEARCH;
 
    this->measure_ssd=NULL;
    this->measure_kld=NULL;
@@ -455,6 +457,39 @@ void reg_base<T>::DoNotUseApproximatedGradient()
 }
 /* *************************************************************** */
 template<class T>
+void reg_base<T>::UseFusedPipeline()
+{
+   this->useFusedPipeline = true;
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_base<T>::UseFusedPipeline");
+#endif
+}
+/* *************************************************************** */
+template<class T>
+void reg_base<T>::DoNotUseFusedPipeline()
+{
+   this->useFusedPipeline = false;
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_base<T>::DoNotUseFusedPipeline");
+#endif
+}
+/* *************************************************************** */
+template<class T>
+void reg_base<T>::SetLineSearchType(int type)
+{
+   if(type!=ADAPTIVE_LINE_SEARCH && type!=BRENT_LINE_SEARCH)
+   {
+      reg_print_fct_error("reg_base<T>::SetLineSearchType");
+      reg_print_msg_error("Unknown line search type");
+      reg_exit();
+   }
+   this->lineSearchType = type;
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_base<T>::SetLineSearchType");
+#endif
+}
+/* *************************************************************** */
+template<class T>
 void reg_base<T>::PrintOutInformation()
 {
    this->verbose = true;
@@ -1115,7 +1150,7 @@ void reg_base<T>::Initialise()
          for(int i=1; i<this->referencePyramid[l]->nt; ++i)
             active[i]=false;
          sigma[0]=this->referenceSmoothingSigma;
-         reg_tools_kernelConvolution(this->referencePyramid[l], sigma, GAUSSIAN_KERNEL, NULL, active);
+         reg_tools_kernelConvolution(this->referencePyramid[l], sigma, RECURSIVE_GAUSSIAN_KERNEL, NULL, active);
          delete []active;
          delete []sigma;
       }
@@ -1128,7 +1163,7 @@ void reg_base<T>::Initialise()
          for(int i=1; i<this->floatingPyramid[l]->nt; ++i)
             active[i]=false;
          sigma[0]=this->floatingSmoothingSigma;
-         reg_tools_kernelConvolution(this->floatingPyramid[l], sigma, GAUSSIAN_KERNEL, NULL, active);
+         reg_tools_kernelConvolution(this->floatingPyramid[l], sigma, RECURSIVE_GAUSSIAN_KERNEL, NULL, active);
          delete []active;
          delete []sigma;
       }
@@ -1154,6 +1189,7 @@ void reg_base<T>::SetOptimiser()
    if(this->useConjGradient)
       this->optimiser=new reg_conjugateGradient<T>();
    else this->optimiser=new reg_optimiser<T>();
+   this->optimiser->SetLineSearchType(this->lineSearchType);
 #ifndef NDEBUG
    reg_print_fct_debug("reg_base<T>::SetOptimiser");
 #endif
@@ -1193,6 +1229,63 @@ double reg_base<T>::ComputeSimilarityMeasure()
 /* *************************************************************** */
 /* *************************************************************** */
 template <class T>
+bool reg_base<T>::InitialiseLocalSimilarityMeasure()
+{
+   // Returns true if all local measures can be evaluated concurrently
+   bool concurrent=true;
+   reg_measure *measures[7]={this->measure_nmi,
+                             this->measure_ssd,
+                             this->measure_kld,
+                             this->measure_lncc,
+                             this->measure_dti,
+                             this->measure_mind,
+                             this->measure_mindssc};
+   for(int i=0; i<7; ++i)
+   {
+      if(measures[i]!=NULL)
+      {
+         measures[i]->InitialiseLocalSimilarityMeasure();
+         concurrent &= measures[i]->IsLocalSimilarityMeasureConcurrent();
+      }
+   }
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_base<T>::InitialiseLocalSimilarityMeasure");
+#endif
+   return concurrent;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+double reg_base<T>::ComputeLocalSimilarityMeasure(nifti_image *localWarped,
+                                                  int *regionStart)
+{
+   double measure=0.;
+   if(this->measure_nmi!=NULL)
+      measure += this->measure_nmi->GetLocalSimilarityMeasureValue(localWarped, regionStart);
+
+   if(this->measure_ssd!=NULL)
+      measure += this->measure_ssd->GetLocalSimilarityMeasureValue(localWarped, regionStart);
+
+   if(this->measure_kld!=NULL)
+      measure += this->measure_kld->GetLocalSimilarityMeasureValue(localWarped, regionStart);
+
+   if(this->measure_lncc!=NULL)
+      measure += this->measure_lncc->GetLocalSimilarityMeasureValue(localWarped, regionStart);
+
+   if(this->measure_dti!=NULL)
+      measure += this->measure_dti->GetLocalSimilarityMeasureValue(localWarped, regionStart);
+
+   if(this->measure_mind!=NULL)
+      measure += this->measure_mind->GetLocalSimilarityMeasureValue(localWarped, regionStart);
+
+   if(this->measure_mindssc!=NULL)
+      measure += this->measure_mindssc->GetLocalSimilarityMeasureValue(localWarped, regionStart);
+
+   return double(this->similarityWeight) * measure;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
 void reg_base<T>::GetVoxelBasedGradient()
 {
    // The voxel based gradient image is filled with zeros
@@ -1258,6 +1351,223 @@ void reg_base<T>::GetVoxelBasedGradient()
 }
 /* *************************************************************** */
 /* *************************************************************** */
+template <class T>
+bool reg_base<T>::CanUseFusedPipeline()
+{
+   // The fused pipeline is restricted to the forward NMI and SSD measures
+   if(!this->useFusedPipeline || this->GetSymmetricStatus() ||
+         !this->IsDeformationFieldTileSupported())
+      return false;
+   if(this->measure_nmi==NULL && this->measure_ssd==NULL)
+      return false;
+   if(this->measure_kld!=NULL || this->measure_lncc!=NULL ||
+         this->measure_dti!=NULL || this->measure_mind!=NULL ||
+         this->measure_mindssc!=NULL)
+      return false;
+   if(this->measure_nmi!=NULL && !this->measure_nmi->IsTileSimilarityMeasureSupported())
+      return false;
+   if(this->measure_ssd!=NULL && !this->measure_ssd->IsTileSimilarityMeasureSupported())
+      return false;
+   return true;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+void reg_base<T>::ComputeFusedTiles(bool computeGradient)
+{
+   // The reference space is split into bricks that are small enough for
+   // their deformation, warped intensities and spatial gradient to remain
+   // in cache. A brick of a 3D image contains at least two slices
+   int imageDim[3]={this->currentReference->nx,
+                    this->currentReference->ny,
+                    this->currentReference->nz};
+   int tileSize[3]={64, 16, imageDim[2]>1?8:1};
+   int tileNumber[3], maxTileSize[3];
+   for(int a=0; a<3; ++a)
+   {
+      tileSize[a]=tileSize[a]<imageDim[a]?tileSize[a]:imageDim[a];
+      tileNumber[a]=(imageDim[a]+tileSize[a]-1)/tileSize[a];
+      // A trailing brick of a single voxel is merged with the previous one
+      if(tileNumber[a]>1 && imageDim[a]%tileSize[a]==1)
+         --tileNumber[a];
+      maxTileSize[a]=tileSize[a]+(tileNumber[a]*tileSize[a]<imageDim[a]?1:0);
+   }
+   int totalTileNumber=tileNumber[0]*tileNumber[1]*tileNumber[2];
+   size_t maxTileVoxelNumber=(size_t)maxTileSize[0]*maxTileSize[1]*maxTileSize[2];
+
+   int threadNumber=1;
+#if defined (_OPENMP)
+   threadNumber=omp_get_max_threads();
+#endif
+   reg_measure *measures[2]={this->measure_nmi, this->measure_ssd};
+   if(!computeGradient)
+   {
+      for(int m=0; m<2; ++m)
+         if(measures[m]!=NULL)
+            measures[m]->InitialiseTileSimilarityMeasure(threadNumber);
+   }
+
+   reg_base<T> *registration=this;
+   nifti_image *deformationField=this->deformationFieldImage;
+   nifti_image *floating=this->currentFloating;
+   nifti_image *warpedImage=this->warped;
+   nifti_image *warpedGradient=this->warImgGradient;
+   int *mask=this->currentMask;
+   int interp=this->interpolation;
+   T padding=this->warpedPaddingValue;
+   int tile, tid, a, x, y, z, t, activeVoxel, regionStart[3], regionSize[3];
+   size_t index, localIndex;
+   int *localMask;
+   nifti_image *localDef, *localWarped, *localGradient;
+#if defined (_OPENMP)
+#pragma omp parallel num_threads(threadNumber) default(none) \
+   shared(registration, deformationField, floating, warpedImage, warpedGradient, \
+   mask, interp, padding, imageDim, tileSize, tileNumber, maxTileSize, \
+   totalTileNumber, maxTileVoxelNumber, measures, computeGradient) \
+   private(tile, tid, a, x, y, z, t, activeVoxel, regionStart, regionSize, \
+   index, localIndex, localMask, localDef, localWarped, localGradient)
+#endif
+   {
+      tid=0;
+#if defined (_OPENMP)
+      tid=omp_get_thread_num();
+#endif
+      // Every thread owns the deformation field, warped image, spatial
+      // gradient and mask of its current brick
+      localDef = nifti_copy_nim_info(deformationField);
+      localWarped = nifti_copy_nim_info(warpedImage);
+      localGradient = nifti_copy_nim_info(warpedGradient);
+      nifti_image *localImages[3]={localDef, localWarped, localGradient};
+      for(a=0; a<3; ++a)
+      {
+         localImages[a]->dim[1]=maxTileSize[0];
+         localImages[a]->dim[2]=maxTileSize[1];
+         localImages[a]->dim[3]=maxTileSize[2];
+         nifti_update_dims_from_array(localImages[a]);
+         localImages[a]->data=(void *)malloc(localImages[a]->nvox*localImages[a]->nbyper);
+      }
+      localMask = (int *)malloc(maxTileVoxelNumber*sizeof(int));
+#if defined (_OPENMP)
+#pragma omp for schedule(static)
+#endif
+      for(tile=0; tile<totalTileNumber; ++tile)
+      {
+         int tileIndex[3]={tile%tileNumber[0],
+                           (tile/tileNumber[0])%tileNumber[1],
+                           tile/(tileNumber[0]*tileNumber[1])};
+         for(a=0; a<3; ++a)
+         {
+            regionStart[a]=tileIndex[a]*tileSize[a];
+            regionSize[a]=tileIndex[a]==tileNumber[a]-1?
+                     imageDim[a]-regionStart[a]:tileSize[a];
+         }
+         // The brick mask is extracted and empty bricks are skipped
+         activeVoxel=0;
+         localIndex=0;
+         for(z=0; z<regionSize[2]; ++z)
+         {
+            for(y=0; y<regionSize[1]; ++y)
+            {
+               index=((size_t)(z+regionStart[2])*imageDim[1]+y+regionStart[1]) *
+                     imageDim[0]+regionStart[0];
+               for(x=0; x<regionSize[0]; ++x)
+               {
+                  localMask[localIndex]=mask[index++];
+                  if(localMask[localIndex++]>-1) ++activeVoxel;
+               }
+            }
+         }
+         if(activeVoxel==0) continue;
+         for(a=0; a<3; ++a)
+         {
+            localImages[a]->dim[1]=regionSize[0];
+            localImages[a]->dim[2]=regionSize[1];
+            localImages[a]->dim[3]=regionSize[2];
+            nifti_update_dims_from_array(localImages[a]);
+         }
+         // The brick deformation and warped intensities are computed
+         registration->GetDeformationFieldTile(localDef, regionStart, localMask);
+         reg_resampleImage(floating,
+                           localWarped,
+                           localDef,
+                           localMask,
+                           interp,
+                           padding);
+         if(!computeGradient)
+         {
+            for(a=0; a<2; ++a)
+               if(measures[a]!=NULL)
+                  measures[a]->AccumulateTileSimilarityMeasure(localWarped, regionStart, tid);
+         }
+         else
+         {
+            for(t=0; t<floating->nt; ++t)
+            {
+               reg_getImageGradient(floating,
+                                    localGradient,
+                                    localDef,
+                                    localMask,
+                                    interp,
+                                    padding,
+                                    t);
+               for(a=0; a<2; ++a)
+                  if(measures[a]!=NULL)
+                     measures[a]->GetTileVoxelBasedSimilarityMeasureGradient(localWarped,
+                                                                            localGradient,
+                                                                            regionStart,
+                                                                            t);
+            }
+         }
+      }
+      nifti_image_free(localDef);
+      nifti_image_free(localWarped);
+      nifti_image_free(localGradient);
+      free(localMask);
+   }
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_base<T>::ComputeFusedTiles");
+#endif
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+double reg_base<T>::ComputeFusedSimilarityMeasure()
+{
+   // The measure statistics are accumulated brick by brick
+   this->ComputeFusedTiles(false);
+   double measure=0.;
+   if(this->measure_nmi!=NULL)
+      measure += this->measure_nmi->GetTileSimilarityMeasureValue();
+
+   if(this->measure_ssd!=NULL)
+      measure += this->measure_ssd->GetTileSimilarityMeasureValue();
+
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_base<T>::ComputeFusedSimilarityMeasure");
+#endif
+   return double(this->similarityWeight) * measure;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+void reg_base<T>::GetFusedVoxelBasedGradient()
+{
+   // The voxel based gradient image is filled with zeros
+   reg_tools_multiplyValueToImage(this->voxelBasedMeasureGradient,
+                                  this->voxelBasedMeasureGradient,
+                                  0.f);
+   // The measure gradients require the statistics of the whole image which
+   // are computed in a first pass, the gradients are then added brick by brick.
+   // The brick deformations and warped intensities are computed again in the
+   // second pass so that they never exist at the size of the full image
+   this->ComputeFusedSimilarityMeasure();
+   this->ComputeFusedTiles(true);
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_base<T>::GetFusedVoxelBasedGradient");
+#endif
+}
+/* *************************************************************** */
+/* *************************************************************** */
 //template<class T>
 //void reg_base<T>::ApproximateParzenWindow()
 //{
@@ -1551,6 +1861,20 @@ void reg_base<T>::Run()
       // Initialise the measures of similarity
       this->InitialiseSimilarity();
 
+      // The fused pipeline works brick by brick and only uses the headers of
+      // the full size warped image, deformation field and warped gradient
+      if(this->CanUseFusedPipeline() && !this->useApproxGradient)
+      {
+         nifti_image *fullSizeImage[3]={this->warped,
+                                        this->deformationFieldImage,
+                                        this->warImgGradient};
+         for(int i=0; i<3; ++i)
+         {
+            free(fullSizeImage[i]->data);
+            fullSizeImage[i]->data=NULL;
+         }
+      }
+
       // initialise the optimiser
       this->SetOptimiser();
 
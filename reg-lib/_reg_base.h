@@ -85,6 +85,8 @@ protected:
    bool additive_mc_nmi;
    bool useConjGradient;
    bool useApproxGradient;
+   bool useFusedPipeline;
+   int lineSearchType;
    bool verbose;
    bool usePyramid;
    int interpolation;
@@ -132,7 +134,13 @@ protected:
 
    virtual void WarpFloatingImage(int);
    virtual double ComputeSimilarityMeasure();
+   virtual bool InitialiseLocalSimilarityMeasure();
+   virtual double ComputeLocalSimilarityMeasure(nifti_image *, int *);
    virtual void GetVoxelBasedGradient();
+   virtual bool CanUseFusedPipeline();
+   virtual double ComputeFusedSimilarityMeasure();
+   virtual void GetFusedVoxelBasedGradient();
+   void ComputeFusedTiles(bool);
    virtual void SmoothGradient()
    {
       return;
@@ -144,6 +152,14 @@ protected:
    {
       return;  // Need to be filled
    }
+   virtual bool IsDeformationFieldTileSupported()
+   {
+      return false;  // Need to be filled
+   }
+   virtual void GetDeformationFieldTile(nifti_image *, int *, int *)
+   {
+      return;  // Need to be filled
+   }
    virtual void SetGradientImageToZero()
    {
       return;  // Need to be filled
@@ -236,6 +252,9 @@ public:
    void DoNotUseConjugateGradient();
    void UseApproximatedGradient();
    void DoNotUseApproximatedGradient();
+   void UseFusedPipeline();
+   void DoNotUseFusedPipeline();
+   void SetLineSearchType(int);
    // Measure of similarity related functions
 //    void ApproximateParzenWindow();
 //    void DoNotApproximateParzenWindow();
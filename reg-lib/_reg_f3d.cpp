@@ -426,6 +426,29 @@ void reg_f3d<T>::GetDeformationField()
 /* *************************************************************** */
 /* *************************************************************** */
 template <class T>
+bool reg_f3d<T>::IsDeformationFieldTileSupported()
+{
+   // Grids with an affine component are composed over the whole field
+   return this->controlPointGrid->intent_p1!=LIN_SPLINE_GRID &&
+         this->controlPointGrid->num_ext==0;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+void reg_f3d<T>::GetDeformationFieldTile(nifti_image *localDeformationField,
+                                         int *regionStart,
+                                         int *localMask)
+{
+   reg_spline_getDeformationFieldRegion(this->controlPointGrid,
+                                        localDeformationField,
+                                        localMask,
+                                        regionStart,
+                                        true // bspline
+                                        );
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
 double reg_f3d<T>::ComputeJacobianBasedPenaltyTerm(int type)
 {
    if(this->jacobianLogWeight<=0) return 0.;
@@ -541,7 +564,9 @@ double reg_f3d<T>::ComputeLandmarkDistancePenaltyTerm()
 template <class T>
 void reg_f3d<T>::GetSimilarityMeasureGradient()
 {
-   this->GetVoxelBasedGradient();
+   if(this->CanUseFusedPipeline())
+      this->GetFusedVoxelBasedGradient();
+   else this->GetVoxelBasedGradient();
 
    int kernel_type=CUBIC_SPLINE_KERNEL;
    // The voxel based NMI gradient is convolved with a spline kernel
@@ -868,8 +893,13 @@ double reg_f3d<T>::GetObjectiveFunctionValue()
    this->currentWMeasure = 0.0;
    if(this->similarityWeight>0)
    {
-      this->WarpFloatingImage(this->interpolation);
-      this->currentWMeasure = this->ComputeSimilarityMeasure();
+      if(this->CanUseFusedPipeline())
+         this->currentWMeasure = this->ComputeFusedSimilarityMeasure();
+      else
+      {
+         this->WarpFloatingImage(this->interpolation);
+         this->currentWMeasure = this->ComputeSimilarityMeasure();
+      }
    }
 #ifndef NDEBUG
    char text[255];
@@ -984,7 +1014,7 @@ void reg_f3d<T>::SmoothGradient()
 /* *************************************************************** */
 /* *************************************************************** */
 template <class T>
-void reg_f3d<T>::GetApproximatedGradient()
+void reg_f3d<T>::GetApproximatedGradientFullEvaluation()
 {
    // Loop over every control point
    T *gridPtr = static_cast<T *>(this->controlPointGrid->data);
@@ -1000,6 +1030,225 @@ void reg_f3d<T>::GetApproximatedGradient()
       gridPtr[i] = currentValue;
       gradPtr[i] = -(T)((valPlus - valMinus ) / (2.0*eps));
    }
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_f3d<T>::GetApproximatedGradientFullEvaluation");
+#endif
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+void reg_f3d<T>::GetApproximatedGradient()
+{
+   // The DTI measure does not warp the floating image, the objective function
+   // is thus fully evaluated
+   if(this->measure_dti!=NULL)
+   {
+      this->GetApproximatedGradientFullEvaluation();
+      return;
+   }
+   // The control point grid is set to the current best position
+   memcpy(this->controlPointGrid->data, this->optimiser->GetBestDOF(),
+          this->controlPointGrid->nvox*this->controlPointGrid->nbyper);
+   this->SetGradientImageToZero();
+
+   if(this->similarityWeight>0)
+   {
+      // The warped image is used as baseline for all local evaluations
+      this->WarpFloatingImage(this->interpolation);
+      bool concurrent = this->InitialiseLocalSimilarityMeasure();
+
+      nifti_image *defField = this->deformationFieldImage;
+      size_t voxelNumber = (size_t)defField->nx*defField->ny*defField->nz;
+      T *defPtr = static_cast<T *>(defField->data);
+      T *gradPtr = static_cast<T *>(this->transformationGradient->data);
+      int imageDim[3]={defField->nx, defField->ny, defField->nz};
+      int gridDim[3]={this->controlPointGrid->nx,
+                      this->controlPointGrid->ny,
+                      this->controlPointGrid->nz};
+      int nodeNumber = gridDim[0]*gridDim[1]*gridDim[2];
+      int axisNumber = defField->nu;
+      T gridVoxelSpacing[3]={this->controlPointGrid->dx / defField->dx,
+                             this->controlPointGrid->dy / defField->dy,
+                             this->controlPointGrid->dz / defField->dz};
+      if(defField->nz==1) gridVoxelSpacing[2]=1;
+      T eps = this->controlPointGrid->dx / 100.f;
+      // A control point only influences the voxels of a box of four
+      // spacings along every axis, the box maximal size is defined
+      int maxRegionSize[3];
+      for(int a=0; a<3; ++a)
+         maxRegionSize[a]=imageDim[a]>1?(int)ceil(4.f*gridVoxelSpacing[a])+3:1;
+      size_t maxRegionVoxelNumber=(size_t)maxRegionSize[0]*maxRegionSize[1]*maxRegionSize[2];
+
+      int node, i, a, r, u, x, y, z, sign, regionStart[3], regionSize[3], nodeIndex[3];
+      size_t index, localIndex;
+      T basis, basisValues[4], *weight[3], *localDefPtr, localWeight;
+      int *localMask;
+      double value[2];
+      nifti_image *localDef, *localWarped;
+#if defined (_OPENMP)
+#pragma omp parallel if(concurrent) default(none) \
+   shared(defField, voxelNumber, defPtr, gradPtr, imageDim, gridDim, nodeNumber, \
+   axisNumber, gridVoxelSpacing, eps, maxRegionSize, maxRegionVoxelNumber, concurrent) \
+   private(node, i, a, r, u, x, y, z, sign, regionStart, regionSize, nodeIndex, \
+   index, localIndex, basis, basisValues, weight, localDefPtr, localWeight, localMask, \
+   value, localDef, localWarped)
+#endif
+      {
+         // Every thread owns its local deformation field, warped image and mask
+         localDef = nifti_copy_nim_info(defField);
+         localDef->dim[1]=maxRegionSize[0];
+         localDef->dim[2]=maxRegionSize[1];
+         localDef->dim[3]=maxRegionSize[2];
+         nifti_update_dims_from_array(localDef);
+         localDef->data = (void *)malloc(localDef->nvox*localDef->nbyper);
+         localDefPtr = static_cast<T *>(localDef->data);
+         localWarped = nifti_copy_nim_info(this->warped);
+         localWarped->dim[1]=maxRegionSize[0];
+         localWarped->dim[2]=maxRegionSize[1];
+         localWarped->dim[3]=maxRegionSize[2];
+         nifti_update_dims_from_array(localWarped);
+         localWarped->data = (void *)malloc(localWarped->nvox*localWarped->nbyper);
+         localMask = (int *)malloc(maxRegionVoxelNumber*sizeof(int));
+         for(a=0; a<3; ++a)
+            weight[a] = (T *)malloc(maxRegionSize[a]*sizeof(T));
+#if defined (_OPENMP)
+#pragma omp for schedule(dynamic)
+#endif
+         for(node=0; node<nodeNumber; ++node)
+         {
+            nodeIndex[0]=node%gridDim[0];
+            nodeIndex[1]=(node/gridDim[0])%gridDim[1];
+            nodeIndex[2]=node/(gridDim[0]*gridDim[1]);
+            // Define the region influenced by the current node and the
+            // associated B-Spline weights, the node is used by the voxels
+            // for which it is in position 0 to 3 of the support
+            for(a=0; a<3; ++a)
+            {
+               regionStart[a]=0;
+               regionSize[a]=1;
+               if(imageDim[a]==1)
+               {
+                  weight[a][0]=1;
+                  continue;
+               }
+               r=(int)floor((nodeIndex[a]-3)*gridVoxelSpacing[a])-1;
+               r=r<0?0:r;
+               regionSize[a]=0;
+               for(x=r; x<imageDim[a] && regionSize[a]<maxRegionSize[a]; ++x)
+               {
+                  i=static_cast<int>(static_cast<T>(x)/gridVoxelSpacing[a]);
+                  basis=static_cast<T>(x)/gridVoxelSpacing[a]-static_cast<T>(i);
+                  if(basis<0) basis=0; //rounding error
+                  i=nodeIndex[a]-i;
+                  if(i<0) break;
+                  if(i>3) continue;
+                  get_BSplineBasisValues<T>(basis, basisValues);
+                  if(regionSize[a]==0) regionStart[a]=x;
+                  weight[a][regionSize[a]++]=basisValues[i];
+               }
+            }
+            if(regionSize[0]==0 || regionSize[1]==0 || regionSize[2]==0)
+            {
+               for(a=0; a<axisNumber; ++a)
+                  gradPtr[a*nodeNumber+node]=0;
+               continue;
+            }
+            // A 3D region has to contain at least two slices to be resampled in 3D
+            if(imageDim[2]>1 && regionSize[2]==1)
+            {
+               if(regionStart[2]+1<imageDim[2])
+                  weight[2][regionSize[2]]=0;
+               else
+               {
+                  weight[2][1]=weight[2][0];
+                  weight[2][0]=0;
+                  --regionStart[2];
+               }
+               ++regionSize[2];
+            }
+            // Update the local images dimensions
+            localDef->dim[1]=localWarped->dim[1]=regionSize[0];
+            localDef->dim[2]=localWarped->dim[2]=regionSize[1];
+            localDef->dim[3]=localWarped->dim[3]=regionSize[2];
+            nifti_update_dims_from_array(localDef);
+            nifti_update_dims_from_array(localWarped);
+            // Extract the region of the deformation field and mask
+            localIndex=0;
+            for(z=0; z<regionSize[2]; ++z)
+            {
+               for(y=0; y<regionSize[1]; ++y)
+               {
+                  index=((size_t)(z+regionStart[2])*imageDim[1]+y+regionStart[1]) *
+                        imageDim[0]+regionStart[0];
+                  for(x=0; x<regionSize[0]; ++x)
+                  {
+                     localMask[localIndex]=this->currentMask[index];
+                     for(u=0; u<axisNumber; ++u)
+                        localDefPtr[u*localDef->nx*localDef->ny*localDef->nz+localIndex] =
+                              defPtr[u*voxelNumber+index];
+                     ++index;
+                     ++localIndex;
+                  }
+               }
+            }
+            // The node is displaced along every axis in both directions. The
+            // deformation field is linear with respect to the node position
+            for(a=0; a<axisNumber; ++a)
+            {
+               T *localAxisPtr = &localDefPtr[a*localDef->nx*localDef->ny*localDef->nz];
+               for(sign=0; sign<2; ++sign)
+               {
+                  localIndex=0;
+                  for(z=0; z<regionSize[2]; ++z)
+                  {
+                     for(y=0; y<regionSize[1]; ++y)
+                     {
+                        index=((size_t)(z+regionStart[2])*imageDim[1]+y+regionStart[1]) *
+                              imageDim[0]+regionStart[0];
+                        localWeight = (sign==0?eps:-eps) * weight[1][y] * weight[2][z];
+                        for(x=0; x<regionSize[0]; ++x)
+                        {
+                           localAxisPtr[localIndex++] =
+                                 defPtr[a*voxelNumber+index++] + localWeight * weight[0][x];
+                        }
+                     }
+                  }
+                  reg_resampleImage(this->currentFloating,
+                                    localWarped,
+                                    localDef,
+                                    localMask,
+                                    this->interpolation,
+                                    this->warpedPaddingValue);
+                  value[sign]=this->ComputeLocalSimilarityMeasure(localWarped,
+                                                                  regionStart);
+               }
+               gradPtr[a*nodeNumber+node] = -(T)((value[0] - value[1]) / (2.0*eps));
+               // The original deformation is restored
+               localIndex=0;
+               for(z=0; z<regionSize[2]; ++z)
+               {
+                  for(y=0; y<regionSize[1]; ++y)
+                  {
+                     index=((size_t)(z+regionStart[2])*imageDim[1]+y+regionStart[1]) *
+                           imageDim[0]+regionStart[0];
+                     for(x=0; x<regionSize[0]; ++x)
+                        localAxisPtr[localIndex++] = defPtr[a*voxelNumber+index++];
+                  }
+               }
+            }
+         }
+         for(a=0; a<3; ++a)
+            free(weight[a]);
+         free(localMask);
+         nifti_image_free(localDef);
+         nifti_image_free(localWarped);
+      }
+   }
+   // The penalty term gradients are computed analytically
+   this->GetBendingEnergyGradient();
+   this->GetJacobianBasedGradient();
+   this->GetLinearEnergyGradient();
+   this->GetLandmarkDistanceGradient();
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d<T>::GetApproximatedGradient");
 #endif
@@ -1127,7 +1376,9 @@ void reg_f3d<T>::GetObjectiveFunctionGradient()
       // Compute the gradient of the similarity measure
       if(this->similarityWeight>0)
       {
-         this->WarpFloatingImage(this->interpolation);
+         // The fused pipeline does not require the full warped image
+         if(!this->CanUseFusedPipeline())
+            this->WarpFloatingImage(this->interpolation);
          this->GetSimilarityMeasureGradient();
       }
       else
@@ -55,9 +55,12 @@ protected:
    virtual void SmoothGradient();
    virtual void GetObjectiveFunctionGradient();
    virtual void GetApproximatedGradient();
+   void GetApproximatedGradientFullEvaluation();
    void GetSimilarityMeasureGradient();
 
    virtual void GetDeformationField();
+   virtual bool IsDeformationFieldTileSupported();
+   virtual void GetDeformationFieldTile(nifti_image *, int *, int *);
    virtual void DisplayCurrentLevelParameters();
 
    virtual double GetObjectiveFunctionValue();
@@ -26,6 +26,8 @@ reg_f3d2<T>::reg_f3d2(int refTimePoint,int floTimePoint)
    this->BCHUpdate=false;
    this->useGradientCumulativeExp=true;
    this->BCHUpdateValue=0;
+   this->flowFieldImage=NULL;
+   this->backwardFlowFieldImage=NULL;
 
 #ifndef NDEBUG
    reg_print_msg_debug("reg_f3d2 constructor called");
@@ -36,6 +38,12 @@ reg_f3d2<T>::reg_f3d2(int refTimePoint,int floTimePoint)
 template <class T>
 reg_f3d2<T>::~reg_f3d2()
 {
+   if(this->flowFieldImage!=NULL)
+      nifti_image_free(this->flowFieldImage);
+   this->flowFieldImage=NULL;
+   if(this->backwardFlowFieldImage!=NULL)
+      nifti_image_free(this->backwardFlowFieldImage);
+   this->backwardFlowFieldImage=NULL;
 #ifndef NDEBUG
    reg_print_msg_debug("reg_f3d2 destructor called");
 #endif
@@ -86,6 +94,44 @@ void reg_f3d2<T>::Initialise()
 /* *************************************************************** */
 /* *************************************************************** */
 template <class T>
+void reg_f3d2<T>::AllocateDeformationField()
+{
+   reg_f3d_sym<T>::AllocateDeformationField();
+   // The flow field buffers share the geometry of the deformation fields and
+   // are kept across the iterations
+   this->flowFieldImage=nifti_copy_nim_info(this->deformationFieldImage);
+   this->flowFieldImage->data=(void *)calloc(this->flowFieldImage->nvox,
+                                             this->flowFieldImage->nbyper);
+   this->backwardFlowFieldImage=nifti_copy_nim_info(this->backwardDeformationFieldImage);
+   this->backwardFlowFieldImage->data=(void *)calloc(this->backwardFlowFieldImage->nvox,
+                                                     this->backwardFlowFieldImage->nbyper);
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_f3d2<T>::AllocateDeformationField");
+#endif
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+void reg_f3d2<T>::ClearDeformationField()
+{
+   reg_f3d_sym<T>::ClearDeformationField();
+   if(this->flowFieldImage!=NULL)
+   {
+      nifti_image_free(this->flowFieldImage);
+      this->flowFieldImage=NULL;
+   }
+   if(this->backwardFlowFieldImage!=NULL)
+   {
+      nifti_image_free(this->backwardFlowFieldImage);
+      this->backwardFlowFieldImage=NULL;
+   }
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_f3d2<T>::ClearDeformationField");
+#endif
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
 void reg_f3d2<T>::GetDeformationField()
 {
    // By default the number of steps is automatically updated
@@ -95,25 +141,22 @@ void reg_f3d2<T>::GetDeformationField()
       updateStepNumber=false;
 #ifndef NDEBUG
    char text[255];
-   sprintf(text, "Velocity integration forward. Step number update=%i",updateStepNumber);
-   reg_print_msg_debug(text);
-#endif
-   // The forward transformation is computed using the scaling-and-squaring approach
-   reg_spline_getDefFieldFromVelocityGrid(this->controlPointGrid,
-                                          this->deformationFieldImage,
-                                          updateStepNumber
-                                          );
-#ifndef NDEBUG
-   sprintf(text, "Velocity integration backward. Step number update=%i",updateStepNumber);
+   sprintf(text, "Velocity integration forward and backward. Step number update=%i",updateStepNumber);
    reg_print_msg_debug(text);
 #endif
-   // The number of step number is copied over from the forward transformation
-   this->backwardControlPointGrid->intent_p2=this->controlPointGrid->intent_p2;
-   // The backward transformation is computed using the scaling-and-squaring approach
-   reg_spline_getDefFieldFromVelocityGrid(this->backwardControlPointGrid,
-                                          this->backwardDeformationFieldImage,
-                                          false
-                                          );
+   // The forward and backward transformations are computed together using the
+   // scaling-and-squaring approach. The number of step number is copied over
+   // from the forward transformation
+   nifti_image *velocityGrids[2]={this->controlPointGrid,
+                                  this->backwardControlPointGrid};
+   nifti_image *deformationFields[2]={this->deformationFieldImage,
+                                      this->backwardDeformationFieldImage};
+   nifti_image *flowFields[2]={this->flowFieldImage,
+                               this->backwardFlowFieldImage};
+   reg_spline_getDefFieldsFromVelocityGrids(velocityGrids,
+                                            deformationFields,
+                                            flowFields,
+                                            updateStepNumber);
    return;
 }
 /* *************************************************************** */
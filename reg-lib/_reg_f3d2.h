@@ -23,7 +23,12 @@ protected:
    bool BCHUpdate;
    bool useGradientCumulativeExp;
    int BCHUpdateValue;
+   /// Buffers used to exponentiate the forward and backward velocity grids
+   nifti_image *flowFieldImage;
+   nifti_image *backwardFlowFieldImage;
 
+   virtual void AllocateDeformationField();
+   virtual void ClearDeformationField();
    virtual void GetDeformationField();
    virtual void GetInverseConsistencyErrorField(bool forceAll);
    virtual void GetInverseConsistencyGradient();
@@ -1039,7 +1039,9 @@ void reg_f3d_sym<T>::SmoothGradient()
 template <class T>
 void reg_f3d_sym<T>::GetApproximatedGradient()
 {
-   reg_f3d<T>::GetApproximatedGradient();
+   // The forward transformation also contributes to the backward terms,
+   // the objective function is thus fully evaluated
+   reg_f3d<T>::GetApproximatedGradientFullEvaluation();
 
    // Loop over every control points
    T *gridPtr = static_cast<T *>(this->backwardControlPointGrid->data);
@@ -1521,6 +1523,7 @@ void reg_f3d_sym<T>::SetOptimiser()
    if(this->useConjGradient)
       this->optimiser=new reg_conjugateGradient<T>();
    else this->optimiser=new reg_optimiser<T>();
+   this->optimiser->SetLineSearchType(this->lineSearchType);
    this->optimiser->Initialise(this->controlPointGrid->nvox,
                                this->controlPointGrid->nz>1?3:2,
                                this->optimiseX,
@@ -0,0 +1,752 @@
+/**
+ * @file _reg_groupwise.cpp
+ * @brief Groupwise registration class used to create a population template
+ *
+ *  Copyright (c) 2009, University College London. All rights reserved.
+ *  Centre for Medical Image Computing (CMIC)
+ *  See the LICENSE.txt file in the nifty_reg root folder
+ *
+ */
+
+#ifndef _REG_GROUPWISE_CPP
+#define _REG_GROUPWISE_CPP
+
+#include "_reg_groupwise.h"
+#include "_reg_ReadWriteImage.h"
+#include "_reg_maths_eigen.h"
+
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+reg_groupwise<T>::reg_groupwise()
+{
+   this->executableName=(char *)"NiftyReg GROUPWISE";
+   this->inputImageNumber=0;
+   this->inputImageName=NULL; // pointer to external
+   this->inputMaskName=NULL; // pointer to external
+   this->templateImage=NULL;
+   this->templateMask=NULL; // pointer to external
+   this->outputFolder=NULL; // pointer to external
+
+   this->affineIterationNumber=5;
+   this->nonRigidIterationNumber=10;
+   this->concurrentRegistrationNumber=1;
+   this->threadNumberPerRegistration=0;
+
+   this->useSymmetricAffine=true;
+   this->affineLevelNumber=3;
+   this->affineMaxIterationNumber=5;
+   this->nonRigidLevelNumber=3;
+   this->nonRigidMaxIterationNumber=150;
+   this->spacing=-5;
+   this->bendingEnergyWeight=0.001;
+   this->linearEnergyWeight=0.01;
+   this->lnccStandardDeviation=0;
+
+   this->verbose=true;
+
+   this->affineTransformation=NULL;
+   this->affineTransformationDefined=NULL;
+   this->controlPointGrid=NULL;
+
+   this->averageSum=NULL;
+   this->averageCount=NULL;
+#ifndef NDEBUG
+   reg_print_msg_debug("reg_groupwise constructor called");
+#endif
+}
+/* *************************************************************** */
+template <class T>
+reg_groupwise<T>::~reg_groupwise()
+{
+   this->ClearTransformations();
+   if(this->templateImage!=NULL)
+      nifti_image_free(this->templateImage);
+   this->templateImage=NULL;
+   if(this->averageSum!=NULL)
+      free(this->averageSum);
+   this->averageSum=NULL;
+   if(this->averageCount!=NULL)
+      free(this->averageCount);
+   this->averageCount=NULL;
+#ifndef NDEBUG
+   reg_print_msg_debug("reg_groupwise destructor called");
+#endif
+}
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::ClearTransformations()
+{
+   if(this->controlPointGrid!=NULL)
+   {
+      for(size_t i=0; i<this->inputImageNumber; ++i)
+         if(this->controlPointGrid[i]!=NULL)
+            nifti_image_free(this->controlPointGrid[i]);
+      free(this->controlPointGrid);
+   }
+   this->controlPointGrid=NULL;
+   if(this->affineTransformation!=NULL)
+      free(this->affineTransformation);
+   this->affineTransformation=NULL;
+   if(this->affineTransformationDefined!=NULL)
+      free(this->affineTransformationDefined);
+   this->affineTransformationDefined=NULL;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::SetInputImages(size_t n, char **names)
+{
+   this->ClearTransformations();
+   this->inputImageNumber=n;
+   this->inputImageName=names;
+   this->affineTransformation=(mat44 *)malloc(n*sizeof(mat44));
+   this->affineTransformationDefined=(bool *)calloc(n,sizeof(bool));
+   this->controlPointGrid=(nifti_image **)calloc(n,sizeof(nifti_image *));
+}
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::SetInputMasks(char **names)
+{
+   this->inputMaskName=names;
+}
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::SetTemplateImage(nifti_image *image)
+{
+   if(this->templateImage!=NULL)
+      nifti_image_free(this->templateImage);
+   this->templateImage=nifti_copy_nim_info(image);
+   this->templateImage->data=(void *)malloc(image->nvox*image->nbyper);
+   memcpy(this->templateImage->data, image->data, image->nvox*image->nbyper);
+   reg_tools_changeDatatype<T>(this->templateImage);
+}
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::SetTemplateMask(nifti_image *mask)
+{
+   this->templateMask=mask;
+}
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::SetOutputFolder(char *folder)
+{
+   this->outputFolder=folder;
+}
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::SetAffineIterationNumber(unsigned int n)
+{
+   this->affineIterationNumber=n;
+}
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::SetNonRigidIterationNumber(unsigned int n)
+{
+   this->nonRigidIterationNumber=n;
+}
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::SetConcurrentRegistrationNumber(unsigned int n)
+{
+   this->concurrentRegistrationNumber=n>0?n:1;
+}
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::SetThreadNumberPerRegistration(unsigned int n)
+{
+   this->threadNumberPerRegistration=n;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::CheckParameters()
+{
+   if(this->inputImageNumber<2)
+   {
+      reg_print_fct_error("reg_groupwise<T>::CheckParameters()");
+      reg_print_msg_error("At least two input images are required");
+      reg_exit();
+   }
+   if(this->templateImage==NULL)
+   {
+      reg_print_fct_error("reg_groupwise<T>::CheckParameters()");
+      reg_print_msg_error("The template image is not defined");
+      reg_exit();
+   }
+   if(this->templateMask!=NULL &&
+         (this->templateMask->nx!=this->templateImage->nx ||
+          this->templateMask->ny!=this->templateImage->ny ||
+          this->templateMask->nz!=this->templateImage->nz))
+   {
+      reg_print_fct_error("reg_groupwise<T>::CheckParameters()");
+      reg_print_msg_error("The template image and its mask have different dimensions");
+      reg_exit();
+   }
+   if(this->threadNumberPerRegistration==0)
+   {
+      this->threadNumberPerRegistration=1;
+#if defined (_OPENMP)
+      this->threadNumberPerRegistration=omp_get_max_threads()/this->concurrentRegistrationNumber;
+      if(this->threadNumberPerRegistration<1)
+         this->threadNumberPerRegistration=1;
+#endif
+   }
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+char *reg_groupwise<T>::GetSubjectName(size_t i, char *name)
+{
+   // The path and the extension of the input image are removed
+   const char *fileName=this->inputImageName[i];
+   const char *slash=strrchr(fileName,'/');
+   if(slash!=NULL) fileName=slash+1;
+   strcpy(name,fileName);
+   const char *extensions[5]={".gz",".nii",".hdr",".img",".nrrd"};
+   for(int e=0; e<5; ++e)
+   {
+      size_t length=strlen(name);
+      size_t extLength=strlen(extensions[e]);
+      if(length>extLength && strcmp(&name[length-extLength],extensions[e])==0)
+         name[length-extLength]='\0';
+   }
+   return name;
+}
+/* *************************************************************** */
+template <class T>
+char *reg_groupwise<T>::GetTransformationFileName(size_t i, bool affine, unsigned int it, char *fileName)
+{
+   char name[1024];
+   this->GetSubjectName(i,name);
+   if(affine)
+      sprintf(fileName,"%s/aff_mat_%s_it%u.txt",this->outputFolder,name,it);
+   else sprintf(fileName,"%s/nrr_cpp_%s_it%u.nii.gz",this->outputFolder,name,it);
+   return fileName;
+}
+/* *************************************************************** */
+template <class T>
+char *reg_groupwise<T>::GetTemplateFileName(bool affine, unsigned int it, char *fileName)
+{
+   if(affine)
+      sprintf(fileName,"%s/average_affine_it_%u.nii.gz",this->outputFolder,it);
+   else sprintf(fileName,"%s/average_nonrigid_it_%u.nii.gz",this->outputFolder,it);
+   return fileName;
+}
+/* *************************************************************** */
+template <class T>
+bool reg_groupwise<T>::ResumeIteration(bool affine, unsigned int it)
+{
+   if(this->outputFolder==NULL)
+      return false;
+   // An iteration is complete when its template and all the transformations
+   // have been saved
+   char fileName[2048];
+   FILE *file=fopen(this->GetTemplateFileName(affine,it,fileName),"r");
+   if(file==NULL)
+      return false;
+   fclose(file);
+   for(size_t i=0; i<this->inputImageNumber; ++i)
+   {
+      file=fopen(this->GetTransformationFileName(i,affine,it,fileName),"r");
+      if(file==NULL)
+         return false;
+      fclose(file);
+   }
+   // The template and the transformations are loaded
+   nifti_image *savedTemplate=reg_io_ReadImageFile(this->GetTemplateFileName(affine,it,fileName));
+   if(savedTemplate==NULL)
+      return false;
+   reg_tools_changeDatatype<T>(savedTemplate);
+   nifti_image_free(this->templateImage);
+   this->templateImage=savedTemplate;
+   for(size_t i=0; i<this->inputImageNumber; ++i)
+   {
+      this->GetTransformationFileName(i,affine,it,fileName);
+      if(affine)
+      {
+         reg_tool_ReadAffineFile(&this->affineTransformation[i],fileName);
+         this->affineTransformationDefined[i]=true;
+      }
+      else
+      {
+         if(this->controlPointGrid[i]!=NULL)
+            nifti_image_free(this->controlPointGrid[i]);
+         this->controlPointGrid[i]=reg_io_ReadImageFile(fileName);
+         reg_tools_changeDatatype<T>(this->controlPointGrid[i]);
+      }
+   }
+   if(this->verbose)
+   {
+      // The message holds "Resumed from " and a file name of up to 2047 characters
+      char text[2061];
+      sprintf(text,"Resumed from %s",this->GetTemplateFileName(affine,it,fileName));
+      reg_print_info(this->executableName, text);
+   }
+   return true;
+}
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::SaveIteration(bool affine, unsigned int it)
+{
+   // The transformations have been saved as they were estimated
+   if(this->outputFolder==NULL)
+      return;
+   char fileName[2048];
+   reg_io_WriteImageFile(this->templateImage,this->GetTemplateFileName(affine,it,fileName));
+}
+/* *************************************************************** */
+template <class T>
+nifti_image *reg_groupwise<T>::ReadSubject(size_t i)
+{
+   nifti_image *image=reg_io_ReadImageFile(this->inputImageName[i]);
+   if(image==NULL)
+   {
+      reg_print_fct_error("reg_groupwise<T>::ReadSubject()");
+      reg_print_msg_error("Error when reading the input image:");
+      reg_print_msg_error(this->inputImageName[i]);
+      reg_exit();
+   }
+   reg_tools_changeDatatype<T>(image);
+   return image;
+}
+/* *************************************************************** */
+template <class T>
+nifti_image *reg_groupwise<T>::CreateDeformationField()
+{
+   nifti_image *deformationField=nifti_copy_nim_info(this->templateImage);
+   deformationField->ndim=deformationField->dim[0]=5;
+   deformationField->nt=deformationField->dim[4]=1;
+   deformationField->nu=deformationField->dim[5]=deformationField->nz>1?3:2;
+   deformationField->nvox=(size_t)deformationField->nx *
+         deformationField->ny * deformationField->nz *
+         deformationField->nt * deformationField->nu;
+   deformationField->nbyper=sizeof(T);
+   deformationField->datatype=sizeof(T)==sizeof(double)?NIFTI_TYPE_FLOAT64:NIFTI_TYPE_FLOAT32;
+   deformationField->intent_code=NIFTI_INTENT_VECTOR;
+   memset(deformationField->intent_name, 0, 16);
+   strcpy(deformationField->intent_name,"NREG_TRANS");
+   deformationField->scl_slope=1.f;
+   deformationField->scl_inter=0.f;
+   deformationField->intent_p1=DEF_FIELD;
+   deformationField->data=(void *)calloc(deformationField->nvox, deformationField->nbyper);
+   return deformationField;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::RegisterSubjectAffine(size_t i, nifti_image *subject, bool rigidOnly)
+{
+   nifti_image *subjectMask=NULL;
+   if(this->inputMaskName!=NULL)
+      subjectMask=reg_io_ReadImageFile(this->inputMaskName[i]);
+
+   reg_aladin<T> *REG=NULL;
+   if(this->useSymmetricAffine)
+      REG=new reg_aladin_sym<T>;
+   else REG=new reg_aladin<T>;
+   REG->SetInputReference(this->templateImage);
+   REG->SetInputFloating(subject);
+   if(this->templateMask!=NULL)
+      REG->SetInputMask(this->templateMask);
+   if(subjectMask!=NULL)
+      REG->SetInputFloatingMask(subjectMask);
+   REG->SetNumberOfLevels(this->affineLevelNumber);
+   REG->SetLevelsToPerform(this->affineLevelNumber);
+   REG->SetMaxIterations(this->affineMaxIterationNumber);
+   // The first iteration is rigid, the following ones start from the
+   // previous transformation
+   if(rigidOnly)
+   {
+      REG->SetPerformRigid(true);
+      REG->SetPerformAffine(false);
+   }
+   else if(this->affineTransformationDefined[i])
+      REG->SetInputTransform(&this->affineTransformation[i]);
+   REG->SetVerbose(this->verbose && this->concurrentRegistrationNumber==1);
+   REG->Run();
+   this->affineTransformation[i]=*REG->GetTransformationMatrix();
+   this->affineTransformationDefined[i]=true;
+   delete REG;
+   if(subjectMask!=NULL)
+      nifti_image_free(subjectMask);
+}
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::RegisterSubjectNonRigid(size_t i, nifti_image *subject)
+{
+   reg_f3d<T> *REG=new reg_f3d<T>(this->templateImage->nt,subject->nt);
+   REG->SetReferenceImage(this->templateImage);
+   REG->SetFloatingImage(subject);
+   if(this->templateMask!=NULL)
+      REG->SetReferenceMask(this->templateMask);
+   // Every iteration starts from the final affine transformation
+   if(this->affineTransformationDefined[i])
+      REG->SetAffineTransformation(&this->affineTransformation[i]);
+   REG->SetLevelNumber(this->nonRigidLevelNumber);
+   REG->SetLevelToPerform(this->nonRigidLevelNumber);
+   REG->SetMaximalIterationNumber(this->nonRigidMaxIterationNumber);
+   REG->SetSpacing(0,this->spacing);
+   REG->SetBendingEnergyWeight(this->bendingEnergyWeight);
+   REG->SetLinearEnergyWeight(this->linearEnergyWeight);
+   if(this->lnccStandardDeviation!=0)
+   {
+      for(int t=0; t<this->templateImage->nt; ++t)
+         REG->UseLNCC(t,this->lnccStandardDeviation);
+   }
+   if(!this->verbose || this->concurrentRegistrationNumber>1)
+      REG->DoNotPrintOutInformation();
+   REG->Run();
+   if(this->controlPointGrid[i]!=NULL)
+      nifti_image_free(this->controlPointGrid[i]);
+   this->controlPointGrid[i]=REG->GetControlPointPositionImage();
+   delete REG;
+}
+/* *************************************************************** */
+/// @brief Save an affine matrix with the nine significant digits that are
+/// required for its float values to be read back exactly. The files written
+/// by reg_tool_WriteAffineFile only keep seven
+void reg_groupwise_writeAffineFile(mat44 *mat,
+                                   const char *fileName)
+{
+   FILE *affineFile=fopen(fileName, "w");
+   if(affineFile==NULL)
+   {
+      reg_print_fct_error("reg_groupwise_writeAffineFile");
+      reg_print_msg_error("The affine file can not be written");
+      reg_exit();
+   }
+   for(int i=0; i<4; i++)
+      fprintf(affineFile, "%.9g %.9g %.9g %.9g\n",
+              mat->m[i][0], mat->m[i][1], mat->m[i][2], mat->m[i][3]);
+   fclose(affineFile);
+}
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::RegisterAllSubjects(bool affine, unsigned int it, bool addToAverage)
+{
+   if(addToAverage)
+      this->InitialiseAverage();
+
+   reg_groupwise<T> *groupwise=this;
+   const int subjectNumber=(int)this->inputImageNumber;
+   const int concurrentNumber=(int)this->concurrentRegistrationNumber;
+   const int threadNumber=(int)this->threadNumberPerRegistration;
+   const bool saveTransformation=this->outputFolder!=NULL;
+   int i;
+   // The subjects are distributed one at a time to the first available
+   // thread as the registration durations vary between subjects
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) schedule(dynamic,1) num_threads(concurrentNumber) \
+   shared(groupwise, subjectNumber, concurrentNumber, threadNumber, saveTransformation, \
+   affine, it, addToAverage) \
+   private(i)
+#endif
+   for(i=0; i<subjectNumber; ++i)
+   {
+#if defined (_OPENMP)
+      omp_set_num_threads(threadNumber);
+#endif
+      char fileName[2048];
+      bool transformationSaved=false;
+      if(saveTransformation)
+      {
+         FILE *file=fopen(groupwise->GetTransformationFileName(i,affine,it,fileName),"r");
+         if(file!=NULL)
+         {
+            fclose(file);
+            transformationSaved=true;
+         }
+      }
+      nifti_image *subject=NULL;
+      if(transformationSaved)
+      {
+         // The registration has been performed by a previous run
+         if(affine)
+         {
+            reg_tool_ReadAffineFile(&groupwise->affineTransformation[i],fileName);
+            groupwise->affineTransformationDefined[i]=true;
+         }
+         else
+         {
+            if(groupwise->controlPointGrid[i]!=NULL)
+               nifti_image_free(groupwise->controlPointGrid[i]);
+            groupwise->controlPointGrid[i]=reg_io_ReadImageFile(fileName);
+            reg_tools_changeDatatype<T>(groupwise->controlPointGrid[i]);
+         }
+      }
+      else
+      {
+         if(groupwise->verbose)
+         {
+            char text[2048];
+            sprintf(text,"%s registration %u - %s",affine?"Affine":"Non-rigid",it,
+                    groupwise->inputImageName[i]);
+            reg_print_info(groupwise->executableName, text);
+         }
+         subject=groupwise->ReadSubject(i);
+         if(affine)
+            groupwise->RegisterSubjectAffine(i,subject,it==1);
+         else groupwise->RegisterSubjectNonRigid(i,subject);
+         // The matrices are saved without loss so that a resumed run uses
+         // the same values as an uninterrupted one
+         if(saveTransformation)
+         {
+            if(affine)
+               reg_groupwise_writeAffineFile(&groupwise->affineTransformation[i],fileName);
+            else reg_io_WriteImageFile(groupwise->controlPointGrid[i],fileName);
+         }
+      }
+      if(addToAverage)
+      {
+         // The subject is resampled while it is still in memory
+         if(subject==NULL)
+            subject=groupwise->ReadSubject(i);
+         nifti_image *deformationField=groupwise->CreateDeformationField();
+         groupwise->GetSubjectDeformationField(i,deformationField,affine,NULL,NULL);
+         nifti_image *warped=nifti_copy_nim_info(groupwise->templateImage);
+         warped->data=(void *)malloc(warped->nvox*warped->nbyper);
+         reg_resampleImage(subject,warped,deformationField,NULL,3,
+                           std::numeric_limits<float>::quiet_NaN());
+         groupwise->AddToAverage(warped);
+         nifti_image_free(warped);
+         nifti_image_free(deformationField);
+      }
+      if(subject!=NULL)
+         nifti_image_free(subject);
+   }
+
+   if(addToAverage)
+      this->FinaliseAverage();
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::GetSubjectDeformationField(size_t i,
+                                                  nifti_image *deformationField,
+                                                  bool affine,
+                                                  mat44 *demeanMatrix,
+                                                  nifti_image *demeanField)
+{
+   if(affine)
+   {
+      mat44 affineTransformation=this->affineTransformation[i];
+      if(demeanMatrix!=NULL)
+         affineTransformation=reg_mat44_mul(demeanMatrix,&affineTransformation);
+      reg_affine_getDeformationField(&affineTransformation,deformationField);
+   }
+   else
+   {
+      reg_spline_getDeformationField(this->controlPointGrid[i],deformationField,NULL,false,true);
+      if(demeanField!=NULL)
+         reg_tools_substractImageToImage(deformationField,demeanField,deformationField);
+   }
+}
+/* *************************************************************** */
+template <class T>
+mat44 reg_groupwise<T>::GetAffineDemeanMatrix()
+{
+   // The rigid components are removed and the average of the remaining
+   // affine matrices is computed in the log-Euclidean space
+   mat44 demeanMatrix, tempMatrix;
+   memset(&demeanMatrix,0,sizeof(mat44));
+   for(size_t i=0; i<this->inputImageNumber; ++i)
+   {
+      float qb,qc,qd,qx,qy,qz,qfac;
+      nifti_mat44_to_quatern(this->affineTransformation[i],&qb,&qc,&qd,&qx,&qy,&qz,NULL,NULL,NULL,&qfac);
+      tempMatrix=nifti_quatern_to_mat44(qb,qc,qd,qx,qy,qz,1.f,1.f,1.f,qfac);
+      tempMatrix=nifti_mat44_inverse(tempMatrix);
+      tempMatrix=reg_mat44_mul(&tempMatrix,&this->affineTransformation[i]);
+      tempMatrix=reg_mat44_logm(&tempMatrix);
+      demeanMatrix=demeanMatrix+tempMatrix;
+   }
+   demeanMatrix=reg_mat44_mul(&demeanMatrix,1.f/(float)this->inputImageNumber);
+   demeanMatrix=reg_mat44_expm(&demeanMatrix);
+   return nifti_mat44_inverse(demeanMatrix);
+}
+/* *************************************************************** */
+template <class T>
+nifti_image *reg_groupwise<T>::GetNonRigidDemeanField()
+{
+   // Average of the non-rigid displacements, once the affine component has
+   // been removed
+   nifti_image *demeanField=this->CreateDeformationField();
+   demeanField->intent_p1=DISP_FIELD;
+   nifti_image *deformationField=this->CreateDeformationField();
+   nifti_image *affineField=this->CreateDeformationField();
+   for(size_t i=0; i<this->inputImageNumber; ++i)
+   {
+      this->GetSubjectDeformationField(i,deformationField,false,NULL,NULL);
+      if(this->affineTransformationDefined[i])
+      {
+         reg_affine_getDeformationField(&this->affineTransformation[i],affineField);
+         reg_tools_substractImageToImage(deformationField,affineField,deformationField);
+      }
+      else
+      {
+         deformationField->intent_p1=DEF_FIELD;
+         reg_getDisplacementFromDeformation(deformationField);
+      }
+      reg_tools_addImageToImage(demeanField,deformationField,demeanField);
+      deformationField->intent_p1=DEF_FIELD;
+   }
+   reg_tools_divideValueToImage(demeanField,demeanField,(float)this->inputImageNumber);
+   nifti_image_free(affineField);
+   nifti_image_free(deformationField);
+   return demeanField;
+}
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::AverageAllSubjects(bool affine,
+                                          mat44 *demeanMatrix,
+                                          nifti_image *demeanField)
+{
+   this->InitialiseAverage();
+
+   reg_groupwise<T> *groupwise=this;
+   const int subjectNumber=(int)this->inputImageNumber;
+   const int concurrentNumber=(int)this->concurrentRegistrationNumber;
+   const int threadNumber=(int)this->threadNumberPerRegistration;
+   int i;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) schedule(dynamic,1) num_threads(concurrentNumber) \
+   shared(groupwise, subjectNumber, concurrentNumber, threadNumber, affine, \
+   demeanMatrix, demeanField) \
+   private(i)
+#endif
+   for(i=0; i<subjectNumber; ++i)
+   {
+#if defined (_OPENMP)
+      omp_set_num_threads(threadNumber);
+#endif
+      nifti_image *subject=groupwise->ReadSubject(i);
+      nifti_image *deformationField=groupwise->CreateDeformationField();
+      groupwise->GetSubjectDeformationField(i,deformationField,affine,demeanMatrix,demeanField);
+      nifti_image *warped=nifti_copy_nim_info(groupwise->templateImage);
+      warped->data=(void *)malloc(warped->nvox*warped->nbyper);
+      reg_resampleImage(subject,warped,deformationField,NULL,3,
+                        std::numeric_limits<float>::quiet_NaN());
+      groupwise->AddToAverage(warped);
+      nifti_image_free(warped);
+      nifti_image_free(deformationField);
+      nifti_image_free(subject);
+   }
+
+   this->FinaliseAverage();
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::InitialiseAverage()
+{
+   if(this->averageSum!=NULL)
+      free(this->averageSum);
+   if(this->averageCount!=NULL)
+      free(this->averageCount);
+   this->averageSum=(double *)calloc(this->templateImage->nvox,sizeof(double));
+   this->averageCount=(unsigned int *)calloc(this->templateImage->nvox,sizeof(unsigned int));
+}
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::AddToAverage(nifti_image *warped)
+{
+   // Sum and number of the defined values. The current template is left
+   // untouched as other registrations may still be using it. The float values
+   // are summed in double, which is exact unless the values of a voxel span
+   // many orders of magnitude, so that the template does not depend on the
+   // order in which the registrations end
+   T *warpedPtr=static_cast<T *>(warped->data);
+   double *sumPtr=this->averageSum;
+   unsigned int *countPtr=this->averageCount;
+   const size_t voxelNumber=this->templateImage->nvox;
+#if defined (_OPENMP)
+#pragma omp critical(reg_groupwise_average)
+#endif
+   {
+      for(size_t index=0; index<voxelNumber; ++index)
+      {
+         double value=(double)warpedPtr[index];
+         if(value==value)
+         {
+            ++countPtr[index];
+            sumPtr[index]+=value;
+         }
+      }
+   }
+}
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::FinaliseAverage()
+{
+   T *templatePtr=static_cast<T *>(this->templateImage->data);
+   for(size_t index=0; index<this->templateImage->nvox; ++index)
+   {
+      templatePtr[index]=this->averageCount[index]>0?
+               (T)(this->averageSum[index]/(double)this->averageCount[index]):
+               std::numeric_limits<T>::quiet_NaN();
+   }
+   this->templateImage->scl_slope=1.f;
+   this->templateImage->scl_inter=0.f;
+   free(this->averageSum);
+   this->averageSum=NULL;
+   free(this->averageCount);
+   this->averageCount=NULL;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+void reg_groupwise<T>::Run()
+{
+   this->CheckParameters();
+#if defined (_OPENMP)
+   if(this->concurrentRegistrationNumber>1)
+      omp_set_max_active_levels(2);
+#endif
+   if(this->verbose)
+   {
+      char text[255];
+      sprintf(text,"%lu input images - %u affine and %u non-rigid iterations",
+              (unsigned long)this->inputImageNumber,this->affineIterationNumber,
+              this->nonRigidIterationNumber);
+      reg_print_info(this->executableName, text);
+      sprintf(text,"%u concurrent registration(s) with %u thread(s) each",
+              this->concurrentRegistrationNumber,this->threadNumberPerRegistration);
+      reg_print_info(this->executableName, text);
+   }
+
+   // Affine iterations, the last one is not demeaned
+   for(unsigned int it=1; it<=this->affineIterationNumber; ++it)
+   {
+      if(this->ResumeIteration(true,it))
+         continue;
+      bool lastIteration=it==this->affineIterationNumber;
+      this->RegisterAllSubjects(true,it,lastIteration);
+      if(!lastIteration)
+      {
+         mat44 demeanMatrix=this->GetAffineDemeanMatrix();
+         this->AverageAllSubjects(true,&demeanMatrix,NULL);
+      }
+      this->SaveIteration(true,it);
+   }
+
+   // Non-rigid iterations, the last one is not demeaned
+   for(unsigned int it=1; it<=this->nonRigidIterationNumber; ++it)
+   {
+      if(this->ResumeIteration(false,it))
+         continue;
+      bool lastIteration=it==this->nonRigidIterationNumber;
+      this->RegisterAllSubjects(false,it,lastIteration);
+      if(!lastIteration)
+      {
+         nifti_image *demeanField=this->GetNonRigidDemeanField();
+         this->AverageAllSubjects(false,NULL,demeanField);
+         nifti_image_free(demeanField);
+      }
+      this->SaveIteration(false,it);
+   }
+}
+/* *************************************************************** */
+/* *************************************************************** */
+
+template class reg_groupwise<float>;
+#endif // _REG_GROUPWISE_CPP
@@ -0,0 +1,177 @@
+/**
+ * @file _reg_groupwise.h
+ * @brief Groupwise registration class used to create a population template
+ *
+ *  Copyright (c) 2009, University College London. All rights reserved.
+ *  Centre for Medical Image Computing (CMIC)
+ *  See the LICENSE.txt file in the nifty_reg root folder
+ *
+ */
+
+#ifndef _REG_GROUPWISE_H
+#define _REG_GROUPWISE_H
+
+#include "_reg_aladin_sym.h"
+#include "_reg_f3d.h"
+#include "_reg_ReadWriteMatrix.h"
+
+/** @brief Groupwise registration class that iteratively registers all the
+ * input images to a template and replaces the template by the average of the
+ * resampled images. The first affine iteration is rigid. The affine and the
+ * non-rigid transformations are demeaned before averaging, except during the
+ * last iteration of each stage.
+ *
+ * The template is kept in memory and the input images are only read when
+ * they are registered or resampled. Each resampled image is added to a
+ * voxel-wise sum and count as soon as it is available and is then freed.
+ * Several registrations run concurrently, each one using its own number of
+ * threads.
+ *
+ * When an output folder is specified, the per-subject transformations and
+ * the template are saved after every iteration, and a new run resumes from
+ * the last complete iteration found in the folder.
+ */
+template <class T>
+class reg_groupwise
+{
+protected:
+   char *executableName;
+
+   size_t inputImageNumber;
+   char **inputImageName; // pointer to external
+   char **inputMaskName; // pointer to external
+   nifti_image *templateImage;
+   nifti_image *templateMask; // pointer to external
+   char *outputFolder; // pointer to external
+
+   unsigned int affineIterationNumber;
+   unsigned int nonRigidIterationNumber;
+   unsigned int concurrentRegistrationNumber;
+   unsigned int threadNumberPerRegistration;
+
+   // Affine registration parameters
+   bool useSymmetricAffine;
+   unsigned int affineLevelNumber;
+   unsigned int affineMaxIterationNumber;
+   // Non-rigid registration parameters
+   unsigned int nonRigidLevelNumber;
+   unsigned int nonRigidMaxIterationNumber;
+   T spacing;
+   T bendingEnergyWeight;
+   T linearEnergyWeight;
+   T lnccStandardDeviation;
+
+   bool verbose;
+
+   mat44 *affineTransformation;
+   bool *affineTransformationDefined;
+   nifti_image **controlPointGrid;
+
+   // Sum and number of the defined values of the resampled images
+   double *averageSum;
+   unsigned int *averageCount;
+
+   virtual void CheckParameters();
+   virtual void ClearTransformations();
+   virtual char *GetSubjectName(size_t, char *);
+   virtual char *GetTransformationFileName(size_t, bool, unsigned int, char *);
+   virtual char *GetTemplateFileName(bool, unsigned int, char *);
+   virtual bool ResumeIteration(bool, unsigned int);
+   virtual void SaveIteration(bool, unsigned int);
+   virtual nifti_image *ReadSubject(size_t);
+   virtual nifti_image *CreateDeformationField();
+
+   virtual void RegisterSubjectAffine(size_t, nifti_image *, bool);
+   virtual void RegisterSubjectNonRigid(size_t, nifti_image *);
+   virtual void RegisterAllSubjects(bool, unsigned int, bool);
+   virtual void GetSubjectDeformationField(size_t, nifti_image *, bool, mat44 *, nifti_image *);
+   virtual mat44 GetAffineDemeanMatrix();
+   virtual nifti_image *GetNonRigidDemeanField();
+   virtual void AverageAllSubjects(bool, mat44 *, nifti_image *);
+
+   virtual void InitialiseAverage();
+   virtual void AddToAverage(nifti_image *);
+   virtual void FinaliseAverage();
+
+public:
+   reg_groupwise();
+   virtual ~reg_groupwise();
+
+   /// @brief Define the input images, their names are not copied
+   void SetInputImages(size_t, char **);
+   /// @brief Define one mask per input image, their names are not copied
+   void SetInputMasks(char **);
+   /// @brief Define the template used to initialise the registrations. The
+   /// image is copied
+   void SetTemplateImage(nifti_image *);
+   void SetTemplateMask(nifti_image *);
+   /// @brief Folder where the iterations are saved and resumed from
+   void SetOutputFolder(char *);
+   void SetAffineIterationNumber(unsigned int);
+   void SetNonRigidIterationNumber(unsigned int);
+   void SetConcurrentRegistrationNumber(unsigned int);
+   void SetThreadNumberPerRegistration(unsigned int);
+
+   void DoNotUseSymmetricAffine()
+   {
+      this->useSymmetricAffine=false;
+   }
+   void SetAffineLevelNumber(unsigned int l)
+   {
+      this->affineLevelNumber=l;
+   }
+   void SetAffineMaxIterationNumber(unsigned int i)
+   {
+      this->affineMaxIterationNumber=i;
+   }
+   void SetNonRigidLevelNumber(unsigned int l)
+   {
+      this->nonRigidLevelNumber=l;
+   }
+   void SetNonRigidMaxIterationNumber(unsigned int i)
+   {
+      this->nonRigidMaxIterationNumber=i;
+   }
+   void SetSpacing(T s)
+   {
+      this->spacing=s;
+   }
+   void SetBendingEnergyWeight(T w)
+   {
+      this->bendingEnergyWeight=w;
+   }
+   void SetLinearEnergyWeight(T w)
+   {
+      this->linearEnergyWeight=w;
+   }
+   /// @brief Use the LNCC instead of the NMI for the non-rigid registrations
+   void UseLNCC(T sd)
+   {
+      this->lnccStandardDeviation=sd;
+   }
+   void DoNotPrintOutInformation()
+   {
+      this->verbose=false;
+   }
+
+   virtual void Run();
+
+   /// @brief Return the current template, the image is not copied
+   nifti_image *GetTemplateImage()
+   {
+      return this->templateImage;
+   }
+   /// @brief Return the latest affine transformation of an input image
+   mat44 *GetAffineTransformation(size_t i)
+   {
+      return this->affineTransformationDefined[i]?&this->affineTransformation[i]:NULL;
+   }
+   /// @brief Return the latest control point grid of an input image, the
+   /// image is not copied
+   nifti_image *GetControlPointGrid(size_t i)
+   {
+      return this->controlPointGrid[i];
+   }
+};
+
+#endif // _REG_GROUPWISE_H
@@ -115,6 +115,8 @@ void ClAladinContent::allocateClPtrs()
 		this->warpedImageClmem = clCreateBuffer(this->clContext, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, this->CurrentWarped->nvox * sizeof(float), this->CurrentWarped->data, &this->errNum);
 		this->sContext->checkErrNum(this->errNum, "ClAladinContent::allocateClPtrs failed to allocate memory (warpedImageClmem): ");
 	}
+	if (this->CurrentReference != NULL && this->CurrentDeformationField == NULL)
+		this->AllocateDeformationField(this->bytes);
 	if (this->CurrentDeformationField != NULL)
 	{
 		this->deformationFieldClmem = clCreateBuffer(this->clContext, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(float) * this->CurrentDeformationField->nvox, this->CurrentDeformationField->data, &this->errNum);
@@ -0,0 +1,12 @@
+#include "CPUFastBlockMatchingKernel.h"
+
+CPUFastBlockMatchingKernel::CPUFastBlockMatchingKernel(AladinContent *con, std::string name) : FastBlockMatchingKernel(name) {
+    reference = con->getCurrentReference();
+    warped = con->getCurrentWarped();
+    params = con->getBlockMatchingParams();
+    mask = con->getCurrentReferenceMask();
+}
+
+void CPUFastBlockMatchingKernel::calculate() {
+    block_matching_method_fast(this->reference, this->warped, this->params, this->mask);
+}
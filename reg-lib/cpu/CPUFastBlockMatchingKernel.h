@@ -0,0 +1,23 @@
+#ifndef CPUFASTBLOCKMATCHINGKERNEL_H
+#define CPUFASTBLOCKMATCHINGKERNEL_H
+
+#include "FastBlockMatchingKernel.h"
+#include "_reg_blockMatching.h"
+#include "nifti1_io.h"
+#include "AladinContent.h"
+
+class CPUFastBlockMatchingKernel : public FastBlockMatchingKernel {
+public:
+
+    CPUFastBlockMatchingKernel(AladinContent *con, std::string name);
+
+    void calculate();
+
+    nifti_image *reference;
+    nifti_image *warped;
+    _reg_blockMatchingParam* params;
+    int *mask;
+
+};
+
+#endif // CPUFASTBLOCKMATCHINGKERNEL_H
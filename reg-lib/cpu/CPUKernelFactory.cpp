@@ -1,7 +1,9 @@
 #include "CPUKernelFactory.h"
 #include "CPUAffineDeformationFieldKernel.h"
+#include "CPUAffineResampleImageKernel.h"
 #include "CPUConvolutionKernel.h"
 #include "CPUBlockMatchingKernel.h"
+#include "CPUFastBlockMatchingKernel.h"
 #include "CPUResampleImageKernel.h"
 #include "CPUOptimiseKernel.h"
 //
@@ -12,7 +14,9 @@ Kernel *CPUKernelFactory::produceKernel(std::string name,  AladinContent *con) c
 	if (name == AffineDeformationFieldKernel::getName()) return new CPUAffineDeformationFieldKernel(con, name);
 	else if (name == ConvolutionKernel::getName()) return new CPUConvolutionKernel(name);
 	else if (name == BlockMatchingKernel::getName()) return new CPUBlockMatchingKernel(con, name);
+	else if (name == FastBlockMatchingKernel::getName()) return new CPUFastBlockMatchingKernel(con, name);
 	else if (name == ResampleImageKernel::getName()) return new CPUResampleImageKernel(con, name);
+	else if (name == AffineResampleImageKernel::getName()) return new CPUAffineResampleImageKernel(con, name);
 	else if (name == OptimiseKernel::getName()) return new CPUOptimiseKernel(con, name);
 	else return NULL;
 }
@@ -468,28 +468,38 @@ void block_matching_method3D(nifti_image * reference,
    DTYPE voxelNumber, localCC, referenceTemp, warpedTemp;
    float bestDisplacement[3], referencePosition_temp[3], tempPosition[3];
    size_t referenceIndex, warpedIndex, blockIndex, tid = 0;
+   int activeIndex;
+
+   // The list of active blocks is extracted so that they can be distributed
+   // dynamically across the threads
+   size_t totalBlockNumber = (size_t)params->blockNumber[0] *
+         params->blockNumber[1] * params->blockNumber[2];
+   int activeBlockNumber = 0;
+   int *activeBlockIndex = (int *)malloc(totalBlockNumber * sizeof(int));
+   for (blockIndex = 0; blockIndex < totalBlockNumber; ++blockIndex) {
+      if (params->totalBlock[blockIndex] > -1)
+         activeBlockIndex[activeBlockNumber++] = (int)blockIndex;
+   }
 
+   // Every thread uses its own workspace, allocated on the heap
+   int threadNumber = 1;
 #if defined (_OPENMP)
-   int threadNumber = omp_get_max_threads();
-   if (threadNumber > 16)
-      omp_set_num_threads(16);
-   DTYPE referenceValues[16][BLOCK_3D_SIZE];
-   DTYPE warpedValues[16][BLOCK_3D_SIZE];
-   bool referenceOverlap[16][BLOCK_3D_SIZE];
-   bool warpedOverlap[16][BLOCK_3D_SIZE];
-#else
-   DTYPE referenceValues[1][BLOCK_3D_SIZE];
-   DTYPE warpedValues[1][BLOCK_3D_SIZE];
-   bool referenceOverlap[1][BLOCK_3D_SIZE];
-   bool warpedOverlap[1][BLOCK_3D_SIZE];
+   threadNumber = omp_get_max_threads();
 #endif
+   DTYPE *referenceValuesArray = (DTYPE *)malloc(threadNumber * BLOCK_3D_SIZE * sizeof(DTYPE));
+   DTYPE *warpedValuesArray = (DTYPE *)malloc(threadNumber * BLOCK_3D_SIZE * sizeof(DTYPE));
+   bool *referenceOverlapArray = (bool *)malloc(threadNumber * BLOCK_3D_SIZE * sizeof(bool));
+   bool *warpedOverlapArray = (bool *)malloc(threadNumber * BLOCK_3D_SIZE * sizeof(bool));
+   DTYPE *referenceValues, *warpedValues;
+   bool *referenceOverlap, *warpedOverlap;
 
    int currentDefinedActiveBlockNumber = 0;
 #if defined (_OPENMP)
-#pragma omp parallel for default(none) \
+#pragma omp parallel for default(none) schedule(dynamic) \
    shared(params, reference, warped, referencePtr, warpedPtr, mask, referenceMatrix_xyz, \
-   referenceOverlap, warpedOverlap, referenceValues, warpedValues) \
-   private(i, j, k, l, m, n, x, y, z, blockIndex, referenceIndex, \
+   activeBlockNumber, activeBlockIndex, referenceOverlapArray, warpedOverlapArray, \
+   referenceValuesArray, warpedValuesArray) \
+   private(i, j, k, l, m, n, x, y, z, activeIndex, blockIndex, referenceIndex, \
    index, tid, referencePtr_Z, referencePtr_XYZ, warpedPtr_Z, warpedPtr_XYZ, \
    maskPtr_Z, maskPtr_XYZ, value, bestCC, bestDisplacement, \
    referenceIndex_start_x, referenceIndex_start_y, referenceIndex_start_z, \
@@ -497,176 +507,179 @@ void block_matching_method3D(nifti_image * reference,
    warpedIndex_start_x, warpedIndex_start_y, warpedIndex_start_z, \
    warpedIndex_end_x, warpedIndex_end_y, warpedIndex_end_z, \
    warpedIndex, referencePosition_temp, tempPosition, referenceTemp, warpedTemp, \
-   referenceMean, referenceVar, warpedMean, warpedVar, voxelNumber,localCC) \
+   referenceMean, referenceVar, warpedMean, warpedVar, voxelNumber, localCC, \
+   referenceValues, warpedValues, referenceOverlap, warpedOverlap) \
    reduction(+:currentDefinedActiveBlockNumber)
 #endif
-   for (k = 0; k < (int)params->blockNumber[2]; k++) {
+   for (activeIndex = 0; activeIndex < activeBlockNumber; ++activeIndex) {
 #if defined (_OPENMP)
       tid = omp_get_thread_num();
 #endif
-      blockIndex = k * params->blockNumber[0] * params->blockNumber[1];
+      referenceValues = &referenceValuesArray[tid * BLOCK_3D_SIZE];
+      warpedValues = &warpedValuesArray[tid * BLOCK_3D_SIZE];
+      referenceOverlap = &referenceOverlapArray[tid * BLOCK_3D_SIZE];
+      warpedOverlap = &warpedOverlapArray[tid * BLOCK_3D_SIZE];
+
+      blockIndex = activeBlockIndex[activeIndex];
+      i = blockIndex % params->blockNumber[0];
+      j = (blockIndex / params->blockNumber[0]) % params->blockNumber[1];
+      k = blockIndex / (params->blockNumber[0] * params->blockNumber[1]);
+
       referenceIndex_start_z = k * BLOCK_WIDTH;
       referenceIndex_end_z = referenceIndex_start_z + BLOCK_WIDTH;
-
-      for (j = 0; j < (int)params->blockNumber[1]; j++) {
-         referenceIndex_start_y = j * BLOCK_WIDTH;
-         referenceIndex_end_y = referenceIndex_start_y + BLOCK_WIDTH;
-
-         for (i = 0; i < (int)params->blockNumber[0]; i++) {
-            referenceIndex_start_x = i * BLOCK_WIDTH;
-            referenceIndex_end_x = referenceIndex_start_x + BLOCK_WIDTH;
-
-            if (params->totalBlock[blockIndex] > -1) {
-               referenceIndex = 0;
-               memset(referenceOverlap[tid], 0, BLOCK_3D_SIZE * sizeof(bool));
-               for (z = (int)referenceIndex_start_z; z < (int)referenceIndex_end_z; z++) {
-                  if (z < reference->nz) {
-                     index = z * reference->nx * reference->ny;
-                     referencePtr_Z = &referencePtr[index];
+      referenceIndex_start_y = j * BLOCK_WIDTH;
+      referenceIndex_end_y = referenceIndex_start_y + BLOCK_WIDTH;
+      referenceIndex_start_x = i * BLOCK_WIDTH;
+      referenceIndex_end_x = referenceIndex_start_x + BLOCK_WIDTH;
+
+      referenceIndex = 0;
+      memset(referenceOverlap, 0, BLOCK_3D_SIZE * sizeof(bool));
+      for (z = (int)referenceIndex_start_z; z < (int)referenceIndex_end_z; z++) {
+         if (z < reference->nz) {
+            index = z * reference->nx * reference->ny;
+            referencePtr_Z = &referencePtr[index];
+            maskPtr_Z = &mask[index];
+            for (y = (int)referenceIndex_start_y; y < (int)referenceIndex_end_y; y++) {
+               if (y < reference->ny) {
+                  index = y * reference->nx + referenceIndex_start_x;
+                  for (x = (int)referenceIndex_start_x; x < (int)referenceIndex_end_x; x++) {
+                     if (x < reference->nx) {
+                        referencePtr_XYZ = &referencePtr_Z[index];
+                        maskPtr_XYZ = &maskPtr_Z[index];
+                        value = *referencePtr_XYZ;
+                        if (value == value && *maskPtr_XYZ > -1) {
+                           referenceValues[referenceIndex] = value;
+                           referenceOverlap[referenceIndex] = 1;
+                        }
+                     }
+                     index++;
+                     referenceIndex++;
+                  }
+               }
+               else
+                  referenceIndex += BLOCK_WIDTH;
+            }
+         }
+         else
+            referenceIndex += BLOCK_WIDTH * BLOCK_WIDTH;
+      }
+      bestCC = params->voxelCaptureRange > 3 ? 0.9 : 0.0; //only when misaligned images are registered
+      bestDisplacement[0] = std::numeric_limits<float>::quiet_NaN();
+      bestDisplacement[1] = 0.f;
+      bestDisplacement[2] = 0.f;
+
+      // iteration over the warped blocks
+      for (n = -1 * params->voxelCaptureRange; n <= params->voxelCaptureRange; n += params->stepSize) {
+         warpedIndex_start_z = referenceIndex_start_z + n;
+         warpedIndex_end_z = warpedIndex_start_z + BLOCK_WIDTH;
+         for (m = -1 * params->voxelCaptureRange; m <= params->voxelCaptureRange; m += params->stepSize) {
+            warpedIndex_start_y = referenceIndex_start_y + m;
+            warpedIndex_end_y = warpedIndex_start_y + BLOCK_WIDTH;
+            for (l = -1 * params->voxelCaptureRange; l <= params->voxelCaptureRange; l += params->stepSize) {
+
+               warpedIndex_start_x = referenceIndex_start_x + l;
+               warpedIndex_end_x = warpedIndex_start_x + BLOCK_WIDTH;
+               warpedIndex = 0;
+               memset(warpedOverlap, 0, BLOCK_3D_SIZE * sizeof(bool));
+               for (z = warpedIndex_start_z; z < warpedIndex_end_z; z++) {
+                  if (-1 < z && z < warped->nz) {
+                     index = z * warped->nx * warped->ny;
+                     warpedPtr_Z = &warpedPtr[index];
                      maskPtr_Z = &mask[index];
-                     for (y = (int)referenceIndex_start_y; y < (int)referenceIndex_end_y; y++) {
-                        if (y < reference->ny) {
-                           index = y * reference->nx + referenceIndex_start_x;
-                           for (x = (int)referenceIndex_start_x; x < (int)referenceIndex_end_x; x++) {
-                              if (x < reference->nx) {
-                                 referencePtr_XYZ = &referencePtr_Z[index];
+                     for (y = warpedIndex_start_y; y < warpedIndex_end_y; y++) {
+                        if (-1 < y && y < warped->ny) {
+                           index = y * warped->nx + warpedIndex_start_x;
+                           for (x = warpedIndex_start_x; x < warpedIndex_end_x; x++) {
+                              if (-1 < x && x < warped->nx) {
+                                 warpedPtr_XYZ = &warpedPtr_Z[index];
                                  maskPtr_XYZ = &maskPtr_Z[index];
-                                 value = *referencePtr_XYZ;
+                                 value = *warpedPtr_XYZ;
                                  if (value == value && *maskPtr_XYZ > -1) {
-                                    referenceValues[tid][referenceIndex] = value;
-                                    referenceOverlap[tid][referenceIndex] = 1;
+                                    warpedValues[warpedIndex] = value;
+                                    warpedOverlap[warpedIndex] = 1;
                                  }
                               }
                               index++;
-                              referenceIndex++;
+                              warpedIndex++;
                            }
                         }
                         else
-                           referenceIndex += BLOCK_WIDTH;
+                           warpedIndex += BLOCK_WIDTH;
                      }
                   }
                   else
-                     referenceIndex += BLOCK_WIDTH * BLOCK_WIDTH;
+                     warpedIndex += BLOCK_WIDTH * BLOCK_WIDTH;
+               }
+               referenceMean = 0.0;
+               warpedMean = 0.0;
+               voxelNumber = 0.0;
+               for (int a = 0; a < BLOCK_3D_SIZE; a++) {
+                  if (referenceOverlap[a] && warpedOverlap[a]) {
+                     referenceMean += referenceValues[a];
+                     warpedMean += warpedValues[a];
+                     voxelNumber++;
+                  }
                }
-               bestCC = params->voxelCaptureRange > 3 ? 0.9 : 0.0; //only when misaligned images are registered
-               bestDisplacement[0] = std::numeric_limits<float>::quiet_NaN();
-               bestDisplacement[1] = 0.f;
-               bestDisplacement[2] = 0.f;
-
-               // iteration over the warped blocks
-               for (n = -1 * params->voxelCaptureRange; n <= params->voxelCaptureRange; n += params->stepSize) {
-                  warpedIndex_start_z = referenceIndex_start_z + n;
-                  warpedIndex_end_z = warpedIndex_start_z + BLOCK_WIDTH;
-                  for (m = -1 * params->voxelCaptureRange; m <= params->voxelCaptureRange; m += params->stepSize) {
-                     warpedIndex_start_y = referenceIndex_start_y + m;
-                     warpedIndex_end_y = warpedIndex_start_y + BLOCK_WIDTH;
-                     for (l = -1 * params->voxelCaptureRange; l <= params->voxelCaptureRange; l += params->stepSize) {
-
-                        warpedIndex_start_x = referenceIndex_start_x + l;
-                        warpedIndex_end_x = warpedIndex_start_x + BLOCK_WIDTH;
-                        warpedIndex = 0;
-                        memset(warpedOverlap[tid], 0, BLOCK_3D_SIZE * sizeof(bool));
-                        for (z = warpedIndex_start_z; z < warpedIndex_end_z; z++) {
-                           if (-1 < z && z < warped->nz) {
-                              index = z * warped->nx * warped->ny;
-                              warpedPtr_Z = &warpedPtr[index];
-                              maskPtr_Z = &mask[index];
-                              for (y = warpedIndex_start_y; y < warpedIndex_end_y; y++) {
-                                 if (-1 < y && y < warped->ny) {
-                                    index = y * warped->nx + warpedIndex_start_x;
-                                    for (x = warpedIndex_start_x; x < warpedIndex_end_x; x++) {
-                                       if (-1 < x && x < warped->nx) {
-                                          warpedPtr_XYZ = &warpedPtr_Z[index];
-                                          maskPtr_XYZ = &maskPtr_Z[index];
-                                          value = *warpedPtr_XYZ;
-                                          if (value == value && *maskPtr_XYZ > -1) {
-                                             warpedValues[tid][warpedIndex] = value;
-                                             warpedOverlap[tid][warpedIndex] = 1;
-                                          }
-                                       }
-                                       index++;
-                                       warpedIndex++;
-                                    }
-                                 }
-                                 else
-                                    warpedIndex += BLOCK_WIDTH;
-                              }
-                           }
-                           else
-                              warpedIndex += BLOCK_WIDTH * BLOCK_WIDTH;
-                        }
-                        referenceMean = 0.0;
-                        warpedMean = 0.0;
-                        voxelNumber = 0.0;
-                        for (int a = 0; a < BLOCK_3D_SIZE; a++) {
-                           if (referenceOverlap[tid][a] && warpedOverlap[tid][a]) {
-                              referenceMean += referenceValues[tid][a];
-                              warpedMean += warpedValues[tid][a];
-                              voxelNumber++;
-                           }
-                        }
 
-                        if (voxelNumber > BLOCK_3D_SIZE / 2) {
-                           referenceMean /= voxelNumber;
-                           warpedMean /= voxelNumber;
-
-                           referenceVar = 0.0;
-                           warpedVar = 0.0;
-                           localCC = 0.0;
-
-                           for (int a = 0; a < BLOCK_3D_SIZE; a++) {
-                              if (referenceOverlap[tid][a] && warpedOverlap[tid][a]) {
-                                 referenceTemp = (referenceValues[tid][a] - referenceMean);
-                                 warpedTemp = (warpedValues[tid][a] - warpedMean);
-                                 referenceVar += (referenceTemp)* (referenceTemp);
-                                 warpedVar += (warpedTemp)* (warpedTemp);
-                                 localCC += (referenceTemp)* (warpedTemp);
-                              }
-                           }
-                           localCC = (referenceVar * warpedVar) > 0.0 ? fabs(localCC / sqrt(referenceVar * warpedVar)) : 0.0;
+               if (voxelNumber > BLOCK_3D_SIZE / 2) {
+                  referenceMean /= voxelNumber;
+                  warpedMean /= voxelNumber;
 
-                           if (localCC > bestCC) {
-                              bestCC = localCC + 1.0e-7f;
-                              bestDisplacement[0] = (float)l;
-                              bestDisplacement[1] = (float)m;
-                              bestDisplacement[2] = (float)n;
-                           }
-                        }
+                  referenceVar = 0.0;
+                  warpedVar = 0.0;
+                  localCC = 0.0;
+
+                  for (int a = 0; a < BLOCK_3D_SIZE; a++) {
+                     if (referenceOverlap[a] && warpedOverlap[a]) {
+                        referenceTemp = (referenceValues[a] - referenceMean);
+                        warpedTemp = (warpedValues[a] - warpedMean);
+                        referenceVar += (referenceTemp)* (referenceTemp);
+                        warpedVar += (warpedTemp)* (warpedTemp);
+                        localCC += (referenceTemp)* (warpedTemp);
                      }
                   }
-               }
-               //if (bestDisplacement[0] == bestDisplacement[0]) {
-               referencePosition_temp[0] = (float)(i * BLOCK_WIDTH);
-               referencePosition_temp[1] = (float)(j * BLOCK_WIDTH);
-               referencePosition_temp[2] = (float)(k * BLOCK_WIDTH);
-
-               bestDisplacement[0] += referencePosition_temp[0];
-               bestDisplacement[1] += referencePosition_temp[1];
-               bestDisplacement[2] += referencePosition_temp[2];
-
-               reg_mat44_mul(referenceMatrix_xyz, referencePosition_temp, tempPosition);
-               z = 3 * params->totalBlock[blockIndex];
-               params->referencePosition[z] = tempPosition[0];
-               params->referencePosition[z+1] = tempPosition[1];
-               params->referencePosition[z+2] = tempPosition[2];
-
-               reg_mat44_mul(referenceMatrix_xyz, bestDisplacement, tempPosition);
-               params->warpedPosition[z] = tempPosition[0];
-               params->warpedPosition[z + 1] = tempPosition[1];
-               params->warpedPosition[z + 2] = tempPosition[2];
-               if (bestDisplacement[0] == bestDisplacement[0]) {
-                  currentDefinedActiveBlockNumber++;
+                  localCC = (referenceVar * warpedVar) > 0.0 ? fabs(localCC / sqrt(referenceVar * warpedVar)) : 0.0;
+
+                  if (localCC > bestCC) {
+                     bestCC = localCC + 1.0e-7f;
+                     bestDisplacement[0] = (float)l;
+                     bestDisplacement[1] = (float)m;
+                     bestDisplacement[2] = (float)n;
+                  }
                }
             }
-            blockIndex++;
          }
       }
+      //if (bestDisplacement[0] == bestDisplacement[0]) {
+      referencePosition_temp[0] = (float)(i * BLOCK_WIDTH);
+      referencePosition_temp[1] = (float)(j * BLOCK_WIDTH);
+      referencePosition_temp[2] = (float)(k * BLOCK_WIDTH);
+
+      bestDisplacement[0] += referencePosition_temp[0];
+      bestDisplacement[1] += referencePosition_temp[1];
+      bestDisplacement[2] += referencePosition_temp[2];
+
+      reg_mat44_mul(referenceMatrix_xyz, referencePosition_temp, tempPosition);
+      z = 3 * params->totalBlock[blockIndex];
+      params->referencePosition[z] = tempPosition[0];
+      params->referencePosition[z+1] = tempPosition[1];
+      params->referencePosition[z+2] = tempPosition[2];
+
+      reg_mat44_mul(referenceMatrix_xyz, bestDisplacement, tempPosition);
+      params->warpedPosition[z] = tempPosition[0];
+      params->warpedPosition[z + 1] = tempPosition[1];
+      params->warpedPosition[z + 2] = tempPosition[2];
+      if (bestDisplacement[0] == bestDisplacement[0]) {
+         currentDefinedActiveBlockNumber++;
+      }
    }
    params->definedActiveBlockNumber = currentDefinedActiveBlockNumber;
 
-#if defined (_OPENMP)
-   omp_set_num_threads(threadNumber);
-#endif
+   free(activeBlockIndex);
+   free(referenceValuesArray);
+   free(warpedValuesArray);
+   free(referenceOverlapArray);
+   free(warpedOverlapArray);
 }
 /* *************************************************************** */
 // Block matching interface function
@@ -704,6 +717,461 @@ void block_matching_method(nifti_image * reference, nifti_image * warped, _reg_b
    }
 }
 /* *************************************************************** */
+/** Computes the number of valid voxels and the sums of the intensities and of
+ * the squared intensities of every block of the warped image that is fully
+ * included in the image. The block origins are stored in a grid of
+ * statDim[0]*statDim[1]*statDim[2] elements. The sums are computed separably,
+ * along x and y for every slice and then along z in place.
+ */
+template<typename DTYPE>
+void block_matching_blockStatistics(nifti_image * warped,
+                                    int *mask,
+                                    int blockDepth,
+                                    int *statDim,
+                                    double *blockSum,
+                                    double *blockSumSquare,
+                                    unsigned char *blockCount)
+{
+   DTYPE *warpedPtr = static_cast<DTYPE *>(warped->data);
+   size_t sliceVoxelNumber = (size_t)warped->nx * warped->ny;
+   size_t statSliceNumber = (size_t)statDim[0] * statDim[1];
+
+   int threadNumber = 1;
+#if defined (_OPENMP)
+   threadNumber = omp_get_max_threads();
+#endif
+   // Row sums along x, one slice per thread
+   size_t rowStatNumber = (size_t)statDim[0] * warped->ny;
+   double *rowSumArray = (double *)malloc(threadNumber * rowStatNumber * sizeof(double));
+   double *rowSumSquareArray = (double *)malloc(threadNumber * rowStatNumber * sizeof(double));
+   unsigned char *rowCountArray = (unsigned char *)malloc(threadNumber * rowStatNumber * sizeof(unsigned char));
+   double *rowSum, *rowSumSquare;
+   unsigned char *rowCount;
+
+   int x, y, z, a;
+   size_t index, statIndex, tid = 0;
+   double sum, sumSquare, value;
+   unsigned char count;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(warped, warpedPtr, mask, statDim, sliceVoxelNumber, statSliceNumber, rowStatNumber, \
+   rowSumArray, rowSumSquareArray, rowCountArray, blockSum, blockSumSquare, blockCount) \
+   private(x, y, a, index, statIndex, tid, sum, sumSquare, value, count, \
+   rowSum, rowSumSquare, rowCount)
+#endif
+   for (z = 0; z < warped->nz; ++z) {
+#if defined (_OPENMP)
+      tid = omp_get_thread_num();
+#endif
+      rowSum = &rowSumArray[tid * rowStatNumber];
+      rowSumSquare = &rowSumSquareArray[tid * rowStatNumber];
+      rowCount = &rowCountArray[tid * rowStatNumber];
+      for (y = 0; y < warped->ny; ++y) {
+         for (x = 0; x < statDim[0]; ++x) {
+            index = z * sliceVoxelNumber + y * warped->nx + x;
+            sum = sumSquare = 0.;
+            count = 0;
+            for (a = 0; a < BLOCK_WIDTH; ++a) {
+               value = (double)warpedPtr[index + a];
+               if (value == value && mask[index + a] > -1) {
+                  sum += value;
+                  sumSquare += value * value;
+                  ++count;
+               }
+            }
+            statIndex = y * statDim[0] + x;
+            rowSum[statIndex] = sum;
+            rowSumSquare[statIndex] = sumSquare;
+            rowCount[statIndex] = count;
+         }
+      }
+      for (y = 0; y < statDim[1]; ++y) {
+         for (x = 0; x < statDim[0]; ++x) {
+            index = y * statDim[0] + x;
+            sum = sumSquare = 0.;
+            count = 0;
+            for (a = 0; a < BLOCK_WIDTH; ++a) {
+               sum += rowSum[index + a * statDim[0]];
+               sumSquare += rowSumSquare[index + a * statDim[0]];
+               count += rowCount[index + a * statDim[0]];
+            }
+            statIndex = z * statSliceNumber + index;
+            blockSum[statIndex] = sum;
+            blockSumSquare[statIndex] = sumSquare;
+            blockCount[statIndex] = count;
+         }
+      }
+   }
+   free(rowSumArray);
+   free(rowSumSquareArray);
+   free(rowCountArray);
+
+   // Sums along z. A slice is only used by the blocks starting at or before
+   // it, the sums can thus be computed in place with increasing z
+   if (blockDepth > 1) {
+      int statIndexXY;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(warped, statDim, statSliceNumber, blockDepth, blockSum, blockSumSquare, blockCount) \
+   private(z, a, statIndex, sum, sumSquare, count)
+#endif
+      for (statIndexXY = 0; statIndexXY < (int)statSliceNumber; ++statIndexXY) {
+         for (z = 0; z < statDim[2]; ++z) {
+            statIndex = z * statSliceNumber + statIndexXY;
+            sum = blockSum[statIndex];
+            sumSquare = blockSumSquare[statIndex];
+            count = blockCount[statIndex];
+            for (a = 1; a < blockDepth; ++a) {
+               sum += blockSum[statIndex + a * statSliceNumber];
+               sumSquare += blockSumSquare[statIndex + a * statSliceNumber];
+               count += blockCount[statIndex + a * statSliceNumber];
+            }
+            blockSum[statIndex] = sum;
+            blockSumSquare[statIndex] = sumSquare;
+            blockCount[statIndex] = count;
+         }
+      }
+   }
+}
+/* *************************************************************** */
+/// Dot product between a centred reference block and a warped block
+template<typename DTYPE>
+inline double block_matching_dotProduct(DTYPE *centredReference,
+                                        DTYPE *warpedPtr,
+                                        size_t rowStride,
+                                        size_t sliceStride,
+                                        int blockDepth)
+{
+   double dotProduct = 0.;
+   for (int z = 0; z < blockDepth; ++z) {
+      for (int y = 0; y < BLOCK_WIDTH; ++y) {
+         DTYPE *warpedRowPtr = &warpedPtr[z * sliceStride + y * rowStride];
+         for (int x = 0; x < BLOCK_WIDTH; ++x)
+            dotProduct += (double)(*centredReference++ * warpedRowPtr[x]);
+      }
+   }
+   return dotProduct;
+}
+#ifdef _USE_SSE
+/* *************************************************************** */
+// A block row is BLOCK_WIDTH=4 floats wide and fits a single SSE register
+template<>
+inline double block_matching_dotProduct<float>(float *centredReference,
+                                               float *warpedPtr,
+                                               size_t rowStride,
+                                               size_t sliceStride,
+                                               int blockDepth)
+{
+   __m128 dotProduct_sse = _mm_setzero_ps();
+   for (int z = 0; z < blockDepth; ++z) {
+      for (int y = 0; y < BLOCK_WIDTH; ++y) {
+         dotProduct_sse = _mm_add_ps(dotProduct_sse,
+                                     _mm_mul_ps(_mm_loadu_ps(centredReference),
+                                                _mm_loadu_ps(&warpedPtr[z * sliceStride + y * rowStride])));
+         centredReference += BLOCK_WIDTH;
+      }
+   }
+   float dotProduct[4];
+   _mm_storeu_ps(dotProduct, dotProduct_sse);
+   return (double)dotProduct[0] + (double)dotProduct[1] +
+         (double)dotProduct[2] + (double)dotProduct[3];
+}
+#endif
+/* *************************************************************** */
+template<typename DTYPE>
+void block_matching_method_fast(nifti_image * reference,
+                                nifti_image * warped,
+                                _reg_blockMatchingParam *params,
+                                int *mask)
+{
+   DTYPE *referencePtr = static_cast<DTYPE *>(reference->data);
+   DTYPE *warpedPtr = static_cast<DTYPE *>(warped->data);
+
+   mat44 *referenceMatrix_xyz;
+   if (reference->sform_code > 0)
+      referenceMatrix_xyz = &(reference->sto_xyz);
+   else
+      referenceMatrix_xyz = &(reference->qto_xyz);
+
+   // The 2D case is handled as a 3D image with blocks of a single slice
+   int dim = reference->nz > 1 ? 3 : 2;
+   int blockDepth = dim == 3 ? BLOCK_WIDTH : 1;
+   int blockSize = dim == 3 ? BLOCK_3D_SIZE : BLOCK_2D_SIZE;
+   int captureRangeZ = dim == 3 ? params->voxelCaptureRange : 0;
+   size_t sliceVoxelNumber = (size_t)reference->nx * reference->ny;
+
+   // Statistics of all the warped blocks included in the image
+   int statDim[3];
+   statDim[0] = warped->nx - BLOCK_WIDTH + 1;
+   statDim[1] = warped->ny - BLOCK_WIDTH + 1;
+   statDim[2] = warped->nz - blockDepth + 1;
+   double *blockSum = NULL;
+   double *blockSumSquare = NULL;
+   unsigned char *blockCount = NULL;
+   if (statDim[0] > 0 && statDim[1] > 0 && statDim[2] > 0) {
+      // The z sums are computed in place, the arrays cover every slice
+      size_t statNumber = (size_t)statDim[0] * statDim[1] * warped->nz;
+      blockSum = (double *)malloc(statNumber * sizeof(double));
+      blockSumSquare = (double *)malloc(statNumber * sizeof(double));
+      blockCount = (unsigned char *)malloc(statNumber * sizeof(unsigned char));
+      block_matching_blockStatistics<DTYPE>(warped, mask, blockDepth, statDim,
+                                            blockSum, blockSumSquare, blockCount);
+   }
+   else statDim[0] = statDim[1] = statDim[2] = 0;
+
+   // The list of active blocks is extracted so that they can be distributed
+   // dynamically across the threads
+   size_t totalBlockNumber = (size_t)params->blockNumber[0] *
+         params->blockNumber[1] * (dim == 3 ? params->blockNumber[2] : 1);
+   int activeBlockNumber = 0;
+   int *activeBlockIndex = (int *)malloc(totalBlockNumber * sizeof(int));
+   for (size_t b = 0; b < totalBlockNumber; ++b) {
+      if (params->totalBlock[b] > -1)
+         activeBlockIndex[activeBlockNumber++] = (int)b;
+   }
+
+   // Every thread uses its own workspace, allocated on the heap
+   int threadNumber = 1;
+#if defined (_OPENMP)
+   threadNumber = omp_get_max_threads();
+#endif
+   DTYPE *referenceValuesArray = (DTYPE *)malloc(threadNumber * BLOCK_3D_SIZE * sizeof(DTYPE));
+   DTYPE *warpedValuesArray = (DTYPE *)malloc(threadNumber * BLOCK_3D_SIZE * sizeof(DTYPE));
+   bool *referenceOverlapArray = (bool *)malloc(threadNumber * BLOCK_3D_SIZE * sizeof(bool));
+   bool *warpedOverlapArray = (bool *)malloc(threadNumber * BLOCK_3D_SIZE * sizeof(bool));
+   DTYPE *referenceValues, *warpedValues;
+   bool *referenceOverlap, *warpedOverlap;
+
+   int activeIndex, blockIndex, i, j, k, l, m, n, x, y, z, a;
+   int referenceStart[3], warpedStart[3], referenceCount;
+   size_t index, tid = 0;
+   bool fullReferenceBlock;
+   double value, bestCC, localCC, referenceMean, warpedMean, referenceVar, warpedVar;
+   double voxelNumber, referenceTemp, warpedTemp;
+   float bestDisplacement[3], referencePosition_temp[3], tempPosition[3];
+
+   int currentDefinedActiveBlockNumber = 0;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) schedule(dynamic) \
+   shared(params, reference, warped, referencePtr, warpedPtr, mask, referenceMatrix_xyz, \
+   activeBlockNumber, activeBlockIndex, referenceOverlapArray, warpedOverlapArray, \
+   referenceValuesArray, warpedValuesArray, dim, blockDepth, blockSize, captureRangeZ, \
+   sliceVoxelNumber, statDim, blockSum, blockSumSquare, blockCount) \
+   private(blockIndex, i, j, k, l, m, n, x, y, z, a, referenceStart, warpedStart, \
+   referenceCount, index, tid, fullReferenceBlock, value, bestCC, localCC, \
+   referenceMean, warpedMean, referenceVar, warpedVar, voxelNumber, referenceTemp, warpedTemp, \
+   bestDisplacement, referencePosition_temp, tempPosition, \
+   referenceValues, warpedValues, referenceOverlap, warpedOverlap) \
+   reduction(+:currentDefinedActiveBlockNumber)
+#endif
+   for (activeIndex = 0; activeIndex < activeBlockNumber; ++activeIndex) {
+#if defined (_OPENMP)
+      tid = omp_get_thread_num();
+#endif
+      referenceValues = &referenceValuesArray[tid * BLOCK_3D_SIZE];
+      warpedValues = &warpedValuesArray[tid * BLOCK_3D_SIZE];
+      referenceOverlap = &referenceOverlapArray[tid * BLOCK_3D_SIZE];
+      warpedOverlap = &warpedOverlapArray[tid * BLOCK_3D_SIZE];
+
+      blockIndex = activeBlockIndex[activeIndex];
+      i = blockIndex % params->blockNumber[0];
+      j = (blockIndex / params->blockNumber[0]) % params->blockNumber[1];
+      k = blockIndex / (params->blockNumber[0] * params->blockNumber[1]);
+      referenceStart[0] = i * BLOCK_WIDTH;
+      referenceStart[1] = j * BLOCK_WIDTH;
+      referenceStart[2] = k * BLOCK_WIDTH;
+
+      // Extract the reference block
+      a = 0;
+      referenceCount = 0;
+      memset(referenceOverlap, 0, blockSize * sizeof(bool));
+      for (z = referenceStart[2]; z < referenceStart[2] + blockDepth; ++z) {
+         for (y = referenceStart[1]; y < referenceStart[1] + BLOCK_WIDTH; ++y) {
+            for (x = referenceStart[0]; x < referenceStart[0] + BLOCK_WIDTH; ++x) {
+               if (z < reference->nz && y < reference->ny && x < reference->nx) {
+                  index = z * sliceVoxelNumber + y * reference->nx + x;
+                  value = (double)referencePtr[index];
+                  if (value == value && mask[index] > -1) {
+                     referenceValues[a] = referencePtr[index];
+                     referenceOverlap[a] = 1;
+                     ++referenceCount;
+                  }
+               }
+               ++a;
+            }
+         }
+      }
+
+      // A fully defined reference block is centred once. Its correlation with
+      // any fully defined warped block then only requires a dot product and
+      // the precomputed warped block statistics
+      fullReferenceBlock = referenceCount == blockSize;
+      referenceVar = 0.;
+      if (fullReferenceBlock) {
+         referenceMean = 0.;
+         for (a = 0; a < blockSize; ++a)
+            referenceMean += (double)referenceValues[a];
+         referenceMean /= (double)blockSize;
+         for (a = 0; a < blockSize; ++a) {
+            referenceTemp = (double)referenceValues[a] - referenceMean;
+            referenceValues[a] = (DTYPE)referenceTemp;
+            referenceVar += referenceTemp * referenceTemp;
+         }
+      }
+
+      bestCC = params->voxelCaptureRange > 3 ? 0.9 : 0.0; //only when misaligned images are registered
+      bestDisplacement[0] = std::numeric_limits<float>::quiet_NaN();
+      bestDisplacement[1] = 0.f;
+      bestDisplacement[2] = 0.f;
+
+      // iteration over the warped blocks
+      for (n = -captureRangeZ; n <= captureRangeZ; n += params->stepSize) {
+         warpedStart[2] = referenceStart[2] + n;
+         for (m = -params->voxelCaptureRange; m <= params->voxelCaptureRange; m += params->stepSize) {
+            warpedStart[1] = referenceStart[1] + m;
+            for (l = -params->voxelCaptureRange; l <= params->voxelCaptureRange; l += params->stepSize) {
+               warpedStart[0] = referenceStart[0] + l;
+
+               if (fullReferenceBlock &&
+                     -1 < warpedStart[0] && warpedStart[0] < statDim[0] &&
+                     -1 < warpedStart[1] && warpedStart[1] < statDim[1] &&
+                     -1 < warpedStart[2] && warpedStart[2] < statDim[2] &&
+                     blockCount[(warpedStart[2] * statDim[1] + warpedStart[1]) * statDim[0] + warpedStart[0]] == blockSize) {
+                  // Fast path: both blocks are fully defined
+                  index = (warpedStart[2] * statDim[1] + warpedStart[1]) * statDim[0] + warpedStart[0];
+                  warpedVar = blockSumSquare[index] - blockSum[index] * blockSum[index] / (double)blockSize;
+                  // Values below the rounding error are considered as a constant block
+                  if (warpedVar <= 1.0e-10 * blockSumSquare[index])
+                     warpedVar = 0.;
+                  localCC = block_matching_dotProduct<DTYPE>(referenceValues,
+                                                             &warpedPtr[warpedStart[2] * sliceVoxelNumber +
+                                                                        warpedStart[1] * warped->nx +
+                                                                        warpedStart[0]],
+                                                             warped->nx,
+                                                             sliceVoxelNumber,
+                                                             blockDepth);
+                  localCC = (referenceVar * warpedVar) > 0.0 ? fabs(localCC / sqrt(referenceVar * warpedVar)) : 0.0;
+               }
+               else {
+                  // Generic path: the correlation is computed over the
+                  // overlap of the defined voxels
+                  a = 0;
+                  memset(warpedOverlap, 0, blockSize * sizeof(bool));
+                  for (z = warpedStart[2]; z < warpedStart[2] + blockDepth; ++z) {
+                     if (z < 0 || z >= warped->nz) {
+                        a += BLOCK_WIDTH * BLOCK_WIDTH;
+                        continue;
+                     }
+                     for (y = warpedStart[1]; y < warpedStart[1] + BLOCK_WIDTH; ++y) {
+                        if (y < 0 || y >= warped->ny) {
+                           a += BLOCK_WIDTH;
+                           continue;
+                        }
+                        index = z * sliceVoxelNumber + y * warped->nx + warpedStart[0];
+                        for (x = warpedStart[0]; x < warpedStart[0] + BLOCK_WIDTH; ++x) {
+                           if (-1 < x && x < warped->nx) {
+                              value = (double)warpedPtr[index];
+                              if (value == value && mask[index] > -1) {
+                                 warpedValues[a] = warpedPtr[index];
+                                 warpedOverlap[a] = 1;
+                              }
+                           }
+                           ++index;
+                           ++a;
+                        }
+                     }
+                  }
+                  referenceMean = 0.0;
+                  warpedMean = 0.0;
+                  voxelNumber = 0.0;
+                  for (a = 0; a < blockSize; a++) {
+                     if (referenceOverlap[a] && warpedOverlap[a]) {
+                        referenceMean += (double)referenceValues[a];
+                        warpedMean += (double)warpedValues[a];
+                        voxelNumber++;
+                     }
+                  }
+                  localCC = 0.0;
+                  if (voxelNumber > blockSize / 2) {
+                     referenceMean /= voxelNumber;
+                     warpedMean /= voxelNumber;
+                     double overlapReferenceVar = 0.0;
+                     warpedVar = 0.0;
+                     for (a = 0; a < blockSize; a++) {
+                        if (referenceOverlap[a] && warpedOverlap[a]) {
+                           referenceTemp = (double)referenceValues[a] - referenceMean;
+                           warpedTemp = (double)warpedValues[a] - warpedMean;
+                           overlapReferenceVar += referenceTemp * referenceTemp;
+                           warpedVar += warpedTemp * warpedTemp;
+                           localCC += referenceTemp * warpedTemp;
+                        }
+                     }
+                     localCC = (overlapReferenceVar * warpedVar) > 0.0 ?
+                              fabs(localCC / sqrt(overlapReferenceVar * warpedVar)) : 0.0;
+                  }
+               }
+               if (localCC > bestCC) {
+                  bestCC = localCC + 1.0e-7f;
+                  bestDisplacement[0] = (float)l;
+                  bestDisplacement[1] = (float)m;
+                  bestDisplacement[2] = (float)n;
+               }
+            }
+         }
+      }
+
+      referencePosition_temp[0] = (float)referenceStart[0];
+      referencePosition_temp[1] = (float)referenceStart[1];
+      referencePosition_temp[2] = (float)referenceStart[2];
+
+      bestDisplacement[0] += referencePosition_temp[0];
+      bestDisplacement[1] += referencePosition_temp[1];
+      bestDisplacement[2] += referencePosition_temp[2];
+
+      index = dim * params->totalBlock[blockIndex];
+      reg_mat44_mul(referenceMatrix_xyz, referencePosition_temp, tempPosition);
+      for (a = 0; a < dim; ++a)
+         params->referencePosition[index + a] = tempPosition[a];
+      reg_mat44_mul(referenceMatrix_xyz, bestDisplacement, tempPosition);
+      for (a = 0; a < dim; ++a)
+         params->warpedPosition[index + a] = tempPosition[a];
+      if (bestDisplacement[0] == bestDisplacement[0]) {
+         currentDefinedActiveBlockNumber++;
+      }
+   }
+   params->definedActiveBlockNumber = currentDefinedActiveBlockNumber;
+
+   free(activeBlockIndex);
+   free(referenceValuesArray);
+   free(warpedValuesArray);
+   free(referenceOverlapArray);
+   free(warpedOverlapArray);
+   if (blockSum != NULL) free(blockSum);
+   if (blockSumSquare != NULL) free(blockSumSquare);
+   if (blockCount != NULL) free(blockCount);
+}
+/* *************************************************************** */
+// Block matching interface function using precomputed block statistics
+void block_matching_method_fast(nifti_image * reference, nifti_image * warped, _reg_blockMatchingParam *params, int *mask) {
+   if (reference->datatype != warped->datatype) {
+      reg_print_fct_error("block_matching_method_fast");
+      reg_print_msg_error("Both input images are expected to be of the same type");
+      reg_exit();
+   }
+   switch (reference->datatype) {
+   case NIFTI_TYPE_FLOAT64:
+      block_matching_method_fast<double>(reference, warped, params, mask);
+      break;
+   case NIFTI_TYPE_FLOAT32:
+      block_matching_method_fast<float>(reference, warped, params, mask);
+      break;
+   default:
+      reg_print_fct_error("block_matching_method_fast");
+      reg_print_msg_error("The reference image data type is not supported");
+      reg_exit();
+   }
+}
+/* *************************************************************** */
 // Find the optimal transformation - affine or rigid
 void optimize(_reg_blockMatchingParam *params,
               mat44 *transformation_matrix,
@@ -112,6 +112,23 @@ void block_matching_method(nifti_image * referenceImage,
                            _reg_blockMatchingParam *params,
                            int *mask);
 
+/** @brief Interface for the block matching algorithm using precomputed
+ * statistics. The sums and sums of squares of every warped block are computed
+ * once, so that the correlation between two fully defined blocks only requires
+ * a dot product. Blocks that are partially defined are handled as in
+ * block_matching_method.
+ * @param referenceImage Reference image in the current registration task
+ * @param warpedImage Warped floating image in the currrent registration task
+ * @param params Block matching parameter structure that contains all
+ * relevant information
+ * @param mask Mask array where only voxel defined as active are considered
+ */
+extern "C++"
+void block_matching_method_fast(nifti_image * referenceImage,
+                                nifti_image * warpedImage,
+                                _reg_blockMatchingParam *params,
+                                int *mask);
+
 /** @brief Find the optimal affine transformation that matches the points
  * in the reference image to the point in the warped image
  * @param params Block-matching structure that contains the relevant information
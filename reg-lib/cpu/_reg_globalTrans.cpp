@@ -15,6 +15,7 @@
 #include "_reg_globalTrans.h"
 #include "_reg_maths.h"
 #include "_reg_maths_eigen.h"
+#include <algorithm>
 
 /* *************************************************************** */
 /* *************************************************************** */
@@ -682,165 +683,344 @@ void estimate_affine_transformation3D(std::vector<_reg_sorted_point3D> &points,
    reg_matrix2DDeallocate(num_points, points2);
 }
 /* *************************************************************** */
-///LTS 2D
-void optimize_2D(float* referencePosition, float* warpedPosition,
-                 unsigned int activeBlockNumber, int percent_to_keep, int max_iter, double tol,
-                 mat44 * final, bool affine) {
-
-   // Set the current transformation to identity
-   reg_mat44_eye(final);
-
-   const unsigned num_points = activeBlockNumber;
-   unsigned long num_equations = num_points * 2;
-   // Keep a sorted list of the distance measure
-   std::multimap<double, _reg_sorted_point2D> queue;
-   std::vector<_reg_sorted_point2D> top_points;
-
-   double distance = 0.0;
-   double lastDistance = std::numeric_limits<double>::max();
-   unsigned long i;
-
-   // The initial vector with all the input points
-   for (unsigned j = 0; j < num_equations; j += 2)
+/// @brief Orders point indices by increasing distance. Ties are broken using
+/// the indices, so the selected points do not depend on the order in which
+/// they are stored.
+struct _reg_lts_distance_comparator
+{
+   const double *distance;
+   _reg_lts_distance_comparator(const double *d) : distance(d) {}
+   bool operator()(unsigned int a, unsigned int b) const
    {
-      top_points.push_back(_reg_sorted_point2D(&referencePosition[j], &warpedPosition[j], 0.0));
+      return distance[a] < distance[b] || (distance[a] == distance[b] && a < b);
    }
-   if (affine) {
-      estimate_affine_transformation2D(top_points, final);
+};
+/* *************************************************************** */
+/** @brief Workspace used by the least trimmed squares estimator. Every buffer
+ * is allocated once and the points are stored as structures of arrays:
+ * reference[d][i] is coordinate d of the i-th reference point.
+ */
+struct _reg_lts_workspace
+{
+   int dim;
+   unsigned int pointNumber;
+   float *reference[3];
+   float *warped[3];
+   float *keptReference[3];
+   float *keptWarped[3];
+   double *distance;
+   unsigned int *pointIndex;
+   // Used by the rigid estimation
+   float **u;
+   float **v;
+   float **ut;
+   float **r;
+   float *w;
+};
+/* *************************************************************** */
+static void reg_lts_allocate(_reg_lts_workspace *ws,
+                             float *referencePosition,
+                             float *warpedPosition,
+                             unsigned int pointNumber,
+                             int dim)
+{
+   ws->dim = dim;
+   ws->pointNumber = pointNumber;
+   for (int d = 0; d < 3; ++d)
+      ws->reference[d] = ws->warped[d] = ws->keptReference[d] = ws->keptWarped[d] = NULL;
+   for (int d = 0; d < dim; ++d) {
+      ws->reference[d] = (float *)malloc(pointNumber * sizeof(float));
+      ws->warped[d] = (float *)malloc(pointNumber * sizeof(float));
+      ws->keptReference[d] = (float *)malloc(pointNumber * sizeof(float));
+      ws->keptWarped[d] = (float *)malloc(pointNumber * sizeof(float));
+   }
+   ws->distance = (double *)malloc(pointNumber * sizeof(double));
+   ws->pointIndex = (unsigned int *)malloc(pointNumber * sizeof(unsigned int));
+   for (unsigned int i = 0; i < pointNumber; ++i) {
+      for (int d = 0; d < dim; ++d) {
+         ws->reference[d][i] = referencePosition[i * dim + d];
+         ws->warped[d][i] = warpedPosition[i * dim + d];
+      }
+      ws->pointIndex[i] = i;
+   }
+   ws->u = reg_matrix2DAllocate<float>(dim, dim);
+   ws->v = reg_matrix2DAllocate<float>(dim, dim);
+   ws->ut = reg_matrix2DAllocate<float>(dim, dim);
+   ws->r = reg_matrix2DAllocate<float>(dim, dim);
+   ws->w = reg_matrix1DAllocate<float>(dim);
+}
+/* *************************************************************** */
+static void reg_lts_deallocate(_reg_lts_workspace *ws)
+{
+   for (int d = 0; d < ws->dim; ++d) {
+      free(ws->reference[d]);
+      free(ws->warped[d]);
+      free(ws->keptReference[d]);
+      free(ws->keptWarped[d]);
+   }
+   free(ws->distance);
+   free(ws->pointIndex);
+   reg_matrix2DDeallocate(ws->dim, ws->u);
+   reg_matrix2DDeallocate(ws->dim, ws->v);
+   reg_matrix2DDeallocate(ws->dim, ws->ut);
+   reg_matrix2DDeallocate(ws->dim, ws->r);
+   reg_matrix1DDeallocate(ws->w);
+}
+/* *************************************************************** */
+/// @brief Distances between the transformed reference points and the warped points
+static void reg_lts_getDistances(_reg_lts_workspace *ws, mat44 *transformation)
+{
+   unsigned int pointNumber = ws->pointNumber;
+   double *distance = ws->distance;
+   double m[3][4];
+   for (int i = 0; i < 3; ++i)
+      for (int j = 0; j < 4; ++j)
+         m[i][j] = static_cast<double>(transformation->m[i][j]);
+   if (ws->dim == 2) {
+      const float *rx = ws->reference[0], *ry = ws->reference[1];
+      const float *wx = ws->warped[0], *wy = ws->warped[1];
+      for (unsigned int i = 0; i < pointNumber; ++i) {
+         float newX = static_cast<float>(m[0][0] * rx[i] + m[0][1] * ry[i] + m[0][3]);
+         float newY = static_cast<float>(m[1][0] * rx[i] + m[1][1] * ry[i] + m[1][3]);
+         distance[i] = sqrt(reg_pow2(newX - wx[i]) + reg_pow2(newY - wy[i]));
+      }
    }
    else {
-      estimate_rigid_transformation2D(top_points, final);
+      const float *rx = ws->reference[0], *ry = ws->reference[1], *rz = ws->reference[2];
+      const float *wx = ws->warped[0], *wy = ws->warped[1], *wz = ws->warped[2];
+      for (unsigned int i = 0; i < pointNumber; ++i) {
+         float newX = static_cast<float>(m[0][0] * rx[i] + m[0][1] * ry[i] + m[0][2] * rz[i] + m[0][3]);
+         float newY = static_cast<float>(m[1][0] * rx[i] + m[1][1] * ry[i] + m[1][2] * rz[i] + m[1][3]);
+         float newZ = static_cast<float>(m[2][0] * rx[i] + m[2][1] * ry[i] + m[2][2] * rz[i] + m[2][3]);
+         distance[i] = sqrt(reg_pow2(newX - wx[i]) + reg_pow2(newY - wy[i]) + reg_pow2(newZ - wz[i]));
+      }
    }
-
-   const unsigned long num_to_keep = (unsigned long)(num_points * (percent_to_keep / 100.0f));
-   float * newWarpedPosition = new float[num_points * 2];
-
-   mat44 lastTransformation;
-   memset(&lastTransformation, 0, sizeof(mat44));
-
-   for (int count = 0; count < max_iter; ++count)
-   {
-      // Transform the points in the reference
-      for (unsigned j = 0; j < num_points * 2; j += 2)
-      {
-         reg_mat33_mul(final, &referencePosition[j], &newWarpedPosition[j]);
+}
+/* *************************************************************** */
+/** @brief Moves the keptNumber points with the smallest distances in the kept
+ * arrays using a partial selection and returns the sum of their distances
+ */
+static double reg_lts_selectPoints(_reg_lts_workspace *ws, unsigned int keptNumber)
+{
+   unsigned int *pointIndex = ws->pointIndex;
+   if (keptNumber < ws->pointNumber) {
+      std::nth_element(pointIndex,
+                       pointIndex + keptNumber,
+                       pointIndex + ws->pointNumber,
+                       _reg_lts_distance_comparator(ws->distance));
+   }
+   double distanceSum = 0.;
+   for (unsigned int i = 0; i < keptNumber; ++i) {
+      unsigned int index = pointIndex[i];
+      distanceSum += ws->distance[index];
+      for (int d = 0; d < ws->dim; ++d) {
+         ws->keptReference[d][i] = ws->reference[d][index];
+         ws->keptWarped[d][i] = ws->warped[d][index];
       }
-      queue = std::multimap<double, _reg_sorted_point2D>();
-      for (unsigned j = 0; j < num_points * 2; j += 2)
-      {
-         distance = get_square_distance2D(&newWarpedPosition[j], &warpedPosition[j]);
-         queue.insert(std::pair<double, _reg_sorted_point2D>(distance,
-                                                             _reg_sorted_point2D(&referencePosition[j], &warpedPosition[j], distance)));
+   }
+   return distanceSum;
+}
+/* *************************************************************** */
+/** @brief Estimates the transformation that best maps the kept reference
+ * points onto the kept warped points. The centroids and the (cross-)covariance
+ * matrices of the centred points are accumulated in a single pass. The affine
+ * solution is given by the normal equations while the rigid one uses the SVD
+ * of the cross-covariance matrix.
+ */
+static void reg_lts_estimate(_reg_lts_workspace *ws,
+                             float **reference,
+                             float **warped,
+                             unsigned int pointNumber,
+                             bool affine,
+                             mat44 *transformation)
+{
+   int dim = ws->dim;
+   double referenceCentroid[3] = {0., 0., 0.};
+   double warpedCentroid[3] = {0., 0., 0.};
+   for (int d = 0; d < dim; ++d) {
+      const float *refPtr = reference[d];
+      const float *warPtr = warped[d];
+      double refSum = 0., warSum = 0.;
+      for (unsigned int i = 0; i < pointNumber; ++i) {
+         refSum += refPtr[i];
+         warSum += warPtr[i];
       }
-
-      distance = 0.0;
-      i = 0;
-      top_points.clear();
-
-      for (std::multimap<double, _reg_sorted_point2D>::iterator it = queue.begin();
-           it != queue.end(); ++it, ++i)
-      {
-         if (i >= num_to_keep) break;
-         top_points.push_back((*it).second);
-         distance += (*it).first;
+      referenceCentroid[d] = refSum / static_cast<double>(pointNumber);
+      warpedCentroid[d] = warSum / static_cast<double>(pointNumber);
+   }
+   // covariance[a][b] = sum(ref_a * ref_b) and crossCovariance[a][b] = sum(ref_a * war_b)
+   double covariance[3][3], crossCovariance[3][3];
+   for (int a = 0; a < dim; ++a) {
+      const float *refPtrA = reference[a];
+      for (int b = 0; b < dim; ++b) {
+         const float *refPtrB = reference[b];
+         const float *warPtrB = warped[b];
+         double covSum = 0., crossSum = 0.;
+         for (unsigned int i = 0; i < pointNumber; ++i) {
+            double refA = refPtrA[i] - referenceCentroid[a];
+            covSum += refA * (refPtrB[i] - referenceCentroid[b]);
+            crossSum += refA * (warPtrB[i] - warpedCentroid[b]);
+         }
+         covariance[a][b] = covSum;
+         crossCovariance[a][b] = crossSum;
       }
+   }
 
-      // If the change is not substantial, we return
-      if ((distance > lastDistance) || (lastDistance - distance) < tol)
-      {
-         // restore the last transformation
-         memcpy(final, &lastTransformation, sizeof(mat44));
-         break;
-      }
-      lastDistance = distance;
-      memcpy(&lastTransformation, final, sizeof(mat44));
-      if (affine) {
-         estimate_affine_transformation2D(top_points, final);
+   double matrix[3][3];
+   if (affine) {
+      // Inverse of the covariance matrix
+      double inverse[3][3], det;
+      if (dim == 2) {
+         det = covariance[0][0] * covariance[1][1] - covariance[0][1] * covariance[1][0];
+         inverse[0][0] = covariance[1][1];
+         inverse[0][1] = -covariance[0][1];
+         inverse[1][0] = -covariance[1][0];
+         inverse[1][1] = covariance[0][0];
       }
       else {
-         estimate_rigid_transformation2D(top_points, final);
+         inverse[0][0] = covariance[1][1] * covariance[2][2] - covariance[1][2] * covariance[2][1];
+         inverse[0][1] = covariance[0][2] * covariance[2][1] - covariance[0][1] * covariance[2][2];
+         inverse[0][2] = covariance[0][1] * covariance[1][2] - covariance[0][2] * covariance[1][1];
+         inverse[1][0] = covariance[1][2] * covariance[2][0] - covariance[1][0] * covariance[2][2];
+         inverse[1][1] = covariance[0][0] * covariance[2][2] - covariance[0][2] * covariance[2][0];
+         inverse[1][2] = covariance[0][2] * covariance[1][0] - covariance[0][0] * covariance[1][2];
+         inverse[2][0] = covariance[1][0] * covariance[2][1] - covariance[1][1] * covariance[2][0];
+         inverse[2][1] = covariance[0][1] * covariance[2][0] - covariance[0][0] * covariance[2][1];
+         inverse[2][2] = covariance[0][0] * covariance[1][1] - covariance[0][1] * covariance[1][0];
+         det = covariance[0][0] * inverse[0][0] + covariance[0][1] * inverse[1][0] + covariance[0][2] * inverse[2][0];
+      }
+      double scale = 0.;
+      for (int d = 0; d < dim; ++d)
+         scale = std::max(scale, covariance[d][d]);
+      if (fabs(det) <= 1.0e-12 * pow(scale, dim)) {
+         // The points are (almost) degenerated, the pseudo-inverse based
+         // estimation is used instead
+         float **points1 = reg_matrix2DAllocate<float>(pointNumber, dim);
+         float **points2 = reg_matrix2DAllocate<float>(pointNumber, dim);
+         for (unsigned int i = 0; i < pointNumber; ++i) {
+            for (int d = 0; d < dim; ++d) {
+               points1[i][d] = reference[d][i];
+               points2[i][d] = warped[d][i];
+            }
+         }
+         if (dim == 2)
+            estimate_affine_transformation2D(points1, points2, pointNumber, transformation);
+         else estimate_affine_transformation3D(points1, points2, pointNumber, transformation);
+         reg_matrix2DDeallocate(pointNumber, points1);
+         reg_matrix2DDeallocate(pointNumber, points2);
+         return;
+      }
+      // matrix = crossCovariance^T * covariance^-1
+      for (int a = 0; a < dim; ++a) {
+         for (int b = 0; b < dim; ++b) {
+            double value = 0.;
+            for (int c = 0; c < dim; ++c)
+               value += crossCovariance[c][a] * inverse[c][b];
+            matrix[a][b] = value / det;
+         }
+      }
+   }
+   else {
+      // rotation = v * u^T where u * w * v^T is the SVD of the cross-covariance
+      for (int a = 0; a < dim; ++a)
+         for (int b = 0; b < dim; ++b)
+            ws->u[a][b] = static_cast<float>(crossCovariance[a][b]);
+      svd(ws->u, dim, dim, ws->w, ws->v);
+      for (int a = 0; a < dim; ++a)
+         for (int b = 0; b < dim; ++b)
+            ws->ut[a][b] = ws->u[b][a];
+      reg_matrix2DMultiply<float>(ws->v, dim, dim, ws->ut, dim, dim, ws->r, false);
+      double det;
+      if (dim == 2)
+         det = ws->r[0][0] * ws->r[1][1] - ws->r[0][1] * ws->r[1][0];
+      else det = ws->r[0][0] * (ws->r[1][1] * ws->r[2][2] - ws->r[1][2] * ws->r[2][1]) -
+            ws->r[0][1] * (ws->r[1][0] * ws->r[2][2] - ws->r[1][2] * ws->r[2][0]) +
+            ws->r[0][2] * (ws->r[1][0] * ws->r[2][1] - ws->r[1][1] * ws->r[2][0]);
+      // Take care of possible reflection
+      if (det < 0.0) {
+         for (int a = 0; a < dim; ++a)
+            ws->v[a][dim - 1] = -ws->v[a][dim - 1];
+         reg_matrix2DMultiply<float>(ws->v, dim, dim, ws->ut, dim, dim, ws->r, false);
       }
+      for (int a = 0; a < dim; ++a)
+         for (int b = 0; b < dim; ++b)
+            matrix[a][b] = ws->r[a][b];
    }
-   delete[] newWarpedPosition;
 
+   reg_mat44_eye(transformation);
+   for (int a = 0; a < dim; ++a) {
+      double translation = warpedCentroid[a];
+      for (int b = 0; b < dim; ++b) {
+         transformation->m[a][b] = static_cast<float>(matrix[a][b]);
+         translation -= matrix[a][b] * referenceCentroid[b];
+      }
+      transformation->m[a][3] = static_cast<float>(translation);
+   }
 }
 /* *************************************************************** */
-///LTS 3D
-void optimize_3D(float *referencePosition, float *warpedPosition,
-                 unsigned int activeBlockNumber, int percent_to_keep, int max_iter, double tol,
-                 mat44 *final, bool affine) {
-
+/** @brief Least trimmed squares estimation of a rigid or affine
+ * transformation. At every iteration only the percent_to_keep percent of the
+ * points with the smallest residual distances are used to estimate the
+ * transformation.
+ */
+static void reg_lts_optimise(float *referencePosition,
+                             float *warpedPosition,
+                             unsigned int pointNumber,
+                             int dim,
+                             int percent_to_keep,
+                             int max_iter,
+                             double tol,
+                             mat44 *final,
+                             bool affine)
+{
    // Set the current transformation to identity
    reg_mat44_eye(final);
 
-   const unsigned num_points = activeBlockNumber;
-   unsigned long num_equations = num_points * 3;
-   // Keep a sorted list of the distance measure
-   std::multimap<double, _reg_sorted_point3D> queue;
-   std::vector<_reg_sorted_point3D> top_points;
-   double distance = 0.0;
-   double lastDistance = std::numeric_limits<double>::max();
-   unsigned long i;
+   _reg_lts_workspace ws;
+   reg_lts_allocate(&ws, referencePosition, warpedPosition, pointNumber, dim);
 
-   // The initial vector with all the input points
-   for (unsigned j = 0; j < num_equations; j+=3) {
-      top_points.push_back(_reg_sorted_point3D(&referencePosition[j],
-                                               &warpedPosition[j],
-                                               0.0));
-   }
-   if (affine) {
-      estimate_affine_transformation3D(top_points, final);
-   } else {
-      estimate_rigid_transformation3D(top_points, final);
-   }
-   unsigned long num_to_keep = (unsigned long)(num_points * (percent_to_keep/100.0f));
-   float* newWarpedPosition = new float[num_points*3];
+   // The initial estimation uses all the input points
+   reg_lts_estimate(&ws, ws.reference, ws.warped, pointNumber, affine, final);
 
+   const unsigned int num_to_keep = (unsigned int)(pointNumber * (percent_to_keep / 100.0f));
+   double distance = 0.0;
+   double lastDistance = std::numeric_limits<double>::max();
    mat44 lastTransformation;
-   memset(&lastTransformation,0,sizeof(mat44));
+   memset(&lastTransformation, 0, sizeof(mat44));
 
    for (int count = 0; count < max_iter; ++count)
    {
-      // Transform the points in the reference
-      for (unsigned j = 0; j < num_points * 3; j+=3) {
-         reg_mat44_mul(final, &referencePosition[j], &newWarpedPosition[j]);
-      }
-      queue = std::multimap<double, _reg_sorted_point3D>();
-      for (unsigned j = 0; j < num_points * 3; j+= 3)
-      {
-         distance = get_square_distance3D(&newWarpedPosition[j], &warpedPosition[j]);
-         queue.insert(std::pair<double,
-                      _reg_sorted_point3D>(distance,
-                                           _reg_sorted_point3D(&referencePosition[j],
-                                                               &warpedPosition[j],
-                                                               distance)));
-      }
-
-      distance = 0.0;
-      i = 0;
-      top_points.clear();
-      for (std::multimap<double, _reg_sorted_point3D>::iterator it = queue.begin();it != queue.end(); ++it, ++i)
-      {
-         if (i >= num_to_keep) break;
-         top_points.push_back((*it).second);
-         distance += (*it).first;
-      }
+      reg_lts_getDistances(&ws, final);
+      distance = reg_lts_selectPoints(&ws, num_to_keep);
 
       // If the change is not substantial, we return
       if ((distance > lastDistance) || (lastDistance - distance) < tol)
       {
+         // restore the last transformation
          memcpy(final, &lastTransformation, sizeof(mat44));
          break;
       }
       lastDistance = distance;
       memcpy(&lastTransformation, final, sizeof(mat44));
-      if(affine) {
-         estimate_affine_transformation3D(top_points, final);
-      } else {
-         estimate_rigid_transformation3D(top_points, final);
-      }
+      reg_lts_estimate(&ws, ws.keptReference, ws.keptWarped, num_to_keep, affine, final);
    }
-   delete [] newWarpedPosition;
+   reg_lts_deallocate(&ws);
+}
+/* *************************************************************** */
+///LTS 2D
+void optimize_2D(float* referencePosition, float* warpedPosition,
+                 unsigned int activeBlockNumber, int percent_to_keep, int max_iter, double tol,
+                 mat44 * final, bool affine) {
+   reg_lts_optimise(referencePosition, warpedPosition, activeBlockNumber, 2,
+                    percent_to_keep, max_iter, tol, final, affine);
+}
+/* *************************************************************** */
+///LTS 3D
+void optimize_3D(float *referencePosition, float *warpedPosition,
+                 unsigned int activeBlockNumber, int percent_to_keep, int max_iter, double tol,
+                 mat44 *final, bool affine) {
+   reg_lts_optimise(referencePosition, warpedPosition, activeBlockNumber, 3,
+                    percent_to_keep, max_iter, tol, final, affine);
 }
 /* *************************************************************** */
 #endif
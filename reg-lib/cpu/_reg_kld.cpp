@@ -457,3 +457,289 @@ void reg_kld::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
 }
 /* *************************************************************** */
 /* *************************************************************** */
+template <class DTYPE>
+void GetDiscretisedValueKLD_core3D(nifti_image *controlPointGridImage,
+                                   float *discretisedValue,
+                                   unsigned short *quantisedValue,
+                                   float *nodeOffset,
+                                   float *nodeScale,
+                                   int discretise_radius,
+                                   int discretise_step,
+                                   nifti_image *refImage,
+                                   nifti_image *warImage,
+                                   int *mask,
+                                   double *timePointWeight)
+{
+   const int label_1D_number = (discretise_radius / discretise_step) * 2 + 1;
+   const int label_nD_number = label_1D_number*label_1D_number*label_1D_number;
+   const int nodeNumber = controlPointGridImage->nx*controlPointGridImage->ny*controlPointGridImage->nz;
+   const size_t voxelNumber = (size_t)refImage->nx*refImage->ny*refImage->nz;
+   // Define the transformation matrices
+   mat44 *grid_vox2mm = &controlPointGridImage->qto_xyz;
+   if(controlPointGridImage->sform_code>0)
+      grid_vox2mm = &controlPointGridImage->sto_xyz;
+   mat44 *image_mm2vox = &refImage->qto_ijk;
+   if(refImage->sform_code>0)
+      image_mm2vox = &refImage->sto_ijk;
+   const mat44 grid2img_vox = reg_mat44_mul(image_mm2vox, grid_vox2mm);
+
+   // Compute the block size, the blocks span [centre-size/2, centre+size/2[
+   // as in the ssd. The region covers the block displaced by all labels
+   int blockHalf[3]={
+      (int)reg_ceil(controlPointGridImage->dx / refImage->dx) / 2,
+      (int)reg_ceil(controlPointGridImage->dy / refImage->dy) / 2,
+      (int)reg_ceil(controlPointGridImage->dz / refImage->dz) / 2
+   };
+   const int blockDim[3]={2*blockHalf[0], 2*blockHalf[1], 2*blockHalf[2]};
+   const int regionDim[3]={blockDim[0]+2*discretise_radius,
+                           blockDim[1]+2*discretise_radius,
+                           blockDim[2]+2*discretise_radius};
+   const int blockVoxelNumber = blockDim[0]*blockDim[1]*blockDim[2];
+   const int regionVoxelNumber = regionDim[0]*regionDim[1]*regionDim[2];
+
+   DTYPE *refImgPtr = static_cast<DTYPE *>(refImage->data);
+   DTYPE *warImgPtr = static_cast<DTYPE *>(warImage->data);
+
+   int threadNumber = 1;
+   int tid = 0;
+#if defined (_OPENMP)
+   threadNumber=omp_get_max_threads();
+#endif
+   // Allocate the thread buffers, the reference values and their entropy
+   // terms are stored consecutively, as are the warped values and their
+   // logarithms
+   double **refBlockValue = (double **)malloc(threadNumber*sizeof(double *));
+   double **warRegionValue = (double **)malloc(threadNumber*sizeof(double *));
+   float **nodeBuffer = (float **)malloc(threadNumber*sizeof(float *));
+   for(int i=0; i<threadNumber; ++i){
+      refBlockValue[i] = (double *)malloc(2*blockVoxelNumber*sizeof(double));
+      warRegionValue[i] = (double *)malloc(2*regionVoxelNumber*sizeof(double));
+      nodeBuffer[i] = (float *)malloc(label_nD_number*sizeof(float));
+   }
+
+   int node, cpx, cpy, cpz, t, x, y, z, a, b, c, label, blockIndex, regionIndex;
+   int definedValueNumber, centre[3], start[3];
+   float gridVox[3], imageVox[3], *nodeValue;
+   double *refBlock, *refBlockLog, *warRegion, *warRegionLog, refValue, warValue,
+         currentSum, value;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(nodeNumber, controlPointGridImage, refImage, warImage, grid2img_vox, \
+   blockHalf, blockDim, regionDim, blockVoxelNumber, regionVoxelNumber, refImgPtr, \
+   warImgPtr, mask, voxelNumber, refBlockValue, warRegionValue, nodeBuffer, discretisedValue, \
+   quantisedValue, nodeOffset, nodeScale, discretise_radius, discretise_step, \
+   label_1D_number, label_nD_number, timePointWeight) \
+   private(node, cpx, cpy, cpz, t, x, y, z, a, b, c, label, blockIndex, regionIndex, \
+   definedValueNumber, centre, start, gridVox, imageVox, nodeValue, refBlock, \
+   refBlockLog, warRegion, warRegionLog, refValue, warValue, currentSum, value, tid)
+#endif
+   for(node=0; node<nodeNumber; ++node){
+#if defined (_OPENMP)
+      tid=omp_get_thread_num();
+#endif
+      cpx = node % controlPointGridImage->nx;
+      cpy = (node / controlPointGridImage->nx) % controlPointGridImage->ny;
+      cpz = node / (controlPointGridImage->nx*controlPointGridImage->ny);
+      gridVox[0]=cpx;
+      gridVox[1]=cpy;
+      gridVox[2]=cpz;
+      reg_mat44_mul(&grid2img_vox, gridVox, imageVox);
+      centre[0]=(int)reg_round(imageVox[0]);
+      centre[1]=(int)reg_round(imageVox[1]);
+      centre[2]=(int)reg_round(imageVox[2]);
+      refBlock=refBlockValue[tid];
+      refBlockLog=&refBlock[blockVoxelNumber];
+      warRegion=warRegionValue[tid];
+      warRegionLog=&warRegion[regionVoxelNumber];
+
+      if(quantisedValue==NULL)
+         nodeValue = &discretisedValue[(size_t)node * label_nD_number];
+      else nodeValue = nodeBuffer[tid];
+      for(label=0; label<label_nD_number; ++label)
+         nodeValue[label]=0;
+
+      for(t=0; t<refImage->nt; ++t){
+         if(timePointWeight[t]<=0.0) continue;
+         // Extract the reference block and its entropy terms, undefined
+         // values are set to NaN
+         start[0]=centre[0]-blockHalf[0];
+         start[1]=centre[1]-blockHalf[1];
+         start[2]=centre[2]-blockHalf[2];
+         blockIndex=0;
+         definedValueNumber=0;
+         for(z=start[2]; z<start[2]+blockDim[2]; ++z){
+            for(y=start[1]; y<start[1]+blockDim[1]; ++y){
+               for(x=start[0]; x<start[0]+blockDim[0]; ++x){
+                  refValue=std::numeric_limits<double>::quiet_NaN();
+                  if(x>-1 && x<refImage->nx && y>-1 && y<refImage->ny && z>-1 && z<refImage->nz){
+                     size_t voxIndex = ((size_t)z*refImage->ny+y)*refImage->nx+x;
+                     if(mask[voxIndex]>-1){
+                        refValue = refImgPtr[t*voxelNumber+voxIndex]+1e-16;
+                        if(refValue==refValue) ++definedValueNumber;
+                     }
+                  }
+                  refBlock[blockIndex]=refValue;
+                  refBlockLog[blockIndex]=refValue*log(refValue);
+                  ++blockIndex;
+               }
+            }
+         }
+         if(definedValueNumber==0){
+            for(label=0; label<label_nD_number; ++label)
+               nodeValue[label]=std::numeric_limits<float>::quiet_NaN();
+            continue;
+         }
+         // Every warped value and its logarithm are computed once for all labels
+         start[0]-=discretise_radius;
+         start[1]-=discretise_radius;
+         start[2]-=discretise_radius;
+         regionIndex=0;
+         for(z=start[2]; z<start[2]+regionDim[2]; ++z){
+            for(y=start[1]; y<start[1]+regionDim[1]; ++y){
+               for(x=start[0]; x<start[0]+regionDim[0]; ++x){
+                  warValue=std::numeric_limits<double>::quiet_NaN();
+                  if(x>-1 && x<warImage->nx && y>-1 && y<warImage->ny && z>-1 && z<warImage->nz)
+                     warValue=warImgPtr[t*voxelNumber+((size_t)z*warImage->ny+y)*warImage->nx+x]+1e-16;
+                  warRegion[regionIndex]=warValue;
+                  warRegionLog[regionIndex]=log(warValue);
+                  ++regionIndex;
+               }
+            }
+         }
+         // Loop over the discretised values. The label l corresponds to a
+         // displacement of l*step-radius voxels, thus to a region offset of l*step.
+         // The blocks are not normalised, the generalised divergence
+         // p.log(p/q)-p+q is thus used. It is positive and only null when the
+         // warped block matches the reference block
+         label=0;
+         for(c=0; c<label_1D_number*discretise_step; c+=discretise_step){
+            for(b=0; b<label_1D_number*discretise_step; b+=discretise_step){
+               for(a=0; a<label_1D_number*discretise_step; a+=discretise_step){
+                  currentSum=0.;
+                  definedValueNumber=0;
+                  blockIndex=0;
+                  for(z=0; z<blockDim[2]; ++z){
+                     for(y=0; y<blockDim[1]; ++y){
+                        regionIndex=((z+c)*regionDim[1]+y+b)*regionDim[0]+a;
+                        for(x=0; x<blockDim[0]; ++x){
+                           value=refBlockLog[blockIndex]-refBlock[blockIndex]*warRegionLog[regionIndex]-
+                                 refBlock[blockIndex]+warRegion[regionIndex];
+                           if(value==value && value!=std::numeric_limits<double>::infinity()){
+                              // Rounding errors can not make the divergence negative
+                              currentSum-=value>0.?value:0.;
+                              ++definedValueNumber;
+                           }
+                           ++blockIndex;
+                           ++regionIndex;
+                        }
+                     }
+                  }
+                  value=std::numeric_limits<double>::quiet_NaN();
+                  if(definedValueNumber>0)
+                     value=currentSum/definedValueNumber;
+                  nodeValue[label] += timePointWeight[t] * value;
+                  ++label;
+               } // a
+            } // b
+         } // c
+      } // t
+      // Deal with the labels that contains NaN values
+      reg_discretisedValue_fillUndefined(nodeValue, label_1D_number);
+      if(quantisedValue!=NULL)
+         reg_discretisedValue_quantise(nodeValue,
+                                       label_nD_number,
+                                       &quantisedValue[(size_t)node * label_nD_number],
+                                       &nodeOffset[node],
+                                       &nodeScale[node]);
+   } // node
+   for(int i=0; i<threadNumber; ++i){
+      free(refBlockValue[i]);
+      free(warRegionValue[i]);
+      free(nodeBuffer[i]);
+   }
+   free(refBlockValue);
+   free(warRegionValue);
+   free(nodeBuffer);
+}
+/* *************************************************************** */
+void reg_kld::ComputeDiscretisedValue(nifti_image *controlPointGridImage,
+                                      float *discretisedValue,
+                                      unsigned short *quantisedValue,
+                                      float *nodeOffset,
+                                      float *nodeScale,
+                                      int discretise_radius,
+                                      int discretise_step)
+{
+   if(this->referenceImagePointer->nz==1){
+      reg_print_fct_error("reg_kld::GetDiscretisedValue");
+      reg_print_msg_error("Not implemented in 2D yet");
+      reg_exit();
+   }
+   switch(this->referenceImagePointer->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      GetDiscretisedValueKLD_core3D<float>
+            (controlPointGridImage,
+             discretisedValue,
+             quantisedValue,
+             nodeOffset,
+             nodeScale,
+             discretise_radius,
+             discretise_step,
+             this->referenceImagePointer,
+             this->warpedFloatingImagePointer,
+             this->referenceMaskPointer,
+             this->timePointWeight);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      GetDiscretisedValueKLD_core3D<double>
+            (controlPointGridImage,
+             discretisedValue,
+             quantisedValue,
+             nodeOffset,
+             nodeScale,
+             discretise_radius,
+             discretise_step,
+             this->referenceImagePointer,
+             this->warpedFloatingImagePointer,
+             this->referenceMaskPointer,
+             this->timePointWeight);
+      break;
+   default:
+      reg_print_fct_error("reg_kld::GetDiscretisedValue");
+      reg_print_msg_error("Unsupported datatype");
+      reg_exit();
+   }
+}
+/* *************************************************************** */
+void reg_kld::GetDiscretisedValue(nifti_image *controlPointGridImage,
+                                  float *discretisedValue,
+                                  int discretise_radius,
+                                  int discretise_step)
+{
+   this->ComputeDiscretisedValue(controlPointGridImage,
+                                 discretisedValue,
+                                 NULL,
+                                 NULL,
+                                 NULL,
+                                 discretise_radius,
+                                 discretise_step);
+}
+/* *************************************************************** */
+void reg_kld::GetQuantisedDiscretisedValue(nifti_image *controlPointGridImage,
+                                           unsigned short *quantisedValue,
+                                           float *nodeOffset,
+                                           float *nodeScale,
+                                           int discretise_radius,
+                                           int discretise_step)
+{
+   this->ComputeDiscretisedValue(controlPointGridImage,
+                                 NULL,
+                                 quantisedValue,
+                                 nodeOffset,
+                                 nodeScale,
+                                 discretise_radius,
+                                 discretise_step);
+}
+/* *************************************************************** */
+/* *************************************************************** */
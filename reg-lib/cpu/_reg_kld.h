@@ -36,8 +36,31 @@ public:
    virtual double GetSimilarityMeasureValue();
    /// @brief Compute the voxel based kld gradient
    virtual void GetVoxelBasedSimilarityMeasureGradient(int current_timepoint);
+   /// @brief Compute the block generalised kld, p.log(p/q)-p+q, for every
+   /// control point and label
+   virtual void GetDiscretisedValue(nifti_image *controlPointGridImage,
+                                    float *discretisedValue,
+                                    int discretise_radius,
+                                    int discretise_step);
+   /// @brief Compute the block kld quantised on 16 bits
+   virtual void GetQuantisedDiscretisedValue(nifti_image *controlPointGridImage,
+                                             unsigned short *quantisedValue,
+                                             float *nodeOffset,
+                                             float *nodeScale,
+                                             int discretise_radius,
+                                             int discretise_step);
    /// @brief reg_kld class destructor
    ~reg_kld() {}
+protected:
+   /// @brief Compute the discretised kld, the values are quantised when
+   /// quantisedValue is not NULL
+   void ComputeDiscretisedValue(nifti_image *controlPointGridImage,
+                                float *discretisedValue,
+                                unsigned short *quantisedValue,
+                                float *nodeOffset,
+                                float *nodeScale,
+                                int discretise_radius,
+                                int discretise_step);
 };
 /* *************************************************************** */
 
@@ -33,8 +33,9 @@ reg_lncc::reg_lncc()
    this->warpedReferenceSdevImage=NULL;
    this->backwardMask = NULL;
 
-   // Gaussian kernel is used by default
-   this->kernelType=GAUSSIAN_KERNEL;
+   // Gaussian kernel is used by default, large kernels being approximated
+   // by a recursive filter
+   this->kernelType=RECURSIVE_GAUSSIAN_KERNEL;
 
    for(int i=0; i<255; ++i)
       kernelStandardDeviation[i]=-5.f;
@@ -87,11 +88,62 @@ reg_lncc::~reg_lncc()
 /* *************************************************************** */
 /* *************************************************************** */
 template <class DTYPE>
+void reg_lncc::UpdateReferenceStatImages(nifti_image *refImage,
+                                         nifti_image *meanRefImage,
+                                         nifti_image *stdDevRefImage,
+                                         int *refMask)
+{
+   // The statistics only depend on the reference image and its mask. They are
+   // thus computed once for all active time points and used by every iteration
+#ifdef _WIN32
+   long voxel;
+   long voxelNumber = (long)refImage->nx*refImage->ny*refImage->nz;
+#else
+   size_t voxel;
+   size_t voxelNumber = (size_t)refImage->nx*refImage->ny*refImage->nz;
+#endif
+   int *mask=(int *)malloc(voxelNumber*sizeof(int));
+   memcpy(mask, refMask, voxelNumber*sizeof(int));
+   reg_tools_removeNanFromMask(refImage, mask);
+
+   bool *activeTimePoint=(bool *)calloc(refImage->nt, sizeof(bool));
+   for(int t=0; t<refImage->nt; ++t)
+      activeTimePoint[t]=this->timePointWeight[t]>0.0;
+
+   memcpy(meanRefImage->data, refImage->data, refImage->nvox*refImage->nbyper);
+   reg_tools_multiplyImageToImage(refImage, refImage, stdDevRefImage);
+   reg_tools_kernelConvolution(meanRefImage, this->kernelStandardDeviation,
+                               this->kernelType, mask, activeTimePoint);
+   reg_tools_kernelConvolution(stdDevRefImage, this->kernelStandardDeviation,
+                               this->kernelType, mask, activeTimePoint);
+
+   for(int t=0; t<refImage->nt; ++t)
+   {
+      if(!activeTimePoint[t]) continue;
+      DTYPE *meanRefPtr = &static_cast<DTYPE *>(meanRefImage->data)[t*voxelNumber];
+      DTYPE *sdevRefPtr = &static_cast<DTYPE *>(stdDevRefImage->data)[t*voxelNumber];
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(voxelNumber, sdevRefPtr, meanRefPtr) \
+   private(voxel)
+#endif
+      for(voxel=0; voxel<voxelNumber; ++voxel)
+      {
+         // G*(I^2) - (G*I)^2
+         sdevRefPtr[voxel] = sqrt(sdevRefPtr[voxel] - reg_pow2(meanRefPtr[voxel]));
+         // Stabilise the computation
+         if(sdevRefPtr[voxel]<1.e-06) sdevRefPtr[voxel]=static_cast<DTYPE>(0);
+      }
+   }
+   free(activeTimePoint);
+   free(mask);
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class DTYPE>
 void reg_lncc::UpdateLocalStatImages(nifti_image *refImage,
                                      nifti_image *warImage,
-                                     nifti_image *meanRefImage,
                                      nifti_image *meanWarImage,
-                                     nifti_image *stdDevRefImage,
                                      nifti_image *stdDevWarImage,
                                      int *refMask,
                                      int *combinedMask,
@@ -109,20 +161,6 @@ void reg_lncc::UpdateLocalStatImages(nifti_image *refImage,
    reg_tools_removeNanFromMask(refImage, combinedMask);
    reg_tools_removeNanFromMask(warImage, combinedMask);
 
-   DTYPE *origRefPtr = static_cast<DTYPE *>(refImage->data);
-   DTYPE *meanRefPtr = static_cast<DTYPE *>(meanRefImage->data);
-   DTYPE *sdevRefPtr = static_cast<DTYPE *>(stdDevRefImage->data);
-   memcpy(meanRefPtr, &origRefPtr[current_timepoint*voxelNumber],
-         voxelNumber*refImage->nbyper);
-   memcpy(sdevRefPtr, &origRefPtr[current_timepoint*voxelNumber],
-         voxelNumber*refImage->nbyper);
-
-   reg_tools_multiplyImageToImage(stdDevRefImage, stdDevRefImage, stdDevRefImage);
-   reg_tools_kernelConvolution(meanRefImage, this->kernelStandardDeviation,
-                               this->kernelType, combinedMask);
-   reg_tools_kernelConvolution(stdDevRefImage, this->kernelStandardDeviation,
-                               this->kernelType, combinedMask);
-
    DTYPE *origWarPtr = static_cast<DTYPE *>(warImage->data);
    DTYPE *meanWarPtr = static_cast<DTYPE *>(meanWarImage->data);
    DTYPE *sdevWarPtr = static_cast<DTYPE *>(stdDevWarImage->data);
@@ -132,22 +170,20 @@ void reg_lncc::UpdateLocalStatImages(nifti_image *refImage,
          voxelNumber*warImage->nbyper);
 
    reg_tools_multiplyImageToImage(stdDevWarImage, stdDevWarImage, stdDevWarImage);
-   reg_tools_kernelConvolution(meanWarImage, this->kernelStandardDeviation,
+   reg_tools_kernelConvolution(meanWarImage, &this->kernelStandardDeviation[current_timepoint],
                                this->kernelType, combinedMask);
-   reg_tools_kernelConvolution(stdDevWarImage, this->kernelStandardDeviation,
+   reg_tools_kernelConvolution(stdDevWarImage, &this->kernelStandardDeviation[current_timepoint],
                                this->kernelType, combinedMask);
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
-   shared(voxelNumber, sdevRefPtr, meanRefPtr, sdevWarPtr, meanWarPtr) \
+   shared(voxelNumber, sdevWarPtr, meanWarPtr) \
    private(voxel)
 #endif
    for(voxel=0; voxel<voxelNumber; ++voxel)
    {
       // G*(I^2) - (G*I)^2
-      sdevRefPtr[voxel] = sqrt(sdevRefPtr[voxel] - reg_pow2(meanRefPtr[voxel]));
       sdevWarPtr[voxel] = sqrt(sdevWarPtr[voxel] - reg_pow2(meanWarPtr[voxel]));
       // Stabilise the computation
-      if(sdevRefPtr[voxel]<1.e-06) sdevRefPtr[voxel]=static_cast<DTYPE>(0);
       if(sdevWarPtr[voxel]<1.e-06) sdevWarPtr[voxel]=static_cast<DTYPE>(0);
    }
 }
@@ -242,12 +278,13 @@ void reg_lncc::InitialiseMeasure(nifti_image *refImgPtr,
    this->forwardCorrelationImage->data=(void *)malloc(voxelNumber *
                                                       this->forwardCorrelationImage->nbyper);
 
-   // Allocate the required images to store mean and stdev of the reference image
-   this->referenceMeanImage=nifti_copy_nim_info(this->forwardCorrelationImage);
+   // Allocate the required images to store mean and stdev of the reference
+   // image, every time point is stored
+   this->referenceMeanImage=nifti_copy_nim_info(this->referenceImagePointer);
    this->referenceMeanImage->data=(void *)malloc(this->referenceMeanImage->nvox *
                                                  this->referenceMeanImage->nbyper);
 
-   this->referenceSdevImage=nifti_copy_nim_info(this->forwardCorrelationImage);
+   this->referenceSdevImage=nifti_copy_nim_info(this->referenceImagePointer);
    this->referenceSdevImage->data=(void *)malloc(this->referenceSdevImage->nvox *
                                                  this->referenceSdevImage->nbyper);
 
@@ -274,12 +311,13 @@ void reg_lncc::InitialiseMeasure(nifti_image *refImgPtr,
       this->backwardCorrelationImage->data=(void *)malloc(voxelNumber *
                                                           this->backwardCorrelationImage->nbyper);
 
-      // Allocate the required images to store mean and stdev of the floating image
-      this->floatingMeanImage=nifti_copy_nim_info(this->backwardCorrelationImage);
+      // Allocate the required images to store mean and stdev of the floating
+      // image, every time point is stored
+      this->floatingMeanImage=nifti_copy_nim_info(this->floatingImagePointer);
       this->floatingMeanImage->data=(void *)malloc(this->floatingMeanImage->nvox *
                                                    this->floatingMeanImage->nbyper);
 
-      this->floatingSdevImage=nifti_copy_nim_info(this->backwardCorrelationImage);
+      this->floatingSdevImage=nifti_copy_nim_info(this->floatingImagePointer);
       this->floatingSdevImage->data=(void *)malloc(this->floatingSdevImage->nvox *
                                                    this->floatingSdevImage->nbyper);
 
@@ -295,6 +333,38 @@ void reg_lncc::InitialiseMeasure(nifti_image *refImgPtr,
       // Allocate the array to store the mask of the backward image
       this->backwardMask=(int *)malloc(voxelNumber*sizeof(int));
    }
+
+   // The reference and floating images are not modified during the
+   // registration, their local statistics are computed once
+   switch(this->referenceImagePointer->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      this->UpdateReferenceStatImages<float>(this->referenceImagePointer,
+                                             this->referenceMeanImage,
+                                             this->referenceSdevImage,
+                                             this->referenceMaskPointer);
+      if(this->isSymmetric)
+         this->UpdateReferenceStatImages<float>(this->floatingImagePointer,
+                                                this->floatingMeanImage,
+                                                this->floatingSdevImage,
+                                                this->floatingMaskPointer);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      this->UpdateReferenceStatImages<double>(this->referenceImagePointer,
+                                              this->referenceMeanImage,
+                                              this->referenceSdevImage,
+                                              this->referenceMaskPointer);
+      if(this->isSymmetric)
+         this->UpdateReferenceStatImages<double>(this->floatingImagePointer,
+                                                 this->floatingMeanImage,
+                                                 this->floatingSdevImage,
+                                                 this->floatingMaskPointer);
+      break;
+   default:
+      reg_print_fct_error("reg_lncc::InitialiseMeasure");
+      reg_print_msg_error("Unsupported datatype");
+      reg_exit();
+   }
 #ifndef NDEBUG
    char text[255];
    reg_print_msg_debug("reg_lncc::InitialiseMeasure().");
@@ -337,9 +407,9 @@ double reg_getLNCCValue(nifti_image *referenceImage,
    DTYPE *warImagePtr=static_cast<DTYPE *>(warpedImage->data);
    DTYPE *currentWarPtr = &warImagePtr[current_timepoint*voxelNumber];
 
-   DTYPE *refMeanPtr=static_cast<DTYPE *>(referenceMeanImage->data);
+   DTYPE *refMeanPtr=&static_cast<DTYPE *>(referenceMeanImage->data)[current_timepoint*voxelNumber];
    DTYPE *warMeanPtr=static_cast<DTYPE *>(warpedMeanImage->data);
-   DTYPE *refSdevPtr=static_cast<DTYPE *>(referenceSdevImage->data);
+   DTYPE *refSdevPtr=&static_cast<DTYPE *>(referenceSdevImage->data)[current_timepoint*voxelNumber];
    DTYPE *warSdevPtr=static_cast<DTYPE *>(warpedSdevImage->data);
    DTYPE *correlaPtr=static_cast<DTYPE *>(correlationImage->data);
 
@@ -391,15 +461,13 @@ double reg_lncc::GetSimilarityMeasureValue()
       if (this->timePointWeight[current_timepoint] > 0.0)
       {
          double tp_value = 0.0;
-         // Compute the mean and variance of the reference and warped floating
+         // Compute the mean and variance of the warped floating
          switch (this->referenceImagePointer->datatype)
          {
          case NIFTI_TYPE_FLOAT32:
             this->UpdateLocalStatImages<float>(this->referenceImagePointer,
                this->warpedFloatingImagePointer,
-               this->referenceMeanImage,
                this->warpedFloatingMeanImage,
-               this->referenceSdevImage,
                this->warpedFloatingSdevImage,
                this->referenceMaskPointer,
                this->forwardMask,
@@ -408,9 +476,7 @@ double reg_lncc::GetSimilarityMeasureValue()
          case NIFTI_TYPE_FLOAT64:
             this->UpdateLocalStatImages<double>(this->referenceImagePointer,
                this->warpedFloatingImagePointer,
-               this->referenceMeanImage,
                this->warpedFloatingMeanImage,
-               this->referenceSdevImage,
                this->warpedFloatingSdevImage,
                this->referenceMaskPointer,
                this->forwardMask,
@@ -429,7 +495,7 @@ double reg_lncc::GetSimilarityMeasureValue()
 					this->warpedFloatingMeanImage,
 					this->warpedFloatingSdevImage,
 					this->forwardMask,
-					this->kernelStandardDeviation,
+					&this->kernelStandardDeviation[current_timepoint],
 					this->forwardCorrelationImage,
 					this->kernelType,
 					current_timepoint);
@@ -442,7 +508,7 @@ double reg_lncc::GetSimilarityMeasureValue()
 					this->warpedFloatingMeanImage,
 					this->warpedFloatingSdevImage,
 					this->forwardMask,
-					this->kernelStandardDeviation,
+					&this->kernelStandardDeviation[current_timepoint],
 					this->forwardCorrelationImage,
 					this->kernelType,
 					current_timepoint);
@@ -450,15 +516,13 @@ double reg_lncc::GetSimilarityMeasureValue()
 			}
 			if (this->isSymmetric)
 			{
-				// Compute the mean and variance of the floating and warped reference
+				// Compute the mean and variance of the warped reference
 				switch (this->floatingImagePointer->datatype)
 				{
 				case NIFTI_TYPE_FLOAT32:
 					this->UpdateLocalStatImages<float>(this->floatingImagePointer,
 						this->warpedReferenceImagePointer,
-						this->floatingMeanImage,
 						this->warpedReferenceMeanImage,
-						this->floatingSdevImage,
 						this->warpedReferenceSdevImage,
 						this->floatingMaskPointer,
 						this->backwardMask,
@@ -467,9 +531,7 @@ double reg_lncc::GetSimilarityMeasureValue()
 				case NIFTI_TYPE_FLOAT64:
 					this->UpdateLocalStatImages<double>(this->floatingImagePointer,
 						this->warpedReferenceImagePointer,
-						this->floatingMeanImage,
 						this->warpedReferenceMeanImage,
-						this->floatingSdevImage,
 						this->warpedReferenceSdevImage,
 						this->floatingMaskPointer,
 						this->backwardMask,
@@ -487,7 +549,7 @@ double reg_lncc::GetSimilarityMeasureValue()
 						this->warpedReferenceMeanImage,
 						this->warpedReferenceSdevImage,
 						this->backwardMask,
-						this->kernelStandardDeviation,
+						&this->kernelStandardDeviation[current_timepoint],
 						this->backwardCorrelationImage,
 						this->kernelType,
 						current_timepoint);
@@ -500,7 +562,7 @@ double reg_lncc::GetSimilarityMeasureValue()
 						this->warpedReferenceMeanImage,
 						this->warpedReferenceSdevImage,
 						this->backwardMask,
-						this->kernelStandardDeviation,
+						&this->kernelStandardDeviation[current_timepoint],
 						this->backwardCorrelationImage,
 						this->kernelType,
 						current_timepoint);
@@ -547,9 +609,9 @@ void reg_getVoxelBasedLNCCGradient(nifti_image *referenceImage,
    DTYPE *warImagePtr=static_cast<DTYPE *>(warpedImage->data);
    DTYPE *currentWarPtr = &warImagePtr[current_timepoint*voxelNumber];
 
-   DTYPE *refMeanPtr=static_cast<DTYPE *>(referenceMeanImage->data);
+   DTYPE *refMeanPtr=&static_cast<DTYPE *>(referenceMeanImage->data)[current_timepoint*voxelNumber];
    DTYPE *warMeanPtr=static_cast<DTYPE *>(warpedMeanImage->data);
-   DTYPE *refSdevPtr=static_cast<DTYPE *>(referenceSdevImage->data);
+   DTYPE *refSdevPtr=&static_cast<DTYPE *>(referenceSdevImage->data)[current_timepoint*voxelNumber];
    DTYPE *warSdevPtr=static_cast<DTYPE *>(warpedSdevImage->data);
    DTYPE *correlaPtr=static_cast<DTYPE *>(correlationImage->data);
 
@@ -684,15 +746,13 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
    if(this->timePointWeight[current_timepoint]==0.0)
       return;
 
-   // Compute the mean and variance of the reference and warped floating
+   // Compute the mean and variance of the warped floating
    switch(this->referenceImagePointer->datatype)
    {
    case NIFTI_TYPE_FLOAT32:
       this->UpdateLocalStatImages<float>(this->referenceImagePointer,
                                          this->warpedFloatingImagePointer,
-                                         this->referenceMeanImage,
                                          this->warpedFloatingMeanImage,
-                                         this->referenceSdevImage,
                                          this->warpedFloatingSdevImage,
                                          this->referenceMaskPointer,
                                          this->forwardMask,
@@ -701,9 +761,7 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
    case NIFTI_TYPE_FLOAT64:
       this->UpdateLocalStatImages<double>(this->referenceImagePointer,
                                           this->warpedFloatingImagePointer,
-                                          this->referenceMeanImage,
                                           this->warpedFloatingMeanImage,
-                                          this->referenceSdevImage,
                                           this->warpedFloatingSdevImage,
                                           this->referenceMaskPointer,
                                           this->forwardMask,
@@ -722,7 +780,7 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
                                            this->warpedFloatingMeanImage,
                                            this->warpedFloatingSdevImage,
                                            this->forwardMask,
-                                           this->kernelStandardDeviation,
+                                           &this->kernelStandardDeviation[current_timepoint],
                                            this->forwardCorrelationImage,
                                            this->warpedFloatingGradientImagePointer,
                                            this->forwardVoxelBasedGradientImagePointer,
@@ -738,7 +796,7 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
                                             this->warpedFloatingMeanImage,
                                             this->warpedFloatingSdevImage,
                                             this->forwardMask,
-                                            this->kernelStandardDeviation,
+                                            &this->kernelStandardDeviation[current_timepoint],
                                             this->forwardCorrelationImage,
                                             this->warpedFloatingGradientImagePointer,
                                             this->forwardVoxelBasedGradientImagePointer,
@@ -749,15 +807,13 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
    }
    if(this->isSymmetric)
    {
-      // Compute the mean and variance of the floating and warped reference
+      // Compute the mean and variance of the warped reference
       switch(this->floatingImagePointer->datatype)
       {
       case NIFTI_TYPE_FLOAT32:
          this->UpdateLocalStatImages<float>(this->floatingImagePointer,
                                             this->warpedReferenceImagePointer,
-                                            this->floatingMeanImage,
                                             this->warpedReferenceMeanImage,
-                                            this->floatingSdevImage,
                                             this->warpedReferenceSdevImage,
                                             this->floatingMaskPointer,
                                             this->backwardMask,
@@ -766,9 +822,7 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
       case NIFTI_TYPE_FLOAT64:
          this->UpdateLocalStatImages<double>(this->floatingImagePointer,
                                              this->warpedReferenceImagePointer,
-                                             this->floatingMeanImage,
                                              this->warpedReferenceMeanImage,
-                                             this->floatingSdevImage,
                                              this->warpedReferenceSdevImage,
                                              this->floatingMaskPointer,
                                              this->backwardMask,
@@ -786,7 +840,7 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
                                               this->warpedReferenceMeanImage,
                                               this->warpedReferenceSdevImage,
                                               this->backwardMask,
-                                              this->kernelStandardDeviation,
+                                              &this->kernelStandardDeviation[current_timepoint],
                                               this->backwardCorrelationImage,
                                               this->warpedReferenceGradientImagePointer,
                                               this->backwardVoxelBasedGradientImagePointer,
@@ -802,7 +856,7 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
                                                this->warpedReferenceMeanImage,
                                                this->warpedReferenceSdevImage,
                                                this->backwardMask,
-                                               this->kernelStandardDeviation,
+                                               &this->kernelStandardDeviation[current_timepoint],
                                                this->backwardCorrelationImage,
                                                this->warpedReferenceGradientImagePointer,
                                                this->backwardVoxelBasedGradientImagePointer,
@@ -816,5 +870,404 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
 }
 /* *************************************************************** */
 /* *************************************************************** */
+/// @brief Returns the sum over the box [start, end[ of a summed-area table
+/// whose first row, column and slice are null
+static inline double reg_lncc_boxSum(double *table,
+                                     const int *tableDim,
+                                     int x0, int y0, int z0,
+                                     int x1, int y1, int z1)
+{
+   const size_t sliceSize=(size_t)tableDim[0]*tableDim[1];
+   double *z0Ptr=&table[z0*sliceSize];
+   double *z1Ptr=&table[z1*sliceSize];
+   return z1Ptr[y1*tableDim[0]+x1] - z1Ptr[y1*tableDim[0]+x0]
+         - z1Ptr[y0*tableDim[0]+x1] + z1Ptr[y0*tableDim[0]+x0]
+         - z0Ptr[y1*tableDim[0]+x1] + z0Ptr[y1*tableDim[0]+x0]
+         + z0Ptr[y0*tableDim[0]+x1] - z0Ptr[y0*tableDim[0]+x0];
+}
+/* *************************************************************** */
+template <class DTYPE>
+void GetDiscretisedValueLNCC_core3D(nifti_image *controlPointGridImage,
+                                    float *discretisedValue,
+                                    unsigned short *quantisedValue,
+                                    float *nodeOffset,
+                                    float *nodeScale,
+                                    int discretise_radius,
+                                    int discretise_step,
+                                    nifti_image *refImage,
+                                    nifti_image *warImage,
+                                    int *mask,
+                                    double *timePointWeight)
+{
+   const int label_1D_number = (discretise_radius / discretise_step) * 2 + 1;
+   const int label_nD_number = label_1D_number*label_1D_number*label_1D_number;
+   const int nodeNumber = controlPointGridImage->nx*controlPointGridImage->ny*controlPointGridImage->nz;
+   const size_t voxelNumber = (size_t)refImage->nx*refImage->ny*refImage->nz;
+   // Define the transformation matrices
+   mat44 *grid_vox2mm = &controlPointGridImage->qto_xyz;
+   if(controlPointGridImage->sform_code>0)
+      grid_vox2mm = &controlPointGridImage->sto_xyz;
+   mat44 *image_mm2vox = &refImage->qto_ijk;
+   if(refImage->sform_code>0)
+      image_mm2vox = &refImage->sto_ijk;
+   const mat44 grid2img_vox = reg_mat44_mul(image_mm2vox, grid_vox2mm);
+
+   // Compute the block size, the blocks span [centre-size/2, centre+size/2[
+   // as in the ssd. The region covers the block displaced by all labels
+   int blockHalf[3]={
+      (int)reg_ceil(controlPointGridImage->dx / refImage->dx) / 2,
+      (int)reg_ceil(controlPointGridImage->dy / refImage->dy) / 2,
+      (int)reg_ceil(controlPointGridImage->dz / refImage->dz) / 2
+   };
+   const int blockDim[3]={2*blockHalf[0], 2*blockHalf[1], 2*blockHalf[2]};
+   const int regionDim[3]={blockDim[0]+2*discretise_radius,
+                           blockDim[1]+2*discretise_radius,
+                           blockDim[2]+2*discretise_radius};
+   const int tableDim[3]={regionDim[0]+1, regionDim[1]+1, regionDim[2]+1};
+   const int blockVoxelNumber = blockDim[0]*blockDim[1]*blockDim[2];
+   const int regionVoxelNumber = regionDim[0]*regionDim[1]*regionDim[2];
+   const int tableSize = tableDim[0]*tableDim[1]*tableDim[2];
+
+   DTYPE *refImgPtr = static_cast<DTYPE *>(refImage->data);
+   DTYPE *warImgPtr = static_cast<DTYPE *>(warImage->data);
+
+   int threadNumber = 1;
+   int tid = 0;
+#if defined (_OPENMP)
+   threadNumber=omp_get_max_threads();
+#endif
+   // Allocate the thread buffers. The summed-area tables of the warped values,
+   // squared values and defined voxels are stored consecutively
+   double **refBlockValue = (double **)malloc(threadNumber*sizeof(double *));
+   double **warRegionValue = (double **)malloc(threadNumber*sizeof(double *));
+   double **regionTable = (double **)malloc(threadNumber*sizeof(double *));
+   float **nodeBuffer = (float **)malloc(threadNumber*sizeof(float *));
+   for(int i=0; i<threadNumber; ++i){
+      refBlockValue[i] = (double *)malloc(blockVoxelNumber*sizeof(double));
+      warRegionValue[i] = (double *)malloc(regionVoxelNumber*sizeof(double));
+      regionTable[i] = (double *)calloc(3*tableSize,sizeof(double));
+      nodeBuffer[i] = (float *)malloc(label_nD_number*sizeof(float));
+   }
+
+   int node, cpx, cpy, cpz, t, x, y, z, a, b, c, label, blockIndex, regionIndex;
+   int definedValueNumber, centre[3], start[3];
+   float gridVox[3], imageVox[3], *nodeValue;
+   double *refBlock, *warRegion, *sumTable, *sum2Table, *countTable;
+   double refMean, warMean, refVar, blockRefVar, warVar, refSum, warSum, refSum2, warSum2, crossSum;
+   double refValue, warValue, value;
+   bool refBlockFull;
+   DTYPE intensity;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(nodeNumber, controlPointGridImage, refImage, warImage, grid2img_vox, \
+   blockHalf, blockDim, regionDim, tableDim, blockVoxelNumber, regionVoxelNumber, \
+   tableSize, refImgPtr, warImgPtr, mask, voxelNumber, refBlockValue, warRegionValue, \
+   regionTable, nodeBuffer, discretisedValue, quantisedValue, nodeOffset, nodeScale, \
+   discretise_radius, discretise_step, label_1D_number, label_nD_number, timePointWeight) \
+   private(node, cpx, cpy, cpz, t, x, y, z, a, b, c, label, blockIndex, regionIndex, \
+   definedValueNumber, centre, start, gridVox, imageVox, nodeValue, refBlock, \
+   warRegion, sumTable, sum2Table, countTable, refMean, warMean, refVar, blockRefVar, \
+   warVar, \
+   refSum, warSum, refSum2, warSum2, crossSum, refValue, warValue, value, \
+   refBlockFull, intensity, tid)
+#endif
+   for(node=0; node<nodeNumber; ++node){
+#if defined (_OPENMP)
+      tid=omp_get_thread_num();
+#endif
+      cpx = node % controlPointGridImage->nx;
+      cpy = (node / controlPointGridImage->nx) % controlPointGridImage->ny;
+      cpz = node / (controlPointGridImage->nx*controlPointGridImage->ny);
+      gridVox[0]=cpx;
+      gridVox[1]=cpy;
+      gridVox[2]=cpz;
+      reg_mat44_mul(&grid2img_vox, gridVox, imageVox);
+      centre[0]=(int)reg_round(imageVox[0]);
+      centre[1]=(int)reg_round(imageVox[1]);
+      centre[2]=(int)reg_round(imageVox[2]);
+      refBlock=refBlockValue[tid];
+      warRegion=warRegionValue[tid];
+      sumTable=regionTable[tid];
+      sum2Table=&sumTable[tableSize];
+      countTable=&sum2Table[tableSize];
+
+      if(quantisedValue==NULL)
+         nodeValue = &discretisedValue[(size_t)node * label_nD_number];
+      else nodeValue = nodeBuffer[tid];
+      for(label=0; label<label_nD_number; ++label)
+         nodeValue[label]=0;
+
+      for(t=0; t<refImage->nt; ++t){
+         if(timePointWeight[t]<=0.0) continue;
+         // Extract the reference block, undefined values are set to NaN
+         start[0]=centre[0]-blockHalf[0];
+         start[1]=centre[1]-blockHalf[1];
+         start[2]=centre[2]-blockHalf[2];
+         blockIndex=0;
+         definedValueNumber=0;
+         refMean=0.;
+         for(z=start[2]; z<start[2]+blockDim[2]; ++z){
+            for(y=start[1]; y<start[1]+blockDim[1]; ++y){
+               for(x=start[0]; x<start[0]+blockDim[0]; ++x){
+                  refValue=std::numeric_limits<double>::quiet_NaN();
+                  if(x>-1 && x<refImage->nx && y>-1 && y<refImage->ny && z>-1 && z<refImage->nz){
+                     size_t voxIndex = ((size_t)z*refImage->ny+y)*refImage->nx+x;
+                     intensity = refImgPtr[t*voxelNumber+voxIndex];
+                     if(mask[voxIndex]>-1 && intensity==intensity){
+                        refValue=intensity;
+                        refMean+=refValue;
+                        ++definedValueNumber;
+                     }
+                  }
+                  refBlock[blockIndex++]=refValue;
+               }
+            }
+         }
+         if(definedValueNumber==0){
+            for(label=0; label<label_nD_number; ++label)
+               nodeValue[label]=std::numeric_limits<float>::quiet_NaN();
+            continue;
+         }
+         // The reference block is centred once for all labels
+         refBlockFull=definedValueNumber==blockVoxelNumber;
+         refMean/=definedValueNumber;
+         refVar=0.;
+         for(blockIndex=0; blockIndex<blockVoxelNumber; ++blockIndex){
+            refBlock[blockIndex]-=refMean;
+            if(refBlock[blockIndex]==refBlock[blockIndex])
+               refVar+=refBlock[blockIndex]*refBlock[blockIndex];
+         }
+         // Extract the warped region and centre it to limit the round-off
+         // errors of the summed-area tables
+         start[0]-=discretise_radius;
+         start[1]-=discretise_radius;
+         start[2]-=discretise_radius;
+         regionIndex=0;
+         definedValueNumber=0;
+         warMean=0.;
+         for(z=start[2]; z<start[2]+regionDim[2]; ++z){
+            for(y=start[1]; y<start[1]+regionDim[1]; ++y){
+               for(x=start[0]; x<start[0]+regionDim[0]; ++x){
+                  warValue=std::numeric_limits<double>::quiet_NaN();
+                  if(x>-1 && x<warImage->nx && y>-1 && y<warImage->ny && z>-1 && z<warImage->nz){
+                     intensity = warImgPtr[t*voxelNumber+((size_t)z*warImage->ny+y)*warImage->nx+x];
+                     if(intensity==intensity){
+                        warValue=intensity;
+                        warMean+=warValue;
+                        ++definedValueNumber;
+                     }
+                  }
+                  warRegion[regionIndex++]=warValue;
+               }
+            }
+         }
+         if(definedValueNumber>0)
+            warMean/=definedValueNumber;
+         // Fill the summed-area tables of the region
+         regionIndex=0;
+         for(z=1; z<tableDim[2]; ++z){
+            for(y=1; y<tableDim[1]; ++y){
+               size_t tableIndex=((size_t)z*tableDim[1]+y)*tableDim[0]+1;
+               for(x=1; x<tableDim[0]; ++x){
+                  warValue=warRegion[regionIndex];
+                  if(warValue==warValue){
+                     warValue-=warMean;
+                     warRegion[regionIndex]=warValue;
+                     sumTable[tableIndex]=warValue;
+                     sum2Table[tableIndex]=warValue*warValue;
+                     countTable[tableIndex]=1.;
+                  }
+                  else{
+                     sumTable[tableIndex]=0.;
+                     sum2Table[tableIndex]=0.;
+                     countTable[tableIndex]=0.;
+                  }
+                  ++regionIndex;
+                  ++tableIndex;
+               }
+            }
+         }
+         for(int s=0; s<3*tableSize; s+=tableSize){
+            for(z=1; z<tableDim[2]; ++z)
+               for(y=1; y<tableDim[1]; ++y)
+                  for(x=2; x<tableDim[0]; ++x)
+                     sumTable[s+(z*tableDim[1]+y)*tableDim[0]+x]+=sumTable[s+(z*tableDim[1]+y)*tableDim[0]+x-1];
+            for(z=1; z<tableDim[2]; ++z)
+               for(y=2; y<tableDim[1]; ++y)
+                  for(x=1; x<tableDim[0]; ++x)
+                     sumTable[s+(z*tableDim[1]+y)*tableDim[0]+x]+=sumTable[s+(z*tableDim[1]+y-1)*tableDim[0]+x];
+            for(z=2; z<tableDim[2]; ++z)
+               for(y=1; y<tableDim[1]; ++y)
+                  for(x=1; x<tableDim[0]; ++x)
+                     sumTable[s+(z*tableDim[1]+y)*tableDim[0]+x]+=sumTable[s+((z-1)*tableDim[1]+y)*tableDim[0]+x];
+         }
+         // Loop over the discretised values. The label l corresponds to a
+         // displacement of l*step-radius voxels, thus to a region offset of l*step
+         label=0;
+         for(c=0; c<label_1D_number*discretise_step; c+=discretise_step){
+            for(b=0; b<label_1D_number*discretise_step; b+=discretise_step){
+               for(a=0; a<label_1D_number*discretise_step; a+=discretise_step){
+                  crossSum=0.;
+                  blockIndex=0;
+                  if(refBlockFull &&
+                        reg_lncc_boxSum(countTable, tableDim, a, b, c,
+                                        a+blockDim[0], b+blockDim[1], c+blockDim[2])==blockVoxelNumber){
+                     // All voxels are defined, the warped sums are read from the tables
+                     for(z=0; z<blockDim[2]; ++z){
+                        for(y=0; y<blockDim[1]; ++y){
+                           double *warPtr=&warRegion[((z+c)*regionDim[1]+y+b)*regionDim[0]+a];
+                           double *refPtr=&refBlock[blockIndex];
+                           for(x=0; x<blockDim[0]; ++x)
+                              crossSum+=refPtr[x]*warPtr[x];
+                           blockIndex+=blockDim[0];
+                        }
+                     }
+                     definedValueNumber=blockVoxelNumber;
+                     warSum=reg_lncc_boxSum(sumTable, tableDim, a, b, c,
+                                            a+blockDim[0], b+blockDim[1], c+blockDim[2]);
+                     warSum2=reg_lncc_boxSum(sum2Table, tableDim, a, b, c,
+                                             a+blockDim[0], b+blockDim[1], c+blockDim[2]);
+                     warVar=warSum2-warSum*warSum/definedValueNumber;
+                     value=crossSum/sqrt(refVar*warVar);
+                     if(!(refVar>0. && warVar>1.e-12*warSum2))
+                        value=std::numeric_limits<double>::quiet_NaN();
+                  }
+                  else{
+                     // Only the voxels defined in both images are considered
+                     definedValueNumber=0;
+                     refSum=warSum=refSum2=warSum2=0.;
+                     for(z=0; z<blockDim[2]; ++z){
+                        for(y=0; y<blockDim[1]; ++y){
+                           regionIndex=((z+c)*regionDim[1]+y+b)*regionDim[0]+a;
+                           for(x=0; x<blockDim[0]; ++x){
+                              refValue=refBlock[blockIndex++];
+                              warValue=warRegion[regionIndex++];
+                              if(refValue==refValue && warValue==warValue){
+                                 refSum+=refValue;
+                                 warSum+=warValue;
+                                 refSum2+=refValue*refValue;
+                                 warSum2+=warValue*warValue;
+                                 crossSum+=refValue*warValue;
+                                 ++definedValueNumber;
+                              }
+                           }
+                        }
+                     }
+                     value=std::numeric_limits<double>::quiet_NaN();
+                     if(definedValueNumber>0){
+                        blockRefVar=refSum2-refSum*refSum/definedValueNumber;
+                        warVar=warSum2-warSum*warSum/definedValueNumber;
+                        if(blockRefVar>1.e-12*refSum2 && warVar>1.e-12*warSum2)
+                           value=(crossSum-refSum*warSum/definedValueNumber)/sqrt(blockRefVar*warVar);
+                     }
+                  }
+                  nodeValue[label] += timePointWeight[t] * value;
+                  ++label;
+               } // a
+            } // b
+         } // c
+      } // t
+      // Deal with the labels that contains NaN values
+      reg_discretisedValue_fillUndefined(nodeValue, label_1D_number);
+      if(quantisedValue!=NULL)
+         reg_discretisedValue_quantise(nodeValue,
+                                       label_nD_number,
+                                       &quantisedValue[(size_t)node * label_nD_number],
+                                       &nodeOffset[node],
+                                       &nodeScale[node]);
+   } // node
+   for(int i=0; i<threadNumber; ++i){
+      free(refBlockValue[i]);
+      free(warRegionValue[i]);
+      free(regionTable[i]);
+      free(nodeBuffer[i]);
+   }
+   free(refBlockValue);
+   free(warRegionValue);
+   free(regionTable);
+   free(nodeBuffer);
+}
+/* *************************************************************** */
+void reg_lncc::ComputeDiscretisedValue(nifti_image *controlPointGridImage,
+                                       float *discretisedValue,
+                                       unsigned short *quantisedValue,
+                                       float *nodeOffset,
+                                       float *nodeScale,
+                                       int discretise_radius,
+                                       int discretise_step)
+{
+   if(this->referenceImagePointer->nz==1){
+      reg_print_fct_error("reg_lncc::GetDiscretisedValue");
+      reg_print_msg_error("Not implemented in 2D yet");
+      reg_exit();
+   }
+   switch(this->referenceImagePointer->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      GetDiscretisedValueLNCC_core3D<float>
+            (controlPointGridImage,
+             discretisedValue,
+             quantisedValue,
+             nodeOffset,
+             nodeScale,
+             discretise_radius,
+             discretise_step,
+             this->referenceImagePointer,
+             this->warpedFloatingImagePointer,
+             this->referenceMaskPointer,
+             this->timePointWeight);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      GetDiscretisedValueLNCC_core3D<double>
+            (controlPointGridImage,
+             discretisedValue,
+             quantisedValue,
+             nodeOffset,
+             nodeScale,
+             discretise_radius,
+             discretise_step,
+             this->referenceImagePointer,
+             this->warpedFloatingImagePointer,
+             this->referenceMaskPointer,
+             this->timePointWeight);
+      break;
+   default:
+      reg_print_fct_error("reg_lncc::GetDiscretisedValue");
+      reg_print_msg_error("Unsupported datatype");
+      reg_exit();
+   }
+}
+/* *************************************************************** */
+void reg_lncc::GetDiscretisedValue(nifti_image *controlPointGridImage,
+                                   float *discretisedValue,
+                                   int discretise_radius,
+                                   int discretise_step)
+{
+   this->ComputeDiscretisedValue(controlPointGridImage,
+                                 discretisedValue,
+                                 NULL,
+                                 NULL,
+                                 NULL,
+                                 discretise_radius,
+                                 discretise_step);
+}
+/* *************************************************************** */
+void reg_lncc::GetQuantisedDiscretisedValue(nifti_image *controlPointGridImage,
+                                            unsigned short *quantisedValue,
+                                            float *nodeOffset,
+                                            float *nodeScale,
+                                            int discretise_radius,
+                                            int discretise_step)
+{
+   this->ComputeDiscretisedValue(controlPointGridImage,
+                                 NULL,
+                                 quantisedValue,
+                                 nodeOffset,
+                                 nodeScale,
+                                 discretise_radius,
+                                 discretise_step);
+}
+/* *************************************************************** */
+/* *************************************************************** */
 #endif
 
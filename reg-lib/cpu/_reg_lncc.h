@@ -44,11 +44,26 @@ public:
    {
       this->kernelStandardDeviation[t]=stddev;
    }
-   /// @brief Stuff
+   /// @brief Set the type of kernel used to compute the local statistics,
+   /// see NREG_CONV_KERNEL_TYPE. MEAN_KERNEL and ITERATED_BOX_KERNEL have a cost
+   /// that does not depend on the kernel size. The kernel has to be set before
+   /// InitialiseMeasure as the reference statistics are computed there
    void SetKernelType(int t)
    {
       this->kernelType=t;
    }
+   /// @brief Compute the block lncc for every control point and label
+   void GetDiscretisedValue(nifti_image *controlPointGridImage,
+                            float *discretisedValue,
+                            int discretise_radius,
+                            int discretise_step);
+   /// @brief Compute the block lncc quantised on 16 bits
+   void GetQuantisedDiscretisedValue(nifti_image *controlPointGridImage,
+                                     unsigned short *quantisedValue,
+                                     float *nodeOffset,
+                                     float *nodeScale,
+                                     int discretise_radius,
+                                     int discretise_step);
 protected:
    float kernelStandardDeviation[255];
    nifti_image *forwardCorrelationImage;
@@ -67,12 +82,29 @@ protected:
 
    int kernelType;
 
+   /// @brief Compute the discretised lncc, the values are quantised when
+   /// quantisedValue is not NULL
+   void ComputeDiscretisedValue(nifti_image *controlPointGridImage,
+                                float *discretisedValue,
+                                unsigned short *quantisedValue,
+                                float *nodeOffset,
+                                float *nodeScale,
+                                int discretise_radius,
+                                int discretise_step);
+
+   /// @brief Compute the local mean and standard deviation of every active
+   /// time point of an image that is not warped
+   template <class DTYPE>
+   void UpdateReferenceStatImages(nifti_image *refImage,
+                                  nifti_image *meanRefImage,
+                                  nifti_image *stdDevRefImage,
+                                  int *refMask);
+   /// @brief Compute the local mean and standard deviation of a time point
+   /// of the warped image and the mask of the voxels to consider
    template <class DTYPE>
    void UpdateLocalStatImages(nifti_image *refImage,
                               nifti_image *warImage,
-                              nifti_image *meanRefImage,
                               nifti_image *meanWarImage,
-                              nifti_image *stdDevRefImage,
                               nifti_image *stdDevWarImage,
                               int *refMask,
                               int *mask,
@@ -82,6 +114,8 @@ protected:
 /* *************************************************************** */
 /** @brief Copmutes and returns the LNCC between two input image
  * @param referenceImage First input image to use to compute the metric
+ * @param referenceMeanImage Local mean of every time point of the
+ * reference image, the specified time point is used
  * @param warpedImage Second input image to use to compute the metric
  * @param gaussianStandardDeviation Standard deviation of the Gaussian kernel
  * to use.
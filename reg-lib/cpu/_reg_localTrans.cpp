@@ -594,6 +594,175 @@ void reg_linear_spline_getDeformationField3D(nifti_image *splineControlPoint,
 }
 /* *************************************************************** */
 /* *************************************************************** */
+/// @brief Compute the deformation field of a box of the reference space from
+/// a cubic spline grid without affine component. The voxels are processed
+/// by rows of cells, a cell containing the voxels that share the same
+/// 4x4(x4) control point support. The basis values are tabulated once per
+/// axis, the control points of a row of cells are combined along z once per
+/// slice and along y once per voxel row so that the remaining interpolation
+/// along x is a 4-tap filter evaluated over contiguous voxels. The positions
+/// are accumulated in double precision, rounding errors would otherwise shift
+/// the border voxels of a grid without deformation outside of the image.
+template<class DTYPE>
+void reg_cubic_spline_getDeformationFieldCells(nifti_image *splineControlPoint,
+                                               nifti_image *deformationField,
+                                               int *mask,
+                                               int *regionStart,
+                                               bool bspline,
+                                               bool multiThreaded)
+{
+   int dim = splineControlPoint->nz>1?3:2;
+   int zSupport = dim==3?4:1;
+   int fieldDim[3]= {deformationField->nx, deformationField->ny, deformationField->nz};
+   size_t cpNumber = (size_t)splineControlPoint->nx*splineControlPoint->ny*splineControlPoint->nz;
+   size_t voxelNumber = (size_t)fieldDim[0]*fieldDim[1]*fieldDim[2];
+   DTYPE *controlPointPtr[3], *fieldPtr[3];
+   for(int d=0; d<dim; ++d)
+   {
+      controlPointPtr[d] = &static_cast<DTYPE *>(splineControlPoint->data)[d*cpNumber];
+      fieldPtr[d] = &static_cast<DTYPE *>(deformationField->data)[d*voxelNumber];
+   }
+   DTYPE gridVoxelSpacing[3];
+   gridVoxelSpacing[0] = splineControlPoint->dx / deformationField->dx;
+   gridVoxelSpacing[1] = splineControlPoint->dy / deformationField->dy;
+   gridVoxelSpacing[2] = splineControlPoint->dz / deformationField->dz;
+
+   // The four basis values of every voxel are stored per axis. The cells
+   // are delimited by the voxels where the first control point of the
+   // support changes
+   double *basisTable[3];
+   int *cellStart[3], *cellPre[3], cellNumber[3];
+   DTYPE basisValues[4], position, basis;
+   for(int a=0; a<3; ++a)
+   {
+      basisTable[a]=(double *)malloc(4*fieldDim[a]*sizeof(double));
+      cellStart[a]=(int *)malloc((fieldDim[a]+1)*sizeof(int));
+      cellPre[a]=(int *)malloc(fieldDim[a]*sizeof(int));
+      cellNumber[a]=0;
+      int previousPre=-1;
+      for(int v=0; v<fieldDim[a]; ++v)
+      {
+         int pre=0;
+         basisValues[0]=1;
+         basisValues[1]=basisValues[2]=basisValues[3]=0;
+         if(a<dim)
+         {
+            position = static_cast<DTYPE>(v+regionStart[a])/gridVoxelSpacing[a];
+            pre=static_cast<int>(position);
+            basis=position-static_cast<DTYPE>(pre);
+            if(basis<0.0) basis=0.0; //rounding error
+            if(bspline) get_BSplineBasisValues<DTYPE>(basis, basisValues);
+            else get_SplineBasisValues<DTYPE>(basis, basisValues);
+         }
+         for(int i=0; i<4; ++i)
+            basisTable[a][4*v+i]=basisValues[i];
+         if(pre!=previousPre)
+         {
+            cellStart[a][cellNumber[a]]=v;
+            cellPre[a][cellNumber[a]++]=pre;
+            previousPre=pre;
+         }
+      }
+      cellStart[a][cellNumber[a]]=fieldDim[a];
+   }
+
+   // The first control point of every voxel support along x is stored
+   // relative to the first control point used by a row of cells
+   int cpStart=cellPre[0][0];
+   int rowCpNumber=cellPre[0][cellNumber[0]-1]+4-cpStart;
+   int *xPre=(int *)malloc(fieldDim[0]*sizeof(int));
+   for(int cx=0; cx<cellNumber[0]; ++cx)
+      for(int v=cellStart[0][cx]; v<cellStart[0][cx+1]; ++v)
+         xPre[v]=cellPre[0][cx]-cpStart;
+   double *xBasis=basisTable[0];
+
+   int cell, x, y, z, b, c, d, i, yPre, zPre;
+   size_t index, cpIndex;
+   double *zRow, *yRow;
+   int rowCellNumber=cellNumber[1]*cellNumber[2];
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) if(multiThreaded) \
+   private(cell, x, y, z, b, c, d, i, yPre, zPre, index, cpIndex, zRow, yRow) \
+   shared(rowCellNumber, cellNumber, cellStart, cellPre, basisTable, xBasis, xPre, \
+   cpStart, rowCpNumber, splineControlPoint, controlPointPtr, fieldPtr, fieldDim, \
+   mask, dim, zSupport)
+#endif // _OPENMP
+   for(cell=0; cell<rowCellNumber; ++cell)
+   {
+      int yCell=cell%cellNumber[1];
+      int zCell=cell/cellNumber[1];
+      yPre=cellPre[1][yCell];
+      zPre=cellPre[2][zCell];
+      zRow=(double *)malloc(4*dim*rowCpNumber*sizeof(double));
+      yRow=(double *)malloc(dim*rowCpNumber*sizeof(double));
+      for(z=cellStart[2][zCell]; z<cellStart[2][zCell+1]; ++z)
+      {
+         // The control points are first combined along z ...
+         for(d=0; d<dim; ++d)
+         {
+            for(b=0; b<4; ++b)
+            {
+               double *zRowPtr=&zRow[(d*4+b)*rowCpNumber];
+               for(i=0; i<rowCpNumber; ++i)
+                  zRowPtr[i]=0.0;
+               for(c=0; c<zSupport; ++c)
+               {
+                  double zBasis=basisTable[2][4*z+c];
+                  cpIndex=((size_t)(zPre+c)*splineControlPoint->ny+yPre+b)*
+                        splineControlPoint->nx+cpStart;
+                  DTYPE *cpPtr=&controlPointPtr[d][cpIndex];
+                  for(i=0; i<rowCpNumber; ++i)
+                     zRowPtr[i] += zBasis*cpPtr[i];
+               }
+            }
+         }
+         for(y=cellStart[1][yCell]; y<cellStart[1][yCell+1]; ++y)
+         {
+            // ... then along y ...
+            double yBasis[4];
+            for(b=0; b<4; ++b)
+               yBasis[b]=basisTable[1][4*y+b];
+            for(d=0; d<dim; ++d)
+            {
+               double *yRowPtr=&yRow[d*rowCpNumber];
+               double *zRowPtr=&zRow[d*4*rowCpNumber];
+               for(i=0; i<rowCpNumber; ++i)
+                  yRowPtr[i]=yBasis[0]*zRowPtr[i] +
+                        yBasis[1]*zRowPtr[rowCpNumber+i] +
+                        yBasis[2]*zRowPtr[2*rowCpNumber+i] +
+                        yBasis[3]*zRowPtr[3*rowCpNumber+i];
+            }
+            // ... and finally along x for the full row of voxels
+            index=((size_t)z*fieldDim[1]+y)*fieldDim[0];
+            int *maskRowPtr=&mask[index];
+            for(d=0; d<dim; ++d)
+            {
+               double *yRowPtr=&yRow[d*rowCpNumber];
+               DTYPE *fieldRowPtr=&fieldPtr[d][index];
+               for(x=0; x<fieldDim[0]; ++x)
+               {
+                  double *colPtr=&yRowPtr[xPre[x]];
+                  double *basisPtr=&xBasis[4*x];
+                  double value=basisPtr[0]*colPtr[0] + basisPtr[1]*colPtr[1] +
+                        basisPtr[2]*colPtr[2] + basisPtr[3]*colPtr[3];
+                  fieldRowPtr[x]=maskRowPtr[x]>-1?static_cast<DTYPE>(value):0;
+               }
+            }
+         } // y
+      } // z
+      free(zRow);
+      free(yRow);
+   } // cell
+   free(xPre);
+   for(int a=0; a<3; ++a)
+   {
+      free(basisTable[a]);
+      free(cellStart[a]);
+      free(cellPre[a]);
+   }
+}
+/* *************************************************************** */
+/* *************************************************************** */
 template<class DTYPE>
 void reg_cubic_spline_getDeformationField2D(nifti_image *splineControlPoint,
                                       nifti_image *deformationField,
@@ -608,7 +777,7 @@ void reg_cubic_spline_getDeformationField2D(nifti_image *splineControlPoint,
       __m128 m;
       float f[4];
    } val;
-   __m128 tempCurrent, tempX, tempY;
+   __m128 tempX, tempY;
 #ifdef _WIN32
    __declspec(align(16)) DTYPE temp[4];
    __declspec(align(16)) DTYPE yBasis[4];
@@ -661,10 +830,6 @@ void reg_cubic_spline_getDeformationField2D(nifti_image *splineControlPoint,
    DTYPE *fieldPtrX=static_cast<DTYPE *>(deformationField->data);
    DTYPE *fieldPtrY=&fieldPtrX[deformationField->nx*deformationField->ny*deformationField->nz];
 
-   DTYPE gridVoxelSpacing[2];
-   gridVoxelSpacing[0] = splineControlPoint->dx / deformationField->dx;
-   gridVoxelSpacing[1] = splineControlPoint->dy / deformationField->dy;
-
    DTYPE basis, xReal, yReal, xVoxel, yVoxel;
    int x, y, a, b, xPre, yPre, oldXpre, oldYpre;
    size_t index, coord;
@@ -796,124 +961,13 @@ void reg_cubic_spline_getDeformationField2D(nifti_image *splineControlPoint,
    }
    else  // starting deformation field is blank - !composition
    {
-
-#if defined (_OPENMP)
-#ifdef _USE_SSE
-#pragma  omp parallel for default(none) \
-   shared(deformationField, gridVoxelSpacing, splineControlPoint, controlPointPtrX, \
-   controlPointPtrY, mask, fieldPtrX, fieldPtrY, bspline) \
-   private(x, y, a, xPre, yPre, oldXpre, oldYpre, index, xReal, yReal, basis, \
-   val, temp, yBasis, tempCurrent, xyBasis, tempX, tempY, \
-   xControlPointCoordinates, yControlPointCoordinates)
-#else // _USE_SSE
-#pragma  omp parallel for default(none) \
-   shared(deformationField, gridVoxelSpacing, splineControlPoint, controlPointPtrX, \
-   controlPointPtrY, mask, fieldPtrX, fieldPtrY, bspline) \
-   private(x, y, a, xPre, yPre, oldXpre, oldYpre, index, xReal, yReal, basis, coord, \
-   temp, yBasis, xyBasis, xControlPointCoordinates, yControlPointCoordinates)
-#endif // _USE_SEE
-#endif // _OPENMP
-      for( y=0; y<deformationField->ny; y++)
-      {
-         index=y*deformationField->nx;
-         oldXpre=oldYpre=9999999;
-
-         yPre=(int)((DTYPE)y/gridVoxelSpacing[1]);
-         basis=(DTYPE)y/gridVoxelSpacing[1]-(DTYPE)yPre;
-         if(basis<0.0) basis=0.0; //rounding error
-         if(bspline) get_BSplineBasisValues<DTYPE>(basis, yBasis);
-         else get_SplineBasisValues<DTYPE>(basis, yBasis);
-
-         for(x=0; x<deformationField->nx; x++)
-         {
-
-            xPre=(int)((DTYPE)x/gridVoxelSpacing[0]);
-            basis=(DTYPE)x/gridVoxelSpacing[0]-(DTYPE)xPre;
-            if(basis<0.0) basis=0.0; //rounding error
-            if(bspline) get_BSplineBasisValues<DTYPE>(basis, temp);
-            else get_SplineBasisValues<DTYPE>(basis, temp);
-#if _USE_SSE
-            val.f[0] = temp[0];
-            val.f[1] = temp[1];
-            val.f[2] = temp[2];
-            val.f[3] = temp[3];
-            tempCurrent=val.m;
-            for(a=0; a<4; a++)
-            {
-               val.m=_mm_set_ps1(yBasis[a]);
-               xyBasis.m[a]=_mm_mul_ps(tempCurrent,val.m);
-            }
-#else
-            coord=0;
-            for(a=0; a<4; a++)
-            {
-               xyBasis[coord++]=temp[0]*yBasis[a];
-               xyBasis[coord++]=temp[1]*yBasis[a];
-               xyBasis[coord++]=temp[2]*yBasis[a];
-               xyBasis[coord++]=temp[3]*yBasis[a];
-            }
-#endif
-            if(oldXpre!=xPre || oldYpre!=yPre)
-            {
-#ifdef _USE_SSE
-               get_GridValues<DTYPE>(xPre,
-                                     yPre,
-                                     splineControlPoint,
-                                     controlPointPtrX,
-                                     controlPointPtrY,
-                                     xControlPointCoordinates.f,
-                                     yControlPointCoordinates.f,
-                                     false, // no approximation
-                                     false // not a deformation field
-                                     );
-#else // _USE_SSE
-               get_GridValues<DTYPE>(xPre,
-                                     yPre,
-                                     splineControlPoint,
-                                     controlPointPtrX,
-                                     controlPointPtrY,
-                                     xControlPointCoordinates,
-                                     yControlPointCoordinates,
-                                     false, // no approximation
-                                     false // not a deformation field
-                                     );
-#endif // _USE_SSE
-               oldXpre=xPre;
-               oldYpre=yPre;
-            }
-
-            xReal=0.0;
-            yReal=0.0;
-
-            if(mask[index]>-1)
-            {
-#if _USE_SSE
-               tempX =  _mm_set_ps1(0.0);
-               tempY =  _mm_set_ps1(0.0);
-               //addition and multiplication of the 64 basis value and CP displacement for each axis
-               for(a=0; a<4; a++)
-               {
-                  tempX = _mm_add_ps(_mm_mul_ps(xyBasis.m[a], xControlPointCoordinates.m[a]), tempX );
-                  tempY = _mm_add_ps(_mm_mul_ps(xyBasis.m[a], yControlPointCoordinates.m[a]), tempY );
-               }
-               //the values stored in SSE variables are transfered to normal float
-               val.m=tempX;
-               xReal=val.f[0]+val.f[1]+val.f[2]+val.f[3];
-               val.m=tempY;
-               yReal= val.f[0]+val.f[1]+val.f[2]+val.f[3];
-#else
-               for(a=0; a<16; a++)
-               {
-                  xReal += xControlPointCoordinates[a] * xyBasis[a];
-                  yReal += yControlPointCoordinates[a] * xyBasis[a];
-               }
-#endif
-            }// mask
-            fieldPtrX[index] = (DTYPE)xReal;
-            fieldPtrY[index] = (DTYPE)yReal;
-            index++;
-         } // x
-      } // y
+      int regionStart[3]={0,0,0};
+      reg_cubic_spline_getDeformationFieldCells<DTYPE>(splineControlPoint,
+                                                       deformationField,
+                                                       mask,
+                                                       regionStart,
+                                                       bspline,
+                                                       true);
    } // composition
 
    return;
@@ -1229,221 +1283,17 @@ void reg_cubic_spline_getDeformationField3D(nifti_image *splineControlPoint,
       DTYPE yzBasis[16], xyzBasis[64];
 #endif // _USE_SSE
 
-      // Assess if lookup table can be used
-      if(gridVoxelSpacing[0]==5. && gridVoxelSpacing[0]==5. && gridVoxelSpacing[0]==5. && force_no_lut==false){
-
-          // Assign a single array that will contain all coefficients
-         DTYPE *coefficients = (DTYPE *)malloc(125*64*sizeof(DTYPE));
-          // Compute and store all required coefficients
-          int coeff_index;
-#if defined (_OPENMP)
-#ifdef _USE_SSE
-#pragma omp parallel for default(none) \
-    private(x, y, z, a, b, c, coeff_index, basis, zBasis, temp, \
-    val, tempCurrent, yzBasis) \
-    shared(coefficients, bspline)
-#else //  _USE_SSE
-#pragma omp parallel for default(none) \
-    private(x, y, z, a, b, c, coeff_index, basis, zBasis, temp, \
-    yzBasis, coord) \
-    shared(coefficients, bspline)
-#endif // _USE_SSE
-#endif // _OPENMP
-          for(z=0;z<5;++z){
-             coeff_index=z*5*5*64;
-              basis=(DTYPE)z/5.;
-              if(bspline) get_BSplineBasisValues<DTYPE>(basis, zBasis);
-              else get_SplineBasisValues<DTYPE>(basis, zBasis);
-              for(y=0;y<5;++y){
-                  basis=(DTYPE)y/5.;
-                  if(bspline) get_BSplineBasisValues<DTYPE>(basis, temp);
-                  else get_SplineBasisValues<DTYPE>(basis, temp);
-#if _USE_SSE
-                  val.f[0] = temp[0];
-                  val.f[1] = temp[1];
-                  val.f[2] = temp[2];
-                  val.f[3] = temp[3];
-                  tempCurrent=val.m;
-                  for(a=0; a<4; a++)
-                  {
-                      val.m=_mm_set_ps1(zBasis[a]);
-                      yzBasis.m[a] = _mm_mul_ps(tempCurrent,val.m);
-                  }
-#else
-                  coord=0;
-                  for(a=0; a<4; a++)
-                  {
-                      yzBasis[coord++]=temp[0]*zBasis[a];
-                      yzBasis[coord++]=temp[1]*zBasis[a];
-                      yzBasis[coord++]=temp[2]*zBasis[a];
-                      yzBasis[coord++]=temp[3]*zBasis[a];
-                  }
-#endif
-
-                  for(x=0;x<5;++x){
-                      basis=(DTYPE)x/5.;
-                      if(bspline) get_BSplineBasisValues<DTYPE>(basis, temp);
-                      else get_SplineBasisValues<DTYPE>(basis, temp);
-#if _USE_SSE
-
-                      val.f[0] = temp[0];
-                      val.f[1] = temp[1];
-                      val.f[2] = temp[2];
-                      val.f[3] = temp[3];
-                      tempCurrent=val.m;
-                      for(a=0; a<16; ++a)
-                      {
-                          val.m=_mm_set_ps1(yzBasis.f[a]);
-                          val.m=_mm_mul_ps(tempCurrent,val.m);
-                          coefficients[coeff_index++]=val.f[0];
-                          coefficients[coeff_index++]=val.f[1];
-                          coefficients[coeff_index++]=val.f[2];
-                          coefficients[coeff_index++]=val.f[3];
-                      }
-#else
-                      for(a=0; a<16; a++)
-                      {
-                          coefficients[coeff_index++]=temp[0]*yzBasis[a];
-                          coefficients[coeff_index++]=temp[1]*yzBasis[a];
-                          coefficients[coeff_index++]=temp[2]*yzBasis[a];
-                          coefficients[coeff_index++]=temp[3]*yzBasis[a];
-                      }
-#endif
-                  } //x
-              } // y
-          } // z
-
-          // Loop over block of 5x5x5 voxels
-#if _USE_SSE
-          int coord;
-#endif // USE_SSE
-#if defined (_OPENMP)
-#ifdef _USE_SSE
-#pragma omp parallel for default(none) \
-   private(x, y, z, a, b, c, xPre, yPre, zPre, real, \
-   index, xyzBasis, temp, coeff_index, coord, tempX, tempY, tempZ, val,\
-   xControlPointCoordinates, yControlPointCoordinates, zControlPointCoordinates) \
-   shared(deformationField, fieldPtrX, fieldPtrY, fieldPtrZ, splineControlPoint, mask, \
-   gridVoxelSpacing, bspline, controlPointPtrX, controlPointPtrY, controlPointPtrZ, \
-   coefficients)
-#else //  _USE_SSE
-#pragma omp parallel for default(none) \
-   private(x, y, z, a, b, c, xPre, yPre, zPre, real, \
-   index, xyzBasis, temp, coeff_index, coord, basis, \
-   xControlPointCoordinates, yControlPointCoordinates, zControlPointCoordinates) \
-   shared(deformationField, fieldPtrX, fieldPtrY, fieldPtrZ, splineControlPoint, mask, \
-   gridVoxelSpacing, bspline, controlPointPtrX, controlPointPtrY, controlPointPtrZ, \
-   coefficients)
-#endif // _USE_SSE
-#endif // _OPENMP
-          for(zPre=0; zPre<splineControlPoint->nz-3; zPre++)
-          {
-              for(yPre=0; yPre<splineControlPoint->ny-3; yPre++)
-              {
-                  for(xPre=0; xPre<splineControlPoint->nx-3; xPre++)
-                  {
-#if _USE_SSE
-                      get_GridValues<DTYPE>(xPre,
-                                            yPre,
-                                            zPre,
-                                            splineControlPoint,
-                                            controlPointPtrX,
-                                            controlPointPtrY,
-                                            controlPointPtrZ,
-                                            xControlPointCoordinates.f,
-                                            yControlPointCoordinates.f,
-                                            zControlPointCoordinates.f,
-                                            false, // no approximation
-                                            false // not a deformation field
-                                            );
-#else // _USE_SSE
-                      get_GridValues<DTYPE>(xPre,
-                                            yPre,
-                                            zPre,
-                                            splineControlPoint,
-                                            controlPointPtrX,
-                                            controlPointPtrY,
-                                            controlPointPtrZ,
-                                            xControlPointCoordinates,
-                                            yControlPointCoordinates,
-                                            zControlPointCoordinates,
-                                            false, // no approximation
-                                            false // not a deformation field
-                                            );
-#endif // _USE_SSE
-                      coeff_index=0;
-                      for(c=0;c<5;++c){
-                          z = zPre*5+c;
-                          if(z<deformationField->nz){
-                              for(b=0;b<5;++b){
-                                  y = yPre*5+b;
-                                  if(y<deformationField->ny){
-                                      index = (z*deformationField->ny+y)*deformationField->nx+xPre*5;
-                                      for(a=0;a<5;++a){
-                                          x = xPre*5+a;
-                                          if(x<deformationField->nx && mask[index]>-1){
-#if _USE_SSE
-                                              tempX =  _mm_set_ps1(0.0);
-                                              tempY =  _mm_set_ps1(0.0);
-                                              tempZ =  _mm_set_ps1(0.0);
-                                              for(coord=0;coord<16;++coord){
-                                                  val.m = _mm_set_ps(coefficients[coeff_index+3],
-                                                        coefficients[coeff_index+2],
-                                                        coefficients[coeff_index+1],
-                                                        coefficients[coeff_index]);
-                                                  coeff_index+=4;
-                                                  tempX = _mm_add_ps(_mm_mul_ps(val.m,
-                                                                                xControlPointCoordinates.m[coord]),
-                                                                     tempX );
-                                                  tempY = _mm_add_ps(_mm_mul_ps(val.m,
-                                                                                yControlPointCoordinates.m[coord]),
-                                                                     tempY );
-                                                  tempZ = _mm_add_ps(_mm_mul_ps(val.m,
-                                                                                zControlPointCoordinates.m[coord]),
-                                                                     tempZ );
-                                              }
-                                              //the values stored in SSE variables are transfered to normal float
-#ifdef __SSE3__
-                                              val.m = _mm_hadd_ps(tempX, tempY);
-                                              val.m = _mm_hadd_ps(val.m, tempZ);
-                                              real[0] = val.f[0];
-                                              real[1] = val.f[1];
-                                              real[2] = val.f[2]+val.f[3];
-#else
-                                              val.m=tempX;
-                                              real[0]=val.f[0]+val.f[1]+val.f[2]+val.f[3];
-                                              val.m=tempY;
-                                              real[1]= val.f[0]+val.f[1]+val.f[2]+val.f[3];
-                                              val.m=tempZ;
-                                              real[2]= val.f[0]+val.f[1]+val.f[2]+val.f[3];
-#endif
-#else // _USE_SSE
-                                              real[0]=real[1]=real[2]=0;
-                                              for(coord=0;coord<64;++coord){
-                                                  basis = coefficients[coeff_index++];
-                                                  real[0] += xControlPointCoordinates[coord] * basis;
-                                                  real[1] += yControlPointCoordinates[coord] * basis;
-                                                  real[2] += zControlPointCoordinates[coord] * basis;
-                                              }
-#endif // _USE_SSE
-                                              fieldPtrX[index] = real[0];
-                                              fieldPtrY[index] = real[1];
-                                              fieldPtrZ[index] = real[2];
-                                          } // x defined
-                                          else coeff_index += 64;
-                                          index++;
-                                      } // a
-                                  } // y defined
-                                  else coeff_index += 5*64;
-                              } // b
-                          } // z defined
-                          else coeff_index += 5*5*64;
-                      } // c
-                  } // xPre
-              } // yPre
-          } // zPre
-          free(coefficients);
-      } // if spacings==5 voxels
+      // The deformation is evaluated cell by cell unless the voxel-wise
+      // evaluation is requested
+      if(force_no_lut==false){
+         int regionStart[3]={0,0,0};
+         reg_cubic_spline_getDeformationFieldCells<DTYPE>(splineControlPoint,
+                                                          deformationField,
+                                                          mask,
+                                                          regionStart,
+                                                          bspline,
+                                                          true);
+      } // cell by cell evaluation
       else{
 
 #if defined (_OPENMP)
@@ -1611,7 +1461,7 @@ void reg_cubic_spline_getDeformationField3D(nifti_image *splineControlPoint,
                   } // x
               } // y
           } // z
-      } // else spacing==5
+      } // voxel-wise evaluation
    }// from a deformation field
 
    return;
@@ -1739,6 +1589,39 @@ void reg_spline_getDeformationField(nifti_image *splineControlPoint,
    return;
 }
 /* *************************************************************** */
+void reg_spline_getDeformationFieldRegion(nifti_image *splineControlPoint,
+                                          nifti_image *deformationField,
+                                          int *mask,
+                                          int *regionStart,
+                                          bool bspline)
+{
+   if(splineControlPoint->datatype != deformationField->datatype)
+   {
+      reg_print_fct_error("reg_spline_getDeformationFieldRegion");
+      reg_print_msg_error("The spline control point image and the deformation field image are expected to be the same type");
+      reg_exit();
+   }
+   if(splineControlPoint->intent_p1==LIN_SPLINE_GRID || splineControlPoint->num_ext>0)
+   {
+      reg_print_fct_error("reg_spline_getDeformationFieldRegion");
+      reg_print_msg_error("Only cubic spline grids without affine component are supported");
+      reg_exit();
+   }
+   switch(deformationField->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      reg_cubic_spline_getDeformationFieldCells<float>(splineControlPoint, deformationField, mask, regionStart, bspline, false);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      reg_cubic_spline_getDeformationFieldCells<double>(splineControlPoint, deformationField, mask, regionStart, bspline, false);
+      break;
+   default:
+      reg_print_fct_error("reg_spline_getDeformationFieldRegion");
+      reg_print_msg_error("Only single or double precision is implemented for deformation field");
+      reg_exit();
+   }
+}
+/* *************************************************************** */
 /* *************************************************************** */
 template<class DTYPE>
 void reg_voxelCentric2NodeCentric_core(nifti_image *nodeImage,
@@ -2548,6 +2431,69 @@ void reg_spline_refineControlPointGrid(nifti_image *controlPointGrid,
 }
 /* *************************************************************** */
 /* *************************************************************** */
+/// @brief Linear interpolation of a 2D deformation field at a real world
+/// position, with a sliding effect outside of the field. The position is
+/// replaced by the interpolated deformation
+template <class DTYPE>
+inline void reg_defField_interpolate2D(DTYPE &realDefX,
+                                       DTYPE &realDefY,
+                                       mat44 *df_real2Voxel,
+                                       mat44 *df_voxel2Real,
+                                       nifti_image *deformationField,
+                                       DTYPE *defPtrX,
+                                       DTYPE *defPtrY)
+{
+   // Conversion from real to voxel in the deformation field
+   DTYPE voxelX = realDefX * df_real2Voxel->m[0][0]
+         + realDefY * df_real2Voxel->m[0][1]
+         + df_real2Voxel->m[0][3];
+   DTYPE voxelY = realDefX * df_real2Voxel->m[1][0]
+         + realDefY * df_real2Voxel->m[1][1]
+         + df_real2Voxel->m[1][3];
+
+   // Linear interpolation to compute the new deformation
+   int pre[2];
+   DTYPE defX, defY, relX[2], relY[2], basis;
+   pre[0]=(int)reg_floor(voxelX);
+   pre[1]=(int)reg_floor(voxelY);
+   relX[1]=voxelX-(DTYPE)pre[0];
+   relX[0]=1.f-relX[1];
+   relY[1]=voxelY-(DTYPE)pre[1];
+   relY[0]=1.f-relY[1];
+   realDefX=realDefY=0.f;
+   for(int b=0; b<2; ++b)
+   {
+      for(int a=0; a<2; ++a)
+      {
+         basis = relX[a] * relY[b];
+         if(pre[0]+a>-1 && pre[0]+a<deformationField->nx &&
+               pre[1]+b>-1 && pre[1]+b<deformationField->ny)
+         {
+            // Uses the deformation field if voxel is in its space
+            size_t index=(pre[1]+b)*deformationField->nx+pre[0]+a;
+            defX = defPtrX[index];
+            defY = defPtrY[index];
+         }
+         else
+         {
+            // Uses a sliding effect
+            get_SlidedValues<DTYPE>(defX,
+                                    defY,
+                                    pre[0]+a,
+                  pre[1]+b,
+                  defPtrX,
+                  defPtrY,
+                  df_voxel2Real,
+                  deformationField->dim,
+                  false // not a deformation field
+                  );
+         }
+         realDefX += defX * basis;
+         realDefY += defY * basis;
+      }
+   }
+}
+/* *************************************************************** */
 template <class DTYPE>
 void reg_defField_compose2D(nifti_image *deformationField,
                             nifti_image *dfToUpdate,
@@ -2580,16 +2526,12 @@ void reg_defField_compose2D(nifti_image *deformationField,
       df_voxel2Real=&(deformationField->qto_xyz);
    }
 
-   size_t index;
-   int a, b, pre[2];
-   DTYPE realDefX, realDefY, voxelX, voxelY;
-   DTYPE defX, defY, relX[2], relY[2], basis;
+   DTYPE realDefX, realDefY;
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
    shared(warVoxelNumber, mask, df_real2Voxel, df_voxel2Real, \
    deformationField, defPtrX, defPtrY, resPtrX, resPtrY) \
-   private(i, a, b, index, pre,realDefX, realDefY, voxelX, voxelY, \
-   defX, defY, relX, relY, basis)
+   private(i, realDefX, realDefY)
 #endif
    for(i=0; i<warVoxelNumber; ++i)
    {
@@ -2597,58 +2539,428 @@ void reg_defField_compose2D(nifti_image *deformationField,
       {
          realDefX = resPtrX[i];
          realDefY = resPtrY[i];
+         reg_defField_interpolate2D<DTYPE>(realDefX,
+                                           realDefY,
+                                           df_real2Voxel,
+                                           df_voxel2Real,
+                                           deformationField,
+                                           defPtrX,
+                                           defPtrY);
+         resPtrX[i]=realDefX;
+         resPtrY[i]=realDefY;
+      }// mask
+   }// loop over every voxel
+}
+/* *************************************************************** */
+/// @brief Linear interpolation of a 3D deformation field at a real world
+/// position, with a sliding effect outside of the field. The position is
+/// replaced by the interpolated deformation
+template <class DTYPE>
+inline void reg_defField_interpolate3D(DTYPE *realDef,
+                                       const mat44 &df_real2Voxel,
+                                       mat44 *df_voxel2Real,
+                                       const int *DefFieldDim,
+                                       int *dim,
+                                       DTYPE *defPtrX,
+                                       DTYPE *defPtrY,
+                                       DTYPE *defPtrZ)
+{
+   // Conversion from real to voxel in the deformation field
+   DTYPE voxel[3];
+   voxel[0] =
+         df_real2Voxel.m[0][0] * realDef[0] +
+         df_real2Voxel.m[0][1] * realDef[1] +
+         df_real2Voxel.m[0][2] * realDef[2] +
+         df_real2Voxel.m[0][3] ;
+   voxel[1] =
+         df_real2Voxel.m[1][0] * realDef[0] +
+         df_real2Voxel.m[1][1] * realDef[1] +
+         df_real2Voxel.m[1][2] * realDef[2] +
+         df_real2Voxel.m[1][3] ;
+   voxel[2] =
+         df_real2Voxel.m[2][0] * realDef[0] +
+         df_real2Voxel.m[2][1] * realDef[1] +
+         df_real2Voxel.m[2][2] * realDef[2] +
+         df_real2Voxel.m[2][3] ;
+
+   // Linear interpolation to compute the new deformation
+   int pre[3], currentX, currentY, currentZ;
+   size_t tempIndex, index;
+   DTYPE defX, defY, defZ, relX[2], relY[2], relZ[2], basis, tempBasis;
+   bool inY, inZ;
+   pre[0]=static_cast<int>reg_floor(voxel[0]);
+   pre[1]=static_cast<int>reg_floor(voxel[1]);
+   pre[2]=static_cast<int>reg_floor(voxel[2]);
+   relX[1]=voxel[0]-static_cast<DTYPE>(pre[0]);
+   relX[0]=1.-relX[1];
+   relY[1]=voxel[1]-static_cast<DTYPE>(pre[1]);
+   relY[0]=1.-relY[1];
+   relZ[1]=voxel[2]-static_cast<DTYPE>(pre[2]);
+   relZ[0]=1.-relZ[1];
+   realDef[0]=realDef[1]=realDef[2]=0.;
+   for(int c=0; c<2; ++c)
+   {
+      currentZ = pre[2]+c;
+      tempIndex=currentZ*DefFieldDim[0]*DefFieldDim[1];
+      if(currentZ>-1 && currentZ<DefFieldDim[2]) inZ=true;
+      else inZ=false;
+      for(int b=0; b<2; ++b)
+      {
+         currentY = pre[1]+b;
+         index=tempIndex+currentY*DefFieldDim[0] + pre[0];
+         tempBasis= relY[b] * relZ[c];
+         if(currentY>-1 && currentY<DefFieldDim[1]) inY=true;
+         else inY=false;
+         for(int a=0; a<2; ++a)
+         {
+            currentX = pre[0]+a;
+            if(currentX>-1 && currentX<DefFieldDim[0] && inY && inZ)
+            {
+               // Uses the deformation field if voxel is in its space
+               defX = defPtrX[index];
+               defY = defPtrY[index];
+               defZ = defPtrZ[index];
+            }
+            else
+            {
+               // Uses a sliding effect
+               get_SlidedValues<DTYPE>(defX,
+                                       defY,
+                                       defZ,
+                                       currentX,
+                                       currentY,
+                                       currentZ,
+                                       defPtrX,
+                                       defPtrY,
+                                       defPtrZ,
+                                       df_voxel2Real,
+                                       dim,
+                                       false // not a displacement field
+                                       );
+            }
+            ++index;
+            basis = relX[a] * tempBasis;
+            realDef[0] += defX * basis;
+            realDef[1] += defY * basis;
+            realDef[2] += defZ * basis;
+         } // a loop
+      } // b loop
+   } // c loop
+}
+/* *************************************************************** */
+/// Size of the bricks in which the 3D deformation field compositions are split
+#define DEF_FIELD_BRICK_X 32
+#define DEF_FIELD_BRICK_Y 8
+#define DEF_FIELD_BRICK_Z 8
+/// @brief Composition of a single voxel of a 3D deformation field: the
+/// position read from posPtr is replaced in resPtr by the interpolated
+/// deformation. The interior positions are interpolated without the sliding
+/// effect checks
+template <class DTYPE>
+inline void reg_defField_compose3DVoxel(size_t index,
+                                        const mat44 &df_real2Voxel,
+                                        mat44 *df_voxel2Real,
+                                        const int *DefFieldDim,
+                                        int *dim,
+                                        DTYPE *defPtrX,
+                                        DTYPE *defPtrY,
+                                        DTYPE *defPtrZ,
+                                        DTYPE *posPtrX,
+                                        DTYPE *posPtrY,
+                                        DTYPE *posPtrZ,
+                                        DTYPE *resPtrX,
+                                        DTYPE *resPtrY,
+                                        DTYPE *resPtrZ)
+{
+   DTYPE realDef[3], voxel[3], relX[2], relY[2], relZ[2], basis, tempBasis;
+   realDef[0] = posPtrX[index];
+   realDef[1] = posPtrY[index];
+   realDef[2] = posPtrZ[index];
+   voxel[0] =
+         df_real2Voxel.m[0][0] * realDef[0] +
+         df_real2Voxel.m[0][1] * realDef[1] +
+         df_real2Voxel.m[0][2] * realDef[2] +
+         df_real2Voxel.m[0][3] ;
+   voxel[1] =
+         df_real2Voxel.m[1][0] * realDef[0] +
+         df_real2Voxel.m[1][1] * realDef[1] +
+         df_real2Voxel.m[1][2] * realDef[2] +
+         df_real2Voxel.m[1][3] ;
+   voxel[2] =
+         df_real2Voxel.m[2][0] * realDef[0] +
+         df_real2Voxel.m[2][1] * realDef[1] +
+         df_real2Voxel.m[2][2] * realDef[2] +
+         df_real2Voxel.m[2][3] ;
+   int pre[3];
+   pre[0]=static_cast<int>reg_floor(voxel[0]);
+   pre[1]=static_cast<int>reg_floor(voxel[1]);
+   pre[2]=static_cast<int>reg_floor(voxel[2]);
+   if(pre[0]<0 || pre[0]>=DefFieldDim[0]-1 ||
+         pre[1]<0 || pre[1]>=DefFieldDim[1]-1 ||
+         pre[2]<0 || pre[2]>=DefFieldDim[2]-1)
+   {
+      // The sliding effect is required on the field border
+      reg_defField_interpolate3D<DTYPE>(realDef,
+                                        df_real2Voxel,
+                                        df_voxel2Real,
+                                        DefFieldDim,
+                                        dim,
+                                        defPtrX,
+                                        defPtrY,
+                                        defPtrZ);
+   }
+   else
+   {
+      relX[1]=voxel[0]-static_cast<DTYPE>(pre[0]);
+      relX[0]=1.-relX[1];
+      relY[1]=voxel[1]-static_cast<DTYPE>(pre[1]);
+      relY[0]=1.-relY[1];
+      relZ[1]=voxel[2]-static_cast<DTYPE>(pre[2]);
+      relZ[0]=1.-relZ[1];
+      realDef[0]=realDef[1]=realDef[2]=0.;
+      for(int c=0; c<2; ++c)
+      {
+         for(int b=0; b<2; ++b)
+         {
+            size_t defIndex=((size_t)(pre[2]+c)*DefFieldDim[1]+pre[1]+b)*DefFieldDim[0]+pre[0];
+            tempBasis=relY[b] * relZ[c];
+            basis=relX[0] * tempBasis;
+            realDef[0] += defPtrX[defIndex] * basis;
+            realDef[1] += defPtrY[defIndex] * basis;
+            realDef[2] += defPtrZ[defIndex] * basis;
+            ++defIndex;
+            basis=relX[1] * tempBasis;
+            realDef[0] += defPtrX[defIndex] * basis;
+            realDef[1] += defPtrY[defIndex] * basis;
+            realDef[2] += defPtrZ[defIndex] * basis;
+         } // b loop
+      } // c loop
+   }
+   resPtrX[index] = realDef[0];
+   resPtrY[index] = realDef[1];
+   resPtrZ[index] = realDef[2];
+}
+/* *************************************************************** */
+/// @brief Composition of four consecutive voxels of a 3D deformation field.
+/// Returns false, without modifying the field, when the vectorised path can
+/// not be used; the voxels are then composed one by one
+template <class DTYPE>
+inline bool reg_defField_compose3DInterior4(size_t,
+                                            int *,
+                                            const mat44 &,
+                                            const int *,
+                                            DTYPE *,
+                                            DTYPE *,
+                                            DTYPE *,
+                                            DTYPE *,
+                                            DTYPE *,
+                                            DTYPE *,
+                                            DTYPE *,
+                                            DTYPE *,
+                                            DTYPE *)
+{
+   return false;
+}
+#ifdef _USE_SSE
+/* *************************************************************** */
+/// The single precision version interpolates the four voxels at once when
+/// none of them is masked out and their eight neighbours are all in the
+/// deformation field. The operations are done in the same order as in the
+/// scalar version so that both return identical values
+template <>
+inline bool reg_defField_compose3DInterior4<float>(size_t index,
+                                                   int *mask,
+                                                   const mat44 &df_real2Voxel,
+                                                   const int *DefFieldDim,
+                                                   float *defPtrX,
+                                                   float *defPtrY,
+                                                   float *defPtrZ,
+                                                   float *posPtrX,
+                                                   float *posPtrY,
+                                                   float *posPtrZ,
+                                                   float *resPtrX,
+                                                   float *resPtrY,
+                                                   float *resPtrZ)
+{
+   if(mask!=NULL)
+   {
+      __m128i maskValue=_mm_loadu_si128(reinterpret_cast<__m128i *>(&mask[index]));
+      if(_mm_movemask_ps(_mm_castsi128_ps(maskValue))!=0)
+         return false;
+   }
 
-         // Conversion from real to voxel in the deformation field
-         voxelX = realDefX * df_real2Voxel->m[0][0]
-               + realDefY * df_real2Voxel->m[0][1]
-               + df_real2Voxel->m[0][3];
-         voxelY = realDefX * df_real2Voxel->m[1][0]
-               + realDefY * df_real2Voxel->m[1][1]
-               + df_real2Voxel->m[1][3];
-
-         // Linear interpolation to compute the new deformation
-         pre[0]=(int)reg_floor(voxelX);
-         pre[1]=(int)reg_floor(voxelY);
-         relX[1]=voxelX-(DTYPE)pre[0];
-         relX[0]=1.f-relX[1];
-         relY[1]=voxelY-(DTYPE)pre[1];
-         relY[0]=1.f-relY[1];
-         realDefX=realDefY=0.f;
-         for(b=0; b<2; ++b)
+   __m128 realDefX=_mm_loadu_ps(&posPtrX[index]);
+   __m128 realDefY=_mm_loadu_ps(&posPtrY[index]);
+   __m128 realDefZ=_mm_loadu_ps(&posPtrZ[index]);
+   __m128 voxel[3];
+   for(int i=0; i<3; ++i)
+   {
+      voxel[i]=_mm_add_ps(_mm_add_ps(_mm_add_ps(
+                                        _mm_mul_ps(_mm_set1_ps(df_real2Voxel.m[i][0]), realDefX),
+                                        _mm_mul_ps(_mm_set1_ps(df_real2Voxel.m[i][1]), realDefY)),
+                                     _mm_mul_ps(_mm_set1_ps(df_real2Voxel.m[i][2]), realDefZ)),
+                          _mm_set1_ps(df_real2Voxel.m[i][3]));
+   }
+   // The truncation is a floor for the strictly positive positions only
+   const __m128 zero=_mm_setzero_ps();
+   __m128 positive=_mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(voxel[0], zero),
+                                         _mm_cmpgt_ps(voxel[1], zero)),
+                              _mm_cmpgt_ps(voxel[2], zero));
+   union
+   {
+      __m128i m[3];
+      int i[12];
+   } pre;
+   // The out of range conversions return the smallest integer
+   __m128i inside=_mm_set1_epi32(-1);
+   for(int i=0; i<3; ++i)
+   {
+      pre.m[i]=_mm_cvttps_epi32(voxel[i]);
+      inside=_mm_and_si128(inside, _mm_cmpgt_epi32(pre.m[i], _mm_set1_epi32(-1)));
+      inside=_mm_and_si128(inside, _mm_cmplt_epi32(pre.m[i], _mm_set1_epi32(DefFieldDim[i]-1)));
+   }
+   if(_mm_movemask_ps(_mm_and_ps(positive, _mm_castsi128_ps(inside)))!=15)
+      return false;
+
+   const __m128 one=_mm_set1_ps(1.f);
+   __m128 relX[2], relY[2], relZ[2];
+   relX[1]=_mm_sub_ps(voxel[0], _mm_cvtepi32_ps(pre.m[0]));
+   relX[0]=_mm_sub_ps(one, relX[1]);
+   relY[1]=_mm_sub_ps(voxel[1], _mm_cvtepi32_ps(pre.m[1]));
+   relY[0]=_mm_sub_ps(one, relY[1]);
+   relZ[1]=_mm_sub_ps(voxel[2], _mm_cvtepi32_ps(pre.m[2]));
+   relZ[0]=_mm_sub_ps(one, relZ[1]);
+
+   // The neighbour values are gathered lane by lane
+   const size_t planeSize=(size_t)DefFieldDim[0]*DefFieldDim[1];
+   size_t defIndex[4];
+   for(int l=0; l<4; ++l)
+      defIndex[l]=(size_t)pre.i[8+l]*planeSize+(size_t)pre.i[4+l]*DefFieldDim[0]+pre.i[l];
+   realDefX=realDefY=realDefZ=zero;
+   for(int c=0; c<2; ++c)
+   {
+      for(int b=0; b<2; ++b)
+      {
+         __m128 tempBasis=_mm_mul_ps(relY[b], relZ[c]);
+         const size_t offset=c*planeSize+b*DefFieldDim[0];
+         for(int a=0; a<2; ++a)
          {
-            for(a=0; a<2; ++a)
+            __m128 basis=_mm_mul_ps(relX[a], tempBasis);
+            const size_t i0=defIndex[0]+offset+a;
+            const size_t i1=defIndex[1]+offset+a;
+            const size_t i2=defIndex[2]+offset+a;
+            const size_t i3=defIndex[3]+offset+a;
+            realDefX=_mm_add_ps(realDefX, _mm_mul_ps(_mm_setr_ps(defPtrX[i0], defPtrX[i1],
+                                                                 defPtrX[i2], defPtrX[i3]), basis));
+            realDefY=_mm_add_ps(realDefY, _mm_mul_ps(_mm_setr_ps(defPtrY[i0], defPtrY[i1],
+                                                                 defPtrY[i2], defPtrY[i3]), basis));
+            realDefZ=_mm_add_ps(realDefZ, _mm_mul_ps(_mm_setr_ps(defPtrZ[i0], defPtrZ[i1],
+                                                                 defPtrZ[i2], defPtrZ[i3]), basis));
+         } // a loop
+      } // b loop
+   } // c loop
+   _mm_storeu_ps(&resPtrX[index], realDefX);
+   _mm_storeu_ps(&resPtrY[index], realDefY);
+   _mm_storeu_ps(&resPtrZ[index], realDefZ);
+   return true;
+}
+#endif // _USE_SSE
+/* *************************************************************** */
+/// @brief Composition of the voxels of a brick [start,end[ of a 3D field of
+/// dimension posDim. The voxels with a negative mask value, if a mask is
+/// provided, are left untouched
+template <class DTYPE>
+inline void reg_defField_compose3DBrick(const int *start,
+                                        const int *end,
+                                        const int *posDim,
+                                        int *mask,
+                                        const mat44 &df_real2Voxel,
+                                        mat44 *df_voxel2Real,
+                                        const int *DefFieldDim,
+                                        int *dim,
+                                        DTYPE *defPtrX,
+                                        DTYPE *defPtrY,
+                                        DTYPE *defPtrZ,
+                                        DTYPE *posPtrX,
+                                        DTYPE *posPtrY,
+                                        DTYPE *posPtrZ,
+                                        DTYPE *resPtrX,
+                                        DTYPE *resPtrY,
+                                        DTYPE *resPtrZ)
+{
+   for(int z=start[2]; z<end[2]; ++z)
+   {
+      for(int y=start[1]; y<end[1]; ++y)
+      {
+         size_t index=((size_t)z*posDim[1]+y)*posDim[0]+start[0];
+         for(int x=start[0]; x<end[0]; x+=4, index+=4)
+         {
+            const int voxelNumber=end[0]-x<4?end[0]-x:4;
+            if(voxelNumber==4 &&
+                  reg_defField_compose3DInterior4<DTYPE>(index,
+                                                         mask,
+                                                         df_real2Voxel,
+                                                         DefFieldDim,
+                                                         defPtrX,
+                                                         defPtrY,
+                                                         defPtrZ,
+                                                         posPtrX,
+                                                         posPtrY,
+                                                         posPtrZ,
+                                                         resPtrX,
+                                                         resPtrY,
+                                                         resPtrZ))
+               continue;
+            for(int v=0; v<voxelNumber; ++v)
             {
-               basis = relX[a] * relY[b];
-               if(pre[0]+a>-1 && pre[0]+a<deformationField->nx &&
-                     pre[1]+b>-1 && pre[1]+b<deformationField->ny)
-               {
-                  // Uses the deformation field if voxel is in its space
-                  index=(pre[1]+b)*deformationField->nx+pre[0]+a;
-                  defX = defPtrX[index];
-                  defY = defPtrY[index];
-               }
-               else
+               if(mask==NULL || mask[index+v]>-1)
                {
-                  // Uses a sliding effect
-                  get_SlidedValues<DTYPE>(defX,
-                                          defY,
-                                          pre[0]+a,
-                        pre[1]+b,
-                        defPtrX,
-                        defPtrY,
-                        df_voxel2Real,
-                        deformationField->dim,
-                        false // not a deformation field
-                        );
+                  reg_defField_compose3DVoxel<DTYPE>(index+v,
+                                                     df_real2Voxel,
+                                                     df_voxel2Real,
+                                                     DefFieldDim,
+                                                     dim,
+                                                     defPtrX,
+                                                     defPtrY,
+                                                     defPtrZ,
+                                                     posPtrX,
+                                                     posPtrY,
+                                                     posPtrZ,
+                                                     resPtrX,
+                                                     resPtrY,
+                                                     resPtrZ);
                }
-               realDefX += defX * basis;
-               realDefY += defY * basis;
             }
-         }
-         resPtrX[i]=realDefX;
-         resPtrY[i]=realDefY;
-      }// mask
-   }// loop over every voxel
+         } // x
+      } // y
+   } // z
+}
+/* *************************************************************** */
+/// @brief Split a field of dimension dim into bricks and returns their number.
+/// As the deformation is smooth, the positions looked up from a brick are
+/// close to each other and the corresponding part of the deformation field
+/// stays in cache
+static inline int reg_defField_getBrickNumber(const int *dim, int *brickNumber)
+{
+   brickNumber[0]=(dim[0]+DEF_FIELD_BRICK_X-1)/DEF_FIELD_BRICK_X;
+   brickNumber[1]=(dim[1]+DEF_FIELD_BRICK_Y-1)/DEF_FIELD_BRICK_Y;
+   brickNumber[2]=(dim[2]+DEF_FIELD_BRICK_Z-1)/DEF_FIELD_BRICK_Z;
+   return brickNumber[0]*brickNumber[1]*brickNumber[2];
+}
+/* *************************************************************** */
+/// @brief Returns the voxel range [start,end[ of a brick
+static inline void reg_defField_getBrickRange(int brick,
+                                              const int *dim,
+                                              const int *brickNumber,
+                                              int *start,
+                                              int *end)
+{
+   const int brickSize[3]= {DEF_FIELD_BRICK_X, DEF_FIELD_BRICK_Y, DEF_FIELD_BRICK_Z};
+   start[0]=(brick%brickNumber[0])*brickSize[0];
+   start[1]=((brick/brickNumber[0])%brickNumber[1])*brickSize[1];
+   start[2]=(brick/(brickNumber[0]*brickNumber[1]))*brickSize[2];
+   for(int i=0; i<3; ++i)
+      end[i]=start[i]+brickSize[i]<dim[i]?start[i]+brickSize[i]:dim[i];
 }
 /* *************************************************************** */
 template <class DTYPE>
@@ -2658,15 +2970,8 @@ void reg_defField_compose3D(nifti_image *deformationField,
 {
    const int DefFieldDim[3]= {deformationField->nx,deformationField->ny,deformationField->nz};
    const size_t DFVoxelNumber=(size_t)DefFieldDim[0]*DefFieldDim[1]*DefFieldDim[2];
-#ifdef _WIN32
-   long i;
-   long warVoxelNumber=(size_t)dfToUpdate->nx*
-         dfToUpdate->ny*dfToUpdate->nz;
-#else
-   size_t i;
-   size_t warVoxelNumber=(size_t)dfToUpdate->nx*
-         dfToUpdate->ny*dfToUpdate->nz;
-#endif
+   const int warDim[3]= {dfToUpdate->nx,dfToUpdate->ny,dfToUpdate->nz};
+   const size_t warVoxelNumber=(size_t)warDim[0]*warDim[1]*warDim[2];
 
    DTYPE *defPtrX = static_cast<DTYPE *>(deformationField->data);
    DTYPE *defPtrY = &defPtrX[DFVoxelNumber];
@@ -2693,107 +2998,38 @@ void reg_defField_compose3D(nifti_image *deformationField,
       df_voxel2Real=&deformationField->qto_xyz;
    }
 
-   size_t tempIndex, index;
-   int a, b, c, currentX, currentY, currentZ, pre[3];
-   DTYPE realDef[3], voxel[3], basis, tempBasis;
-   DTYPE defX, defY, defZ, relX[2], relY[2], relZ[2];
-   bool inY, inZ;
+   // The voxels to update are processed brick by brick
+   int brickNumber[3];
+   const int totalBrickNumber=reg_defField_getBrickNumber(warDim, brickNumber);
+   int brick, start[3], end[3];
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
-   shared(warVoxelNumber, mask, df_real2Voxel, df_voxel2Real, DefFieldDim, \
-   defPtrX, defPtrY, defPtrZ, resPtrX, resPtrY, resPtrZ, deformationField) \
-   private(i, a, b, c, currentX, currentY, currentZ, index, tempIndex, pre, \
-   realDef, voxel, tempBasis, defX, defY, defZ, relX, relY, relZ, basis, inY, inZ)
+   shared(mask, df_real2Voxel, df_voxel2Real, DefFieldDim, warDim, \
+   brickNumber, totalBrickNumber, defPtrX, defPtrY, defPtrZ, \
+   resPtrX, resPtrY, resPtrZ, deformationField) \
+   private(brick, start, end)
 #endif
-   for(i=0; i<warVoxelNumber; ++i)
+   for(brick=0; brick<totalBrickNumber; ++brick)
    {
-      if(mask[i]>-1)
-      {
-         // Conversion from real to voxel in the deformation field
-         realDef[0] = resPtrX[i];
-         realDef[1] = resPtrY[i];
-         realDef[2] = resPtrZ[i];
-         voxel[0] =
-               df_real2Voxel.m[0][0] * realDef[0] +
-               df_real2Voxel.m[0][1] * realDef[1] +
-               df_real2Voxel.m[0][2] * realDef[2] +
-               df_real2Voxel.m[0][3] ;
-         voxel[1] =
-               df_real2Voxel.m[1][0] * realDef[0] +
-               df_real2Voxel.m[1][1] * realDef[1] +
-               df_real2Voxel.m[1][2] * realDef[2] +
-               df_real2Voxel.m[1][3] ;
-         voxel[2] =
-               df_real2Voxel.m[2][0] * realDef[0] +
-               df_real2Voxel.m[2][1] * realDef[1] +
-               df_real2Voxel.m[2][2] * realDef[2] +
-               df_real2Voxel.m[2][3] ;
-         //reg_mat44_mul(df_real2Voxel, realDef, voxel);
-
-         // Linear interpolation to compute the new deformation
-         pre[0]=static_cast<int>reg_floor(voxel[0]);
-         pre[1]=static_cast<int>reg_floor(voxel[1]);
-         pre[2]=static_cast<int>reg_floor(voxel[2]);
-         relX[1]=voxel[0]-static_cast<DTYPE>(pre[0]);
-         relX[0]=1.-relX[1];
-         relY[1]=voxel[1]-static_cast<DTYPE>(pre[1]);
-         relY[0]=1.-relY[1];
-         relZ[1]=voxel[2]-static_cast<DTYPE>(pre[2]);
-         relZ[0]=1.-relZ[1];
-         realDef[0]=realDef[1]=realDef[2]=0.;
-         for(c=0; c<2; ++c)
-         {
-            currentZ = pre[2]+c;
-            tempIndex=currentZ*DefFieldDim[0]*DefFieldDim[1];
-            if(currentZ>-1 && currentZ<DefFieldDim[2]) inZ=true;
-            else inZ=false;
-            for(b=0; b<2; ++b)
-            {
-               currentY = pre[1]+b;
-               index=tempIndex+currentY*DefFieldDim[0] + pre[0];
-               tempBasis= relY[b] * relZ[c];
-               if(currentY>-1 && currentY<DefFieldDim[1]) inY=true;
-               else inY=false;
-               for(a=0; a<2; ++a)
-               {
-                  currentX = pre[0]+a;
-                  if(currentX>-1 && currentX<DefFieldDim[0] && inY && inZ)
-                  {
-                     // Uses the deformation field if voxel is in its space
-                     defX = defPtrX[index];
-                     defY = defPtrY[index];
-                     defZ = defPtrZ[index];
-                  }
-                  else
-                  {
-                     // Uses a sliding effect
-                     get_SlidedValues<DTYPE>(defX,
-                                             defY,
-                                             defZ,
-                                             currentX,
-                                             currentY,
-                                             currentZ,
-                                             defPtrX,
-                                             defPtrY,
-                                             defPtrZ,
-                                             df_voxel2Real,
-                                             deformationField->dim,
-                                             false // not a displacement field
-                                             );
-                  }
-                  ++index;
-                  basis = relX[a] * tempBasis;
-                  realDef[0] += defX * basis;
-                  realDef[1] += defY * basis;
-                  realDef[2] += defZ * basis;
-               } // a loop
-            } // b loop
-         } // c loop
-         resPtrX[i] = realDef[0];
-         resPtrY[i] = realDef[1];
-         resPtrZ[i] = realDef[2];
-      }// mask
-   }// loop over every voxel
+      reg_defField_getBrickRange(brick, warDim, brickNumber, start, end);
+      reg_defField_compose3DBrick<DTYPE>(start,
+                                         end,
+                                         warDim,
+                                         mask,
+                                         df_real2Voxel,
+                                         df_voxel2Real,
+                                         DefFieldDim,
+                                         deformationField->dim,
+                                         defPtrX,
+                                         defPtrY,
+                                         defPtrZ,
+                                         resPtrX,
+                                         resPtrY,
+                                         resPtrZ,
+                                         resPtrX,
+                                         resPtrY,
+                                         resPtrZ);
+   }
 }
 /* *************************************************************** */
 void reg_defField_compose(nifti_image *deformationField,
@@ -3346,25 +3582,104 @@ static void optimize(gsl_multimin_function *f, double *start, void *data, double
    nmsimplex_calc_center (&t, start);
 }
 /* *************************************************************** */
+/// Maximal number of resolution levels used to warm start the inversion
+#define DEF_FIELD_INVERT_LEVEL 3
+/// Minimal dimension of the coarsest inversion level
+#define DEF_FIELD_INVERT_MIN_DIM 8
+/* *************************************************************** */
+/// @brief Returns the distance between a target position and the transformed
+/// position. The difference between both is stored in residual
+template <class DTYPE>
+static inline double reg_defFieldInvert_getResidual(const double *target,
+                                                    const double *position,
+                                                    nifti_image *deformationField,
+                                                    double *residual)
+{
+   double warped[3];
+   FastWarp<DTYPE>(position[0], position[1], position[2], deformationField,
+                   &warped[0], &warped[1], &warped[2]);
+   residual[0]=target[0]-warped[0];
+   residual[1]=target[1]-warped[1];
+   residual[2]=target[2]-warped[2];
+   return sqrt(residual[0]*residual[0]+residual[1]*residual[1]+residual[2]*residual[2]);
+}
+/* *************************************************************** */
+/// @brief Inverts the transformation at a single target position using the
+/// fixed-point iteration p <- p + (target - T(p)), which is equivalent to
+/// v <- -u(target + v) on the displacement. The step is halved whenever the
+/// residual does not decrease. Returns false when the iteration stagnates
+/// before the tolerance is reached
+template <class DTYPE>
+static bool reg_defFieldInvert_fixedPoint(const double *target,
+                                          double *position,
+                                          nifti_image *deformationField,
+                                          double tolerance,
+                                          int maxIterationNumber,
+                                          double *error)
+{
+   double residual[3], newPosition[3], newResidual[3];
+   double currentError=reg_defFieldInvert_getResidual<DTYPE>(target, position,
+                                                             deformationField, residual);
+   for(int it=0; it<maxIterationNumber && currentError>tolerance; ++it)
+   {
+      bool improved=false;
+      for(double step=1.; step>=0.0625; step*=0.5)
+      {
+         newPosition[0]=position[0]+step*residual[0];
+         newPosition[1]=position[1]+step*residual[1];
+         newPosition[2]=position[2]+step*residual[2];
+         double newError=reg_defFieldInvert_getResidual<DTYPE>(target, newPosition,
+                                                               deformationField, newResidual);
+         if(newError<currentError)
+         {
+            for(int i=0; i<3; ++i)
+            {
+               position[i]=newPosition[i];
+               residual[i]=newResidual[i];
+            }
+            currentError=newError;
+            improved=true;
+            break;
+         }
+      }
+      if(!improved)
+      {
+         *error=currentError;
+         return false;
+      }
+   }
+   *error=currentError;
+   return true;
+}
+/* *************************************************************** */
 template <class DTYPE>
 void reg_defFieldInvert3D(nifti_image *inputDeformationField,
                           nifti_image *outputDeformationField,
-                          float tolerance)
+                          float tolerance,
+                          int maxIterationNumber,
+                          bool useOutputAsInitialisation,
+                          double *inverseError)
 {
-   int outputVoxelNumber = outputDeformationField->nx *
-         outputDeformationField->ny *
-         outputDeformationField->nz;
+   const int outputDim[3]= {outputDeformationField->nx,
+                            outputDeformationField->ny,
+                            outputDeformationField->nz
+                           };
+   const size_t outputVoxelNumber=(size_t)outputDim[0]*outputDim[1]*outputDim[2];
+   DTYPE *outPtrX=static_cast<DTYPE *>(outputDeformationField->data);
+   DTYPE *outPtrY=&outPtrX[outputVoxelNumber];
+   DTYPE *outPtrZ=&outPtrY[outputVoxelNumber];
 
    mat44 *OutXYZMatrix;
    if(outputDeformationField->sform_code>0)
       OutXYZMatrix=&(outputDeformationField->sto_xyz);
    else OutXYZMatrix=&(outputDeformationField->qto_xyz);
 
-   // added:
    mat44 *InXYZMatrix;
    if(inputDeformationField->sform_code>0)
       InXYZMatrix=&(inputDeformationField->sto_xyz);
    else InXYZMatrix=&(inputDeformationField->qto_xyz);
+   // The translation observed at the centre of the input field is used
+   // to initialise the positions of the coarsest level
    float center[4], center2[4];
    double centerout[4], delta[4];
    center[0] = inputDeformationField->nx / 2;
@@ -3372,68 +3687,202 @@ void reg_defFieldInvert3D(nifti_image *inputDeformationField,
    center[2] = inputDeformationField->nz / 2;
    center[3] = 1;
    reg_mat44_mul(InXYZMatrix, center, center2);
-   FastWarp<float>(center2[0], center2[1], center2[2], inputDeformationField, &centerout[0], &centerout[1], &centerout[2]);
+   FastWarp<DTYPE>(center2[0], center2[1], center2[2], inputDeformationField,
+                   &centerout[0], &centerout[1], &centerout[2]);
    delta[0] = center2[0]-centerout[0];
    delta[1] = center2[1]-centerout[1];
    delta[2] = center2[2]-centerout[2];
-   // end added
-
 
-   int i,x,y,z;
-   double position[4], pars[4], arrayy[4][3];
-   struct ddata dat;
-   DTYPE *outData;
+   // The inverse is first computed on subsampled output grids. Each level
+   // is initialised from the displacement of the coarser one
+   int levelNumber=1;
+   if(!useOutputAsInitialisation)
+   {
+      while(levelNumber<DEF_FIELD_INVERT_LEVEL &&
+            ((outputDim[0]-1)>>levelNumber)+1>=DEF_FIELD_INVERT_MIN_DIM &&
+            ((outputDim[1]-1)>>levelNumber)+1>=DEF_FIELD_INVERT_MIN_DIM &&
+            ((outputDim[2]-1)>>levelNumber)+1>=DEF_FIELD_INVERT_MIN_DIM)
+         ++levelNumber;
+   }
+   double *coarseDisp=NULL;
+   int coarseDim[3]= {0,0,0};
+   double errorSum=0., errorMax=0.;
+   size_t errorNumber=0, fallbackNumber=0;
+   for(int level=levelNumber-1; level>=0; --level)
+   {
+      const int levelStep=1<<level;
+      int levelDim[3];
+      for(int i=0; i<3; ++i)
+         levelDim[i]=(outputDim[i]-1)/levelStep+1;
+      const size_t levelVoxelNumber=(size_t)levelDim[0]*levelDim[1]*levelDim[2];
+      // The finest level is directly stored in the output field
+      double *levelDisp=NULL;
+      if(level>0)
+         levelDisp=(double *)malloc(3*levelVoxelNumber*sizeof(double));
+
+      int brickNumber[3];
+      const int totalBrickNumber=reg_defField_getBrickNumber(levelDim, brickNumber);
+      double *brickErrorSum=(double *)calloc(totalBrickNumber,sizeof(double));
+      double *brickErrorMax=(double *)calloc(totalBrickNumber,sizeof(double));
+      size_t *brickErrorNumber=(size_t *)calloc(totalBrickNumber,sizeof(size_t));
+      size_t *brickFallbackNumber=(size_t *)calloc(totalBrickNumber,sizeof(size_t));
+
+      int brick, x, y, z, start[3], end[3];
+      size_t index;
+      double voxel[4], target[4], position[3], coarse[3], error, arrayy[4][3];
+      struct ddata dat;
 #if defined (_OPENMP)
-#pragma omp parallel for default(none) \
-   shared(outputDeformationField,tolerance,outputVoxelNumber, \
-   inputDeformationField, OutXYZMatrix, delta) \
-   private(i,x,y,z,dat,outData,position,pars,arrayy)
+#pragma omp parallel for default(none) schedule(dynamic) \
+   shared(inputDeformationField, tolerance, maxIterationNumber, useOutputAsInitialisation, \
+   OutXYZMatrix, delta, level, levelStep, levelDim, levelVoxelNumber, levelDisp, \
+   coarseDisp, coarseDim, brickNumber, totalBrickNumber, brickErrorSum, brickErrorMax, \
+   brickErrorNumber, brickFallbackNumber, outputDim, outPtrX, outPtrY, outPtrZ) \
+   private(brick, x, y, z, start, end, index, voxel, target, position, coarse, \
+   error, arrayy, dat)
 #endif
-   for (z=0; z<outputDeformationField->nz; ++z)
-   {
-      dat.deformationField = inputDeformationField;
-      for(i=0; i<4; ++i)              /* set up 2D array pointers */
-         dat.arrayy[i]= arrayy[i];
-
-      outData = (DTYPE *)(outputDeformationField->data) +
-            outputDeformationField->nx * outputDeformationField->ny * z;
-
-      for(y=0; y<outputDeformationField->ny; ++y)
+      for(brick=0; brick<totalBrickNumber; ++brick)
       {
-         for(x=0; x<outputDeformationField->nx; ++x)
+         reg_defField_getBrickRange(brick, levelDim, brickNumber, start, end);
+         for(z=start[2]; z<end[2]; ++z)
          {
-
-            // convert x, y,z to world coordinates
-            position[0] = x;
-            position[1] = y;
-            position[2] = z;
-            position[3] = 1;
-            reg_mat44_mul(OutXYZMatrix, position, pars);
-            dat.gx = pars[0];
-            dat.gy = pars[1];
-            dat.gz = pars[2];
-
-            // added
-            pars[0] += delta[0];
-            pars[1] += delta[1];
-            pars[2] += delta[2];
-            // end added
-
-            optimize(cost_function, pars, (void *)&dat, tolerance);
-            // output = (warp-1)(input);
-
-            outData[0]        = pars[0];
-            outData[outputVoxelNumber]   = pars[1];
-            outData[outputVoxelNumber*2] = pars[2];
-            ++outData;
+            for(y=start[1]; y<end[1]; ++y)
+            {
+               index=((size_t)z*levelDim[1]+y)*levelDim[0]+start[0];
+               for(x=start[0]; x<end[0]; ++x, ++index)
+               {
+                  voxel[0]=x*levelStep;
+                  voxel[1]=y*levelStep;
+                  voxel[2]=z*levelStep;
+                  voxel[3]=1;
+                  reg_mat44_mul(OutXYZMatrix, voxel, target);
+                  if(level==0 && useOutputAsInitialisation)
+                  {
+                     position[0]=outPtrX[index];
+                     position[1]=outPtrY[index];
+                     position[2]=outPtrZ[index];
+                  }
+                  else if(coarseDisp!=NULL)
+                  {
+                     // Linear interpolation of the coarser level displacement
+                     coarse[0]=0.5*x;
+                     coarse[1]=0.5*y;
+                     coarse[2]=0.5*z;
+                     int pre[3];
+                     double rel[3];
+                     for(int i=0; i<3; ++i)
+                     {
+                        pre[i]=static_cast<int>(coarse[i]);
+                        if(pre[i]>coarseDim[i]-2) pre[i]=coarseDim[i]-2;
+                        rel[i]=coarse[i]-pre[i];
+                     }
+                     const size_t coarseVoxelNumber=(size_t)coarseDim[0]*coarseDim[1]*coarseDim[2];
+                     position[0]=target[0];
+                     position[1]=target[1];
+                     position[2]=target[2];
+                     for(int c=0; c<2; ++c)
+                     {
+                        for(int b=0; b<2; ++b)
+                        {
+                           for(int a=0; a<2; ++a)
+                           {
+                              const size_t coarseIndex=((size_t)(pre[2]+c)*coarseDim[1]+pre[1]+b)*
+                                    coarseDim[0]+pre[0]+a;
+                              const double basis=(a?rel[0]:1.-rel[0])*
+                                    (b?rel[1]:1.-rel[1])*
+                                    (c?rel[2]:1.-rel[2]);
+                              position[0]+=basis*coarseDisp[coarseIndex];
+                              position[1]+=basis*coarseDisp[coarseIndex+coarseVoxelNumber];
+                              position[2]+=basis*coarseDisp[coarseIndex+2*coarseVoxelNumber];
+                           }
+                        }
+                     }
+                  }
+                  else
+                  {
+                     position[0]=target[0]+delta[0];
+                     position[1]=target[1]+delta[1];
+                     position[2]=target[2]+delta[2];
+                  }
+                  if(!reg_defFieldInvert_fixedPoint<DTYPE>(target,
+                                                           position,
+                                                           inputDeformationField,
+                                                           tolerance,
+                                                           maxIterationNumber,
+                                                           &error))
+                  {
+                     // The simplex search is used where the fixed-point
+                     // iteration stagnates, typically around foldings
+                     dat.deformationField=inputDeformationField;
+                     for(int i=0; i<4; ++i)
+                        dat.arrayy[i]=arrayy[i];
+                     dat.gx=target[0];
+                     dat.gy=target[1];
+                     dat.gz=target[2];
+                     optimize(cost_function, position, (void *)&dat, tolerance);
+                     error=sqrt(cost_function(position, (void *)&dat));
+                     ++brickFallbackNumber[brick];
+                  }
+                  if(error==error)
+                  {
+                     brickErrorSum[brick]+=error;
+                     brickErrorMax[brick]=error>brickErrorMax[brick]?error:brickErrorMax[brick];
+                     ++brickErrorNumber[brick];
+                  }
+                  if(level>0)
+                  {
+                     levelDisp[index]=position[0]-target[0];
+                     levelDisp[index+levelVoxelNumber]=position[1]-target[1];
+                     levelDisp[index+2*levelVoxelNumber]=position[2]-target[2];
+                  }
+                  else
+                  {
+                     outPtrX[index]=static_cast<DTYPE>(position[0]);
+                     outPtrY[index]=static_cast<DTYPE>(position[1]);
+                     outPtrZ[index]=static_cast<DTYPE>(position[2]);
+                  }
+               } // x
+            } // y
+         } // z
+      } // bricks
+      if(level==0)
+      {
+         for(brick=0; brick<totalBrickNumber; ++brick)
+         {
+            errorSum+=brickErrorSum[brick];
+            errorMax=brickErrorMax[brick]>errorMax?brickErrorMax[brick]:errorMax;
+            errorNumber+=brickErrorNumber[brick];
          }
       }
+      for(brick=0; brick<totalBrickNumber; ++brick)
+         fallbackNumber+=brickFallbackNumber[brick];
+      free(brickErrorSum);
+      free(brickErrorMax);
+      free(brickErrorNumber);
+      free(brickFallbackNumber);
+      if(coarseDisp!=NULL) free(coarseDisp);
+      coarseDisp=levelDisp;
+      for(int i=0; i<3; ++i)
+         coarseDim[i]=levelDim[i];
+   } // level
+#ifndef NDEBUG
+   char text[255];
+   sprintf(text, "Deformation field inversion over %i level(s) - %lu simplex fallback(s)",
+           levelNumber, (unsigned long)fallbackNumber);
+   reg_print_msg_debug(text);
+#endif
+   if(inverseError!=NULL)
+   {
+      inverseError[0]=errorNumber>0?errorSum/(double)errorNumber:std::numeric_limits<double>::quiet_NaN();
+      inverseError[1]=errorMax;
    }
 }
 /* *************************************************************** */
 void reg_defFieldInvert(nifti_image *inputDeformationField,
                         nifti_image *outputDeformationField,
-                        float tolerance)
+                        float tolerance,
+                        int maxIterationNumber,
+                        bool useOutputAsInitialisation,
+                        double *inverseError)
 {
    // Check the input image data types
    if(inputDeformationField->datatype!=outputDeformationField->datatype)
@@ -3450,15 +3899,21 @@ void reg_defFieldInvert(nifti_image *inputDeformationField,
       reg_exit();
    }
 
+   if(tolerance!=tolerance)
+      tolerance=1.0e-6f;
+
    switch(inputDeformationField->datatype)
    {
    case NIFTI_TYPE_FLOAT32:
       reg_defFieldInvert3D<float>
-            (inputDeformationField,outputDeformationField,tolerance);
+            (inputDeformationField,outputDeformationField,tolerance,
+             maxIterationNumber,useOutputAsInitialisation,inverseError);
       break;
    case NIFTI_TYPE_FLOAT64:
       reg_defFieldInvert3D<double>
-            (inputDeformationField,outputDeformationField,tolerance);
+            (inputDeformationField,outputDeformationField,tolerance,
+             maxIterationNumber,useOutputAsInitialisation,inverseError);
+      break;
    default:
       reg_print_fct_error("reg_defFieldInvert");
       reg_print_msg_error("Deformation field pixel type unsupported");
@@ -3999,18 +4454,193 @@ void reg_spline_getFlowFieldFromVelocityGrid(nifti_image *velocityFieldGrid,
    velocityFieldGrid->num_ext=oldNumExt;
 }
 /* *************************************************************** */
-void reg_defField_getDeformationFieldFromFlowField(nifti_image *flowFieldImage,
-                                                   nifti_image *deformationFieldImage,
-                                                   bool updateStepNumber)
+/// @brief Squares deformation fields: every deformation field is applied to
+/// itself and the result is stored in the corresponding squared field. The
+/// voxels of all the fields are processed in a single parallel loop
+template <class DTYPE>
+void reg_defField_square2D(nifti_image **deformationField,
+                           nifti_image **squaredField,
+                           int fieldNumber)
 {
-   // Check first if the velocity field is actually a velocity field
-   if(flowFieldImage->intent_p1 != DEF_VEL_FIELD)
+   DTYPE *defPtrX[2], *defPtrY[2], *resPtrX[2], *resPtrY[2];
+   mat44 *df_real2Voxel[2], *df_voxel2Real[2];
+   size_t fieldStart[3]={0,0,0};
+   for(int f=0; f<fieldNumber; ++f)
    {
-      reg_print_fct_error("reg_defField_getDeformationFieldFromFlowField");
-      reg_print_msg_error("The provide field is not a velocity field");
+      size_t voxelNumber=(size_t)deformationField[f]->nx*deformationField[f]->ny;
+      fieldStart[f+1]=fieldStart[f]+voxelNumber;
+      defPtrX[f] = static_cast<DTYPE *>(deformationField[f]->data);
+      defPtrY[f] = &defPtrX[f][voxelNumber];
+      resPtrX[f] = static_cast<DTYPE *>(squaredField[f]->data);
+      resPtrY[f] = &resPtrX[f][voxelNumber];
+      if(deformationField[f]->sform_code>0)
+      {
+         df_real2Voxel[f]=&(squaredField[f]->sto_ijk);
+         df_voxel2Real[f]=&(deformationField[f]->sto_xyz);
+      }
+      else
+      {
+         df_real2Voxel[f]=&(squaredField[f]->qto_ijk);
+         df_voxel2Real[f]=&(deformationField[f]->qto_xyz);
+      }
+   }
+#ifdef _WIN32
+   long i;
+   long totalVoxelNumber=fieldStart[fieldNumber];
+#else
+   size_t i;
+   size_t totalVoxelNumber=fieldStart[fieldNumber];
+#endif
+   size_t index;
+   int f;
+   DTYPE realDefX, realDefY;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(totalVoxelNumber, fieldStart, deformationField, df_real2Voxel, \
+   df_voxel2Real, defPtrX, defPtrY, resPtrX, resPtrY) \
+   private(i, f, index, realDefX, realDefY)
+#endif
+   for(i=0; i<totalVoxelNumber; ++i)
+   {
+      f=(size_t)i<fieldStart[1]?0:1;
+      index=i-fieldStart[f];
+      realDefX = defPtrX[f][index];
+      realDefY = defPtrY[f][index];
+      reg_defField_interpolate2D<DTYPE>(realDefX,
+                                        realDefY,
+                                        df_real2Voxel[f],
+                                        df_voxel2Real[f],
+                                        deformationField[f],
+                                        defPtrX[f],
+                                        defPtrY[f]);
+      resPtrX[f][index]=realDefX;
+      resPtrY[f][index]=realDefY;
+   }
+}
+/* *************************************************************** */
+template <class DTYPE>
+void reg_defField_square3D(nifti_image **deformationField,
+                           nifti_image **squaredField,
+                           int fieldNumber)
+{
+   DTYPE *defPtrX[2], *defPtrY[2], *defPtrZ[2];
+   DTYPE *resPtrX[2], *resPtrY[2], *resPtrZ[2];
+   mat44 df_real2Voxel[2], *df_voxel2Real[2];
+   int DefFieldDim[2][3];
+   for(int f=0; f<fieldNumber; ++f)
+   {
+      DefFieldDim[f][0]=deformationField[f]->nx;
+      DefFieldDim[f][1]=deformationField[f]->ny;
+      DefFieldDim[f][2]=deformationField[f]->nz;
+      size_t voxelNumber=(size_t)DefFieldDim[f][0]*DefFieldDim[f][1]*DefFieldDim[f][2];
+      defPtrX[f] = static_cast<DTYPE *>(deformationField[f]->data);
+      defPtrY[f] = &defPtrX[f][voxelNumber];
+      defPtrZ[f] = &defPtrY[f][voxelNumber];
+      resPtrX[f] = static_cast<DTYPE *>(squaredField[f]->data);
+      resPtrY[f] = &resPtrX[f][voxelNumber];
+      resPtrZ[f] = &resPtrY[f][voxelNumber];
+      if(deformationField[f]->sform_code>0)
+      {
+         df_real2Voxel[f]=deformationField[f]->sto_ijk;
+         df_voxel2Real[f]=&deformationField[f]->sto_xyz;
+      }
+      else
+      {
+         df_real2Voxel[f]=deformationField[f]->qto_ijk;
+         df_voxel2Real[f]=&deformationField[f]->qto_xyz;
+      }
+   }
+   // The bricks of both fields are processed in a single parallel loop
+   int brickNumber[2][3];
+   int fieldBrickStart[3]={0,0,0};
+   for(int f=0; f<fieldNumber; ++f)
+      fieldBrickStart[f+1]=fieldBrickStart[f]+
+            reg_defField_getBrickNumber(DefFieldDim[f], brickNumber[f]);
+   const int totalBrickNumber=fieldBrickStart[fieldNumber];
+   int brick, f, start[3], end[3];
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(totalBrickNumber, fieldBrickStart, brickNumber, deformationField, \
+   df_real2Voxel, df_voxel2Real, DefFieldDim, defPtrX, defPtrY, defPtrZ, \
+   resPtrX, resPtrY, resPtrZ) \
+   private(brick, f, start, end)
+#endif
+   for(brick=0; brick<totalBrickNumber; ++brick)
+   {
+      f=brick<fieldBrickStart[1]?0:1;
+      reg_defField_getBrickRange(brick-fieldBrickStart[f], DefFieldDim[f],
+                                 brickNumber[f], start, end);
+      reg_defField_compose3DBrick<DTYPE>(start,
+                                         end,
+                                         DefFieldDim[f],
+                                         NULL,
+                                         df_real2Voxel[f],
+                                         df_voxel2Real[f],
+                                         DefFieldDim[f],
+                                         deformationField[f]->dim,
+                                         defPtrX[f],
+                                         defPtrY[f],
+                                         defPtrZ[f],
+                                         defPtrX[f],
+                                         defPtrY[f],
+                                         defPtrZ[f],
+                                         resPtrX[f],
+                                         resPtrY[f],
+                                         resPtrZ[f]);
+   }
+}
+/* *************************************************************** */
+/// @brief Squares one or two deformation fields of the same type and
+/// dimension in a single parallel loop
+static void reg_defField_square(nifti_image **deformationField,
+                                nifti_image **squaredField,
+                                int fieldNumber)
+{
+   if(fieldNumber<1 || fieldNumber>2)
+   {
+      reg_print_fct_error("reg_defField_square");
+      reg_print_msg_error("One or two deformation fields are expected");
       reg_exit();
    }
-
+   for(int f=0; f<fieldNumber; ++f)
+   {
+      if(deformationField[f]->datatype != deformationField[0]->datatype ||
+            squaredField[f]->datatype != deformationField[0]->datatype ||
+            deformationField[f]->nu != deformationField[0]->nu)
+      {
+         reg_print_fct_error("reg_defField_square");
+         reg_print_msg_error("All deformation fields are expected to have the same type and dimension");
+         reg_exit();
+      }
+   }
+   switch(deformationField[0]->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      if(deformationField[0]->nu==2)
+         reg_defField_square2D<float>(deformationField,squaredField,fieldNumber);
+      else reg_defField_square3D<float>(deformationField,squaredField,fieldNumber);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      if(deformationField[0]->nu==2)
+         reg_defField_square2D<double>(deformationField,squaredField,fieldNumber);
+      else reg_defField_square3D<double>(deformationField,squaredField,fieldNumber);
+      break;
+   default:
+      reg_print_fct_error("reg_defField_square");
+      reg_print_msg_error("Deformation field pixel type unsupported");
+      reg_exit();
+   }
+}
+/* *************************************************************** */
+/// @brief Removes the affine component of a flow field, updates its number of
+/// squaring steps if required and scales it down. The flow field then contains
+/// the deformation field to square. The affine component is returned as a
+/// displacement field, or NULL if there is none
+static nifti_image *reg_defField_scaleFlowField(nifti_image *flowFieldImage,
+                                                nifti_image *deformationFieldImage,
+                                                bool updateStepNumber,
+                                                int *squaringStepNumber)
+{
    // Remove the affine component from the flow field
    nifti_image *affineOnly=NULL;
    if(flowFieldImage->num_ext>0)
@@ -4083,27 +4713,15 @@ void reg_defField_getDeformationFieldFromFlowField(nifti_image *flowFieldImage,
 
    // Conversion from displacement to deformation
    reg_getDeformationFromDisplacement(flowFieldImage);
-
-   // The computed scaled deformation field is copied over
-   memcpy(deformationFieldImage->data, flowFieldImage->data,
-          deformationFieldImage->nvox*deformationFieldImage->nbyper);
-
-   // The deformation field is squared
-   for(unsigned short i=0; i<squaringNumber; ++i)
-   {
-      // The deformation field is applied to itself
-      reg_defField_compose(deformationFieldImage,
-                           flowFieldImage,
-                           NULL);
-      // The computed scaled deformation field is copied over
-      memcpy(deformationFieldImage->data, flowFieldImage->data,
-             deformationFieldImage->nvox*deformationFieldImage->nbyper);
-#ifndef NDEBUG
-      char text[255];
-      sprintf(text, "Squaring (composition) step %u/%u", i+1, squaringNumber);
-      reg_print_msg_debug(text);
-#endif
-   }
+   *squaringStepNumber=squaringNumber;
+   return affineOnly;
+}
+/* *************************************************************** */
+/// @brief Restores the affine components of a squared deformation field
+static void reg_defField_restoreAffineComponents(nifti_image *flowFieldImage,
+                                                 nifti_image *deformationFieldImage,
+                                                 nifti_image *affineOnly)
+{
    // The affine conponent of the transformation is restored
    if(affineOnly!=NULL)
    {
@@ -4123,6 +4741,49 @@ void reg_defField_getDeformationFieldFromFlowField(nifti_image *flowFieldImage,
    }
 }
 /* *************************************************************** */
+void reg_defField_getDeformationFieldFromFlowField(nifti_image *flowFieldImage,
+                                                   nifti_image *deformationFieldImage,
+                                                   bool updateStepNumber)
+{
+   // Check first if the velocity field is actually a velocity field
+   if(flowFieldImage->intent_p1 != DEF_VEL_FIELD)
+   {
+      reg_print_fct_error("reg_defField_getDeformationFieldFromFlowField");
+      reg_print_msg_error("The provide field is not a velocity field");
+      reg_exit();
+   }
+
+   int squaringNumber;
+   nifti_image *affineOnly=reg_defField_scaleFlowField(flowFieldImage,
+                                                       deformationFieldImage,
+                                                       updateStepNumber,
+                                                       &squaringNumber);
+
+   // The deformation field is squared, the flow field and the deformation
+   // field being alternatively used as input and output
+   nifti_image *currentField=flowFieldImage;
+   nifti_image *squaredField=deformationFieldImage;
+   for(unsigned short i=0; i<squaringNumber; ++i)
+   {
+      // The deformation field is applied to itself
+      reg_defField_square(&currentField, &squaredField, 1);
+      std::swap(currentField, squaredField);
+#ifndef NDEBUG
+      char text[255];
+      sprintf(text, "Squaring (composition) step %u/%u", i+1, squaringNumber);
+      reg_print_msg_debug(text);
+#endif
+   }
+   // The squared deformation field is copied over if required
+   if(currentField!=deformationFieldImage)
+      memcpy(deformationFieldImage->data, currentField->data,
+             deformationFieldImage->nvox*deformationFieldImage->nbyper);
+
+   reg_defField_restoreAffineComponents(flowFieldImage,
+                                        deformationFieldImage,
+                                        affineOnly);
+}
+/* *************************************************************** */
 void reg_spline_getDefFieldFromVelocityGrid(nifti_image *velocityFieldGrid,
                                             nifti_image *deformationFieldImage,
                                             bool updateStepNumber)
@@ -4175,6 +4836,76 @@ void reg_spline_getDefFieldFromVelocityGrid(nifti_image *velocityFieldGrid,
    return;
 }
 /* *************************************************************** */
+void reg_spline_getDefFieldsFromVelocityGrids(nifti_image **velocityFieldGrid,
+                                              nifti_image **deformationFieldImage,
+                                              nifti_image **flowFieldImage,
+                                              bool updateStepNumber)
+{
+   nifti_image *affineOnly[2];
+   int squaringNumber[2];
+   for(int d=0; d<2; ++d)
+   {
+      if(velocityFieldGrid[d]->intent_p1 != SPLINE_VEL_GRID)
+      {
+         reg_print_fct_error("reg_spline_getDefFieldsFromVelocityGrids");
+         reg_print_msg_error("The provided input images are not velocity grids");
+         reg_exit();
+      }
+      // Clean any extension in the deformation field as it is unexpected
+      nifti_free_extensions(deformationFieldImage[d]);
+
+      // The flow field is stored in the provided buffer
+      nifti_image *flowField = flowFieldImage[d];
+      nifti_free_extensions(flowField);
+      flowField->intent_code=NIFTI_INTENT_VECTOR;
+      memset(flowField->intent_name, 0, 16);
+      strcpy(flowField->intent_name,"NREG_TRANS");
+      flowField->intent_p1=DEF_VEL_FIELD;
+      flowField->intent_p2=velocityFieldGrid[d]->intent_p2;
+      if(velocityFieldGrid[d]->num_ext>0)
+         nifti_copy_extensions(flowField, velocityFieldGrid[d]);
+
+      // Generate the velocity field
+      reg_spline_getFlowFieldFromVelocityGrid(velocityFieldGrid[d],
+                                              flowField);
+      // Scale the flow field. Only the first field updates its number of steps
+      affineOnly[d]=reg_defField_scaleFlowField(flowField,
+                                                deformationFieldImage[d],
+                                                d==0?updateStepNumber:false,
+                                                &squaringNumber[d]);
+      velocityFieldGrid[d]->intent_p2=flowField->intent_p2;
+      // The number of steps is copied over to the second transformation
+      if(d==0)
+         velocityFieldGrid[1]->intent_p2=velocityFieldGrid[0]->intent_p2;
+   }
+
+   // Both deformation fields are squared together, the flow fields and the
+   // deformation fields being alternatively used as input and output
+   nifti_image *currentField[2]={flowFieldImage[0], flowFieldImage[1]};
+   nifti_image *squaredField[2]={deformationFieldImage[0], deformationFieldImage[1]};
+   for(unsigned short i=0; i<squaringNumber[0]; ++i)
+   {
+      reg_defField_square(currentField, squaredField, 2);
+      std::swap(currentField[0], squaredField[0]);
+      std::swap(currentField[1], squaredField[1]);
+#ifndef NDEBUG
+      char text[255];
+      sprintf(text, "Squaring (composition) step %u/%u", i+1, squaringNumber[0]);
+      reg_print_msg_debug(text);
+#endif
+   }
+   for(int d=0; d<2; ++d)
+   {
+      // The squared deformation field is copied over if required
+      if(currentField[d]!=deformationFieldImage[d])
+         memcpy(deformationFieldImage[d]->data, currentField[d]->data,
+                deformationFieldImage[d]->nvox*deformationFieldImage[d]->nbyper);
+      reg_defField_restoreAffineComponents(flowFieldImage[d],
+                                           deformationFieldImage[d],
+                                           affineOnly[d]);
+   }
+}
+/* *************************************************************** */
 /* *************************************************************** */
 void reg_spline_getIntermediateDefFieldFromVelGrid(nifti_image *velocityFieldGrid,
                                                    nifti_image **deformationFieldImage)
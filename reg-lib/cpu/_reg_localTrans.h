@@ -69,6 +69,25 @@ void reg_spline_getDeformationField(nifti_image *controlPointGridImage,
                                     bool bspline = true,
                                     bool force_no_lut = false);
 /* *************************************************************** */
+/** @brief Compute the deformation field over a box of the reference space
+ * from a cubic spline control point grid. The box starts at regionStart and
+ * has the dimension of the deformation field image, which must share the
+ * voxel spacing of the reference image. The function is not multi-threaded
+ * and can thus be called concurrently on different boxes.
+ * @param controlPointGridImage Control point grid that contains the deformation
+ * parametrisation. Grids with an affine component are not supported.
+ * @param deformationField Output image of the box size
+ * @param mask Mask array of the box size. Any voxel with a positive value is included
+ * @param regionStart Index of the first box voxel in the reference image
+ * @param bspline A cubic B-Spline scheme is used if the value is set to true
+ */
+extern "C++"
+void reg_spline_getDeformationFieldRegion(nifti_image *controlPointGridImage,
+                                          nifti_image *deformationField,
+                                          int *mask,
+                                          int *regionStart,
+                                          bool bspline = true);
+/* *************************************************************** */
 /** @brief Upsample an image from voxel space to node space using
  * millimiter correspendences.
  * @param nodeImage This image is a coarse representation of the
@@ -139,19 +158,31 @@ void reg_defField_compose(nifti_image *deformationField,
                           nifti_image *dfToUpdate,
                           int *mask);
 /* *************************************************************** */
-/** @brief Compute the inverse of a deformation field
- * @author Marcel van Herk (CMIC / NKI / AVL)
+/** @brief Compute the inverse of a deformation field. Each output position
+ * is found by the fixed-point iteration u^-1 = -u(x+u^-1) on the displacement,
+ * warm started from subsampled output grids. The simplex search of
+ * Marcel van Herk (CMIC / NKI / AVL) is used where the iteration stagnates.
  * @param inputDeformationField Image that contains the deformation
  * field to invert.
  * @param outputDeformationField Image that will contains the inverse
  * of the input deformation field
- * @param tolerance Tolerance value for the optimisation. Set to nan
- * for the default value.
+ * @param tolerance Tolerance, in mm, on the distance between a position and
+ * the transformation of its inverse. Set to nan for the default value.
+ * @param maxIterationNumber Maximal number of fixed-point iterations per
+ * voxel and resolution level
+ * @param useOutputAsInitialisation The positions stored in the output field,
+ * for example an inverse computed at a previous level, are used as starting
+ * point instead of the subsampled grids
+ * @param inverseError If not NULL, receives the mean and maximal distance,
+ * in mm, between the output positions and the transformation of their inverse
  */
 extern "C++"
 void reg_defFieldInvert(nifti_image *inputDeformationField,
                         nifti_image *outputDeformationField,
-                        float tolerance);
+                        float tolerance,
+                        int maxIterationNumber = 100,
+                        bool useOutputAsInitialisation = false,
+                        double *inverseError = NULL);
 /* *************************************************************** */
 extern "C++"
 void reg_defField_getDeformationFieldFromFlowField(nifti_image *flowFieldImage,
@@ -171,6 +202,26 @@ void reg_spline_getDefFieldFromVelocityGrid(nifti_image *velocityFieldGrid,
                                             nifti_image *deformationFieldImage,
                                             bool updateStepNumber);
 /* *************************************************************** */
+/** @brief The deformation fields of two velocity grids, typically the
+ * forward and backward transformations, are computed at once. Both
+ * scaling-and-squaring integrations are performed in the same parallel
+ * loops and alternate between the deformation fields and the flow field
+ * buffers, so that no image is allocated.
+ * @param velocityFieldGrid Array of two images that contain velocity
+ * fields parametrised using a grid of control points
+ * @param deformationFieldImage Array of two deformation field images
+ * that will be filled using the exponentiation of the velocity fields
+ * @param flowFieldImage Array of two images with the same geometry and
+ * type as the deformation fields, used as work buffers
+ * @param updateStepNumber The number of squaring steps of the first grid
+ * is updated if true. It is then always copied to the second grid
+ */
+extern "C++"
+void reg_spline_getDefFieldsFromVelocityGrids(nifti_image **velocityFieldGrid,
+                                              nifti_image **deformationFieldImage,
+                                              nifti_image **flowFieldImage,
+                                              bool updateStepNumber);
+/* *************************************************************** */
 extern "C++"
 void reg_spline_getIntermediateDefFieldFromVelGrid(nifti_image *velocityFieldGrid,
                                                    nifti_image **deformationFieldImage);
@@ -114,6 +114,105 @@ template void reg_matrixInvertMultiply<float>(float *, size_t, size_t *, float *
 template void reg_matrixInvertMultiply<double>(double *, size_t, size_t *, double *);
 /* *************************************************************** */
 /* *************************************************************** */
+/// Number of columns of the blocks of the Cholesky decomposition
+#define CHOLESKY_BLOCK_SIZE 64
+template<class T>
+bool reg_choleskyDecomposition(T *mat,
+                               size_t dim)
+{
+   // The decomposition is right-looking and processed by blocks of columns
+   // so that the trailing update reads rows with a unit stride
+   int matrixSize = (int)dim;
+   int i, j, k, blockStart, blockEnd;
+   T sum;
+   for(blockStart=0; blockStart<matrixSize; blockStart+=CHOLESKY_BLOCK_SIZE)
+   {
+      blockEnd = blockStart+CHOLESKY_BLOCK_SIZE<matrixSize ?
+               blockStart+CHOLESKY_BLOCK_SIZE : matrixSize;
+      // Decomposition of the diagonal block
+      for(j=blockStart; j<blockEnd; ++j)
+      {
+         sum = mat[(size_t)j*dim+j];
+         for(k=blockStart; k<j; ++k)
+            sum -= reg_pow2(mat[(size_t)j*dim+k]);
+         if(!(sum>0))
+            return false;
+         mat[(size_t)j*dim+j] = sqrt(sum);
+         for(i=j+1; i<blockEnd; ++i)
+         {
+            sum = mat[(size_t)i*dim+j];
+            for(k=blockStart; k<j; ++k)
+               sum -= mat[(size_t)i*dim+k]*mat[(size_t)j*dim+k];
+            mat[(size_t)i*dim+j] = sum/mat[(size_t)j*dim+j];
+         }
+      }
+      // Columns of the block below the diagonal block
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(mat, dim, matrixSize, blockStart, blockEnd) \
+   private(i, j, k, sum)
+#endif
+      for(i=blockEnd; i<matrixSize; ++i)
+      {
+         for(j=blockStart; j<blockEnd; ++j)
+         {
+            sum = mat[(size_t)i*dim+j];
+            for(k=blockStart; k<j; ++k)
+               sum -= mat[(size_t)i*dim+k]*mat[(size_t)j*dim+k];
+            mat[(size_t)i*dim+j] = sum/mat[(size_t)j*dim+j];
+         }
+      }
+      // Update of the trailing lower triangle
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) schedule(dynamic) \
+   shared(mat, dim, matrixSize, blockStart, blockEnd) \
+   private(i, j, k, sum)
+#endif
+      for(i=blockEnd; i<matrixSize; ++i)
+      {
+         T *rowI = &mat[(size_t)i*dim];
+         for(j=blockEnd; j<=i; ++j)
+         {
+            T *rowJ = &mat[(size_t)j*dim];
+            sum = 0;
+            for(k=blockStart; k<blockEnd; ++k)
+               sum += rowI[k]*rowJ[k];
+            rowI[j] -= sum;
+         }
+      }
+   }
+   return true;
+}
+template bool reg_choleskyDecomposition<float>(float *, size_t);
+template bool reg_choleskyDecomposition<double>(double *, size_t);
+/* *************************************************************** */
+/* *************************************************************** */
+template<class T>
+void reg_choleskySolve(T *mat,
+                       size_t dim,
+                       T *vec)
+{
+   // Forward substitution with the lower triangle
+   for(size_t i=0; i<dim; ++i)
+   {
+      T sum = vec[i];
+      for(size_t k=0; k<i; ++k)
+         sum -= mat[i*dim+k]*vec[k];
+      vec[i] = sum/mat[i*dim+i];
+   }
+   // Backward substitution with its transpose
+   for(int i=(int)dim-1; i>-1; --i)
+   {
+      T sum = vec[i];
+      for(size_t k=i+1; k<dim; ++k)
+         sum -= mat[k*dim+i]*vec[k];
+      vec[i] = sum/mat[(size_t)i*dim+i];
+   }
+}
+template void reg_choleskySolve<float>(float *, size_t, float *);
+template void reg_choleskySolve<double>(double *, size_t, double *);
+/* *************************************************************** */
+/* *************************************************************** */
 template<class T>
 void reg_matrixMultiply(T *mat1,
                         T *mat2,
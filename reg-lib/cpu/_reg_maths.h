@@ -136,6 +136,21 @@ void reg_matrixInvertMultiply(T *mat,
                               size_t *index,
                               T *vec);
 /* *************************************************************** */
+/** @brief Cholesky decomposition of a symmetric positive definite matrix.
+ * The lower triangle of the row-major matrix is overwritten by the
+ * decomposition, the upper triangle is not used.
+ * @return false if the matrix is not positive definite
+ */
+extern "C++" template <class T>
+bool reg_choleskyDecomposition(T *mat,
+                               size_t dim);
+/* *************************************************************** */
+/// @brief Solve in place a linear system from its Cholesky decomposition
+extern "C++" template <class T>
+void reg_choleskySolve(T *mat,
+                       size_t dim,
+                       T *vec);
+/* *************************************************************** */
 /* *************************************************************** */
 /* *************************************************************** */
 /* *************************************************************** */
@@ -65,8 +65,81 @@ public:
          reg_exit();
       }
    }
-   /// @brief Here
+   /// @brief Store the information required to evaluate the measure
+   /// over a sub-region of the reference space, see GetLocalSimilarityMeasureValue.
+   /// The current warped floating image is used as baseline
+   virtual void InitialiseLocalSimilarityMeasure() {}
+   /// @brief Returns the measure value that would be obtained if the warped
+   /// floating image values in a box were replaced by the values of the
+   /// specified local image. The box starts at regionStart and has the
+   /// dimension of the local image. The default implementation swaps the values
+   /// and computes the full measure, it can thus not be called concurrently.
+   /// Measure classes can override it to only consider the modified region.
+   virtual double GetLocalSimilarityMeasureValue(nifti_image *localWarpedImage,
+                                                 int *regionStart)
+   {
+      this->SwapLocalWarpedValues(localWarpedImage, regionStart);
+      double measure=this->GetSimilarityMeasureValue();
+      this->SwapLocalWarpedValues(localWarpedImage, regionStart);
+      return measure;
+   }
+   /// @brief Returns true if GetLocalSimilarityMeasureValue does not modify
+   /// the warped image and can thus be called by several threads
+   virtual bool IsLocalSimilarityMeasureConcurrent()
+   {
+      return false;
+   }
+   /// @brief Returns true if the forward measure and its voxel-based gradient
+   /// can be computed from tiles of the warped floating image, see
+   /// AccumulateTileSimilarityMeasure
+   virtual bool IsTileSimilarityMeasureSupported()
+   {
+      return false;
+   }
+   /// @brief Reset the statistics accumulated over the tiles. Up to
+   /// threadNumber tile accumulations can then be run concurrently
+   virtual void InitialiseTileSimilarityMeasure(int threadNumber) {}
+   /// @brief Add the contribution of a tile of the warped floating image to
+   /// the measure statistics. The tile starts at regionStart and has the
+   /// dimension of the local image. Concurrent calls must use distinct thread
+   /// indices
+   virtual void AccumulateTileSimilarityMeasure(nifti_image *localWarpedImage,
+                                                int *regionStart,
+                                                int threadIndex) {}
+   /// @brief Returns the measure value from the statistics accumulated over
+   /// all tiles and stores what is required to compute its gradient
+   virtual double GetTileSimilarityMeasureValue()
+   {
+      return 0.;
+   }
+   /// @brief Add the voxel-based measure gradient of a tile to the forward
+   /// voxel-based gradient image. The local warped gradient image holds the
+   /// spatial gradient of the specified time point. GetTileSimilarityMeasureValue
+   /// has to be called first. Tiles can be processed concurrently
+   virtual void GetTileVoxelBasedSimilarityMeasureGradient(nifti_image *localWarpedImage,
+                                                           nifti_image *localWarpedGradient,
+                                                           int *regionStart,
+                                                           int current_timepoint) {}
+   /// @brief Compute the measure of similarity between a block of the reference
+   /// image centred on every control point and the same block of the warped
+   /// floating image displaced by every discrete label. The values are stored
+   /// with the label as fastest dimension, higher values being better
    virtual void GetDiscretisedValue(nifti_image *, float *, int , int) {}
+   /// @brief Same as GetDiscretisedValue but the values of every control point
+   /// are quantised on 16 bits: value = nodeOffset[node] + nodeScale[node] *
+   /// quantisedValue[node*labelNumber+label]. No full precision cost volume
+   /// is allocated
+   virtual void GetQuantisedDiscretisedValue(nifti_image *,
+                                             unsigned short *,
+                                             float *,
+                                             float *,
+                                             int,
+                                             int)
+   {
+      reg_print_fct_error("reg_measure::GetQuantisedDiscretisedValue");
+      reg_print_msg_error("The discretised values are not implemented for this measure");
+      reg_exit();
+   }
    void SetTimepointWeight(int timepoint, double weight)
    {
       this->timePointWeight[timepoint]=weight;
@@ -102,6 +175,33 @@ protected:
 
    double timePointWeight[255];
    int referenceTimePoint;
+   /// @brief Swap the values of a box of the warped floating image with the
+   /// values of a local image of the box size
+   void SwapLocalWarpedValues(nifti_image *localWarpedImage,
+                              int *regionStart)
+   {
+      nifti_image *warped=this->warpedFloatingImagePointer;
+      size_t lineSize=(size_t)localWarpedImage->nx*warped->nbyper;
+      char *localPtr=static_cast<char *>(localWarpedImage->data);
+      char *buffer=(char *)malloc(lineSize);
+      for(int t=0; t<localWarpedImage->nt; ++t)
+      {
+         for(int z=0; z<localWarpedImage->nz; ++z)
+         {
+            for(int y=0; y<localWarpedImage->ny; ++y)
+            {
+               size_t index=(((size_t)t*warped->nz+z+regionStart[2])*warped->ny+
+                     y+regionStart[1])*warped->nx+regionStart[0];
+               char *warPtr=&static_cast<char *>(warped->data)[index*warped->nbyper];
+               memcpy(buffer, warPtr, lineSize);
+               memcpy(warPtr, localPtr, lineSize);
+               memcpy(localPtr, buffer, lineSize);
+               localPtr+=lineSize;
+            }
+         }
+      }
+      free(buffer);
+   }
    /// @brief Measure class constructor
    reg_measure()
    {
@@ -115,4 +215,91 @@ protected:
 };
 /* \/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/ */
 /* \/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/ */
+/** @brief Replace the undefined (NaN) discretised values of a control point
+ * by the value of the closest defined label. All values are set to zero if
+ * none is defined
+ * @param nodeValue Discretised values of the control point
+ * @param label_1D_number Number of labels along each axis
+ */
+inline void reg_discretisedValue_fillUndefined(float *nodeValue,
+                                               int label_1D_number)
+{
+   const int label_nD_number = label_1D_number*label_1D_number*label_1D_number;
+   int definedValueNumber=0;
+   for(int label=0; label<label_nD_number;++label){
+      if(nodeValue[label]==nodeValue[label])
+         ++definedValueNumber;
+   }
+   if(definedValueNumber==0){
+      for(int label=0; label<label_nD_number;++label){
+         nodeValue[label]=0;
+      }
+   }
+   else if(definedValueNumber<label_nD_number){
+      int label=0;
+      // Loop over all labels
+      int label_x, label2_x, label_y, label2_y, label_z, label2_z, label2;
+      float min_distance, current_distance;
+      for(label_z=0; label_z<label_1D_number;++label_z){
+         for(label_y=0; label_y<label_1D_number;++label_y){
+            for(label_x=0; label_x<label_1D_number;++label_x){
+               // check if the current label is defined
+               if(nodeValue[label]!=nodeValue[label]){
+                  label2=0;
+                  min_distance=std::numeric_limits<float>::max();
+                  // Loop again over all label to detect the defined values
+                  for(label2_z=0; label2_z<label_1D_number;++label2_z){
+                     for(label2_y=0; label2_y<label_1D_number;++label2_y){
+                        for(label2_x=0; label2_x<label_1D_number;++label2_x){
+                           // Check if the value is defined
+                           if(nodeValue[label2]==nodeValue[label2]){
+                              // compute the distance between label and label2
+                              current_distance = reg_pow2(label_x-label2_x)+reg_pow2(label_y-label2_y)+reg_pow2(label_z-label2_z);
+                              if(current_distance<min_distance){
+                                 min_distance=current_distance;
+                                 nodeValue[label] = nodeValue[label2];
+                              }
+                           } // Check if label2 is defined
+                           ++label2;
+                        } // x
+                     } // y
+                  } // z
+               } // check if undefined label
+               ++label;
+            } //x
+         } // y
+      } // z
+   } // node with undefined label
+}
+/* *************************************************************** */
+/** @brief Quantise the discretised values of a control point on 16 bits
+ * between their minimal and maximal values
+ * @param nodeValue Discretised values of the control point, all defined
+ * @param label_nD_number Number of labels
+ * @param quantisedValue Output quantised values
+ * @param nodeOffset Output value of the quantised value 0
+ * @param nodeScale Output value difference between consecutive quantised values
+ */
+inline void reg_discretisedValue_quantise(float *nodeValue,
+                                          int label_nD_number,
+                                          unsigned short *quantisedValue,
+                                          float *nodeOffset,
+                                          float *nodeScale)
+{
+   float minValue=nodeValue[0];
+   float maxValue=nodeValue[0];
+   for(int label=1; label<label_nD_number;++label){
+      minValue=nodeValue[label]<minValue?nodeValue[label]:minValue;
+      maxValue=nodeValue[label]>maxValue?nodeValue[label]:maxValue;
+   }
+   *nodeOffset=minValue;
+   *nodeScale=(maxValue-minValue)/65535.f;
+   const float ratio=maxValue>minValue?65535.f/(maxValue-minValue):0.f;
+   for(int label=0; label<label_nD_number;++label){
+      quantisedValue[label]=static_cast<unsigned short>
+            ((nodeValue[label]-minValue)*ratio+0.5f);
+   }
+}
+/* *************************************************************** */
+/* *************************************************************** */
 #endif // _REG_MEASURE_H
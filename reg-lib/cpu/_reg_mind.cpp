@@ -11,165 +11,326 @@
 
 #include "_reg_mind.h"
 
+/// Number of consecutive columns that are smoothed together along y and z
+#define MIND_COLUMN_NUMBER 64
+
 /* *************************************************************** */
+/// @brief Coefficients of the Gaussian kernel used to smooth the squared
+/// differences. The standard deviation is half a voxel, which gives a radius
+/// of one voxel, and the values are the ones of reg_tools_kernelConvolution
+template <class BTYPE>
+void GetMINDKernel(BTYPE &centre, BTYPE &side)
+{
+   double sigma = 0.5;
+   // 2.506... = sqrt(2*pi)
+   centre = static_cast<BTYPE>(exp(-0. / (2.0*reg_pow2(sigma))) / (sigma*2.506628274631));
+   side = static_cast<BTYPE>(exp(-1. / (2.0*reg_pow2(sigma))) / (sigma*2.506628274631));
+}
+/* *************************************************************** */
+/// @brief Convolve in place the lines along the specified axis with the
+/// three-tap kernel. The values outside of the image are null and the sums
+/// are accumulated as in reg_tools_convolveLines
+template <class DTYPE, class BTYPE>
+void FilterMINDLines(DTYPE *dataPtr,
+                     int *dim,
+                     int axis,
+                     BTYPE centre,
+                     BTYPE side)
+{
+   int length = dim[axis];
+   if(length<2) return;
+   int block, i, c, columnNumber;
+   size_t index;
+   BTYPE previous[MIND_COLUMN_NUMBER], current, next, sum;
+   if(axis==0)
+   {
+      // Every line along x is processed at once
+      int lineNumber = dim[1]*dim[2];
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(dataPtr, dim, length, lineNumber, centre, side) \
+   private(block, i, index, previous, current, next, sum)
+#endif
+      for(block=0; block<lineNumber; ++block)
+      {
+         index = (size_t)block*length;
+         previous[0] = 0;
+         current = static_cast<BTYPE>(dataPtr[index]);
+         for(i=0; i<length; ++i, ++index)
+         {
+            next = i+1<length ? static_cast<BTYPE>(dataPtr[index+1]) : 0;
+            sum = centre*current;
+            sum += side*(previous[0]+next);
+            dataPtr[index] = static_cast<DTYPE>(sum);
+            previous[0] = current;
+            current = next;
+         }
+      }
+      return;
+   }
+   // The lines along y and z are processed by chunks of consecutive columns
+   // so that every row is read with a unit stride
+   size_t stride = axis==1 ? (size_t)dim[0] : (size_t)dim[0]*dim[1];
+   int outerNumber = axis==1 ? dim[2] : dim[1];
+   size_t outerOffset = axis==1 ? (size_t)dim[0]*dim[1] : (size_t)dim[0];
+   int chunkNumber = (dim[0]+MIND_COLUMN_NUMBER-1)/MIND_COLUMN_NUMBER;
+   int blockNumber = outerNumber*chunkNumber;
+   DTYPE *rowPtr, *nextRowPtr;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(dataPtr, dim, length, stride, outerOffset, chunkNumber, blockNumber, \
+   centre, side) \
+   private(block, i, c, index, columnNumber, previous, current, next, sum, \
+   rowPtr, nextRowPtr)
+#endif
+   for(block=0; block<blockNumber; ++block)
+   {
+      index = (size_t)(block/chunkNumber)*outerOffset +
+            (size_t)(block%chunkNumber)*MIND_COLUMN_NUMBER;
+      columnNumber = dim[0]-(block%chunkNumber)*MIND_COLUMN_NUMBER;
+      if(columnNumber>MIND_COLUMN_NUMBER) columnNumber=MIND_COLUMN_NUMBER;
+      for(c=0; c<columnNumber; ++c)
+         previous[c] = 0;
+      for(i=0; i<length; ++i)
+      {
+         rowPtr = &dataPtr[index+i*stride];
+         nextRowPtr = i+1<length ? &rowPtr[stride] : NULL;
+         for(c=0; c<columnNumber; ++c)
+         {
+            current = static_cast<BTYPE>(rowPtr[c]);
+            next = nextRowPtr!=NULL ? static_cast<BTYPE>(nextRowPtr[c]) : 0;
+            sum = centre*current;
+            sum += side*(previous[c]+next);
+            rowPtr[c] = static_cast<DTYPE>(sum);
+            previous[c] = current;
+         }
+      }
+   }
+}
+/* *************************************************************** */
+/// @brief Flag the voxels that are used by the descriptors and smooth the
+/// resulting density. The density only depends on the mask, it is thus
+/// shared by all the descriptor channels
 template <class DTYPE>
-void ShiftImage(nifti_image* inputImgPtr,
-                nifti_image* shiftedImgPtr,
-                int *maskPtr,
-                int tx,
-                int ty,
-                int tz)
+void GetMINDDensity(DTYPE *inputPtr,
+                    int *maskPtr,
+                    bool *validPtr,
+                    float *densityPtr,
+                    int *dim)
 {
-   DTYPE* inputData = static_cast<DTYPE*> (inputImgPtr->data);
-   DTYPE* shiftImageData = static_cast<DTYPE*> (shiftedImgPtr->data);
-
-   int currentIndex;
-   int shiftedIndex;
-
-   int x, y, z, old_x, old_y, old_z;
-
+#ifdef WIN32
+   long voxelNumber = (long)dim[0]*dim[1]*dim[2];
+   long voxelIndex;
+#else
+   size_t voxelNumber = (size_t)dim[0]*dim[1]*dim[2];
+   size_t voxelIndex;
+#endif
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(inputPtr, maskPtr, validPtr, densityPtr, voxelNumber) \
+   private(voxelIndex)
+#endif
+   for(voxelIndex=0; voxelIndex<voxelNumber; ++voxelIndex)
+   {
+      validPtr[voxelIndex] = maskPtr[voxelIndex]>-1 &&
+            inputPtr[voxelIndex]==inputPtr[voxelIndex];
+      densityPtr[voxelIndex] = validPtr[voxelIndex] ? 1.f : 0.f;
+   }
+   DTYPE centre, side;
+   GetMINDKernel<DTYPE>(centre, side);
+   for(int n=0; n<3; ++n)
+      FilterMINDLines<float,DTYPE>(densityPtr, dim, n, centre, side);
+}
+/* *************************************************************** */
+/// @brief Compute the smoothed squared difference between the input image and
+/// its shifted version. The shift, the difference and the smoothing along x
+/// are done in a single pass, the values are normalised by the density and
+/// added to the mean image when meanPtr is not NULL
+template <class DTYPE>
+void GetMINDSmoothedDifference(DTYPE *inputPtr,
+                               bool *validPtr,
+                               float *densityPtr,
+                               DTYPE *outputPtr,
+                               DTYPE *meanPtr,
+                               int *dim,
+                               int tx,
+                               int ty,
+                               int tz)
+{
+   DTYPE centre, side;
+   GetMINDKernel<DTYPE>(centre, side);
+   int lineNumber = dim[1]*dim[2];
+   int line, x, old_x, old_y, old_z;
+   bool validLine;
+   size_t lineIndex, shiftedIndex;
+   DTYPE previous, current, next, shiftedValue, diff, sum;
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
-   shared(inputData, shiftImageData, shiftedImgPtr, inputImgPtr, \
-   maskPtr, tx, ty, tz) \
-   private(x, y, z, old_x, old_y, old_z, shiftedIndex, \
-   currentIndex)
+   shared(inputPtr, validPtr, outputPtr, dim, lineNumber, tx, ty, tz, \
+   centre, side) \
+   private(line, x, old_x, old_y, old_z, validLine, lineIndex, shiftedIndex, \
+   previous, current, next, shiftedValue, diff, sum)
 #endif
-   for (z=0;z<shiftedImgPtr->nz;z++) {
-      currentIndex = z * shiftedImgPtr->nx * shiftedImgPtr->ny;
-      old_z = z-tz;
-      for (y=0;y<shiftedImgPtr->ny;y++) {
-         old_y = y-ty;
-         for (x=0;x<shiftedImgPtr->nx;x++) {
-            old_x = x-tx;
-            if(old_x>-1 && old_x<inputImgPtr->nx &&
-                  old_y>-1 && old_y<inputImgPtr->ny &&
-                  old_z>-1 && old_z<inputImgPtr->nz){
-               shiftedIndex = (old_z*inputImgPtr->ny+old_y)*inputImgPtr->nx+old_x;
-               if(maskPtr[shiftedIndex]>-1) {
-                  shiftImageData[currentIndex]=inputData[shiftedIndex];
-               } // mask is not defined
-               else{
-                  //shiftImageData[currentIndex]=std::numeric_limits<DTYPE>::quiet_NaN();
-                   shiftImageData[currentIndex]=0.0;
-               }
-            } // outside of the image
-            else{
-               //shiftImageData[currentIndex]=std::numeric_limits<DTYPE>::quiet_NaN();
-                shiftImageData[currentIndex]=0.0;
+   for(line=0; line<lineNumber; ++line)
+   {
+      lineIndex = (size_t)line*dim[0];
+      old_y = line%dim[1]-ty;
+      old_z = line/dim[1]-tz;
+      validLine = old_y>-1 && old_y<dim[1] && old_z>-1 && old_z<dim[2];
+      shiftedIndex = validLine ? ((size_t)old_z*dim[1]+old_y)*dim[0] : 0;
+      previous = 0;
+      current = 0;
+      // The squared differences are computed one voxel ahead of the
+      // convolution. They are null where the density is null
+      for(x=-1; x<dim[0]; ++x)
+      {
+         next = 0;
+         if(x+1<dim[0] && validPtr[lineIndex+x+1])
+         {
+            old_x = x+1-tx;
+            shiftedValue = 0;
+            if(validLine && old_x>-1 && old_x<dim[0] &&
+                  validPtr[shiftedIndex+old_x])
+               shiftedValue = inputPtr[shiftedIndex+old_x];
+            diff = static_cast<DTYPE>((double)inputPtr[lineIndex+x+1] -
+                                      (double)shiftedValue);
+            next = static_cast<DTYPE>((double)diff * (double)diff);
+         }
+         if(x>-1)
+         {
+            if(dim[0]>1)
+            {
+               sum = centre*current;
+               sum += side*(previous+next);
+               outputPtr[lineIndex+x] = sum;
             }
-            currentIndex++;
+            else outputPtr[lineIndex+x] = current;
          }
+         previous = current;
+         current = next;
       }
    }
+   // Smoothing along the y and z axes
+   FilterMINDLines<DTYPE,DTYPE>(outputPtr, dim, 1, centre, side);
+   FilterMINDLines<DTYPE,DTYPE>(outputPtr, dim, 2, centre, side);
+   // Normalisation by the density
+#ifdef WIN32
+   long voxelNumber = (long)dim[0]*dim[1]*dim[2];
+   long voxelIndex;
+#else
+   size_t voxelNumber = (size_t)dim[0]*dim[1]*dim[2];
+   size_t voxelIndex;
+#endif
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(validPtr, densityPtr, outputPtr, meanPtr, voxelNumber) \
+   private(voxelIndex)
+#endif
+   for(voxelIndex=0; voxelIndex<voxelNumber; ++voxelIndex)
+   {
+      if(validPtr[voxelIndex])
+         outputPtr[voxelIndex] = static_cast<DTYPE>((float)outputPtr[voxelIndex] /
+                                                    densityPtr[voxelIndex]);
+      else outputPtr[voxelIndex] = std::numeric_limits<DTYPE>::quiet_NaN();
+      if(meanPtr!=NULL)
+         meanPtr[voxelIndex] = static_cast<DTYPE>((double)meanPtr[voxelIndex] +
+                                                  (double)outputPtr[voxelIndex]);
+   }
 }
 /* *************************************************************** */
+/// @brief Normalise the descriptors of every voxel of the mask by their
+/// mean and their maximal value
 template <class DTYPE>
-void GetMINDImageDesciptor_core(nifti_image* inputImage,
-                                nifti_image* MINDImage,
-                                int *maskPtr,
-                                int descriptorOffset,
-                                int current_timepoint)
+void NormaliseMINDDescriptor(DTYPE *descriptorPtr,
+                             DTYPE *meanPtr,
+                             int *maskPtr,
+                             int lengthDescriptor,
+                             size_t voxelNumber)
 {
 #ifdef WIN32
-   const long voxelNumber = (long)inputImage->nx *
-         inputImage->ny * inputImage->nz;
    long voxelIndex;
+   long voxelNumber_l = (long)voxelNumber;
 #else
-   const size_t voxelNumber = (size_t)inputImage->nx *
-         inputImage->ny * inputImage->nz;
    size_t voxelIndex;
+   size_t voxelNumber_l = voxelNumber;
 #endif
-
-   // Create a pointer to the descriptor image
-   DTYPE* MINDImgDataPtr = static_cast<DTYPE *>(MINDImage->data);
-
-   // Allocate an image to store the current timepoint reference image
-   nifti_image *currentInputImage = nifti_copy_nim_info(inputImage);
-   currentInputImage->ndim=currentInputImage->dim[0]=inputImage->nz>1?3:2;
-   currentInputImage->nt=currentInputImage->dim[4]=1;
-   currentInputImage->nvox=voxelNumber;
-   DTYPE *inputImagePtr = static_cast<DTYPE *>(inputImage->data);
-   currentInputImage->data = static_cast<void *>(&inputImagePtr[current_timepoint*voxelNumber]);
-
-   // Allocate an image to store the mean image
-   nifti_image *meanImage = nifti_copy_nim_info(currentInputImage);
-   meanImage->data=(void *)calloc(meanImage->nvox,meanImage->nbyper);
-   DTYPE* meanImgDataPtr = static_cast<DTYPE *>(meanImage->data);
-
-   // Allocate an image to store the shifted image
-   nifti_image *shiftedImage = nifti_copy_nim_info(currentInputImage);
-   shiftedImage->data = (void *)malloc(shiftedImage->nvox*shiftedImage->nbyper);
-
-   // Allocation of the difference image
-   nifti_image *diff_image = nifti_copy_nim_info(currentInputImage);
-   diff_image->data = (void *) malloc(diff_image->nvox*diff_image->nbyper);
-
-   // Define the sigma for the convolution
-   float sigma = -0.5;// negative value denotes voxel width
-
-   //2D version
-   int samplingNbr = (currentInputImage->nz > 1) ? 6 : 4;
-   int RSampling3D_x[6] = {-descriptorOffset, descriptorOffset,  0, 0,  0, 0};
-   int RSampling3D_y[6] = {0,  0, -descriptorOffset, descriptorOffset,  0, 0};
-   int RSampling3D_z[6] = {0,  0,  0, 0, -descriptorOffset, descriptorOffset};
-
-   for(int i=0;i<samplingNbr;i++) {
-      ShiftImage<DTYPE>(currentInputImage, shiftedImage, maskPtr,
-                        RSampling3D_x[i], RSampling3D_y[i], RSampling3D_z[i]);
-      reg_tools_substractImageToImage(currentInputImage, shiftedImage, diff_image);
-      reg_tools_multiplyImageToImage(diff_image, diff_image, diff_image);
-      reg_tools_kernelConvolution(diff_image, &sigma, GAUSSIAN_KERNEL, maskPtr);
-      reg_tools_addImageToImage(meanImage, diff_image, meanImage);
-
-      // Store the current descriptor
-      unsigned int index = i * diff_image->nvox;
-      memcpy(&MINDImgDataPtr[index], diff_image->data,
-             diff_image->nbyper * diff_image->nvox);
-   }
-   // Compute the mean over the number of sample
-   reg_tools_divideValueToImage(meanImage, meanImage, samplingNbr);
-
-   // Compute the MIND desccriptor
-   int mindIndex;
+   size_t mindIndex;
    DTYPE meanValue, max_desc, descValue;
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
-   shared(samplingNbr, maskPtr, meanImgDataPtr, \
-   MINDImgDataPtr) \
+   shared(lengthDescriptor, maskPtr, meanPtr, descriptorPtr, voxelNumber, \
+   voxelNumber_l) \
    private(voxelIndex, meanValue, max_desc, descValue, mindIndex)
 #endif
-   for(voxelIndex=0;voxelIndex<voxelNumber;voxelIndex++) {
+   for(voxelIndex=0;voxelIndex<voxelNumber_l;voxelIndex++) {
 
       if(maskPtr[voxelIndex]>-1){
          // Get the mean value for the current voxel
-         meanValue = meanImgDataPtr[voxelIndex];
+         meanValue = static_cast<DTYPE>((double)meanPtr[voxelIndex]/(double)lengthDescriptor);
          if(meanValue == 0) {
             meanValue = std::numeric_limits<DTYPE>::epsilon();
          }
          max_desc = 0;
          mindIndex=voxelIndex;
-         for(int t=0;t<samplingNbr;t++) {
-            descValue = (DTYPE)exp(-MINDImgDataPtr[mindIndex]/meanValue);
-            MINDImgDataPtr[mindIndex] = descValue;
+         for(int t=0;t<lengthDescriptor;t++) {
+            descValue = (DTYPE)exp(-descriptorPtr[mindIndex]/meanValue);
+            descriptorPtr[mindIndex] = descValue;
             max_desc = (std::max)(max_desc, descValue);
             mindIndex+=voxelNumber;
          }
 
          mindIndex=voxelIndex;
-         for(int t=0;t<samplingNbr;t++) {
-            descValue = MINDImgDataPtr[mindIndex];
-            MINDImgDataPtr[mindIndex] = descValue/max_desc;
+         for(int t=0;t<lengthDescriptor;t++) {
+            descValue = descriptorPtr[mindIndex];
+            descriptorPtr[mindIndex] = descValue/max_desc;
             mindIndex+=voxelNumber;
          }
       } // mask
    } // voxIndex
+}
+/* *************************************************************** */
+template <class DTYPE>
+void GetMINDImageDesciptor_core(nifti_image* inputImage,
+                                nifti_image* MINDImage,
+                                int *maskPtr,
+                                int descriptorOffset,
+                                int current_timepoint)
+{
+   const size_t voxelNumber = (size_t)inputImage->nx *
+         inputImage->ny * inputImage->nz;
+   int dim[3] = {inputImage->nx, inputImage->ny, inputImage->nz};
+
+   // Create a pointer to the descriptor image and to the current time point
+   DTYPE* MINDImgDataPtr = static_cast<DTYPE *>(MINDImage->data);
+   DTYPE *inputImagePtr = &static_cast<DTYPE *>(inputImage->data)[current_timepoint*voxelNumber];
+
+   // The density and the mean are shared by all the descriptor channels
+   bool *validPtr = (bool *)malloc(voxelNumber*sizeof(bool));
+   float *densityPtr = (float *)malloc(voxelNumber*sizeof(float));
+   DTYPE *meanImgDataPtr = (DTYPE *)calloc(voxelNumber, sizeof(DTYPE));
+   GetMINDDensity<DTYPE>(inputImagePtr, maskPtr, validPtr, densityPtr, dim);
+
+   //2D version
+   int samplingNbr = (inputImage->nz > 1) ? 6 : 4;
+   int RSampling3D_x[6] = {-descriptorOffset, descriptorOffset,  0, 0,  0, 0};
+   int RSampling3D_y[6] = {0,  0, -descriptorOffset, descriptorOffset,  0, 0};
+   int RSampling3D_z[6] = {0,  0,  0, 0, -descriptorOffset, descriptorOffset};
+
+   // The descriptor channels are directly computed in the descriptor image
+   for(int i=0;i<samplingNbr;i++) {
+      GetMINDSmoothedDifference<DTYPE>(inputImagePtr, validPtr, densityPtr,
+                                       &MINDImgDataPtr[i*voxelNumber],
+                                       meanImgDataPtr, dim,
+                                       RSampling3D_x[i], RSampling3D_y[i], RSampling3D_z[i]);
+   }
+
+   // Compute the MIND desccriptor
+   NormaliseMINDDescriptor<DTYPE>(MINDImgDataPtr, meanImgDataPtr, maskPtr,
+                                  samplingNbr, voxelNumber);
    // Mr Propre
-   nifti_image_free(diff_image);
-   nifti_image_free(shiftedImage);
-   nifti_image_free(meanImage);
-   currentInputImage->data=NULL;
-   nifti_image_free(currentInputImage);
+   free(validPtr);
+   free(densityPtr);
+   free(meanImgDataPtr);
 }
 /* *************************************************************** */
 void GetMINDImageDesciptor(nifti_image* inputImgPtr,
@@ -209,54 +370,24 @@ void GetMINDSSCImageDesciptor_core(nifti_image* inputImage,
                                    int descriptorOffset,
                                    int current_timepoint)
 {
-
-#ifdef WIN32
-   const long voxelNumber = (long)inputImage->nx *
-         inputImage->ny * inputImage->nz;
-   long voxelIndex;
-#else
    const size_t voxelNumber = (size_t)inputImage->nx *
          inputImage->ny * inputImage->nz;
-   size_t voxelIndex;
-#endif
+   int dim[3] = {inputImage->nx, inputImage->ny, inputImage->nz};
 
-   // Create a pointer to the descriptor image
+   // Create a pointer to the descriptor image and to the current time point
    DTYPE* MINDSSCImgDataPtr = static_cast<DTYPE *>(MINDSSCImage->data);
+   DTYPE *inputImagePtr = &static_cast<DTYPE *>(inputImage->data)[current_timepoint*voxelNumber];
 
-   // Allocate an image to store the current timepoint reference image
-   nifti_image *currentInputImage = nifti_copy_nim_info(inputImage);
-   currentInputImage->ndim=currentInputImage->dim[0]=inputImage->nz>1?3:2;
-   currentInputImage->nt=currentInputImage->dim[4]=1;
-   currentInputImage->nvox=voxelNumber;
-   DTYPE *inputImagePtr = static_cast<DTYPE *>(inputImage->data);
-   currentInputImage->data = static_cast<void *>(&inputImagePtr[current_timepoint*voxelNumber]);
-
-   // Allocate an image to store the mean image
-   nifti_image *mean_img = nifti_copy_nim_info(currentInputImage);
-   mean_img->data=(void *)calloc(mean_img->nvox,mean_img->nbyper);
-   DTYPE* meanImgDataPtr = static_cast<DTYPE *>(mean_img->data);
-
-   // Allocate an image to store the warped image
-   nifti_image *shiftedImage = nifti_copy_nim_info(currentInputImage);
-   shiftedImage->data = (void *)malloc(shiftedImage->nvox*shiftedImage->nbyper);
-
-   // Define the sigma for the convolution
-   float sigma = -0.5;// negative value denotes voxel width
-   //float sigma = -1.0;// negative value denotes voxel width
+   // The density and the mean are shared by all the descriptor channels
+   bool *validPtr = (bool *)malloc(voxelNumber*sizeof(bool));
+   float *densityPtr = (float *)malloc(voxelNumber*sizeof(float));
+   DTYPE *meanImgDataPtr = (DTYPE *)calloc(voxelNumber, sizeof(DTYPE));
+   DTYPE *diffImgDataPtr = (DTYPE *)malloc(voxelNumber*sizeof(DTYPE));
+   GetMINDDensity<DTYPE>(inputImagePtr, maskPtr, validPtr, densityPtr, dim);
 
    //2D version
-   int samplingNbr = (currentInputImage->nz > 1) ? 6 : 2;
-   int lengthDescriptor = (currentInputImage->nz > 1) ? 12 : 4;
-
-   // Allocation of the difference image
-   //std::vector<nifti_image *> vectNiftiImage;
-   //for(int i=0;i<samplingNbr;i++) {
-   nifti_image *diff_image = nifti_copy_nim_info(currentInputImage);
-   diff_image->data = (void *) malloc(diff_image->nvox*diff_image->nbyper);
-   int *mask_diff_image = (int *)calloc(diff_image->nvox, sizeof(int));
-
-   nifti_image *diff_imageShifted = nifti_copy_nim_info(currentInputImage);
-   diff_imageShifted->data = (void *) malloc(diff_imageShifted->nvox*diff_imageShifted->nbyper);
+   int samplingNbr = (inputImage->nz > 1) ? 6 : 2;
+   int lengthDescriptor = (inputImage->nz > 1) ? 12 : 4;
 
    int RSampling3D_x[6] = {+descriptorOffset,+descriptorOffset,-descriptorOffset,+0,+descriptorOffset,+0};
    int RSampling3D_y[6] = {+descriptorOffset,-descriptorOffset,+0,-descriptorOffset,+0,+descriptorOffset};
@@ -265,73 +396,64 @@ void GetMINDSSCImageDesciptor_core(nifti_image* inputImage,
    int tx[12]={-descriptorOffset,+0,-descriptorOffset,+0,+0,+descriptorOffset,+0,+0,+0,-descriptorOffset,+0,+0};
    int ty[12]={+0,-descriptorOffset,+0,+descriptorOffset,+0,+0,+0,+descriptorOffset,+0,+0,+0,-descriptorOffset};
    int tz[12]={+0,+0,+0,+0,-descriptorOffset,+0,-descriptorOffset,+0,-descriptorOffset,+0,-descriptorOffset,+0};
-   int compteurId = 0;
 
+   int lineNumber = dim[1]*dim[2];
+   int line, x, y, z, j, old_x, old_y, old_z, compteurId;
+   size_t index;
+   DTYPE shiftedValue, *descPtr;
    for(int i=0;i<samplingNbr;i++) {
-      ShiftImage<DTYPE>(currentInputImage, shiftedImage, maskPtr,
-                        RSampling3D_x[i], RSampling3D_y[i], RSampling3D_z[i]);
-      reg_tools_substractImageToImage(currentInputImage, shiftedImage, diff_image);
-      reg_tools_multiplyImageToImage(diff_image, diff_image, diff_image);
-      reg_tools_kernelConvolution(diff_image, &sigma, GAUSSIAN_KERNEL, maskPtr);
-
-      for(int j=0;j<2;j++){
-
-         ShiftImage<DTYPE>(diff_image, diff_imageShifted, mask_diff_image,
-                           tx[compteurId], ty[compteurId], tz[compteurId]);
-
-         reg_tools_addImageToImage(mean_img, diff_imageShifted, mean_img);
-         // Store the current descriptor
-         unsigned int index = compteurId * diff_imageShifted->nvox;
-         memcpy(&MINDSSCImgDataPtr[index], diff_imageShifted->data,
-                diff_imageShifted->nbyper * diff_imageShifted->nvox);
-         compteurId++;
-      }
-   }
-   // Compute the mean over the number of sample
-   reg_tools_divideValueToImage(mean_img, mean_img, lengthDescriptor);
-
-   // Compute the MINDSSC desccriptor
-   int mindIndex;
-   DTYPE meanValue, max_desc, descValue;
+      GetMINDSmoothedDifference<DTYPE>(inputImagePtr, validPtr, densityPtr,
+                                       diffImgDataPtr, NULL, dim,
+                                       RSampling3D_x[i], RSampling3D_y[i], RSampling3D_z[i]);
+      // The two self-similarity channels are shifted copies of the smoothed
+      // difference, the mean is accumulated in the same pass
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
-   shared(lengthDescriptor, samplingNbr, maskPtr, meanImgDataPtr, \
-   MINDSSCImgDataPtr) \
-   private(voxelIndex, meanValue, max_desc, descValue, mindIndex)
+   shared(diffImgDataPtr, MINDSSCImgDataPtr, meanImgDataPtr, dim, lineNumber, \
+   voxelNumber, tx, ty, tz, i) \
+   private(line, x, y, z, j, old_x, old_y, old_z, compteurId, index, \
+   shiftedValue, descPtr)
 #endif
-   for(voxelIndex=0;voxelIndex<voxelNumber;voxelIndex++) {
-
-      if(maskPtr[voxelIndex]>-1){
-         // Get the mean value for the current voxel
-         meanValue = meanImgDataPtr[voxelIndex];
-         if(meanValue == 0) {
-            meanValue = std::numeric_limits<DTYPE>::epsilon();
+      for(line=0; line<lineNumber; ++line)
+      {
+         y = line%dim[1];
+         z = line/dim[1];
+         for(j=0;j<2;j++){
+            compteurId = 2*i+j;
+            descPtr = &MINDSSCImgDataPtr[compteurId*voxelNumber + (size_t)line*dim[0]];
+            old_y = y-ty[compteurId];
+            old_z = z-tz[compteurId];
+            index = ((size_t)old_z*dim[1]+old_y)*dim[0];
+            for(x=0; x<dim[0]; ++x)
+            {
+               old_x = x-tx[compteurId];
+               shiftedValue = 0;
+               if(old_x>-1 && old_x<dim[0] &&
+                     old_y>-1 && old_y<dim[1] &&
+                     old_z>-1 && old_z<dim[2])
+                  shiftedValue = diffImgDataPtr[index+old_x];
+               descPtr[x] = shiftedValue;
+            }
          }
-         max_desc = 0;
-         mindIndex=voxelIndex;
-         for(int t=0;t<lengthDescriptor;t++) {
-            descValue = (DTYPE)exp(-MINDSSCImgDataPtr[mindIndex]/meanValue);
-            MINDSSCImgDataPtr[mindIndex] = descValue;
-            max_desc = std::max(max_desc, descValue);
-            mindIndex+=voxelNumber;
+         for(x=0; x<dim[0]; ++x)
+         {
+            index = (size_t)line*dim[0]+x;
+            for(j=0;j<2;j++){
+               meanImgDataPtr[index] = static_cast<DTYPE>((double)meanImgDataPtr[index] +
+                                                          (double)MINDSSCImgDataPtr[(2*i+j)*voxelNumber+index]);
+            }
          }
+      }
+   }
 
-         mindIndex=voxelIndex;
-         for(int t=0;t<lengthDescriptor;t++) {
-            descValue = MINDSSCImgDataPtr[mindIndex];
-            MINDSSCImgDataPtr[mindIndex] = descValue/max_desc;
-            mindIndex+=voxelNumber;
-         }
-      } // mask
-   } // voxIndex
+   // Compute the MINDSSC desccriptor
+   NormaliseMINDDescriptor<DTYPE>(MINDSSCImgDataPtr, meanImgDataPtr, maskPtr,
+                                  lengthDescriptor, voxelNumber);
    // Mr Propre
-   nifti_image_free(diff_imageShifted);
-   free(mask_diff_image);
-   nifti_image_free(diff_image);
-   nifti_image_free(shiftedImage);
-   nifti_image_free(mean_img);
-   currentInputImage->data=NULL;
-   nifti_image_free(currentInputImage);
+   free(validPtr);
+   free(densityPtr);
+   free(meanImgDataPtr);
+   free(diffImgDataPtr);
 }
 /* *************************************************************** */
 void GetMINDSSCImageDesciptor(nifti_image* inputImgPtr,
@@ -364,6 +486,248 @@ void GetMINDSSCImageDesciptor(nifti_image* inputImgPtr,
    }
 }
 /* *************************************************************** */
+/// @brief Number of bits set in a packed descriptor
+inline int reg_mind_bitCount(uint64_t value)
+{
+#if defined (__POPCNT__)
+   return __builtin_popcountll(value);
+#else
+   value = value - ((value >> 1) & 0x5555555555555555ULL);
+   value = (value & 0x3333333333333333ULL) + ((value >> 2) & 0x3333333333333333ULL);
+   value = (value + (value >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+   return static_cast<int>((value * 0x0101010101010101ULL) >> 56);
+#endif
+}
+/* *************************************************************** */
+template <class DTYPE>
+void GetPackedMINDDescriptor_core(nifti_image *descriptorImage,
+                                  uint64_t *packedPtr)
+{
+#ifdef WIN32
+   long voxelNumber = (long)descriptorImage->nx *
+         descriptorImage->ny * descriptorImage->nz;
+   long voxelIndex;
+#else
+   size_t voxelNumber = (size_t)descriptorImage->nx *
+         descriptorImage->ny * descriptorImage->nz;
+   size_t voxelIndex;
+#endif
+   DTYPE *descriptorPtr = static_cast<DTYPE *>(descriptorImage->data);
+   int channelNumber = descriptorImage->nt;
+   int level;
+   uint64_t packedValue;
+   DTYPE descValue;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(descriptorPtr, packedPtr, voxelNumber, channelNumber) \
+   private(voxelIndex, level, packedValue, descValue)
+#endif
+   for(voxelIndex=0; voxelIndex<voxelNumber; ++voxelIndex)
+   {
+      packedValue = 0;
+      for(int t=0; t<channelNumber; ++t)
+      {
+         // The undefined values are considered as null, as in the block ssd
+         descValue = descriptorPtr[t*voxelNumber+voxelIndex];
+         level = 0;
+         if(descValue==descValue)
+            level = static_cast<int>(descValue * MIND_PACKED_BIT_NUMBER + 0.5);
+         level = level<0 ? 0 : (level>MIND_PACKED_BIT_NUMBER ? MIND_PACKED_BIT_NUMBER : level);
+         // Thermometer code: the Hamming distance between two codes is the
+         // absolute difference between their levels
+         packedValue |= (((uint64_t)1 << level) - 1) << (t * MIND_PACKED_BIT_NUMBER);
+      }
+      packedPtr[voxelIndex] = packedValue;
+   }
+}
+/* *************************************************************** */
+void GetPackedMINDDescriptor(nifti_image *descriptorImage,
+                             uint64_t *packedPtr)
+{
+   if(descriptorImage->nt * MIND_PACKED_BIT_NUMBER > 64) {
+      reg_print_fct_error("GetPackedMINDDescriptor");
+      reg_print_msg_error("The descriptor has too many channels to be packed on 64 bits");
+      reg_exit();
+   }
+   switch (descriptorImage->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      GetPackedMINDDescriptor_core<float>(descriptorImage, packedPtr);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      GetPackedMINDDescriptor_core<double>(descriptorImage, packedPtr);
+      break;
+   default:
+      reg_print_fct_error("GetPackedMINDDescriptor");
+      reg_print_msg_error("Descriptor image datatype not supported");
+      reg_exit();
+      break;
+   }
+}
+/* *************************************************************** */
+/// @brief Compute the negated block Hamming distance between the packed
+/// descriptors for every control point and label. The distances are
+/// expressed in descriptor unit, they are the l1 distances between the
+/// quantised descriptors
+void GetDiscretisedValueHamming_core3D(nifti_image *controlPointGridImage,
+                                       float *discretisedValue,
+                                       unsigned short *quantisedValue,
+                                       float *nodeOffset,
+                                       float *nodeScale,
+                                       int discretise_radius,
+                                       int discretise_step,
+                                       nifti_image *refImage,
+                                       uint64_t *refPackedPtr,
+                                       uint64_t *warPackedPtr,
+                                       int *mask)
+{
+   int cpx, cpy, cpz, x, y, z, a, b, c, blockIndex, discretisedIndex;
+   int definedValueNumber, distance, currentControlPoint;
+   size_t rowIndex;
+   bool rowInside;
+   const int label_1D_number = (discretise_radius / discretise_step) * 2 + 1;
+   const int label_nD_number = label_1D_number*label_1D_number*label_1D_number;
+   float gridVox[3], imageVox[3];
+   // Define the transformation matrices
+   mat44 *grid_vox2mm = &controlPointGridImage->qto_xyz;
+   if(controlPointGridImage->sform_code>0)
+      grid_vox2mm = &controlPointGridImage->sto_xyz;
+   mat44 *image_mm2vox = &refImage->qto_ijk;
+   if(refImage->sform_code>0)
+      image_mm2vox = &refImage->sto_ijk;
+   mat44 grid2img_vox = reg_mat44_mul(image_mm2vox, grid_vox2mm);
+
+   // Compute the block size
+   const int blockSize[3]={
+      (int)reg_ceil(controlPointGridImage->dx / refImage->dx),
+      (int)reg_ceil(controlPointGridImage->dy / refImage->dy),
+      (int)reg_ceil(controlPointGridImage->dz / refImage->dz),
+   };
+   const int voxelBlockNumber = blockSize[0] * blockSize[1] * blockSize[2];
+   const int imageDim[3] = {refImage->nx, refImage->ny, refImage->nz};
+
+   int threadNumber = 1;
+   int tid = 0;
+#if defined (_OPENMP)
+   threadNumber=omp_get_max_threads();
+#endif
+   // The reference block and the values of a quantised node are stored in
+   // thread buffers
+   uint64_t **refBlockValue = (uint64_t **) malloc(threadNumber*sizeof(uint64_t *));
+   for(a=0;a<threadNumber;++a)
+      refBlockValue[a] = (uint64_t *) malloc(voxelBlockNumber*sizeof(uint64_t));
+   float **nodeBuffer = NULL;
+   if(quantisedValue!=NULL){
+      nodeBuffer = (float **) malloc(threadNumber*sizeof(float *));
+      for(a=0;a<threadNumber;++a)
+         nodeBuffer[a] = (float *) malloc(label_nD_number*sizeof(float));
+   }
+   float *nodeValue;
+   uint64_t *blockPtr;
+
+   // Loop over all control points
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(controlPointGridImage, grid2img_vox, blockSize, imageDim, refBlockValue, \
+   mask, refPackedPtr, warPackedPtr, discretise_radius, discretise_step, \
+   discretisedValue, quantisedValue, nodeOffset, nodeScale, nodeBuffer, \
+   label_nD_number, label_1D_number) \
+   private(cpx, cpy, cpz, x, y, z, a, b, c, blockIndex, discretisedIndex, \
+   definedValueNumber, distance, currentControlPoint, rowIndex, rowInside, \
+   gridVox, imageVox, tid, nodeValue, blockPtr)
+#endif
+   for(cpz=0; cpz<controlPointGridImage->nz; ++cpz){
+#if defined (_OPENMP)
+      tid=omp_get_thread_num();
+#endif
+      blockPtr = refBlockValue[tid];
+      gridVox[2] = cpz;
+      for(cpy=0; cpy<controlPointGridImage->ny; ++cpy){
+         gridVox[1] = cpy;
+         for(cpx=0; cpx<controlPointGridImage->nx; ++cpx){
+            gridVox[0] = cpx;
+            currentControlPoint=controlPointGridImage->ny*controlPointGridImage->nx*cpz +
+                  controlPointGridImage->nx*cpy+cpx;
+
+            // Compute the corresponding image voxel position
+            reg_mat44_mul(&grid2img_vox, gridVox, imageVox);
+            imageVox[0]=reg_round(imageVox[0]);
+            imageVox[1]=reg_round(imageVox[1]);
+            imageVox[2]=reg_round(imageVox[2]);
+
+            if(quantisedValue==NULL)
+               nodeValue = &discretisedValue[currentControlPoint * label_nD_number];
+            else nodeValue = nodeBuffer[tid];
+            for(discretisedIndex=0; discretisedIndex<label_nD_number; ++discretisedIndex)
+               nodeValue[discretisedIndex] = std::numeric_limits<float>::quiet_NaN();
+
+            // Extract the block in the reference descriptor, the undefined
+            // descriptors are null
+            blockIndex = 0;
+            definedValueNumber = 0;
+            for(z=imageVox[2]-blockSize[2]/2; z<imageVox[2]+blockSize[2]/2; ++z) {
+               for(y=imageVox[1]-blockSize[1]/2; y<imageVox[1]+blockSize[1]/2; ++y) {
+                  rowInside = y>-1 && y<imageDim[1] && z>-1 && z<imageDim[2];
+                  rowIndex = rowInside ? ((size_t)z*imageDim[1]+y)*imageDim[0] : 0;
+                  for(x=imageVox[0]-blockSize[0]/2; x<imageVox[0]+blockSize[0]/2; ++x) {
+                     blockPtr[blockIndex] = 0;
+                     if(rowInside && x>-1 && x<imageDim[0] && mask[rowIndex+x]>-1){
+                        blockPtr[blockIndex] = refPackedPtr[rowIndex+x];
+                        ++definedValueNumber;
+                     }
+                     blockIndex++;
+                  } // x
+               } // y
+            } // z
+            // Loop over the discretised value
+            if(definedValueNumber>0){
+               discretisedIndex=0;
+               for(c=imageVox[2]-discretise_radius; c<=imageVox[2]+discretise_radius; c+=discretise_step){
+                  for(b=imageVox[1]-discretise_radius; b<=imageVox[1]+discretise_radius; b+=discretise_step){
+                     for(a=imageVox[0]-discretise_radius; a<=imageVox[0]+discretise_radius; a+=discretise_step){
+                        blockIndex = 0;
+                        distance = 0;
+                        for(z=c-blockSize[2]/2; z<c+blockSize[2]/2; ++z){
+                           for(y=b-blockSize[1]/2; y<b+blockSize[1]/2; ++y){
+                              rowInside = y>-1 && y<imageDim[1] && z>-1 && z<imageDim[2];
+                              rowIndex = rowInside ? ((size_t)z*imageDim[1]+y)*imageDim[0] : 0;
+                              for(x=a-blockSize[0]/2; x<a+blockSize[0]/2; ++x){
+                                 // The warped descriptors outside of the image are null
+                                 if(rowInside && x>-1 && x<imageDim[0])
+                                    distance += reg_mind_bitCount(blockPtr[blockIndex] ^
+                                                                  warPackedPtr[rowIndex+x]);
+                                 else distance += reg_mind_bitCount(blockPtr[blockIndex]);
+                                 blockIndex++;
+                              } // x
+                           } // y
+                        } // z
+                        nodeValue[discretisedIndex] = -(float)distance / (float)MIND_PACKED_BIT_NUMBER;
+                        ++discretisedIndex;
+                     } // a
+                  } // b
+               } // c
+            } // defined value in the reference block
+            // Deal with the labels that contains NaN values
+            reg_discretisedValue_fillUndefined(nodeValue, label_1D_number);
+            if(quantisedValue!=NULL)
+               reg_discretisedValue_quantise(nodeValue,
+                                             label_nD_number,
+                                             &quantisedValue[(size_t)currentControlPoint * label_nD_number],
+                                             &nodeOffset[currentControlPoint],
+                                             &nodeScale[currentControlPoint]);
+         } // cpx
+      } // cpy
+   } // cpz
+   for(a=0;a<threadNumber;++a)
+      free(refBlockValue[a]);
+   free(refBlockValue);
+   if(nodeBuffer!=NULL){
+      for(a=0;a<threadNumber;++a)
+         free(nodeBuffer[a]);
+      free(nodeBuffer);
+   }
+}
+/* *************************************************************** */
 reg_mind::reg_mind()
    : reg_ssd()
 {
@@ -374,6 +738,14 @@ reg_mind::reg_mind()
    this->warpedReferenceImageDescriptor=NULL;
    this->mind_type=MIND_TYPE;
    this->descriptorOffset=1;
+   this->forwardCombinedMask=NULL;
+   this->backwardCombinedMask=NULL;
+   this->referenceDescriptorTimePoint=-1;
+   this->floatingDescriptorTimePoint=-1;
+   this->packedDescriptor=false;
+   this->referencePackedDescriptor=NULL;
+   this->warpedFloatingPackedDescriptor=NULL;
+   this->referencePackedTimePoint=-1;
 #ifndef NDEBUG
    reg_print_msg_debug("reg_mind constructor called");
 #endif
@@ -382,6 +754,10 @@ reg_mind::reg_mind()
 void reg_mind::SetDescriptorOffset(int val)
 {
    this->descriptorOffset = val;
+   // The cached descriptors have been computed with the previous offset
+   this->referenceDescriptorTimePoint=-1;
+   this->floatingDescriptorTimePoint=-1;
+   this->referencePackedTimePoint=-1;
 }
 /* *************************************************************** */
 int reg_mind::GetDescriptorOffset()
@@ -389,6 +765,16 @@ int reg_mind::GetDescriptorOffset()
    return this->descriptorOffset;
 }
 /* *************************************************************** */
+void reg_mind::SetPackedDescriptor(bool val)
+{
+   this->packedDescriptor = val;
+}
+/* *************************************************************** */
+bool reg_mind::GetPackedDescriptor()
+{
+   return this->packedDescriptor;
+}
+/* *************************************************************** */
 reg_mind::~reg_mind() {
    if(this->referenceImageDescriptor != NULL)
       nifti_image_free(this->referenceImageDescriptor);
@@ -405,6 +791,22 @@ reg_mind::~reg_mind() {
    if(this->warpedReferenceImageDescriptor != NULL)
       nifti_image_free(this->warpedReferenceImageDescriptor);
    this->warpedReferenceImageDescriptor = NULL;
+
+   if(this->forwardCombinedMask != NULL)
+      free(this->forwardCombinedMask);
+   this->forwardCombinedMask = NULL;
+
+   if(this->backwardCombinedMask != NULL)
+      free(this->backwardCombinedMask);
+   this->backwardCombinedMask = NULL;
+
+   if(this->referencePackedDescriptor != NULL)
+      free(this->referencePackedDescriptor);
+   this->referencePackedDescriptor = NULL;
+
+   if(this->warpedFloatingPackedDescriptor != NULL)
+      free(this->warpedFloatingPackedDescriptor);
+   this->warpedFloatingPackedDescriptor = NULL;
 }
 /* *************************************************************** */
 void reg_mind::InitialiseMeasure(nifti_image *refImgPtr,
@@ -440,6 +842,32 @@ void reg_mind::InitialiseMeasure(nifti_image *refImgPtr,
       discriptor_number=this->referenceImagePointer->nz>1?12:4;
 
    }
+   // The descriptors of a previous level are discarded
+   if(this->referenceImageDescriptor != NULL)
+      nifti_image_free(this->referenceImageDescriptor);
+   if(this->warpedFloatingImageDescriptor != NULL)
+      nifti_image_free(this->warpedFloatingImageDescriptor);
+   if(this->floatingImageDescriptor != NULL)
+      nifti_image_free(this->floatingImageDescriptor);
+   if(this->warpedReferenceImageDescriptor != NULL)
+      nifti_image_free(this->warpedReferenceImageDescriptor);
+   this->floatingImageDescriptor = NULL;
+   this->warpedReferenceImageDescriptor = NULL;
+   if(this->forwardCombinedMask != NULL)
+      free(this->forwardCombinedMask);
+   if(this->backwardCombinedMask != NULL)
+      free(this->backwardCombinedMask);
+   this->backwardCombinedMask = NULL;
+   if(this->referencePackedDescriptor != NULL)
+      free(this->referencePackedDescriptor);
+   if(this->warpedFloatingPackedDescriptor != NULL)
+      free(this->warpedFloatingPackedDescriptor);
+   this->referencePackedDescriptor = NULL;
+   this->warpedFloatingPackedDescriptor = NULL;
+   this->referenceDescriptorTimePoint=-1;
+   this->floatingDescriptorTimePoint=-1;
+   this->referencePackedTimePoint=-1;
+
    // Initialise the reference descriptor
    this->referenceImageDescriptor = nifti_copy_nim_info(this->referenceImagePointer);
    this->referenceImageDescriptor->dim[0]=this->referenceImageDescriptor->ndim=4;
@@ -460,6 +888,9 @@ void reg_mind::InitialiseMeasure(nifti_image *refImgPtr,
          this->warpedFloatingImageDescriptor->nt;
    this->warpedFloatingImageDescriptor->data=(void *)malloc(this->warpedFloatingImageDescriptor->nvox*
                                                             this->warpedFloatingImageDescriptor->nbyper);
+   this->forwardCombinedMask=(int *)malloc((size_t)this->referenceImagePointer->nx*
+                                           this->referenceImagePointer->ny*
+                                           this->referenceImagePointer->nz*sizeof(int));
 
    if(this->isSymmetric) {
       if(this->floatingImagePointer->nt>1 || this->warpedReferenceImagePointer->nt>1){
@@ -486,6 +917,9 @@ void reg_mind::InitialiseMeasure(nifti_image *refImgPtr,
             this->warpedReferenceImageDescriptor->nt;
       this->warpedReferenceImageDescriptor->data=(void *)malloc(this->warpedReferenceImageDescriptor->nvox*
                                                                 this->warpedReferenceImageDescriptor->nbyper);
+      this->backwardCombinedMask=(int *)malloc((size_t)this->floatingImagePointer->nx*
+                                               this->floatingImagePointer->ny*
+                                               this->floatingImagePointer->nz*sizeof(int));
    }
 
    for(int i=0;i<referenceImageDescriptor->nt;++i) {
@@ -503,42 +937,66 @@ void reg_mind::InitialiseMeasure(nifti_image *refImgPtr,
 #endif
 }
 /* *************************************************************** */
+void reg_mind::UpdateDescriptors(nifti_image *fixedImage,
+                                 nifti_image *warpedImage,
+                                 int *fixedMask,
+                                 int *combinedMask,
+                                 nifti_image *fixedDescriptor,
+                                 nifti_image *warpedDescriptor,
+                                 int &fixedDescriptorTimePoint,
+                                 int current_timepoint)
+{
+   size_t voxelNumber = (size_t)fixedImage->nx *
+         fixedImage->ny * fixedImage->nz;
+   memcpy(combinedMask, fixedMask, voxelNumber*sizeof(int));
+   reg_tools_removeNanFromMask(fixedImage, combinedMask);
+
+   // The fixed image does not change within a level
+   if(fixedDescriptorTimePoint!=current_timepoint){
+      if(this->mind_type==MIND_TYPE)
+         GetMINDImageDesciptor(fixedImage,
+                               fixedDescriptor,
+                               combinedMask,
+                               this->descriptorOffset,
+                               current_timepoint);
+      else if(this->mind_type==MINDSSC_TYPE)
+         GetMINDSSCImageDesciptor(fixedImage,
+                                  fixedDescriptor,
+                                  combinedMask,
+                                  this->descriptorOffset,
+                                  current_timepoint);
+      fixedDescriptorTimePoint=current_timepoint;
+   }
+
+   reg_tools_removeNanFromMask(warpedImage, combinedMask);
+   if(this->mind_type==MIND_TYPE)
+      GetMINDImageDesciptor(warpedImage,
+                            warpedDescriptor,
+                            combinedMask,
+                            this->descriptorOffset,
+                            current_timepoint);
+   else if(this->mind_type==MINDSSC_TYPE)
+      GetMINDSSCImageDesciptor(warpedImage,
+                               warpedDescriptor,
+                               combinedMask,
+                               this->descriptorOffset,
+                               current_timepoint);
+}
+/* *************************************************************** */
 double reg_mind::GetSimilarityMeasureValue()
 {
    double MINDValue=0.;
    for(int t=0; t<this->referenceImagePointer->nt; ++t){
       if(this->timePointWeight[t]>0.0){
-         size_t voxelNumber = (size_t)referenceImagePointer->nx *
-               referenceImagePointer->ny * referenceImagePointer->nz;
-         int *combinedMask = (int *)malloc(voxelNumber*sizeof(int));
-         memcpy(combinedMask, this->referenceMaskPointer, voxelNumber*sizeof(int));
-         reg_tools_removeNanFromMask(this->referenceImagePointer, combinedMask);
-         reg_tools_removeNanFromMask(this->warpedFloatingImagePointer, combinedMask);
-
-         if(this->mind_type==MIND_TYPE){
-            GetMINDImageDesciptor(this->referenceImagePointer,
-                                  this->referenceImageDescriptor,
-                                  combinedMask,
-                                  this->descriptorOffset,
-                                  t);
-            GetMINDImageDesciptor(this->warpedFloatingImagePointer,
-                                  this->warpedFloatingImageDescriptor,
-                                  combinedMask,
-                                  this->descriptorOffset,
-                                  t);
-         }
-         else if(this->mind_type==MINDSSC_TYPE){
-            GetMINDSSCImageDesciptor(this->referenceImagePointer,
-                                     this->referenceImageDescriptor,
-                                     combinedMask,
-                                     this->descriptorOffset,
-                                     t);
-            GetMINDSSCImageDesciptor(this->warpedFloatingImagePointer,
-                                     this->warpedFloatingImageDescriptor,
-                                     combinedMask,
-                                     this->descriptorOffset,
-                                     t);
-         }
+         int *combinedMask = this->forwardCombinedMask;
+         this->UpdateDescriptors(this->referenceImagePointer,
+                                 this->warpedFloatingImagePointer,
+                                 this->referenceMaskPointer,
+                                 combinedMask,
+                                 this->referenceImageDescriptor,
+                                 this->warpedFloatingImageDescriptor,
+                                 this->referenceDescriptorTimePoint,
+                                 t);
 
          switch(this->referenceImageDescriptor->datatype)
          {
@@ -569,42 +1027,19 @@ double reg_mind::GetSimilarityMeasureValue()
             reg_print_msg_error("Warped pixel type unsupported");
             reg_exit();
          }
-         free(combinedMask);
 
          // Backward computation
          if(this->isSymmetric)
          {
-            voxelNumber = (size_t)floatingImagePointer->nx *
-                  floatingImagePointer->ny * floatingImagePointer->nz;
-            combinedMask = (int *)malloc(voxelNumber*sizeof(int));
-            memcpy(combinedMask, this->floatingMaskPointer, voxelNumber*sizeof(int));
-            reg_tools_removeNanFromMask(this->floatingImagePointer, combinedMask);
-            reg_tools_removeNanFromMask(this->warpedReferenceImagePointer, combinedMask);
-
-            if(this->mind_type==MIND_TYPE){
-               GetMINDImageDesciptor(this->floatingImagePointer,
-                                     this->floatingImageDescriptor,
-                                     combinedMask,
-                                     this->descriptorOffset,
-                                     t);
-               GetMINDImageDesciptor(this->warpedReferenceImagePointer,
-                                     this->warpedReferenceImageDescriptor,
-                                     combinedMask,
-                                     this->descriptorOffset,
-                                     t);
-            }
-            else if(this->mind_type==MINDSSC_TYPE){
-               GetMINDSSCImageDesciptor(this->floatingImagePointer,
-                                        this->floatingImageDescriptor,
-                                        combinedMask,
-                                        this->descriptorOffset,
-                                        t);
-               GetMINDSSCImageDesciptor(this->warpedReferenceImagePointer,
-                                        this->warpedReferenceImageDescriptor,
-                                        combinedMask,
-                                        this->descriptorOffset,
-                                        t);
-            }
+            combinedMask = this->backwardCombinedMask;
+            this->UpdateDescriptors(this->floatingImagePointer,
+                                    this->warpedReferenceImagePointer,
+                                    this->floatingMaskPointer,
+                                    combinedMask,
+                                    this->floatingImageDescriptor,
+                                    this->warpedReferenceImageDescriptor,
+                                    this->floatingDescriptorTimePoint,
+                                    t);
 
             switch(this->floatingImageDescriptor->datatype)
             {
@@ -635,7 +1070,6 @@ double reg_mind::GetSimilarityMeasureValue()
                reg_print_msg_error("Warped pixel type unsupported");
                reg_exit();
             }
-            free(combinedMask);
          }
       }
    }
@@ -649,44 +1083,16 @@ void reg_mind::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
    if(this->timePointWeight[current_timepoint]==0.0)
       return;
 
-   // Create a combined mask to ignore masked and undefined values
-   size_t voxelNumber = (size_t)this->referenceImagePointer->nx *
-         this->referenceImagePointer->ny *
-         this->referenceImagePointer->nz;
-   int *combinedMask = (int *)malloc(voxelNumber*sizeof(int));
-   memcpy(combinedMask, this->referenceMaskPointer, voxelNumber*sizeof(int));
-   reg_tools_removeNanFromMask(this->referenceImagePointer, combinedMask);
-   reg_tools_removeNanFromMask(this->warpedFloatingImagePointer, combinedMask);
-
-   if(this->mind_type==MIND_TYPE){
-      // Compute the reference image descriptors
-      GetMINDImageDesciptor(this->referenceImagePointer,
-                            this->referenceImageDescriptor,
-                            combinedMask,
-                            this->descriptorOffset,
-                            current_timepoint);
-      // Compute the warped floating image descriptors
-      GetMINDImageDesciptor(this->warpedFloatingImagePointer,
-                            this->warpedFloatingImageDescriptor,
-                            combinedMask,
-                            this->descriptorOffset,
-                            current_timepoint);
-   }
-   else if(this->mind_type==MINDSSC_TYPE){
-      // Compute the reference image descriptors
-      GetMINDSSCImageDesciptor(this->referenceImagePointer,
-                               this->referenceImageDescriptor,
-                               combinedMask,
-                               this->descriptorOffset,
-                               current_timepoint);
-      // Compute the warped floating image descriptors
-      GetMINDSSCImageDesciptor(this->warpedFloatingImagePointer,
-                               this->warpedFloatingImageDescriptor,
-                               combinedMask,
-                               this->descriptorOffset,
-                               current_timepoint);
-   }
-
+   // Update the combined mask and the descriptors
+   int *combinedMask = this->forwardCombinedMask;
+   this->UpdateDescriptors(this->referenceImagePointer,
+                           this->warpedFloatingImagePointer,
+                           this->referenceMaskPointer,
+                           combinedMask,
+                           this->referenceImageDescriptor,
+                           this->warpedFloatingImageDescriptor,
+                           this->referenceDescriptorTimePoint,
+                           current_timepoint);
 
    for(int desc_index=0; desc_index<this->discriptor_number; ++desc_index){
       // Compute the warped image descriptors gradient
@@ -731,42 +1137,19 @@ void reg_mind::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
          reg_exit();
       }
    }
-   free(combinedMask);
 
    // Compute the gradient of the ssd for the backward transformation
    if(this->isSymmetric)
    {
-      voxelNumber = (size_t)floatingImagePointer->nx *
-            floatingImagePointer->ny * floatingImagePointer->nz;
-      combinedMask = (int *)malloc(voxelNumber*sizeof(int));
-      memcpy(combinedMask, this->floatingMaskPointer, voxelNumber*sizeof(int));
-      reg_tools_removeNanFromMask(this->floatingImagePointer, combinedMask);
-      reg_tools_removeNanFromMask(this->warpedReferenceImagePointer, combinedMask);
-
-      if(this->mind_type==MIND_TYPE){
-         GetMINDImageDesciptor(this->floatingImagePointer,
-                               this->floatingImageDescriptor,
-                               combinedMask,
-                               this->descriptorOffset,
-                               current_timepoint);
-         GetMINDImageDesciptor(this->warpedReferenceImagePointer,
-                               this->warpedReferenceImageDescriptor,
-                               combinedMask,
-                               this->descriptorOffset,
-                               current_timepoint);
-      }
-      else if(this->mind_type==MINDSSC_TYPE){
-         GetMINDSSCImageDesciptor(this->floatingImagePointer,
-                                  this->floatingImageDescriptor,
-                                  combinedMask,
-                                  this->descriptorOffset,
-                                  current_timepoint);
-         GetMINDSSCImageDesciptor(this->warpedReferenceImagePointer,
-                                  this->warpedReferenceImageDescriptor,
-                                  combinedMask,
-                                  this->descriptorOffset,
-                                  current_timepoint);
-      }
+      combinedMask = this->backwardCombinedMask;
+      this->UpdateDescriptors(this->floatingImagePointer,
+                              this->warpedReferenceImagePointer,
+                              this->floatingMaskPointer,
+                              combinedMask,
+                              this->floatingImageDescriptor,
+                              this->warpedReferenceImageDescriptor,
+                              this->floatingDescriptorTimePoint,
+                              current_timepoint);
 
       for(int desc_index=0; desc_index<this->discriptor_number; ++desc_index){
           reg_getImageGradient_symDiff(this->warpedReferenceImageDescriptor,
@@ -810,10 +1193,124 @@ void reg_mind::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
             reg_exit();
          }
       }
-      free(combinedMask);
    }
 }
 /* *************************************************************** */
+void reg_mind::GetDiscretisedDescriptorValue(nifti_image *controlPointGridImage,
+                                             float *discretisedValue,
+                                             unsigned short *quantisedValue,
+                                             float *nodeOffset,
+                                             float *nodeScale,
+                                             int discretise_radius,
+                                             int discretise_step)
+{
+   // The descriptor images only hold the descriptors of one time point
+   int activeTimePoint=-1;
+   for(int t=0; t<this->referenceImagePointer->nt; ++t){
+      if(this->timePointWeight[t]>0.0){
+         if(activeTimePoint>-1){
+            reg_print_fct_error("reg_mind::GetDiscretisedValue");
+            reg_print_msg_error("Only one active time point is supported");
+            reg_exit();
+         }
+         activeTimePoint=t;
+      }
+   }
+   if(activeTimePoint<0){
+      reg_print_fct_error("reg_mind::GetDiscretisedValue");
+      reg_print_msg_error("No active time point");
+      reg_exit();
+   }
+
+   // Update the combined mask and the descriptors
+   int *combinedMask = this->forwardCombinedMask;
+   this->UpdateDescriptors(this->referenceImagePointer,
+                           this->warpedFloatingImagePointer,
+                           this->referenceMaskPointer,
+                           combinedMask,
+                           this->referenceImageDescriptor,
+                           this->warpedFloatingImageDescriptor,
+                           this->referenceDescriptorTimePoint,
+                           activeTimePoint);
+
+   if(this->packedDescriptor){
+      if(this->referenceImagePointer->nz==1){
+         reg_print_fct_error("reg_mind::GetDiscretisedValue");
+         reg_print_msg_error("Not implemented in 2D yet");
+         reg_exit();
+      }
+      // The packed descriptors are allocated on first use
+      size_t voxelNumber = (size_t)this->referenceImagePointer->nx *
+            this->referenceImagePointer->ny * this->referenceImagePointer->nz;
+      if(this->referencePackedDescriptor==NULL){
+         this->referencePackedDescriptor = (uint64_t *)malloc(voxelNumber*sizeof(uint64_t));
+         this->warpedFloatingPackedDescriptor = (uint64_t *)malloc(voxelNumber*sizeof(uint64_t));
+      }
+      if(this->referencePackedTimePoint!=activeTimePoint){
+         GetPackedMINDDescriptor(this->referenceImageDescriptor,
+                                 this->referencePackedDescriptor);
+         this->referencePackedTimePoint=activeTimePoint;
+      }
+      GetPackedMINDDescriptor(this->warpedFloatingImageDescriptor,
+                              this->warpedFloatingPackedDescriptor);
+      // The block Hamming distance is computed between the packed descriptors
+      GetDiscretisedValueHamming_core3D(controlPointGridImage,
+                                        discretisedValue,
+                                        quantisedValue,
+                                        nodeOffset,
+                                        nodeScale,
+                                        discretise_radius,
+                                        discretise_step,
+                                        this->referenceImagePointer,
+                                        this->referencePackedDescriptor,
+                                        this->warpedFloatingPackedDescriptor,
+                                        combinedMask);
+      return;
+   }
+
+   // The block ssd is computed between the descriptors
+   this->ComputeDiscretisedValue(this->referenceImageDescriptor,
+                                 this->warpedFloatingImageDescriptor,
+                                 combinedMask,
+                                 controlPointGridImage,
+                                 discretisedValue,
+                                 quantisedValue,
+                                 nodeOffset,
+                                 nodeScale,
+                                 discretise_radius,
+                                 discretise_step);
+}
+/* *************************************************************** */
+void reg_mind::GetDiscretisedValue(nifti_image *controlPointGridImage,
+                                   float *discretisedValue,
+                                   int discretise_radius,
+                                   int discretise_step)
+{
+   this->GetDiscretisedDescriptorValue(controlPointGridImage,
+                                       discretisedValue,
+                                       NULL,
+                                       NULL,
+                                       NULL,
+                                       discretise_radius,
+                                       discretise_step);
+}
+/* *************************************************************** */
+void reg_mind::GetQuantisedDiscretisedValue(nifti_image *controlPointGridImage,
+                                            unsigned short *quantisedValue,
+                                            float *nodeOffset,
+                                            float *nodeScale,
+                                            int discretise_radius,
+                                            int discretise_step)
+{
+   this->GetDiscretisedDescriptorValue(controlPointGridImage,
+                                       NULL,
+                                       quantisedValue,
+                                       nodeOffset,
+                                       nodeScale,
+                                       discretise_radius,
+                                       discretise_step);
+}
+/* *************************************************************** */
 /* *************************************************************** */
 reg_mindssc::reg_mindssc()
    : reg_mind()
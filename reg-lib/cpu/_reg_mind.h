@@ -18,10 +18,14 @@
 #include "_reg_globalTrans.h"
 #include "_reg_resampling.h"
 #include <algorithm>
+#include <stdint.h>
 
 #define MIND_TYPE 0
 #define MINDSSC_TYPE 1
 
+/// Number of bits used to encode every channel of the packed descriptors
+#define MIND_PACKED_BIT_NUMBER 5
+
 /* *************************************************************** */
 /* *************************************************************** */
 /// @brief MIND measure of similarity class
@@ -30,7 +34,8 @@ class reg_mind : public reg_ssd
 public:
    /// @brief reg_mind class constructor
    reg_mind();
-   /// @brief Initialise the reg_mind object
+   /// @brief Initialise the reg_mind object. The cached reference and floating
+   /// descriptors are discarded, they are recomputed at the next evaluation
    void InitialiseMeasure(nifti_image *refImgPtr,
                           nifti_image *floImgPtr,
                           int *maskRefPtr,
@@ -46,9 +51,29 @@ public:
    virtual double GetSimilarityMeasureValue();
    /// @brief Compute the voxel based gradient
    virtual void GetVoxelBasedSimilarityMeasureGradient(int current_timepoint);
+   /// @brief Compute the block ssd between the descriptors for every control
+   /// point and label
+   virtual void GetDiscretisedValue(nifti_image *controlPointGridImage,
+                                    float *discretisedValue,
+                                    int discretise_radius,
+                                    int discretise_step);
+   /// @brief Compute the block ssd between the descriptors quantised on 16 bits
+   virtual void GetQuantisedDiscretisedValue(nifti_image *controlPointGridImage,
+                                             unsigned short *quantisedValue,
+                                             float *nodeOffset,
+                                             float *nodeScale,
+                                             int discretise_radius,
+                                             int discretise_step);
    /// @brief
    void SetDescriptorOffset(int);
    int GetDescriptorOffset();
+   /// @brief Use the packed descriptors to compute the discretised values.
+   /// Every channel is quantised on MIND_PACKED_BIT_NUMBER+1 levels and the
+   /// descriptor of a voxel is stored in a 64-bit word. The discretised values
+   /// are the negated block Hamming distances between the packed descriptors.
+   /// The measure value and its gradient still use the full descriptors
+   void SetPackedDescriptor(bool);
+   bool GetPackedDescriptor();
    /// @brief Measure class desstructor
    ~reg_mind();
 
@@ -62,6 +87,42 @@ protected:
    int descriptorOffset;
    int mind_type;
    int discriptor_number;
+
+   /// Masks of the voxels that are defined in both the fixed and warped images
+   int *forwardCombinedMask;
+   int *backwardCombinedMask;
+   /// Time points described by the cached reference and floating descriptors,
+   /// -1 when the descriptors have to be recomputed
+   int referenceDescriptorTimePoint;
+   int floatingDescriptorTimePoint;
+
+   /// Packed descriptors used by the discretised values
+   bool packedDescriptor;
+   uint64_t *referencePackedDescriptor;
+   uint64_t *warpedFloatingPackedDescriptor;
+   int referencePackedTimePoint;
+
+   /// @brief Update the combined mask and the descriptors of the warped image.
+   /// The descriptors of the fixed image only depend on its own mask and are
+   /// computed when the cached ones do not describe the current time point
+   void UpdateDescriptors(nifti_image *fixedImage,
+                          nifti_image *warpedImage,
+                          int *fixedMask,
+                          int *combinedMask,
+                          nifti_image *fixedDescriptor,
+                          nifti_image *warpedDescriptor,
+                          int &fixedDescriptorTimePoint,
+                          int current_timepoint);
+
+   /// @brief Compute the descriptors of the active time point and their
+   /// discretised ssd, the values are quantised when quantisedValue is not NULL
+   void GetDiscretisedDescriptorValue(nifti_image *controlPointGridImage,
+                                      float *discretisedValue,
+                                      unsigned short *quantisedValue,
+                                      float *nodeOffset,
+                                      float *nodeScale,
+                                      int discretise_radius,
+                                      int discretise_step);
 };
 /* *************************************************************** */
 /// @brief MIND-SSC measure of similarity class
@@ -87,4 +148,11 @@ void GetMINDSSCImageDesciptor(nifti_image* inputImgPtr,
                               int *mask,
                               int descriptorOffset,
                               int current_timepoint);
+/// @brief Quantise every channel of a MIND or MIND-SSC descriptor image on
+/// MIND_PACKED_BIT_NUMBER+1 levels and pack them in one 64-bit word per voxel.
+/// A thermometer code is used so that the Hamming distance between two packed
+/// descriptors is the l1 distance between their quantised levels
+extern "C++"
+void GetPackedMINDDescriptor(nifti_image *descriptorImage,
+                             uint64_t *packedPtr);
 #endif
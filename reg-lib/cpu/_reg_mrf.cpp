@@ -5,6 +5,69 @@
 #include <fstream>
 #include "_reg_ReadWriteBinary.h"
 //DEBUG
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#if defined (_OPENMP)
+#include "omp.h"
+#endif
+/*****************************************************/
+/// @brief Allocates a buffer in memory or, when requested and possible, maps
+/// it to an unlinked temporary file so that the system can page it out
+static void reg_mrf_allocateBuffer(reg_mrf_buffer *buffer, size_t size, bool mapped)
+{
+   buffer->data=NULL;
+   buffer->size=size;
+   buffer->mapped=false;
+#ifndef _WIN32
+   if(mapped){
+      const char *tmpDir=getenv("TMPDIR");
+      if(tmpDir==NULL || tmpDir[0]=='\0')
+         tmpDir="/tmp";
+      char *fileName=(char *)malloc(strlen(tmpDir)+20);
+      sprintf(fileName, "%s/reg_mrf_XXXXXX", tmpDir);
+      int fileDescriptor=mkstemp(fileName);
+      if(fileDescriptor!=-1){
+         // The file is removed as soon as the mapping is released
+         unlink(fileName);
+         if(ftruncate(fileDescriptor, (off_t)size)==0){
+            void *data=mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+            if(data!=MAP_FAILED){
+               buffer->data=data;
+               buffer->mapped=true;
+            }
+         }
+         close(fileDescriptor);
+      }
+      free(fileName);
+   }
+#endif
+   if(mapped && !buffer->mapped)
+      reg_print_msg_warn("reg_mrf: the cost volume could not be mapped to a temporary file and is kept in memory");
+   if(buffer->data==NULL){
+      buffer->data=malloc(size);
+      if(buffer->data==NULL){
+         reg_print_fct_error("reg_mrf_allocateBuffer");
+         reg_print_msg_error("The cost volume could not be allocated");
+         reg_exit();
+      }
+   }
+}
+/*****************************************************/
+static void reg_mrf_freeBuffer(reg_mrf_buffer *buffer)
+{
+   if(buffer->data==NULL)
+      return;
+#ifndef _WIN32
+   if(buffer->mapped)
+      munmap(buffer->data, buffer->size);
+   else
+#endif
+      free(buffer->data);
+   buffer->data=NULL;
+}
 /*****************************************************/
 reg_mrf::reg_mrf(int _discrete_radius,
                  int _discrete_increment,
@@ -29,8 +92,14 @@ reg_mrf::reg_mrf(int _discrete_radius,
     for(int i=0;i<this->image_dim;++i){
         this->discrete_values_mm[i] = (float *)malloc(this->label_nD_num*sizeof(float));
     }
-    //To store the cost data term - originaly SAD between images.
-    this->discretised_measures = (float *)calloc(this->node_number*this->label_nD_num,sizeof(float));
+    // The quantised cost volume is allocated once the memory budget is known
+    this->memory_budget = 0;
+    this->data_cost_buffer.data = this->message_buffer.data = NULL;
+    this->data_cost = NULL;
+    this->data_offset = this->data_scale = NULL;
+    this->message = NULL;
+    this->message_offset = this->message_scale = NULL;
+    this->discretised_measures = NULL;
 
     // Allocate the arrays to store the tree
     this->orderedList = (int *) malloc(this->node_number*sizeof(int));
@@ -38,8 +107,10 @@ reg_mrf::reg_mrf(int _discrete_radius,
     this->edgeWeight = (float *) malloc(this->node_number*sizeof(float));
 
     //regulatization - optimization
-    this->regularised_cost= (float *)malloc(this->node_number*this->label_nD_num*sizeof(float));
     this->optimal_label_index=(int *)malloc(this->node_number*sizeof(int));
+
+    this->input_transformation = NULL;
+    this->initialised = false;
 }
 /*****************************************************/
 reg_mrf::reg_mrf(reg_measure *_measure,
@@ -107,8 +178,14 @@ reg_mrf::reg_mrf(reg_measure *_measure,
    free(discrete_values_vox);
 
 
-   //To store the cost data term - originaly SAD between images.
-   this->discretised_measures = (float *)calloc(this->node_number*this->label_nD_num,sizeof(float));
+   // The quantised cost volume is allocated once the memory budget is known
+   this->memory_budget = 0;
+   this->data_cost_buffer.data = this->message_buffer.data = NULL;
+   this->data_cost = NULL;
+   this->data_offset = this->data_scale = NULL;
+   this->message = NULL;
+   this->message_offset = this->message_scale = NULL;
+   this->discretised_measures = NULL;
 
    // Allocate the arrays to store the tree
    this->orderedList = (int *) malloc(this->node_number*sizeof(int));
@@ -116,7 +193,6 @@ reg_mrf::reg_mrf(reg_measure *_measure,
    this->edgeWeight = (float *) malloc(this->node_number*sizeof(float));
 
    //regulatization - optimization
-   this->regularised_cost= (float *)malloc(this->node_number*this->label_nD_num*sizeof(float));
    this->optimal_label_index=(int *)malloc(this->node_number*sizeof(int));
 
    this->initialised = false;
@@ -128,6 +204,23 @@ reg_mrf::~reg_mrf()
       free(this->discretised_measures);
    this->discretised_measures=NULL;
 
+   reg_mrf_freeBuffer(&this->data_cost_buffer);
+   reg_mrf_freeBuffer(&this->message_buffer);
+   this->data_cost=NULL;
+   this->message=NULL;
+   if(this->data_offset!=NULL)
+      free(this->data_offset);
+   this->data_offset=NULL;
+   if(this->data_scale!=NULL)
+      free(this->data_scale);
+   this->data_scale=NULL;
+   if(this->message_offset!=NULL)
+      free(this->message_offset);
+   this->message_offset=NULL;
+   if(this->message_scale!=NULL)
+      free(this->message_scale);
+   this->message_scale=NULL;
+
    if(this->orderedList!=NULL)
       free(this->orderedList);
    this->orderedList=NULL;
@@ -140,10 +233,6 @@ reg_mrf::~reg_mrf()
       free(this->edgeWeight);
    this->edgeWeight=NULL;
 
-   if(this->regularised_cost!=NULL)
-      free(this->regularised_cost);
-   this->regularised_cost=NULL;
-
    if(this->optimal_label_index!=NULL)
       free(this->optimal_label_index);
    this->optimal_label_index=NULL;
@@ -185,15 +274,111 @@ void reg_mrf::Initialise()
 #endif
 }
 /*****************************************************/
+void reg_mrf::SetMemoryBudget(size_t bytes)
+{
+   if(this->data_cost_buffer.data!=NULL){
+      reg_print_fct_error("reg_mrf::SetMemoryBudget");
+      reg_print_msg_error("The memory budget has to be set before the data term is computed");
+      reg_exit();
+   }
+   this->memory_budget=bytes;
+}
+/*****************************************************/
+void reg_mrf::GetCostVolumeLayout(size_t *fixedSize,
+                                  size_t *dataSize,
+                                  size_t *messageSize,
+                                  bool *mapData,
+                                  bool *mapMessage)
+{
+   const size_t costNumber=this->node_number*this->label_nD_num;
+   *dataSize=costNumber*sizeof(unsigned short);
+   *messageSize=costNumber*sizeof(unsigned short);
+   // The tree, its levels and their construction buffers, the per node
+   // quantisation parameters, the labels
+   // and the initial transformation
+   *fixedSize=this->node_number*(9*sizeof(int)+(5+this->image_dim)*sizeof(float));
+   // The per thread buffers of the message passing
+   int threadNumber=1;
+#if defined (_OPENMP)
+   threadNumber=omp_get_max_threads();
+#endif
+   *fixedSize+=threadNumber*this->label_nD_num*(2*sizeof(float)+sizeof(int));
+   // The messages are mapped first as the data term is read more often
+   *mapMessage=this->memory_budget>0 &&
+         *fixedSize+*dataSize+*messageSize>this->memory_budget;
+   *mapData=*mapMessage && *fixedSize+*dataSize>this->memory_budget;
+}
+/*****************************************************/
+size_t reg_mrf::GetPeakMemoryFootprint()
+{
+   size_t fixedSize, dataSize, messageSize;
+   bool mapData, mapMessage;
+   this->GetCostVolumeLayout(&fixedSize, &dataSize, &messageSize, &mapData, &mapMessage);
+   size_t costVolumeSize=fixedSize+(mapData?0:dataSize)+(mapMessage?0:messageSize);
+   // The graph used to build the minimum spanning tree is released before the
+   // cost volume is allocated
+   size_t graphSize=this->node_number*this->image_dim*2*(sizeof(float)+sizeof(int)) +
+         this->node_number*(3*sizeof(int)+sizeof(float)+sizeof(bool)+sizeof(std::pair<short,int>));
+   return std::max(costVolumeSize, graphSize);
+}
+/*****************************************************/
+void reg_mrf::AllocateCostVolume()
+{
+   if(this->data_cost_buffer.data!=NULL)
+      return;
+   size_t fixedSize, dataSize, messageSize;
+   bool mapData, mapMessage;
+   this->GetCostVolumeLayout(&fixedSize, &dataSize, &messageSize, &mapData, &mapMessage);
+   char text[255];
+   sprintf(text, "Cost volume of %lu nodes and %i labels - peak memory footprint %g MB",
+           (unsigned long)this->node_number, this->label_nD_num,
+           (double)this->GetPeakMemoryFootprint()/1048576.);
+   reg_print_info("reg_mrf", text);
+   if(mapMessage){
+      sprintf(text, "%g MB are mapped to a temporary file to stay within the %g MB budget",
+              (double)((mapData?dataSize:0)+messageSize)/1048576.,
+              (double)this->memory_budget/1048576.);
+      reg_print_info("reg_mrf", text);
+   }
+   if(mapData && fixedSize>this->memory_budget)
+      reg_print_msg_warn("reg_mrf: the memory budget is smaller than the tree footprint and is exceeded");
+
+   reg_mrf_allocateBuffer(&this->data_cost_buffer, dataSize, mapData);
+   reg_mrf_allocateBuffer(&this->message_buffer, messageSize, mapMessage);
+   this->data_cost=static_cast<unsigned short *>(this->data_cost_buffer.data);
+   this->message=static_cast<unsigned short *>(this->message_buffer.data);
+   this->data_offset=(float *)malloc(this->node_number*sizeof(float));
+   this->data_scale=(float *)malloc(this->node_number*sizeof(float));
+   this->message_offset=(float *)malloc(this->node_number*sizeof(float));
+   this->message_scale=(float *)malloc(this->node_number*sizeof(float));
+}
+/*****************************************************/
 float* reg_mrf::GetDiscretisedMeasurePtr()
 {
+   if(this->data_cost==NULL)
+      return NULL;
+   const size_t labelNumber=this->label_nD_num;
+   if(this->discretised_measures==NULL)
+      this->discretised_measures=(float *)malloc(this->node_number*labelNumber*sizeof(float));
+   for(size_t node=0;node<this->node_number;node++){
+      for(size_t l=0;l<labelNumber;l++){
+         this->discretised_measures[node*labelNumber+l]=this->data_offset[node] +
+               this->data_scale[node]*this->data_cost[node*labelNumber+l];
+      }
+   }
    return this->discretised_measures;
 }
 /*****************************************************/
 void reg_mrf::SetDiscretisedMeasure(float* dm)
 {
-   for(size_t i=0;i<this->node_number*this->label_nD_num;i++) {
-       this->discretised_measures[i]=dm[i];
+   this->AllocateCostVolume();
+   const size_t labelNumber=this->label_nD_num;
+   for(size_t node=0;node<this->node_number;node++) {
+      reg_discretisedValue_quantise(&dm[node*labelNumber],
+                                    this->label_nD_num,
+                                    &this->data_cost[node*labelNumber],
+                                    &this->data_offset[node],
+                                    &this->data_scale[node]);
    }
 }
 /*****************************************************/
@@ -240,13 +425,19 @@ void reg_mrf::SetEdgeWeight(float* ew)
 /*****************************************************/
 void reg_mrf::GetDiscretisedMeasure()
 {
-   measure->GetDiscretisedValue(this->controlPointImage,
-                                this->discretised_measures,
-                                this->discrete_radius,
-                                this->discrete_increment);
+   this->AllocateCostVolume();
+   // The data term is quantised per node, no full precision cost volume is
+   // allocated
+   measure->GetQuantisedDiscretisedValue(this->controlPointImage,
+                                         this->data_cost,
+                                         this->data_offset,
+                                         this->data_scale,
+                                         this->discrete_radius,
+                                         this->discrete_increment);
    //Let's put the values positive for the mrf
-   for(size_t i=0;i<this->node_number*this->label_nD_num;i++) {
-       this->discretised_measures[i]=-this->discretised_measures[i];
+   for(size_t node=0;node<this->node_number;node++) {
+       this->data_offset[node]=-this->data_offset[node];
+       this->data_scale[node]=-this->data_scale[node];
    }
 //DEBUG
 /*
@@ -284,11 +475,95 @@ for(int i=0;i<32388174;i++){
 /*****************************************************/
 void reg_mrf::getOptimalLabel()
 {
-   for(size_t node=0; node<this->node_number; ++node) {
-      this->optimal_label_index[node]=
-         std::min_element(this->regularised_cost+node*this->label_nD_num,this->regularised_cost+(node+1)*this->label_nD_num) -
-         (this->regularised_cost+node*this->label_nD_num);
+   /* Backward pass of the belief propagation, from the root to the leaves.
+     The regularised cost of a node is the sum of its data cost, of the
+     messages of its children and of the message of its parent. It is only
+     kept long enough to extract the optimal label and to compute the messages
+     to the children, which replace their now unused upward messages.
+    */
+   const size_t labelNumber=this->label_nD_num;
+
+   int *levelNodes=(int *)malloc(this->node_number*sizeof(int));
+   int *levelStart=(int *)malloc((this->node_number+1)*sizeof(int));
+   int *childStart=(int *)malloc((this->node_number+1)*sizeof(int));
+   int *children=(int *)malloc(this->node_number*sizeof(int));
+   int levelNumber=this->GetTreeLevels(levelNodes, levelStart, childStart, children);
+
+   unsigned short *dataCost=this->data_cost;
+   float *dataOffset=this->data_offset;
+   float *dataScale=this->data_scale;
+   unsigned short *message=this->message;
+   float *messageOffset=this->message_offset;
+   float *messageScale=this->message_scale;
+   int *optimalLabel=this->optimal_label_index;
+   float *edgeWeights=this->edgeWeight;
+   int label1DNumber=this->label_1D_num;
+   int level, n, c;
+   size_t l;
+#if defined (_OPENMP)
+#pragma omp parallel default(none) \
+   shared(dataCost, dataOffset, dataScale, message, messageOffset, messageScale, \
+   optimalLabel, levelNodes, levelStart, childStart, children, levelNumber, \
+   edgeWeights, label1DNumber, labelNumber) \
+   private(level, n, c, l)
+#endif
+   {
+      //buffer variable
+      float *nodeCost=new float[labelNumber];
+      float *cost1=new float[labelNumber];
+      int *inds=new int[labelNumber];
+
+      for(level=0;level<levelNumber;level++){
+#if defined (_OPENMP)
+#pragma omp for schedule(static)
+#endif
+         for(n=levelStart[level];n<levelStart[level+1];n++){
+            int node=levelNodes[n];
+            unsigned short *nodeData=&dataCost[node*labelNumber];
+            for(l=0;l<labelNumber;l++)
+               nodeCost[l]=dataOffset[node]+dataScale[node]*nodeData[l];
+            //add the children mincost to the node
+            for(c=childStart[node];c<childStart[node+1];c++){
+               int child=children[c];
+               unsigned short *childMessage=&message[child*labelNumber];
+               for(l=0;l<labelNumber;l++)
+                  nodeCost[l]+=messageOffset[child]+messageScale[child]*childMessage[l];
+            }
+            //add the message from the parent, the root has none
+            if(level>0){
+               unsigned short *nodeMessage=&message[node*labelNumber];
+               for(l=0;l<labelNumber;l++)
+                  nodeCost[l]+=messageOffset[node]+messageScale[node]*nodeMessage[l];
+            }
+            optimalLabel[node]=std::min_element(nodeCost,nodeCost+labelNumber)-nodeCost;
+            //pass the messages to the children
+            for(c=childStart[node];c<childStart[node+1];c++){
+               int child=children[c];
+               //retreive the weight of the edge between node and child
+               float edgew=edgeWeights[child];
+               float edgew1=1.0f/edgew;
+               unsigned short *childMessage=&message[child*labelNumber];
+               for(l=0;l<labelNumber;l++)
+                  cost1[l]=(nodeCost[l]-messageOffset[child]-messageScale[child]*childMessage[l])*edgew;
+               dt3x(cost1,inds,label1DNumber,0,0,0);
+               for(l=0;l<labelNumber;l++)
+                  cost1[l]*=edgew1;
+               reg_discretisedValue_quantise(cost1, labelNumber, childMessage,
+                                          &messageOffset[child], &messageScale[child]);
+            }
+         }
+      }
+      delete []nodeCost;
+      delete []cost1;
+      delete []inds;
    }
+   free(levelNodes);
+   free(levelStart);
+   free(childStart);
+   free(children);
+#ifndef NDEBUG
+   reg_print_msg_debug("reg_mrf::getOptimalLabel done");
+#endif
 }
 /*****************************************************/
 void reg_mrf::UpdateNodePositions()
@@ -721,96 +996,181 @@ void reg_mrf::GetPrimsMST(float *edgeWeightMatrix,
    delete []addedToMST;
 }
 /*****************************************************/
+int reg_mrf::GetTreeLevels(int *levelNodes,
+                           int *levelStart,
+                           int *childStart,
+                           int *children)
+{
+   // The depth of every node is deduced from its parent as the ordered list
+   // goes from the root to the leaves
+   int *nodeDepth=(int *)malloc(this->node_number*sizeof(int));
+   int levelNumber=1;
+   nodeDepth[this->orderedList[0]]=0;
+   for(size_t i=1;i<this->node_number;i++){
+      int node=this->orderedList[i];
+      nodeDepth[node]=nodeDepth[this->parentsList[node]]+1;
+      levelNumber=nodeDepth[node]+1>levelNumber?nodeDepth[node]+1:levelNumber;
+   }
+   // The nodes of each level are stored contiguously, in the ordered list order
+   for(int l=0;l<=levelNumber;l++)
+      levelStart[l]=0;
+   for(size_t i=0;i<this->node_number;i++)
+      ++levelStart[nodeDepth[i]+1];
+   for(int l=0;l<levelNumber;l++)
+      levelStart[l+1]+=levelStart[l];
+   int *levelPosition=(int *)malloc(levelNumber*sizeof(int));
+   memcpy(levelPosition, levelStart, levelNumber*sizeof(int));
+   for(size_t i=0;i<this->node_number;i++){
+      int node=this->orderedList[i];
+      levelNodes[levelPosition[nodeDepth[node]]++]=node;
+   }
+   // The children of every node are stored from the last to the first one in
+   // the ordered list, which is the order in which their messages are summed
+   for(size_t i=0;i<=this->node_number;i++)
+      childStart[i]=0;
+   for(size_t i=1;i<this->node_number;i++)
+      ++childStart[this->parentsList[this->orderedList[i]]+1];
+   for(size_t i=0;i<this->node_number;i++)
+      childStart[i+1]+=childStart[i];
+   int *childPosition=(int *)malloc(this->node_number*sizeof(int));
+   memcpy(childPosition, childStart, this->node_number*sizeof(int));
+   for(size_t i=this->node_number-1;i>0;i--){
+      int node=this->orderedList[i];
+      children[childPosition[this->parentsList[node]]++]=node;
+   }
+   free(childPosition);
+   free(levelPosition);
+   free(nodeDepth);
+   return levelNumber;
+}
+/*****************************************************/
 void reg_mrf::GetRegularisation()
 {
    /* Incremental diffusion regularisation of parametrised transformation
      using (globally optimal) belief-propagation on minimum spanning tree.
      Fast distance transform uses squared differences.
      Similarity cost for each node and label has to be given as input.
+     The nodes of a same tree level are independent and their messages are
+     computed in parallel, one level after the other. Only the quantised
+     messages are stored, the regularised cost of a node being recomputed
+     from them during the backward pass, see reg_mrf::getOptimalLabel.
     */
+   const size_t labelNumber=this->label_nD_num;
 
-   //buffer variable
-   float *cost1=new float[this->label_nD_num];
-   float *vals=new float[this->label_nD_num];
-   int *inds=new int[this->label_nD_num];
-
-
-   float* message=new float[this->node_number*this->label_nD_num];
-   //initialize the energy term with the data cost value
-   for(size_t i=0;i<this->node_number*this->label_nD_num;i++){
-      //matrix = discretisedValue (first dimension displacement label, second dim. control point)
-      this->regularised_cost[i]=this->discretised_measures[i];
-      message[i]=0.0;
-   }
+   int *levelNodes=(int *)malloc(this->node_number*sizeof(int));
+   int *levelStart=(int *)malloc((this->node_number+1)*sizeof(int));
+   int *childStart=(int *)malloc((this->node_number+1)*sizeof(int));
+   int *children=(int *)malloc(this->node_number*sizeof(int));
+   int levelNumber=this->GetTreeLevels(levelNodes, levelStart, childStart, children);
 
-   for(int i=0;i<this->label_nD_num;i++){
-      cost1[i]=0;
-   }
-
-   //weight of the regularisation - constant weight
-   //float edgew=this->regularisation_weight + std::numeric_limits<float>::epsilon();
-   //float edgew1=1.0f/edgew;
-
-   //calculate mst-cost
-   for(int i=(this->node_number-1);i>0;i--){ //do for each control point
-      //retreive the child of the current node - start with the leave
-      int ochild=this->orderedList[i];//ordered list of all the nodes from root to leaves
-      //retreive the parent node of the child
-      int oparent=this->parentsList[ochild];
-      //retreive the weight of the edge between oparent and ochild
-      float edgew=this->edgeWeight[ochild];
-      float edgew1=1.0f/edgew;
-
-      for(int l=0;l<this->label_nD_num;l++){
-         //matrix = discretisedValue (first dimension displacement label, second dim. control point)
-         //weighted by the  edge weight
-         cost1[l]=this->regularised_cost[ochild*this->label_nD_num+l]*edgew;
-      }
-
-      //fast distance transform
-      //It is were the regularisation is calculated
-      dt3x(cost1,inds,this->label_1D_num,0,0,0);
+   unsigned short *dataCost=this->data_cost;
+   float *dataOffset=this->data_offset;
+   float *dataScale=this->data_scale;
+   unsigned short *message=this->message;
+   float *messageOffset=this->message_offset;
+   float *messageScale=this->message_scale;
+   float *edgeWeights=this->edgeWeight;
+   int label1DNumber=this->label_1D_num;
+   int level, n, c;
+   size_t l;
+#if defined (_OPENMP)
+#pragma omp parallel default(none) \
+   shared(dataCost, dataOffset, dataScale, message, messageOffset, messageScale, \
+   levelNodes, levelStart, childStart, children, levelNumber, edgeWeights, \
+   label1DNumber, labelNumber) \
+   private(level, n, c, l)
+#endif
+   {
+      //buffer variable
+      float *cost1=new float[labelNumber];
+      int *inds=new int[labelNumber];
 
-      //add mincost to parent node
-      for(int l=0;l<this->label_nD_num;l++){
-         message[ochild*this->label_nD_num+l]=cost1[l]*edgew1;
-         this->regularised_cost[oparent*this->label_nD_num+l]+=cost1[l]*edgew1;
+      //calculate mst-cost, from the leaves to the root
+      for(level=levelNumber-1;level>0;level--){
+#if defined (_OPENMP)
+#pragma omp for schedule(static)
+#endif
+         for(n=levelStart[level];n<levelStart[level+1];n++){
+            int node=levelNodes[n];
+            //initialize the energy term with the data cost value
+            unsigned short *nodeData=&dataCost[node*labelNumber];
+            for(l=0;l<labelNumber;l++)
+               cost1[l]=dataOffset[node]+dataScale[node]*nodeData[l];
+            //add the children mincost to the node
+            for(c=childStart[node];c<childStart[node+1];c++){
+               int child=children[c];
+               unsigned short *childMessage=&message[child*labelNumber];
+               for(l=0;l<labelNumber;l++)
+                  cost1[l]+=messageOffset[child]+messageScale[child]*childMessage[l];
+            }
+            //retreive the weight of the edge between the node and its parent
+            float edgew=edgeWeights[node];
+            float edgew1=1.0f/edgew;
+            for(l=0;l<labelNumber;l++)
+               cost1[l]*=edgew;
+            //fast distance transform
+            //It is were the regularisation is calculated
+            dt3x(cost1,inds,label1DNumber,0,0,0);
+            for(l=0;l<labelNumber;l++)
+               cost1[l]*=edgew1;
+            reg_discretisedValue_quantise(cost1, labelNumber, &message[node*labelNumber],
+                                       &messageOffset[node], &messageScale[node]);
+         }
       }
+      delete []cost1;
+      delete []inds;
    }
 
-   //backwards pass mst-cost
-   for(size_t i=1;i<this->node_number;i++){ //other direction
-      int ochild=this->orderedList[i];
-      int oparent=this->parentsList[ochild];
-      //retreive the weight of the edge between oparent and ochild
-      float edgew=this->edgeWeight[ochild];
-      float edgew1=1.0f/edgew;
-
-      for(int l=0;l<this->label_nD_num;l++){
-         cost1[l]=(this->regularised_cost[oparent*this->label_nD_num+l]-message[ochild*this->label_nD_num+l]+message[oparent*this->label_nD_num+l])*edgew;
+   free(levelNodes);
+   free(levelStart);
+   free(childStart);
+   free(children);
+}
+/*****************************************************/
+/*****************************************************/
+#ifdef _USE_SSE
+/// @brief Distance transform of short lines: every output value is the
+/// minimum over all input positions, four output positions being processed at once
+static void dt1sq_sse(float *val,int* ind,int len,float offset,int k,float* f,int* ind1){
+   for(int q=0;q<len;q++){
+      f[q]=val[q*k];
+      ind1[q]=ind[q*k];
+   }
+   union{__m128 m; float f[4];} bestVal;
+   union{__m128i m; int i[4];} bestInd;
+   for(int q=0;q<len;q+=4){
+      __m128 position=_mm_sub_ps(_mm_set_ps((float)(q+3),(float)(q+2),(float)(q+1),(float)q),
+                                 _mm_set1_ps(offset));
+      __m128 best=_mm_set1_ps(std::numeric_limits<float>::max());
+      __m128i bestIndex=_mm_setzero_si128();
+      for(int j=0;j<len;j++){
+         __m128 distance=_mm_sub_ps(position,_mm_set1_ps((float)j));
+         __m128 cost=_mm_add_ps(_mm_mul_ps(distance,distance),_mm_set1_ps(f[j]));
+         // The first position reaching the minimum is kept
+         __m128i lower=_mm_castps_si128(_mm_cmplt_ps(cost,best));
+         bestIndex=_mm_or_si128(_mm_and_si128(lower,_mm_set1_epi32(j)),
+                                _mm_andnot_si128(lower,bestIndex));
+         best=_mm_min_ps(cost,best);
       }
-
-      dt3x(cost1,inds,this->label_1D_num,0,0,0);
-      for(int l=0;l<this->label_nD_num;l++){
-         message[ochild*this->label_nD_num+l]=cost1[l]*edgew1;
+      bestVal.m=best;
+      bestInd.m=bestIndex;
+      for(int i=0;i<4 && q+i<len;i++){
+         val[(q+i)*k]=bestVal.f[i];
+         ind[(q+i)*k]=ind1[bestInd.i[i]];
       }
-
-   }
-
-   for(size_t i=0;i<this->node_number*this->label_nD_num;i++){
-      this->regularised_cost[i]+=message[i];
    }
-
-   delete []message;
-   delete []cost1;
-   delete []vals;
-   delete []inds;
 }
-/*****************************************************/
+#endif
 /*****************************************************/
 //fast distance transform for message computation following Pedro Felzenszwalb's implementation
 //see http://cs.brown.edu/~pff/dt/index.html for details
 void dt1sq(float *val,int* ind,int len,float offset,int k,int* v,float* z,float* f,int* ind1){
+#ifdef _USE_SSE
+   if(len<=DT_BRUTE_FORCE_MAX_LENGTH){
+      dt1sq_sse(val,ind,len,offset,k,f,ind1);
+      return;
+   }
+#endif
    float INF=1e10;
    int j=0;
    z[0]=-INF;
@@ -31,6 +31,13 @@ struct Edge{
    }
 };
 
+/// @brief Array kept either in memory or in a memory-mapped temporary file
+struct reg_mrf_buffer{
+   void *data;
+   size_t size;
+   bool mapped;
+};
+
 class reg_mrf
 {
 public:
@@ -50,13 +57,24 @@ public:
    /// @brief Destructor
    ~reg_mrf();
    void Run();
+   /// @brief Sets the maximal number of bytes the cost volume can use in memory.
+   /// The quantised messages, and then the quantised data term, are mapped to
+   /// a temporary file when the budget would be exceeded. 0 means no limit
+   void SetMemoryBudget(size_t bytes);
+   /// @brief Returns the estimated peak memory footprint in bytes, excluding
+   /// the arrays mapped to a temporary file
+   size_t GetPeakMemoryFootprint();
    //4 the tests
    void GetDiscretisedMeasure();
+   /// @brief Returns a dequantised copy of the data term
    float* GetDiscretisedMeasurePtr();
    void SetDiscretisedMeasure(float* dm);
    //
+   /// @brief Computes the messages from the leaves to the root
    void GetRegularisation();
    //
+   /// @brief Computes the messages from the root to the leaves and keeps the
+   /// label with the lowest regularised cost for every node
    void getOptimalLabel();
    int* GetOptimalLabelPtr();
    //
@@ -72,6 +90,16 @@ public:
 
 private:
    void Initialise();
+   /// @brief Allocates the quantised data term and messages, within the memory budget
+   void AllocateCostVolume();
+   /// @brief Returns the size in bytes of the arrays kept in memory and of the
+   /// quantised data term and messages, and which of the latter are mapped to
+   /// a temporary file to stay within the memory budget
+   void GetCostVolumeLayout(size_t *fixedSize, size_t *dataSize, size_t *messageSize,
+                            bool *mapData, bool *mapMessage);
+   /// @brief Sorts the nodes by tree level and lists the children of each node.
+   /// Returns the number of levels
+   int GetTreeLevels(int *levelNodes, int *levelStart, int *childStart, int *children);
    void UpdateNodePositions();
    void GetGraph(float *, int *);
 
@@ -95,8 +123,16 @@ private:
    int label_nD_num; ///< Total number of discretised values
 
    nifti_image *input_transformation;
-   float *discretised_measures; ///< All discretised measures of similarity
-   float* regularised_cost; ///< Discretised cost that embeds data term and regularisation cost
+   size_t memory_budget; ///< Maximal number of bytes of the cost volume kept in memory
+   reg_mrf_buffer data_cost_buffer; ///< Storage of the quantised data term
+   reg_mrf_buffer message_buffer; ///< Storage of the quantised messages
+   unsigned short *data_cost; ///< Data term of every node and label, quantised on 16 bits
+   float *data_offset; ///< Data term value of the quantised value 0 for each node
+   float *data_scale; ///< Data term difference between consecutive quantised values for each node
+   unsigned short *message; ///< Message of every node and label, quantised on 16 bits
+   float *message_offset; ///< Message value of the quantised value 0 for each node
+   float *message_scale; ///< Message difference between consecutive quantised values for each node
+   float *discretised_measures; ///< Dequantised data term, only allocated on request
    int* optimal_label_index; ///< Optimimal label index for each node
 
    bool initialised; ///< Variable to access if the object has been initialised
@@ -117,6 +153,9 @@ void GetGraph_core2D(nifti_image* controlPointGridImage,
                      nifti_image *refImage,
                      int *mask);
 
+/// Line length up to which the SSE distance transform compares every pair of
+/// positions instead of computing the lower envelope of the parabolas
+#define DT_BRUTE_FORCE_MAX_LENGTH 16
 extern "C++"
 void dt1sq(float *val,int* ind,int len,float offset,int k,int* v,float* z,float* f,int* ind1);
 extern "C++"
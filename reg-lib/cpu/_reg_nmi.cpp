@@ -25,6 +25,10 @@ reg_nmi::reg_nmi()
    this->backwardJointHistogramPro=NULL;
    this->backwardJointHistogramLog=NULL;
    this->backwardEntropyValues=NULL;
+   this->localJointHistogramCount=NULL;
+   this->tileJointHistogramCount=NULL;
+   this->tileThreadNumber=0;
+   this->discretisedBinNumber=8;
 
    for(int i=0; i<255; ++i)
    {
@@ -117,6 +121,27 @@ void reg_nmi::ClearHistogram()
       free(this->backwardEntropyValues);
    }
    this->backwardEntropyValues=NULL;
+   if(this->localJointHistogramCount!=NULL)
+   {
+      for(int i=0; i<255; ++i)
+      {
+         if(this->localJointHistogramCount[i]!=NULL)
+            free(this->localJointHistogramCount[i]);
+      }
+      free(this->localJointHistogramCount);
+   }
+   this->localJointHistogramCount=NULL;
+   if(this->tileJointHistogramCount!=NULL)
+   {
+      for(int i=0; i<255; ++i)
+      {
+         if(this->tileJointHistogramCount[i]!=NULL)
+            free(this->tileJointHistogramCount[i]);
+      }
+      free(this->tileJointHistogramCount);
+   }
+   this->tileJointHistogramCount=NULL;
+   this->tileThreadNumber=0;
 #ifndef NDEBUG
    reg_print_msg_debug("reg_nmi::ClearHistogram called");
 #endif
@@ -263,6 +288,286 @@ PrecisionTYPE GetBasisSplineDerivativeValue(PrecisionTYPE ori)
 }
 /* *************************************************************** */
 /* *************************************************************** */
+/// Number of contiguous blocks used to accumulate the histogram sums. The
+/// partial sums are always combined in the same order, which makes the
+/// normalisation and the entropies independent of the number of threads.
+#define NMI_SUM_BLOCK_NUMBER 64
+/* *************************************************************** */
+/// @brief Fill the joint histogram of one time point. Each thread fills a
+/// private copy of the histogram which are then merged using a tree reduction.
+/// The histogram only holds integer counts, the result is thus exact whatever
+/// the number of threads.
+template <class DTYPE>
+void reg_getNMIJointHistogram(DTYPE *refPtr,
+                              DTYPE *warPtr,
+                              int *referenceMask,
+                              size_t voxelNumber,
+                              int referenceBinNumber,
+                              int floatingBinNumber,
+                              double *jointHistoProPtr)
+{
+   int jointBinNumber = referenceBinNumber * floatingBinNumber;
+   int threadNumber = 1;
+#if defined (_OPENMP)
+   threadNumber = omp_get_max_threads();
+#endif
+   // A single thread fills directly the output histogram
+   if(threadNumber==1)
+   {
+      for(size_t voxel=0; voxel<voxelNumber; ++voxel)
+      {
+         if(referenceMask[voxel]>-1)
+         {
+            DTYPE refValue=refPtr[voxel];
+            DTYPE warValue=warPtr[voxel];
+            if(refValue==refValue && warValue==warValue &&
+                  refValue>=0 && warValue>=0 &&
+                  refValue<referenceBinNumber &&
+                  warValue<floatingBinNumber)
+            {
+               ++jointHistoProPtr[static_cast<int>(refValue) +
+                     static_cast<int>(warValue) * referenceBinNumber];
+            }
+         }
+      }
+      return;
+   }
+   // Allocate one private histogram per thread, the first one being the output
+   double **threadHisto = (double **)malloc(threadNumber*sizeof(double *));
+   threadHisto[0] = jointHistoProPtr;
+   for(int i=1; i<threadNumber; ++i)
+      threadHisto[i] = (double *)calloc(jointBinNumber, sizeof(double));
+#if defined (_OPENMP)
+   size_t voxel;
+   int tid, stride, bin;
+   DTYPE refValue, warValue;
+   double *histoPtr;
+#pragma omp parallel default(none) num_threads(threadNumber) \
+   shared(refPtr, warPtr, referenceMask, voxelNumber, referenceBinNumber, \
+   floatingBinNumber, jointBinNumber, threadNumber, threadHisto) \
+   private(voxel, tid, stride, bin, refValue, warValue, histoPtr)
+   {
+      tid = omp_get_thread_num();
+      histoPtr = threadHisto[tid];
+      // Every thread fills its own histogram
+#pragma omp for schedule(static)
+      for(voxel=0; voxel<voxelNumber; ++voxel)
+      {
+         if(referenceMask[voxel]>-1)
+         {
+            refValue=refPtr[voxel];
+            warValue=warPtr[voxel];
+            if(refValue==refValue && warValue==warValue &&
+                  refValue>=0 && warValue>=0 &&
+                  refValue<referenceBinNumber &&
+                  warValue<floatingBinNumber)
+            {
+               ++histoPtr[static_cast<int>(refValue) +
+                     static_cast<int>(warValue) * referenceBinNumber];
+            }
+         }
+      }
+      // The private histograms are merged pairwise, log2(threadNumber) levels
+      for(stride=1; stride<threadNumber; stride*=2)
+      {
+#pragma omp barrier
+         if(tid%(2*stride)==0 && tid+stride<threadNumber)
+         {
+            for(bin=0; bin<jointBinNumber; ++bin)
+               histoPtr[bin] += threadHisto[tid+stride][bin];
+         }
+      }
+   }
+#endif
+   for(int i=1; i<threadNumber; ++i)
+      free(threadHisto[i]);
+   free(threadHisto);
+}
+/* *************************************************************** */
+/// @brief Compute the entropy of an array of probabilities and store the
+/// log of the probabilities. The accumulation order is fixed.
+static double reg_getNMIEntropy(double *proPtr,
+                                double *logPtr,
+                                int binNumber)
+{
+   double partialSum[NMI_SUM_BLOCK_NUMBER];
+   int blockSize = (binNumber + NMI_SUM_BLOCK_NUMBER - 1) / NMI_SUM_BLOCK_NUMBER;
+   int block, i, last;
+   double valPro, valLog, sum;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(proPtr, logPtr, binNumber, blockSize, partialSum) \
+   private(block, i, last, valPro, valLog, sum)
+#endif
+   for(block=0; block<NMI_SUM_BLOCK_NUMBER; ++block)
+   {
+      sum=0.;
+      last = (block+1)*blockSize<binNumber?(block+1)*blockSize:binNumber;
+      for(i=block*blockSize; i<last; ++i)
+      {
+         valPro=proPtr[i];
+         if(valPro>0)
+         {
+            valLog=log(valPro);
+            sum -= valPro * valLog;
+            logPtr[i]=valLog;
+         }
+      }
+      partialSum[block]=sum;
+   }
+   double entropy=0.;
+   for(block=0; block<NMI_SUM_BLOCK_NUMBER; ++block)
+      entropy += partialSum[block];
+   return entropy;
+}
+/* *************************************************************** */
+/// @brief Smooth a joint histogram filled with voxel counts, normalise it,
+/// compute its marginals and the associated entropies. entropyValues
+/// receives the reference, warped and joint entropies and the voxel number
+static void reg_getNMIEntropyValues(double *jointHistoProPtr,
+                                    double *jointHistoLogPtr,
+                                    int refBinNumber,
+                                    int floBinNumber,
+                                    int totalBinNumber,
+                                    double *entropyValues)
+{
+   int jointBinNumber = refBinNumber * floBinNumber;
+   // Convolve the histogram with a cubic B-spline kernel
+   double kernel[3];
+   kernel[0]=kernel[2]=GetBasisSplineValue(-1.);
+   kernel[1]=GetBasisSplineValue(0.);
+   double partialSum[NMI_SUM_BLOCK_NUMBER];
+   int r, f, i, it, index, block, blockSize, last;
+   double value, sum, *ptrHisto;
+   // Histogram is first smooth along the reference axis
+   memset(jointHistoLogPtr,0,totalBinNumber*sizeof(double));
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(jointHistoProPtr, jointHistoLogPtr, refBinNumber, floBinNumber, kernel) \
+   private(f, r, it, index, value, ptrHisto)
+#endif
+   for(f=0; f<floBinNumber; ++f)
+   {
+      for(r=0; r<refBinNumber; ++r)
+      {
+         value=0.0;
+         index = r-1;
+         ptrHisto = &jointHistoProPtr[index+refBinNumber*f];
+
+         for(it=0; it<3; it++)
+         {
+            if(-1<index && index<refBinNumber)
+            {
+               value += *ptrHisto * kernel[it];
+            }
+            ++ptrHisto;
+            ++index;
+         }
+         jointHistoLogPtr[r+refBinNumber*f] = value;
+      }
+   }
+   // Histogram is then smooth along the warped floating axis
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(jointHistoProPtr, jointHistoLogPtr, refBinNumber, floBinNumber, kernel) \
+   private(f, r, it, index, value, ptrHisto)
+#endif
+   for(f=0; f<floBinNumber; ++f)
+   {
+      for(r=0; r<refBinNumber; ++r)
+      {
+         value=0.;
+         index = f-1;
+         ptrHisto = &jointHistoLogPtr[r+refBinNumber*index];
+
+         for(it=0; it<3; it++)
+         {
+            if(-1<index && index<floBinNumber)
+            {
+               value += *ptrHisto * kernel[it];
+            }
+            ptrHisto+=refBinNumber;
+            ++index;
+         }
+         jointHistoProPtr[r+refBinNumber*f] = value;
+      }
+   }
+   // Normalise the histogram
+   blockSize = (jointBinNumber + NMI_SUM_BLOCK_NUMBER - 1) / NMI_SUM_BLOCK_NUMBER;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(jointHistoProPtr, jointBinNumber, blockSize, partialSum) \
+   private(block, i, last, sum)
+#endif
+   for(block=0; block<NMI_SUM_BLOCK_NUMBER; ++block)
+   {
+      sum=0.;
+      last = (block+1)*blockSize<jointBinNumber?(block+1)*blockSize:jointBinNumber;
+      for(i=block*blockSize; i<last; ++i)
+         sum+=jointHistoProPtr[i];
+      partialSum[block]=sum;
+   }
+   double activeVoxel=0.f;
+   for(block=0; block<NMI_SUM_BLOCK_NUMBER; ++block)
+      activeVoxel+=partialSum[block];
+   entropyValues[3]=activeVoxel;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(jointHistoProPtr, jointBinNumber, activeVoxel) \
+   private(i)
+#endif
+   for(i=0; i<jointBinNumber; ++i)
+      jointHistoProPtr[i]/=activeVoxel;
+   // Marginalise over the reference axis
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(jointHistoProPtr, refBinNumber, floBinNumber, jointBinNumber) \
+   private(r, f, index, sum)
+#endif
+   for(r=0; r<refBinNumber; ++r)
+   {
+      sum=0.;
+      index=r;
+      for(f=0; f<floBinNumber; ++f)
+      {
+         sum+=jointHistoProPtr[index];
+         index+=refBinNumber;
+      }
+      jointHistoProPtr[jointBinNumber+r]=sum;
+   }
+   // Marginalise over the warped floating axis
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(jointHistoProPtr, refBinNumber, floBinNumber, jointBinNumber) \
+   private(r, f, index, sum)
+#endif
+   for(f=0; f<floBinNumber; ++f)
+   {
+      sum=0.;
+      index=refBinNumber*f;
+      for(r=0; r<refBinNumber; ++r)
+      {
+         sum+=jointHistoProPtr[index];
+         ++index;
+      }
+      jointHistoProPtr[jointBinNumber+refBinNumber+f]=sum;
+   }
+   // Set the log values to zero
+   memset(jointHistoLogPtr,0,totalBinNumber*sizeof(double));
+   // Compute the entropy of the reference image
+   entropyValues[0]=reg_getNMIEntropy(&jointHistoProPtr[jointBinNumber],
+                                         &jointHistoLogPtr[jointBinNumber],
+                                         refBinNumber);
+   // Compute the entropy of the warped floating image
+   entropyValues[1]=reg_getNMIEntropy(&jointHistoProPtr[jointBinNumber+refBinNumber],
+                                         &jointHistoLogPtr[jointBinNumber+refBinNumber],
+                                         floBinNumber);
+   // Compute the joint entropy
+   entropyValues[2]=reg_getNMIEntropy(jointHistoProPtr,
+                                         jointHistoLogPtr,
+                                         jointBinNumber);
+}
+/* *************************************************************** */
 template <class DTYPE>
 void reg_getNMIValue(nifti_image *referenceImage,
                      nifti_image *warpedImage,
@@ -296,150 +601,24 @@ void reg_getNMIValue(nifti_image *referenceImage,
          // Define some pointers to the current histograms
          double *jointHistoProPtr = jointhistogramPro[t];
          double *jointHistoLogPtr = jointHistogramLog[t];
+         int refBinNumber = referenceBinNumber[t];
+         int floBinNumber = floatingBinNumber[t];
          // Empty the joint histogram
          memset(jointHistoProPtr,0,totalBinNumber[t]*sizeof(double));
          // Fill the joint histograms using an approximation
-         DTYPE *refPtr = &refImagePtr[t*voxelNumber];
-         DTYPE *warPtr = &warImagePtr[t*voxelNumber];
-         for(size_t voxel=0; voxel<voxelNumber; ++voxel)
-         {
-            if(referenceMask[voxel]>-1)
-            {
-               DTYPE refValue=refPtr[voxel];
-               DTYPE warValue=warPtr[voxel];
-               if(refValue==refValue && warValue==warValue &&
-                     refValue>=0 && warValue>=0 &&
-                     refValue<referenceBinNumber[t] &&
-                     warValue<floatingBinNumber[t])
-               {
-                  ++jointHistoProPtr[static_cast<int>(refValue) +
-                        static_cast<int>(warValue) * referenceBinNumber[t]];
-               }
-            }
-         }
-         // Convolve the histogram with a cubic B-spline kernel
-         double kernel[3];
-         kernel[0]=kernel[2]=GetBasisSplineValue(-1.);
-         kernel[1]=GetBasisSplineValue(0.);
-         // Histogram is first smooth along the reference axis
-         memset(jointHistoLogPtr,0,totalBinNumber[t]*sizeof(double));
-         for(int f=0; f<floatingBinNumber[t]; ++f)
-         {
-            for(int r=0; r<referenceBinNumber[t]; ++r)
-            {
-               double value=0.0;
-               int index = r-1;
-               double *ptrHisto = &jointHistoProPtr[index+referenceBinNumber[t]*f];
-
-               for(int it=0; it<3; it++)
-               {
-                  if(-1<index && index<referenceBinNumber[t])
-                  {
-                     value += *ptrHisto * kernel[it];
-                  }
-                  ++ptrHisto;
-                  ++index;
-               }
-               jointHistoLogPtr[r+referenceBinNumber[t]*f] = value;
-            }
-         }
-         // Histogram is then smooth along the warped floating axis
-         for(int r=0; r<referenceBinNumber[t]; ++r)
-         {
-            for(int f=0; f<floatingBinNumber[t]; ++f)
-            {
-               double value=0.;
-               int index = f-1;
-               double *ptrHisto = &jointHistoLogPtr[r+referenceBinNumber[t]*index];
-
-               for(int it=0; it<3; it++)
-               {
-                  if(-1<index && index<floatingBinNumber[t])
-                  {
-                     value += *ptrHisto * kernel[it];
-                  }
-                  ptrHisto+=referenceBinNumber[t];
-                  ++index;
-               }
-               jointHistoProPtr[r+referenceBinNumber[t]*f] = value;
-            }
-         }
-         // Normalise the histogram
-         double activeVoxel=0.f;
-         for(int i=0; i<totalBinNumber[t]; ++i)
-            activeVoxel+=jointHistoProPtr[i];
-         entropyValues[t][3]=activeVoxel;
-         for(int i=0; i<totalBinNumber[t]; ++i)
-            jointHistoProPtr[i]/=activeVoxel;
-         // Marginalise over the reference axis
-         for(int r=0; r<referenceBinNumber[t]; ++r)
-         {
-            double sum=0.;
-            int index=r;
-            for(int f=0; f<floatingBinNumber[t]; ++f)
-            {
-               sum+=jointHistoProPtr[index];
-               index+=referenceBinNumber[t];
-            }
-            jointHistoProPtr[referenceBinNumber[t]*
-                  floatingBinNumber[t]+r]=sum;
-         }
-         // Marginalise over the warped floating axis
-         for(int f=0; f<floatingBinNumber[t]; ++f)
-         {
-            double sum=0.;
-            int index=referenceBinNumber[t]*f;
-            for(int r=0; r<referenceBinNumber[t]; ++r)
-            {
-               sum+=jointHistoProPtr[index];
-               ++index;
-            }
-            jointHistoProPtr[referenceBinNumber[t]*
-                  floatingBinNumber[t]+referenceBinNumber[t]+f]=sum;
-         }
-         // Set the log values to zero
-         memset(jointHistoLogPtr,0,totalBinNumber[t]*sizeof(double));
-         // Compute the entropy of the reference image
-         double referenceEntropy=0.;
-         for(int r=0; r<referenceBinNumber[t]; ++r)
-         {
-            double valPro=jointHistoProPtr[referenceBinNumber[t]*floatingBinNumber[t]+r];
-            if(valPro>0)
-            {
-               double valLog=log(valPro);
-               referenceEntropy -= valPro * valLog;
-               jointHistoLogPtr[referenceBinNumber[t]*floatingBinNumber[t]+r]=valLog;
-            }
-         }
-         entropyValues[t][0]=referenceEntropy;
-         // Compute the entropy of the warped floating image
-         double warpedEntropy=0.;
-         for(int f=0; f<floatingBinNumber[t]; ++f)
-         {
-            double valPro=jointHistoProPtr[referenceBinNumber[t]*floatingBinNumber[t]+
-                  referenceBinNumber[t]+f];
-            if(valPro>0)
-            {
-               double valLog=log(valPro);
-               warpedEntropy -= valPro * valLog;
-               jointHistoLogPtr[referenceBinNumber[t]*floatingBinNumber[t]+
-                     referenceBinNumber[t]+f]=valLog;
-            }
-         }
-         entropyValues[t][1]=warpedEntropy;
-         // Compute the joint entropy
-         double jointEntropy=0.;
-         for(int i=0; i<referenceBinNumber[t]*floatingBinNumber[t]; ++i)
-         {
-            double valPro=jointHistoProPtr[i];
-            if(valPro>0)
-            {
-               double valLog=log(valPro);
-               jointEntropy -= valPro * valLog;
-               jointHistoLogPtr[i]=valLog;
-            }
-         }
-         entropyValues[t][2]=jointEntropy;
+         reg_getNMIJointHistogram<DTYPE>(&refImagePtr[t*voxelNumber],
+                                         &warImagePtr[t*voxelNumber],
+                                         referenceMask,
+                                         voxelNumber,
+                                         refBinNumber,
+                                         floBinNumber,
+                                         jointHistoProPtr);
+         reg_getNMIEntropyValues(jointHistoProPtr,
+                                 jointHistoLogPtr,
+                                 refBinNumber,
+                                 floBinNumber,
+                                 totalBinNumber[t],
+                                 entropyValues[t]);
       } // if active time point
    } // iterate over all time point in the reference image
 }
@@ -562,6 +741,178 @@ double reg_nmi::GetSimilarityMeasureValue()
    return nmi_value_forward+nmi_value_backward;
 }
 /* *************************************************************** */
+/// @brief Update a joint histogram of voxel counts when the warped values
+/// of a box of the reference space are replaced by the values of a local image
+template <class DTYPE>
+void reg_updateNMIJointHistogram(nifti_image *referenceImage,
+                                 DTYPE *refPtr,
+                                 DTYPE *warPtr,
+                                 DTYPE *localPtr,
+                                 int *referenceMask,
+                                 int *regionStart,
+                                 int *regionSize,
+                                 int referenceBinNumber,
+                                 int floatingBinNumber,
+                                 double *jointHistoProPtr)
+{
+   size_t localIndex=0;
+   for(int z=0; z<regionSize[2]; ++z)
+   {
+      for(int y=0; y<regionSize[1]; ++y)
+      {
+         size_t voxel=((size_t)(z+regionStart[2])*referenceImage->ny+y+regionStart[1]) *
+               referenceImage->nx+regionStart[0];
+         for(int x=0; x<regionSize[0]; ++x, ++voxel, ++localIndex)
+         {
+            if(referenceMask[voxel]>-1)
+            {
+               DTYPE refValue=refPtr[voxel];
+               if(refValue!=refValue || refValue<0 || refValue>=referenceBinNumber)
+                  continue;
+               // The previous contribution is removed
+               DTYPE warValue=warPtr[voxel];
+               if(warValue==warValue && warValue>=0 && warValue<floatingBinNumber)
+                  --jointHistoProPtr[static_cast<int>(refValue) +
+                        static_cast<int>(warValue) * referenceBinNumber];
+               // The new contribution is added
+               warValue=localPtr[localIndex];
+               if(warValue==warValue && warValue>=0 && warValue<floatingBinNumber)
+                  ++jointHistoProPtr[static_cast<int>(refValue) +
+                        static_cast<int>(warValue) * referenceBinNumber];
+            }
+         }
+      }
+   }
+}
+/* *************************************************************** */
+void reg_nmi::InitialiseLocalSimilarityMeasure()
+{
+   if(this->localJointHistogramCount==NULL)
+   {
+      this->localJointHistogramCount=(double**)malloc(255*sizeof(double *));
+      for(int i=0; i<255; ++i)
+         this->localJointHistogramCount[i]=NULL;
+   }
+   size_t voxelNumber = (size_t)this->referenceImagePointer->nx *
+         this->referenceImagePointer->ny *
+         this->referenceImagePointer->nz;
+   for(int t=0; t<this->referenceTimePoint; ++t)
+   {
+      if(this->timePointWeight[t] > 0.0)
+      {
+         int jointBinNumber=this->referenceBinNumber[t]*this->floatingBinNumber[t];
+         if(this->localJointHistogramCount[t]==NULL)
+            this->localJointHistogramCount[t]=(double *)malloc(jointBinNumber*sizeof(double));
+         memset(this->localJointHistogramCount[t],0,jointBinNumber*sizeof(double));
+         // The joint histogram of the current warped image is stored before normalisation
+         switch(this->referenceImagePointer->datatype)
+         {
+         case NIFTI_TYPE_FLOAT32:
+            reg_getNMIJointHistogram<float>
+                  (&static_cast<float *>(this->referenceImagePointer->data)[t*voxelNumber],
+                   &static_cast<float *>(this->warpedFloatingImagePointer->data)[t*voxelNumber],
+                   this->referenceMaskPointer,
+                   voxelNumber,
+                   this->referenceBinNumber[t],
+                   this->floatingBinNumber[t],
+                   this->localJointHistogramCount[t]);
+            break;
+         case NIFTI_TYPE_FLOAT64:
+            reg_getNMIJointHistogram<double>
+                  (&static_cast<double *>(this->referenceImagePointer->data)[t*voxelNumber],
+                   &static_cast<double *>(this->warpedFloatingImagePointer->data)[t*voxelNumber],
+                   this->referenceMaskPointer,
+                   voxelNumber,
+                   this->referenceBinNumber[t],
+                   this->floatingBinNumber[t],
+                   this->localJointHistogramCount[t]);
+            break;
+         default:
+            reg_print_fct_error("reg_nmi::InitialiseLocalSimilarityMeasure()");
+            reg_print_msg_error("Unsupported datatype");
+            reg_exit();
+         }
+      }
+   }
+#ifndef NDEBUG
+   reg_print_msg_debug("reg_nmi::InitialiseLocalSimilarityMeasure called");
+#endif
+}
+/* *************************************************************** */
+double reg_nmi::GetLocalSimilarityMeasureValue(nifti_image *localWarpedImage,
+                                               int *regionStart)
+{
+   // The backward term is not local and the full measure is thus computed
+   if(this->isSymmetric || this->localJointHistogramCount==NULL)
+      return reg_measure::GetLocalSimilarityMeasureValue(localWarpedImage, regionStart);
+
+   int regionSize[3]={localWarpedImage->nx,
+                      localWarpedImage->ny,
+                      localWarpedImage->nz};
+   size_t voxelNumber = (size_t)this->referenceImagePointer->nx *
+         this->referenceImagePointer->ny *
+         this->referenceImagePointer->nz;
+   size_t localVoxelNumber = (size_t)regionSize[0]*regionSize[1]*regionSize[2];
+   double nmi_value=0., entropyValues[4];
+   for(int t=0; t<this->referenceTimePoint; ++t)
+   {
+      if(this->timePointWeight[t] > 0.0)
+      {
+         int refBinNumber=this->referenceBinNumber[t];
+         int floBinNumber=this->floatingBinNumber[t];
+         // Local copies of the histograms are used as the function is thread-safe
+         double *jointHistoProPtr=(double *)malloc(this->totalBinNumber[t]*sizeof(double));
+         double *jointHistoLogPtr=(double *)malloc(this->totalBinNumber[t]*sizeof(double));
+         memcpy(jointHistoProPtr, this->localJointHistogramCount[t],
+                refBinNumber*floBinNumber*sizeof(double));
+         switch(this->referenceImagePointer->datatype)
+         {
+         case NIFTI_TYPE_FLOAT32:
+            reg_updateNMIJointHistogram<float>
+                  (this->referenceImagePointer,
+                   &static_cast<float *>(this->referenceImagePointer->data)[t*voxelNumber],
+                   &static_cast<float *>(this->warpedFloatingImagePointer->data)[t*voxelNumber],
+                   &static_cast<float *>(localWarpedImage->data)[t*localVoxelNumber],
+                   this->referenceMaskPointer,
+                   regionStart,
+                   regionSize,
+                   refBinNumber,
+                   floBinNumber,
+                   jointHistoProPtr);
+            break;
+         case NIFTI_TYPE_FLOAT64:
+            reg_updateNMIJointHistogram<double>
+                  (this->referenceImagePointer,
+                   &static_cast<double *>(this->referenceImagePointer->data)[t*voxelNumber],
+                   &static_cast<double *>(this->warpedFloatingImagePointer->data)[t*voxelNumber],
+                   &static_cast<double *>(localWarpedImage->data)[t*localVoxelNumber],
+                   this->referenceMaskPointer,
+                   regionStart,
+                   regionSize,
+                   refBinNumber,
+                   floBinNumber,
+                   jointHistoProPtr);
+            break;
+         default:
+            reg_print_fct_error("reg_nmi::GetLocalSimilarityMeasureValue()");
+            reg_print_msg_error("Unsupported datatype");
+            reg_exit();
+         }
+         reg_getNMIEntropyValues(jointHistoProPtr,
+                                 jointHistoLogPtr,
+                                 refBinNumber,
+                                 floBinNumber,
+                                 this->totalBinNumber[t],
+                                 entropyValues);
+         nmi_value += this->timePointWeight[t] *
+               (entropyValues[0] + entropyValues[1]) / entropyValues[2];
+         free(jointHistoProPtr);
+         free(jointHistoLogPtr);
+      }
+   }
+   return nmi_value;
+}
+/* *************************************************************** */
 template <class DTYPE>
 void reg_getVoxelBasedNMIGradient2D(nifti_image *referenceImage,
                                     nifti_image *warpedImage,
@@ -976,5 +1327,616 @@ void reg_nmi::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
 }
 /* *************************************************************** */
 /* *************************************************************** */
+void reg_nmi::InitialiseTileSimilarityMeasure(int threadNumber)
+{
+   if(this->tileJointHistogramCount==NULL)
+   {
+      this->tileJointHistogramCount=(double**)malloc(255*sizeof(double *));
+      for(int i=0; i<255; ++i)
+         this->tileJointHistogramCount[i]=NULL;
+   }
+   for(int t=0; t<this->referenceTimePoint; ++t)
+   {
+      if(this->timePointWeight[t] > 0.0)
+      {
+         size_t histoSize=(size_t)threadNumber*
+               this->referenceBinNumber[t]*this->floatingBinNumber[t];
+         if(threadNumber!=this->tileThreadNumber && this->tileJointHistogramCount[t]!=NULL)
+         {
+            free(this->tileJointHistogramCount[t]);
+            this->tileJointHistogramCount[t]=NULL;
+         }
+         if(this->tileJointHistogramCount[t]==NULL)
+            this->tileJointHistogramCount[t]=(double *)malloc(histoSize*sizeof(double));
+         memset(this->tileJointHistogramCount[t],0,histoSize*sizeof(double));
+      }
+   }
+   this->tileThreadNumber=threadNumber;
+}
+/* *************************************************************** */
+/// @brief Add the voxel counts of a box of the reference space to a joint
+/// histogram. The warped values are read from a local image of the box size
+template <class DTYPE>
+void reg_getNMIRegionJointHistogram(nifti_image *referenceImage,
+                                    DTYPE *refPtr,
+                                    DTYPE *localPtr,
+                                    int *referenceMask,
+                                    int *regionStart,
+                                    int *regionSize,
+                                    int referenceBinNumber,
+                                    int floatingBinNumber,
+                                    double *jointHistoProPtr)
+{
+   size_t localIndex=0;
+   for(int z=0; z<regionSize[2]; ++z)
+   {
+      for(int y=0; y<regionSize[1]; ++y)
+      {
+         size_t voxel=((size_t)(z+regionStart[2])*referenceImage->ny+y+regionStart[1]) *
+               referenceImage->nx+regionStart[0];
+         for(int x=0; x<regionSize[0]; ++x, ++voxel, ++localIndex)
+         {
+            if(referenceMask[voxel]>-1)
+            {
+               DTYPE refValue=refPtr[voxel];
+               DTYPE warValue=localPtr[localIndex];
+               if(refValue==refValue && warValue==warValue &&
+                     refValue>=0 && warValue>=0 &&
+                     refValue<referenceBinNumber &&
+                     warValue<floatingBinNumber)
+               {
+                  ++jointHistoProPtr[static_cast<int>(refValue) +
+                        static_cast<int>(warValue) * referenceBinNumber];
+               }
+            }
+         }
+      }
+   }
+}
+/* *************************************************************** */
+void reg_nmi::AccumulateTileSimilarityMeasure(nifti_image *localWarpedImage,
+                                              int *regionStart,
+                                              int threadIndex)
+{
+   int regionSize[3]={localWarpedImage->nx,
+                      localWarpedImage->ny,
+                      localWarpedImage->nz};
+   size_t voxelNumber = (size_t)this->referenceImagePointer->nx *
+         this->referenceImagePointer->ny *
+         this->referenceImagePointer->nz;
+   size_t localVoxelNumber = (size_t)regionSize[0]*regionSize[1]*regionSize[2];
+   for(int t=0; t<this->referenceTimePoint; ++t)
+   {
+      if(this->timePointWeight[t] > 0.0)
+      {
+         int refBinNumber=this->referenceBinNumber[t];
+         int floBinNumber=this->floatingBinNumber[t];
+         double *histoPtr=&this->tileJointHistogramCount[t][(size_t)threadIndex*refBinNumber*floBinNumber];
+         switch(this->referenceImagePointer->datatype)
+         {
+         case NIFTI_TYPE_FLOAT32:
+            reg_getNMIRegionJointHistogram<float>
+                  (this->referenceImagePointer,
+                   &static_cast<float *>(this->referenceImagePointer->data)[t*voxelNumber],
+                   &static_cast<float *>(localWarpedImage->data)[t*localVoxelNumber],
+                   this->referenceMaskPointer,
+                   regionStart,
+                   regionSize,
+                   refBinNumber,
+                   floBinNumber,
+                   histoPtr);
+            break;
+         case NIFTI_TYPE_FLOAT64:
+            reg_getNMIRegionJointHistogram<double>
+                  (this->referenceImagePointer,
+                   &static_cast<double *>(this->referenceImagePointer->data)[t*voxelNumber],
+                   &static_cast<double *>(localWarpedImage->data)[t*localVoxelNumber],
+                   this->referenceMaskPointer,
+                   regionStart,
+                   regionSize,
+                   refBinNumber,
+                   floBinNumber,
+                   histoPtr);
+            break;
+         default:
+            reg_print_fct_error("reg_nmi::AccumulateTileSimilarityMeasure()");
+            reg_print_msg_error("Unsupported datatype");
+            reg_exit();
+         }
+      }
+   }
+}
+/* *************************************************************** */
+double reg_nmi::GetTileSimilarityMeasureValue()
+{
+   double nmi_value=0.;
+   for(int t=0; t<this->referenceTimePoint; ++t)
+   {
+      if(this->timePointWeight[t] > 0.0)
+      {
+         int refBinNumber=this->referenceBinNumber[t];
+         int floBinNumber=this->floatingBinNumber[t];
+         int jointBinNumber=refBinNumber*floBinNumber;
+         // The thread histograms only hold integer counts, the merged
+         // histogram is thus identical to the one of the full image
+         double *jointHistoProPtr=this->forwardJointHistogramPro[t];
+         memset(jointHistoProPtr,0,this->totalBinNumber[t]*sizeof(double));
+         for(int i=0; i<this->tileThreadNumber; ++i)
+         {
+            double *histoPtr=&this->tileJointHistogramCount[t][(size_t)i*jointBinNumber];
+            for(int bin=0; bin<jointBinNumber; ++bin)
+               jointHistoProPtr[bin] += histoPtr[bin];
+         }
+         reg_getNMIEntropyValues(jointHistoProPtr,
+                                 this->forwardJointHistogramLog[t],
+                                 refBinNumber,
+                                 floBinNumber,
+                                 this->totalBinNumber[t],
+                                 this->forwardEntropyValues[t]);
+         nmi_value += this->timePointWeight[t] *
+               (this->forwardEntropyValues[t][0] +
+               this->forwardEntropyValues[t][1] ) /
+               this->forwardEntropyValues[t][2];
+      }
+   }
+   return nmi_value;
+}
+/* *************************************************************** */
+/// @brief Add the voxel based nmi gradient of a box of the reference space
+/// to the measure gradient image. The warped values and their spatial gradient
+/// are read from local images of the box size
+template <class DTYPE>
+void reg_getVoxelBasedNMIGradientRegion(nifti_image *referenceImage,
+                                        nifti_image *localWarpedImage,
+                                        nifti_image *localWarpedGradient,
+                                        nifti_image *measureGradientImage,
+                                        int *referenceMask,
+                                        int *regionStart,
+                                        int referenceBinNumber,
+                                        int floatingBinNumber,
+                                        double *logHistoPtr,
+                                        double *entropyPtr,
+                                        int current_timepoint,
+                                        double timepoint_weight)
+{
+   size_t voxelNumber = (size_t)referenceImage->nx*referenceImage->ny*referenceImage->nz;
+   size_t localVoxelNumber = (size_t)localWarpedImage->nx*localWarpedImage->ny*localWarpedImage->nz;
+   DTYPE *refPtr = &static_cast<DTYPE *>(referenceImage->data)[current_timepoint*voxelNumber];
+   DTYPE *warPtr = &static_cast<DTYPE *>(localWarpedImage->data)[current_timepoint*localVoxelNumber];
+   int dim = referenceImage->nz>1?3:2;
+   DTYPE *warGradPtr[3], *measureGradPtr[3];
+   for(int d=0; d<dim; ++d)
+   {
+      warGradPtr[d]=&static_cast<DTYPE *>(localWarpedGradient->data)[d*localVoxelNumber];
+      measureGradPtr[d]=&static_cast<DTYPE *>(measureGradientImage->data)[d*voxelNumber];
+   }
+   double nmi = (entropyPtr[0]+entropyPtr[1])/entropyPtr[2];
+   size_t referenceOffset=referenceBinNumber*floatingBinNumber;
+   size_t floatingOffset=referenceOffset+referenceBinNumber;
+   size_t localIndex=0;
+   for(int z=0; z<localWarpedImage->nz; ++z)
+   {
+      for(int y=0; y<localWarpedImage->ny; ++y)
+      {
+         size_t voxel=((size_t)(z+regionStart[2])*referenceImage->ny+y+regionStart[1]) *
+               referenceImage->nx+regionStart[0];
+         for(int x=0; x<localWarpedImage->nx; ++x, ++voxel, ++localIndex)
+         {
+            if(referenceMask[voxel]>-1)
+            {
+               DTYPE refValue = refPtr[voxel];
+               DTYPE warValue = warPtr[localIndex];
+               if(refValue==refValue && warValue==warValue)
+               {
+                  DTYPE grad[3];
+                  double jointDeriv[3]= {0.};
+                  double refDeriv[3]= {0.};
+                  double warDeriv[3]= {0.};
+                  for(int d=0; d<dim; ++d)
+                     grad[d]=warGradPtr[d][localIndex];
+
+                  for(int r=(int)(refValue-1.0); r<(int)(refValue+3.0); ++r)
+                  {
+                     if(-1<r && r<referenceBinNumber)
+                     {
+                        for(int w=(int)(warValue-1.0); w<(int)(warValue+3.0); ++w)
+                        {
+                           if(-1<w && w<floatingBinNumber)
+                           {
+                              double commun =
+                                    GetBasisSplineValue((double)refValue - (double)r) *
+                                    GetBasisSplineDerivativeValue((double)warValue - (double)w);
+                              double jointLog = logHistoPtr[r+w*referenceBinNumber];
+                              double refLog = logHistoPtr[r+referenceOffset];
+                              double warLog = logHistoPtr[w+floatingOffset];
+                              for(int d=0; d<dim; ++d)
+                              {
+                                 if(grad[d]==grad[d])
+                                 {
+                                    refDeriv[d] += commun * grad[d] * refLog;
+                                    warDeriv[d] += commun * grad[d] * warLog;
+                                    jointDeriv[d] += commun * grad[d] * jointLog;
+                                 }
+                              }
+                           }
+                        }
+                     }
+                  }
+                  for(int d=0; d<dim; ++d)
+                     measureGradPtr[d][voxel] += (DTYPE)(timepoint_weight * (refDeriv[d] + warDeriv[d] -
+                           nmi * jointDeriv[d]) / (entropyPtr[2]*entropyPtr[3]));
+               }// Check that the values are defined
+            } // mask
+         } // x
+      } // y
+   } // z
+}
+/* *************************************************************** */
+void reg_nmi::GetTileVoxelBasedSimilarityMeasureGradient(nifti_image *localWarpedImage,
+                                                         nifti_image *localWarpedGradient,
+                                                         int *regionStart,
+                                                         int current_timepoint)
+{
+   if(this->timePointWeight[current_timepoint]==0.0)
+      return;
+   switch(this->referenceImagePointer->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      reg_getVoxelBasedNMIGradientRegion<float>(this->referenceImagePointer,
+                                                localWarpedImage,
+                                                localWarpedGradient,
+                                                this->forwardVoxelBasedGradientImagePointer,
+                                                this->referenceMaskPointer,
+                                                regionStart,
+                                                this->referenceBinNumber[current_timepoint],
+                                                this->floatingBinNumber[current_timepoint],
+                                                this->forwardJointHistogramLog[current_timepoint],
+                                                this->forwardEntropyValues[current_timepoint],
+                                                current_timepoint,
+                                                this->timePointWeight[current_timepoint]);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      reg_getVoxelBasedNMIGradientRegion<double>(this->referenceImagePointer,
+                                                 localWarpedImage,
+                                                 localWarpedGradient,
+                                                 this->forwardVoxelBasedGradientImagePointer,
+                                                 this->referenceMaskPointer,
+                                                 regionStart,
+                                                 this->referenceBinNumber[current_timepoint],
+                                                 this->floatingBinNumber[current_timepoint],
+                                                 this->forwardJointHistogramLog[current_timepoint],
+                                                 this->forwardEntropyValues[current_timepoint],
+                                                 current_timepoint,
+                                                 this->timePointWeight[current_timepoint]);
+      break;
+   default:
+      reg_print_fct_error("reg_nmi::GetTileVoxelBasedSimilarityMeasureGradient()");
+      reg_print_msg_error("Unsupported datatype");
+      reg_exit();
+   }
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class DTYPE>
+void GetDiscretisedValueNMI_core3D(nifti_image *controlPointGridImage,
+                                   float *discretisedValue,
+                                   unsigned short *quantisedValue,
+                                   float *nodeOffset,
+                                   float *nodeScale,
+                                   int discretise_radius,
+                                   int discretise_step,
+                                   nifti_image *refImage,
+                                   nifti_image *warImage,
+                                   int *mask,
+                                   double *timePointWeight,
+                                   unsigned short *referenceBinNumber,
+                                   unsigned short *floatingBinNumber,
+                                   int blockBinNumber)
+{
+   const int label_1D_number = (discretise_radius / discretise_step) * 2 + 1;
+   const int label_nD_number = label_1D_number*label_1D_number*label_1D_number;
+   const int nodeNumber = controlPointGridImage->nx*controlPointGridImage->ny*controlPointGridImage->nz;
+   const size_t voxelNumber = (size_t)refImage->nx*refImage->ny*refImage->nz;
+   // Define the transformation matrices
+   mat44 *grid_vox2mm = &controlPointGridImage->qto_xyz;
+   if(controlPointGridImage->sform_code>0)
+      grid_vox2mm = &controlPointGridImage->sto_xyz;
+   mat44 *image_mm2vox = &refImage->qto_ijk;
+   if(refImage->sform_code>0)
+      image_mm2vox = &refImage->sto_ijk;
+   const mat44 grid2img_vox = reg_mat44_mul(image_mm2vox, grid_vox2mm);
+
+   // Compute the block size, the blocks span [centre-size/2, centre+size/2[
+   // as in the ssd. The region covers the block displaced by all labels
+   int blockHalf[3]={
+      (int)reg_ceil(controlPointGridImage->dx / refImage->dx) / 2,
+      (int)reg_ceil(controlPointGridImage->dy / refImage->dy) / 2,
+      (int)reg_ceil(controlPointGridImage->dz / refImage->dz) / 2
+   };
+   const int blockDim[3]={2*blockHalf[0], 2*blockHalf[1], 2*blockHalf[2]};
+   const int regionDim[3]={blockDim[0]+2*discretise_radius,
+                           blockDim[1]+2*discretise_radius,
+                           blockDim[2]+2*discretise_radius};
+   const int blockVoxelNumber = blockDim[0]*blockDim[1]*blockDim[2];
+   const int regionVoxelNumber = regionDim[0]*regionDim[1]*regionDim[2];
+   const int jointBinNumber = blockBinNumber*blockBinNumber;
+
+   DTYPE *refImgPtr = static_cast<DTYPE *>(refImage->data);
+   DTYPE *warImgPtr = static_cast<DTYPE *>(warImage->data);
+
+   // The entropies are computed from the voxel counts: H = log(n) - sum(c.log(c))/n
+   double *countLogCount = (double *)malloc((blockVoxelNumber+1)*sizeof(double));
+   countLogCount[0]=0.;
+   for(int c=1; c<=blockVoxelNumber; ++c)
+      countLogCount[c]=c*log((double)c);
+
+   int threadNumber = 1;
+   int tid = 0;
+#if defined (_OPENMP)
+   threadNumber=omp_get_max_threads();
+#endif
+   // Allocate the thread buffers
+   int **refBlockBin = (int **)malloc(threadNumber*sizeof(int *));
+   int **warRegionBin = (int **)malloc(threadNumber*sizeof(int *));
+   int **jointHisto = (int **)malloc(threadNumber*sizeof(int *));
+   float **nodeBuffer = (float **)malloc(threadNumber*sizeof(float *));
+   for(int i=0; i<threadNumber; ++i){
+      refBlockBin[i] = (int *)malloc(blockVoxelNumber*sizeof(int));
+      warRegionBin[i] = (int *)malloc(regionVoxelNumber*sizeof(int));
+      jointHisto[i] = (int *)malloc((jointBinNumber+2*blockBinNumber)*sizeof(int));
+      nodeBuffer[i] = (float *)malloc(label_nD_number*sizeof(float));
+   }
+
+   int node, cpx, cpy, cpz, t, x, y, z, a, b, c, label, blockIndex, regionIndex;
+   int refBin, warBin, definedValueNumber, centre[3], start[3], *joint, *refHisto, *warHisto;
+   float gridVox[3], imageVox[3], *nodeValue;
+   double refRatio, warRatio, refEntropy, warEntropy, jointEntropy, value;
+   DTYPE intensity;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(nodeNumber, controlPointGridImage, refImage, warImage, grid2img_vox, blockHalf, blockDim, \
+   regionDim, blockVoxelNumber, jointBinNumber, refImgPtr, warImgPtr, mask, voxelNumber, \
+   countLogCount, refBlockBin, warRegionBin, jointHisto, nodeBuffer, discretisedValue, \
+   quantisedValue, nodeOffset, nodeScale, discretise_radius, discretise_step, \
+   label_1D_number, label_nD_number, timePointWeight, referenceBinNumber, \
+   floatingBinNumber, blockBinNumber) \
+   private(node, cpx, cpy, cpz, t, x, y, z, a, b, c, label, blockIndex, regionIndex, \
+   refBin, warBin, definedValueNumber, centre, start, joint, refHisto, warHisto, \
+   gridVox, imageVox, nodeValue, refRatio, warRatio, refEntropy, warEntropy, \
+   jointEntropy, value, intensity, tid)
+#endif
+   for(node=0; node<nodeNumber; ++node){
+#if defined (_OPENMP)
+      tid=omp_get_thread_num();
+#endif
+      cpx = node % controlPointGridImage->nx;
+      cpy = (node / controlPointGridImage->nx) % controlPointGridImage->ny;
+      cpz = node / (controlPointGridImage->nx*controlPointGridImage->ny);
+      gridVox[0]=cpx;
+      gridVox[1]=cpy;
+      gridVox[2]=cpz;
+      reg_mat44_mul(&grid2img_vox, gridVox, imageVox);
+      centre[0]=(int)reg_round(imageVox[0]);
+      centre[1]=(int)reg_round(imageVox[1]);
+      centre[2]=(int)reg_round(imageVox[2]);
+      joint=jointHisto[tid];
+      refHisto=&joint[jointBinNumber];
+      warHisto=&refHisto[blockBinNumber];
+
+      if(quantisedValue==NULL)
+         nodeValue = &discretisedValue[(size_t)node * label_nD_number];
+      else nodeValue = nodeBuffer[tid];
+      for(label=0; label<label_nD_number; ++label)
+         nodeValue[label]=0;
+
+      for(t=0; t<refImage->nt; ++t){
+         if(timePointWeight[t]<=0.0) continue;
+         // The intensities have been rescaled between 2 and bin-3
+         refRatio=(double)blockBinNumber/(double)(referenceBinNumber[t]-5);
+         warRatio=(double)blockBinNumber/(double)(floatingBinNumber[t]-5);
+         // Extract the bins of the reference block
+         start[0]=centre[0]-blockHalf[0];
+         start[1]=centre[1]-blockHalf[1];
+         start[2]=centre[2]-blockHalf[2];
+         blockIndex=0;
+         definedValueNumber=0;
+         for(z=start[2]; z<start[2]+blockDim[2]; ++z){
+            for(y=start[1]; y<start[1]+blockDim[1]; ++y){
+               for(x=start[0]; x<start[0]+blockDim[0]; ++x){
+                  refBin=-1;
+                  if(x>-1 && x<refImage->nx && y>-1 && y<refImage->ny && z>-1 && z<refImage->nz){
+                     size_t voxIndex = ((size_t)z*refImage->ny+y)*refImage->nx+x;
+                     intensity = refImgPtr[t*voxelNumber+voxIndex];
+                     if(mask[voxIndex]>-1 && intensity==intensity){
+                        refBin=static_cast<int>((intensity-2.)*refRatio);
+                        refBin=refBin<0?0:(refBin<blockBinNumber?refBin:blockBinNumber-1);
+                        ++definedValueNumber;
+                     }
+                  }
+                  refBlockBin[tid][blockIndex++]=refBin;
+               }
+            }
+         }
+         if(definedValueNumber==0){
+            for(label=0; label<label_nD_number; ++label)
+               nodeValue[label]=std::numeric_limits<float>::quiet_NaN();
+            continue;
+         }
+         // Extract the bins of the warped region once for all labels
+         start[0]-=discretise_radius;
+         start[1]-=discretise_radius;
+         start[2]-=discretise_radius;
+         regionIndex=0;
+         for(z=start[2]; z<start[2]+regionDim[2]; ++z){
+            for(y=start[1]; y<start[1]+regionDim[1]; ++y){
+               for(x=start[0]; x<start[0]+regionDim[0]; ++x){
+                  warBin=-1;
+                  if(x>-1 && x<warImage->nx && y>-1 && y<warImage->ny && z>-1 && z<warImage->nz){
+                     intensity = warImgPtr[t*voxelNumber+((size_t)z*warImage->ny+y)*warImage->nx+x];
+                     if(intensity==intensity){
+                        warBin=static_cast<int>((intensity-2.)*warRatio);
+                        warBin=warBin<0?0:(warBin<blockBinNumber?warBin:blockBinNumber-1);
+                     }
+                  }
+                  warRegionBin[tid][regionIndex++]=warBin;
+               }
+            }
+         }
+         // Loop over the discretised values
+         // The label l corresponds to a displacement of l*step-radius voxels,
+         // thus to a region offset of l*step
+         label=0;
+         for(c=0; c<label_1D_number*discretise_step; c+=discretise_step){
+            for(b=0; b<label_1D_number*discretise_step; b+=discretise_step){
+               for(a=0; a<label_1D_number*discretise_step; a+=discretise_step){
+                  memset(joint, 0, (jointBinNumber+2*blockBinNumber)*sizeof(int));
+                  definedValueNumber=0;
+                  blockIndex=0;
+                  for(z=0; z<blockDim[2]; ++z){
+                     for(y=0; y<blockDim[1]; ++y){
+                        regionIndex=((z+c)*regionDim[1]+y+b)*regionDim[0]+a;
+                        for(x=0; x<blockDim[0]; ++x){
+                           refBin=refBlockBin[tid][blockIndex++];
+                           warBin=warRegionBin[tid][regionIndex++];
+                           if(refBin>-1 && warBin>-1){
+                              ++joint[refBin*blockBinNumber+warBin];
+                              ++refHisto[refBin];
+                              ++warHisto[warBin];
+                              ++definedValueNumber;
+                           }
+                        }
+                     }
+                  }
+                  value=std::numeric_limits<double>::quiet_NaN();
+                  if(definedValueNumber>0){
+                     refEntropy=warEntropy=jointEntropy=0.;
+                     for(x=0; x<blockBinNumber; ++x){
+                        refEntropy+=countLogCount[refHisto[x]];
+                        warEntropy+=countLogCount[warHisto[x]];
+                     }
+                     for(x=0; x<jointBinNumber; ++x)
+                        jointEntropy+=countLogCount[joint[x]];
+                     const double logCount=countLogCount[definedValueNumber]/definedValueNumber;
+                     refEntropy=logCount-refEntropy/definedValueNumber;
+                     warEntropy=logCount-warEntropy/definedValueNumber;
+                     jointEntropy=logCount-jointEntropy/definedValueNumber;
+                     if(jointEntropy>0.)
+                        value=(refEntropy+warEntropy)/jointEntropy;
+                  }
+                  nodeValue[label] += timePointWeight[t] * value;
+                  ++label;
+               } // a
+            } // b
+         } // c
+      } // t
+      // Deal with the labels that contains NaN values
+      reg_discretisedValue_fillUndefined(nodeValue, label_1D_number);
+      if(quantisedValue!=NULL)
+         reg_discretisedValue_quantise(nodeValue,
+                                       label_nD_number,
+                                       &quantisedValue[(size_t)node * label_nD_number],
+                                       &nodeOffset[node],
+                                       &nodeScale[node]);
+   } // node
+   for(int i=0; i<threadNumber; ++i){
+      free(refBlockBin[i]);
+      free(warRegionBin[i]);
+      free(jointHisto[i]);
+      free(nodeBuffer[i]);
+   }
+   free(refBlockBin);
+   free(warRegionBin);
+   free(jointHisto);
+   free(nodeBuffer);
+   free(countLogCount);
+}
+/* *************************************************************** */
+void reg_nmi::ComputeDiscretisedValue(nifti_image *controlPointGridImage,
+                                      float *discretisedValue,
+                                      unsigned short *quantisedValue,
+                                      float *nodeOffset,
+                                      float *nodeScale,
+                                      int discretise_radius,
+                                      int discretise_step)
+{
+   if(this->referenceImagePointer->nz==1){
+      reg_print_fct_error("reg_nmi::GetDiscretisedValue");
+      reg_print_msg_error("Not implemented in 2D yet");
+      reg_exit();
+   }
+   switch(this->referenceImagePointer->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      GetDiscretisedValueNMI_core3D<float>
+            (controlPointGridImage,
+             discretisedValue,
+             quantisedValue,
+             nodeOffset,
+             nodeScale,
+             discretise_radius,
+             discretise_step,
+             this->referenceImagePointer,
+             this->warpedFloatingImagePointer,
+             this->referenceMaskPointer,
+             this->timePointWeight,
+             this->referenceBinNumber,
+             this->floatingBinNumber,
+             this->discretisedBinNumber);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      GetDiscretisedValueNMI_core3D<double>
+            (controlPointGridImage,
+             discretisedValue,
+             quantisedValue,
+             nodeOffset,
+             nodeScale,
+             discretise_radius,
+             discretise_step,
+             this->referenceImagePointer,
+             this->warpedFloatingImagePointer,
+             this->referenceMaskPointer,
+             this->timePointWeight,
+             this->referenceBinNumber,
+             this->floatingBinNumber,
+             this->discretisedBinNumber);
+      break;
+   default:
+      reg_print_fct_error("reg_nmi::GetDiscretisedValue");
+      reg_print_msg_error("Unsupported datatype");
+      reg_exit();
+   }
+}
+/* *************************************************************** */
+void reg_nmi::GetDiscretisedValue(nifti_image *controlPointGridImage,
+                                  float *discretisedValue,
+                                  int discretise_radius,
+                                  int discretise_step)
+{
+   this->ComputeDiscretisedValue(controlPointGridImage,
+                                 discretisedValue,
+                                 NULL,
+                                 NULL,
+                                 NULL,
+                                 discretise_radius,
+                                 discretise_step);
+}
+/* *************************************************************** */
+void reg_nmi::GetQuantisedDiscretisedValue(nifti_image *controlPointGridImage,
+                                           unsigned short *quantisedValue,
+                                           float *nodeOffset,
+                                           float *nodeScale,
+                                           int discretise_radius,
+                                           int discretise_step)
+{
+   this->ComputeDiscretisedValue(controlPointGridImage,
+                                 NULL,
+                                 quantisedValue,
+                                 nodeOffset,
+                                 nodeScale,
+                                 discretise_radius,
+                                 discretise_step);
+}
+/* *************************************************************** */
+/* *************************************************************** */
 
 #endif // _REG_NMI
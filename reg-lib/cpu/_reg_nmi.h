@@ -41,6 +41,34 @@ public:
    double GetSimilarityMeasureValue();
    /// @brief Compute the voxel based nmi gradient
    void GetVoxelBasedSimilarityMeasureGradient(int current_timepoint);
+   /// @brief Store the joint histogram voxel counts of the current warped image
+   void InitialiseLocalSimilarityMeasure();
+   /// @brief Returns the nmi value when a region of the warped image is updated
+   double GetLocalSimilarityMeasureValue(nifti_image *localWarpedImage,
+                                         int *regionStart);
+   /// @brief The local value is only concurrent when the measure is not symmetric
+   bool IsLocalSimilarityMeasureConcurrent()
+   {
+      return !this->isSymmetric;
+   }
+   /// @brief The tile-wise computation is only available for the forward measure
+   bool IsTileSimilarityMeasureSupported()
+   {
+      return !this->isSymmetric;
+   }
+   /// @brief Allocate and reset one joint histogram of voxel counts per thread
+   void InitialiseTileSimilarityMeasure(int threadNumber);
+   /// @brief Add the voxel counts of a tile to the thread joint histogram
+   void AccumulateTileSimilarityMeasure(nifti_image *localWarpedImage,
+                                        int *regionStart,
+                                        int threadIndex);
+   /// @brief Merge the thread joint histograms and returns the nmi value
+   double GetTileSimilarityMeasureValue();
+   /// @brief Compute the voxel based nmi gradient over a tile
+   void GetTileVoxelBasedSimilarityMeasureGradient(nifti_image *localWarpedImage,
+                                                   nifti_image *localWarpedGradient,
+                                                   int *regionStart,
+                                                   int current_timepoint);
    void SetRefAndFloatBinNumbers(unsigned short refBinNumber,
                                  unsigned short floBinNumber,
                                  int timepoint)
@@ -64,6 +92,24 @@ public:
    {
       return this->floatingBinNumber;
    }
+   /// @brief Compute the block nmi for every control point and label
+   void GetDiscretisedValue(nifti_image *controlPointGridImage,
+                            float *discretisedValue,
+                            int discretise_radius,
+                            int discretise_step);
+   /// @brief Compute the block nmi quantised on 16 bits
+   void GetQuantisedDiscretisedValue(nifti_image *controlPointGridImage,
+                                     unsigned short *quantisedValue,
+                                     float *nodeOffset,
+                                     float *nodeScale,
+                                     int discretise_radius,
+                                     int discretise_step);
+   /// @brief Set the number of bins of the block joint histograms used by
+   /// the discretised values. The blocks only contain a few hundred voxels
+   void SetDiscretisedBinNumber(int b)
+   {
+      this->discretisedBinNumber=b;
+   }
    /// @brief reg_nmi class destructor
    ~reg_nmi();
 
@@ -77,8 +123,21 @@ protected:
    double **backwardJointHistogramPro;
    double **backwardJointHistogramLog;
    double **backwardEntropyValues;
+   double **localJointHistogramCount;
+   double **tileJointHistogramCount;
+   int tileThreadNumber;
+   int discretisedBinNumber;
 
    void ClearHistogram();
+   /// @brief Compute the discretised nmi, the values are quantised when
+   /// quantisedValue is not NULL
+   void ComputeDiscretisedValue(nifti_image *controlPointGridImage,
+                                float *discretisedValue,
+                                unsigned short *quantisedValue,
+                                float *nodeOffset,
+                                float *nodeScale,
+                                int discretise_radius,
+                                int discretise_step);
 };
 /* *************************************************************** */
 /* *************************************************************** */
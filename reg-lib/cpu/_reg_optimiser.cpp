@@ -31,6 +31,7 @@ reg_optimiser<T>::reg_optimiser()
    this->bestObjFunctionValue=0.0;
    this->objFunc=NULL;
    this->gradient_b=NULL;
+   this->lineSearchType=ADAPTIVE_LINE_SEARCH;
 
 #ifndef NDEBUG
    reg_print_msg_debug("reg_optimiser<T>::reg_optimiser() called");
@@ -154,9 +155,9 @@ void reg_optimiser<T>::Perturbation(float length)
 /* *************************************************************** */
 /* *************************************************************** */
 template <class T>
-void reg_optimiser<T>::Optimise(T maxLength,
-                                T smallLength,
-                                T &startLength)
+void reg_optimiser<T>::AdaptiveLineSearch(T maxLength,
+                                          T smallLength,
+                                          T &startLength)
 {
    size_t lineIteration=0;
    float addedLength=0;
@@ -164,7 +165,7 @@ void reg_optimiser<T>::Optimise(T maxLength,
 
    // Start performing the line search
    while(currentLength>smallLength &&
-         lineIteration<12 &&
+         lineIteration<LINE_SEARCH_MAX_EVALUATION &&
          this->currentIterationNumber<this->maxIterationNumber)
    {
 
@@ -222,6 +223,222 @@ void reg_optimiser<T>::Optimise(T maxLength,
 /* *************************************************************** */
 /* *************************************************************** */
 template <class T>
+double reg_optimiser<T>::EvaluateStepLength(T length,
+                                            T &bestLength)
+{
+   // The parameters are always updated from the best DOF, which is not
+   // modified during the line search
+   this->objFunc->UpdateParameters(-(float)length);
+   this->currentObjFunctionValue=this->objFunc->GetObjectiveFunctionValue();
+   if(this->currentObjFunctionValue > this->bestObjFunctionValue)
+   {
+#ifndef NDEBUG
+      char text[255];
+      sprintf(text, "[%i] objective function: %g | Step length %g | ACCEPTED",
+              (int)this->currentIterationNumber,
+              this->currentObjFunctionValue,
+              length);
+      reg_print_msg_debug(text);
+#endif
+      this->objFunc->UpdateBestObjFunctionValue();
+      this->bestObjFunctionValue=this->currentObjFunctionValue;
+      bestLength=length;
+   }
+#ifndef NDEBUG
+   else
+   {
+      char text[255];
+      sprintf(text, "[%i] objective function: %g | Step length %g | REJECTED",
+              (int)this->currentIterationNumber,
+              this->currentObjFunctionValue,
+              length);
+      reg_print_msg_debug(text);
+   }
+#endif
+   this->IncrementCurrentIterationNumber();
+   return this->currentObjFunctionValue;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+void reg_optimiser<T>::FinaliseLineSearch(T bestLength,
+                                          T &startLength)
+{
+   if(bestLength>0)
+   {
+      // The best step length is applied and becomes the new best DOF
+      this->objFunc->UpdateParameters(-(float)bestLength);
+      this->StoreCurrentDOF();
+   }
+   else this->RestoreBestDOF();
+   // update the current size for the next iteration
+   startLength=bestLength;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+void reg_optimiser<T>::BrentLineSearch(T maxLength,
+                                       T smallLength,
+                                       T &startLength)
+{
+   const double goldenRatio=1.618034;
+   const double goldenSection=0.3819660;
+   size_t evaluationNumber=0;
+   T bestLength=0;
+
+   if(!(startLength>smallLength) ||
+         this->currentIterationNumber>=this->maxIterationNumber)
+   {
+      this->FinaliseLineSearch(bestLength, startLength);
+      return;
+   }
+
+   // The maximum is first bracketed by a<b<c with f(b)>f(a) and f(b)>=f(c)
+   double a=0., b=startLength, c=0.;
+   double fa=this->bestObjFunctionValue, fb, fc;
+   fb=this->EvaluateStepLength((T)b, bestLength);
+   ++evaluationNumber;
+   bool bracketed=false;
+   if(fb>fa)
+   {
+      // The step is grown until the objective function decreases
+      while(evaluationNumber<LINE_SEARCH_MAX_EVALUATION &&
+            this->currentIterationNumber<this->maxIterationNumber)
+      {
+         c=b+goldenRatio*(b-a);
+         c=c<(double)maxLength?c:(double)maxLength;
+         if(c<=b) break;
+         fc=this->EvaluateStepLength((T)c, bestLength);
+         ++evaluationNumber;
+         if(fc<=fb)
+         {
+            bracketed=true;
+            break;
+         }
+         a=b;
+         fa=fb;
+         b=c;
+         fb=fc;
+      }
+   }
+   else
+   {
+      // The step is shrunk until the objective function increases
+      c=b;
+      fc=fb;
+      while(evaluationNumber<LINE_SEARCH_MAX_EVALUATION &&
+            this->currentIterationNumber<this->maxIterationNumber)
+      {
+         b=0.5*c;
+         if(b<=smallLength) break;
+         fb=this->EvaluateStepLength((T)b, bestLength);
+         ++evaluationNumber;
+         if(fb>fa)
+         {
+            bracketed=true;
+            break;
+         }
+         c=b;
+         fc=fb;
+      }
+   }
+
+   // Brent's method refines the bracketed maximum using parabolic
+   // interpolation with golden section steps as a fall back
+   if(bracketed)
+   {
+      double x=b, w=b, v=b;
+      double fx=fb, fw=fb, fv=fb;
+      double d=0., e=0.;
+      double lower=a, upper=c;
+      const double tolerance=0.5*(double)smallLength;
+      while(evaluationNumber<LINE_SEARCH_MAX_EVALUATION &&
+            this->currentIterationNumber<this->maxIterationNumber)
+      {
+         double middle=0.5*(lower+upper);
+         if(fabs(x-middle)<=2.*tolerance-0.5*(upper-lower))
+            break;
+         bool goldenStep=true;
+         if(fabs(e)>tolerance)
+         {
+            // Parabola through x, w and v
+            double r=(x-w)*(fv-fx);
+            double q=(x-v)*(fw-fx);
+            double p=(x-v)*q-(x-w)*r;
+            q=2.*(q-r);
+            if(q>0.) p=-p;
+            q=fabs(q);
+            double previousE=e;
+            e=d;
+            if(fabs(p)<fabs(0.5*q*previousE) && p>q*(lower-x) && p<q*(upper-x))
+            {
+               d=p/q;
+               double u=x+d;
+               if(u-lower<2.*tolerance || upper-u<2.*tolerance)
+                  d=middle>=x?tolerance:-tolerance;
+               goldenStep=false;
+            }
+         }
+         if(goldenStep)
+         {
+            e=x>=middle?lower-x:upper-x;
+            d=goldenSection*e;
+         }
+         double u=fabs(d)>=tolerance?x+d:x+(d>=0.?tolerance:-tolerance);
+         double fu=this->EvaluateStepLength((T)u, bestLength);
+         ++evaluationNumber;
+         if(fu>=fx)
+         {
+            if(u>=x) lower=x;
+            else upper=x;
+            v=w;
+            fv=fw;
+            w=x;
+            fw=fx;
+            x=u;
+            fx=fu;
+         }
+         else
+         {
+            if(u<x) lower=u;
+            else upper=u;
+            if(fu>=fw || w==x)
+            {
+               v=w;
+               fv=fw;
+               w=u;
+               fw=fu;
+            }
+            else if(fu>=fv || v==x || v==w)
+            {
+               v=u;
+               fv=fu;
+            }
+         }
+      }
+   }
+   this->FinaliseLineSearch(bestLength, startLength);
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+void reg_optimiser<T>::Optimise(T maxLength,
+                                T smallLength,
+                                T &startLength)
+{
+   switch(this->lineSearchType)
+   {
+   case BRENT_LINE_SEARCH:
+      this->BrentLineSearch(maxLength, smallLength, startLength);
+      break;
+   default:
+      this->AdaptiveLineSearch(maxLength, smallLength, startLength);
+      break;
+   }
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
 void reg_optimiser<T>::reg_test_optimiser()
 {
    this->objFunc->UpdateParameters(1.f);
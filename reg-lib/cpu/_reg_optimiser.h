@@ -11,6 +11,19 @@
 #include <stdio.h>
 #include <time.h>
 
+/* *************************************************************** */
+/* *************************************************************** */
+/// @brief Line search strategies used by reg_optimiser::Optimise
+typedef enum
+{
+   /// The step is grown by 10% after an improvement and halved otherwise
+   ADAPTIVE_LINE_SEARCH,
+   /// The maximum is bracketed and refined using Brent's method
+   BRENT_LINE_SEARCH
+} NREG_LINE_SEARCH_TYPE;
+
+/// Maximal number of objective function evaluations per line search
+#define LINE_SEARCH_MAX_EVALUATION 12
 /* *************************************************************** */
 /* *************************************************************** */
 /** @brief Interface between the registration class and the optimiser
@@ -58,6 +71,20 @@ protected:
    double bestObjFunctionValue;
    double currentObjFunctionValue;
    InterfaceOptimiser *objFunc;
+   int lineSearchType;
+
+   /// @brief Evaluates the objective function at the specified distance
+   /// from the best DOF along the gradient. The best objective function
+   /// value and its step length are updated in case of improvement
+   double EvaluateStepLength(T length, T &bestLength);
+   /// @brief Sets the DOF to the best evaluated step length
+   void FinaliseLineSearch(T bestLength, T &startLength);
+   void AdaptiveLineSearch(T maxLength,
+                           T smallLength,
+                           T &startLength);
+   void BrentLineSearch(T maxLength,
+                        T smallLength,
+                        T &startLength);
 
 public:
    reg_optimiser();
@@ -148,6 +175,14 @@ public:
    {
       this->currentIterationNumber++;
    }
+   virtual void SetLineSearchType(int t)
+   {
+      this->lineSearchType=t;
+   }
+   virtual int GetLineSearchType()
+   {
+      return this->lineSearchType;
+   }
    virtual void Initialise(size_t nvox,
                            int dim,
                            bool optX,
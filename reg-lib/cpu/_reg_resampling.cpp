@@ -19,11 +19,21 @@
 
 #define SINC_KERNEL_RADIUS 3
 #define SINC_KERNEL_SIZE SINC_KERNEL_RADIUS*2
+#define RESAMPLING_CHANNEL_BLOCK 4
 
 /* *************************************************************** */
 void interpWindowedSincKernel(double relative, double *basis)
 {
     if(relative<0.0) relative=0.0; //reg_rounding error
+    // The sines of every node are derived from the sines of the first node using
+    // sin(a-i.pi)=(-1)^i.sin(a) and a rotation of pi/radius for the window term
+    static const double cosStep=cos(M_PI/static_cast<double>(SINC_KERNEL_RADIUS));
+    static const double sinStep=sin(M_PI/static_cast<double>(SINC_KERNEL_RADIUS));
+    double sinPiX=sin(M_PI*relative);
+    if(SINC_KERNEL_RADIUS%2==1) sinPiX=-sinPiX;
+    double windowAngle=M_PI*relative/static_cast<double>(SINC_KERNEL_RADIUS);
+    double sinWindow=-sin(windowAngle);
+    double cosWindow=-cos(windowAngle);
     int j=0;
     double sum=0.;
     for(int i=-SINC_KERNEL_RADIUS; i<SINC_KERNEL_RADIUS; ++i)
@@ -36,10 +46,12 @@ void interpWindowedSincKernel(double relative, double *basis)
         else{
             double pi_x=M_PI*x;
             basis[j]=static_cast<double>(SINC_KERNEL_RADIUS) *
-                    sin(pi_x) *
-                    sin(pi_x/static_cast<double>(SINC_KERNEL_RADIUS)) /
-                    (pi_x*pi_x);
+                    sinPiX * sinWindow / (pi_x*pi_x);
         }
+        sinPiX=-sinPiX;
+        double temp=sinWindow*cosStep-cosWindow*sinStep;
+        cosWindow=cosWindow*cosStep+sinWindow*sinStep;
+        sinWindow=temp;
         sum+=basis[j];
         j++;
     }
@@ -112,6 +124,222 @@ void interpNearestNeighKernel(double relative, double *basis)
 }
 /* *************************************************************** */
 /* *************************************************************** */
+/// @brief Interpolation kernels used by the resampling functions. The kernel
+/// size and offset are compile-time constants so that the interpolation loops
+/// are unrolled for every kernel and the basis functions are inlined
+struct reg_nearestNeighInterpolant
+{
+    enum {size=2, offset=0};
+    static inline void getBasis(double relative, double *basis)
+    {
+        interpNearestNeighKernel(relative, basis);
+    }
+};
+struct reg_linearInterpolant
+{
+    enum {size=2, offset=0};
+    static inline void getBasis(double relative, double *basis)
+    {
+        interpLinearKernel(relative, basis);
+    }
+};
+struct reg_cubicSplineInterpolant
+{
+    enum {size=4, offset=1};
+    static inline void getBasis(double relative, double *basis)
+    {
+        interpCubicSplineKernel(relative, basis);
+    }
+};
+struct reg_windowedSincInterpolant
+{
+    enum {size=SINC_KERNEL_SIZE, offset=SINC_KERNEL_RADIUS};
+    static inline void getBasis(double relative, double *basis)
+    {
+        interpWindowedSincKernel(relative, basis);
+    }
+};
+/* *************************************************************** */
+/// @brief Returns the weighted sum of kernelSize consecutive intensities
+template<class FloatingTYPE, int kernelSize>
+inline double reg_interpolateLine(const FloatingTYPE *intensity,
+                                  const double *basis)
+{
+    double value=0.;
+    for(int a=0; a<kernelSize; ++a)
+        value += static_cast<double>(intensity[a]) * basis[a];
+    return value;
+}
+/* *************************************************************** */
+/// @brief Interpolate a 3D volume when the whole kernel support, starting at
+/// the previous node, lies in the image
+template<class FloatingTYPE, class InterpolantTYPE>
+inline double reg_interpolateInterior3D(const FloatingTYPE *intensity,
+                                        const int *dim,
+                                        const int *previous,
+                                        const double *xBasis,
+                                        const double *yBasis,
+                                        const double *zBasis)
+{
+    const size_t sliceSize=(size_t)dim[0]*dim[1];
+    const FloatingTYPE *zPointer=&intensity[previous[2]*sliceSize +
+          (size_t)previous[1]*dim[0] + previous[0]];
+    double value=0.;
+    for(int c=0; c<InterpolantTYPE::size; c++)
+    {
+        const FloatingTYPE *xyzPointer=zPointer;
+        double yTempNewValue=0.0;
+        for(int b=0; b<InterpolantTYPE::size; b++)
+        {
+            yTempNewValue += reg_interpolateLine<FloatingTYPE,InterpolantTYPE::size>(xyzPointer, xBasis) *
+                  yBasis[b];
+            xyzPointer += dim[0];
+        }
+        value += yTempNewValue * zBasis[c];
+        zPointer += sliceSize;
+    }
+    return value;
+}
+/* *************************************************************** */
+/// @brief Interpolate a 3D volume when the kernel support crosses the image
+/// border, the nodes outside of the image take the padding value
+template<class FloatingTYPE, class InterpolantTYPE>
+inline double reg_interpolateBorder3D(const FloatingTYPE *intensity,
+                                      const int *dim,
+                                      const int *previous,
+                                      const double *xBasis,
+                                      const double *yBasis,
+                                      const double *zBasis,
+                                      double paddingValue)
+{
+    const size_t sliceSize=(size_t)dim[0]*dim[1];
+    double value=0.;
+    for(int c=0; c<InterpolantTYPE::size; c++)
+    {
+        int Z= previous[2]+c;
+        double yTempNewValue=0.0;
+        for(int b=0; b<InterpolantTYPE::size; b++)
+        {
+            int Y= previous[1]+b;
+            double xTempNewValue=0.0;
+            for(int a=0; a<InterpolantTYPE::size; a++)
+            {
+                int X= previous[0]+a;
+                if(-1<X && X<dim[0] &&
+                   -1<Z && Z<dim[2] &&
+                   -1<Y && Y<dim[1])
+                {
+                    xTempNewValue +=  static_cast<double>(intensity[Z*sliceSize +
+                          (size_t)Y*dim[0] + X]) * xBasis[a];
+                }
+                else
+                {
+                    // paddingValue
+                    xTempNewValue +=  paddingValue * xBasis[a];
+                }
+            }
+            yTempNewValue += xTempNewValue * yBasis[b];
+        }
+        value += yTempNewValue * zBasis[c];
+    }
+    return value;
+}
+/* *************************************************************** */
+/// @brief Interpolate a 2D image when the whole kernel support, starting at
+/// the previous node, lies in the image
+template<class FloatingTYPE, class InterpolantTYPE>
+inline double reg_interpolateInterior2D(const FloatingTYPE *intensity,
+                                        const int *dim,
+                                        const int *previous,
+                                        const double *xBasis,
+                                        const double *yBasis)
+{
+    const FloatingTYPE *xyPointer=&intensity[(size_t)previous[1]*dim[0]+previous[0]];
+    double value=0.;
+    for(int b=0; b<InterpolantTYPE::size; b++)
+    {
+        value += reg_interpolateLine<FloatingTYPE,InterpolantTYPE::size>(xyPointer, xBasis) *
+              yBasis[b];
+        xyPointer += dim[0];
+    }
+    return value;
+}
+/* *************************************************************** */
+/// @brief Interpolate a 2D image when the kernel support crosses the image
+/// border, the nodes outside of the image take the padding value
+template<class FloatingTYPE, class InterpolantTYPE>
+inline double reg_interpolateBorder2D(const FloatingTYPE *intensity,
+                                      const int *dim,
+                                      const int *previous,
+                                      const double *xBasis,
+                                      const double *yBasis,
+                                      double paddingValue)
+{
+    double value=0.;
+    for(int b=0; b<InterpolantTYPE::size; b++)
+    {
+        int Y= previous[1]+b;
+        double xTempNewValue=0.0;
+        for(int a=0; a<InterpolantTYPE::size; a++)
+        {
+            int X= previous[0]+a;
+            if(-1<X && X<dim[0] &&
+               -1<Y && Y<dim[1])
+            {
+                xTempNewValue +=  static_cast<double>(intensity[(size_t)Y*dim[0]+X]) *
+                      xBasis[a];
+            }
+            else
+            {
+                // paddingValue
+                xTempNewValue +=  paddingValue * xBasis[a];
+            }
+        }
+        value += xTempNewValue * yBasis[b];
+    }
+    return value;
+}
+/* *************************************************************** */
+/// @brief Store an interpolated intensity in the warped image, integer
+/// intensities are rounded and clamped to the datatype range
+template<class FloatingTYPE>
+inline void reg_setWarpedIntensity(FloatingTYPE *warpedIntensity,
+                                   double intensity,
+                                   int datatype)
+{
+    switch(datatype)
+    {
+    case NIFTI_TYPE_FLOAT32:
+    case NIFTI_TYPE_FLOAT64:
+        *warpedIntensity=static_cast<FloatingTYPE>(intensity);
+        break;
+    case NIFTI_TYPE_UINT8:
+        if(intensity!=intensity)
+            intensity=0;
+        intensity=(intensity<=255?reg_round(intensity):255); // 255=2^8-1
+        *warpedIntensity=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
+        break;
+    case NIFTI_TYPE_UINT16:
+        if(intensity!=intensity)
+            intensity=0;
+        intensity=(intensity<=65535?reg_round(intensity):65535); // 65535=2^16-1
+        *warpedIntensity=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
+        break;
+    case NIFTI_TYPE_UINT32:
+        if(intensity!=intensity)
+            intensity=0;
+        intensity=(intensity<=4294967295?reg_round(intensity):4294967295); // 4294967295=2^32-1
+        *warpedIntensity=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
+        break;
+    default:
+        if(intensity!=intensity)
+            intensity=0;
+        *warpedIntensity=static_cast<FloatingTYPE>(reg_round(intensity));
+        break;
+    }
+}
+/* *************************************************************** */
+/* *************************************************************** */
 template <class DTYPE>
 void reg_dti_resampling_preprocessing(nifti_image *floatingImage,
                                       void **originalFloatingData,
@@ -355,13 +583,12 @@ void reg_dti_resampling_postprocessing(nifti_image *inputImage,
     }
 }
 /* *************************************************************** */
-template<class FloatingTYPE, class FieldTYPE>
+template<class FloatingTYPE, class FieldTYPE, class InterpolantTYPE>
 void ResampleImage3D(nifti_image *floatingImage,
                      nifti_image *deformationField,
                      nifti_image *warpedImage,
                      int *mask,
-                     FieldTYPE paddingValue,
-                     int kernel)
+                     FieldTYPE paddingValue)
 {
 #ifdef _WIN32
     long  index;
@@ -385,32 +612,9 @@ void ResampleImage3D(nifti_image *floatingImage,
         floatingIJKMatrix=&(floatingImage->sto_ijk);
     else floatingIJKMatrix=&(floatingImage->qto_ijk);
 
-    // Define the kernel to use
-    int kernel_size;
-    int kernel_offset=0;
-    void (*kernelCompFctPtr)(double,double *);
-    switch(kernel){
-    case 0:
-        kernel_size=2;
-        kernelCompFctPtr=&interpNearestNeighKernel;
-        kernel_offset=0;
-        break; // nereast-neighboor interpolation
-    case 1:
-        kernel_size=2;
-        kernelCompFctPtr=&interpLinearKernel;
-        kernel_offset=0;
-        break; // linear interpolation
-    case 4:
-        kernel_size=SINC_KERNEL_SIZE;
-        kernelCompFctPtr=&interpWindowedSincKernel;
-        kernel_offset=SINC_KERNEL_RADIUS;
-        break; // sinc interpolation
-    default:
-        kernel_size=4;
-        kernelCompFctPtr=&interpCubicSplineKernel;
-        kernel_offset=1;
-        break; // cubic spline interpolation
-    }
+    const int kernel_size=InterpolantTYPE::size;
+    const int floatingDim[3]={floatingImage->nx, floatingImage->ny, floatingImage->nz};
+    const int floatingDatatype=floatingImage->datatype;
 
     // Iteration over the different volume along the 4th axis
     for(size_t t=0; t<(size_t)warpedImage->nt*warpedImage->nu; t++)
@@ -424,19 +628,17 @@ void ResampleImage3D(nifti_image *floatingImage,
         FloatingTYPE *warpedIntensity = &warpedIntensityPtr[t*warpedVoxelNumber];
         FloatingTYPE *floatingIntensity = &floatingIntensityPtr[t*floatingVoxelNumber];
 
-        int a, b, c, Y, Z, previous[3];
+        int previous[3];
 
-        FloatingTYPE *zPointer, *xyzPointer;
-        double xBasis[SINC_KERNEL_SIZE], yBasis[SINC_KERNEL_SIZE], zBasis[SINC_KERNEL_SIZE], relative[3];
-        double xTempNewValue, yTempNewValue, intensity;
+        double xBasis[kernel_size], yBasis[kernel_size], zBasis[kernel_size], relative[3];
+        double intensity;
         float world[3], position[3];
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
-    private(index, intensity, world, position, previous, xBasis, yBasis, zBasis, relative, \
-    a, b, c, Y, Z, zPointer, xyzPointer, xTempNewValue, yTempNewValue) \
-    shared(floatingIntensity, warpedIntensity, warpedVoxelNumber, floatingVoxelNumber, \
+    private(index, intensity, world, position, previous, xBasis, yBasis, zBasis, relative) \
+    shared(floatingIntensity, warpedIntensity, warpedVoxelNumber, \
     deformationFieldPtrX, deformationFieldPtrY, deformationFieldPtrZ, maskPtr, \
-    floatingIJKMatrix, floatingImage, paddingValue, kernel_size, kernel_offset, kernelCompFctPtr)
+    floatingIJKMatrix, floatingDim, floatingDatatype, paddingValue)
 #endif // _OPENMP
         for(index=0; index<warpedVoxelNumber; index++)
         {
@@ -460,112 +662,44 @@ void ResampleImage3D(nifti_image *floatingImage,
                 relative[1]=static_cast<double>(position[1])-static_cast<double>(previous[1]);
                 relative[2]=static_cast<double>(position[2])-static_cast<double>(previous[2]);
 
-                (*kernelCompFctPtr)(relative[0], xBasis);
-                (*kernelCompFctPtr)(relative[1], yBasis);
-                (*kernelCompFctPtr)(relative[2], zBasis);
-                previous[0]-=kernel_offset;
-                previous[1]-=kernel_offset;
-                previous[2]-=kernel_offset;
-
-                intensity=0.0;
-                if(-1<(previous[0]) && (previous[0]+kernel_size-1)<floatingImage->nx &&
-                   -1<(previous[1]) && (previous[1]+kernel_size-1)<floatingImage->ny &&
-                   -1<(previous[2]) && (previous[2]+kernel_size-1)<floatingImage->nz){
-                   for(c=0; c<kernel_size; c++)
-                   {
-                      Z= previous[2]+c;
-                      zPointer = &floatingIntensity[Z*floatingImage->nx*floatingImage->ny];
-                      yTempNewValue=0.0;
-                      for(b=0; b<kernel_size; b++)
-                      {
-                         Y= previous[1]+b;
-                         xyzPointer = &zPointer[Y*floatingImage->nx+previous[0]];
-                         xTempNewValue=0.0;
-                         for(a=0; a<kernel_size; a++)
-                         {
-                            xTempNewValue +=  static_cast<double>(*xyzPointer++) * xBasis[a];
-                         }
-                         yTempNewValue += xTempNewValue * yBasis[b];
-                      }
-                      intensity += yTempNewValue * zBasis[c];
-                   }
-                }
-                else{
-                   for(c=0; c<kernel_size; c++)
-                   {
-                      Z= previous[2]+c;
-                      zPointer = &floatingIntensity[Z*floatingImage->nx*floatingImage->ny];
-                      yTempNewValue=0.0;
-                      for(b=0; b<kernel_size; b++)
-                      {
-                         Y= previous[1]+b;
-                         xyzPointer = &zPointer[Y*floatingImage->nx+previous[0]];
-                         xTempNewValue=0.0;
-                         for(a=0; a<kernel_size; a++)
-                         {
-                            if(-1<(previous[0]+a) && (previous[0]+a)<floatingImage->nx &&
-                               -1<Z && Z<floatingImage->nz &&
-                               -1<Y && Y<floatingImage->ny)
-                            {
-                               xTempNewValue +=  static_cast<double>(*xyzPointer) * xBasis[a];
-                            }
-                            else
-                            {
-                               // paddingValue
-                               xTempNewValue +=  static_cast<double>(paddingValue) * xBasis[a];
-                            }
-                            xyzPointer++;
-                         }
-                         yTempNewValue += xTempNewValue * yBasis[b];
-                      }
-                      intensity += yTempNewValue * zBasis[c];
-                   }
-                }
+                InterpolantTYPE::getBasis(relative[0], xBasis);
+                InterpolantTYPE::getBasis(relative[1], yBasis);
+                InterpolantTYPE::getBasis(relative[2], zBasis);
+                previous[0]-=InterpolantTYPE::offset;
+                previous[1]-=InterpolantTYPE::offset;
+                previous[2]-=InterpolantTYPE::offset;
+
+                if(-1<(previous[0]) && (previous[0]+kernel_size-1)<floatingDim[0] &&
+                   -1<(previous[1]) && (previous[1]+kernel_size-1)<floatingDim[1] &&
+                   -1<(previous[2]) && (previous[2]+kernel_size-1)<floatingDim[2])
+                    intensity=reg_interpolateInterior3D<FloatingTYPE,InterpolantTYPE>(floatingIntensity,
+                                                                                      floatingDim,
+                                                                                      previous,
+                                                                                      xBasis,
+                                                                                      yBasis,
+                                                                                      zBasis);
+                else intensity=reg_interpolateBorder3D<FloatingTYPE,InterpolantTYPE>(floatingIntensity,
+                                                                                     floatingDim,
+                                                                                     previous,
+                                                                                     xBasis,
+                                                                                     yBasis,
+                                                                                     zBasis,
+                                                                                     paddingValue);
             }
 
-            switch(floatingImage->datatype)
-            {
-            case NIFTI_TYPE_FLOAT32:
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity);
-                break;
-            case NIFTI_TYPE_FLOAT64:
-                warpedIntensity[index]=intensity;
-                break;
-            case NIFTI_TYPE_UINT8:
-                if(intensity!=intensity)
-                    intensity=0;
-                intensity=(intensity<=255?reg_round(intensity):255); // 255=2^8-1
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                break;
-            case NIFTI_TYPE_UINT16:
-                if(intensity!=intensity)
-                    intensity=0;
-                intensity=(intensity<=65535?reg_round(intensity):65535); // 65535=2^16-1
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                break;
-            case NIFTI_TYPE_UINT32:
-                if(intensity!=intensity)
-                    intensity=0;
-                intensity=(intensity<=4294967295?reg_round(intensity):4294967295); // 4294967295=2^32-1
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                break;
-            default:
-                if(intensity!=intensity)
-                    intensity=0;
-                warpedIntensity[index]=static_cast<FloatingTYPE>(reg_round(intensity));
-                break;
-            }
+            reg_setWarpedIntensity<FloatingTYPE>(&warpedIntensity[index],
+                                                 intensity,
+                                                 floatingDatatype);
         }
     }
 }
 /* *************************************************************** */
-template<class FloatingTYPE, class FieldTYPE>
+template<class FloatingTYPE, class FieldTYPE, class InterpolantTYPE>
 void ResampleImage2D(nifti_image *floatingImage,
                      nifti_image *deformationField,
                      nifti_image *warpedImage,
                      int *mask,
-                     FieldTYPE paddingValue,
-                     int kernel)
+                     FieldTYPE paddingValue)
 {
 #ifdef _WIN32
     long  index;
@@ -588,31 +722,9 @@ void ResampleImage2D(nifti_image *floatingImage,
         floatingIJKMatrix=&(floatingImage->sto_ijk);
     else floatingIJKMatrix=&(floatingImage->qto_ijk);
 
-    int kernel_size;
-    int kernel_offset=0;
-    void (*kernelCompFctPtr)(double,double *);
-    switch(kernel){
-    case 0:
-        kernel_size=2;
-        kernelCompFctPtr=&interpNearestNeighKernel;
-        kernel_offset=0;
-        break; // nereast-neighboor interpolation
-    case 1:
-        kernel_size=2;
-        kernelCompFctPtr=&interpLinearKernel;
-        kernel_offset=0;
-        break; // linear interpolation
-    case 4:
-        kernel_size=SINC_KERNEL_SIZE;
-        kernelCompFctPtr=&interpWindowedSincKernel;
-        kernel_offset=SINC_KERNEL_RADIUS;
-        break; // sinc interpolation
-    default:
-        kernel_size=4;
-        kernelCompFctPtr=&interpCubicSplineKernel;
-        kernel_offset=1;
-        break; // cubic spline interpolation
-    }
+    const int kernel_size=InterpolantTYPE::size;
+    const int floatingDim[2]={floatingImage->nx, floatingImage->ny};
+    const int floatingDatatype=floatingImage->datatype;
 
     // Iteration over the different volume along the 4th axis
     for(size_t t=0; t<(size_t)warpedImage->nt*warpedImage->nu; t++)
@@ -625,20 +737,18 @@ void ResampleImage2D(nifti_image *floatingImage,
         FloatingTYPE *warpedIntensity = &warpedIntensityPtr[t*warpedVoxelNumber];
         FloatingTYPE *floatingIntensity = &floatingIntensityPtr[t*floatingVoxelNumber];
 
-        int a, b, Y, previous[2];
+        int previous[2];
 
-        FloatingTYPE *xyzPointer;
-        double xBasis[SINC_KERNEL_SIZE], yBasis[SINC_KERNEL_SIZE], relative[2];
-        double xTempNewValue, intensity;
+        double xBasis[kernel_size], yBasis[kernel_size], relative[2];
+        double intensity;
         float world[3] = {0.0, 0.0, 0.0};
         float position[3] = {0.0, 0.0, 0.0};
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
-    private(index, intensity, world, position, previous, xBasis, yBasis, relative, \
-    a, b, Y, xyzPointer, xTempNewValue) \
-    shared(floatingIntensity, warpedIntensity, warpedVoxelNumber, floatingVoxelNumber, \
+    private(index, intensity, world, position, previous, xBasis, yBasis, relative) \
+    shared(floatingIntensity, warpedIntensity, warpedVoxelNumber, \
     deformationFieldPtrX, deformationFieldPtrY, maskPtr, \
-    floatingIJKMatrix, floatingImage, paddingValue, kernel_size, kernel_offset, kernelCompFctPtr)
+    floatingIJKMatrix, floatingDim, floatingDatatype, paddingValue)
 #endif // _OPENMP
         for(index=0; index<warpedVoxelNumber; index++)
         {
@@ -659,61 +769,384 @@ void ResampleImage2D(nifti_image *floatingImage,
                 relative[0] = static_cast<double>(position[0])-static_cast<double>(previous[0]);
                 relative[1] = static_cast<double>(position[1])-static_cast<double>(previous[1]);
 
-                (*kernelCompFctPtr)(relative[0], xBasis);
-                (*kernelCompFctPtr)(relative[1], yBasis);
-                previous[0]-=kernel_offset;
-                previous[1]-=kernel_offset;
+                InterpolantTYPE::getBasis(relative[0], xBasis);
+                InterpolantTYPE::getBasis(relative[1], yBasis);
+                previous[0]-=InterpolantTYPE::offset;
+                previous[1]-=InterpolantTYPE::offset;
+
+                if(-1<(previous[0]) && (previous[0]+kernel_size-1)<floatingDim[0] &&
+                   -1<(previous[1]) && (previous[1]+kernel_size-1)<floatingDim[1])
+                    intensity=reg_interpolateInterior2D<FloatingTYPE,InterpolantTYPE>(floatingIntensity,
+                                                                                      floatingDim,
+                                                                                      previous,
+                                                                                      xBasis,
+                                                                                      yBasis);
+                else intensity=reg_interpolateBorder2D<FloatingTYPE,InterpolantTYPE>(floatingIntensity,
+                                                                                     floatingDim,
+                                                                                     previous,
+                                                                                     xBasis,
+                                                                                     yBasis,
+                                                                                     paddingValue);
+
+                reg_setWarpedIntensity<FloatingTYPE>(&warpedIntensity[index],
+                                                     intensity,
+                                                     floatingDatatype);
+            }
+        }
+    }
+}
+/* *************************************************************** */
+/// @brief Copy the volumes of a 4D/5D image into a channel-last buffer so
+/// that the values of all channels of a voxel are contiguous. The channels of
+/// every voxel are padded with zeros up to channelStride values
+template<class FloatingTYPE>
+FloatingTYPE *reg_getInterleavedChannels(nifti_image *image,
+                                         size_t voxelNumber,
+                                         size_t channelNumber,
+                                         size_t channelStride)
+{
+    FloatingTYPE *imagePtr = static_cast<FloatingTYPE *>(image->data);
+    FloatingTYPE *interleavedPtr = (FloatingTYPE *)malloc(voxelNumber*channelStride*sizeof(FloatingTYPE));
+#ifdef _WIN32
+    long  index;
+    long voxelNumberLong = (long)voxelNumber;
+#else
+    size_t  index;
+    size_t voxelNumberLong = voxelNumber;
+#endif
+    size_t t;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+    private(index, t) \
+    shared(imagePtr, interleavedPtr, voxelNumber, voxelNumberLong, channelNumber, channelStride)
+#endif // _OPENMP
+    for(index=0; index<voxelNumberLong; ++index)
+    {
+        for(t=0; t<channelNumber; ++t)
+            interleavedPtr[index*channelStride+t]=imagePtr[t*voxelNumber+index];
+        for(; t<channelStride; ++t)
+            interleavedPtr[index*channelStride+t]=0;
+    }
+    return interleavedPtr;
+}
+/* *************************************************************** */
+/// @brief Resample all the volumes of a 3D image along its 4th and 5th axes.
+/// The position, basis values and node indices are computed once per warped
+/// voxel and applied to blocks of RESAMPLING_CHANNEL_BLOCK channels of an
+/// interleaved copy of the floating image
+template<class FloatingTYPE, class FieldTYPE, class InterpolantTYPE>
+void ResampleImage3D_MultiChannel(nifti_image *floatingImage,
+                                  nifti_image *deformationField,
+                                  nifti_image *warpedImage,
+                                  int *mask,
+                                  FieldTYPE paddingValue)
+{
+#ifdef _WIN32
+    long  index;
+    long warpedVoxelNumber = (long)warpedImage->nx*warpedImage->ny*warpedImage->nz;
+    long floatingVoxelNumber = (long)floatingImage->nx*floatingImage->ny*floatingImage->nz;
+#else
+    size_t  index;
+    size_t warpedVoxelNumber = (size_t)warpedImage->nx*warpedImage->ny*warpedImage->nz;
+    size_t floatingVoxelNumber = (size_t)floatingImage->nx*floatingImage->ny*floatingImage->nz;
+#endif
+    const size_t channelNumber = (size_t)warpedImage->nt*warpedImage->nu;
+    const size_t channelStride = ((channelNumber+RESAMPLING_CHANNEL_BLOCK-1)/RESAMPLING_CHANNEL_BLOCK) *
+          RESAMPLING_CHANNEL_BLOCK;
+    FloatingTYPE *floatingIntensity = reg_getInterleavedChannels<FloatingTYPE>(floatingImage,
+                                                                              floatingVoxelNumber,
+                                                                              channelNumber,
+                                                                              channelStride);
+    FloatingTYPE *warpedIntensity = static_cast<FloatingTYPE *>(warpedImage->data);
+    FieldTYPE *deformationFieldPtrX = static_cast<FieldTYPE *>(deformationField->data);
+    FieldTYPE *deformationFieldPtrY = &deformationFieldPtrX[warpedVoxelNumber];
+    FieldTYPE *deformationFieldPtrZ = &deformationFieldPtrY[warpedVoxelNumber];
+
+    int *maskPtr = &mask[0];
+
+    mat44 *floatingIJKMatrix;
+    if(floatingImage->sform_code>0)
+        floatingIJKMatrix=&(floatingImage->sto_ijk);
+    else floatingIJKMatrix=&(floatingImage->qto_ijk);
+
+    const int kernel_size=InterpolantTYPE::size;
+    const int floatingDim[3]={floatingImage->nx, floatingImage->ny, floatingImage->nz};
+    const size_t floatingSliceSize=(size_t)floatingDim[0]*floatingDim[1];
+    const int floatingDatatype=floatingImage->datatype;
+
+#ifndef NDEBUG
+    char text[255];
+    sprintf(text, "3D resampling of %zu interleaved volumes",channelNumber);
+    reg_print_msg_debug(text);
+#endif
+
+    int a, b, c, l, X, Y, Z, previous[3];
+    size_t t;
+    bool isInterior;
+    FloatingTYPE *nodePointer;
+    double xBasis[kernel_size], yBasis[kernel_size], zBasis[kernel_size], relative[3];
+    double xTempNewValue[RESAMPLING_CHANNEL_BLOCK], yTempNewValue[RESAMPLING_CHANNEL_BLOCK];
+    double intensity[RESAMPLING_CHANNEL_BLOCK];
+    float world[3], position[3];
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+    private(index, t, world, position, previous, xBasis, yBasis, zBasis, relative, \
+    a, b, c, l, X, Y, Z, isInterior, nodePointer, xTempNewValue, yTempNewValue, intensity) \
+    shared(floatingIntensity, warpedIntensity, warpedVoxelNumber, channelNumber, channelStride, \
+    deformationFieldPtrX, deformationFieldPtrY, deformationFieldPtrZ, maskPtr, \
+    floatingIJKMatrix, floatingDim, floatingSliceSize, floatingDatatype, paddingValue)
+#endif // _OPENMP
+    for(index=0; index<warpedVoxelNumber; index++)
+    {
+        if((maskPtr[index])>-1)
+        {
+            world[0]=static_cast<float>(deformationFieldPtrX[index]);
+            world[1]=static_cast<float>(deformationFieldPtrY[index]);
+            world[2]=static_cast<float>(deformationFieldPtrZ[index]);
+
+            // real -> voxel; floating space
+            reg_mat44_mul(floatingIJKMatrix, world, position);
+
+            previous[0] = static_cast<int>(reg_floor(position[0]));
+            previous[1] = static_cast<int>(reg_floor(position[1]));
+            previous[2] = static_cast<int>(reg_floor(position[2]));
+
+            relative[0]=static_cast<double>(position[0])-static_cast<double>(previous[0]);
+            relative[1]=static_cast<double>(position[1])-static_cast<double>(previous[1]);
+            relative[2]=static_cast<double>(position[2])-static_cast<double>(previous[2]);
+
+            InterpolantTYPE::getBasis(relative[0], xBasis);
+            InterpolantTYPE::getBasis(relative[1], yBasis);
+            InterpolantTYPE::getBasis(relative[2], zBasis);
+            previous[0]-=InterpolantTYPE::offset;
+            previous[1]-=InterpolantTYPE::offset;
+            previous[2]-=InterpolantTYPE::offset;
 
-                intensity=0.0;
+            isInterior=-1<(previous[0]) && (previous[0]+kernel_size-1)<floatingDim[0] &&
+                  -1<(previous[1]) && (previous[1]+kernel_size-1)<floatingDim[1] &&
+                  -1<(previous[2]) && (previous[2]+kernel_size-1)<floatingDim[2];
+
+            // The same weights are applied to every block of channels
+            for(t=0; t<channelNumber; t+=RESAMPLING_CHANNEL_BLOCK)
+            {
+                for(l=0; l<RESAMPLING_CHANNEL_BLOCK; ++l)
+                    intensity[l]=0.0;
+                for(c=0; c<kernel_size; c++)
+                {
+                    Z= previous[2]+c;
+                    for(l=0; l<RESAMPLING_CHANNEL_BLOCK; ++l)
+                        yTempNewValue[l]=0.0;
+                    for(b=0; b<kernel_size; b++)
+                    {
+                        Y= previous[1]+b;
+                        for(l=0; l<RESAMPLING_CHANNEL_BLOCK; ++l)
+                            xTempNewValue[l]=0.0;
+                        for(a=0; a<kernel_size; a++)
+                        {
+                            X= previous[0]+a;
+                            if(isInterior ||
+                               (-1<X && X<floatingDim[0] &&
+                                -1<Z && Z<floatingDim[2] &&
+                                -1<Y && Y<floatingDim[1]))
+                            {
+                                nodePointer = &floatingIntensity[(Z*floatingSliceSize +
+                                      (size_t)Y*floatingDim[0] + X)*channelStride + t];
+                                for(l=0; l<RESAMPLING_CHANNEL_BLOCK; ++l)
+                                    xTempNewValue[l] += static_cast<double>(nodePointer[l]) * xBasis[a];
+                            }
+                            else
+                            {
+                                // paddingValue
+                                for(l=0; l<RESAMPLING_CHANNEL_BLOCK; ++l)
+                                    xTempNewValue[l] += static_cast<double>(paddingValue) * xBasis[a];
+                            }
+                        }
+                        for(l=0; l<RESAMPLING_CHANNEL_BLOCK; ++l)
+                            yTempNewValue[l] += xTempNewValue[l] * yBasis[b];
+                    }
+                    for(l=0; l<RESAMPLING_CHANNEL_BLOCK; ++l)
+                        intensity[l] += yTempNewValue[l] * zBasis[c];
+                }
+                for(l=0; l<RESAMPLING_CHANNEL_BLOCK && t+l<channelNumber; ++l)
+                    reg_setWarpedIntensity<FloatingTYPE>(&warpedIntensity[(t+l)*warpedVoxelNumber+index],
+                                                         intensity[l],
+                                                         floatingDatatype);
+            }
+        }
+        else
+        {
+            for(t=0; t<channelNumber; ++t)
+                reg_setWarpedIntensity<FloatingTYPE>(&warpedIntensity[t*warpedVoxelNumber+index],
+                                                     paddingValue,
+                                                     floatingDatatype);
+        }
+    }
+    free(floatingIntensity);
+}
+/* *************************************************************** */
+/// @brief Resample all the volumes of a 2D image along its 4th and 5th axes,
+/// see ResampleImage3D_MultiChannel
+template<class FloatingTYPE, class FieldTYPE, class InterpolantTYPE>
+void ResampleImage2D_MultiChannel(nifti_image *floatingImage,
+                                  nifti_image *deformationField,
+                                  nifti_image *warpedImage,
+                                  int *mask,
+                                  FieldTYPE paddingValue)
+{
+#ifdef _WIN32
+    long  index;
+    long warpedVoxelNumber = (long)warpedImage->nx*warpedImage->ny;
+    long floatingVoxelNumber = (long)floatingImage->nx*floatingImage->ny;
+#else
+    size_t  index;
+    size_t warpedVoxelNumber = (size_t)warpedImage->nx*warpedImage->ny;
+    size_t floatingVoxelNumber = (size_t)floatingImage->nx*floatingImage->ny;
+#endif
+    const size_t channelNumber = (size_t)warpedImage->nt*warpedImage->nu;
+    const size_t channelStride = ((channelNumber+RESAMPLING_CHANNEL_BLOCK-1)/RESAMPLING_CHANNEL_BLOCK) *
+          RESAMPLING_CHANNEL_BLOCK;
+    FloatingTYPE *floatingIntensity = reg_getInterleavedChannels<FloatingTYPE>(floatingImage,
+                                                                              floatingVoxelNumber,
+                                                                              channelNumber,
+                                                                              channelStride);
+    FloatingTYPE *warpedIntensity = static_cast<FloatingTYPE *>(warpedImage->data);
+    FieldTYPE *deformationFieldPtrX = static_cast<FieldTYPE *>(deformationField->data);
+    FieldTYPE *deformationFieldPtrY = &deformationFieldPtrX[warpedVoxelNumber];
+
+    int *maskPtr = &mask[0];
+
+    mat44 *floatingIJKMatrix;
+    if(floatingImage->sform_code>0)
+        floatingIJKMatrix=&(floatingImage->sto_ijk);
+    else floatingIJKMatrix=&(floatingImage->qto_ijk);
+
+    const int kernel_size=InterpolantTYPE::size;
+    const int floatingDim[2]={floatingImage->nx, floatingImage->ny};
+    const int floatingDatatype=floatingImage->datatype;
+
+#ifndef NDEBUG
+    char text[255];
+    sprintf(text, "2D resampling of %zu interleaved volumes",channelNumber);
+    reg_print_msg_debug(text);
+#endif
+
+    int a, b, l, X, Y, previous[2];
+    size_t t;
+    bool isInterior;
+    FloatingTYPE *nodePointer;
+    double xBasis[kernel_size], yBasis[kernel_size], relative[2];
+    double xTempNewValue[RESAMPLING_CHANNEL_BLOCK], intensity[RESAMPLING_CHANNEL_BLOCK];
+    float world[3] = {0.0, 0.0, 0.0};
+    float position[3] = {0.0, 0.0, 0.0};
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+    private(index, t, world, position, previous, xBasis, yBasis, relative, \
+    a, b, l, X, Y, isInterior, nodePointer, xTempNewValue, intensity) \
+    shared(floatingIntensity, warpedIntensity, warpedVoxelNumber, channelNumber, channelStride, \
+    deformationFieldPtrX, deformationFieldPtrY, maskPtr, \
+    floatingIJKMatrix, floatingDim, floatingDatatype, paddingValue)
+#endif // _OPENMP
+    for(index=0; index<warpedVoxelNumber; index++)
+    {
+        // The voxels outside of the mask are not modified
+        if((maskPtr[index])>-1)
+        {
+            world[0] = static_cast<float>(deformationFieldPtrX[index]);
+            world[1] = static_cast<float>(deformationFieldPtrY[index]);
+            world[2] = 0;
+
+            // real -> voxel; floating space
+            reg_mat44_mul(floatingIJKMatrix, world, position);
+
+            previous[0] = static_cast<int>(reg_floor(position[0]));
+            previous[1] = static_cast<int>(reg_floor(position[1]));
+
+            relative[0] = static_cast<double>(position[0])-static_cast<double>(previous[0]);
+            relative[1] = static_cast<double>(position[1])-static_cast<double>(previous[1]);
+
+            InterpolantTYPE::getBasis(relative[0], xBasis);
+            InterpolantTYPE::getBasis(relative[1], yBasis);
+            previous[0]-=InterpolantTYPE::offset;
+            previous[1]-=InterpolantTYPE::offset;
+
+            isInterior=-1<(previous[0]) && (previous[0]+kernel_size-1)<floatingDim[0] &&
+                  -1<(previous[1]) && (previous[1]+kernel_size-1)<floatingDim[1];
+
+            // The same weights are applied to every block of channels
+            for(t=0; t<channelNumber; t+=RESAMPLING_CHANNEL_BLOCK)
+            {
+                for(l=0; l<RESAMPLING_CHANNEL_BLOCK; ++l)
+                    intensity[l]=0.0;
                 for(b=0; b<kernel_size; b++)
                 {
                     Y= previous[1]+b;
-                    xyzPointer = &floatingIntensity[Y*floatingImage->nx+previous[0]];
-                    xTempNewValue=0.0;
+                    for(l=0; l<RESAMPLING_CHANNEL_BLOCK; ++l)
+                        xTempNewValue[l]=0.0;
                     for(a=0; a<kernel_size; a++)
                     {
-                        if(-1<(previous[0]+a) && (previous[0]+a)<floatingImage->nx &&
-                                -1<Y && Y<floatingImage->ny)
+                        X= previous[0]+a;
+                        if(isInterior ||
+                           (-1<X && X<floatingDim[0] &&
+                            -1<Y && Y<floatingDim[1]))
                         {
-                            xTempNewValue +=  static_cast<double>(*xyzPointer) * xBasis[a];
+                            nodePointer = &floatingIntensity[((size_t)Y*floatingDim[0]+X)*channelStride + t];
+                            for(l=0; l<RESAMPLING_CHANNEL_BLOCK; ++l)
+                                xTempNewValue[l] += static_cast<double>(nodePointer[l]) * xBasis[a];
                         }
                         else
                         {
                             // paddingValue
-                            xTempNewValue +=  static_cast<double>(paddingValue) * xBasis[a];
+                            for(l=0; l<RESAMPLING_CHANNEL_BLOCK; ++l)
+                                xTempNewValue[l] += static_cast<double>(paddingValue) * xBasis[a];
                         }
-                        xyzPointer++;
                     }
-                    intensity += xTempNewValue * yBasis[b];
-                }
-
-                switch(floatingImage->datatype)
-                {
-                case NIFTI_TYPE_FLOAT32:
-                    warpedIntensity[index]=static_cast<FloatingTYPE>(intensity);
-                    break;
-                case NIFTI_TYPE_FLOAT64:
-                    warpedIntensity[index]=intensity;
-                    break;
-                case NIFTI_TYPE_UINT8:
-                    intensity=(intensity<=255?reg_round(intensity):255); // 255=2^8-1
-                    warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                    break;
-                case NIFTI_TYPE_UINT16:
-                    intensity=(intensity<=65535?reg_round(intensity):65535); // 65535=2^16-1
-                    warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                    break;
-                case NIFTI_TYPE_UINT32:
-                    intensity=(intensity<=4294967295?reg_round(intensity):4294967295); // 4294967295=2^32-1
-                    warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                    break;
-                default:
-                    warpedIntensity[index]=static_cast<FloatingTYPE>(reg_round(intensity));
-                    break;
+                    for(l=0; l<RESAMPLING_CHANNEL_BLOCK; ++l)
+                        intensity[l] += xTempNewValue[l] * yBasis[b];
                 }
+                for(l=0; l<RESAMPLING_CHANNEL_BLOCK && t+l<channelNumber; ++l)
+                    reg_setWarpedIntensity<FloatingTYPE>(&warpedIntensity[(t+l)*warpedVoxelNumber+index],
+                                                         intensity[l],
+                                                         floatingDatatype);
             }
         }
     }
+    free(floatingIntensity);
+}
+/* *************************************************************** */
+/// @brief Select at compile time the resampling function specialised for
+/// the interpolation kernel, the image dimension and the number of channels
+template<class FloatingTYPE, class FieldTYPE, class InterpolantTYPE>
+void ResampleImage(nifti_image *floatingImage,
+                   nifti_image *deformationField,
+                   nifti_image *warpedImage,
+                   int *mask,
+                   FieldTYPE paddingValue)
+{
+    // The geometry is shared by all the volumes along the 4th and 5th axes
+    bool multiChannel=(size_t)warpedImage->nt*warpedImage->nu>1;
+    if(deformationField->nz>1 && multiChannel)
+        ResampleImage3D_MultiChannel<FloatingTYPE,FieldTYPE,InterpolantTYPE>(floatingImage,
+                                                                             deformationField,
+                                                                             warpedImage,
+                                                                             mask,
+                                                                             paddingValue);
+    else if(multiChannel)
+        ResampleImage2D_MultiChannel<FloatingTYPE,FieldTYPE,InterpolantTYPE>(floatingImage,
+                                                                             deformationField,
+                                                                             warpedImage,
+                                                                             mask,
+                                                                             paddingValue);
+    else if(deformationField->nz>1)
+        ResampleImage3D<FloatingTYPE,FieldTYPE,InterpolantTYPE>(floatingImage,
+                                                                deformationField,
+                                                                warpedImage,
+                                                                mask,
+                                                                paddingValue);
+    else ResampleImage2D<FloatingTYPE,FieldTYPE,InterpolantTYPE>(floatingImage,
+                                                                 deformationField,
+                                                                 warpedImage,
+                                                                 mask,
+                                                                 paddingValue);
 }
 /* *************************************************************** */
 /* *************************************************************** */
@@ -748,23 +1181,36 @@ void reg_resampleImage2(nifti_image *floatingImage,
                                                    dtIndicies);
 
     // The deformation field contains the position in the real world
-    if(deformationFieldImage->nz>1)
-    {
-        ResampleImage3D<FloatingTYPE,FieldTYPE>(floatingImage,
-                                                deformationFieldImage,
-                                                warpedImage,
-                                                mask,
-                                                paddingValue,
-                                                interp);
-    }
-    else
+    switch(interp)
     {
-        ResampleImage2D<FloatingTYPE,FieldTYPE>(floatingImage,
-                                                deformationFieldImage,
-                                                warpedImage,
-                                                mask,
-                                                paddingValue,
-                                                interp);
+    case 0: // nearest-neighbour interpolation
+        ResampleImage<FloatingTYPE,FieldTYPE,reg_nearestNeighInterpolant>(floatingImage,
+                                                                         deformationFieldImage,
+                                                                         warpedImage,
+                                                                         mask,
+                                                                         paddingValue);
+        break;
+    case 1: // linear interpolation
+        ResampleImage<FloatingTYPE,FieldTYPE,reg_linearInterpolant>(floatingImage,
+                                                                   deformationFieldImage,
+                                                                   warpedImage,
+                                                                   mask,
+                                                                   paddingValue);
+        break;
+    case 4: // sinc interpolation
+        ResampleImage<FloatingTYPE,FieldTYPE,reg_windowedSincInterpolant>(floatingImage,
+                                                                         deformationFieldImage,
+                                                                         warpedImage,
+                                                                         mask,
+                                                                         paddingValue);
+        break;
+    default: // cubic spline interpolation
+        ResampleImage<FloatingTYPE,FieldTYPE,reg_cubicSplineInterpolant>(floatingImage,
+                                                                        deformationFieldImage,
+                                                                        warpedImage,
+                                                                        mask,
+                                                                        paddingValue);
+        break;
     }
     // The temporary logged floating array is deleted and the original restored
     if(originalFloatingData!=NULL)
@@ -1027,6 +1473,368 @@ void reg_resampleImage(nifti_image *floatingImage,
     }
 }
 /* *************************************************************** */
+/* *************************************************************** */
+/// @brief Resample a 3D image through an affine transformation. The voxel
+/// matrix maps the warped voxel indices onto the floating voxel indices. The
+/// floating position is stepped along every line of the warped image by
+/// adding the first matrix column, so no deformation field is required
+template<class FloatingTYPE, class InterpolantTYPE>
+void ResampleImage3D_Affine(nifti_image *floatingImage,
+                            nifti_image *warpedImage,
+                            double voxelMatrix[4][4],
+                            int *mask,
+                            double paddingValue)
+{
+    const size_t warpedVoxelNumber = (size_t)warpedImage->nx*warpedImage->ny*warpedImage->nz;
+    const size_t floatingVoxelNumber = (size_t)floatingImage->nx*floatingImage->ny*floatingImage->nz;
+    const size_t channelNumber = (size_t)warpedImage->nt*warpedImage->nu;
+    FloatingTYPE *floatingIntensityPtr = static_cast<FloatingTYPE *>(floatingImage->data);
+    FloatingTYPE *warpedIntensityPtr = static_cast<FloatingTYPE *>(warpedImage->data);
+
+    const int kernel_size=InterpolantTYPE::size;
+    const int floatingDim[3]={floatingImage->nx, floatingImage->ny, floatingImage->nz};
+    const int floatingDatatype=floatingImage->datatype;
+    const int warpedDim[3]={warpedImage->nx, warpedImage->ny, warpedImage->nz};
+    const int lineNumber=warpedDim[1]*warpedDim[2];
+
+#ifndef NDEBUG
+    char text[255];
+    sprintf(text, "3D affine resampling of %zu volume(s)",channelNumber);
+    reg_print_msg_debug(text);
+#endif
+
+    int line, x, i, previous[3];
+    size_t index, t;
+    double xBasis[kernel_size], yBasis[kernel_size], zBasis[kernel_size];
+    double position[3], relative[3], intensity;
+    bool isInterior;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+    private(line, x, i, index, t, previous, xBasis, yBasis, zBasis, \
+    position, relative, intensity, isInterior) \
+    shared(floatingIntensityPtr, warpedIntensityPtr, warpedVoxelNumber, floatingVoxelNumber, \
+    channelNumber, voxelMatrix, mask, floatingDim, floatingDatatype, warpedDim, lineNumber, \
+    paddingValue)
+#endif // _OPENMP
+    for(line=0; line<lineNumber; ++line)
+    {
+        // The floating position of the first voxel of the line
+        for(i=0; i<3; ++i)
+            position[i]=voxelMatrix[i][1]*static_cast<double>(line%warpedDim[1]) +
+                  voxelMatrix[i][2]*static_cast<double>(line/warpedDim[1]) +
+                  voxelMatrix[i][3];
+        index=(size_t)line*warpedDim[0];
+        for(x=0; x<warpedDim[0]; ++x, ++index)
+        {
+            if(mask[index]>-1)
+            {
+                for(i=0; i<3; ++i)
+                {
+                    previous[i] = static_cast<int>(reg_floor(position[i]));
+                    relative[i] = position[i]-static_cast<double>(previous[i]);
+                }
+                InterpolantTYPE::getBasis(relative[0], xBasis);
+                InterpolantTYPE::getBasis(relative[1], yBasis);
+                InterpolantTYPE::getBasis(relative[2], zBasis);
+                previous[0]-=InterpolantTYPE::offset;
+                previous[1]-=InterpolantTYPE::offset;
+                previous[2]-=InterpolantTYPE::offset;
+
+                isInterior=-1<(previous[0]) && (previous[0]+kernel_size-1)<floatingDim[0] &&
+                      -1<(previous[1]) && (previous[1]+kernel_size-1)<floatingDim[1] &&
+                      -1<(previous[2]) && (previous[2]+kernel_size-1)<floatingDim[2];
+                for(t=0; t<channelNumber; ++t)
+                {
+                    if(isInterior)
+                        intensity=reg_interpolateInterior3D<FloatingTYPE,InterpolantTYPE>(&floatingIntensityPtr[t*floatingVoxelNumber],
+                                                                                          floatingDim,
+                                                                                          previous,
+                                                                                          xBasis,
+                                                                                          yBasis,
+                                                                                          zBasis);
+                    else intensity=reg_interpolateBorder3D<FloatingTYPE,InterpolantTYPE>(&floatingIntensityPtr[t*floatingVoxelNumber],
+                                                                                         floatingDim,
+                                                                                         previous,
+                                                                                         xBasis,
+                                                                                         yBasis,
+                                                                                         zBasis,
+                                                                                         paddingValue);
+                    reg_setWarpedIntensity<FloatingTYPE>(&warpedIntensityPtr[t*warpedVoxelNumber+index],
+                                                         intensity,
+                                                         floatingDatatype);
+                }
+            }
+            else
+            {
+                for(t=0; t<channelNumber; ++t)
+                    reg_setWarpedIntensity<FloatingTYPE>(&warpedIntensityPtr[t*warpedVoxelNumber+index],
+                                                         paddingValue,
+                                                         floatingDatatype);
+            }
+            // Step to the next voxel of the line
+            for(i=0; i<3; ++i)
+                position[i]+=voxelMatrix[i][0];
+        }
+    }
+}
+/* *************************************************************** */
+/// @brief Resample a 2D image through an affine transformation, see
+/// ResampleImage3D_Affine. The voxels outside of the mask are not modified
+template<class FloatingTYPE, class InterpolantTYPE>
+void ResampleImage2D_Affine(nifti_image *floatingImage,
+                            nifti_image *warpedImage,
+                            double voxelMatrix[4][4],
+                            int *mask,
+                            double paddingValue)
+{
+    const size_t warpedVoxelNumber = (size_t)warpedImage->nx*warpedImage->ny;
+    const size_t floatingVoxelNumber = (size_t)floatingImage->nx*floatingImage->ny;
+    const size_t channelNumber = (size_t)warpedImage->nt*warpedImage->nu;
+    FloatingTYPE *floatingIntensityPtr = static_cast<FloatingTYPE *>(floatingImage->data);
+    FloatingTYPE *warpedIntensityPtr = static_cast<FloatingTYPE *>(warpedImage->data);
+
+    const int kernel_size=InterpolantTYPE::size;
+    const int floatingDim[2]={floatingImage->nx, floatingImage->ny};
+    const int floatingDatatype=floatingImage->datatype;
+    const int warpedDim[2]={warpedImage->nx, warpedImage->ny};
+
+#ifndef NDEBUG
+    char text[255];
+    sprintf(text, "2D affine resampling of %zu volume(s)",channelNumber);
+    reg_print_msg_debug(text);
+#endif
+
+    int y, x, i, previous[2];
+    size_t index, t;
+    double xBasis[kernel_size], yBasis[kernel_size];
+    double position[2], relative[2], intensity;
+    bool isInterior;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+    private(y, x, i, index, t, previous, xBasis, yBasis, \
+    position, relative, intensity, isInterior) \
+    shared(floatingIntensityPtr, warpedIntensityPtr, warpedVoxelNumber, floatingVoxelNumber, \
+    channelNumber, voxelMatrix, mask, floatingDim, floatingDatatype, warpedDim, paddingValue)
+#endif // _OPENMP
+    for(y=0; y<warpedDim[1]; ++y)
+    {
+        // The floating position of the first voxel of the line
+        for(i=0; i<2; ++i)
+            position[i]=voxelMatrix[i][1]*static_cast<double>(y) + voxelMatrix[i][3];
+        index=(size_t)y*warpedDim[0];
+        for(x=0; x<warpedDim[0]; ++x, ++index)
+        {
+            if(mask[index]>-1)
+            {
+                for(i=0; i<2; ++i)
+                {
+                    previous[i] = static_cast<int>(reg_floor(position[i]));
+                    relative[i] = position[i]-static_cast<double>(previous[i]);
+                }
+                InterpolantTYPE::getBasis(relative[0], xBasis);
+                InterpolantTYPE::getBasis(relative[1], yBasis);
+                previous[0]-=InterpolantTYPE::offset;
+                previous[1]-=InterpolantTYPE::offset;
+
+                isInterior=-1<(previous[0]) && (previous[0]+kernel_size-1)<floatingDim[0] &&
+                      -1<(previous[1]) && (previous[1]+kernel_size-1)<floatingDim[1];
+                for(t=0; t<channelNumber; ++t)
+                {
+                    if(isInterior)
+                        intensity=reg_interpolateInterior2D<FloatingTYPE,InterpolantTYPE>(&floatingIntensityPtr[t*floatingVoxelNumber],
+                                                                                          floatingDim,
+                                                                                          previous,
+                                                                                          xBasis,
+                                                                                          yBasis);
+                    else intensity=reg_interpolateBorder2D<FloatingTYPE,InterpolantTYPE>(&floatingIntensityPtr[t*floatingVoxelNumber],
+                                                                                         floatingDim,
+                                                                                         previous,
+                                                                                         xBasis,
+                                                                                         yBasis,
+                                                                                         paddingValue);
+                    reg_setWarpedIntensity<FloatingTYPE>(&warpedIntensityPtr[t*warpedVoxelNumber+index],
+                                                         intensity,
+                                                         floatingDatatype);
+                }
+            }
+            // Step to the next voxel of the line
+            for(i=0; i<2; ++i)
+                position[i]+=voxelMatrix[i][0];
+        }
+    }
+}
+/* *************************************************************** */
+template<class FloatingTYPE, class InterpolantTYPE>
+void ResampleImage_Affine(nifti_image *floatingImage,
+                          nifti_image *warpedImage,
+                          double voxelMatrix[4][4],
+                          int *mask,
+                          double paddingValue)
+{
+    if(warpedImage->nz>1)
+        ResampleImage3D_Affine<FloatingTYPE,InterpolantTYPE>(floatingImage,
+                                                             warpedImage,
+                                                             voxelMatrix,
+                                                             mask,
+                                                             paddingValue);
+    else ResampleImage2D_Affine<FloatingTYPE,InterpolantTYPE>(floatingImage,
+                                                              warpedImage,
+                                                              voxelMatrix,
+                                                              mask,
+                                                              paddingValue);
+}
+/* *************************************************************** */
+template<class FloatingTYPE>
+void reg_resampleImage_affine2(nifti_image *floatingImage,
+                               nifti_image *warpedImage,
+                               double voxelMatrix[4][4],
+                               int *mask,
+                               int interp,
+                               double paddingValue)
+{
+    switch(interp)
+    {
+    case 0: // nearest-neighbour interpolation
+        ResampleImage_Affine<FloatingTYPE,reg_nearestNeighInterpolant>(floatingImage,
+                                                                      warpedImage,
+                                                                      voxelMatrix,
+                                                                      mask,
+                                                                      paddingValue);
+        break;
+    case 1: // linear interpolation
+        ResampleImage_Affine<FloatingTYPE,reg_linearInterpolant>(floatingImage,
+                                                                warpedImage,
+                                                                voxelMatrix,
+                                                                mask,
+                                                                paddingValue);
+        break;
+    case 4: // sinc interpolation
+        ResampleImage_Affine<FloatingTYPE,reg_windowedSincInterpolant>(floatingImage,
+                                                                      warpedImage,
+                                                                      voxelMatrix,
+                                                                      mask,
+                                                                      paddingValue);
+        break;
+    default: // cubic spline interpolation
+        ResampleImage_Affine<FloatingTYPE,reg_cubicSplineInterpolant>(floatingImage,
+                                                                     warpedImage,
+                                                                     voxelMatrix,
+                                                                     mask,
+                                                                     paddingValue);
+        break;
+    }
+}
+/* *************************************************************** */
+void reg_resampleImage_affine(nifti_image *floatingImage,
+                              nifti_image *warpedImage,
+                              mat44 *affineTransformation,
+                              int *mask,
+                              int interp,
+                              float paddingValue)
+{
+    if(floatingImage->datatype != warpedImage->datatype)
+    {
+        reg_print_fct_error("reg_resampleImage_affine");
+        reg_print_msg_error("The floating and warped image should have the same data type");
+        reg_exit();
+    }
+
+    if(floatingImage->nt != warpedImage->nt)
+    {
+        reg_print_fct_error("reg_resampleImage_affine");
+        reg_print_msg_error("The floating and warped images have different dimension along the time axis");
+        reg_exit();
+    }
+
+    // a mask array is created if no mask is specified
+    bool MrPropreRules = false;
+    if(mask==NULL)
+    {
+        // voxels in the background are set to negative value so 0 corresponds to active voxel
+        mask=(int *)calloc(warpedImage->nx*warpedImage->ny*warpedImage->nz,sizeof(int));
+        MrPropreRules = true;
+    }
+
+    // The warped voxel to floating voxel matrix is composed in double precision
+    mat44 *warpedXYZMatrix, *floatingIJKMatrix;
+    if(warpedImage->sform_code>0)
+        warpedXYZMatrix=&(warpedImage->sto_xyz);
+    else warpedXYZMatrix=&(warpedImage->qto_xyz);
+    if(floatingImage->sform_code>0)
+        floatingIJKMatrix=&(floatingImage->sto_ijk);
+    else floatingIJKMatrix=&(floatingImage->qto_ijk);
+    double worldMatrix[4][4], voxelMatrix[4][4];
+    for(int i=0; i<4; ++i)
+    {
+        for(int j=0; j<4; ++j)
+        {
+            worldMatrix[i][j]=0.;
+            for(int k=0; k<4; ++k)
+                worldMatrix[i][j]+=static_cast<double>(affineTransformation->m[i][k]) *
+                      static_cast<double>(warpedXYZMatrix->m[k][j]);
+        }
+    }
+    // As in reg_resampleImage, the 2D positions lie in the z=0 plane
+    if(warpedImage->nz==1)
+        for(int j=0; j<4; ++j)
+            worldMatrix[2][j]=0.;
+    for(int i=0; i<4; ++i)
+    {
+        for(int j=0; j<4; ++j)
+        {
+            voxelMatrix[i][j]=0.;
+            for(int k=0; k<4; ++k)
+                voxelMatrix[i][j]+=static_cast<double>(floatingIJKMatrix->m[i][k]) *
+                      worldMatrix[k][j];
+        }
+    }
+
+    switch ( floatingImage->datatype )
+    {
+    case NIFTI_TYPE_UINT8:
+        reg_resampleImage_affine2<unsigned char>(floatingImage, warpedImage, voxelMatrix,
+                                                 mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_INT8:
+        reg_resampleImage_affine2<char>(floatingImage, warpedImage, voxelMatrix,
+                                        mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_UINT16:
+        reg_resampleImage_affine2<unsigned short>(floatingImage, warpedImage, voxelMatrix,
+                                                  mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_INT16:
+        reg_resampleImage_affine2<short>(floatingImage, warpedImage, voxelMatrix,
+                                         mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_UINT32:
+        reg_resampleImage_affine2<unsigned int>(floatingImage, warpedImage, voxelMatrix,
+                                                mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_INT32:
+        reg_resampleImage_affine2<int>(floatingImage, warpedImage, voxelMatrix,
+                                       mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_FLOAT32:
+        reg_resampleImage_affine2<float>(floatingImage, warpedImage, voxelMatrix,
+                                         mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_FLOAT64:
+        reg_resampleImage_affine2<double>(floatingImage, warpedImage, voxelMatrix,
+                                          mask, interp, paddingValue);
+        break;
+    default:
+        reg_print_fct_error("reg_resampleImage_affine");
+        reg_print_msg_error("The floating image data type is not supported");
+        reg_exit();
+    }
+    if(MrPropreRules==true)
+    {
+        free(mask);
+        mask=NULL;
+    }
+}
+/* *************************************************************** */
 
 template<class FloatingTYPE, class FieldTYPE>
 void ResampleImage3D_PSF_Sinc(nifti_image *floatingImage,
@@ -2921,7 +3729,7 @@ void CubicSplineImageGradient3D(nifti_image *floatingImage,
         grad[1]=0.0;
         grad[2]=0.0;
 
-        if((*maskPtr++)>-1)
+        if(maskPtr[index]>-1)
         {
 
             world[0]=(FieldTYPE) deformationFieldPtrX[index];
@@ -42,6 +42,28 @@ void reg_resampleImage(nifti_image *floatingImage,
                        float paddingValue,
                        bool *dti_timepoint = NULL,
                        mat33 * jacMat = NULL);
+/** @brief Resample a floating image into the space of a warped image using an
+ * affine transformation. The result is equivalent to reg_affine_getDeformationField
+ * followed by reg_resampleImage but no deformation field is computed: the floating
+ * voxel positions are stepped along the lines of the warped image.
+ * @param floatingImage Floating image that is interpolated
+ * @param warpedImage Warped image that is being generated, its header defines
+ * the reference space
+ * @param affineTransformation Affine transformation in real coordinates
+ * @param mask Array that contains information about the mask. Only voxel with mask value different
+ * from zero are being considered. If NULL, all voxels are considered
+ * @param interp Interpolation type. 0, 1, 3 or 4 correspond to nearest neighbor, linear,
+ * cubic or sinc interpolation
+ * @param paddingValue Value to be used for padding when the correspondences are outside of the
+ * reference image space.
+ */
+extern "C++"
+void reg_resampleImage_affine(nifti_image *floatingImage,
+                              nifti_image *warpedImage,
+                              mat44 *affineTransformation,
+                              int *mask,
+                              int interp,
+                              float paddingValue);
 extern "C++"
 void reg_resampleImage_PSF(nifti_image *floatingImage,
                            nifti_image *warpedImage,
@@ -20,12 +20,24 @@ reg_ssd::reg_ssd()
    : reg_measure()
 {
    memset(this->normaliseTimePoint,0,255*sizeof(bool) );
+   this->tileThreadNumber=0;
+   this->tileSSDValue=NULL;
+   this->tileWeightValue=NULL;
 #ifndef NDEBUG
    reg_print_msg_debug("reg_ssd constructor called");
 #endif
 }
 /* *************************************************************** */
 /* *************************************************************** */
+reg_ssd::~reg_ssd()
+{
+   if(this->tileSSDValue!=NULL)
+      free(this->tileSSDValue);
+   if(this->tileWeightValue!=NULL)
+      free(this->tileWeightValue);
+}
+/* *************************************************************** */
+/* *************************************************************** */
 void reg_ssd::InitialiseMeasure(nifti_image *refImgPtr,
                                 nifti_image *floImgPtr,
                                 int *maskRefPtr,
@@ -510,6 +522,407 @@ void reg_ssd::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
 }
 /* *************************************************************** */
 /* *************************************************************** */
+/// @brief Computes the sum of squared differences and the sum of weights
+/// over a box of the reference space for one time point. The warped values
+/// are read from the local image when specified, from the warped image otherwise
+template <class DTYPE>
+void reg_getSSDRegionSums(nifti_image *referenceImage,
+                          nifti_image *warpedImage,
+                          nifti_image *localWarpedImage,
+                          int *mask,
+                          nifti_image *localWeightSimImage,
+                          int *regionStart,
+                          int *regionSize,
+                          int time,
+                          double *ssdValue,
+                          double *weightValue)
+{
+   size_t voxelNumber = (size_t)referenceImage->nx*referenceImage->ny*referenceImage->nz;
+   DTYPE *currentRefPtr=&static_cast<DTYPE *>(referenceImage->data)[time*voxelNumber];
+   DTYPE *currentWarPtr=NULL;
+   float warSlope=warpedImage->scl_slope, warInter=warpedImage->scl_inter;
+   if(localWarpedImage==NULL)
+      currentWarPtr=&static_cast<DTYPE *>(warpedImage->data)[time*voxelNumber];
+   else currentWarPtr=&static_cast<DTYPE *>(localWarpedImage->data)
+         [(size_t)time*regionSize[0]*regionSize[1]*regionSize[2]];
+   DTYPE *localWeightPtr=NULL;
+   if(localWeightSimImage!=NULL)
+      localWeightPtr=static_cast<DTYPE *>(localWeightSimImage->data);
+
+   double SSD_local=0., n=0., refValue, warValue, diff;
+   size_t voxel, warIndex;
+   int z, y, x;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(referenceImage, currentRefPtr, currentWarPtr, mask, localWeightPtr, \
+   localWarpedImage, regionStart, regionSize, warSlope, warInter) \
+   private(z, y, x, voxel, warIndex, refValue, warValue, diff) \
+   reduction(+:SSD_local) \
+   reduction(+:n)
+#endif
+   for(z=0; z<regionSize[2]; ++z)
+   {
+      for(y=0; y<regionSize[1]; ++y)
+      {
+         voxel=((size_t)(z+regionStart[2])*referenceImage->ny+y+regionStart[1]) *
+               referenceImage->nx+regionStart[0];
+         warIndex=((size_t)z*regionSize[1]+y)*regionSize[0];
+         for(x=0; x<regionSize[0]; ++x, ++voxel, ++warIndex)
+         {
+            // Check if the current voxel belongs to the mask
+            if(mask[voxel]>-1)
+            {
+               refValue = (double)(currentRefPtr[voxel] * referenceImage->scl_slope +
+                                   referenceImage->scl_inter);
+               warValue = (double)(currentWarPtr[localWarpedImage==NULL?voxel:warIndex] *
+                     warSlope + warInter);
+               // Ensure that both ref and warped values are defined
+               if(refValue==refValue && warValue==warValue)
+               {
+#ifdef MRF_USE_SAD
+                  diff = fabs(refValue-warValue);
+#else
+                  diff = reg_pow2(refValue-warValue);
+#endif
+                  if(localWeightPtr!=NULL)
+                  {
+                     SSD_local += diff * localWeightPtr[voxel];
+                     n += localWeightPtr[voxel];
+                  }
+                  else
+                  {
+                     SSD_local += diff;
+                     n += 1.0;
+                  }
+               }
+            }
+         }
+      }
+   }
+   *ssdValue=SSD_local;
+   *weightValue=n;
+}
+/* *************************************************************** */
+void reg_ssd::InitialiseLocalSimilarityMeasure()
+{
+   int regionStart[3]={0,0,0};
+   int regionSize[3]={this->referenceImagePointer->nx,
+                      this->referenceImagePointer->ny,
+                      this->referenceImagePointer->nz};
+   for(int t=0; t<this->referenceImagePointer->nt; ++t)
+   {
+      this->localSSDValue[t]=this->localWeightValue[t]=0.;
+      if(this->timePointWeight[t]>0.0)
+      {
+         switch(this->referenceImagePointer->datatype)
+         {
+         case NIFTI_TYPE_FLOAT32:
+            reg_getSSDRegionSums<float>(this->referenceImagePointer,
+                                        this->warpedFloatingImagePointer,
+                                        NULL,
+                                        this->referenceMaskPointer,
+                                        this->forwardLocalWeightSimImagePointer,
+                                        regionStart,
+                                        regionSize,
+                                        t,
+                                        &this->localSSDValue[t],
+                                        &this->localWeightValue[t]);
+            break;
+         case NIFTI_TYPE_FLOAT64:
+            reg_getSSDRegionSums<double>(this->referenceImagePointer,
+                                         this->warpedFloatingImagePointer,
+                                         NULL,
+                                         this->referenceMaskPointer,
+                                         this->forwardLocalWeightSimImagePointer,
+                                         regionStart,
+                                         regionSize,
+                                         t,
+                                         &this->localSSDValue[t],
+                                         &this->localWeightValue[t]);
+            break;
+         default:
+            reg_print_fct_error("reg_ssd::InitialiseLocalSimilarityMeasure");
+            reg_print_msg_error("Warped pixel type unsupported");
+            reg_exit();
+         }
+      }
+   }
+#ifndef NDEBUG
+   reg_print_msg_debug("reg_ssd::InitialiseLocalSimilarityMeasure called");
+#endif
+}
+/* *************************************************************** */
+double reg_ssd::GetLocalSimilarityMeasureValue(nifti_image *localWarpedImage,
+                                               int *regionStart)
+{
+   // The backward term is not local and the full measure is thus computed
+   if(this->isSymmetric)
+      return reg_measure::GetLocalSimilarityMeasureValue(localWarpedImage, regionStart);
+
+   int regionSize[3]={localWarpedImage->nx,
+                      localWarpedImage->ny,
+                      localWarpedImage->nz};
+   double SSDValue=0., baseSSD, baseWeight, newSSD, newWeight;
+   for(int t=0; t<this->referenceImagePointer->nt; ++t)
+   {
+      if(this->timePointWeight[t]>0.0)
+      {
+         // The region contribution is replaced by the local image one
+         switch(this->referenceImagePointer->datatype)
+         {
+         case NIFTI_TYPE_FLOAT32:
+            reg_getSSDRegionSums<float>(this->referenceImagePointer,
+                                        this->warpedFloatingImagePointer,
+                                        NULL,
+                                        this->referenceMaskPointer,
+                                        this->forwardLocalWeightSimImagePointer,
+                                        regionStart,
+                                        regionSize,
+                                        t,
+                                        &baseSSD,
+                                        &baseWeight);
+            reg_getSSDRegionSums<float>(this->referenceImagePointer,
+                                        this->warpedFloatingImagePointer,
+                                        localWarpedImage,
+                                        this->referenceMaskPointer,
+                                        this->forwardLocalWeightSimImagePointer,
+                                        regionStart,
+                                        regionSize,
+                                        t,
+                                        &newSSD,
+                                        &newWeight);
+            break;
+         case NIFTI_TYPE_FLOAT64:
+            reg_getSSDRegionSums<double>(this->referenceImagePointer,
+                                         this->warpedFloatingImagePointer,
+                                         NULL,
+                                         this->referenceMaskPointer,
+                                         this->forwardLocalWeightSimImagePointer,
+                                         regionStart,
+                                         regionSize,
+                                         t,
+                                         &baseSSD,
+                                         &baseWeight);
+            reg_getSSDRegionSums<double>(this->referenceImagePointer,
+                                         this->warpedFloatingImagePointer,
+                                         localWarpedImage,
+                                         this->referenceMaskPointer,
+                                         this->forwardLocalWeightSimImagePointer,
+                                         regionStart,
+                                         regionSize,
+                                         t,
+                                         &newSSD,
+                                         &newWeight);
+            break;
+         default:
+            reg_print_fct_error("reg_ssd::GetLocalSimilarityMeasureValue");
+            reg_print_msg_error("Warped pixel type unsupported");
+            reg_exit();
+         }
+         SSDValue -= this->timePointWeight[t] *
+               (this->localSSDValue[t] - baseSSD + newSSD) /
+               (this->localWeightValue[t] - baseWeight + newWeight);
+      }
+   }
+   return SSDValue;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+void reg_ssd::InitialiseTileSimilarityMeasure(int threadNumber)
+{
+   if(threadNumber!=this->tileThreadNumber)
+   {
+      if(this->tileSSDValue!=NULL) free(this->tileSSDValue);
+      if(this->tileWeightValue!=NULL) free(this->tileWeightValue);
+      this->tileSSDValue=(double *)malloc(threadNumber*255*sizeof(double));
+      this->tileWeightValue=(double *)malloc(threadNumber*255*sizeof(double));
+      this->tileThreadNumber=threadNumber;
+   }
+   memset(this->tileSSDValue,0,threadNumber*255*sizeof(double));
+   memset(this->tileWeightValue,0,threadNumber*255*sizeof(double));
+}
+/* *************************************************************** */
+void reg_ssd::AccumulateTileSimilarityMeasure(nifti_image *localWarpedImage,
+                                              int *regionStart,
+                                              int threadIndex)
+{
+   int regionSize[3]={localWarpedImage->nx,
+                      localWarpedImage->ny,
+                      localWarpedImage->nz};
+   double ssdValue, weightValue;
+   for(int t=0; t<this->referenceImagePointer->nt; ++t)
+   {
+      if(this->timePointWeight[t]>0.0)
+      {
+         switch(this->referenceImagePointer->datatype)
+         {
+         case NIFTI_TYPE_FLOAT32:
+            reg_getSSDRegionSums<float>(this->referenceImagePointer,
+                                        this->warpedFloatingImagePointer,
+                                        localWarpedImage,
+                                        this->referenceMaskPointer,
+                                        this->forwardLocalWeightSimImagePointer,
+                                        regionStart,
+                                        regionSize,
+                                        t,
+                                        &ssdValue,
+                                        &weightValue);
+            break;
+         case NIFTI_TYPE_FLOAT64:
+            reg_getSSDRegionSums<double>(this->referenceImagePointer,
+                                         this->warpedFloatingImagePointer,
+                                         localWarpedImage,
+                                         this->referenceMaskPointer,
+                                         this->forwardLocalWeightSimImagePointer,
+                                         regionStart,
+                                         regionSize,
+                                         t,
+                                         &ssdValue,
+                                         &weightValue);
+            break;
+         default:
+            reg_print_fct_error("reg_ssd::AccumulateTileSimilarityMeasure");
+            reg_print_msg_error("Warped pixel type unsupported");
+            reg_exit();
+         }
+         this->tileSSDValue[threadIndex*255+t] += ssdValue;
+         this->tileWeightValue[threadIndex*255+t] += weightValue;
+      }
+   }
+}
+/* *************************************************************** */
+double reg_ssd::GetTileSimilarityMeasureValue()
+{
+   double SSDValue=0.;
+   for(int t=0; t<this->referenceImagePointer->nt; ++t)
+   {
+      this->tileActiveWeight[t]=0.;
+      if(this->timePointWeight[t]>0.0)
+      {
+         // The thread sums are merged in a fixed order
+         double SSD_local=0.;
+         for(int i=0; i<this->tileThreadNumber; ++i)
+         {
+            SSD_local += this->tileSSDValue[i*255+t];
+            this->tileActiveWeight[t] += this->tileWeightValue[i*255+t];
+         }
+         SSD_local *= this->timePointWeight[t];
+         this->currentValue[t]=-SSD_local;
+         SSDValue -= SSD_local/this->tileActiveWeight[t];
+      }
+   }
+   return SSDValue;
+}
+/* *************************************************************** */
+/// @brief Add the voxel based ssd gradient of a box of the reference space
+/// to the measure gradient image. The warped values and their spatial gradient
+/// are read from local images of the box size
+template <class DTYPE>
+void reg_getVoxelBasedSSDGradientRegion(nifti_image *referenceImage,
+                                        nifti_image *localWarpedImage,
+                                        nifti_image *localWarpedGradient,
+                                        nifti_image *measureGradientImage,
+                                        int *mask,
+                                        nifti_image *localWeightSimImage,
+                                        int *regionStart,
+                                        int time,
+                                        double adjusted_weight)
+{
+   size_t voxelNumber = (size_t)referenceImage->nx*referenceImage->ny*referenceImage->nz;
+   size_t localVoxelNumber = (size_t)localWarpedImage->nx*localWarpedImage->ny*localWarpedImage->nz;
+   DTYPE *currentRefPtr=&static_cast<DTYPE *>(referenceImage->data)[time*voxelNumber];
+   DTYPE *currentWarPtr=&static_cast<DTYPE *>(localWarpedImage->data)[time*localVoxelNumber];
+   DTYPE *localWeightPtr=NULL;
+   if(localWeightSimImage!=NULL)
+      localWeightPtr=static_cast<DTYPE *>(localWeightSimImage->data);
+   int dim = referenceImage->nz>1?3:2;
+   DTYPE *spatialGradPtr[3], *measureGradPtr[3];
+   for(int d=0; d<dim; ++d)
+   {
+      spatialGradPtr[d]=&static_cast<DTYPE *>(localWarpedGradient->data)[d*localVoxelNumber];
+      measureGradPtr[d]=&static_cast<DTYPE *>(measureGradientImage->data)[d*voxelNumber];
+   }
+   double refValue, warValue, common;
+   size_t localIndex=0;
+   for(int z=0; z<localWarpedImage->nz; ++z)
+   {
+      for(int y=0; y<localWarpedImage->ny; ++y)
+      {
+         size_t voxel=((size_t)(z+regionStart[2])*referenceImage->ny+y+regionStart[1]) *
+               referenceImage->nx+regionStart[0];
+         for(int x=0; x<localWarpedImage->nx; ++x, ++voxel, ++localIndex)
+         {
+            if(mask[voxel]>-1)
+            {
+               refValue = (double)(currentRefPtr[voxel] * referenceImage->scl_slope +
+                                   referenceImage->scl_inter);
+               warValue = (double)(currentWarPtr[localIndex] * localWarpedImage->scl_slope +
+                                   localWarpedImage->scl_inter);
+               if(refValue==refValue && warValue==warValue)
+               {
+#ifdef MRF_USE_SAD
+                  common = refValue>warValue?-1.f:1.f;
+                  common *= (refValue - warValue);
+#else
+                  common = -2.0 * (refValue - warValue);
+#endif
+                  if(localWeightPtr!=NULL)
+                     common *= localWeightPtr[voxel];
+                  common *= adjusted_weight;
+                  for(int d=0; d<dim; ++d)
+                  {
+                     if(spatialGradPtr[d][localIndex]==spatialGradPtr[d][localIndex])
+                        measureGradPtr[d][voxel] += (DTYPE)(common * spatialGradPtr[d][localIndex]);
+                  }
+               }
+            }
+         }
+      }
+   }
+}
+/* *************************************************************** */
+void reg_ssd::GetTileVoxelBasedSimilarityMeasureGradient(nifti_image *localWarpedImage,
+                                                         nifti_image *localWarpedGradient,
+                                                         int *regionStart,
+                                                         int current_timepoint)
+{
+   if(this->timePointWeight[current_timepoint]==0.0)
+      return;
+   // The normalisation uses the weight of all active voxels
+   double adjusted_weight = this->timePointWeight[current_timepoint] /
+         this->tileActiveWeight[current_timepoint];
+   switch(this->referenceImagePointer->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      reg_getVoxelBasedSSDGradientRegion<float>(this->referenceImagePointer,
+                                                localWarpedImage,
+                                                localWarpedGradient,
+                                                this->forwardVoxelBasedGradientImagePointer,
+                                                this->referenceMaskPointer,
+                                                this->forwardLocalWeightSimImagePointer,
+                                                regionStart,
+                                                current_timepoint,
+                                                adjusted_weight);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      reg_getVoxelBasedSSDGradientRegion<double>(this->referenceImagePointer,
+                                                 localWarpedImage,
+                                                 localWarpedGradient,
+                                                 this->forwardVoxelBasedGradientImagePointer,
+                                                 this->referenceMaskPointer,
+                                                 this->forwardLocalWeightSimImagePointer,
+                                                 regionStart,
+                                                 current_timepoint,
+                                                 adjusted_weight);
+      break;
+   default:
+      reg_print_fct_error("reg_ssd::GetTileVoxelBasedSimilarityMeasureGradient");
+      reg_print_msg_error("Unsupported datatype");
+      reg_exit();
+   }
+}
+/* *************************************************************** */
+/* *************************************************************** */
 template <class DTYPE>
 void GetDiscretisedValueSSD_core3D(nifti_image *controlPointGridImage,
                                    float *discretisedValue,
@@ -762,6 +1175,9 @@ void GetDiscretisedValueSSD_core3D(nifti_image *controlPointGridImage,
 template <class DTYPE>
 void GetDiscretisedValueSSD_core3D_2(nifti_image *controlPointGridImage,
                                      float *discretisedValue,
+                                     unsigned short *quantisedValue,
+                                     float *nodeOffset,
+                                     float *nodeScale,
                                      int discretise_radius,
                                      int discretise_step,
                                      nifti_image *refImage,
@@ -817,16 +1233,27 @@ void GetDiscretisedValueSSD_core3D_2(nifti_image *controlPointGridImage,
    float** refBlockValue = (float **) malloc(threadNumber*sizeof(float *));
    for(a=0;a<threadNumber;++a)
       refBlockValue[a] = (float *) malloc(voxelBlockNumber_t*sizeof(float));
+   // The values of a node are computed in a thread buffer when quantised
+   float **nodeBuffer = NULL;
+   if(quantisedValue!=NULL){
+      nodeBuffer = (float **) malloc(threadNumber*sizeof(float *));
+      for(a=0;a<threadNumber;++a)
+         nodeBuffer[a] = (float *) malloc(label_nD_number*sizeof(float));
+   }
+   float *nodeValue;
 
    // Loop over all control points
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
    shared(controlPointGridImage, refImage, warImage, grid2img_vox, blockSize, \
    padding_value, refBlockValue, mask, refImgPtr, warImgPtr, discretise_radius, \
-   discretise_step, discretisedValue) \
+   discretise_step, discretisedValue, voxelBlockNumber, voxelBlockNumber_t, \
+   voxelNumber, label_nD_number, label_1D_number, quantisedValue, nodeOffset, \
+   nodeScale, nodeBuffer) \
    private(cpx, cpy, cpz, x, y, z, a, b, c, t, currentControlPoint, gridVox, imageVox, \
    voxIndex, idBlock, blockIndex, definedValueNumber, tid, \
-   timeV, voxIndex_t, blockIndex_t, discretisedIndex, currentSum, currentValue)
+   timeV, voxIndex_t, blockIndex_t, discretisedIndex, currentSum, currentValue, \
+   nodeValue)
 #endif
    for(cpz=0; cpz<controlPointGridImage->nz; ++cpz){
 #if defined (_OPENMP)
@@ -846,6 +1273,12 @@ void GetDiscretisedValueSSD_core3D_2(nifti_image *controlPointGridImage,
             imageVox[1]=reg_round(imageVox[1]);
             imageVox[2]=reg_round(imageVox[2]);
 
+            if(quantisedValue==NULL)
+               nodeValue = &discretisedValue[currentControlPoint * label_nD_number];
+            else nodeValue = nodeBuffer[tid];
+            for(discretisedIndex=0; discretisedIndex<label_nD_number; ++discretisedIndex)
+               nodeValue[discretisedIndex] = std::numeric_limits<float>::quiet_NaN();
+
             //INIT
             for(idBlock=0;idBlock<voxelBlockNumber_t;idBlock++) {
                refBlockValue[tid][idBlock]=padding_value;
@@ -934,74 +1367,31 @@ void GetDiscretisedValueSSD_core3D_2(nifti_image *controlPointGridImage,
                               } // x
                            } // y
                         } // z
-                        discretisedValue[currentControlPoint * label_nD_number + discretisedIndex] = currentSum;
+                        nodeValue[discretisedIndex] = currentSum;
                         ++discretisedIndex;
                      } // a
                   } // b
                } // cc
             } // defined value in the reference block
-            ++currentControlPoint;
+            // Deal with the labels that contains NaN values
+            reg_discretisedValue_fillUndefined(nodeValue, label_1D_number);
+            if(quantisedValue!=NULL)
+               reg_discretisedValue_quantise(nodeValue,
+                                             label_nD_number,
+                                             &quantisedValue[(size_t)currentControlPoint * label_nD_number],
+                                             &nodeOffset[currentControlPoint],
+                                             &nodeScale[currentControlPoint]);
          } // cpx
       } // cpy
    } // cpz
    for(a=0;a<threadNumber;++a)
       free(refBlockValue[a]);
    free(refBlockValue);
-
-   // Deal with the labels that contains NaN values
-   for(int node=0; node<controlPointGridImage->nx*controlPointGridImage->ny*controlPointGridImage->nz; ++node){
-      int definedValueNumber=0;
-      float *discretisedValuePtr = &discretisedValue[node * label_nD_number];
-      float meanValue=0;
-      for(int label=0; label<label_nD_number;++label){
-         if(discretisedValuePtr[label]==discretisedValuePtr[label]){
-            ++definedValueNumber;
-            meanValue+=discretisedValuePtr[label];
-         }
-      }
-      if(definedValueNumber==0){
-         for(int label=0; label<label_nD_number;++label){
-            discretisedValuePtr[label]=0;
-         }
-      }
-      else if(definedValueNumber<label_nD_number){
-         // Needs to be altered for efficiency
-         int label=0;
-         // Loop over all labels
-         int label_x, label2_x, label_y, label2_y, label_z, label2_z, label2;
-         float min_distance, current_distance;
-         for(label_z=0; label_z<label_1D_number;++label_z){
-            for(label_y=0; label_y<label_1D_number;++label_y){
-               for(label_x=0; label_x<label_1D_number;++label_x){
-                  // check if the current label is defined
-                  if(discretisedValuePtr[label]!=discretisedValuePtr[label]){
-                     label2=0;
-                     min_distance=std::numeric_limits<float>::max();
-                     // Loop again over all label to detect the defined values
-                     for(label2_z=0; label2_z<label_1D_number;++label2_z){
-                        for(label2_y=0; label2_y<label_1D_number;++label2_y){
-                           for(label2_x=0; label2_x<label_1D_number;++label2_x){
-                              // Check if the value is defined
-                              if(discretisedValuePtr[label2]==discretisedValuePtr[label2]){
-                                 // compute the distance between label and label2
-                                 current_distance = reg_pow2(label_x-label2_x)+reg_pow2(label_y-label2_y)+reg_pow2(label_z-label2_z);
-                                 if(current_distance<min_distance){
-                                    min_distance=current_distance;
-                                    discretisedValuePtr[label] = discretisedValuePtr[label2];
-                                 }
-                              } // Check if label2 is defined
-                              ++label2;
-                           } // x
-                        } // y
-                     } // z
-                  } // check if undefined label
-                  ++label;
-               } //x
-            } // y
-         } // z
-
-      } // node with undefined label
-   } // node
+   if(nodeBuffer!=NULL){
+      for(a=0;a<threadNumber;++a)
+         free(nodeBuffer[a]);
+      free(nodeBuffer);
+   }
 }
 /* *************************************************************** */
 //template <class DTYPE>
@@ -1018,34 +1408,46 @@ void GetDiscretisedValueSSD_core3D_2(nifti_image *controlPointGridImage,
 //    reg_exit();
 //}
 /* *************************************************************** */
-void reg_ssd::GetDiscretisedValue(nifti_image *controlPointGridImage,
-                                  float *discretisedValue,
-                                  int discretise_radius,
-                                  int discretise_step)
+void reg_ssd::ComputeDiscretisedValue(nifti_image *refImage,
+                                      nifti_image *warImage,
+                                      int *mask,
+                                      nifti_image *controlPointGridImage,
+                                      float *discretisedValue,
+                                      unsigned short *quantisedValue,
+                                      float *nodeOffset,
+                                      float *nodeScale,
+                                      int discretise_radius,
+                                      int discretise_step)
 {
-   if(referenceImagePointer->nz > 1) {
-      switch(this->referenceImagePointer->datatype)
+   if(refImage->nz > 1) {
+      switch(refImage->datatype)
       {
       case NIFTI_TYPE_FLOAT32:
          GetDiscretisedValueSSD_core3D_2<float>
                (controlPointGridImage,
                 discretisedValue,
+                quantisedValue,
+                nodeOffset,
+                nodeScale,
                 discretise_radius,
                 discretise_step,
-                this->referenceImagePointer,
-                this->warpedFloatingImagePointer,
-                this->referenceMaskPointer
+                refImage,
+                warImage,
+                mask
                 );
          break;
       case NIFTI_TYPE_FLOAT64:
          GetDiscretisedValueSSD_core3D_2<double>
                (controlPointGridImage,
                 discretisedValue,
+                quantisedValue,
+                nodeOffset,
+                nodeScale,
                 discretise_radius,
                 discretise_step,
-                this->referenceImagePointer,
-                this->warpedFloatingImagePointer,
-                this->referenceMaskPointer
+                refImage,
+                warImage,
+                mask
                 );
          break;
       default:
@@ -1059,35 +1461,42 @@ void reg_ssd::GetDiscretisedValue(nifti_image *controlPointGridImage,
       reg_print_fct_error("reg_ssd::GetDiscretisedValue");
       reg_print_msg_error("Not implemented in 2D yet");
       reg_exit();
-      //        switch(this->referenceImagePointer->datatype)
-      //        {
-      //        case NIFTI_TYPE_FLOAT32:
-      //            GetDiscretisedValueSSD_core2D<float>
-      //                    (controlPointGridImage,
-      //                     discretisedValue,
-      //                     discretise_radius,
-      //                     discretise_step,
-      //                     this->referenceImagePointer,
-      //                     this->warpedFloatingImagePointer,
-      //                     this->referenceMaskPointer
-      //                     );
-      //            break;
-      //        case NIFTI_TYPE_FLOAT64:
-      //            GetDiscretisedValueSSD_core2D<double>
-      //                    (controlPointGridImage,
-      //                     discretisedValue,
-      //                     discretise_radius,
-      //                     discretise_step,
-      //                     this->referenceImagePointer,
-      //                     this->warpedFloatingImagePointer,
-      //                     this->referenceMaskPointer
-      //                     );
-      //            break;
-      //        default:
-      //            reg_print_fct_error("reg_ssd::GetDiscretisedValue");
-      //            reg_print_msg_error("Unsupported datatype");
-      //            reg_exit();
-      //        }
    }
 }
 /* *************************************************************** */
+void reg_ssd::GetDiscretisedValue(nifti_image *controlPointGridImage,
+                                  float *discretisedValue,
+                                  int discretise_radius,
+                                  int discretise_step)
+{
+   this->ComputeDiscretisedValue(this->referenceImagePointer,
+                                 this->warpedFloatingImagePointer,
+                                 this->referenceMaskPointer,
+                                 controlPointGridImage,
+                                 discretisedValue,
+                                 NULL,
+                                 NULL,
+                                 NULL,
+                                 discretise_radius,
+                                 discretise_step);
+}
+/* *************************************************************** */
+void reg_ssd::GetQuantisedDiscretisedValue(nifti_image *controlPointGridImage,
+                                           unsigned short *quantisedValue,
+                                           float *nodeOffset,
+                                           float *nodeScale,
+                                           int discretise_radius,
+                                           int discretise_step)
+{
+   this->ComputeDiscretisedValue(this->referenceImagePointer,
+                                 this->warpedFloatingImagePointer,
+                                 this->referenceMaskPointer,
+                                 controlPointGridImage,
+                                 NULL,
+                                 quantisedValue,
+                                 nodeOffset,
+                                 nodeScale,
+                                 discretise_radius,
+                                 discretise_step);
+}
+/* *************************************************************** */
@@ -43,15 +43,70 @@ public:
    virtual double GetSimilarityMeasureValue();
    /// @brief Compute the voxel based ssd gradient
    virtual void GetVoxelBasedSimilarityMeasureGradient(int current_timepoint);
-   /// @brief Here
+   /// @brief Store the ssd and active voxel weight of every time point
+   virtual void InitialiseLocalSimilarityMeasure();
+   /// @brief Returns the ssd value when a region of the warped image is updated
+   virtual double GetLocalSimilarityMeasureValue(nifti_image *localWarpedImage,
+                                                 int *regionStart);
+   /// @brief The local value is only concurrent when the measure is not symmetric
+   virtual bool IsLocalSimilarityMeasureConcurrent()
+   {
+      return !this->isSymmetric;
+   }
+   /// @brief The tile-wise computation is only available for the forward
+   /// measure without local weights
+   virtual bool IsTileSimilarityMeasureSupported()
+   {
+      return !this->isSymmetric && this->forwardLocalWeightSimImagePointer==NULL;
+   }
+   /// @brief Allocate and reset the per-thread ssd and weight sums
+   virtual void InitialiseTileSimilarityMeasure(int threadNumber);
+   /// @brief Add the ssd and weight sums of a tile to the thread sums
+   virtual void AccumulateTileSimilarityMeasure(nifti_image *localWarpedImage,
+                                                int *regionStart,
+                                                int threadIndex);
+   /// @brief Returns the ssd value from the thread sums
+   virtual double GetTileSimilarityMeasureValue();
+   /// @brief Compute the voxel based ssd gradient over a tile
+   virtual void GetTileVoxelBasedSimilarityMeasureGradient(nifti_image *localWarpedImage,
+                                                           nifti_image *localWarpedGradient,
+                                                           int *regionStart,
+                                                           int current_timepoint);
+   /// @brief Compute the negated block ssd for every control point and label
    virtual void GetDiscretisedValue(nifti_image *controlPointGridImage,
                                     float *discretisedValue,
                                     int discretise_radius,
                                     int discretise_step);
+   /// @brief Compute the negated block ssd quantised on 16 bits
+   virtual void GetQuantisedDiscretisedValue(nifti_image *controlPointGridImage,
+                                             unsigned short *quantisedValue,
+                                             float *nodeOffset,
+                                             float *nodeScale,
+                                             int discretise_radius,
+                                             int discretise_step);
    /// @brief reg_ssd class desstructor
-   ~reg_ssd() {}
+   ~reg_ssd();
 protected:
    float currentValue[255];
+   double localSSDValue[255];
+   double localWeightValue[255];
+   int tileThreadNumber;
+   double *tileSSDValue;
+   double *tileWeightValue;
+   double tileActiveWeight[255];
+
+   /// @brief Compute the discretised ssd between the specified images, the
+   /// values are quantised when quantisedValue is not NULL
+   void ComputeDiscretisedValue(nifti_image *refImage,
+                                nifti_image *warImage,
+                                int *mask,
+                                nifti_image *controlPointGridImage,
+                                float *discretisedValue,
+                                unsigned short *quantisedValue,
+                                float *nodeOffset,
+                                float *nodeScale,
+                                int discretise_radius,
+                                int discretise_step);
 
 private:
    bool normaliseTimePoint[255];
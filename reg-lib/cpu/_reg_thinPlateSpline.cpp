@@ -37,6 +37,7 @@ reg_tps<T>::reg_tps(size_t d, size_t n)
    }
    this->initialised=false;
    this->approxInter=0.;
+   this->approxError=0.;
 }
 /* *************************************************************** */
 /* *************************************************************** */
@@ -99,6 +100,13 @@ void reg_tps<T>::SetAproxInter(T v)
 /* *************************************************************** */
 /* *************************************************************** */
 template <class T>
+void reg_tps<T>::SetApproximationError(T v)
+{
+   this->approxError=v;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
 T reg_tps<T>::GetTPSEuclideanDistance(size_t i, size_t j)
 {
    T temp = this->positionX[i] - this->positionX[j];
@@ -140,7 +148,214 @@ T reg_tps<T>::GetTPSweight(T dist)
 /* *************************************************************** */
 /* *************************************************************** */
 template <class T>
-void reg_tps<T>::InitialiseTPS()
+void reg_tps<T>::FillKernelMatrix(T *matrix, size_t matrixSide)
+{
+   // Distance matrix is computed
+   int landmarkNumber=(int)this->number;
+   int i, j;
+   T distance;
+   double a=0.;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) schedule(dynamic) \
+   shared(matrix, matrixSide, landmarkNumber) \
+   private(i, j, distance) \
+   reduction(+:a)
+#endif
+   for(i=0; i<landmarkNumber; ++i)
+   {
+      for(j=i+1; j<landmarkNumber; ++j)
+      {
+         distance = this->GetTPSEuclideanDistance(i,j);
+         a += distance * 2.;
+         distance = this->GetTPSweight(distance);
+         matrix[i*matrixSide+j]=matrix[j*matrixSide+i]=distance;
+      }
+   }
+   a/=(double)(this->number*this->number);
+   a=(double)this->approxInter*a*a;
+   for(size_t i=0; i<this->number; ++i)
+   {
+      matrix[i*matrixSide+i]=a;
+   }
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+bool reg_tps<T>::SolveSymmetricSystem()
+{
+   // The coefficients c and the affine parameters d solve K.c + P.d = v and
+   // P'.c = 0. With the QR decomposition P = Q.[R;0], c = Q.[0;e] where e
+   // solves the projected system (Q'.K.Q)_22 e = (Q'.v)_2. This matrix is
+   // symmetric positive definite as the kernel is conditionally positive
+   // definite of order two
+   size_t n=this->number;
+   size_t m=this->dim+1;
+   if(n<=m) return false;
+   size_t s=n-m;
+   T *matrixK=(T *)malloc(n*n*sizeof(T));
+   if(matrixK==NULL) return false;
+   this->FillKernelMatrix(matrixK, n);
+
+   T *coefficient[3]={this->coefficientX, this->coefficientY, this->coefficientZ};
+
+   // Householder QR decomposition of the polynomial matrix, stored by column
+   T *householder=(T *)calloc(n*m,sizeof(T));
+   T beta[4], matrixR[16];
+   for(size_t i=0; i<n; ++i)
+   {
+      householder[i]=1;
+      householder[n+i]=this->positionX[i];
+      householder[2*n+i]=this->positionY[i];
+      if(this->dim==3)
+         householder[3*n+i]=this->positionZ[i];
+   }
+   for(size_t c=0; c<m; ++c)
+   {
+      T *v=&householder[c*n];
+      double norm=0.;
+      for(size_t i=c; i<n; ++i)
+         norm += reg_pow2((double)v[i]);
+      norm=sqrt(norm);
+      if(norm==0)
+      {
+         free(householder);
+         free(matrixK);
+         return false;
+      }
+      T alpha = v[c]>0 ? -norm : norm;
+      v[c] -= alpha;
+      double vNorm=0.;
+      for(size_t i=c; i<n; ++i)
+         vNorm += reg_pow2((double)v[i]);
+      beta[c]=2./vNorm;
+      matrixR[c*m+c]=alpha;
+      // Apply the reflection to the remaining columns
+      for(size_t c2=c+1; c2<m; ++c2)
+      {
+         T *w=&householder[c2*n];
+         double dot=0.;
+         for(size_t i=c; i<n; ++i)
+            dot += v[i]*w[i];
+         dot *= beta[c];
+         for(size_t i=c; i<n; ++i)
+            w[i] -= dot*v[i];
+         matrixR[c*m+c2]=w[c];
+      }
+      for(size_t i=0; i<c; ++i)
+         v[i]=0;
+   }
+
+   // Apply the reflections to both sides of the kernel matrix and to the
+   // right hand sides
+   T *vectorW=(T *)malloc(n*sizeof(T));
+   int i, j;
+   int landmarkNumber=(int)n;
+   T *v;
+   double dot;
+   for(size_t c=0; c<m; ++c)
+   {
+      v=&householder[c*n];
+      // w = beta.K.v
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(matrixK, vectorW, v, beta, c, n, landmarkNumber) \
+   private(i, j, dot)
+#endif
+      for(i=0; i<landmarkNumber; ++i)
+      {
+         dot=0.;
+         for(j=(int)c; j<landmarkNumber; ++j)
+            dot += matrixK[(size_t)i*n+j]*v[j];
+         vectorW[i]=beta[c]*dot;
+      }
+      // u = w - beta/2.(v'.w).v and K = K - v.u' - u.v'
+      dot=0.;
+      for(size_t k=c; k<n; ++k)
+         dot += v[k]*vectorW[k];
+      dot *= 0.5*beta[c];
+      for(size_t k=0; k<n; ++k)
+         vectorW[k] -= dot*v[k];
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(matrixK, vectorW, v, n, landmarkNumber) \
+   private(i, j)
+#endif
+      for(i=0; i<landmarkNumber; ++i)
+      {
+         T *rowK=&matrixK[(size_t)i*n];
+         for(j=0; j<landmarkNumber; ++j)
+            rowK[j] -= v[i]*vectorW[j] + vectorW[i]*v[j];
+      }
+      for(size_t d=0; d<this->dim; ++d)
+      {
+         dot=0.;
+         for(size_t k=c; k<n; ++k)
+            dot += v[k]*coefficient[d][k];
+         dot *= beta[c];
+         for(size_t k=c; k<n; ++k)
+            coefficient[d][k] -= dot*v[k];
+      }
+   }
+   free(vectorW);
+
+   // Keep the coupling between the affine and the projected parts before
+   // the projected matrix is compacted in place
+   T *matrixK12=(T *)malloc(m*s*sizeof(T));
+   for(size_t r=0; r<m; ++r)
+      memcpy(&matrixK12[r*s], &matrixK[r*n+m], s*sizeof(T));
+   for(size_t r=0; r<s; ++r)
+      memmove(&matrixK[r*s], &matrixK[(r+m)*n+m], s*sizeof(T));
+
+   bool success=reg_choleskyDecomposition<T>(matrixK, s);
+   if(success)
+   {
+      for(size_t d=0; d<this->dim; ++d)
+      {
+         T *coef=coefficient[d];
+         // Projected coefficients
+         reg_choleskySolve<T>(matrixK, s, &coef[m]);
+         // Affine parameters from R.d = (Q'.v)_1 - (Q'.K.Q)_12.e
+         T affine[4];
+         for(size_t r=0; r<m; ++r)
+         {
+            double sum=coef[r];
+            for(size_t k=0; k<s; ++k)
+               sum -= matrixK12[r*s+k]*coef[m+k];
+            affine[r]=sum;
+         }
+         for(int r=(int)m-1; r>-1; --r)
+         {
+            double sum=affine[r];
+            for(size_t k=r+1; k<m; ++k)
+               sum -= matrixR[r*m+k]*affine[k];
+            affine[r]=sum/matrixR[r*m+r];
+         }
+         // c = Q.[0;e]
+         for(size_t r=0; r<m; ++r)
+            coef[r]=0;
+         for(int c=(int)m-1; c>-1; --c)
+         {
+            v=&householder[c*n];
+            dot=0.;
+            for(size_t k=c; k<n; ++k)
+               dot += v[k]*coef[k];
+            dot *= beta[c];
+            for(size_t k=c; k<n; ++k)
+               coef[k] -= dot*v[k];
+         }
+         for(size_t r=0; r<m; ++r)
+            coef[n+r]=affine[r];
+      }
+   }
+   free(matrixK12);
+   free(householder);
+   free(matrixK);
+   return success;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+void reg_tps<T>::SolveFullSystem()
 {
    size_t matrix_side=this->number + this->dim + 1;
    T *matrixL=(T *)calloc(matrix_side*matrix_side,sizeof(T));
@@ -156,24 +371,7 @@ void reg_tps<T>::InitialiseTPS()
       reg_exit();
    }
 
-   // Distance matrix is computed
-   double a=0.;
-   for(size_t i=0; i<this->number; ++i)
-   {
-      for(size_t j=i+1; j<this->number; ++j)
-      {
-         T distance = this->GetTPSEuclideanDistance(i,j);
-         a += distance * 2.;
-         distance = this->GetTPSweight(distance);
-         matrixL[i*matrix_side+j]=matrixL[j*matrix_side+i]=distance;
-      }
-   }
-   a/=(double)(this->number*this->number);
-   a=(double)this->approxInter*a*a;
-   for(size_t i=0; i<this->number; ++i)
-   {
-      matrixL[i*matrix_side+i]=a;
-   }
+   this->FillKernelMatrix(matrixL, matrix_side);
    for(size_t i=0; i<this->number; ++i)
    {
       matrixL[i*matrix_side+this->number]=matrixL[(this->number)*matrix_side+i]=1;
@@ -205,102 +403,322 @@ void reg_tps<T>::InitialiseTPS()
 
    free(index);
    free(matrixL);
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+void reg_tps<T>::InitialiseTPS()
+{
+   // The symmetric solver modifies the right hand sides, which are restored
+   // if it fails
+   size_t coefficientNumber=this->number + this->dim + 1;
+   T *coefficientCopy=(T *)malloc(3*coefficientNumber*sizeof(T));
+   memcpy(coefficientCopy, this->coefficientX, coefficientNumber*sizeof(T));
+   memcpy(&coefficientCopy[coefficientNumber], this->coefficientY, coefficientNumber*sizeof(T));
+   if(this->dim==3)
+      memcpy(&coefficientCopy[2*coefficientNumber], this->coefficientZ, coefficientNumber*sizeof(T));
+
+   if(this->SolveSymmetricSystem()==false)
+   {
+#ifndef NDEBUG
+      reg_print_msg_debug("reg_tps<T>::InitialiseTPS() - The projected system is not positive definite, a LU decomposition is used");
+#endif
+      memcpy(this->coefficientX, coefficientCopy, coefficientNumber*sizeof(T));
+      memcpy(this->coefficientY, &coefficientCopy[coefficientNumber], coefficientNumber*sizeof(T));
+      if(this->dim==3)
+         memcpy(this->coefficientZ, &coefficientCopy[2*coefficientNumber], coefficientNumber*sizeof(T));
+      this->SolveFullSystem();
+   }
+   free(coefficientCopy);
    this->initialised=true;
    return;
 }
 /* *************************************************************** */
 /* *************************************************************** */
 template <class T>
-void reg_tps<T>::FillDeformationField(nifti_image *deformationField)
+void reg_tps<T>::GetTPSPosition(T *position, T *result)
 {
-   if(this->initialised==false)
-      this->InitialiseTPS();
-
-   size_t voxelNumber = deformationField->nx*deformationField->ny*deformationField->nz;
+   const size_t n=this->number;
+   T finalPositionX=this->coefficientX[n]+
+                    this->coefficientX[n+1]*position[0]+
+                    this->coefficientX[n+2]*position[1];
+   T finalPositionY=this->coefficientY[n]+
+                    this->coefficientY[n+1]*position[0]+
+                    this->coefficientY[n+2]*position[1];
+   T finalPositionZ=0;
+   if(this->dim==3)
+   {
+      finalPositionX += this->coefficientX[n+3]*position[2];
+      finalPositionY += this->coefficientY[n+3]*position[2];
+      finalPositionZ=this->coefficientZ[n]+
+                     this->coefficientZ[n+1]*position[0]+
+                     this->coefficientZ[n+2]*position[1]+
+                     this->coefficientZ[n+3]*position[2];
+      // r^2.log(r) is computed as r^2.log(r^2)/2 to avoid the square root
+      for(size_t i=0; i<n; ++i)
+      {
+         T squaredDistance=reg_pow2(this->positionX[i]-position[0]) +
+                           reg_pow2(this->positionY[i]-position[1]) +
+                           reg_pow2(this->positionZ[i]-position[2]);
+         T weight = squaredDistance>0 ? (T)0.5*squaredDistance*log(squaredDistance) : 0;
+         finalPositionX += this->coefficientX[i]*weight;
+         finalPositionY += this->coefficientY[i]*weight;
+         finalPositionZ += this->coefficientZ[i]*weight;
+      }
+   }
+   else
+   {
+      for(size_t i=0; i<n; ++i)
+      {
+         T squaredDistance=reg_pow2(this->positionX[i]-position[0]) +
+                           reg_pow2(this->positionY[i]-position[1]);
+         T weight = squaredDistance>0 ? (T)0.5*squaredDistance*log(squaredDistance) : 0;
+         finalPositionX += this->coefficientX[i]*weight;
+         finalPositionY += this->coefficientY[i]*weight;
+      }
+   }
+   result[0]=finalPositionX+position[0];
+   result[1]=finalPositionY+position[1];
+   result[2]=finalPositionZ+position[2];
+}
+/* *************************************************************** */
+/* *************************************************************** */
+/// @brief Trilinear interpolation weights of the corners of a tile, the
+/// corner index is (z*2+y)*2+x
+template <class T>
+inline void reg_tps_trilinearBasis(T *relative, T *basis)
+{
+   basis[0]=(1-relative[0])*(1-relative[1])*(1-relative[2]);
+   basis[1]=relative[0]*(1-relative[1])*(1-relative[2]);
+   basis[2]=(1-relative[0])*relative[1]*(1-relative[2]);
+   basis[3]=relative[0]*relative[1]*(1-relative[2]);
+   basis[4]=(1-relative[0])*(1-relative[1])*relative[2];
+   basis[5]=relative[0]*(1-relative[1])*relative[2];
+   basis[6]=(1-relative[0])*relative[1]*relative[2];
+   basis[7]=relative[0]*relative[1]*relative[2];
+}
+/* *************************************************************** */
+template <class T>
+void reg_tps<T>::FillDeformationFieldTile(nifti_image *deformationField,
+                                          int *cornerStart,
+                                          int *cornerEnd,
+                                          int *voxelEnd,
+                                          T *cornerValue)
+{
+   size_t voxelNumber = (size_t)deformationField->nx*deformationField->ny*deformationField->nz;
    T *defX=static_cast<T *>(deformationField->data);
    T *defY=&defX[voxelNumber];
-   T *defZ=NULL;
-   if(this->dim==3)
-      defZ=&defY[voxelNumber];
-
-   mat44 *voxel2realDF=NULL;
+   T *defZ=this->dim==3?&defY[voxelNumber]:NULL;
+   mat44 *voxel2realDF=&(deformationField->qto_xyz);
    if(deformationField->sform_code>0)
       voxel2realDF=&(deformationField->sto_xyz);
-   else voxel2realDF=&(deformationField->qto_xyz);
 
-   T position[3];
+   T position[3], exactValue[3], interpolatedValue[3], basis[8];
+   int x, y, z;
+   bool exact=this->approxError<=0;
 
-   int index=0;
-   for(int z=0; z<deformationField->nz; ++z)
+   // The interpolation error is measured every quarter of the tile, on the
+   // faces that belong to the tile included, and at the voxels closest to the
+   // landmarks, where the kernel is the least smooth
+   T span[3], relative[3];
+   for(int a=0; a<3; ++a)
+      span[a]=(T)(cornerEnd[a]-cornerStart[a]);
+   std::vector<int> checkVoxel;
+   if(!exact)
    {
-      for(int y=0; y<deformationField->ny; ++y)
+      int checkNumber[3];
+      for(int a=0; a<3; ++a)
+      {
+         checkNumber[a]=cornerEnd[a]>cornerStart[a]?4:1;
+         if(voxelEnd[a]>cornerEnd[a] && cornerEnd[a]>cornerStart[a])
+            checkNumber[a]=5;
+      }
+      for(z=0; z<checkNumber[2]; ++z)
       {
-         for(int x=0; x<deformationField->nx; ++x)
+         for(y=0; y<checkNumber[1]; ++y)
          {
-
-            // Compute the voxel position in mm
-            position[0]=x * voxel2realDF->m[0][0] +
-                        y * voxel2realDF->m[0][1] +
-                        z * voxel2realDF->m[0][2] +
-                        voxel2realDF->m[0][3];
-            position[1]=x * voxel2realDF->m[1][0] +
-                        y * voxel2realDF->m[1][1] +
-                        z * voxel2realDF->m[1][2] +
-                        voxel2realDF->m[1][3];
-            position[2]=x * voxel2realDF->m[2][0] +
-                        y * voxel2realDF->m[2][1] +
-                        z * voxel2realDF->m[2][2] +
-                        voxel2realDF->m[2][3];
-
-            T finalPositionX=0;
-            T finalPositionY=0;
-            T finalPositionZ=0;
-            if(this->dim==3)
+            for(x=0; x<checkNumber[0]; ++x)
             {
-               finalPositionX=this->coefficientX[this->number]+
-                              this->coefficientX[this->number+1]*position[0]+
-                              this->coefficientX[this->number+2]*position[1]+
-                              this->coefficientX[this->number+3]*position[2];
-
-               finalPositionY=this->coefficientY[this->number]+
-                              this->coefficientY[this->number+1]*position[0]+
-                              this->coefficientY[this->number+2]*position[1]+
-                              this->coefficientY[this->number+3]*position[2];
-
-               finalPositionZ=this->coefficientZ[this->number]+
-                              this->coefficientZ[this->number+1]*position[0]+
-                              this->coefficientZ[this->number+2]*position[1]+
-                              this->coefficientZ[this->number+3]*position[2];
+               checkVoxel.push_back(cornerStart[0]+(x*(cornerEnd[0]-cornerStart[0]))/4);
+               checkVoxel.push_back(cornerStart[1]+(y*(cornerEnd[1]-cornerStart[1]))/4);
+               checkVoxel.push_back(cornerStart[2]+(z*(cornerEnd[2]-cornerStart[2]))/4);
             }
-            else
-            {
-               finalPositionX=this->coefficientX[this->number] +
-                              this->coefficientX[this->number+1]*position[0]+
-                              this->coefficientX[this->number+2]*position[1];
+         }
+      }
+      mat44 *real2voxelDF=&(deformationField->qto_ijk);
+      if(deformationField->sform_code>0)
+         real2voxelDF=&(deformationField->sto_ijk);
+      for(size_t i=0; i<this->number; ++i)
+      {
+         position[0]=this->positionX[i];
+         position[1]=this->positionY[i];
+         position[2]=this->dim==3?this->positionZ[i]:0;
+         T voxel[3];
+         reg_mat44_mul(real2voxelDF, position, voxel);
+         int landmarkVoxel[3];
+         bool inside=true;
+         for(int a=0; a<3; ++a)
+         {
+            landmarkVoxel[a]=a<(int)this->dim?static_cast<int>(reg_round(voxel[a])):0;
+            if(landmarkVoxel[a]<cornerStart[a] || landmarkVoxel[a]>=voxelEnd[a])
+               inside=false;
+         }
+         if(inside)
+            checkVoxel.insert(checkVoxel.end(), landmarkVoxel, landmarkVoxel+3);
+      }
+   }
+   for(size_t v=0; v<checkVoxel.size() && !exact; v+=3)
+   {
+      T voxel[3];
+      for(int a=0; a<3; ++a)
+      {
+         voxel[a]=(T)checkVoxel[v+a];
+         relative[a]=span[a]>0?(voxel[a]-cornerStart[a])/span[a]:0;
+      }
+      reg_tps_trilinearBasis(relative, basis);
+      reg_mat44_mul(voxel2realDF, voxel, position);
+      this->GetTPSPosition(position, exactValue);
+      T error=0;
+      for(int a=0; a<(int)this->dim; ++a)
+      {
+         interpolatedValue[a]=0;
+         for(int b=0; b<8; ++b)
+            interpolatedValue[a] += basis[b]*cornerValue[b*3+a];
+         error += reg_pow2(interpolatedValue[a]-exactValue[a]);
+      }
+      // The error between the control voxels is not measured, half of the
+      // bound is kept as a safety margin
+      if(2*sqrt(error)>this->approxError)
+         exact=true;
+   }
 
-               finalPositionY=this->coefficientY[this->number] +
-                              this->coefficientY[this->number+1]*position[0]+
-                              this->coefficientY[this->number+2]*position[1];
+   // Fill the tile
+   for(z=cornerStart[2]; z<voxelEnd[2]; ++z)
+   {
+      relative[2]=span[2]>0?(T)(z-cornerStart[2])/span[2]:0;
+      for(y=cornerStart[1]; y<voxelEnd[1]; ++y)
+      {
+         relative[1]=span[1]>0?(T)(y-cornerStart[1])/span[1]:0;
+         size_t index=((size_t)z*deformationField->ny+y)*deformationField->nx+cornerStart[0];
+         for(x=cornerStart[0]; x<voxelEnd[0]; ++x, ++index)
+         {
+            if(exact)
+            {
+               T voxel[3]={(T)x,(T)y,(T)z};
+               reg_mat44_mul(voxel2realDF, voxel, position);
+               this->GetTPSPosition(position, exactValue);
+               defX[index]=exactValue[0];
+               defY[index]=exactValue[1];
+               if(defZ!=NULL)
+                  defZ[index]=exactValue[2];
             }
-
-            // Compute the displacement
-            for(size_t i=0; i<this->number; ++i)
+            else
             {
-               T distance=GetTPSweight(GetTPSEuclideanDistance(i,position));
-               finalPositionX += this->coefficientX[i]*distance;
-               finalPositionY += this->coefficientY[i]*distance;
-               if(this->dim==3)
-                  finalPositionZ += this->coefficientZ[i]*distance;
+               relative[0]=span[0]>0?(T)(x-cornerStart[0])/span[0]:0;
+               reg_tps_trilinearBasis(relative, basis);
+               for(int a=0; a<(int)this->dim; ++a)
+               {
+                  interpolatedValue[a]=0;
+                  for(int b=0; b<8; ++b)
+                     interpolatedValue[a] += basis[b]*cornerValue[b*3+a];
+               }
+               defX[index]=interpolatedValue[0];
+               defY[index]=interpolatedValue[1];
+               if(defZ!=NULL)
+                  defZ[index]=interpolatedValue[2];
             }
-            defX[index]=finalPositionX+position[0];
-            defY[index]=finalPositionY+position[1];
-            if(this->dim==3)
-               defZ[index]=finalPositionZ+position[2];
-            index++;
          }
       }
    }
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+void reg_tps<T>::FillDeformationField(nifti_image *deformationField)
+{
+   if(this->initialised==false)
+      this->InitialiseTPS();
+
+   mat44 *voxel2realDF=NULL;
+   if(deformationField->sform_code>0)
+      voxel2realDF=&(deformationField->sto_xyz);
+   else voxel2realDF=&(deformationField->qto_xyz);
+
+   // The field is processed by tiles, the tile corners are nodes of a grid
+   // whose spacing is TPS_TILE_SIZE voxels
+   int imageDim[3]={deformationField->nx,deformationField->ny,deformationField->nz};
+   int nodeNumber[3], tileNumber[3];
+   for(int a=0; a<3; ++a)
+   {
+      nodeNumber[a]=imageDim[a]>1?(imageDim[a]-2)/TPS_TILE_SIZE+2:1;
+      tileNumber[a]=nodeNumber[a]>1?nodeNumber[a]-1:1;
+   }
+   const int totalNodeNumber=nodeNumber[0]*nodeNumber[1]*nodeNumber[2];
+   const int totalTileNumber=tileNumber[0]*tileNumber[1]*tileNumber[2];
+
+   // The nodes are only required by the interpolation
+   T *nodeValue=NULL;
+   int node, tile, a, c;
+   T voxel[3], position[3];
+   if(this->approxError>0)
+   {
+      nodeValue=(T *)malloc(3*totalNodeNumber*sizeof(T));
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(nodeValue, nodeNumber, imageDim, voxel2realDF, totalNodeNumber) \
+   private(node, voxel, position)
+#endif
+      for(node=0; node<totalNodeNumber; ++node)
+      {
+         voxel[0]=(T)(node%nodeNumber[0]*TPS_TILE_SIZE);
+         voxel[1]=(T)(node/nodeNumber[0]%nodeNumber[1]*TPS_TILE_SIZE);
+         voxel[2]=(T)(node/(nodeNumber[0]*nodeNumber[1])*TPS_TILE_SIZE);
+         for(int b=0; b<3; ++b)
+            voxel[b]=voxel[b]<imageDim[b]-1?voxel[b]:imageDim[b]-1;
+         reg_mat44_mul(voxel2realDF, voxel, position);
+         this->GetTPSPosition(position, &nodeValue[3*node]);
+      }
+   }
 
+   int tileIndex[3], cornerStart[3], cornerEnd[3], voxelEnd[3];
+   T cornerValue[24];
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) schedule(dynamic) \
+   shared(deformationField, nodeValue, nodeNumber, tileNumber, imageDim, totalTileNumber) \
+   private(tile, a, c, tileIndex, cornerStart, cornerEnd, voxelEnd, cornerValue)
+#endif
+   for(tile=0; tile<totalTileNumber; ++tile)
+   {
+      tileIndex[0]=tile%tileNumber[0];
+      tileIndex[1]=tile/tileNumber[0]%tileNumber[1];
+      tileIndex[2]=tile/(tileNumber[0]*tileNumber[1]);
+      int cornerNode[2][3];
+      for(a=0; a<3; ++a)
+      {
+         cornerNode[0][a]=tileIndex[a];
+         cornerNode[1][a]=tileIndex[a]+1<nodeNumber[a]?tileIndex[a]+1:tileIndex[a];
+         cornerStart[a]=cornerNode[0][a]*TPS_TILE_SIZE;
+         cornerEnd[a]=cornerNode[1][a]*TPS_TILE_SIZE<imageDim[a]-1 ?
+                  cornerNode[1][a]*TPS_TILE_SIZE : imageDim[a]-1;
+         // The last tile along an axis includes its upper corner
+         voxelEnd[a]=tileIndex[a]==tileNumber[a]-1?imageDim[a]:cornerEnd[a];
+      }
+      if(nodeValue!=NULL)
+      {
+         for(c=0; c<8; ++c)
+         {
+            int n=((cornerNode[(c>>2)&1][2]*nodeNumber[1]) +
+                  cornerNode[(c>>1)&1][1])*nodeNumber[0] +
+                  cornerNode[c&1][0];
+            for(a=0; a<3; ++a)
+               cornerValue[c*3+a]=nodeValue[3*n+a];
+         }
+      }
+      this->FillDeformationFieldTile(deformationField, cornerStart, cornerEnd,
+                                     voxelEnd, cornerValue);
+   }
+   if(nodeValue!=NULL)
+      free(nodeValue);
 }
 /* *************************************************************** */
 /* *************************************************************** */
@@ -14,6 +14,9 @@
 
 #include "_reg_maths.h"
 
+/// Number of voxels along every axis of the tiles of the interpolated field
+#define TPS_TILE_SIZE 8
+
 /* *************************************************************** */
 template <class T>
 class reg_tps
@@ -29,10 +32,29 @@ protected:
    size_t number;
    bool initialised;
    T approxInter;
+   T approxError;
 
    T GetTPSEuclideanDistance(size_t i, size_t j);
    T GetTPSEuclideanDistance(size_t i, T *p);
    T GetTPSweight(T dist);
+   /// @brief Fill the kernel matrix, with the regularisation on its diagonal
+   void FillKernelMatrix(T *matrix, size_t matrixSide);
+   /// @brief Solve the system restricted to the null space of the affine
+   /// constraints, where the kernel matrix is symmetric positive definite.
+   /// Returns false when the Cholesky decomposition fails
+   bool SolveSymmetricSystem();
+   /// @brief Solve the full system with a LU decomposition
+   void SolveFullSystem();
+   /// @brief Compute the transformed position of a point in mm
+   void GetTPSPosition(T *position, T *result);
+   /// @brief Fill a tile of the deformation field by trilinear interpolation
+   /// of its corner values when the interpolation error is below approxError
+   /// at the control voxels, and by exact evaluation otherwise
+   void FillDeformationFieldTile(nifti_image *deformationField,
+                                 int *cornerStart,
+                                 int *cornerEnd,
+                                 int *voxelEnd,
+                                 T *cornerValue);
 
 public:
    reg_tps(size_t d,size_t n);
@@ -40,6 +62,12 @@ public:
    void SetPosition(T*,T*,T*,T*,T*,T*);
    void SetPosition(T*,T*,T*,T*);
    void SetAproxInter(T);
+   /// @brief Set the maximal error in mm of the interpolated deformation
+   /// field. The field is interpolated within the tiles of TPS_TILE_SIZE
+   /// voxels where the error measured at control voxels is below half the
+   /// bound. A null value, the default, gives an exact evaluation of every
+   /// voxel
+   void SetApproximationError(T);
 
    void InitialiseTPS();
    void FillDeformationField(nifti_image *deformationField);
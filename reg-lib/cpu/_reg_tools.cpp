@@ -1100,6 +1100,391 @@ void reg_tools_divideValueToImage(nifti_image *img1,
 }
 /* *************************************************************** */
 /* *************************************************************** */
+/// Number of image lines convolved together, their values are interleaved
+/// in the line buffers so that the filters operate with a unit stride
+#define CONVOLUTION_LINE_NUMBER 8
+/// Number of values per line buffer position, intensity and density
+#define CONVOLUTION_LANE_NUMBER (2*CONVOLUTION_LINE_NUMBER)
+/// Number of successive box filters used to approximate a Gaussian kernel
+#define ITERATED_BOX_PASS_NUMBER 3
+/* *************************************************************** */
+/// @brief Compute the radii of the successive box filters whose combined
+/// variance is the closest to the variance of a Gaussian of the specified
+/// standard deviation (Wells, IEEE TPAMI 1986). A box of radius r has a
+/// variance of r(r+1)/3. The sum of the radii is returned.
+static int reg_tools_getIteratedBoxRadii(double sigma,
+                                         int *radii)
+{
+   double variance=sigma*sigma;
+   int lowerRadius=static_cast<int>(floor((sqrt(1.0+12.0*variance/ITERATED_BOX_PASS_NUMBER)-1.0)/2.0));
+   double lowerVariance=lowerRadius*(lowerRadius+1.0)/3.0;
+   double upperVariance=(lowerRadius+1.0)*(lowerRadius+2.0)/3.0;
+   // Number of passes that use the lower radius
+   int lowerNumber=reg_round((ITERATED_BOX_PASS_NUMBER*upperVariance-variance) /
+                             (upperVariance-lowerVariance));
+   lowerNumber=lowerNumber<0?0:(lowerNumber>ITERATED_BOX_PASS_NUMBER?ITERATED_BOX_PASS_NUMBER:lowerNumber);
+   int radiusSum=0;
+   for(int p=0; p<ITERATED_BOX_PASS_NUMBER; ++p)
+   {
+      radii[p]=p<lowerNumber?lowerRadius:lowerRadius+1;
+      radiusSum += radii[p];
+   }
+   return radiusSum;
+}
+/* *************************************************************** */
+/// @brief Compute the coefficients of the fourth order recursive Gaussian
+/// filter of Deriche (INRIA RR-1893, 1993). The Gaussian is split into a
+/// causal part, which includes the origin, and an anti-causal part that share
+/// the same denominator. The coefficients are normalised to a unit gain.
+static void reg_tools_getRecursiveGaussianCoefficients(double sigma,
+                                                       double *causal,
+                                                       double *antiCausal,
+                                                       double *denominator)
+{
+   // The Gaussian is approximated by the sum of two damped cosines and sines
+   double a[2]= {1.3530, -0.3531};
+   double b[2]= {1.8151, 0.0902};
+   double w[2]= {0.6681, 2.0787};
+   double l[2]= {-1.3932, -1.3732};
+   double response[5];
+   for(int n=0; n<5; ++n)
+   {
+      response[n]=0;
+      for(int i=0; i<2; ++i)
+         response[n] += (a[i]*cos(w[i]*n/sigma)+b[i]*sin(w[i]*n/sigma))*exp(l[i]*n/sigma);
+   }
+   // The denominator is the product of the two complex conjugate pole pairs
+   double pair[2][3];
+   for(int i=0; i<2; ++i)
+   {
+      pair[i][0]=1.0;
+      pair[i][1]=-2.0*exp(l[i]/sigma)*cos(w[i]/sigma);
+      pair[i][2]=exp(2.0*l[i]/sigma);
+   }
+   double fullDenominator[5]= {0,0,0,0,0};
+   for(int i=0; i<3; ++i)
+      for(int j=0; j<3; ++j)
+         fullDenominator[i+j] += pair[0][i]*pair[1][j];
+   // The numerators are obtained from the first values of the responses
+   double gain=0, denominatorSum=0;
+   for(int j=0; j<5; ++j)
+   {
+      double causalValue=0, antiCausalValue=0;
+      for(int i=0; i<=j; ++i)
+      {
+         causalValue += fullDenominator[i]*response[j-i];
+         if(j-i>0) antiCausalValue += fullDenominator[i]*response[j-i];
+      }
+      if(j<4) causal[j]=causalValue;
+      if(j>0) antiCausal[j-1]=antiCausalValue;
+      gain += (j<4?causalValue:0)+(j>0?antiCausalValue:0);
+      denominatorSum += fullDenominator[j];
+      if(j>0) denominator[j-1]=fullDenominator[j];
+   }
+   for(int j=0; j<4; ++j)
+   {
+      causal[j] *= denominatorSum/gain;
+      antiCausal[j] *= denominatorSum/gain;
+   }
+}
+/* *************************************************************** */
+/// @brief Convolve the interleaved lines of a buffer with a symmetric kernel
+/// of the specified radius. Values outside of the lines are considered null
+template <class BTYPE>
+void reg_tools_convolveLines(BTYPE *input,
+                             BTYPE *output,
+                             int length,
+                             BTYPE *kernel,
+                             int radius)
+{
+   // The sums are accumulated in a local array that the compiler can keep
+   // in registers
+   BTYPE sum[CONVOLUTION_LANE_NUMBER];
+   for(int i=0; i<length; ++i)
+   {
+      BTYPE *inPtr=&input[i*CONVOLUTION_LANE_NUMBER];
+      BTYPE centreValue=kernel[radius];
+      for(int l=0; l<CONVOLUTION_LANE_NUMBER; ++l)
+         sum[l]=centreValue*inPtr[l];
+      if(i>=radius && i+radius<length)
+      {
+         // Both kernel sides are within the line
+         for(int k=1; k<=radius; ++k)
+         {
+            BTYPE kernelValue=kernel[radius+k];
+            BTYPE *prePtr=&input[(i-k)*CONVOLUTION_LANE_NUMBER];
+            BTYPE *postPtr=&input[(i+k)*CONVOLUTION_LANE_NUMBER];
+            for(int l=0; l<CONVOLUTION_LANE_NUMBER; ++l)
+               sum[l] += kernelValue*(prePtr[l]+postPtr[l]);
+         }
+      }
+      else
+      {
+         for(int k=-radius; k<=radius; ++k)
+         {
+            if(k==0 || i+k<0 || i+k>=length) continue;
+            BTYPE kernelValue=kernel[radius+k];
+            BTYPE *currentPtr=&input[(i+k)*CONVOLUTION_LANE_NUMBER];
+            for(int l=0; l<CONVOLUTION_LANE_NUMBER; ++l)
+               sum[l] += kernelValue*currentPtr[l];
+         }
+      }
+      BTYPE *outPtr=&output[i*CONVOLUTION_LANE_NUMBER];
+      for(int l=0; l<CONVOLUTION_LANE_NUMBER; ++l)
+         outPtr[l]=sum[l];
+   }
+}
+/* *************************************************************** */
+/// @brief Sum the values of the interleaved lines of a buffer over a window
+/// of the specified radius using running sums. The input buffer is modified
+template <class BTYPE>
+void reg_tools_boxFilterLines(BTYPE *input,
+                              BTYPE *output,
+                              int length,
+                              int radius)
+{
+   for(int i=1; i<length; ++i)
+   {
+      BTYPE *currentPtr=&input[i*CONVOLUTION_LANE_NUMBER];
+      BTYPE *previousPtr=&input[(i-1)*CONVOLUTION_LANE_NUMBER];
+      for(int l=0; l<CONVOLUTION_LANE_NUMBER; ++l)
+         currentPtr[l] += previousPtr[l];
+   }
+   for(int i=0; i<length; ++i)
+   {
+      int last=i+radius<length?i+radius:length-1;
+      BTYPE *outPtr=&output[i*CONVOLUTION_LANE_NUMBER];
+      BTYPE *lastPtr=&input[last*CONVOLUTION_LANE_NUMBER];
+      if(i-radius-1>=0)
+      {
+         BTYPE *firstPtr=&input[(i-radius-1)*CONVOLUTION_LANE_NUMBER];
+         for(int l=0; l<CONVOLUTION_LANE_NUMBER; ++l)
+            outPtr[l]=lastPtr[l]-firstPtr[l];
+      }
+      else
+      {
+         for(int l=0; l<CONVOLUTION_LANE_NUMBER; ++l)
+            outPtr[l]=lastPtr[l];
+      }
+   }
+}
+/* *************************************************************** */
+/// @brief Apply the recursive Gaussian filter to the interleaved lines of a
+/// buffer. Values outside of the lines are considered null, which is exact
+/// as both passes start from a null state
+template <class BTYPE>
+void reg_tools_recursiveGaussianLines(BTYPE *input,
+                                      BTYPE *output,
+                                      int length,
+                                      double *causal,
+                                      double *antiCausal,
+                                      double *denominator)
+{
+   BTYPE n0=causal[0], n1=causal[1], n2=causal[2], n3=causal[3];
+   BTYPE m1=antiCausal[0], m2=antiCausal[1], m3=antiCausal[2], m4=antiCausal[3];
+   BTYPE d1=denominator[0], d2=denominator[1], d3=denominator[2], d4=denominator[3];
+   // The previous input and output values of every lane are kept in local arrays
+   BTYPE x1[CONVOLUTION_LANE_NUMBER], x2[CONVOLUTION_LANE_NUMBER];
+   BTYPE x3[CONVOLUTION_LANE_NUMBER], x4[CONVOLUTION_LANE_NUMBER];
+   BTYPE y1[CONVOLUTION_LANE_NUMBER], y2[CONVOLUTION_LANE_NUMBER];
+   BTYPE y3[CONVOLUTION_LANE_NUMBER], y4[CONVOLUTION_LANE_NUMBER];
+   BTYPE *inPtr, *outPtr;
+   int i, l;
+   // Causal pass
+   for(l=0; l<CONVOLUTION_LANE_NUMBER; ++l)
+      x1[l]=x2[l]=x3[l]=y1[l]=y2[l]=y3[l]=y4[l]=0;
+   for(i=0; i<length; ++i)
+   {
+      inPtr=&input[i*CONVOLUTION_LANE_NUMBER];
+      outPtr=&output[i*CONVOLUTION_LANE_NUMBER];
+      for(l=0; l<CONVOLUTION_LANE_NUMBER; ++l)
+      {
+         BTYPE value=n0*inPtr[l] + n1*x1[l] + n2*x2[l] + n3*x3[l] -
+               d1*y1[l] - d2*y2[l] - d3*y3[l] - d4*y4[l];
+         x3[l]=x2[l];
+         x2[l]=x1[l];
+         x1[l]=inPtr[l];
+         y4[l]=y3[l];
+         y3[l]=y2[l];
+         y2[l]=y1[l];
+         y1[l]=outPtr[l]=value;
+      }
+   }
+   // Anti-causal pass, its values are added to the causal ones
+   for(l=0; l<CONVOLUTION_LANE_NUMBER; ++l)
+      x1[l]=x2[l]=x3[l]=x4[l]=y1[l]=y2[l]=y3[l]=y4[l]=0;
+   for(i=length-1; i>=0; --i)
+   {
+      inPtr=&input[i*CONVOLUTION_LANE_NUMBER];
+      outPtr=&output[i*CONVOLUTION_LANE_NUMBER];
+      for(l=0; l<CONVOLUTION_LANE_NUMBER; ++l)
+      {
+         BTYPE value=m1*x1[l] + m2*x2[l] + m3*x3[l] + m4*x4[l] -
+               d1*y1[l] - d2*y2[l] - d3*y3[l] - d4*y4[l];
+         x4[l]=x3[l];
+         x3[l]=x2[l];
+         x2[l]=x1[l];
+         x1[l]=inPtr[l];
+         y4[l]=y3[l];
+         y3[l]=y2[l];
+         y2[l]=y1[l];
+         y1[l]=value;
+         outPtr[l] += value;
+      }
+   }
+}
+/* *************************************************************** */
+/// @brief Filter all the lines of a 3D intensity image and of its density
+/// image along the specified axis. The values are buffered and filtered
+/// using the BTYPE precision
+template <class DTYPE, class BTYPE>
+void reg_tools_filterImageLines(DTYPE *intensityPtr,
+                                float *densityPtr,
+                                int *imageDim,
+                                int n,
+                                int kernelType,
+                                double *kernel,
+                                int radius,
+                                bool recursive,
+                                double *causal,
+                                double *antiCausal,
+                                double *denominator,
+                                int *boxRadii)
+{
+   BTYPE *lineKernel=(BTYPE *)malloc((2*radius+1)*sizeof(BTYPE));
+   for(int i=0; i<2*radius+1; ++i)
+      lineKernel[i]=static_cast<BTYPE>(kernel[i]);
+   // The lines along the current axis are processed in blocks of
+   // CONVOLUTION_LINE_NUMBER lines. Along y and z, the lines of a block are
+   // consecutive in memory and read with a unit stride
+   int linePerPlane, planeNumber, lineOffset;
+   size_t planeOffset, voxelOffset;
+   switch(n)
+   {
+   case 0:
+      linePerPlane = imageDim[1]*imageDim[2];
+      planeNumber = 1;
+      planeOffset = 0;
+      lineOffset = imageDim[0];
+      voxelOffset = 1;
+      break;
+   case 1:
+      linePerPlane = imageDim[0];
+      planeNumber = imageDim[2];
+      planeOffset = (size_t)imageDim[0]*imageDim[1];
+      lineOffset = 1;
+      voxelOffset = imageDim[0];
+      break;
+   default:
+      linePerPlane = imageDim[0]*imageDim[1];
+      planeNumber = 1;
+      planeOffset = 0;
+      lineOffset = 1;
+      voxelOffset = (size_t)imageDim[0]*imageDim[1];
+   }
+   int length = imageDim[n];
+   // The successive box filters are applied to lines that are padded with
+   // null values, so that they are equivalent to a single kernel at the borders
+   int padding = kernelType==ITERATED_BOX_KERNEL?radius:0;
+   int bufferLength = length+2*padding;
+   int blockPerPlane = (linePerPlane+CONVOLUTION_LINE_NUMBER-1)/CONVOLUTION_LINE_NUMBER;
+   int blockNumber = blockPerPlane*planeNumber;
+   int block, firstLine, lineNumber, i, l, p;
+   size_t blockIndex, voxelIndex;
+   BTYPE *inputBuffer, *outputBuffer, *resultBuffer;
+#if defined (_OPENMP)
+#pragma omp parallel default(none) \
+   shared(intensityPtr, densityPtr, lineKernel, radius, kernelType, recursive, \
+   causal, antiCausal, denominator, boxRadii, linePerPlane, planeOffset, lineOffset, voxelOffset, \
+   length, padding, bufferLength, blockPerPlane, blockNumber) \
+   private(block, firstLine, lineNumber, i, l, p, blockIndex, voxelIndex, \
+   inputBuffer, outputBuffer, resultBuffer)
+#endif // _OPENMP
+   {
+      // Every thread uses its own line buffers
+      inputBuffer=(BTYPE *)malloc((size_t)bufferLength*CONVOLUTION_LANE_NUMBER*sizeof(BTYPE));
+      outputBuffer=(BTYPE *)malloc((size_t)bufferLength*CONVOLUTION_LANE_NUMBER*sizeof(BTYPE));
+#if defined (_OPENMP)
+#pragma omp for schedule(static)
+#endif // _OPENMP
+      for(block=0; block<blockNumber; ++block)
+      {
+         firstLine=(block%blockPerPlane)*CONVOLUTION_LINE_NUMBER;
+         lineNumber=linePerPlane-firstLine;
+         if(lineNumber>CONVOLUTION_LINE_NUMBER)
+            lineNumber=CONVOLUTION_LINE_NUMBER;
+         blockIndex=(size_t)(block/blockPerPlane)*planeOffset +
+               (size_t)firstLine*lineOffset;
+         // Fetch the lines into the interleaved buffer
+         for(i=0; i<padding*CONVOLUTION_LANE_NUMBER; ++i)
+            inputBuffer[i]=inputBuffer[(padding+length)*CONVOLUTION_LANE_NUMBER+i]=0;
+         for(i=0; i<length; ++i)
+         {
+            BTYPE *bufferPtr=&inputBuffer[(padding+i)*CONVOLUTION_LANE_NUMBER];
+            voxelIndex=blockIndex+i*voxelOffset;
+            for(l=0; l<lineNumber; ++l)
+            {
+               bufferPtr[l]=intensityPtr[voxelIndex];
+               bufferPtr[CONVOLUTION_LINE_NUMBER+l]=densityPtr[voxelIndex];
+               voxelIndex+=lineOffset;
+            }
+            for(; l<CONVOLUTION_LINE_NUMBER; ++l)
+               bufferPtr[l]=bufferPtr[CONVOLUTION_LINE_NUMBER+l]=0;
+         }
+         // Filter the intensity and density lines
+         if(recursive)
+         {
+            reg_tools_recursiveGaussianLines(inputBuffer, outputBuffer, length,
+                                             causal, antiCausal, denominator);
+            resultBuffer=outputBuffer;
+         }
+         else if(kernelType==MEAN_KERNEL)
+         {
+            reg_tools_boxFilterLines(inputBuffer, outputBuffer, length, radius);
+            resultBuffer=outputBuffer;
+         }
+         else if(kernelType==ITERATED_BOX_KERNEL)
+         {
+            // The box filters alternate between the two buffers
+            for(p=0; p<ITERATED_BOX_PASS_NUMBER; ++p)
+            {
+               if(p%2==0)
+               {
+                  reg_tools_boxFilterLines(inputBuffer, outputBuffer, bufferLength, boxRadii[p]);
+                  resultBuffer=outputBuffer;
+               }
+               else
+               {
+                  reg_tools_boxFilterLines(outputBuffer, inputBuffer, bufferLength, boxRadii[p]);
+                  resultBuffer=inputBuffer;
+               }
+            }
+         }
+         else
+         {
+            reg_tools_convolveLines(inputBuffer, outputBuffer, length,
+                                    lineKernel, radius);
+            resultBuffer=outputBuffer;
+         }
+         // Store the filtered values in place
+         for(i=0; i<length; ++i)
+         {
+            BTYPE *bufferPtr=&resultBuffer[(padding+i)*CONVOLUTION_LANE_NUMBER];
+            voxelIndex=blockIndex+i*voxelOffset;
+            for(l=0; l<lineNumber; ++l)
+            {
+               intensityPtr[voxelIndex]=static_cast<DTYPE>(bufferPtr[l]);
+               densityPtr[voxelIndex]=static_cast<float>(bufferPtr[CONVOLUTION_LINE_NUMBER+l]);
+               voxelIndex+=lineOffset;
+            }
+         }
+      } // block
+      free(inputBuffer);
+      free(outputBuffer);
+   }
+   free(lineKernel);
+}
+/* *************************************************************** */
 template <class DTYPE>
 void reg_tools_kernelConvolution_core(nifti_image *image,
                                       float *sigma,
@@ -1108,11 +1493,6 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
                                       bool *timePoint,
                                       bool *axis)
 {
-   if(image->nx>2048 || image->ny>2048 || image->nz>2048){
-      reg_print_fct_error("reg_tools_kernelConvolution_core");
-      reg_print_msg_error("This function does not support images with dimension > 2048");
-      reg_exit();
-   }
 #ifdef WIN32
    long index;
    long voxelNumber = (long)image->nx*image->ny*image->nz;
@@ -1148,19 +1528,25 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
          // Loop over the x, y and z dimensions
          for(int n=0; n<3; n++)
          {
-            if(axis[n] && image->dim[n]>1)
+            if(axis[n] && imageDim[n]>1)
             {
                double temp;
                if(sigma[t]>0) temp=sigma[t]/image->pixdim[n+1]; // mm to voxel
                else temp=fabs(sigma[t]); // voxel based if negative value
                int radius=0;
                // Define the kernel size
+               int boxRadii[ITERATED_BOX_PASS_NUMBER];
                if(kernelType==MEAN_KERNEL || kernelType==LINEAR_KERNEL)
                {
                   // Mean  or linear filtering
                   radius = static_cast<int>(temp);
                }
-               else if(kernelType==GAUSSIAN_KERNEL)
+               else if(kernelType==ITERATED_BOX_KERNEL)
+               {
+                  // Successive box filters, the radius is the kernel support
+                  radius = reg_tools_getIteratedBoxRadii(temp, boxRadii);
+               }
+               else if(kernelType==GAUSSIAN_KERNEL || kernelType==RECURSIVE_GAUSSIAN_KERNEL)
                {
                   // Gaussian kernel
                   radius=static_cast<int>(temp*3.0f);
@@ -1177,256 +1563,64 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
                }
                if(radius>0)
                {
-                  // Allocate the kernel
-                  float kernel[4096];
+                  // The recursive filter is only used when it is both
+                  // accurate and cheaper than the kernel
+                  bool recursive = kernelType==RECURSIVE_GAUSSIAN_KERNEL &&
+                        temp>=RECURSIVE_GAUSSIAN_MIN_SIGMA;
+                  double causal[4], antiCausal[4], denominator[4];
+                  if(recursive)
+                     reg_tools_getRecursiveGaussianCoefficients(temp, causal, antiCausal,
+                                                                denominator);
+                  // Allocate and fill the kernel, it is not used by the box
+                  // filters and the recursive filter
+                  double *kernel=(double *)malloc((2*radius+1)*sizeof(double));
                   double kernelSum=0;
-                  // Fill the kernel
-                  if(kernelType==CUBIC_SPLINE_KERNEL)
+                  for(int i=-radius; i<=radius; i++)
                   {
-                     // Compute the Cubic Spline kernel
-                     for(int i=-radius; i<=radius; i++)
+                     double relative;
+                     switch(kernelType)
                      {
+                     case CUBIC_SPLINE_KERNEL:
                         // temp contains the kernel node spacing
-                        double relative = (double)(fabs((double)(double)i/(double)temp));
-                        if(relative<1.0) kernel[i+radius] = (float)(2.0/3.0 - relative*relative + 0.5*relative*relative*relative);
-                        else if (relative<2.0) kernel[i+radius] = (float)(-(relative-2.0)*(relative-2.0)*(relative-2.0)/6.0);
+                        relative = fabs((double)i/temp);
+                        if(relative<1.0) kernel[i+radius] = 2.0/3.0 - relative*relative + 0.5*relative*relative*relative;
+                        else if (relative<2.0) kernel[i+radius] = -(relative-2.0)*(relative-2.0)*(relative-2.0)/6.0;
                         else kernel[i+radius]=0;
-                        kernelSum += kernel[i+radius];
-                     }
-                  }
-                  else if(kernelType==GAUSSIAN_KERNEL)
-                  {
-                     // Compute the Gaussian kernel
-                     for(int i=-radius; i<=radius; i++)
-                     {
+                        break;
+                     case GAUSSIAN_KERNEL:
+                     case RECURSIVE_GAUSSIAN_KERNEL:
                         // 2.506... = sqrt(2*pi)
                         // temp contains the sigma in voxel
-                        kernel[radius+i]=static_cast<float>(exp(-(double)(i*i)/(2.0*reg_pow2(temp))) /
-                                                            (temp*2.506628274631));
-                        kernelSum += kernel[radius+i];
-                     }
-                  }
-                  else if(kernelType==LINEAR_KERNEL)
-                  {
-                     // Compute the linear kernel
-                     for(int i=-radius; i<=radius; i++)
-                     {
-                        kernel[radius+i]= 1.f - fabs(static_cast<float>(i)/static_cast<float>(radius));
-                        kernelSum += kernel[radius+i];
-                     }
-                  }
-                  else if(kernelType==MEAN_KERNEL && imageDim[2]==1)
-                  {
-                     // Compute the mean kernel
-                     for(int i=-radius; i<=radius; i++)
-                     {
-                        kernel[radius+i]= 1.f;
-                        kernelSum += kernel[radius+i];
+                        kernel[radius+i]=exp(-(double)(i*i)/(2.0*reg_pow2(temp))) /
+                              (temp*2.506628274631);
+                        break;
+                     case LINEAR_KERNEL:
+                        kernel[radius+i]= 1.0 - fabs((double)i/(double)radius);
+                        break;
+                     default:
+                        kernel[radius+i]= 1.0;
                      }
+                     kernelSum += kernel[radius+i];
                   }
-                  // No kernel is required for the mean filtering
                   // No need for kernel normalisation as this is handle by the density function
 #ifndef NDEBUG
                   char text[255];
-                  sprintf(text, "Convolution type[%i] dim[%i] tp[%i] radius[%i] kernelSum[%g]", kernelType, n, t, radius, kernelSum);
+                  sprintf(text, "Convolution type[%i] dim[%i] tp[%i] radius[%i] kernelSum[%g] recursive[%i]",
+                          kernelType, n, t, radius, kernelSum, recursive);
                   reg_print_msg_debug(text);
 #endif
-                  int planeNumber, planeIndex, lineOffset;
-                  int lineIndex, shiftPre, shiftPst, k;
-                  switch(n)
-                  {
-                  case 0:
-                     planeNumber=imageDim[1]*imageDim[2];
-                     lineOffset  = 1;
-                     break;
-                  case 1:
-                     planeNumber = imageDim[0]*imageDim[2];
-                     lineOffset  = imageDim[0];
-                     break;
-                  case 2:
-                     planeNumber = imageDim[0]*imageDim[1];
-                     lineOffset  = planeNumber;
-                     break;
-                  }
-
-                  size_t realIndex;
-                  float *kernelPtr, kernelValue;
-                  double densitySum, intensitySum;
-                  DTYPE *currentIntensityPtr=NULL;
-                  float *currentDensityPtr = NULL;
-                  DTYPE bufferIntensity[2048];
-                  float bufferDensity[2048];
-                  double bufferIntensitycur=0;
-                  double bufferDensitycur=0;
-
-#ifdef _USE_SSE
-                  union
-                  {
-                     __m128 m;
-                     float f[4] ;
-                  } intensity_sum_sse, density_sum_sse;
-                  __m128 kernel_sse, intensity_sse, density_sse;
-#endif
-
-#if defined (_OPENMP)
-#ifdef _USE_SSE
-#pragma omp parallel for default(none) \
-   shared(imageDim, intensityPtr, densityPtr, radius, kernel, lineOffset, n, \
-   planeNumber,kernelSum) \
-   private(realIndex,currentIntensityPtr,currentDensityPtr,lineIndex,bufferIntensity, \
-   bufferDensity,shiftPre,shiftPst,kernelPtr,kernelValue,densitySum,intensitySum, \
-   k, bufferIntensitycur,bufferDensitycur, planeIndex, \
-   kernel_sse, intensity_sse, density_sse, intensity_sum_sse, density_sum_sse)
-#else
-#pragma omp parallel for default(none) \
-   shared(imageDim, intensityPtr, densityPtr, radius, kernel, lineOffset, n, \
-   planeNumber,kernelSum) \
-   private(realIndex,currentIntensityPtr,currentDensityPtr,lineIndex,bufferIntensity, \
-   bufferDensity,shiftPre,shiftPst,kernelPtr,kernelValue,densitySum,intensitySum, \
-   k, bufferIntensitycur,bufferDensitycur, planeIndex)
-#endif
-#endif // _OPENMP
-                  // Loop over the different voxel
-                  for(planeIndex=0; planeIndex<planeNumber; ++planeIndex)
-                  {
-
-                     switch(n)
-                     {
-                     case 0:
-                        realIndex = planeIndex * imageDim[0];
-                        break;
-                     case 1:
-                        realIndex = (planeIndex/imageDim[0]) *
-                              imageDim[0]*imageDim[1] +
-                              planeIndex%imageDim[0];
-                        break;
-                     case 2:
-                        realIndex = planeIndex;
-                        break;
-                     default:
-                        realIndex=0;
-                     }
-                     // Fetch the current line into a stack buffer
-                     currentIntensityPtr= &intensityPtr[realIndex];
-                     currentDensityPtr  = &densityPtr[realIndex];
-                     for(lineIndex=0; lineIndex<imageDim[n]; ++lineIndex)
-                     {
-                        bufferIntensity[lineIndex] = *currentIntensityPtr;
-                        bufferDensity[lineIndex]   = *currentDensityPtr;
-                        currentIntensityPtr       += lineOffset;
-                        currentDensityPtr         += lineOffset;
-                     }
-                     if(kernelSum>0)
-                     {
-                        // Perform the kernel convolution along 1 line
-                        for(lineIndex=0; lineIndex<imageDim[n]; ++lineIndex)
-                        {
-                           // Define the kernel boundaries
-                           shiftPre = lineIndex - radius;
-                           shiftPst = lineIndex + radius + 1;
-                           if(shiftPre<0)
-                           {
-                              kernelPtr = &kernel[-shiftPre];
-                              shiftPre=0;
-                           }
-                           else kernelPtr = &kernel[0];
-                           if(shiftPst>imageDim[n]) shiftPst=imageDim[n];
-                           // Set the current values to zero
-                           // Increment the current value by performing the weighted sum
-#ifdef _USE_SSE
-                           intensity_sum_sse.m = _mm_set_ps1(0.0);
-                           density_sum_sse.m = _mm_set_ps1(0.0);
-                           k=shiftPre;
-                           while(k<shiftPst-3)
-                           {
-                              kernel_sse = _mm_set_ps(kernelPtr[0], kernelPtr[1], kernelPtr[2], kernelPtr[3]);
-                              kernelPtr+=4;
-                              intensity_sse = _mm_set_ps(static_cast<float>(bufferIntensity[k]),
-                                                         static_cast<float>(bufferIntensity[k+1]),
-                                                         static_cast<float>(bufferIntensity[k+2]),
-                                                         static_cast<float>(bufferIntensity[k+3]));
-                              density_sse = _mm_set_ps(bufferDensity[k],
-                                    bufferDensity[k+1],
-                                    bufferDensity[k+2],
-                                    bufferDensity[k+3]);
-                              k+=4;
-                              intensity_sum_sse.m = _mm_add_ps(_mm_mul_ps(kernel_sse, intensity_sse), intensity_sum_sse.m);
-                              density_sum_sse.m = _mm_add_ps(_mm_mul_ps(kernel_sse, density_sse), density_sum_sse.m);
-                           }
-#ifdef __SSE3__
-                           intensity_sum_sse.m = _mm_hadd_ps(intensity_sum_sse.m, density_sum_sse.m);
-                           intensity_sum_sse.m = _mm_hadd_ps(intensity_sum_sse.m, intensity_sum_sse.m);
-                           intensitySum = intensity_sum_sse.f[0];
-                           densitySum = intensity_sum_sse.f[1];
-#else
-                           intensitySum = intensity_sum_sse.f[0] + intensity_sum_sse.f[1] + intensity_sum_sse.f[2] + intensity_sum_sse.f[3];
-                           densitySum = density_sum_sse.f[0] + density_sum_sse.f[1] + density_sum_sse.f[2] + density_sum_sse.f[3];
-#endif
-                           while(k<shiftPst)
-                           {
-                              kernelValue   = *kernelPtr++;
-                              intensitySum +=  kernelValue * bufferIntensity[k];
-                              densitySum   +=  kernelValue * bufferDensity[k++];
-                           }
-#else
-                           intensitySum=0;
-                           densitySum=0;
-                           for(k=shiftPre; k<shiftPst; ++k)
-                           {
-                              kernelValue   = *kernelPtr++;
-                              intensitySum +=  kernelValue * bufferIntensity[k];
-                              densitySum   +=  kernelValue * bufferDensity[k];
-                           }
-#endif
-                           // Store the computed value inplace
-                           intensityPtr[realIndex] = static_cast<DTYPE>(intensitySum);
-                           densityPtr[realIndex] = static_cast<float>(densitySum);
-                           realIndex += lineOffset;
-                        } // line convolution
-                     } // kernel sum
-                     else
-                     {
-                        for(lineIndex=1; lineIndex<imageDim[n]; ++lineIndex)
-                        {
-                           bufferIntensity[lineIndex]+=bufferIntensity[lineIndex-1];
-                           bufferDensity[lineIndex]+=bufferDensity[lineIndex-1];
-                        }
-                        shiftPre = -radius - 1;
-                        shiftPst = radius;
-                        for(lineIndex=0; lineIndex<imageDim[n]; ++lineIndex,++shiftPre,++shiftPst)
-                        {
-                           if(shiftPre>-1)
-                           {
-                              if(shiftPst<imageDim[n])
-                              {
-                                 bufferIntensitycur = bufferIntensity[shiftPre]-bufferIntensity[shiftPst];
-                                 bufferDensitycur = bufferDensity[shiftPre]-bufferDensity[shiftPst];
-                              }
-                              else
-                              {
-                                 bufferIntensitycur = bufferIntensity[shiftPre]-bufferIntensity[imageDim[n]-1];
-                                 bufferDensitycur = bufferDensity[shiftPre]-bufferDensity[imageDim[n]-1];
-                              }
-                           }
-                           else
-                           {
-                              if(shiftPst<imageDim[n])
-                              {
-                                 bufferIntensitycur = -bufferIntensity[shiftPst];
-                                 bufferDensitycur = -bufferDensity[shiftPst];
-                              }
-                              else{
-                                 bufferIntensitycur = 0;
-                                 bufferDensitycur = 0;
-                              }
-                           }
-                           intensityPtr[realIndex]=static_cast<DTYPE>(bufferIntensitycur);
-                           densityPtr[realIndex]=static_cast<float>(bufferDensitycur);
-
-                           realIndex += lineOffset;
-                        } // line convolution of mean filter
-                     } // No kernel computation
-                  } // pixel in starting plane
+                  // Kernel convolutions are computed in the image precision, the
+                  // running sums and the recursive filter in double precision
+                  if(recursive || kernelType==MEAN_KERNEL || kernelType==ITERATED_BOX_KERNEL)
+                     reg_tools_filterImageLines<DTYPE,double>(intensityPtr, densityPtr, imageDim,
+                                                              n, kernelType, kernel, radius,
+                                                              recursive, causal, antiCausal, denominator,
+                                                              boxRadii);
+                  else reg_tools_filterImageLines<DTYPE,DTYPE>(intensityPtr, densityPtr, imageDim,
+                                                               n, kernelType, kernel, radius,
+                                                               recursive, causal, antiCausal, denominator,
+                                                               boxRadii);
+                  free(kernel);
                } // radius > 0
             } // active axis
          } // axes
@@ -23,9 +23,15 @@ typedef enum
    MEAN_KERNEL,
    LINEAR_KERNEL,
    GAUSSIAN_KERNEL,
-   CUBIC_SPLINE_KERNEL
+   CUBIC_SPLINE_KERNEL,
+   RECURSIVE_GAUSSIAN_KERNEL,
+   ITERATED_BOX_KERNEL
 } NREG_CONV_KERNEL_TYPE;
 
+/// Standard deviation, in voxel, from which the RECURSIVE_GAUSSIAN_KERNEL
+/// convolution uses a recursive filter instead of a truncated Gaussian kernel
+#define RECURSIVE_GAUSSIAN_MIN_SIGMA 6.0
+
 /* *************************************************************** */
 /** @brief This function check some header parameters and correct them in
  * case of error. For example no dimension is lower than one. The scl_sclope
@@ -83,6 +89,12 @@ void reg_getRealImageSpacing(nifti_image *image,
  * @param image Image to be smoothed
  * @param sigma Standard deviation of the Gaussian kernel
  * to use. The kernel is bounded between +/- 3 sigma.
+ * @param kernelType Type of kernel, see NREG_CONV_KERNEL_TYPE. With
+ * RECURSIVE_GAUSSIAN_KERNEL, the Gaussian convolution is approximated by a
+ * recursive filter whose cost does not depend on sigma once sigma reaches
+ * RECURSIVE_GAUSSIAN_MIN_SIGMA voxels. With ITERATED_BOX_KERNEL, it is
+ * approximated by successive box filters. MEAN_KERNEL and ITERATED_BOX_KERNEL
+ * are computed with running sums and their cost does not depend on sigma.
  * @param axis Boolean array to specify which axis have to be
  * smoothed. The array follow the dim array of the nifti header.
  */
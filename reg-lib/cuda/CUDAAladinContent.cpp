@@ -159,6 +159,8 @@ void CudaAladinContent::allocateCuPtrs()
       cudaCommon_allocateArrayToDevice<float>(&warpedImageArray_d, this->CurrentWarped->nvox);
       cudaCommon_transferFromDeviceToNiftiSimple<float>(&warpedImageArray_d, this->CurrentWarped);
    }
+   if (this->CurrentReference != NULL && this->CurrentDeformationField == NULL)
+      this->AllocateDeformationField(this->bytes);
    if (this->CurrentDeformationField != NULL) {
       cudaCommon_allocateArrayToDevice<float>(&deformationFieldArray_d, this->CurrentDeformationField->nvox);
       cudaCommon_transferFromDeviceToNiftiSimple<float>(&deformationFieldArray_d, this->CurrentDeformationField);
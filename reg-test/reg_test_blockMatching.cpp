@@ -5,6 +5,7 @@
 #include "_reg_globalTrans.h"
 
 #include "BlockMatchingKernel.h"
+#include "FastBlockMatchingKernel.h"
 #include "Platform.h"
 
 #include "AladinContent.h"
@@ -79,11 +80,15 @@ void check_matching_difference(int dim,
    }
 }
 
-void test(AladinContent *con, int platformCode) {
+void test(AladinContent *con, int platformCode, std::string kernelName) {
 
    Platform *platform = new Platform(platformCode);
 
-   Kernel *blockMatchingKernel = platform->createKernel(BlockMatchingKernel::getName(), con);
+   Kernel *blockMatchingKernel = platform->createKernel(kernelName, con);
+   if (blockMatchingKernel == NULL) {
+      reg_print_msg_error("The block matching kernel is not available on this platform");
+      reg_exit();
+   }
    blockMatchingKernel->castTo<BlockMatchingKernel>()->calculate();
 
    delete blockMatchingKernel;
@@ -93,8 +98,8 @@ void test(AladinContent *con, int platformCode) {
 int main(int argc, char **argv)
 {
 
-   if (argc != 5) {
-      fprintf(stderr, "Usage: %s <refImage> <warpedImage> <expectedBlockMatchingMatrix> <platformCode>\n", argv[0]);
+   if (argc != 5 && argc != 6) {
+      fprintf(stderr, "Usage: %s <refImage> <warpedImage> <expectedBlockMatchingMatrix> <platformCode> [fastKernel]\n", argv[0]);
       return EXIT_FAILURE;
    }
 
@@ -102,6 +107,9 @@ int main(int argc, char **argv)
    char *inputWarpedImageName = argv[2];
    char* expectedBlockMatchingMatrixName = argv[3];
    int   platformCode = atoi(argv[4]);
+   std::string kernelName = BlockMatchingKernel::getName();
+   if (argc == 6 && atoi(argv[5]) == 1)
+      kernelName = FastBlockMatchingKernel::getName();
 
    // Read the input reference image
    nifti_image *referenceImage = reg_io_ReadImageFile(inputRefImageName);
@@ -156,7 +164,17 @@ int main(int argc, char **argv)
    }
    con->setCurrentWarped(warpedImage);
    //con->setCurrentWarped(referenceImage);
-   test(con, platformCode);
+#if defined (_OPENMP)
+   // The block matching should not modify the number of threads
+   int threadNumber = omp_get_max_threads();
+#endif
+   test(con, platformCode, kernelName);
+#if defined (_OPENMP)
+   if (omp_get_max_threads() != threadNumber) {
+      reg_print_msg_error("The block matching modified the number of OpenMP threads");
+      return EXIT_FAILURE;
+   }
+#endif
    blockMatchingParams = con->getBlockMatchingParams();
 
 #ifndef NDEBUG
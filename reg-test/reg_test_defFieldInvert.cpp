@@ -0,0 +1,148 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_localTrans.h"
+#include "_reg_globalTrans.h"
+#include "_reg_tools.h"
+
+#define CONTROL_POINT_SPACING 5.f
+#define TOLERANCE 1.0e-6f
+/// Maximal inverse consistency error accepted in mm
+#define EPS 1.0e-4
+
+/// @brief Invert a smooth deformation field and check that the composition
+/// of the field with its inverse is the identity. The error has to decrease
+/// with the number of iterations and a seeded inversion has to be as accurate
+int main(int argc, char **argv)
+{
+   if(argc!=2)
+   {
+      fprintf(stderr, "Usage: %s <refImage>\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   char *inputRefImageName=argv[1];
+
+   /* Read the reference image */
+   nifti_image *refImage = reg_io_ReadImageFile(inputRefImageName);
+   if(refImage == NULL)
+   {
+      fprintf(stderr,"[NiftyReg ERROR] Error when reading the reference image: %s\n",
+              inputRefImageName);
+      return EXIT_FAILURE;
+   }
+   if(refImage->nz==1)
+   {
+      fprintf(stderr,"[NiftyReg ERROR] The inversion is only implemented in 3D\n");
+      return EXIT_FAILURE;
+   }
+
+   // A smooth deformation is generated from a perturbed control point grid
+   float spacing[3]={CONTROL_POINT_SPACING, CONTROL_POINT_SPACING, CONTROL_POINT_SPACING};
+   nifti_image *controlPointGrid = NULL;
+   reg_createControlPointGrid<float>(&controlPointGrid, refImage, spacing);
+   mat44 identity;
+   reg_mat44_eye(&identity);
+   reg_affine_getDeformationField(&identity, controlPointGrid);
+   float *cppPtr = static_cast<float *>(controlPointGrid->data);
+   srand(0);
+   for(size_t i=0; i<controlPointGrid->nvox; ++i)
+      cppPtr[i] += 0.5f*CONTROL_POINT_SPACING*((float)rand()/(float)RAND_MAX-0.5f);
+
+   nifti_image *deformationField = nifti_copy_nim_info(refImage);
+   deformationField->ndim=deformationField->dim[0]=5;
+   deformationField->nt=deformationField->dim[4]=1;
+   deformationField->nu=deformationField->dim[5]=3;
+   nifti_update_dims_from_array(deformationField);
+   deformationField->datatype=NIFTI_TYPE_FLOAT32;
+   deformationField->nbyper=sizeof(float);
+   deformationField->intent_code=NIFTI_INTENT_VECTOR;
+   memset(deformationField->intent_name, 0, 16);
+   strcpy(deformationField->intent_name,"NREG_TRANS");
+   deformationField->intent_p1=DEF_FIELD;
+   deformationField->scl_slope=1.f;
+   deformationField->scl_inter=0.f;
+   deformationField->data=calloc(deformationField->nvox, deformationField->nbyper);
+   reg_spline_getDeformationField(controlPointGrid, deformationField, NULL, false, true);
+
+   nifti_image *inverseField = nifti_copy_nim_info(deformationField);
+   inverseField->data=calloc(inverseField->nvox, inverseField->nbyper);
+
+   int result = EXIT_SUCCESS;
+
+   // The error has to decrease with the number of iterations
+   int iterationNumber[3]={1, 5, 100};
+   double inverseError[3][2];
+   for(int i=0; i<3; ++i)
+   {
+      reg_defFieldInvert(deformationField, inverseField, TOLERANCE,
+                         iterationNumber[i], false, inverseError[i]);
+      printf("reg_test_defFieldInvert: %i iteration(s) - mean error %g mm - max error %g mm\n",
+             iterationNumber[i], inverseError[i][0], inverseError[i][1]);
+      if(i>0 && inverseError[i][0]>inverseError[i-1][0])
+         result = EXIT_FAILURE;
+   }
+   if(inverseError[2][1]>EPS)
+      result = EXIT_FAILURE;
+
+   // The composition of the deformation with its inverse is the identity.
+   // Only the positions mapped inside the field are checked as the
+   // composition uses a sliding effect instead of extrapolating the field
+   nifti_image *composedField = nifti_copy_nim_info(inverseField);
+   composedField->data=malloc(composedField->nvox*composedField->nbyper);
+   memcpy(composedField->data, inverseField->data, composedField->nvox*composedField->nbyper);
+   reg_defField_compose(deformationField, composedField, NULL);
+   size_t voxelNumber = (size_t)inverseField->nx*inverseField->ny*inverseField->nz;
+   float *invPtr = static_cast<float *>(inverseField->data);
+   float *comPtr = static_cast<float *>(composedField->data);
+   mat44 *xyz = inverseField->sform_code>0?&inverseField->sto_xyz:&inverseField->qto_xyz;
+   mat44 *ijk = inverseField->sform_code>0?&inverseField->sto_ijk:&inverseField->qto_ijk;
+   double maxDifference = 0.;
+   size_t index = 0;
+   for(int z=0; z<inverseField->nz; ++z)
+   {
+      for(int y=0; y<inverseField->ny; ++y)
+      {
+         for(int x=0; x<inverseField->nx; ++x, ++index)
+         {
+            float inverse[3]={invPtr[index], invPtr[index+voxelNumber], invPtr[index+2*voxelNumber]};
+            float inverseVoxel[3];
+            reg_mat44_mul(ijk, inverse, inverseVoxel);
+            if(inverseVoxel[0]<0 || inverseVoxel[0]>inverseField->nx-1 ||
+                  inverseVoxel[1]<0 || inverseVoxel[1]>inverseField->ny-1 ||
+                  inverseVoxel[2]<0 || inverseVoxel[2]>inverseField->nz-1)
+               continue;
+            float voxel[3]={(float)x, (float)y, (float)z}, position[3];
+            reg_mat44_mul(xyz, voxel, position);
+            for(int d=0; d<3; ++d)
+            {
+               double difference = fabs(comPtr[index+d*voxelNumber]-position[d]);
+               maxDifference = difference>maxDifference?difference:maxDifference;
+            }
+         }
+      }
+   }
+   printf("reg_test_defFieldInvert: maximal composition difference %g mm\n", maxDifference);
+   if(maxDifference>EPS)
+      result = EXIT_FAILURE;
+
+   // An inversion seeded with the inverse returns the same accuracy
+   double seededError[2];
+   reg_defFieldInvert(deformationField, inverseField, TOLERANCE,
+                      100, true, seededError);
+   printf("reg_test_defFieldInvert: seeded - mean error %g mm - max error %g mm\n",
+          seededError[0], seededError[1]);
+   if(seededError[1]>EPS)
+      result = EXIT_FAILURE;
+
+   nifti_image_free(composedField);
+   nifti_image_free(inverseField);
+   nifti_image_free(deformationField);
+   nifti_image_free(controlPointGrid);
+   nifti_image_free(refImage);
+
+#ifndef NDEBUG
+   if(result==EXIT_SUCCESS)
+      fprintf(stdout, "reg_test_defFieldInvert ok\n");
+#endif
+
+   return result;
+}
@@ -0,0 +1,153 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_localTrans.h"
+#include "_reg_tools.h"
+#include "_reg_ssd.h"
+#include "_reg_nmi.h"
+#include "_reg_lncc.h"
+#include "_reg_kld.h"
+#include "_reg_mind.h"
+
+#define MEASURE_NUMBER 7
+#define CONTROL_POINT_SPACING 5.f
+#define DISCRETE_RADIUS 3
+#define DISCRETE_STEP 1
+
+/// @brief MIND-SSC measure that uses the packed descriptors
+class reg_mindssc_packed : public reg_mindssc
+{
+public:
+   reg_mindssc_packed() : reg_mindssc()
+   {
+      this->SetPackedDescriptor(true);
+   }
+};
+
+/// @brief Check that the unit displacement gives the best discretised value
+/// when the warped image is the reference image and that the quantised values
+/// are within half a quantisation step of the full precision ones
+template <class MeasureTYPE>
+int reg_test_discretisedMeasure(const char *measureName,
+                                nifti_image *refImage)
+{
+   // The image is registered to itself
+   nifti_image *floImage = nifti_copy_nim_info(refImage);
+   floImage->data = malloc(floImage->nvox*floImage->nbyper);
+   memcpy(floImage->data, refImage->data, floImage->nvox*floImage->nbyper);
+   nifti_image *refCopy = nifti_copy_nim_info(refImage);
+   refCopy->data = malloc(refCopy->nvox*refCopy->nbyper);
+   memcpy(refCopy->data, refImage->data, refCopy->nvox*refCopy->nbyper);
+   size_t voxelNumber = (size_t)refImage->nx*refImage->ny*refImage->nz;
+   int *mask = (int *)calloc(voxelNumber, sizeof(int));
+
+   MeasureTYPE *measure = new MeasureTYPE();
+   for(int t=0; t<refImage->nt; ++t)
+      measure->SetTimepointWeight(t, 1.);
+   // The floating image is also the warped image as the nmi rescales both
+   measure->InitialiseMeasure(refCopy, floImage, mask, floImage, NULL, NULL, NULL);
+
+   float spacing[3]={CONTROL_POINT_SPACING, CONTROL_POINT_SPACING, CONTROL_POINT_SPACING};
+   nifti_image *controlPointGrid = NULL;
+   reg_createControlPointGrid<float>(&controlPointGrid, refImage, spacing);
+   size_t nodeNumber = (size_t)controlPointGrid->nx*controlPointGrid->ny*controlPointGrid->nz;
+   const int label_1D_number = (DISCRETE_RADIUS / DISCRETE_STEP) * 2 + 1;
+   const int label_nD_number = label_1D_number*label_1D_number*label_1D_number;
+   const int centreLabel = label_nD_number / 2;
+
+   float *discretisedValue = (float *)malloc(nodeNumber*label_nD_number*sizeof(float));
+   unsigned short *quantisedValue = (unsigned short *)malloc(nodeNumber*label_nD_number*sizeof(unsigned short));
+   float *nodeOffset = (float *)malloc(nodeNumber*sizeof(float));
+   float *nodeScale = (float *)malloc(nodeNumber*sizeof(float));
+   measure->GetDiscretisedValue(controlPointGrid, discretisedValue,
+                                DISCRETE_RADIUS, DISCRETE_STEP);
+   measure->GetQuantisedDiscretisedValue(controlPointGrid, quantisedValue,
+                                         nodeOffset, nodeScale,
+                                         DISCRETE_RADIUS, DISCRETE_STEP);
+
+   int result = EXIT_SUCCESS;
+   size_t wrongNodeNumber = 0;
+   double maxQuantisationError = 0.;
+   for(size_t node=0; node<nodeNumber; ++node){
+      float *nodeValue = &discretisedValue[node*label_nD_number];
+      for(int label=0; label<label_nD_number; ++label){
+         if(nodeValue[label]!=nodeValue[label] || nodeValue[label]>nodeValue[centreLabel]){
+            ++wrongNodeNumber;
+            break;
+         }
+      }
+      for(int label=0; label<label_nD_number; ++label){
+         double error = fabs(nodeOffset[node] +
+                             nodeScale[node] * quantisedValue[node*label_nD_number+label] -
+                             nodeValue[label]);
+         double range = nodeScale[node]>0 ? 65535. * nodeScale[node] : 1.;
+         maxQuantisationError = error/range>maxQuantisationError ? error/range : maxQuantisationError;
+      }
+   }
+   printf("reg_test_discretisedValue: %s - %lu/%lu node(s) with a better displaced value, "
+          "maximal relative quantisation error %g\n",
+          measureName, (unsigned long)wrongNodeNumber, (unsigned long)nodeNumber,
+          maxQuantisationError);
+   if(wrongNodeNumber>0 || maxQuantisationError>0.5/65535.+1.e-5)
+      result = EXIT_FAILURE;
+
+   free(discretisedValue);
+   free(quantisedValue);
+   free(nodeOffset);
+   free(nodeScale);
+   free(mask);
+   delete measure;
+   nifti_image_free(controlPointGrid);
+   nifti_image_free(floImage);
+   nifti_image_free(refCopy);
+   return result;
+}
+
+int main(int argc, char **argv)
+{
+   if(argc!=2)
+   {
+      fprintf(stderr, "Usage: %s <refImage>\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   char *inputRefImageName=argv[1];
+
+   /* Read the reference image */
+   nifti_image *refImage = reg_io_ReadImageFile(inputRefImageName);
+   if(refImage == NULL)
+   {
+      fprintf(stderr,"[NiftyReg ERROR] Error when reading the reference image: %s\n",
+              inputRefImageName);
+      return EXIT_FAILURE;
+   }
+   if(refImage->nz==1)
+   {
+      fprintf(stderr,"[NiftyReg ERROR] The discretised values are only implemented in 3D\n");
+      return EXIT_FAILURE;
+   }
+   reg_tools_changeDatatype<float>(refImage);
+
+   int result[MEASURE_NUMBER];
+   result[0]=reg_test_discretisedMeasure<reg_ssd>("ssd", refImage);
+   result[1]=reg_test_discretisedMeasure<reg_nmi>("nmi", refImage);
+   result[2]=reg_test_discretisedMeasure<reg_lncc>("lncc", refImage);
+   result[3]=reg_test_discretisedMeasure<reg_mind>("mind", refImage);
+   result[4]=reg_test_discretisedMeasure<reg_mindssc>("mindssc", refImage);
+   result[5]=reg_test_discretisedMeasure<reg_mindssc_packed>("packed mindssc", refImage);
+   // The kld expects probabilities, its input is thus rescaled to [0,1]
+   for(int t=0; t<refImage->nt; ++t)
+      reg_intensityRescale(refImage, t, 0.f, 1.f);
+   result[6]=reg_test_discretisedMeasure<reg_kld>("kld", refImage);
+
+   nifti_image_free(refImage);
+
+   for(int m=0; m<MEASURE_NUMBER; ++m)
+   {
+      if(result[m]!=EXIT_SUCCESS)
+         return EXIT_FAILURE;
+   }
+#ifndef NDEBUG
+   fprintf(stdout, "reg_test_discretisedValue ok\n");
+#endif
+
+   return EXIT_SUCCESS;
+}
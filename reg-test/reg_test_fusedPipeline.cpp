@@ -0,0 +1,177 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_tools.h"
+#include "_reg_f3d.h"
+
+#define EPS 0.0001
+#define GRADIENT_EPS 0.005
+
+/// @brief Expose the similarity measure computation of the f3d class
+class reg_f3d_test : public reg_f3d<float>
+{
+public:
+   reg_f3d_test(int refTimePoint, int floTimePoint)
+      : reg_f3d<float>(refTimePoint, floTimePoint) {}
+   void InitialiseFirstLevel()
+   {
+      this->Initialise();
+      this->currentLevel=0;
+      this->currentReference=this->referencePyramid[0];
+      this->currentFloating=this->floatingPyramid[0];
+      this->currentMask=this->maskPyramid[0];
+      this->AllocateWarped();
+      this->AllocateDeformationField();
+      this->AllocateWarpedGradient();
+      this->InitialiseCurrentLevel();
+      this->AllocateVoxelBasedMeasureGradient();
+      this->AllocateTransformationGradient();
+      this->InitialiseSimilarity();
+   }
+   void PerturbControlPointGrid()
+   {
+      float *cppPtr=static_cast<float *>(this->controlPointGrid->data);
+      for(size_t i=0; i<this->controlPointGrid->nvox; ++i)
+         cppPtr[i] += 0.37f*sinf(1.3f*(float)i);
+   }
+   bool IsFusedPipelineUsed()
+   {
+      return this->CanUseFusedPipeline();
+   }
+   double GetMeasureValue(bool fused)
+   {
+      if(fused) return this->ComputeFusedSimilarityMeasure();
+      this->WarpFloatingImage(this->interpolation);
+      return this->ComputeSimilarityMeasure();
+   }
+   nifti_image *GetVoxelBasedMeasureGradient(bool fused)
+   {
+      if(fused) this->GetFusedVoxelBasedGradient();
+      else
+      {
+         this->WarpFloatingImage(this->interpolation);
+         this->ComputeSimilarityMeasure();
+         this->GetVoxelBasedGradient();
+      }
+      nifti_image *gradient=nifti_copy_nim_info(this->voxelBasedMeasureGradient);
+      gradient->data=(void *)malloc(gradient->nvox*gradient->nbyper);
+      memcpy(gradient->data, this->voxelBasedMeasureGradient->data,
+             gradient->nvox*gradient->nbyper);
+      return gradient;
+   }
+};
+
+int main(int argc, char **argv)
+{
+   if(argc!=4)
+   {
+      fprintf(stderr, "Usage: %s <refImage> <floImage> <NMI|SSD>\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   char *inputRefImageName=argv[1];
+   char *inputFloImageName=argv[2];
+   char *measure_type=argv[3];
+
+   /* Read the reference image */
+   nifti_image *refImage = reg_io_ReadImageFile(inputRefImageName);
+   if(refImage == NULL)
+   {
+      fprintf(stderr,"[NiftyReg ERROR] Error when reading the reference image: %s\n",
+              inputRefImageName);
+      return EXIT_FAILURE;
+   }
+   reg_tools_changeDatatype<float>(refImage);
+
+   /* Read the floating image */
+   nifti_image *floImage = reg_io_ReadImageFile(inputFloImageName);
+   if(floImage == NULL)
+   {
+      fprintf(stderr,"[NiftyReg ERROR] Error when reading the floating image: %s\n",
+              inputFloImageName);
+      return EXIT_FAILURE;
+   }
+   reg_tools_changeDatatype<float>(floImage);
+
+   // The image border is masked out as rounding errors could otherwise move
+   // its voxels outside of the floating image in only one of the pipelines
+   nifti_image *maskImage=nifti_copy_nim_info(refImage);
+   maskImage->dim[4]=maskImage->nt=1;
+   nifti_update_dims_from_array(maskImage);
+   maskImage->data=(void *)calloc(maskImage->nvox,maskImage->nbyper);
+   float *maskPtr=static_cast<float *>(maskImage->data);
+   for(int z=0; z<maskImage->nz; ++z)
+      for(int y=1; y<maskImage->ny-1; ++y)
+         for(int x=1; x<maskImage->nx-1; ++x)
+            if(maskImage->nz==1 || (z>0 && z<maskImage->nz-1))
+               maskPtr[(z*maskImage->ny+y)*maskImage->nx+x]=1.f;
+
+   reg_f3d_test *registration=new reg_f3d_test(refImage->nt,floImage->nt);
+   registration->SetReferenceImage(refImage);
+   registration->SetFloatingImage(floImage);
+   registration->SetReferenceMask(maskImage);
+   registration->SetLevelNumber(1);
+   registration->DoNotPrintOutInformation();
+   // The spatial gradient of the linear interpolation is not continuous
+   registration->UseCubicSplineInterpolation();
+   if(strcmp(measure_type, "SSD")==0)
+   {
+      for(int i=0;i<refImage->nt;++i)
+         registration->UseSSD(i,false);
+   }
+   else if(strcmp(measure_type, "NMI")!=0)
+   {
+      reg_print_msg_error("reg_test_fusedPipeline: Unknown measure type");
+      return EXIT_FAILURE;
+   }
+   registration->UseFusedPipeline();
+   registration->InitialiseFirstLevel();
+   registration->PerturbControlPointGrid();
+   if(!registration->IsFusedPipelineUsed())
+   {
+      reg_print_msg_error("reg_test_fusedPipeline: The fused pipeline can not be used");
+      return EXIT_FAILURE;
+   }
+
+   // The measure value and its voxel-based gradient are compared
+   double value=registration->GetMeasureValue(false);
+   double fusedValue=registration->GetMeasureValue(true);
+   double value_difference=fabs(value-fusedValue)/fabs(value);
+
+   nifti_image *gradient=registration->GetVoxelBasedMeasureGradient(false);
+   nifti_image *fusedGradient=registration->GetVoxelBasedMeasureGradient(true);
+   reg_tools_substractImageToImage(gradient, fusedGradient, fusedGradient);
+   reg_tools_abs_image(fusedGradient);
+   reg_tools_abs_image(gradient);
+   double gradient_difference=reg_tools_getMaxValue(fusedGradient, -1) /
+         reg_tools_getMaxValue(gradient, -1);
+#ifndef NDEBUG
+   printf("reg_test_fusedPipeline: %s %iD - value = %.7g - fused value = %.7g - gradient difference = %.7g\n",
+          measure_type, (refImage->nz>1?3:2), value, fusedValue, gradient_difference);
+#endif
+
+   // Free the allocated images
+   nifti_image_free(gradient);
+   nifti_image_free(fusedGradient);
+   delete registration;
+   nifti_image_free(refImage);
+   nifti_image_free(floImage);
+   nifti_image_free(maskImage);
+
+   if(value_difference>EPS)
+   {
+      fprintf(stderr, "reg_test_fusedPipeline: Incorrect measure value %g (>%g)\n",
+              value_difference, EPS);
+      return EXIT_FAILURE;
+   }
+   if(gradient_difference>GRADIENT_EPS)
+   {
+      fprintf(stderr, "reg_test_fusedPipeline: Incorrect voxel-based gradient %g (>%g)\n",
+              gradient_difference, GRADIENT_EPS);
+      return EXIT_FAILURE;
+   }
+#ifndef NDEBUG
+   fprintf(stdout, "reg_test_fusedPipeline ok: %g (<%g) %g (<%g)\n",
+           value_difference, EPS, gradient_difference, GRADIENT_EPS);
+#endif
+
+   return EXIT_SUCCESS;
+}
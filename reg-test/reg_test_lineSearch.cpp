@@ -0,0 +1,141 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_tools.h"
+#include "_reg_f3d.h"
+
+#if defined (_OPENMP)
+#include "omp.h"
+#endif
+
+#define STRATEGY_NUMBER 2
+/// Minimal fraction of the objective function improvement of the adaptive
+/// line search that the other strategies have to reach
+#define IMPROVEMENT_RATIO 0.9
+
+/// @brief Count the objective function evaluations and record the best value
+class reg_f3d_test : public reg_f3d<float>
+{
+public:
+   size_t evaluationNumber;
+   size_t gradientNumber;
+   double initialValue;
+   double bestValue;
+
+   reg_f3d_test(int refTimePoint, int floTimePoint)
+      : reg_f3d<float>(refTimePoint, floTimePoint)
+   {
+      this->evaluationNumber=0;
+      this->gradientNumber=0;
+      this->initialValue=this->bestValue=0.;
+   }
+   double GetObjectiveFunctionValue()
+   {
+      ++this->evaluationNumber;
+      return reg_f3d<float>::GetObjectiveFunctionValue();
+   }
+   void GetObjectiveFunctionGradient()
+   {
+      ++this->gradientNumber;
+      reg_f3d<float>::GetObjectiveFunctionGradient();
+   }
+   void UpdateBestObjFunctionValue()
+   {
+      reg_f3d<float>::UpdateBestObjFunctionValue();
+      this->bestValue=this->bestWMeasure-this->bestWBE-this->bestWLE-
+            this->bestWJac-this->bestWLand;
+      if(this->evaluationNumber==1)
+         this->initialValue=this->bestValue;
+   }
+};
+
+int main(int argc, char **argv)
+{
+   if(argc!=3)
+   {
+      fprintf(stderr, "Usage: %s <refImage> <floImage>\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   char *inputRefImageName=argv[1];
+   char *inputFloImageName=argv[2];
+
+   /* Read the reference image */
+   nifti_image *refImage = reg_io_ReadImageFile(inputRefImageName);
+   if(refImage == NULL)
+   {
+      fprintf(stderr,"[NiftyReg ERROR] Error when reading the reference image: %s\n",
+              inputRefImageName);
+      return EXIT_FAILURE;
+   }
+   reg_tools_changeDatatype<float>(refImage);
+
+   /* Read the floating image */
+   nifti_image *floImage = reg_io_ReadImageFile(inputFloImageName);
+   if(floImage == NULL)
+   {
+      fprintf(stderr,"[NiftyReg ERROR] Error when reading the floating image: %s\n",
+              inputFloImageName);
+      return EXIT_FAILURE;
+   }
+   reg_tools_changeDatatype<float>(floImage);
+
+   // The same registration is run to convergence with every line search
+   int strategy[STRATEGY_NUMBER]={ADAPTIVE_LINE_SEARCH,
+                                  BRENT_LINE_SEARCH};
+   const char *strategyName[STRATEGY_NUMBER]={"adaptive",
+                                              "Brent"};
+   double improvement[STRATEGY_NUMBER];
+   for(int s=0; s<STRATEGY_NUMBER; ++s)
+   {
+      reg_f3d_test *registration=new reg_f3d_test(refImage->nt,floImage->nt);
+      registration->SetReferenceImage(refImage);
+      registration->SetFloatingImage(floImage);
+      registration->SetLevelNumber(1);
+      registration->SetMaximalIterationNumber(500);
+      registration->DoNotPrintOutInformation();
+      registration->SetLineSearchType(strategy[s]);
+#if defined (_OPENMP)
+      double start=omp_get_wtime();
+#else
+      clock_t start=clock();
+#endif
+      registration->Run();
+#if defined (_OPENMP)
+      double elapsed=omp_get_wtime()-start;
+#else
+      double elapsed=(double)(clock()-start)/(double)CLOCKS_PER_SEC;
+#endif
+      improvement[s]=registration->bestValue-registration->initialValue;
+      printf("reg_test_lineSearch: %s %iD - objective %.7g -> %.7g in %g second(s), "
+             "%lu evaluation(s), %lu gradient(s)\n",
+             strategyName[s], (refImage->nz>1?3:2), registration->initialValue,
+             registration->bestValue, elapsed,
+             (unsigned long)registration->evaluationNumber,
+             (unsigned long)registration->gradientNumber);
+      delete registration;
+      if(improvement[s]!=improvement[s] || improvement[s]<=0.)
+      {
+         printf("reg_test_lineSearch: No improvement with the %s line search\n",
+                strategyName[s]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   // Free the allocated images
+   nifti_image_free(refImage);
+   nifti_image_free(floImage);
+
+   for(int s=1; s<STRATEGY_NUMBER; ++s)
+   {
+      if(improvement[s]<IMPROVEMENT_RATIO*improvement[0])
+      {
+         printf("reg_test_lineSearch: Insufficient improvement with the %s line search (%g < %g)\n",
+                strategyName[s], improvement[s], IMPROVEMENT_RATIO*improvement[0]);
+         return EXIT_FAILURE;
+      }
+   }
+#ifndef NDEBUG
+   fprintf(stdout, "reg_test_lineSearch ok\n");
+#endif
+
+   return EXIT_SUCCESS;
+}
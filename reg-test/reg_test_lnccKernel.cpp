@@ -0,0 +1,171 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_tools.h"
+#include "_reg_resampling.h"
+#include "_reg_lncc.h"
+
+#if defined (_OPENMP)
+#include "omp.h"
+#endif
+
+#define EPS 0.01
+#define CONVOLUTION_EPS 0.02
+#define KERNEL_NUMBER 5
+#define LNCC_ITERATION 10
+
+/// @brief Allocate an image with the spatial dimension of the input image
+/// and one vector per voxel
+nifti_image *reg_test_allocateGradientImage(nifti_image *image)
+{
+   nifti_image *gradient=nifti_copy_nim_info(image);
+   gradient->dim[0]=gradient->ndim=5;
+   gradient->dim[4]=gradient->nt=1;
+   gradient->dim[5]=gradient->nu=image->nz>1?3:2;
+   nifti_update_dims_from_array(gradient);
+   gradient->data=(void *)calloc(gradient->nvox,gradient->nbyper);
+   return gradient;
+}
+
+int main(int argc, char **argv)
+{
+   if(argc!=3)
+   {
+      fprintf(stderr, "Usage: %s <refImage> <warImage>\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   char *inputRefImageName=argv[1];
+   char *inputWarImageName=argv[2];
+
+   /* Read the reference image */
+   nifti_image *refImage = reg_io_ReadImageFile(inputRefImageName);
+   if(refImage == NULL)
+   {
+      fprintf(stderr,"[NiftyReg ERROR] Error when reading the reference image: %s\n",
+              inputRefImageName);
+      return EXIT_FAILURE;
+   }
+   reg_tools_changeDatatype<float>(refImage);
+
+   /* Read the warped image */
+   nifti_image *warImage = reg_io_ReadImageFile(inputWarImageName);
+   if(warImage == NULL)
+   {
+      fprintf(stderr,"[NiftyReg ERROR] Error when reading the floating image: %s\n",
+              inputWarImageName);
+      return EXIT_FAILURE;
+   }
+   reg_tools_changeDatatype<float>(warImage);
+
+   // Check if the input images have the same size
+   for(int i=0;i<8;++i){
+      if(refImage->dim[i]!=warImage->dim[i])
+      {
+         reg_print_msg_error("reg_test_lnccKernel: The input images do not have the same size");
+         return EXIT_FAILURE;
+      }
+   }
+
+   int *mask_image=(int *)calloc(refImage->nvox,sizeof(int));
+   nifti_image *warGradient=reg_test_allocateGradientImage(warImage);
+   reg_getImageGradient_symDiff(warImage, warGradient, mask_image,
+                                std::numeric_limits<float>::quiet_NaN(), 0);
+   nifti_image *lnccGradient=reg_test_allocateGradientImage(refImage);
+
+   // The LNCC and its gradient are computed with every kernel type
+   int kernelType[KERNEL_NUMBER]={GAUSSIAN_KERNEL,
+                                  RECURSIVE_GAUSSIAN_KERNEL,
+                                  CUBIC_SPLINE_KERNEL,
+                                  MEAN_KERNEL,
+                                  ITERATED_BOX_KERNEL};
+   const char *kernelName[KERNEL_NUMBER]={"Gaussian",
+                                          "recursive Gaussian",
+                                          "cubic spline",
+                                          "mean",
+                                          "iterated box"};
+   double measure[KERNEL_NUMBER];
+   for(int k=0;k<KERNEL_NUMBER;++k)
+   {
+      reg_lncc *measure_object=new reg_lncc();
+      measure_object->SetKernelType(kernelType[k]);
+      for(int i=0;i<refImage->nt;++i)
+         measure_object->SetTimepointWeight(i, 1.);
+#if defined (_OPENMP)
+      double start=omp_get_wtime();
+#else
+      clock_t start=clock();
+#endif
+      measure_object->InitialiseMeasure(refImage,
+                                        warImage,
+                                        mask_image,
+                                        warImage,
+                                        warGradient,
+                                        lnccGradient);
+      for(int i=0;i<LNCC_ITERATION;++i)
+      {
+         measure[k]=measure_object->GetSimilarityMeasureValue();
+         measure_object->GetVoxelBasedSimilarityMeasureGradient(0);
+      }
+#if defined (_OPENMP)
+      double elapsed=(omp_get_wtime()-start)/(double)LNCC_ITERATION;
+#else
+      double elapsed=(double)(clock()-start)/(CLOCKS_PER_SEC*(double)LNCC_ITERATION);
+#endif
+      printf("reg_test_lnccKernel: %s kernel - LNCC %iD = %.7g in %g second(s) per iteration\n",
+             kernelName[k], (refImage->nz>1?3:2), measure[k], elapsed);
+      delete measure_object;
+      if(measure[k]!=measure[k] || measure[k]<0. || measure[k]>1.)
+      {
+         printf("reg_test_lnccKernel: Invalid LNCC value with the %s kernel\n",
+                kernelName[k]);
+         return EXIT_FAILURE;
+      }
+   }
+   double measure_difference=fabs(measure[4]-measure[0])/measure[0];
+
+   // The iterated box filters are compared to the Gaussian kernel
+   nifti_image *kernelImage=nifti_copy_nim_info(refImage);
+   kernelImage->data=(void *)malloc(kernelImage->nvox*kernelImage->nbyper);
+   memcpy(kernelImage->data, refImage->data, kernelImage->nvox*kernelImage->nbyper);
+   nifti_image *boxImage=nifti_copy_nim_info(refImage);
+   boxImage->data=(void *)malloc(boxImage->nvox*boxImage->nbyper);
+   memcpy(boxImage->data, refImage->data, boxImage->nvox*boxImage->nbyper);
+   float *sigmaValues = new float[refImage->nt*refImage->nu];
+   for(int i=0; i<refImage->nt*refImage->nu; ++i)
+      sigmaValues[i] = -5.f;
+   reg_tools_kernelConvolution(kernelImage, sigmaValues, GAUSSIAN_KERNEL);
+   reg_tools_kernelConvolution(boxImage, sigmaValues, ITERATED_BOX_KERNEL);
+   delete []sigmaValues;
+   double range = reg_tools_getMaxValue(kernelImage, -1) -
+         reg_tools_getMinValue(kernelImage, -1);
+   reg_tools_substractImageToImage(kernelImage, boxImage, boxImage);
+   reg_tools_abs_image(boxImage);
+   double convolution_difference = reg_tools_getMaxValue(boxImage, -1) / range;
+
+   // Free the allocated images
+   nifti_image_free(kernelImage);
+   nifti_image_free(boxImage);
+   nifti_image_free(warGradient);
+   nifti_image_free(lnccGradient);
+   nifti_image_free(refImage);
+   nifti_image_free(warImage);
+   free(mask_image);
+
+   if(convolution_difference>CONVOLUTION_EPS)
+   {
+      printf("reg_test_lnccKernel: Incorrect iterated box convolution (diff=%.7g)\n",
+             convolution_difference);
+      return EXIT_FAILURE;
+   }
+   if(measure_difference>EPS)
+   {
+      printf("reg_test_lnccKernel: Incorrect iterated box LNCC value (diff=%.7g)\n",
+             measure_difference);
+      return EXIT_FAILURE;
+   }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_lnccKernel ok: %g (<%g) %g (<%g)\n",
+            convolution_difference, CONVOLUTION_EPS, measure_difference, EPS);
+#endif
+
+   return EXIT_SUCCESS;
+}
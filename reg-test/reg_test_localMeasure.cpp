@@ -0,0 +1,144 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_tools.h"
+#include "_reg_nmi.h"
+#include "_reg_ssd.h"
+
+#define EPS 0.000001
+#define REGION_SIZE 8
+
+int main(int argc, char **argv)
+{
+   if(argc!=4)
+   {
+      fprintf(stderr, "Usage: %s <refImage> <warImage> <NMI|SSD>\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   char *inputRefImageName=argv[1];
+   char *inputWarImageName=argv[2];
+   char *measure_type=argv[3];
+
+   /* Read the reference image */
+   nifti_image *refImage = reg_io_ReadImageFile(inputRefImageName);
+   if(refImage == NULL)
+   {
+      fprintf(stderr,"[NiftyReg ERROR] Error when reading the reference image: %s\n",
+              inputRefImageName);
+      return EXIT_FAILURE;
+   }
+   reg_tools_changeDatatype<float>(refImage);
+
+   /* Read the warped image */
+   nifti_image *warImage = reg_io_ReadImageFile(inputWarImageName);
+   if(warImage == NULL)
+   {
+      fprintf(stderr,"[NiftyReg ERROR] Error when reading the floating image: %s\n",
+              inputWarImageName);
+      return EXIT_FAILURE;
+   }
+   reg_tools_changeDatatype<float>(warImage);
+
+   // Check if the input images have the same size
+   for(int i=0;i<8;++i){
+      if(refImage->dim[i]!=warImage->dim[i])
+      {
+         reg_print_msg_error("reg_test_localMeasure: The input images do not have the same size");
+         return EXIT_FAILURE;
+      }
+   }
+
+   int *mask_image=(int *)calloc(refImage->nvox,sizeof(int));
+
+   reg_nmi *nmi_object=NULL;
+   reg_ssd *ssd_object=NULL;
+   reg_measure *measure_object=NULL;
+   if(strcmp(measure_type, "NMI")==0)
+      measure_object=nmi_object=new reg_nmi();
+   else if(strcmp(measure_type, "SSD")==0)
+      measure_object=ssd_object=new reg_ssd();
+   else
+   {
+      reg_print_msg_error("reg_test_localMeasure: Unknown measure type");
+      return EXIT_FAILURE;
+   }
+   for(int i=0;i<refImage->nt;++i)
+      measure_object->SetTimepointWeight(i, 1.);
+   // The floating image is used as warped image, the NMI measure rescales it
+   if(nmi_object!=NULL)
+      nmi_object->InitialiseMeasure(refImage,
+                                    warImage,
+                                    mask_image,
+                                    warImage,
+                                    NULL,
+                                    NULL);
+   else ssd_object->InitialiseMeasure(refImage,
+                                      warImage,
+                                      mask_image,
+                                      warImage,
+                                      NULL,
+                                      NULL,
+                                      NULL);
+   measure_object->InitialiseLocalSimilarityMeasure();
+
+   // A region of the warped image is replaced by the reference image values
+   int regionStart[3], regionSize[3];
+   regionSize[0]=refImage->nx<REGION_SIZE?refImage->nx:REGION_SIZE;
+   regionSize[1]=refImage->ny<REGION_SIZE?refImage->ny:REGION_SIZE;
+   regionSize[2]=refImage->nz<REGION_SIZE?refImage->nz:REGION_SIZE;
+   for(int i=0;i<3;++i)
+      regionStart[i]=(refImage->dim[i+1]-regionSize[i])/2;
+   nifti_image *localImage=nifti_copy_nim_info(warImage);
+   localImage->dim[1]=regionSize[0];
+   localImage->dim[2]=regionSize[1];
+   localImage->dim[3]=regionSize[2];
+   nifti_update_dims_from_array(localImage);
+   localImage->data=(void *)malloc(localImage->nvox*localImage->nbyper);
+   float *localPtr=static_cast<float *>(localImage->data);
+   float *refPtr=static_cast<float *>(refImage->data);
+   float *warPtr=static_cast<float *>(warImage->data);
+   size_t voxelNumber=(size_t)refImage->nx*refImage->ny*refImage->nz;
+   size_t localIndex=0;
+   for(int t=0;t<refImage->nt;++t)
+      for(int z=regionStart[2];z<regionStart[2]+regionSize[2];++z)
+         for(int y=regionStart[1];y<regionStart[1]+regionSize[1];++y)
+            for(int x=regionStart[0];x<regionStart[0]+regionSize[0];++x)
+               localPtr[localIndex++]=refPtr[t*voxelNumber+(z*refImage->ny+y)*refImage->nx+x];
+
+   double localMeasure=measure_object->GetLocalSimilarityMeasureValue(localImage,
+                                                                      regionStart);
+
+   // The full measure is computed after updating the warped image
+   localIndex=0;
+   for(int t=0;t<refImage->nt;++t)
+      for(int z=regionStart[2];z<regionStart[2]+regionSize[2];++z)
+         for(int y=regionStart[1];y<regionStart[1]+regionSize[1];++y)
+            for(int x=regionStart[0];x<regionStart[0]+regionSize[0];++x)
+               warPtr[t*voxelNumber+(z*refImage->ny+y)*refImage->nx+x]=localPtr[localIndex++];
+   double measure=measure_object->GetSimilarityMeasureValue();
+
+   double max_difference=fabs(measure-localMeasure);
+#ifndef NDEBUG
+   printf("reg_test_localMeasure: %s value %iD = %.7g - local value = %.7g\n",
+          measure_type, (refImage->nz>1?3:2), measure, localMeasure);
+#endif
+   if(max_difference>EPS)
+   {
+      printf("reg_test_localMeasure: Incorrect local measure value %.7g (diff=%.7g)\n",
+             localMeasure, max_difference);
+      return EXIT_FAILURE;
+   }
+
+   // Free the allocated images
+   if(nmi_object!=NULL) delete nmi_object;
+   if(ssd_object!=NULL) delete ssd_object;
+   nifti_image_free(localImage);
+   nifti_image_free(refImage);
+   nifti_image_free(warImage);
+   free(mask_image);
+
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_localMeasure ok: %g (<%g)\n", max_difference, EPS);
+#endif
+
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,163 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_localTrans.h"
+#include "_reg_tools.h"
+#include "_reg_ssd.h"
+#include "_reg_mrf.h"
+
+#if defined (_OPENMP)
+#include "omp.h"
+#endif
+
+#define THREAD_CONFIG_NUMBER 3
+#define CONTROL_POINT_SPACING 5.f
+#define DISCRETE_RADIUS 3
+#define DISCRETE_STEP 1
+#define REGULARISATION_WEIGHT 0.4f
+
+/// @brief Runs the discrete optimisation from an identity control point grid
+/// and returns a copy of the optimal label of every node
+int *reg_test_mrf_getLabels(reg_measure *measure,
+                            nifti_image *refImage,
+                            size_t memoryBudget,
+                            size_t *nodeNumber,
+                            size_t *peakMemory)
+{
+   float spacing[3]={CONTROL_POINT_SPACING, CONTROL_POINT_SPACING, CONTROL_POINT_SPACING};
+   nifti_image *controlPointGrid = NULL;
+   reg_createControlPointGrid<float>(&controlPointGrid, refImage, spacing);
+   reg_getDeformationFromDisplacement(controlPointGrid);
+   *nodeNumber = (size_t)controlPointGrid->nx*controlPointGrid->ny*controlPointGrid->nz;
+
+   reg_mrf *mrf = new reg_mrf(measure, refImage, controlPointGrid,
+                              DISCRETE_RADIUS, DISCRETE_STEP, REGULARISATION_WEIGHT);
+   mrf->SetMemoryBudget(memoryBudget);
+   *peakMemory = mrf->GetPeakMemoryFootprint();
+   mrf->Run();
+   int *labels = (int *)malloc(*nodeNumber*sizeof(int));
+   memcpy(labels, mrf->GetOptimalLabelPtr(), *nodeNumber*sizeof(int));
+
+   delete mrf;
+   nifti_image_free(controlPointGrid);
+   return labels;
+}
+
+int main(int argc, char **argv)
+{
+   if(argc!=3)
+   {
+      fprintf(stderr, "Usage: %s <refImage> <warImage>\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   char *inputRefImageName=argv[1];
+   char *inputWarImageName=argv[2];
+
+   /* Read the reference image */
+   nifti_image *refImage = reg_io_ReadImageFile(inputRefImageName);
+   if(refImage == NULL)
+   {
+      fprintf(stderr,"[NiftyReg ERROR] Error when reading the reference image: %s\n",
+              inputRefImageName);
+      return EXIT_FAILURE;
+   }
+   if(refImage->nz==1)
+   {
+      fprintf(stderr,"[NiftyReg ERROR] The discrete optimisation is only implemented in 3D\n");
+      return EXIT_FAILURE;
+   }
+   reg_tools_changeDatatype<float>(refImage);
+
+   /* Read the warped image */
+   nifti_image *warImage = reg_io_ReadImageFile(inputWarImageName);
+   if(warImage == NULL)
+   {
+      fprintf(stderr,"[NiftyReg ERROR] Error when reading the floating image: %s\n",
+              inputWarImageName);
+      return EXIT_FAILURE;
+   }
+   reg_tools_changeDatatype<float>(warImage);
+
+   // Check if the input images have the same size
+   for(int i=0;i<8;++i){
+      if(refImage->dim[i]!=warImage->dim[i])
+      {
+         reg_print_msg_error("reg_test_mrf: The input images do not have the same size");
+         return EXIT_FAILURE;
+      }
+   }
+
+   int *mask_image=(int *)calloc(refImage->nvox,sizeof(int));
+
+   reg_ssd *measure_object=new reg_ssd();
+   for(int i=0;i<refImage->nt;++i)
+      measure_object->SetTimepointWeight(i, 1.);
+   measure_object->InitialiseMeasure(refImage,
+                                     warImage,
+                                     mask_image,
+                                     warImage,
+                                     NULL,
+                                     NULL,
+                                     NULL);
+
+   int result = EXIT_SUCCESS;
+   size_t nodeNumber, peakMemory, spilledPeakMemory;
+
+   // The labels have to be identical for every number of threads
+   int threadConfig[THREAD_CONFIG_NUMBER]={1,4,8};
+   int *labels[THREAD_CONFIG_NUMBER];
+#if defined (_OPENMP)
+   int maxThreadNumber = omp_get_max_threads();
+#endif
+   for(int c=0;c<THREAD_CONFIG_NUMBER;++c)
+   {
+#if defined (_OPENMP)
+      omp_set_num_threads(threadConfig[c]);
+#endif
+      labels[c]=reg_test_mrf_getLabels(measure_object, refImage, 0,
+                                       &nodeNumber, &peakMemory);
+   }
+   for(int c=1;c<THREAD_CONFIG_NUMBER;++c)
+   {
+      size_t differenceNumber=0;
+      for(size_t n=0;n<nodeNumber;++n)
+         if(labels[c][n]!=labels[0][n]) ++differenceNumber;
+      printf("reg_test_mrf: %i vs %i thread(s) - %lu/%lu different label(s)\n",
+             threadConfig[0], threadConfig[c],
+             (unsigned long)differenceNumber, (unsigned long)nodeNumber);
+      if(differenceNumber>0)
+         result = EXIT_FAILURE;
+   }
+
+   // The cost volume mapped to a temporary file has to give the same labels
+   // as the one kept in memory. The last thread configuration is kept so that
+   // both peak memory footprints are comparable
+   int *spilledLabels=reg_test_mrf_getLabels(measure_object, refImage, 1,
+                                             &nodeNumber, &spilledPeakMemory);
+   size_t differenceNumber=0;
+   for(size_t n=0;n<nodeNumber;++n)
+      if(spilledLabels[n]!=labels[0][n]) ++differenceNumber;
+   printf("reg_test_mrf: mapped cost volume - %lu/%lu different label(s), "
+          "peak memory footprint %g MB instead of %g MB\n",
+          (unsigned long)differenceNumber, (unsigned long)nodeNumber,
+          (double)spilledPeakMemory/1048576., (double)peakMemory/1048576.);
+   if(differenceNumber>0 || spilledPeakMemory>=peakMemory)
+      result = EXIT_FAILURE;
+#if defined (_OPENMP)
+   omp_set_num_threads(maxThreadNumber);
+#endif
+
+   for(int c=0;c<THREAD_CONFIG_NUMBER;++c)
+      free(labels[c]);
+   free(spilledLabels);
+   free(mask_image);
+   delete measure_object;
+   nifti_image_free(refImage);
+   nifti_image_free(warImage);
+
+#ifndef NDEBUG
+   if(result==EXIT_SUCCESS)
+      fprintf(stdout, "reg_test_mrf ok\n");
+#endif
+
+   return result;
+}
@@ -0,0 +1,120 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_tools.h"
+#include "_reg_nmi.h"
+
+#if defined (_OPENMP)
+#include "omp.h"
+#endif
+
+#define THREAD_CONFIG_NUMBER 4
+#define NMI_ITERATION 20
+
+int main(int argc, char **argv)
+{
+   if(argc!=3)
+   {
+      fprintf(stderr, "Usage: %s <refImage> <warImage>\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   char *inputRefImageName=argv[1];
+   char *inputWarImageName=argv[2];
+
+   /* Read the reference image */
+   nifti_image *refImage = reg_io_ReadImageFile(inputRefImageName);
+   if(refImage == NULL)
+   {
+      fprintf(stderr,"[NiftyReg ERROR] Error when reading the reference image: %s\n",
+              inputRefImageName);
+      return EXIT_FAILURE;
+   }
+   reg_tools_changeDatatype<float>(refImage);
+
+   /* Read the warped image */
+   nifti_image *warImage = reg_io_ReadImageFile(inputWarImageName);
+   if(warImage == NULL)
+   {
+      fprintf(stderr,"[NiftyReg ERROR] Error when reading the floating image: %s\n",
+              inputWarImageName);
+      return EXIT_FAILURE;
+   }
+   reg_tools_changeDatatype<float>(warImage);
+
+   // Check if the input images have the same size
+   for(int i=0;i<8;++i){
+      if(refImage->dim[i]!=warImage->dim[i])
+      {
+         reg_print_msg_error("reg_test_nmi_threads: The input images do not have the same size");
+         return EXIT_FAILURE;
+      }
+   }
+
+   int *mask_image=(int *)calloc(refImage->nvox,sizeof(int));
+
+   reg_nmi *measure_object=new reg_nmi();
+   for(int i=0;i<refImage->nt;++i)
+      measure_object->SetTimepointWeight(i, 1.);
+   measure_object->InitialiseMeasure(refImage,
+                                     warImage,
+                                     mask_image,
+                                     warImage,
+                                     NULL,
+                                     NULL);
+
+   // The NMI value has to be identical for every number of threads
+   int threadConfig[THREAD_CONFIG_NUMBER]={1,8,32,64};
+   double measure[THREAD_CONFIG_NUMBER];
+   double elapsed[THREAD_CONFIG_NUMBER];
+#if defined (_OPENMP)
+   int maxThreadNumber = omp_get_max_threads();
+#endif
+   for(int c=0;c<THREAD_CONFIG_NUMBER;++c)
+   {
+#if defined (_OPENMP)
+      omp_set_num_threads(threadConfig[c]);
+      double start=omp_get_wtime();
+#else
+      clock_t start=clock();
+#endif
+      for(int i=0;i<NMI_ITERATION;++i)
+      {
+         double value=measure_object->GetSimilarityMeasureValue();
+         if(i>0 && value!=measure[c])
+         {
+            printf("reg_test_nmi_threads: NMI value is not reproducible with %i threads\n",
+                   threadConfig[c]);
+            return EXIT_FAILURE;
+         }
+         measure[c]=value;
+      }
+#if defined (_OPENMP)
+      elapsed[c]=(omp_get_wtime()-start)/(double)NMI_ITERATION;
+#else
+      elapsed[c]=(double)(clock()-start)/(CLOCKS_PER_SEC*(double)NMI_ITERATION);
+#endif
+      printf("reg_test_nmi_threads: %i thread(s) - NMI %iD = %.15g in %g second(s) [speed-up %g]\n",
+             threadConfig[c], (refImage->nz>1?3:2), measure[c], elapsed[c],
+             elapsed[0]/elapsed[c]);
+      if(measure[c]!=measure[0])
+      {
+         printf("reg_test_nmi_threads: Incorrect NMI value with %i threads (diff=%.7g)\n",
+                threadConfig[c], fabs(measure[c]-measure[0]));
+         return EXIT_FAILURE;
+      }
+   }
+#if defined (_OPENMP)
+   omp_set_num_threads(maxThreadNumber);
+#endif
+
+   // Free the allocated images
+   delete measure_object;
+   nifti_image_free(refImage);
+   nifti_image_free(warImage);
+   free(mask_image);
+
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_nmi_threads ok\n");
+#endif
+
+   return EXIT_SUCCESS;
+}
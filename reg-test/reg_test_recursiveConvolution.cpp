@@ -0,0 +1,64 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_tools.h"
+
+#define EPS 0.01
+
+int main(int argc, char **argv)
+{
+   if(argc!=3)
+   {
+      fprintf(stderr, "Usage: %s <refImage> <sigma>\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   char *inputImageName=argv[1];
+   float sigma=(float)atof(argv[2]);
+   if(sigma<RECURSIVE_GAUSSIAN_MIN_SIGMA)
+   {
+      reg_print_msg_error("reg_test_recursiveConvolution: The recursive filter is not used with this sigma");
+      return EXIT_FAILURE;
+   }
+
+   // Read the input reference image
+   nifti_image *kernelImage = reg_io_ReadImageFile(inputImageName);
+   if(kernelImage == NULL)
+   {
+      reg_print_msg_error("The input reference image could not be read");
+      return EXIT_FAILURE;
+   }
+   reg_tools_changeDatatype<float>(kernelImage);
+   nifti_image *recursiveImage = nifti_copy_nim_info(kernelImage);
+   recursiveImage->data = (void *)malloc(recursiveImage->nvox*recursiveImage->nbyper);
+   memcpy(recursiveImage->data, kernelImage->data, recursiveImage->nvox*recursiveImage->nbyper);
+
+   // The image is smoothed with the truncated and the recursive Gaussian filters
+   float *sigmaValues = new float[kernelImage->nt*kernelImage->nu];
+   for(int i=0; i<kernelImage->nt*kernelImage->nu; ++i)
+      sigmaValues[i] = -sigma;
+   reg_tools_kernelConvolution(kernelImage, sigmaValues, GAUSSIAN_KERNEL);
+   reg_tools_kernelConvolution(recursiveImage, sigmaValues, RECURSIVE_GAUSSIAN_KERNEL);
+   delete []sigmaValues;
+
+   // The difference is normalised by the intensity range of the smoothed image
+   double range = reg_tools_getMaxValue(kernelImage, -1) -
+         reg_tools_getMinValue(kernelImage, -1);
+   reg_tools_substractImageToImage(kernelImage, recursiveImage, recursiveImage);
+   reg_tools_abs_image(recursiveImage);
+   double max_difference = reg_tools_getMaxValue(recursiveImage, -1) / range;
+
+   nifti_image_free(kernelImage);
+   nifti_image_free(recursiveImage);
+
+   if(max_difference > EPS)
+   {
+      fprintf(stderr, "reg_test_recursiveConvolution error too large: %g (>%g)\n",
+              max_difference, EPS);
+      return EXIT_FAILURE;
+   }
+#ifndef NDEBUG
+   fprintf(stdout, "reg_test_recursiveConvolution ok: %g (<%g)\n",
+           max_difference, EPS);
+#endif
+
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,135 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_tools.h"
+#include "_reg_thinPlateSpline.h"
+
+#define LANDMARK_NUMBER 100
+/// Maximal error accepted in mm at the landmarks
+#define EPS 1.0e-6
+/// Error bound of the approximated deformation field in mm
+#define APPROXIMATION_ERROR 0.1
+
+/// @brief Fit a thin plate spline to landmarks with a smooth displacement and
+/// check that the deformation field interpolates the landmarks and that the
+/// approximated field is within the requested bound of the exact one
+int main(int argc, char **argv)
+{
+   if(argc!=2)
+   {
+      fprintf(stderr, "Usage: %s <refImage>\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   char *inputRefImageName=argv[1];
+
+   /* Read the reference image */
+   nifti_image *refImage = reg_io_ReadImageFile(inputRefImageName);
+   if(refImage == NULL)
+   {
+      fprintf(stderr,"[NiftyReg ERROR] Error when reading the reference image: %s\n",
+              inputRefImageName);
+      return EXIT_FAILURE;
+   }
+   const int dim=refImage->nz>1?3:2;
+   const size_t voxelNumber=(size_t)refImage->nx*refImage->ny*refImage->nz;
+
+   nifti_image *deformationField = nifti_copy_nim_info(refImage);
+   deformationField->ndim=deformationField->dim[0]=5;
+   deformationField->nt=deformationField->dim[4]=1;
+   deformationField->nu=deformationField->dim[5]=dim;
+   nifti_update_dims_from_array(deformationField);
+   deformationField->datatype=NIFTI_TYPE_FLOAT64;
+   deformationField->nbyper=sizeof(double);
+   deformationField->data=calloc(deformationField->nvox,deformationField->nbyper);
+   nifti_image *approxField = nifti_copy_nim_info(deformationField);
+   approxField->data=calloc(approxField->nvox,approxField->nbyper);
+   mat44 *voxel2real=&refImage->qto_xyz;
+   if(refImage->sform_code>0)
+      voxel2real=&refImage->sto_xyz;
+
+   // The landmarks are distinct voxels with a smooth displacement
+   double position[3][LANDMARK_NUMBER], displacement[3][LANDMARK_NUMBER];
+   size_t landmarkIndex[LANDMARK_NUMBER];
+   bool *used=(bool *)calloc(voxelNumber,sizeof(bool));
+   srand(0);
+   for(int i=0; i<LANDMARK_NUMBER; ++i)
+   {
+      size_t index;
+      do
+      {
+         index=(size_t)(((double)rand()/((double)RAND_MAX+1.))*voxelNumber);
+      } while(used[index]);
+      used[index]=true;
+      landmarkIndex[i]=index;
+      double voxel[3]={(double)(index%refImage->nx),
+                       (double)(index/refImage->nx%refImage->ny),
+                       (double)(index/((size_t)refImage->nx*refImage->ny))};
+      double real[3];
+      reg_mat44_mul(voxel2real, voxel, real);
+      for(int a=0; a<3; ++a)
+         position[a][i]=real[a];
+      displacement[0][i]=3.*sin(real[0]/15.);
+      displacement[1][i]=3.*cos(real[1]/20.);
+      displacement[2][i]=2.*sin((real[0]+real[2])/25.);
+   }
+   free(used);
+
+   reg_tps<double> exactTps(dim, LANDMARK_NUMBER);
+   reg_tps<double> approxTps(dim, LANDMARK_NUMBER);
+   if(dim==3)
+   {
+      exactTps.SetPosition(position[0], position[1], position[2],
+            displacement[0], displacement[1], displacement[2]);
+      approxTps.SetPosition(position[0], position[1], position[2],
+            displacement[0], displacement[1], displacement[2]);
+   }
+   else
+   {
+      exactTps.SetPosition(position[0], position[1], displacement[0], displacement[1]);
+      approxTps.SetPosition(position[0], position[1], displacement[0], displacement[1]);
+   }
+   approxTps.SetApproximationError(APPROXIMATION_ERROR);
+   exactTps.FillDeformationField(deformationField);
+   approxTps.FillDeformationField(approxField);
+
+   int result=EXIT_SUCCESS;
+   double *defPtr=static_cast<double *>(deformationField->data);
+   double *approxPtr=static_cast<double *>(approxField->data);
+
+   // The exact field interpolates the landmarks
+   double maxLandmarkError=0.;
+   for(int i=0; i<LANDMARK_NUMBER; ++i)
+   {
+      double error=0.;
+      for(int a=0; a<dim; ++a)
+         error += reg_pow2(defPtr[a*voxelNumber+landmarkIndex[i]] -
+                           position[a][i] - displacement[a][i]);
+      maxLandmarkError=sqrt(error)>maxLandmarkError?sqrt(error):maxLandmarkError;
+   }
+   printf("reg_test_tps: maximal landmark error %g mm\n", maxLandmarkError);
+   if(maxLandmarkError>EPS)
+      result=EXIT_FAILURE;
+
+   // The approximated field is within the bound
+   double maxApproximationError=0.;
+   for(size_t index=0; index<voxelNumber; ++index)
+   {
+      double error=0.;
+      for(int a=0; a<dim; ++a)
+         error += reg_pow2(defPtr[a*voxelNumber+index]-approxPtr[a*voxelNumber+index]);
+      maxApproximationError=sqrt(error)>maxApproximationError?sqrt(error):maxApproximationError;
+   }
+   printf("reg_test_tps: maximal approximation error %g mm\n", maxApproximationError);
+   if(maxApproximationError>APPROXIMATION_ERROR)
+      result=EXIT_FAILURE;
+
+   nifti_image_free(approxField);
+   nifti_image_free(deformationField);
+   nifti_image_free(refImage);
+
+#ifndef NDEBUG
+   if(result==EXIT_SUCCESS)
+      fprintf(stdout, "reg_test_tps ok\n");
+#endif
+
+   return result;
+}